@@ -1,4 +1,4 @@
-#version 420 core
+#version 430 core
 
 layout (early_fragment_tests) in;
 
@@ -24,6 +24,14 @@ void main(void)
 
     index = atomicCounterIncrement(list_counter);
 
+    // The list store is sized from how many fragments previous frames
+    // needed. Anything that doesn't fit is dropped, but still counted so
+    // that the store can grow.
+    if (index >= uint(imageSize(list_buffer)))
+    {
+        discard;
+    }
+
     old_head = imageAtomicExchange(head_pointer_image, ivec2(gl_FragCoord.xy), uint(index));
 
     vec3 L = normalize(light_position - frag_position);
@@ -0,0 +1,37 @@
+#version 430 core
+
+// Weighted blended order independent transparency (McGuire & Bavoil).
+// Draw buffer 0 accumulates additively, draw buffer 1 multiplies
+// together (1 - alpha) of every fragment.
+layout (location = 0) out vec4 accum;
+layout (location = 1) out float reveal;
+
+in vec3 frag_position;
+in vec3 frag_normal;
+in vec4 surface_color;
+
+uniform vec3 light_position = vec3(40.0, 20.0, 100.0);
+
+void main(void)
+{
+    vec3 L = normalize(light_position - frag_position);
+    vec3 V = normalize(-frag_position);
+    vec3 N = normalize(frag_normal);
+    vec3 H = normalize(L + V);
+
+    float NdotL = dot(N, L);
+    float NdotH = dot(N, H);
+
+    vec4 modulator = vec4(surface_color.rgb * abs(NdotL), surface_color.a);
+    vec4 additive_component = mix(surface_color, vec4(1.0), 0.6) * vec4(pow(clamp(NdotH, 0.0, 1.0), 26.0)) * 0.7;
+
+    float alpha = modulator.a;
+    vec3 premultiplied = modulator.rgb * alpha + additive_component.rgb;
+
+    // Favor fragments that are near the viewer and opaque
+    float weight = clamp(pow(min(1.0, alpha * 10.0) + 0.01, 3.0) * 1e8 *
+                         pow(1.0 - gl_FragCoord.z * 0.9, 3.0), 1e-2, 3e3);
+
+    accum = vec4(premultiplied, alpha) * weight;
+    reveal = alpha;
+}
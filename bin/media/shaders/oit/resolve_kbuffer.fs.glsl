@@ -0,0 +1,147 @@
+#version 430 core
+
+/*
+ * OpenGL Programming Guide - Order Independent Transparency Example
+ *
+ * This is the resolve shader for the bounded k-buffer.
+ *
+ * It sorts and blends as resolve_lists.fs.glsl does: (depth, slot) pairs,
+ * a bitonic network for up to FRONT_K fragments and an approximate tail
+ * for any beyond.
+ */
+
+// The number of fragments written to each pixel
+layout (binding = 0, r32ui) uniform uimage2D count_image;
+// Fixed number of fragment slots per pixel
+layout (binding = 1, rgba32ui) uniform uimageBuffer list_buffer;
+
+// This is the output color
+layout (location = 0) out vec4 color;
+
+// The number of fragments that are sorted exactly
+#define FRONT_K 32
+
+// (depth, slot) of the nearest fragments, nearest first once sorted
+uvec2 fragments[FRONT_K];
+
+vec4 tail_color = vec4(0.0);
+float tail_alpha = 0.0;
+float tail_transmittance = 1.0;
+
+void compare_swap(uint a, uint b)
+{
+    if (fragments[a].x > fragments[b].x)
+    {
+        uvec2 t = fragments[a];
+        fragments[a] = fragments[b];
+        fragments[b] = t;
+    }
+}
+
+void sort_network(const uint n)
+{
+    uint i, j, k;
+
+    for (k = 2u; k <= n; k <<= 1)
+    {
+        for (j = k >> 1; j > 0u; j >>= 1)
+        {
+            for (i = 0u; i < n; i++)
+            {
+                uint l = i ^ j;
+
+                if (l > i)
+                {
+                    if ((i & k) == 0u)
+                        compare_swap(i, l);
+                    else
+                        compare_swap(l, i);
+                }
+            }
+        }
+    }
+}
+
+void add_to_tail(uvec4 fragment)
+{
+    vec4 modulator = unpackUnorm4x8(fragment.y);
+    vec4 additive_component = unpackUnorm4x8(fragment.w);
+
+    tail_color += modulator * modulator.a + additive_component;
+    tail_alpha += modulator.a;
+    tail_transmittance *= 1.0 - modulator.a;
+}
+
+void main(void)
+{
+    ivec2 P = ivec2(gl_FragCoord.xy);
+    ivec2 size = imageSize(count_image);
+    uint k = uint(imageSize(list_buffer) / (size.x * size.y));
+    uint count = min(imageLoad(count_image, P).x, k);
+    uint base = uint(P.y * size.x + P.x) * k;
+    uint fragment_count = 0;
+    uint i, slot;
+
+    for (slot = 0; slot < count; slot++)
+    {
+        uvec4 fragment = imageLoad(list_buffer, int(base + slot));
+        uvec2 key = uvec2(fragment.z, base + slot);
+
+        if (fragment_count < FRONT_K)
+        {
+            fragments[fragment_count++] = key;
+            if (fragment_count == FRONT_K)
+                sort_network(FRONT_K);
+        }
+        else if (key.x < fragments[FRONT_K - 1].x)
+        {
+            for (i = 0; i < FRONT_K; i++)
+            {
+                if (key.x < fragments[i].x)
+                {
+                    uvec2 t = fragments[i];
+                    fragments[i] = key;
+                    key = t;
+                }
+            }
+
+            add_to_tail(imageLoad(list_buffer, int(key.y)));
+        }
+        else
+        {
+            add_to_tail(fragment);
+        }
+    }
+
+    if (fragment_count < FRONT_K)
+    {
+        uint n = fragment_count <= 8 ? 8 : fragment_count <= 16 ? 16 : 32;
+
+        for (i = fragment_count; i < n; i++)
+            fragments[i] = uvec2(0xFFFFFFFFu, 0u);
+
+        if (n == 8)
+            sort_network(8);
+        else if (n == 16)
+            sort_network(16);
+        else
+            sort_network(32);
+    }
+
+    vec4 final_color = vec4(0.0);
+    float transmittance = 1.0;
+
+    for (i = 0; i < fragment_count; i++)
+    {
+        uvec4 fragment = imageLoad(list_buffer, int(fragments[i].y));
+        vec4 modulator = unpackUnorm4x8(fragment.y);
+        vec4 additive_component = unpackUnorm4x8(fragment.w);
+
+        final_color += transmittance * (modulator * modulator.a + additive_component);
+        transmittance *= 1.0 - modulator.a;
+    }
+
+    final_color += transmittance * tail_color / max(tail_alpha, 1e-5) * (1.0 - tail_transmittance);
+
+    color = final_color;
+}
@@ -1,9 +1,20 @@
-#version 420 core
+#version 430 core
 
 /*
  * OpenGL Programming Guide - Order Independent Transparency Example
  *
  * This is the resolve shader for order independent transparency.
+ *
+ * Each fragment is gathered as a uvec2 of its depth and its index in the
+ * list buffer, so the sort moves two words rather than four; the colors are
+ * fetched again once the order is known. The nearest FRONT_K fragments are
+ * sorted by a bitonic network sized for the count (8, 16 or 32) and
+ * composited front to back. Once the array is full, nearer fragments are
+ * inserted and push the farthest out into the tail, which is blended
+ * approximately behind the front fragments: the weighted average of its
+ * colors, covering as much as its fragments together would.
+ *
+ * OITBuffer::ResolveReference does the same on the CPU.
  */
 
 // The per-pixel image containing the head pointers
@@ -14,62 +25,136 @@ layout (binding = 1, rgba32ui) uniform uimageBuffer list_buffer;
 // This is the output color
 layout (location = 0) out vec4 color;
 
-// This is the maximum number of overlapping fragments allowed
-#define MAX_FRAGMENTS 40
+// The number of fragments that are sorted exactly
+#define FRONT_K 32
+
+// (depth, index) of the nearest fragments, nearest first once sorted
+uvec2 fragments[FRONT_K];
+
+// Weighted sum of the colors behind the front fragments, the sum of their
+// alphas and the product of their transmittances
+vec4 tail_color = vec4(0.0);
+float tail_alpha = 0.0;
+float tail_transmittance = 1.0;
+
+void compare_swap(uint a, uint b)
+{
+    if (fragments[a].x > fragments[b].x)
+    {
+        uvec2 t = fragments[a];
+        fragments[a] = fragments[b];
+        fragments[b] = t;
+    }
+}
+
+// Bitonic sorting network over the first n (a power of two) fragments.
+// Called with constant n, so the loops unroll to a fixed set of swaps.
+void sort_network(const uint n)
+{
+    uint i, j, k;
+
+    for (k = 2u; k <= n; k <<= 1)
+    {
+        for (j = k >> 1; j > 0u; j >>= 1)
+        {
+            for (i = 0u; i < n; i++)
+            {
+                uint l = i ^ j;
+
+                if (l > i)
+                {
+                    if ((i & k) == 0u)
+                        compare_swap(i, l);
+                    else
+                        compare_swap(l, i);
+                }
+            }
+        }
+    }
+}
+
+void add_to_tail(uvec4 fragment)
+{
+    vec4 modulator = unpackUnorm4x8(fragment.y);
+    vec4 additive_component = unpackUnorm4x8(fragment.w);
 
-// Temporary array used for sorting fragments
-uvec4 fragment_list[MAX_FRAGMENTS];
+    tail_color += modulator * modulator.a + additive_component;
+    tail_alpha += modulator.a;
+    tail_transmittance *= 1.0 - modulator.a;
+}
 
 void main(void)
 {
     uint current_index;
     uint fragment_count = 0;
+    uint i;
 
     current_index = imageLoad(head_pointer_image, ivec2(gl_FragCoord).xy).x;
 
-    while (current_index != 0 && fragment_count < MAX_FRAGMENTS)
+    while (current_index != 0)
     {
         uvec4 fragment = imageLoad(list_buffer, int(current_index));
-        fragment_list[fragment_count] = fragment;
-        current_index = fragment.x;
-        fragment_count++;
-    }
-
-    uint i, j;
+        uvec2 key = uvec2(fragment.z, current_index);
 
-    if (fragment_count > 1)
-    {
-
-        for (i = 0; i < fragment_count - 1; i++)
+        if (fragment_count < FRONT_K)
         {
-            for (j = i + 1; j < fragment_count; j++)
+            fragments[fragment_count++] = key;
+            if (fragment_count == FRONT_K)
+                sort_network(FRONT_K);
+        }
+        else if (key.x < fragments[FRONT_K - 1].x)
+        {
+            // Insert in order; the farthest falls off the end
+            for (i = 0; i < FRONT_K; i++)
             {
-                uvec4 fragment1 = fragment_list[i];
-                uvec4 fragment2 = fragment_list[j];
-
-                float depth1 = uintBitsToFloat(fragment1.z);
-                float depth2 = uintBitsToFloat(fragment2.z);
-
-                if (depth1 < depth2)
+                if (key.x < fragments[i].x)
                 {
-                    fragment_list[i] = fragment2;
-                    fragment_list[j] = fragment1;
+                    uvec2 t = fragments[i];
+                    fragments[i] = key;
+                    key = t;
                 }
             }
+
+            add_to_tail(imageLoad(list_buffer, int(key.y)));
+        }
+        else
+        {
+            add_to_tail(fragment);
         }
 
+        current_index = fragment.x;
+    }
+
+    // Pad to the next network size with keys that sort last
+    if (fragment_count < FRONT_K)
+    {
+        uint n = fragment_count <= 8 ? 8 : fragment_count <= 16 ? 16 : 32;
+
+        for (i = fragment_count; i < n; i++)
+            fragments[i] = uvec2(0xFFFFFFFFu, 0u);
+
+        if (n == 8)
+            sort_network(8);
+        else if (n == 16)
+            sort_network(16);
+        else
+            sort_network(32);
     }
 
     vec4 final_color = vec4(0.0);
+    float transmittance = 1.0;
 
     for (i = 0; i < fragment_count; i++)
     {
-        vec4 modulator = unpackUnorm4x8(fragment_list[i].y);
-        vec4 additive_component = unpackUnorm4x8(fragment_list[i].w);
+        uvec4 fragment = imageLoad(list_buffer, int(fragments[i].y));
+        vec4 modulator = unpackUnorm4x8(fragment.y);
+        vec4 additive_component = unpackUnorm4x8(fragment.w);
 
-        final_color = mix(final_color, modulator, modulator.a) + additive_component;
+        final_color += transmittance * (modulator * modulator.a + additive_component);
+        transmittance *= 1.0 - modulator.a;
     }
 
+    final_color += transmittance * tail_color / max(tail_alpha, 1e-5) * (1.0 - tail_transmittance);
+
     color = final_color;
-    // color = vec4(float(fragment_count) / float(MAX_FRAGMENTS));
 }
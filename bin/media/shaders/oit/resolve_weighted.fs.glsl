@@ -0,0 +1,24 @@
+#version 430 core
+
+/*
+ * OpenGL Programming Guide - Order Independent Transparency Example
+ *
+ * This is the resolve shader for weighted blended transparency.
+ */
+
+layout (binding = 0) uniform sampler2D accum_texture;
+layout (binding = 1) uniform sampler2D reveal_texture;
+
+// This is the output color
+layout (location = 0) out vec4 color;
+
+void main(void)
+{
+    ivec2 P = ivec2(gl_FragCoord.xy);
+    vec4 accum = texelFetch(accum_texture, P, 0);
+    float reveal = texelFetch(reveal_texture, P, 0).r;
+
+    // Weighted average of the fragments' colors, covering as much of the
+    // (black) background as the fragments together hide
+    color = vec4(accum.rgb / max(accum.a, 1e-5) * (1.0 - reveal), 1.0);
+}
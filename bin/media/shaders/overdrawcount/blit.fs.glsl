@@ -5,12 +5,17 @@
  */
 
 // Buffer containing the rendered image
-layout (binding = 0, r32ui) uniform uimage2D output_image;
+layout (binding = 0, r32ui) readonly uniform uimage2D output_image;
+
+// Heat ramp indexed by count
+layout (binding = 0) uniform samplerBuffer palette;
 
 // This is the output color
 layout (location = 0) out vec4 color;
 
 void main(void)
 {
-    color = vec4(imageLoad(output_image, ivec2(gl_FragCoord.xy)).xxxx) / 32.0;
+    uint count = imageLoad(output_image, ivec2(gl_FragCoord.xy)).x;
+
+    color = texelFetch(palette, int(min(count, 255u)));
 }
@@ -1,7 +1,13 @@
-#version 330
+#version 430 core
 
-uniform sampler2DShadow depth_texture;
-uniform vec3 light_position;
+// One layer per cascade. The sizes of these arrays must match
+// CASCADE_COUNT in the application.
+uniform sampler2DArrayShadow depth_texture;
+uniform mat4 shadow_matrix[4];
+uniform float cascade_far[4];
+
+// Direction towards the light, in eye space
+uniform vec3 light_direction;
 
 uniform vec3 material_ambient;
 uniform vec3 material_diffuse;
@@ -12,7 +18,6 @@ layout (location = 0) out vec4 color;
 
 in VS_FS_INTERFACE
 {
-    vec4 shadow_coord;
     vec3 world_coord;
     vec3 eye_coord;
     vec3 normal;
@@ -20,15 +25,27 @@ in VS_FS_INTERFACE
 
 void main(void)
 {
-    vec3 N = fragment.normal;
-    vec3 L = normalize(light_position - fragment.world_coord);
+    vec3 N = normalize(fragment.normal);
+    vec3 L = light_direction;
     float LdotN = dot(N, L);
     vec3 R = reflect(-L, N);
 
     float diffuse = max(LdotN, 0.0);
-    float specular = max(pow(dot(normalize(-fragment.eye_coord), R), material_specular_power), 0.0);
+    float specular = max(pow(max(dot(normalize(-fragment.eye_coord), R), 0.0), material_specular_power), 0.0);
+
+    // Pick the nearest cascade that covers the fragment
+    float depth = -fragment.eye_coord.z;
+    int cascade = 0;
+
+    for (int i = 0; i < 3; i++)
+    {
+        if (depth > cascade_far[i])
+            cascade = i + 1;
+    }
 
-    float f = textureProj(depth_texture, fragment.shadow_coord);
+    // Cascades use orthographic projections, so there is no divide by w
+    vec4 shadow_coord = shadow_matrix[cascade] * vec4(fragment.world_coord, 1.0);
+    float f = texture(depth_texture, vec4(shadow_coord.xy, float(cascade), shadow_coord.z));
 
     color = vec4(material_ambient + f * (material_diffuse * diffuse + material_specular * specular), 1.0);
 }
@@ -1,17 +1,16 @@
-#version 330
+#version 430 core
 
-uniform mat4 model_matrix;
 uniform mat4 view_matrix;
 uniform mat4 projection_matrix;
 
-uniform mat4 shadow_matrix;
-
 layout (location = 0) in vec4 position;
 layout (location = 1) in vec3 normal;
 
+// Per-instance transform (locations 3 to 6)
+layout (location = 3) in mat4 model_matrix;
+
 out VS_FS_INTERFACE
 {
-    vec4 shadow_coord;
     vec3 world_coord;
     vec3 eye_coord;
     vec3 normal;
@@ -25,7 +24,6 @@ void main(void)
 
     vertex.world_coord = world_pos.xyz;
     vertex.eye_coord = eye_pos.xyz;
-    vertex.shadow_coord = shadow_matrix * world_pos;
     vertex.normal = mat3(view_matrix * model_matrix) * normal;
 
     gl_Position = clip_pos;
@@ -0,0 +1,28 @@
+#version 430 core
+
+// One invocation per cascade. This must match CASCADE_COUNT in the
+// application.
+layout (triangles, invocations = 4) in;
+layout (triangle_strip, max_vertices = 3) out;
+
+uniform mat4 cascade_matrix[4];
+
+in VS_GS_INTERFACE
+{
+    flat uint cascade_mask;
+} vertex_in[];
+
+void main(void)
+{
+    // Skip the cascades that the instance was culled from
+    if ((vertex_in[0].cascade_mask & (1u << gl_InvocationID)) == 0u)
+        return;
+
+    for (int i = 0; i < 3; i++)
+    {
+        gl_Layer = gl_InvocationID;
+        gl_Position = cascade_matrix[gl_InvocationID] * gl_in[i].gl_Position;
+        EmitVertex();
+    }
+    EndPrimitive();
+}
@@ -1,10 +1,19 @@
-#version 330
-
-uniform mat4 model_view_projection_matrix;
+#version 430 core
 
 layout (location = 0) in vec4 position;
 
+// Per-instance transform (locations 3 to 6) and the set of cascades that
+// the instance may cast into, one bit per cascade
+layout (location = 3) in mat4 model_matrix;
+layout (location = 7) in uint cascade_mask;
+
+out VS_GS_INTERFACE
+{
+    flat uint cascade_mask;
+} vertex;
+
 void main(void)
 {
-    gl_Position = model_view_projection_matrix * position;
+    gl_Position = model_matrix * position;
+    vertex.cascade_mask = cascade_mask;
 }
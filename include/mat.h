@@ -10,6 +10,8 @@
 #include <iostream>
 
 #include "vec.h"
+#include "vmath.h"
+#include "vmathkernels.h"
 
 //----------------------------------------------------------------------------
 //
@@ -375,9 +377,14 @@ mat3 transpose( const mat3& A ) {
 //  mat4.h - 4D square matrix
 //
 
+//  Rows are kept 16-byte aligned, and the products, transpose and inverse
+//  use the SIMD kernels in vmathkernels.h, which see the rows as columns:
+//  the bytes of a mat4 are the vmath::mat4 layout of its transpose.
+//
+
 class mat4 {
 
-    vec4  _m[4];
+    alignas(16) vec4  _m[4];
 
    public:
     //
@@ -448,15 +455,10 @@ class mat4 {
 	{ return m * s; }
 	
     mat4 operator * ( const mat4& m ) const {
-	mat4  a( 0.0 );
+	mat4  a;
 
-	for ( int i = 0; i < 4; ++i ) {
-	    for ( int j = 0; j < 4; ++j ) {
-		for ( int k = 0; k < 4; ++k ) {
-		    a[i][j] += _m[i][k] * m[k][j];
-		}
-	    }
-	}
+	// (this * m) transposed is transpose(m) * transpose(this)
+	mat4_multiply( a, m, *this );
 
 	return a;
     }
@@ -481,17 +483,7 @@ class mat4 {
     }
 
     mat4& operator *= ( const mat4& m ) {
-	mat4  a( 0.0 );
-
-	for ( int i = 0; i < 4; ++i ) {
-	    for ( int j = 0; j < 4; ++j ) {
-		for ( int k = 0; k < 4; ++k ) {
-		    a[i][j] += _m[i][k] * m[k][j];
-		}
-	    }
-	}
-
-	*this = a;
+	mat4_multiply( *this, m, *this );
         return *this;
     }
 
@@ -513,11 +505,11 @@ class mat4 {
     //
 
     vec4 operator * ( const vec4& v ) const {  // m * v
-	return vec4( _m[0][0]*v.x + _m[0][1]*v.y + _m[0][2]*v.z + _m[0][3]*v.w,
-		     _m[1][0]*v.x + _m[1][1]*v.y + _m[1][2]*v.z + _m[1][3]*v.w,
-		     _m[2][0]*v.x + _m[2][1]*v.y + _m[2][2]*v.z + _m[2][3]*v.w,
-		     _m[3][0]*v.x + _m[3][1]*v.y + _m[3][2]*v.z + _m[3][3]*v.w
-	    );
+	vec4  r;
+
+	mat4_transform_transposed( r, *this, v );
+
+	return r;
     }
 	
     //
@@ -561,10 +553,21 @@ mat4 matrixCompMult( const mat4& A, const mat4& B ) {
 
 inline
 mat4 transpose( const mat4& A ) {
-    return mat4( A[0][0], A[1][0], A[2][0], A[3][0],
-		 A[0][1], A[1][1], A[2][1], A[3][1],
-		 A[0][2], A[1][2], A[2][2], A[3][2],
-		 A[0][3], A[1][3], A[2][3], A[3][3] );
+    mat4  T;
+
+    mat4_transpose( T, A );
+
+    return T;
+}
+
+//  A singular matrix gives the identity
+inline
+mat4 inverse( const mat4& A ) {
+    mat4  I;
+
+    mat4_inverse( I, A );
+
+    return I;
 }
 
 //////////////////////////////////////////////////////////////////////////////
@@ -761,6 +764,56 @@ mat4 LookAt( const vec4& eye, const vec4& at, const vec4& up )
     return c * Translate( -eye );
 }
 
+//----------------------------------------------------------------------------
+//
+//  Mixing with vmath
+//
+//    The two mat4s have the same size and alignment, and differ only in
+//    storing rows or columns. Converting is a transpose in registers, and a
+//    product of one of each reads both in place, at the cost of a plain
+//    product. The result has the type of the left-hand side.
+//
+
+static_assert( sizeof(mat4) == sizeof(vmath::mat4) && alignof(mat4) == alignof(vmath::mat4),
+	       "mat4 and vmath::mat4 must share a layout" );
+
+inline
+vmath::mat4 to_vmath( const mat4& A ) {
+    vmath::mat4  m;
+
+    mat4_transpose( m, A );
+
+    return m;
+}
+
+inline
+mat4 to_angel( const vmath::mat4& m ) {
+    mat4  A;
+
+    mat4_transpose( A, m );
+
+    return A;
+}
+
+inline
+vmath::mat4 operator * ( const vmath::mat4& m, const mat4& A ) {
+    vmath::mat4  r;
+
+    mat4_multiply_transposed_b( r, m, A );
+
+    return r;
+}
+
+inline
+mat4 operator * ( const mat4& A, const vmath::mat4& m ) {
+    mat4  R;
+
+    // (A * m) transposed is transpose(m) * transpose(A)
+    mat4_multiply_transposed_a( R, m, A );
+
+    return R;
+}
+
 //----------------------------------------------------------------------------
 
 #endif // __MAT_H__
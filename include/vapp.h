@@ -2,12 +2,48 @@
 #define __VAPP_H__
 
 #include "vgl.h"
+#include "vjobs.h"
+
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
+// Frame times are kept for this many frames for the running statistics
+#define VAPP_FRAME_HISTORY  128
+
+struct FrameStats
+{
+    unsigned int    frames;             // Frames displayed so far
+    unsigned int    updates;            // Update calls made by the last frame
+    unsigned int    dropped_updates;    // Fixed steps skipped to catch up after stalls, in total
+    double          frame_time;         // Seconds from the start of the previous frame to this one
+    double          cpu_time;           // Seconds the last frame spent in Update and Display
+    double          average;            // Mean, shortest and longest frame times and their
+    double          minimum;            // standard deviation over the last VAPP_FRAME_HISTORY
+    double          maximum;            // frames
+    double          deviation;
+    double          fps;                // 1 / average
+};
 
 class VermilionApplication
 {
 protected:
-    inline VermilionApplication(void) {}
-    virtual ~VermilionApplication(void) {}
+    inline VermilionApplication(void)
+        : m_pWindow(0),
+          m_clockStart(0.0),
+          m_fixedStep(0.0),
+          m_maxSteps(5),
+          m_accumulator(0.0),
+          m_alpha(1.0f),
+          m_lastFrameStart(-1.0),
+          m_frameLimit(0.0),
+          m_spinTime(0.0),
+          m_frameDeadline(0.0)
+    {
+        memset(&m_frameStats, 0, sizeof(m_frameStats));
+    }
 
     static VermilionApplication * s_app;
     GLFWwindow* m_pWindow;
@@ -23,6 +59,49 @@ protected:
     static void char_callback(GLFWwindow* window, unsigned int codepoint);
     unsigned int app_time();
 
+    // Seconds since Initialize, from a high resolution monotonic clock
+    double app_seconds();
+
+    // Runs Update every 'step' seconds of real time, up to 'max_steps' times
+    // a frame; anything beyond that is dropped rather than letting a slow
+    // frame cause slower ones. Display then draws the state between the last
+    // two steps given by GetInterpolationAlpha. A step of zero (the default)
+    // calls Update once a frame with the time since the previous one.
+    void SetFixedTimestep(double step, unsigned int max_steps = 5);
+
+    // Vertical blanks to wait for in glfwSwapBuffers; zero turns vsync off
+    void SetSwapInterval(int interval);
+
+    // Caps the frame rate on the CPU. Each frame sleeps until 'spin' seconds
+    // before its deadline and then spins, since sleeps overshoot. Zero fps
+    // turns the limiter off.
+    void SetFrameLimit(double fps, double spin = 0.002);
+
+    // How far between the last two fixed steps the current time is, from 0
+    // to 1. Always 1 without a fixed step.
+    float GetInterpolationAlpha(void) const { return m_alpha; }
+
+    const FrameStats& GetFrameStats(void) const { return m_frameStats; }
+
+    // One pass of the main loop: fixed steps, Display, the frame limiter
+    // and the statistics
+    void RunFrame(void);
+
+    double          m_clockStart;
+    double          m_fixedStep;
+    unsigned int    m_maxSteps;
+    double          m_accumulator;
+    float           m_alpha;
+    double          m_lastFrameStart;
+    double          m_frameLimit;
+    double          m_spinTime;
+    double          m_frameDeadline;
+    double          m_frameHistory[VAPP_FRAME_HISTORY];
+    FrameStats      m_frameStats;
+
+    // Started by Initialize with a thread per core
+    JobSystem       m_jobs;
+
 #ifdef _DEBUG
     static void APIENTRY DebugOutputCallback(GLenum source,
                                              GLenum type,
@@ -34,10 +113,19 @@ protected:
 #endif
 
 public:
+    virtual ~VermilionApplication(void) {}
+
     void MainLoop(void);
 
+    // For fanning CPU work out over all cores, from the main thread or from
+    // inside jobs
+    JobSystem& GetJobSystem(void) { return m_jobs; }
+
     virtual void Initialize(const char * title = 0);
 
+    // Advances the simulation by 'dt' seconds. See SetFixedTimestep.
+    virtual void Update(double /* dt */) { /* NOTHING */ }
+
     virtual void Display(bool auto_redraw = true)
     {
         glfwSwapBuffers(m_pWindow);
@@ -115,7 +203,7 @@ void VermilionApplication::MainLoop(void)                   \
 {                                                           \
     do                                                      \
     {                                                       \
-        Display();                                          \
+        RunFrame();                                         \
         glfwPollEvents();                                   \
     } while (!glfwWindowShouldClose(m_pWindow));            \
 }                                                           \
@@ -127,6 +215,7 @@ MAIN_DECL                                                   \
     app->Initialize(title);                                 \
     app->MainLoop();                                        \
     app->Finalize();                                        \
+    delete app;                                             \
                                                             \
     return 0;                                               \
 }                                                           \
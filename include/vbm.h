@@ -16,6 +16,50 @@
 #define VBM_FLAG_HAS_INDICES        0x00000002
 #define VBM_FLAG_HAS_FRAMES         0x00000004
 #define VBM_FLAG_HAS_MATERIALS      0x00000008
+#define VBM_FLAG_HAS_LODS           0x00000010
+#define VBM_FLAG_HAS_BOUNDS         0x00000020
+#define VBM_FLAG_HAS_SKELETON       0x00000040
+#define VBM_FLAG_HAS_COMPRESSION    0x00000080
+
+#define VBM_MAGIC_CURRENT           0x314d4253
+
+// Flags for VBObject::LoadFromVBM
+#define VBM_LOAD_KEEP_DATA          0x00000001  // Keep a copy of the vertex and index data in memory
+#define VBM_LOAD_CPU_ONLY           0x00000002  // Keep the data in memory only; create no OpenGL objects
+#define VBM_LOAD_PACK_VERTICES      0x00000004  // Upload normals as 10:10:10:2 SNORM and texture coordinates ("texcoord" or "map1") as halves
+
+typedef struct VBM_VEC4F_t
+{
+    float x;
+    float y;
+    float z;
+    float w;
+} VBM_VEC4F;
+
+typedef struct VBM_VEC3F_t
+{
+    float x;
+    float y;
+    float z;
+} VBM_VEC3F;
+
+typedef struct VBM_VEC2F_t
+{
+    float x;
+    float y;
+} VBM_VEC2F;
+
+// Axis-aligned bounding box and bounding sphere of a model or of one of its
+// frames. The header carries bounds for the whole file; when
+// VBM_FLAG_HAS_BOUNDS is set, one of these per frame follows the level of
+// detail headers.
+typedef struct VBM_BOUNDS_t
+{
+    VBM_VEC3F min;              /// Minimum corner of the bounding box
+    VBM_VEC3F max;              /// Maximum corner of the bounding box
+    VBM_VEC3F center;           /// Center of the bounding sphere
+    float radius;               /// Radius of the bounding sphere
+} VBM_BOUNDS;
 
 typedef struct VBM_HEADER_t
 {
@@ -30,6 +74,8 @@ typedef struct VBM_HEADER_t
     unsigned int index_type;
     unsigned int num_materials;
     unsigned int flags;
+    unsigned int num_lods;
+    VBM_BOUNDS bounds;
 } VBM_HEADER;
 
 typedef struct VBM_HEADER_OLD_t
@@ -62,33 +108,76 @@ typedef struct VBM_FRAME_HEADER_t
     unsigned int flags;
 } VBM_FRAME_HEADER;
 
-typedef struct VBM_RENDER_CHUNK_t
+// One of these follows the frame headers for each level of detail when
+// VBM_FLAG_HAS_LODS is set. Levels are stored finest first. 'error' is the
+// geometric error introduced by the level, relative to the bounding radius
+// of the model, so that it can be converted to pixels given the projected
+// size of the object.
+typedef struct VBM_LOD_HEADER_t
 {
-    unsigned int material_index;
-    unsigned int first;
-    unsigned int count;
-} VBM_RENDER_CHUNK;
+    unsigned int frame;
+    float error;
+} VBM_LOD_HEADER;
+
+// Skeletons. When VBM_FLAG_HAS_SKELETON is set, a VBM_SKELETON_HEADER
+// follows the bounds, then 'num_joints' joints and then each clip: its
+// header followed by 'num_keys' * 'num_joints' poses (every joint of the
+// first key, then every joint of the second and so on). Joints are stored
+// parents first; roots have a parent of -1. Skin weights are ordinary
+// attributes named "joints" and "weights" of four components each, the
+// joint indices being stored as floats.
+typedef struct VBM_SKELETON_HEADER_t
+{
+    unsigned int num_joints;
+    unsigned int num_clips;
+} VBM_SKELETON_HEADER;
 
-typedef struct VBM_VEC4F_t
+// Transform of a joint relative to its parent
+typedef struct VBM_JOINT_POSE_t
 {
-    float x;
-    float y;
-    float z;
-    float w;
-} VBM_VEC4F;
+    VBM_VEC4F rotation;         /// Unit quaternion (x, y, z, w)
+    VBM_VEC3F translation;
+    VBM_VEC3F scale;
+} VBM_JOINT_POSE;
 
-typedef struct VBM_VEC3F_t
+typedef struct VBM_JOINT_t
 {
-    float x;
-    float y;
-    float z;
-} VBM_VEC3F;
+    char name[32];
+    int parent;                 /// Index of the parent joint, or -1
+    VBM_JOINT_POSE bind_pose;   /// Pose relative to the parent when bound to the mesh
+    float inverse_bind[16];     /// Model to joint space at bind time, column major
+} VBM_JOINT;
+
+// Keys are evenly spaced: key k is at k * duration / (num_keys - 1) seconds
+typedef struct VBM_CLIP_HEADER_t
+{
+    char name[32];
+    unsigned int num_keys;
+    float duration;             /// In seconds
+} VBM_CLIP_HEADER;
+
+// Compressed files. When VBM_FLAG_HAS_COMPRESSION is set, the vertex data
+// of each attribute and then the indices are stored as streams, each a
+// header followed by 'size' bytes of data, padded to a multiple of four.
+// Each stream has its own codec (see vcodec.h). Decoded, the streams are
+// exactly the data of an uncompressed file; the materials follow them as
+// usual.
+#define VBM_CODEC_NONE              0   // Stored as it is
+#define VBM_CODEC_DELTA             1   // Vertex data: deltas in byte planes, packed or entropy coded
+#define VBM_CODEC_FAN               2   // Indices: a triangle fan of deltas in byte planes, packed or entropy coded
+
+typedef struct VBM_STREAM_HEADER_t
+{
+    unsigned int codec;
+    unsigned int size;          /// Bytes of data, not counting the padding
+} VBM_STREAM_HEADER;
 
-typedef struct VBM_VEC2F_t
+typedef struct VBM_RENDER_CHUNK_t
 {
-    float x;
-    float y;
-} VBM_VEC2F;
+    unsigned int material_index;
+    unsigned int first;
+    unsigned int count;
+} VBM_RENDER_CHUNK;
 
 typedef struct VBM_MATERIAL_t
 {
@@ -115,15 +204,45 @@ public:
     VBObject(void);
     virtual ~VBObject(void);
 
-    bool LoadFromVBM(const char * filename, int vertexIndex, int normalIndex, int texCoord0Index);
+    bool LoadFromVBM(const char * filename, int vertexIndex, int normalIndex, int texCoord0Index, unsigned int flags = 0);
     void Render(unsigned int frame_index = 0, unsigned int instances = 0);
+    void RenderIndirect(GLuint indirect_buffer, GLintptr offset = 0);
     bool Free(void);
 
-    unsigned int GetVertexCount(unsigned int frame = 0)
+    unsigned int GetVertexCount(unsigned int frame = 0) const
     {
         return frame < m_header.num_frames ? m_frame[frame].count : 0;
     }
 
+    unsigned int GetFirstVertex(unsigned int frame = 0) const
+    {
+        return frame < m_header.num_frames ? m_frame[frame].first : 0;
+    }
+
+    // Number of vertices in each attribute, across all frames
+    unsigned int GetAttributeVertexCount(void) const
+    {
+        return m_header.num_vertices;
+    }
+
+    bool IsIndexed(void) const
+    {
+        return m_header.num_indices != 0;
+    }
+
+    // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT, as the index buffer holds them
+    GLenum GetIndexType(void) const
+    {
+        return m_header.index_type == GL_UNSIGNED_SHORT ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    }
+
+    // Fills in the indirect draw command that is equivalent to
+    // Render(frame_index, instances). Indexed objects use all five words of
+    // a DrawElementsIndirectCommand, others the first four words of a
+    // DrawArraysIndirectCommand. The instance count is the second word in
+    // both cases. The first index counts indices of GetIndexType, not bytes.
+    void GetDrawCommand(unsigned int frame_index, unsigned int instances, GLuint command[5]) const;
+
     unsigned int GetAttributeCount(void) const
     {
         return m_header.num_attribs;
@@ -134,11 +253,82 @@ public:
         return index < m_header.num_attribs ? m_attrib[index].name : 0;
     }
 
+    unsigned int GetAttributeComponents(unsigned int index) const
+    {
+        return index < m_header.num_attribs ? m_attrib[index].components : 0;
+    }
+
+    // Index of the attribute called 'name', or -1
+    int FindAttribute(const char * name) const;
+
+    // The vertex data of attribute 'index' and the indices (widened to
+    // 32 bits) as loaded. Only available if the object was loaded with
+    // VBM_LOAD_KEEP_DATA or VBM_LOAD_CPU_ONLY; NULL otherwise.
+    const float * GetAttributeData(unsigned int index) const;
+
+    const GLuint * GetIndexData(void) const
+    {
+        return m_index_data;
+    }
+
     unsigned int GetFrameCount(void) const
     {
         return m_header.num_frames;
     }
 
+    const VBM_BOUNDS& GetBounds(void) const
+    {
+        return m_header.bounds;
+    }
+
+    const VBM_BOUNDS& GetFrameBounds(unsigned int frame) const
+    {
+        return frame < m_header.num_frames ? m_bounds[frame] : m_header.bounds;
+    }
+
+    // Bounding sphere packed as (center, radius)
+    const vmath::vec4 GetBoundingSphere(unsigned int frame = 0) const
+    {
+        const VBM_BOUNDS& b = GetFrameBounds(frame);
+        return vmath::vec4(b.center.x, b.center.y, b.center.z, b.radius);
+    }
+
+    unsigned int GetLODCount(void) const
+    {
+        return m_header.num_lods;
+    }
+
+    // Returns the frame index of the coarsest level of detail whose error,
+    // projected onto an object 'screen_size' pixels across, does not exceed
+    // 'max_pixel_error'. Returns frame 0 for models without levels of detail.
+    unsigned int SelectLOD(float screen_size, float max_pixel_error = 1.0f) const;
+
+    unsigned int GetJointCount(void) const
+    {
+        return m_skeleton.num_joints;
+    }
+
+    const VBM_JOINT * GetJoints(void) const
+    {
+        return m_joints;
+    }
+
+    unsigned int GetClipCount(void) const
+    {
+        return m_skeleton.num_clips;
+    }
+
+    const VBM_CLIP_HEADER& GetClip(unsigned int clip) const
+    {
+        return m_clips[clip];
+    }
+
+    // The poses of every key of 'clip', key by key
+    const VBM_JOINT_POSE * GetClipKeys(unsigned int clip) const
+    {
+        return clip < m_skeleton.num_clips ? m_clip_keys + m_clip_first_key[clip] : 0;
+    }
+
     unsigned int GetMaterialCount(void) const
     {
         return m_header.num_materials;
@@ -202,6 +392,13 @@ protected:
     VBM_HEADER m_header;
     VBM_ATTRIB_HEADER * m_attrib;
     VBM_FRAME_HEADER * m_frame;
+    VBM_LOD_HEADER * m_lod;
+    VBM_BOUNDS * m_bounds;
+    VBM_SKELETON_HEADER m_skeleton;
+    VBM_JOINT * m_joints;
+    VBM_CLIP_HEADER * m_clips;
+    VBM_JOINT_POSE * m_clip_keys;
+    unsigned int * m_clip_first_key;
     VBM_MATERIAL * m_material;
     VBM_RENDER_CHUNK * m_chunks;
 
@@ -213,6 +410,13 @@ protected:
     };
 
     material_texture * m_material_textures;
+
+    float * m_vertex_data;
+    GLuint * m_index_data;
+
+    static GLenum GetPackedType(const VBM_ATTRIB_HEADER& attrib);
+    unsigned char * DecodeStreams(const unsigned char * in, const unsigned char * end) const;
+    static void CalculateBounds(const float * positions, unsigned int components, const unsigned int * indices, unsigned int first, unsigned int count, VBM_BOUNDS& bounds);
 };
 #endif /* VBM_FILE_TYPES_ONLY */
 
@@ -0,0 +1,115 @@
+#ifndef __VCLUSTER_H__
+#define __VCLUSTER_H__
+
+#include "vgl.h"
+#include "vmath.h"
+
+#include <vector>
+
+class JobSystem;
+
+// Clustered forward shading. The view frustum is divided into a grid of
+// froxels: screen tiles in x and y, exponentially spaced slices in depth.
+// Every frame each froxel gets the list of point lights whose spheres of
+// influence touch it, so fragment shaders only visit the lights that can
+// reach them. Lights can be assigned by a compute shader or, as a reference
+// and fallback, on the CPU.
+//
+// Bind makes the results available to shaders as:
+//
+// layout (std140, binding = 0) uniform CLUSTER_PARAMS
+// {
+//     uvec4 cluster_grid;      // Froxels in x, y and z
+//     vec4  cluster_depth;     // Slice = log(view depth) * x + y; near, far
+//     vec4  cluster_tile;      // 1 / tile size in pixels
+// };
+// layout (std430, binding = 0) buffer CLUSTER_LIGHTS { vec4 lights[]; };       // View-space position and radius, color
+// layout (std430, binding = 1) buffer CLUSTER_RANGES { uvec2 clusters[]; };    // First index and count
+// layout (std430, binding = 2) buffer CLUSTER_INDICES { uint light_indices[]; };
+//
+// Froxel (x, y, z) is element x + (y + z * grid_y) * grid_x of clusters.
+
+#define CLUSTER_MAX_LIGHTS  256     // Lights per froxel beyond this are dropped
+
+struct ClusterLight
+{
+    vmath::vec4 position;           // World-space position, radius in w
+    vmath::vec4 color;
+};
+
+struct ClusterStats
+{
+    unsigned int    lights;                 // Lights submitted
+    unsigned int    light_indices;          // Total length of all of the lists
+    unsigned int    max_cluster_lights;     // Longest list
+    float           average_cluster_lights; // Mean list length over all froxels
+    unsigned int    overflowed_clusters;    // Froxels that hit CLUSTER_MAX_LIGHTS
+    float           assign_time;            // Microseconds spent assigning on the CPU
+};
+
+class ClusteredLighting
+{
+public:
+    ClusteredLighting(void);
+    virtual ~ClusteredLighting(void);
+
+    bool Initialize(unsigned int grid_x = 16, unsigned int grid_y = 9, unsigned int grid_z = 24,
+                    unsigned int max_lights = 4096, unsigned int max_light_indices = 0);
+    void Free(void);
+
+    // Builds the froxel bounds. The projection must be a perspective one
+    // with near and far planes at view-space distances n and f. Call again
+    // whenever the projection or the size of the viewport changes.
+    void SetProjection(const vmath::mat4& projection, float n, float f, GLsizei width, GLsizei height);
+
+    void SetLights(const ClusterLight * lights, unsigned int count);
+
+    // Moves the lights into view space and assigns them to froxels, either
+    // with the compute shader or with AssignReference on 'jobs'. The
+    // statistics other than 'lights' are only gathered on the CPU path.
+    void Update(JobSystem& jobs, const vmath::mat4& view_matrix, bool use_cpu = false);
+
+    void Bind(void);
+
+    const ClusterStats& GetStats(void) const { return m_stats; }
+
+    // Assigns view-space lights (position and radius in x, y, z and r) to
+    // froxels given by their view-space bounds. Writes each froxel's first
+    // index and count to 'ranges' and the concatenated lists, each in
+    // increasing light order, to 'indices'. Returns the number of indices
+    // written, at most 'max_indices'. Slices are split across 'jobs'.
+    static unsigned int AssignReference(JobSystem& jobs, const float * x, const float * y, const float * z, const float * r,
+                                        unsigned int light_count,
+                                        const vmath::vec4 * bounds_min, const vmath::vec4 * bounds_max,
+                                        unsigned int grid_x, unsigned int grid_y, unsigned int grid_z,
+                                        GLuint * ranges, GLuint * indices, unsigned int max_indices,
+                                        ClusterStats * stats = 0);
+
+protected:
+    unsigned int    m_grid[3];
+    unsigned int    m_max_lights;
+    unsigned int    m_max_light_indices;
+
+    GLuint          m_program;
+    GLint           m_light_count_loc;
+    GLint           m_max_indices_loc;
+
+    GLuint          m_params_buffer;
+    GLuint          m_light_buffer;
+    GLuint          m_range_buffer;
+    GLuint          m_index_buffer;
+    GLuint          m_bounds_buffer;
+    GLuint          m_counter_buffer;
+
+    // Lights in world space, and in view space split into components
+    std::vector<ClusterLight>   m_lights;
+    std::vector<float>          m_view_lights;
+
+    // Froxel bounds in view space
+    std::vector<vmath::vec4>    m_bounds_min;
+    std::vector<vmath::vec4>    m_bounds_max;
+
+    ClusterStats    m_stats;
+};
+
+#endif /* __VCLUSTER_H__ */
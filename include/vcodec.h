@@ -0,0 +1,45 @@
+#ifndef __VCODEC_H__
+#define __VCODEC_H__
+
+#include <stddef.h>
+#include <vector>
+
+// Lossless compression of the vertex and index streams of VBM files.
+//
+// Both work on 32-bit values. Vertices are replaced by their difference
+// from the previous vertex, component by component and taken as integers,
+// so that neighbouring floats with the same exponent give small numbers.
+// Indices are coded a triangle at a time as a fan: the first corner
+// relative to the first corner of the previous triangle, the other two
+// relative to the first. The differences are zigzagged (0, -1, 1, -2...
+// become 0, 1, 2, 3...) and split into four planes, one for each byte, so
+// that the mostly zero high bytes sit together. Each plane is then stored
+// as a single repeated byte, as it is, packed or entropy coded with rANS.
+// Packed planes give the commonest bytes codes of one, two or four bits
+// and the rest an escape code, with the escaped bytes stored after the
+// codes; with SSE4.1 sixteen codes at a time become bytes by shuffles,
+// escapes and all, so they decode almost as fast as they're read. rANS is
+// a static order 0 model with 12-bit probabilities and 32 interleaved
+// states, so that no state waits on the one before it. Where the CPU has
+// AVX2 the states sit in four registers and are looked up with gathers;
+// with SSE4.1, in eight. Even so it decodes several times slower than the
+// rest, so a plane is only coded with it when that saves a quarter of the
+// plane over the smallest of the others. Decoding runs a few thousand
+// values at a time through all four planes, so the bytes are put back
+// together from the cache.
+//
+// Nothing here depends on OpenGL, so obj2vbm can build it too.
+
+// Appends the encoding of 'count' vertices of 'components' 32-bit values
+// to 'out'
+void vbm_encode_vertices(std::vector<unsigned char>& out, const void * vertices, unsigned int components, unsigned int count);
+
+// Appends the encoding of 'count' 32-bit indices to 'out'
+void vbm_encode_indices(std::vector<unsigned char>& out, const unsigned int * indices, unsigned int count);
+
+// Decode 'size' bytes at 'in' into 'out', which has room for the values.
+// Return false if the data is damaged or doesn't describe that many values.
+bool vbm_decode_vertices(void * vertices, unsigned int components, unsigned int count, const unsigned char * in, size_t size);
+bool vbm_decode_indices(unsigned int * indices, unsigned int count, const unsigned char * in, size_t size);
+
+#endif /* __VCODEC_H__ */
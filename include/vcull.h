@@ -0,0 +1,50 @@
+#ifndef __VCULL_H__
+#define __VCULL_H__
+
+#include "vmath.h"
+
+namespace vmath
+{
+
+// Extracts the six planes of the frustum described by a view-projection
+// matrix (Gribb & Hartmann). Planes are normalized and face inwards, so a
+// point p is inside plane n when dot(n.xyz, p) + n.w >= 0.
+void frustumPlanes(const mat4& m, vec4 planes[6]);
+
+// Transforms a local-space bounding sphere (center, radius) by each of
+// 'count' model matrices. World-space centers and radii are written as
+// separate arrays (structure-of-arrays) ready for cullSpheres. The radius
+// is scaled by the largest axis scale of each matrix.
+void transformSpheres(const vec4& sphere, const mat4 * matrices, unsigned int count,
+                      float * x, float * y, float * z, float * r);
+
+// Tests 'count' spheres against the frustum, four or eight at a time. The
+// indices of the spheres that may be visible are written to 'visible' in
+// increasing order and their number is returned.
+unsigned int cullSpheres(const vec4 planes[6],
+                         const float * x, const float * y, const float * z, const float * r,
+                         unsigned int count, unsigned int * visible);
+
+// As cullSpheres, but for axis-aligned boxes given by their centers and
+// half-extents.
+unsigned int cullBoxes(const vec4 planes[6],
+                       const float * cx, const float * cy, const float * cz,
+                       const float * ex, const float * ey, const float * ez,
+                       unsigned int count, unsigned int * visible);
+
+// Gathers the elements of 'src' listed in 'visible' to the front of 'dst',
+// ready to be uploaded as instance data.
+template <typename T>
+static inline unsigned int compactInstances(const T * src, const unsigned int * visible, unsigned int count, T * dst)
+{
+    for (unsigned int i = 0; i < count; i++)
+    {
+        dst[i] = src[visible[i]];
+    }
+
+    return count;
+}
+
+};
+
+#endif /* __VCULL_H__ */
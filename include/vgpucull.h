@@ -0,0 +1,84 @@
+#ifndef __VGPUCULL_H__
+#define __VGPUCULL_H__
+
+#include "vgl.h"
+#include "vmath.h"
+#include "vbm.h"
+
+class HiZPyramid;
+
+// Culls instances of a VBObject on the GPU. Instance transforms stay
+// resident in a shader storage buffer; each frame a compute pass tests
+// every instance's bounding sphere against the view frustum (and, if a
+// hierarchical-Z pyramid is supplied, against the previous frame's depth),
+// appends the survivors to a compacted buffer and bumps the instance count
+// of an indirect draw command. Nothing is read back to the CPU.
+//
+// The compacted outputs are an array of mat4 (the visible transforms) and
+// an array of uint (the original index of each visible instance, for
+// looking up other per-instance data). Bind either as vertex attributes
+// with a divisor of one, as texture buffers or as storage buffers.
+class GPUInstanceCuller
+{
+public:
+    GPUInstanceCuller(void);
+    virtual ~GPUInstanceCuller(void);
+
+    bool Initialize(unsigned int max_instances);
+    void Free(void);
+
+    // Replaces transforms first .. first + count - 1 in the resident buffer
+    void SetInstances(const vmath::mat4 * matrices, unsigned int count, unsigned int first = 0);
+
+    // Number of resident instances that are considered by Cull, at most
+    // the 'max_instances' given to Initialize
+    void SetInstanceCount(unsigned int count) { m_instance_count = count < m_max_instances ? count : m_max_instances; }
+    unsigned int GetInstanceCount(void) const { return m_instance_count; }
+
+    // Supplies a Hi-Z pyramid, normally built from the previous frame's
+    // depth (NULL turns the occlusion test off). It must match the viewport.
+    void SetHiZ(const HiZPyramid * hiz) { m_hiz = hiz; }
+
+    // Resets the indirect command for 'frame_index' of 'object' and
+    // dispatches the culling pass.
+    void Cull(const VBObject& object, unsigned int frame_index, const vmath::mat4& view_projection);
+
+    // Issues the indirect draw. The VAO of 'object' must already source
+    // its per-instance data from the compacted buffers.
+    void Render(VBObject& object);
+
+    GLuint GetVisibleMatrixBuffer(void) const { return m_visible_matrix_buffer; }
+    GLuint GetVisibleIndexBuffer(void) const { return m_visible_index_buffer; }
+    GLuint GetCommandBuffer(void) const { return m_command_buffer; }
+
+    // CPU implementation of the frustum part of the test performed by the
+    // compute shader, for validating it on machines without a GPU. Writes
+    // the indices of the visible instances in increasing order; the GPU
+    // produces the same set in an unspecified order.
+    static unsigned int CullReference(const vmath::mat4 * matrices, unsigned int count,
+                                      const vmath::vec4& sphere, const vmath::mat4& view_projection,
+                                      unsigned int * visible);
+
+protected:
+    GLuint m_program;
+    GLuint m_instance_buffer;
+    GLuint m_visible_matrix_buffer;
+    GLuint m_visible_index_buffer;
+    GLuint m_command_buffer;
+
+    const HiZPyramid * m_hiz;
+
+    unsigned int m_max_instances;
+    unsigned int m_instance_count;
+
+    struct
+    {
+        GLint frustum_planes;
+        GLint bounding_sphere;
+        GLint instance_count;
+        GLint view_projection;
+        GLint use_hiz;
+    } m_uniforms;
+};
+
+#endif /* __VGPUCULL_H__ */
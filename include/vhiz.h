@@ -0,0 +1,113 @@
+#ifndef __VHIZ_H__
+#define __VHIZ_H__
+
+#include "vgl.h"
+#include "vmath.h"
+
+class JobSystem;
+
+// Hierarchical-Z pyramid. Build reduces a depth texture (normally the
+// previous frame's) to a chain of levels, each holding the farthest depth
+// of 2x2 texels of the level below, in a single compute dispatch. Test
+// then checks a batch of window-space boxes against it and writes one
+// visibility word per box to a storage buffer, where it can serve as the
+// instance count of indirect draws.
+//
+// The levels live in a shader storage buffer rather than a texture so that
+// the whole chain is writable from one dispatch. Texel (x, y) of level n
+// covers exactly the pixels [x * 2^n, (x + 1) * 2^n) x [y * 2^n, (y + 1) * 2^n);
+// the levels are rounded up rather than down in size, so nothing is lost at
+// the edges of odd-sized levels.
+
+#define HIZ_MAX_LEVELS  16
+
+// A box in window space: x and y in pixels, z as depth in [0, 1]. Only the
+// z of 'min' (the nearest point) takes part in the test.
+struct HiZBox
+{
+    vmath::vec4 min;
+    vmath::vec4 max;
+};
+
+class HiZPyramid
+{
+public:
+    HiZPyramid(void);
+    virtual ~HiZPyramid(void);
+
+    bool Initialize(GLsizei width, GLsizei height);
+    void Free(void);
+    void Resize(GLsizei width, GLsizei height);
+
+    // Rebuilds every level from 'depth_texture', which must be a complete
+    // (non-mipmapped textures need GL_NEAREST or GL_LINEAR minification)
+    // depth texture of the size given to Initialize, with no comparison mode.
+    void Build(GLuint depth_texture);
+
+    // Tests 'count' HiZBoxes read from 'box_buffer', writing 1 (visible) or
+    // 0 (hidden) to word 'i * output_stride + output_offset' of
+    // 'output_buffer' for box i. A stride of 5 and an offset of 1 targets
+    // the instance counts of an array of DrawElementsIndirectCommands.
+    void Test(GLuint box_buffer, unsigned int count, GLuint output_buffer,
+              unsigned int output_stride = 1, unsigned int output_offset = 0);
+
+    // For shaders that do their own testing. GetTestSource returns GLSL that
+    // declares the pyramid and
+    //
+    //     bool hiz_visible(vec4 rect, float z);
+    //
+    // where 'rect' is (x0, y0, x1, y1) in pixels. It must follow the
+    // #version line and a #define of HIZ_BINDING, the storage buffer binding
+    // to read the pyramid from. Bind sets up the currently bound 'program'
+    // to use it.
+    static const char * GetTestSource(void);
+    void Bind(GLuint program, GLuint binding) const;
+
+    GLuint GetBuffer(void) const { return m_pyramid_buffer; }
+    GLsizei GetWidth(void) const { return m_width; }
+    GLsizei GetHeight(void) const { return m_height; }
+    int GetLevels(void) const { return m_levels; }
+
+    // Layout of the pyramid: fills in the offset (in floats) of each level
+    // and returns the total size in floats
+    static int LevelCount(GLsizei width, GLsizei height);
+    static unsigned int LevelOffsets(GLsizei width, GLsizei height, GLuint * offsets);
+
+    // Projects the world-space box 'lo' - 'hi' through 'view_projection' to
+    // a window of 'width' by 'height'. If it reaches behind the eye the
+    // result covers the whole window at depth zero (so always passes) and
+    // false is returned.
+    static bool ProjectBox(const vmath::mat4& view_projection, const vmath::vec3& lo, const vmath::vec3& hi,
+                           GLsizei width, GLsizei height, HiZBox& box);
+
+    // CPU implementations of Build and Test, for validating them on
+    // machines without a GPU. Their results match the GPU bit for bit.
+    // 'depth' is width * height floats, bottom row first; 'pyramid' has
+    // room for LevelOffsets(width, height) floats. Large levels and batches
+    // are split across 'jobs'.
+    static void BuildReference(JobSystem& jobs, const float * depth, GLsizei width, GLsizei height, float * pyramid);
+    static void TestReference(JobSystem& jobs, const float * pyramid, GLsizei width, GLsizei height,
+                              const HiZBox * boxes, unsigned int count, GLuint * visible);
+
+protected:
+    void AllocatePyramid(void);
+
+    GLsizei         m_width;
+    GLsizei         m_height;
+    int             m_levels;
+    GLuint          m_offsets[HIZ_MAX_LEVELS];
+
+    GLuint          m_build_program;
+    GLuint          m_test_program;
+    GLuint          m_pyramid_buffer;
+    GLuint          m_counter_buffer;
+
+    struct
+    {
+        GLint box_count;
+        GLint output_stride;
+        GLint output_offset;
+    } m_test_uniforms;
+};
+
+#endif /* __VHIZ_H__ */
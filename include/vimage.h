@@ -0,0 +1,149 @@
+#ifndef __VIMAGE_H__
+#define __VIMAGE_H__
+
+#include "vgl.h"
+#include "vermilion.h"
+
+#include <vector>
+
+class JobSystem;
+
+// Separable convolution and summed-area tables over images of any size, on
+// the GPU in compute shaders and on the CPU over vglImageData.
+//
+// Every GPU pass filters or scans along rows and writes its result
+// transposed, so running the same pass twice covers the rows and then the
+// columns and leaves the image the right way round. Reads walk along rows
+// in every pass, the intermediate image is height by width, and there is
+// only one kernel to write for each operation.
+//
+// Convolution gives each workgroup a tile of TILE_SIZE pixels of a row,
+// which it loads into shared memory together with an apron of 'radius'
+// pixels either side, clamped to the image edge. Kernels wider than
+// MAX_SHARED_RADIUS read their taps from the image instead.
+//
+// The summed-area table is a running sum along each row, twice. Any box
+// is then four reads, whatever its radius; box blur divides by the part
+// of the box that is inside the image. The sums grow with the image, so
+// precision falls with its size: a 1024 x 1024 image of values up to one
+// sums to 2^20, where floats are 1/8 apart.
+//
+// The CPU versions do the same arithmetic in the same order, with SSE (or
+// AVX, two pixels at a time) and split across a JobSystem, so they give
+// the same bits as the shaders, which mark their sums precise - given IEEE
+// arithmetic that doesn't flush denormals. They work on GL_RGBA / GL_FLOAT
+// images, which convert_image_to_rgba32f makes from other formats.
+
+// Allocates a 'width' x 'height' GL_RGBA / GL_FLOAT 2D image with one level
+// and no contents. Release it with vglUnloadImage.
+void create_rgba32f_image(vglImageData * image, GLsizei width, GLsizei height);
+
+// Converts level 'level' of a 2D 'image' with GL_RED, GL_RG, GL_RGB,
+// GL_BGR, GL_RGBA or GL_BGRA components of GL_UNSIGNED_BYTE,
+// GL_UNSIGNED_SHORT (both normalized) or GL_FLOAT type to a new GL_RGBA /
+// GL_FLOAT image in 'result'. Missing components are 0, and alpha 1.
+// Returns false, leaving 'result' alone, for any other image.
+bool convert_image_to_rgba32f(const vglImageData * image, vglImageData * result, int level = 0);
+
+// Fills 'weights' with the 2 * radius + 1 taps of a normalized Gaussian
+// with standard deviation 'sigma'. A negative radius picks ceil(3 sigma).
+int gaussian_kernel(float sigma, std::vector<float>& weights, int radius = -1);
+
+struct ImageFilterStats
+{
+    GLsizei         width;
+    GLsizei         height;
+    int             radius;
+    float           time;               // Microseconds for the last CPU operation
+    float           megapixels_per_second;
+};
+
+class ImageProcessor
+{
+public:
+    ImageProcessor(void);
+    virtual ~ImageProcessor(void);
+
+    // Without 'gpu', no compute shaders are built and only the CPU
+    // functions are available
+    bool Initialize(bool gpu = true);
+    void Free(void);
+
+    // Sets the 2 * radius + 1 taps used by Convolve, for both directions
+    void SetKernel(const float * weights, int radius);
+    int GetRadius(void) const { return m_radius; }
+    const float * GetKernel(void) const { return m_weights.data(); }
+
+    // GPU versions. The textures are GL_RGBA32F 2D textures of 'width' x
+    // 'height' texels; level zero is read and written. 'output' must not
+    // be 'input'. Each call waits for earlier image stores and leaves its
+    // results visible to later image loads; texture fetches and other
+    // uses need their own barrier.
+    void Convolve(GLuint input, GLuint output, GLsizei width, GLsizei height);
+    void SummedAreaTable(GLuint input, GLuint output, GLsizei width, GLsizei height);
+    void BoxBlur(GLuint sat, GLuint output, GLsizei width, GLsizei height, int radius);
+
+    // CPU versions over GL_RGBA / GL_FLOAT images. 'output' must be zeroed
+    // or hold an earlier result, which is reused if it is the right size.
+    // They return false if 'input' has any other format.
+    bool Convolve(JobSystem& jobs, const vglImageData * input, vglImageData * output);
+    bool SummedAreaTable(JobSystem& jobs, const vglImageData * input, vglImageData * output);
+    bool BoxBlur(JobSystem& jobs, const vglImageData * sat, vglImageData * output, int radius);
+
+    const ImageFilterStats& GetStats(void) const { return m_stats; }
+
+    enum
+    {
+        TILE_SIZE = 256,
+        MAX_SHARED_RADIUS = 128,
+        SCAN_GROUP_SIZE = 64,
+        BOX_GROUP_SIZE = 16
+    };
+
+protected:
+    enum
+    {
+        PROGRAM_CONVOLVE_SHARED,
+        PROGRAM_CONVOLVE_DIRECT,
+        PROGRAM_SCAN,
+        PROGRAM_BOX_BLUR,
+        PROGRAM_TOTAL
+    };
+
+    // The height x width image between the two passes
+    void PrepareTranspose(GLsizei width, GLsizei height);
+    // 1 / the width of the box around each column, then 1 / its height
+    // around each row
+    void PrepareBoxScales(GLsizei width, GLsizei height, int radius);
+
+    std::vector<float>          m_weights;
+    int                         m_radius;
+    std::vector<float>          m_box_scales;
+    GLsizei                     m_box_width;
+    GLsizei                     m_box_height;
+    int                         m_box_radius;
+
+    GLuint                      m_programs[PROGRAM_TOTAL];
+    GLuint                      m_weight_buffer;
+    GLuint                      m_box_scale_buffer;
+    GLuint                      m_transpose_texture;
+    GLsizei                     m_transpose_width;
+    GLsizei                     m_transpose_height;
+
+    struct
+    {
+        GLint radius;
+    } m_convolve_uniforms[2];
+
+    struct
+    {
+        GLint radius;
+    } m_box_uniforms;
+
+    // Rows between the two CPU passes
+    std::vector<float>          m_rows;
+
+    ImageFilterStats            m_stats;
+};
+
+#endif /* __VIMAGE_H__ */
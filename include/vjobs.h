@@ -0,0 +1,155 @@
+#ifndef __VJOBS_H__
+#define __VJOBS_H__
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+// A work-stealing job system. Each thread (the one that called Initialize
+// and one worker per remaining core) owns a Chase-Lev deque: it pushes and
+// pops jobs at one end while idle threads steal from the other.
+//
+// Jobs are taken from a per-thread ring of JOB_POOL_SIZE, so creating one
+// doesn't allocate. A slot is only reused once its job has finished; when
+// the next one hasn't, Create returns NULL and ParallelFor runs the rest of
+// its range inline rather than split it further. ParallelFor also raises
+// its grain so that one call makes at most JOB_MAX_RANGE_PIECES pieces.
+// Jobs may only be created and run by the thread that initialized the
+// system and by jobs themselves.
+//
+// A job finishes once its function has returned and all the jobs created
+// with it as their parent have finished. Jobs can also depend on others,
+// and then don't start until those have finished. Wait runs other jobs
+// until the one waited on finishes, so it can be called from inside jobs.
+// Workers that find nothing to do for a while sleep until a job is queued,
+// so a system with no work costs nothing.
+
+#define JOB_POOL_SIZE       4096
+#define JOB_QUEUE_SIZE      4096
+#define JOB_MAX_DEPENDENTS  16
+
+// Leaves room in the pool for nested ParallelFors and other jobs
+#define JOB_MAX_RANGE_PIECES    (JOB_POOL_SIZE / 16)
+
+struct JobStats
+{
+    unsigned int    threads;        // Including the one that called Initialize
+    unsigned int    executed;       // Jobs run since the last ResetStats
+    unsigned int    stolen;         // ... of which were taken from another thread
+    unsigned int    inline_runs;    // Jobs run immediately because a queue was full
+    unsigned int    pool_full;      // Jobs not created because the next slot was still in use
+};
+
+class JobSystem
+{
+public:
+    struct Job;
+
+    JobSystem(void);
+    virtual ~JobSystem(void);
+
+    // 'threads' of zero uses one per core
+    bool Initialize(int threads = 0);
+    void Free(void);
+
+    unsigned int GetThreadCount(void) const { return (unsigned int)m_threads.size(); }
+
+    // Creates a job that runs 'function'. It doesn't start until Run.
+    // Returns NULL if the calling thread's pool is full; the caller can
+    // then run 'function' itself.
+    Job * Create(const std::function<void()>& function, Job * parent = NULL);
+
+    // Holds 'job' back until 'prerequisite' has finished. Both must have been
+    // created but not yet run. Returns false, and adds nothing, if
+    // 'prerequisite' already has JOB_MAX_DEPENDENTS dependents.
+    bool AddDependency(Job * job, Job * prerequisite);
+
+    // Queues 'job' on the calling thread, or leaves it for its last
+    // prerequisite to queue when that finishes
+    void Run(Job * job);
+
+    // Runs jobs until 'job' has finished
+    void Wait(const Job * job);
+
+    bool IsFinished(const Job * job) const;
+
+    // Calls function(begin, end) over [0, count) in ranges of at most
+    // 'grain' (raised to count / JOB_MAX_RANGE_PIECES where that is
+    // larger), splitting the range in halves so that idle threads steal
+    // large pieces first. Returns when all of them have returned.
+    void ParallelFor(unsigned int count, unsigned int grain,
+                     const std::function<void(unsigned int, unsigned int)>& function);
+
+    JobStats GetStats(void) const;
+    void ResetStats(void);
+
+    struct Job
+    {
+        std::function<void()>   function;
+        // ParallelFor's ranges
+        const std::function<void(unsigned int, unsigned int)> * range_function;
+        unsigned int            begin;
+        unsigned int            end;
+        unsigned int            grain;
+
+        Job *                   parent;
+        std::atomic<int>        unfinished;     // This job and its unfinished children
+        std::atomic<int>        dependencies;   // Unfinished prerequisites, plus one until Run
+        Job *                   dependents[JOB_MAX_DEPENDENTS];
+        int                     dependent_count;
+    };
+
+protected:
+    // Lock-free deque after Chase and Lev, with the memory orderings of
+    // Le et al., "Correct and Efficient Work-Stealing for Weak Memory Models"
+    class Queue
+    {
+    public:
+        Queue(void) : m_top(0), m_bottom(0) {}
+
+        bool Push(Job * job);       // Owner only
+        Job * Pop(void);            // Owner only
+        Job * Steal(void);          // Any thread
+        bool IsEmpty(void) const;   // Any thread
+
+    protected:
+        std::atomic<long>   m_top;
+        std::atomic<long>   m_bottom;
+        std::atomic<Job *>  m_jobs[JOB_QUEUE_SIZE];
+    };
+
+    struct Thread
+    {
+        Queue                       queue;
+        Job                         pool[JOB_POOL_SIZE];
+        unsigned int                next_job;
+        unsigned int                random;
+        std::atomic<unsigned int>   executed;
+        std::atomic<unsigned int>   stolen;
+        std::atomic<unsigned int>   inline_runs;
+        std::atomic<unsigned int>   pool_full;
+    };
+
+    Thread * CurrentThread(void) const;
+    Job * Allocate(void);
+    Job * GetJob(Thread * thread);
+    bool HasQueuedJobs(void) const;
+    void Push(Job * job);
+    void Execute(Job * job);
+    void Finish(Job * job);
+    void WorkerMain(unsigned int index);
+    static void RunRange(JobSystem * system, Job * job);
+
+    std::vector<Thread *>       m_threads;
+    std::vector<std::thread>    m_workers;
+    std::atomic<bool>           m_running;
+    std::atomic<int>            m_sleeping;
+    unsigned int                m_wakeups;      // Bumped under m_mutex to wake a sleeper
+    std::mutex                  m_mutex;
+    std::condition_variable     m_condition;
+};
+
+#endif /* __VJOBS_H__ */
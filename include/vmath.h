@@ -1,10 +1,17 @@
 #ifndef __VMATH_H__
 #define __VMATH_H__
 
+// vmath needs C++17 (/std:c++17 or -std=c++17). Most of it is constexpr so
+// that constant transforms and tables can be worked out by the compiler,
+// which takes C++17's rules for constexpr loops and locals. Until C++20 a
+// constexpr constructor must also initialize every member, so the vector
+// and matrix constructors zero their elements before writing them.
 
 #define _USE_MATH_DEFINES  1 // Include constants defined in math.h
 #include <math.h>
 
+#include "vmathkernels.h"
+
 namespace vmath
 {
 
@@ -24,60 +31,121 @@ inline T radians(T angleInDegrees)
     return angleInDegrees * static_cast<T>(M_PI/180.0);
 }
 
+// Philox4x32-10, the counter-based generator of Salmon et al., "Parallel
+// Random Numbers: As Easy as 1, 2, 3". It's a keyed bijection of a 128-bit
+// counter, so any value of any stream can be had directly, from any thread,
+// without state. random_bits numbers the 32-bit words of the stream 'key'
+// consecutively; word n is word n % 4 of the block for counter n / 4.
+static constexpr void philox4x32(const unsigned int counter[4], unsigned int key0, unsigned int key1, unsigned int result[4])
+{
+    unsigned int c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+
+    for (int i = 0; i < 10; i++)
+    {
+        const unsigned long long p0 = 0xD2511F53ull * c0;
+        const unsigned long long p1 = 0xCD9E8D57ull * c2;
+
+        c0 = (unsigned int)(p1 >> 32) ^ c1 ^ key0;
+        c2 = (unsigned int)(p0 >> 32) ^ c3 ^ key1;
+        c1 = (unsigned int)p1;
+        c3 = (unsigned int)p0;
+
+        key0 += 0x9E3779B9u;
+        key1 += 0xBB67AE85u;
+    }
+
+    result[0] = c0;
+    result[1] = c1;
+    result[2] = c2;
+    result[3] = c3;
+}
+
+static constexpr unsigned int random_bits(unsigned int key, unsigned int counter)
+{
+    const unsigned int block[4] = { counter >> 2, 0, 0, 0 };
+    unsigned int result[4] = { 0, 0, 0, 0 };
+
+    philox4x32(block, key, 0, result);
+
+    return result[counter & 3];
+}
+
+// The top 23 random bits over 2^23: the same as putting them in the
+// mantissa of a float in [1, 2) and taking away one, but constexpr
+static constexpr float random_bits_to_float(unsigned int bits)
+{
+    return float(bits >> 9) * (1.0f / 8388608.0f);
+}
+
+// The shared sequence behind vmath::random<T>(), one for each T as when each
+// random<T> kept its own static seed. Not constexpr, and not thread safe.
+template <typename T>
+inline unsigned int random_sequence_bits(void)
+{
+    static unsigned int seed = 0x13371337;
+
+    seed *= 16807;
+
+    return seed ^ (seed >> 4) ^ (seed << 15);
+}
+
+// vmath::random<T>() draws from a shared sequence that isn't thread safe;
+// vmath::random<T>(key, counter) is value 'counter' of the stream 'key' and
+// can be called from anywhere.
 template <typename T>
 struct random
 {
-    operator T ()
+    constexpr random(void) : counter_based(false), key(0), counter(0) {}
+    constexpr random(unsigned int key_, unsigned int counter_) : counter_based(true), key(key_), counter(counter_) {}
+
+    bool            counter_based;
+    unsigned int    key;
+    unsigned int    counter;
+
+    constexpr operator T () const
     {
-        static unsigned int seed = 0x13371337;
-        unsigned int res;
-        unsigned int tmp;
-        
-        seed *= 16807;
-        
-        tmp = seed ^ (seed >> 4) ^ (seed << 15);
-        
-        res = (tmp >> 9) | 0x3F800000;
+        if (counter_based)
+            return static_cast<T>(random_bits_to_float(random_bits(key, counter)));
 
-        return static_cast<T>(res);
+        return static_cast<T>((random_sequence_bits<T>() >> 9) | 0x3F800000);
     }
 };
 
 template<>
 struct random<float>
 {
-    operator float()
-    {
-        static unsigned int seed = 0x13371337;
-        float res;
-        unsigned int tmp;
-
-        seed *= 16807;
+    constexpr random(void) : counter_based(false), key(0), counter(0) {}
+    constexpr random(unsigned int key_, unsigned int counter_) : counter_based(true), key(key_), counter(counter_) {}
 
-        tmp = seed ^ (seed >> 4) ^ (seed << 15);
+    bool            counter_based;
+    unsigned int    key;
+    unsigned int    counter;
 
-        *((unsigned int *) &res) = (tmp >> 9) | 0x3F800000;
+    constexpr operator float() const
+    {
+        if (counter_based)
+            return random_bits_to_float(random_bits(key, counter));
 
-        return (res - 1.0f);
+        return random_bits_to_float(random_sequence_bits<float>());
     }
 };
 
 template<>
 struct random<unsigned int>
 {
-    operator unsigned int()
-    {
-        static unsigned int seed = 0x13371337;
-        unsigned int res;
-        unsigned int tmp;
+    constexpr random(void) : counter_based(false), key(0), counter(0) {}
+    constexpr random(unsigned int key_, unsigned int counter_) : counter_based(true), key(key_), counter(counter_) {}
 
-        seed *= 16807;
+    bool            counter_based;
+    unsigned int    key;
+    unsigned int    counter;
 
-        tmp = seed ^ (seed >> 4) ^ (seed << 15);
-
-        res = (tmp >> 9) | 0x3F800000;
+    constexpr operator unsigned int() const
+    {
+        if (counter_based)
+            return random_bits(key, counter);
 
-        return res;
+        return (random_sequence_bits<unsigned int>() >> 9) | 0x3F800000;
     }
 };
 
@@ -88,148 +156,142 @@ public:
     typedef class vecN<T,len> my_type;
     typedef T element_type;
 
-    // Default constructor does nothing, just like built-in types
-    inline vecN()
+    // Default constructor zeroes, which constexpr needs. Where the
+    // elements are written straight after, the compiler drops the zeroes.
+    constexpr vecN()
+        : data()
     {
-        // Uninitialized variable
     }
 
     // Copy constructor
-    inline vecN(const vecN& that)
+    constexpr vecN(const vecN& that)
+        : data()
     {
         assign(that);
     }
 
     // Construction from scalar
-    inline vecN(T s)
+    constexpr vecN(T s)
+        : data()
     {
-        int n;
-        for (n = 0; n < len; n++)
+        for (int n = 0; n < len; n++)
         {
             data[n] = s;
         }
     }
 
     // Assignment operator
-    inline vecN& operator=(const vecN& that)
+    constexpr vecN& operator=(const vecN& that)
     {
         assign(that);
         return *this;
     }
 
-    inline vecN& operator=(const T& that)
+    constexpr vecN& operator=(const T& that)
     {
-        int n;
-        for (n = 0; n < len; n++)
+        for (int n = 0; n < len; n++)
             data[n] = that;
 
         return *this;
     }
 
-    inline vecN operator+(const vecN& that) const
+    constexpr vecN operator+(const vecN& that) const
     {
         my_type result;
-        int n;
-        for (n = 0; n < len; n++)
+        for (int n = 0; n < len; n++)
             result.data[n] = data[n] + that.data[n];
         return result;
     }
 
-    inline vecN& operator+=(const vecN& that)
+    constexpr vecN& operator+=(const vecN& that)
     {
         return (*this = *this + that);
     }
 
-    inline vecN operator-() const
+    constexpr vecN operator-() const
     {
         my_type result;
-        int n;
-        for (n = 0; n < len; n++)
+        for (int n = 0; n < len; n++)
             result.data[n] = -data[n];
         return result;
     }
 
-    inline vecN operator-(const vecN& that) const
+    constexpr vecN operator-(const vecN& that) const
     {
         my_type result;
-        int n;
-        for (n = 0; n < len; n++)
+        for (int n = 0; n < len; n++)
             result.data[n] = data[n] - that.data[n];
         return result;
     }
 
-    inline vecN& operator-=(const vecN& that)
+    constexpr vecN& operator-=(const vecN& that)
     {
         return (*this = *this - that);
     }
 
-    inline vecN operator*(const vecN& that) const
+    constexpr vecN operator*(const vecN& that) const
     {
         my_type result;
-        int n;
-        for (n = 0; n < len; n++)
+        for (int n = 0; n < len; n++)
             result.data[n] = data[n] * that.data[n];
         return result;
     }
 
-    inline vecN& operator*=(const vecN& that)
+    constexpr vecN& operator*=(const vecN& that)
     {
         return (*this = *this * that);
     }
 
-    inline vecN operator*(const T& that) const
+    constexpr vecN operator*(const T& that) const
     {
         my_type result;
-        int n;
-        for (n = 0; n < len; n++)
+        for (int n = 0; n < len; n++)
             result.data[n] = data[n] * that;
         return result;
     }
 
-    inline vecN& operator*=(const T& that)
+    constexpr vecN& operator*=(const T& that)
     {
         assign(*this * that);
 
         return *this;
     }
 
-    inline vecN operator/(const vecN& that) const
+    constexpr vecN operator/(const vecN& that) const
     {
         my_type result;
-        int n;
-        for (n = 0; n < len; n++)
+        for (int n = 0; n < len; n++)
             result.data[n] = data[n] / that.data[n];
         return result;
     }
 
-    inline vecN& operator/=(const vecN& that)
+    constexpr vecN& operator/=(const vecN& that)
     {
         assign(*this / that);
 
         return *this;
     }
 
-    inline vecN operator/(const T& that) const
+    constexpr vecN operator/(const T& that) const
     {
         my_type result;
-        int n;
-        for (n = 0; n < len; n++)
+        for (int n = 0; n < len; n++)
             result.data[n] = data[n] / that;
         return result;
     }
 
-    inline vecN& operator/=(const T& that)
+    constexpr vecN& operator/=(const T& that)
     {
         assign(*this / that);
         return *this;
     }
 
-    inline T& operator[](int n) { return data[n]; }
-    inline const T& operator[](int n) const { return data[n]; }
+    constexpr T& operator[](int n) { return data[n]; }
+    constexpr const T& operator[](int n) const { return data[n]; }
 
-    inline static int size(void) { return len; }
+    constexpr static int size(void) { return len; }
 
-    inline operator const T* () const { return &data[0]; }
+    constexpr operator const T* () const { return &data[0]; }
 
     static inline vecN random()
     {
@@ -246,10 +308,9 @@ public:
 protected:
     T data[len];
 
-    inline void assign(const vecN& that)
+    constexpr void assign(const vecN& that)
     {
-        int n;
-        for (n = 0; n < len; n++)
+        for (int n = 0; n < len; n++)
             data[n] = that.data[n];
     }
 };
@@ -260,13 +321,13 @@ class Tvec2 : public vecN<T,2>
 public:
     typedef vecN<T,2> base;
 
-    // Uninitialized variable
-    inline Tvec2() {}
+    // Zero
+    constexpr Tvec2() {}
     // Copy constructor
-    inline Tvec2(const base& v) : base(v) {}
+    constexpr Tvec2(const base& v) : base(v) {}
 
     // vec2(x, y);
-    inline Tvec2(T x, T y)
+    constexpr Tvec2(T x, T y)
     {
         base::data[0] = x;
         base::data[1] = y;
@@ -279,14 +340,14 @@ class Tvec3 : public vecN<T,3>
 public:
     typedef vecN<T,3> base;
 
-    // Uninitialized variable
-    inline Tvec3() {}
+    // Zero
+    constexpr Tvec3() {}
 
     // Copy constructor
-    inline Tvec3(const base& v) : base(v) {}
+    constexpr Tvec3(const base& v) : base(v) {}
 
     // vec3(x, y, z);
-    inline Tvec3(T x, T y, T z)
+    constexpr Tvec3(T x, T y, T z)
     {
         base::data[0] = x;
         base::data[1] = y;
@@ -294,7 +355,7 @@ public:
     }
 
     // vec3(v, z);
-    inline Tvec3(const Tvec2<T>& v, T z)
+    constexpr Tvec3(const Tvec2<T>& v, T z)
     {
         base::data[0] = v[0];
         base::data[1] = v[1];
@@ -302,7 +363,7 @@ public:
     }
 
     // vec3(x, v)
-    inline Tvec3(T x, const Tvec2<T>& v)
+    constexpr Tvec3(T x, const Tvec2<T>& v)
     {
         base::data[0] = x;
         base::data[1] = v[0];
@@ -316,14 +377,14 @@ class Tvec4 : public vecN<T,4>
 public:
     typedef vecN<T,4> base;
 
-    // Uninitialized variable
-    inline Tvec4() {}
+    // Zero
+    constexpr Tvec4() {}
 
     // Copy constructor
-    inline Tvec4(const base& v) : base(v) {}
+    constexpr Tvec4(const base& v) : base(v) {}
 
     // vec4(x, y, z, w);
-    inline Tvec4(T x, T y, T z, T w)
+    constexpr Tvec4(T x, T y, T z, T w)
     {
         base::data[0] = x;
         base::data[1] = y;
@@ -332,7 +393,7 @@ public:
     }
 
     // vec4(v, z, w);
-    inline Tvec4(const Tvec2<T>& v, T z, T w)
+    constexpr Tvec4(const Tvec2<T>& v, T z, T w)
     {
         base::data[0] = v[0];
         base::data[1] = v[1];
@@ -341,7 +402,7 @@ public:
     }
 
     // vec4(x, v, w);
-    inline Tvec4(T x, const Tvec2<T>& v, T w)
+    constexpr Tvec4(T x, const Tvec2<T>& v, T w)
     {
         base::data[0] = x;
         base::data[1] = v[0];
@@ -350,7 +411,7 @@ public:
     }
 
     // vec4(x, y, v);
-    inline Tvec4(T x, T y, const Tvec2<T>& v)
+    constexpr Tvec4(T x, T y, const Tvec2<T>& v)
     {
         base::data[0] = x;
         base::data[1] = y;
@@ -359,7 +420,7 @@ public:
     }
 
     // vec4(v1, v2);
-    inline Tvec4(const Tvec2<T>& u, const Tvec2<T>& v)
+    constexpr Tvec4(const Tvec2<T>& u, const Tvec2<T>& v)
     {
         base::data[0] = u[0];
         base::data[1] = u[1];
@@ -368,7 +429,7 @@ public:
     }
 
     // vec4(v, w);
-    inline Tvec4(const Tvec3<T>& v, T w)
+    constexpr Tvec4(const Tvec3<T>& v, T w)
     {
         base::data[0] = v[0];
         base::data[1] = v[1];
@@ -377,7 +438,7 @@ public:
     }
 
     // vec4(x, v);
-    inline Tvec4(T x, const Tvec3<T>& v)
+    constexpr Tvec4(T x, const Tvec3<T>& v)
     {
         base::data[0] = x;
         base::data[1] = v[0];
@@ -410,35 +471,34 @@ typedef Tvec4<unsigned int> uvec4;
 typedef Tvec4<double> dvec4;
 
 template <typename T, int n>
-static inline const vecN<T,n> operator * (T x, const vecN<T,n>& v)
+static constexpr const vecN<T,n> operator * (T x, const vecN<T,n>& v)
 {
     return v * x;
 }
 
 template <typename T>
-static inline const Tvec2<T> operator / (T x, const Tvec2<T>& v)
+static constexpr const Tvec2<T> operator / (T x, const Tvec2<T>& v)
 {
     return Tvec2<T>(x / v[0], x / v[1]);
 }
 
 template <typename T>
-static inline const Tvec3<T> operator / (T x, const Tvec3<T>& v)
+static constexpr const Tvec3<T> operator / (T x, const Tvec3<T>& v)
 {
     return Tvec3<T>(x / v[0], x / v[1], x / v[2]);
 }
 
 template <typename T>
-static inline const Tvec4<T> operator / (T x, const Tvec4<T>& v)
+static constexpr const Tvec4<T> operator / (T x, const Tvec4<T>& v)
 {
     return Tvec4<T>(x / v[0], x / v[1], x / v[2], x / v[3]);
 }
 
 template <typename T, int len>
-static inline T dot(const vecN<T,len>& a, const vecN<T,len>& b)
+static constexpr T dot(const vecN<T,len>& a, const vecN<T,len>& b)
 {
-    int n;
     T total = T(0);
-    for (n = 0; n < len; n++)
+    for (int n = 0; n < len; n++)
     {
         total += a[n] * b[n];
     }
@@ -446,7 +506,7 @@ static inline T dot(const vecN<T,len>& a, const vecN<T,len>& b)
 }
 
 template <typename T>
-static inline vecN<T,3> cross(const vecN<T,3>& a, const vecN<T,3>& b)
+static constexpr vecN<T,3> cross(const vecN<T,3>& a, const vecN<T,3>& b)
 {
     return Tvec3<T>(a[1] * b[2] - b[1] * a[2],
                     a[2] * b[0] - b[2] * a[0],
@@ -488,100 +548,105 @@ template <typename T>
 class Tquaternion
 {
 public:
-    inline Tquaternion()
+    // Zero, so that the constructor can be constexpr
+    constexpr Tquaternion()
+        : a()
     {
 
     }
 
-    inline Tquaternion(const Tquaternion& q)
-        : r(q.r),
-          v(q.v)
+    constexpr Tquaternion(const Tquaternion& q)
+        : a()
     {
-
+        for (int n = 0; n < 4; n++)
+            a[n] = q.a[n];
     }
 
-    inline Tquaternion(T _r)
-        : r(_r),
-          v(T(0))
+    constexpr Tquaternion(T _r)
+        : a()
     {
-
+        a[0] = _r;
     }
 
-    inline Tquaternion(T _r, const Tvec3<T>& _v)
-        : r(_r),
-          v(_v)
+    constexpr Tquaternion(T _r, const Tvec3<T>& _v)
+        : a()
     {
+        a[0] = _r;
+        a[1] = _v[0];
+        a[2] = _v[1];
+        a[3] = _v[2];
+    }
 
+    constexpr Tquaternion(const Tvec4<T>& _v)
+        : a()
+    {
+        for (int n = 0; n < 4; n++)
+            a[n] = _v[n];
     }
 
-    inline Tquaternion(const Tvec4<T>& _v)
-        : r(_v[0]),
-          v(_v[1], _v[2], _v[3])
+    constexpr Tquaternion(T _x, T _y, T _z, T _w)
+        : a()
     {
+        a[0] = _x;
+        a[1] = _y;
+        a[2] = _z;
+        a[3] = _w;
     }
 
-    inline Tquaternion(T _x, T _y, T _z, T _w)
-        : r(_x),
-          v(_y, _z, _w)
+    constexpr Tquaternion& operator=(const Tquaternion& q)
     {
+        for (int n = 0; n < 4; n++)
+            a[n] = q.a[n];
 
+        return *this;
     }
 
-    inline T& operator[](int n)
+    constexpr T& operator[](int n)
     {
         return a[n];
     }
 
-    inline const T& operator[](int n) const
+    constexpr const T& operator[](int n) const
     {
         return a[n];
     }
 
-    inline Tquaternion operator+(const Tquaternion& q) const
+    constexpr Tquaternion operator+(const Tquaternion& q) const
     {
-        return quaternion(r + q.r, v + q.v);
+        return Tquaternion(a[0] + q.a[0], a[1] + q.a[1], a[2] + q.a[2], a[3] + q.a[3]);
     }
 
-    inline Tquaternion& operator+=(const Tquaternion& q)
+    constexpr Tquaternion& operator+=(const Tquaternion& q)
     {
-        r += q.r;
-        v += q.v;
-
-        return *this;
+        return (*this = *this + q);
     }
 
-    inline Tquaternion operator-(const Tquaternion& q) const
+    constexpr Tquaternion operator-(const Tquaternion& q) const
     {
-        return quaternion(r - q.r, v - q.v);
+        return Tquaternion(a[0] - q.a[0], a[1] - q.a[1], a[2] - q.a[2], a[3] - q.a[3]);
     }
 
-    inline Tquaternion& operator-=(const Tquaternion& q)
+    constexpr Tquaternion& operator-=(const Tquaternion& q)
     {
-        r -= q.r;
-        v -= q.v;
-
-        return *this;
+        return (*this = *this - q);
     }
 
-    inline Tquaternion operator-() const
+    constexpr Tquaternion operator-() const
     {
-        return Tquaternion(-r, -v);
+        return Tquaternion(-a[0], -a[1], -a[2], -a[3]);
     }
 
-    inline Tquaternion operator*(const T s) const
+    constexpr Tquaternion operator*(const T s) const
     {
         return Tquaternion(a[0] * s, a[1] * s, a[2] * s, a[3] * s);
     }
 
-    inline Tquaternion& operator*=(const T s)
+    constexpr Tquaternion& operator*=(const T s)
     {
-        r *= s;
-        v *= s;
-
-        return *this;
+        return (*this = *this * s);
     }
 
-    inline Tquaternion operator*(const Tquaternion& q) const
+    constexpr Tquaternion operator*(const Tquaternion& q) const
     {
         const T x1 = a[0];
         const T y1 = a[1];
@@ -598,17 +663,14 @@ public:
                            w1 * w2 - x1 * x2 - y1 * y2 - z1 * z2);
     }
 
-    inline Tquaternion operator/(const T s) const
+    constexpr Tquaternion operator/(const T s) const
     {
         return Tquaternion(a[0] / s, a[1] / s, a[2] / s, a[3] / s);
     }
 
-    inline Tquaternion& operator/=(const T s)
+    constexpr Tquaternion& operator/=(const T s)
     {
-        r /= s;
-        v /= s;
-
-        return *this;
+        return (*this = *this / s);
     }
 
     inline operator Tvec4<T>&()
@@ -621,24 +683,27 @@ public:
         return *(const Tvec4<T>*)&a[0];
     }
 
-    inline bool operator==(const Tquaternion& q) const
+    constexpr bool operator==(const Tquaternion& q) const
     {
-        return (r == q.r) && (v == q.v);
+        return (a[0] == q.a[0]) && (a[1] == q.a[1]) && (a[2] == q.a[2]) && (a[3] == q.a[3]);
     }
 
-    inline bool operator!=(const Tquaternion& q) const
+    constexpr bool operator!=(const Tquaternion& q) const
     {
-        return (r != q.r) || (v != q.v);
+        return !(*this == q);
     }
 
-    inline matNM<T,4,4> asMatrix() const
+    constexpr matNM<T,4,4> asMatrix() const
     {
         matNM<T,4,4> m;
 
+        const T x = a[0];
+        const T y = a[1];
+        const T z = a[2];
+        const T w = a[3];
         const T xx = x * x;
         const T yy = y * y;
         const T zz = z * z;
-        const T ww = w * w;
         const T xy = x * y;
         const T xz = x * z;
         const T xw = x * w;
@@ -677,22 +742,9 @@ public:
     */
 
 private:
-    union
-    {
-        struct
-        {
-            T           r;
-            Tvec3<T>    v;
-        };
-        struct
-        {
-            T           x;
-            T           y;
-            T           z;
-            T           w;
-        };
-        T               a[4];
-    };
+    // x, y, z, w. A plain array rather than a union of it with named
+    // members, so that constant expressions can read it.
+    T               a[4];
 };
 
 typedef Tquaternion<float> quaternion;
@@ -701,13 +753,13 @@ typedef Tquaternion<unsigned int> uquaternion;
 typedef Tquaternion<double> dquaternion;
 
 template <typename T>
-static inline Tquaternion<T> operator*(T a, const Tquaternion<T>& b)
+static constexpr Tquaternion<T> operator*(T a, const Tquaternion<T>& b)
 {
     return b * a;
 }
 
 template <typename T>
-static inline Tquaternion<T> operator/(T a, const Tquaternion<T>& b)
+static constexpr Tquaternion<T> operator/(T a, const Tquaternion<T>& b)
 {
     return Tquaternion<T>(a / b[0], a / b[1], a / b[2], a / b[3]);
 }
@@ -725,21 +777,23 @@ public:
     typedef class matNM<T,w,h> my_type;
     typedef class vecN<T,h> vector_type;
 
-    // Default constructor does nothing, just like built-in types
-    inline matNM()
+    // Default constructor zeroes, as vecN's does
+    constexpr matNM()
+        : data()
     {
-        // Uninitialized variable
     }
 
     // Copy constructor
-    inline matNM(const matNM& that)
+    constexpr matNM(const matNM& that)
+        : data()
     {
         assign(that);
     }
 
     // Construction from element type
     // explicit to prevent assignment from T
-    explicit inline matNM(T f)
+    explicit constexpr matNM(T f)
+        : data()
     {
         for (int n = 0; n < w; n++)
         {
@@ -748,7 +802,8 @@ public:
     }
 
     // Construction from vector
-    inline matNM(const vector_type& v)
+    constexpr matNM(const vector_type& v)
+        : data()
     {
         for (int n = 0; n < w; n++)
         {
@@ -757,60 +812,98 @@ public:
     }
 
     // Assignment operator
-    inline matNM& operator=(const my_type& that)
+    constexpr matNM& operator=(const my_type& that)
     {
         assign(that);
         return *this;
     }
 
-    inline matNM operator+(const my_type& that) const
+    constexpr matNM operator+(const my_type& that) const
     {
         my_type result;
-        int n;
-        for (n = 0; n < w; n++)
+        for (int n = 0; n < w; n++)
             result.data[n] = data[n] + that.data[n];
         return result;
     }
 
-    inline my_type& operator+=(const my_type& that)
+    constexpr my_type& operator+=(const my_type& that)
     {
         return (*this = *this + that);
     }
 
-    inline my_type operator-(const my_type& that) const
+    constexpr my_type operator-(const my_type& that) const
     {
         my_type result;
-        int n;
-        for (n = 0; n < w; n++)
+        for (int n = 0; n < w; n++)
             result.data[n] = data[n] - that.data[n];
         return result;
     }
 
-    inline my_type& operator-=(const my_type& that)
+    constexpr my_type& operator-=(const my_type& that)
     {
         return (*this = *this - that);
     }
 
-    inline my_type operator*(const T& that) const
+    constexpr my_type operator*(const T& that) const
     {
         my_type result;
-        int n;
-        for (n = 0; n < w; n++)
+        for (int n = 0; n < w; n++)
             result.data[n] = data[n] * that;
         return result;
     }
 
-    inline my_type& operator*=(const T& that)
+    constexpr my_type& operator*=(const T& that)
     {
-        int n;
-        for (n = 0; n < w; n++)
+        for (int n = 0; n < w; n++)
             data[n] = data[n] * that;
         return *this;
     }
 
     // Matrix multiply.
     // TODO: This only works for square matrices. Need more template skill to make a non-square version.
-    inline my_type operator*(const my_type& that) const
+    constexpr my_type operator*(const my_type& that) const
+    {
+        return multiply_generic(that);
+    }
+
+    constexpr my_type& operator*=(const my_type& that)
+    {
+        return (*this = *this * that);
+    }
+
+    constexpr vector_type& operator[](int n) { return data[n]; }
+    constexpr const vector_type& operator[](int n) const { return data[n]; }
+    constexpr operator T*() { return &data[0][0]; }
+    constexpr operator const T*() const { return &data[0][0]; }
+
+    constexpr matNM<T,h,w> transpose(void) const
+    {
+        return transpose_generic();
+    }
+
+    static constexpr my_type identity()
+    {
+        my_type result(0);
+
+        for (int i = 0; i < w; i++)
+        {
+            result[i][i] = 1;
+        }
+
+        return result;
+    }
+
+    static constexpr int width(void) { return w; }
+    static constexpr int height(void) { return h; }
+
+protected:
+    // Column primary data (essentially, array of vectors). 4x4 matrices of
+    // 32-bit elements are aligned for the SIMD kernels in vmathkernels.h.
+    alignas(w == 4 && h == 4 && sizeof(T) == 4 ? 16 : alignof(vecN<T,h>)) vecN<T,h> data[w];
+
+    // The plain loops behind operator* and transpose, which the float 4x4
+    // versions fall back on in constant expressions
+    constexpr my_type multiply_generic(const my_type& that) const
     {
         my_type result(0);
 
@@ -832,24 +925,13 @@ public:
         return result;
     }
 
-    inline my_type& operator*=(const my_type& that)
-    {
-        return (*this = *this * that);
-    }
-
-    inline vector_type& operator[](int n) { return data[n]; }
-    inline const vector_type& operator[](int n) const { return data[n]; }
-    inline operator T*() { return &data[0][0]; }
-    inline operator const T*() const { return &data[0][0]; }
-
-    inline matNM<T,h,w> transpose(void) const
+    constexpr matNM<T,h,w> transpose_generic(void) const
     {
         matNM<T,h,w> result;
-        int x, y;
 
-        for (y = 0; y < w; y++)
+        for (int y = 0; y < w; y++)
         {
-            for (x = 0; x < h; x++)
+            for (int x = 0; x < h; x++)
             {
                 result[x][y] = data[y][x];
             }
@@ -858,33 +940,57 @@ public:
         return result;
     }
 
-    static inline my_type identity()
+    // Assignment function - called from assignment operator and copy constructor.
+    constexpr void assign(const matNM& that)
     {
-        my_type result(0);
+        for (int n = 0; n < w; n++)
+            data[n] = that.data[n];
+    }
+};
 
-        for (int i = 0; i < w; i++)
-        {
-            result[i][i] = 1;
-        }
+// Float 4x4 products and transposes go through the shared SIMD kernels,
+// except in constant expressions, where the compiler can tell us it is
+// evaluating one; without that they aren't constexpr.
+#if defined(__has_builtin)
+#if __has_builtin(__builtin_is_constant_evaluated)
+#define VMATH_HAS_CONSTANT_EVALUATED 1
+#endif
+#endif
+#if !defined(VMATH_HAS_CONSTANT_EVALUATED) && ((defined(__GNUC__) && __GNUC__ >= 9) || (defined(_MSC_VER) && _MSC_VER >= 1925))
+#define VMATH_HAS_CONSTANT_EVALUATED 1
+#endif
 
-        return result;
-    }
+#ifdef VMATH_HAS_CONSTANT_EVALUATED
+#define VMATH_SIMD_CONSTEXPR constexpr
+#define VMATH_IF_CONSTANT_EVALUATED(x) if (__builtin_is_constant_evaluated()) return x
+#else
+#define VMATH_SIMD_CONSTEXPR inline
+#define VMATH_IF_CONSTANT_EVALUATED(x)
+#endif
 
-    static inline int width(void) { return w; }
-    static inline int height(void) { return h; }
+template <>
+VMATH_SIMD_CONSTEXPR matNM<float,4,4> matNM<float,4,4>::operator*(const matNM<float,4,4>& that) const
+{
+    VMATH_IF_CONSTANT_EVALUATED(multiply_generic(that));
 
-protected:
-    // Column primary data (essentially, array of vectors)
-    vecN<T,h> data[w];
+    matNM<float,4,4> result;
 
-    // Assignment function - called from assignment operator and copy constructor.
-    inline void assign(const matNM& that)
-    {
-        int n;
-        for (n = 0; n < w; n++)
-            data[n] = that.data[n];
-    }
-};
+    mat4_multiply(result, *this, that);
+
+    return result;
+}
+
+template <>
+VMATH_SIMD_CONSTEXPR matNM<float,4,4> matNM<float,4,4>::transpose(void) const
+{
+    VMATH_IF_CONSTANT_EVALUATED(transpose_generic());
+
+    matNM<float,4,4> result;
+
+    mat4_transpose(result, *this);
+
+    return result;
+}
 
 /*
 template <typename T, const int N>
@@ -924,11 +1030,12 @@ public:
     typedef matNM<T,4,4> base;
     typedef Tmat4<T> my_type;
 
-    inline Tmat4() {}
-    inline Tmat4(const my_type& that) : base(that) {}
-    inline Tmat4(const base& that) : base(that) {}
-    inline Tmat4(const vecN<T,4>& v) : base(v) {}
-    inline Tmat4(const vecN<T,4>& v0,
+    constexpr Tmat4() {}
+    constexpr Tmat4(const my_type& that) : base(that) {}
+    constexpr Tmat4& operator=(const my_type& that) = default;
+    constexpr Tmat4(const base& that) : base(that) {}
+    constexpr Tmat4(const vecN<T,4>& v) : base(v) {}
+    constexpr Tmat4(const vecN<T,4>& v0,
                  const vecN<T,4>& v1,
                  const vecN<T,4>& v2,
                  const vecN<T,4>& v3)
@@ -952,11 +1059,12 @@ public:
     typedef matNM<T,3,3> base;
     typedef Tmat3<T> my_type;
 
-    inline Tmat3() {}
-    inline Tmat3(const my_type& that) : base(that) {}
-    inline Tmat3(const base& that) : base(that) {}
-    inline Tmat3(const vecN<T,3>& v) : base(v) {}
-    inline Tmat3(const vecN<T,3>& v0,
+    constexpr Tmat3() {}
+    constexpr Tmat3(const my_type& that) : base(that) {}
+    constexpr Tmat3& operator=(const my_type& that) = default;
+    constexpr Tmat3(const base& that) : base(that) {}
+    constexpr Tmat3(const vecN<T,3>& v) : base(v) {}
+    constexpr Tmat3(const vecN<T,3>& v0,
                  const vecN<T,3>& v1,
                  const vecN<T,3>& v2)
     {
@@ -978,11 +1086,11 @@ public:
     typedef matNM<T,2,2> base;
     typedef Tmat2<T> my_type;
 
-    inline Tmat2() {}
-    inline Tmat2(const my_type& that) : base(that) {}
-    inline Tmat2(const base& that) : base(that) {}
-    inline Tmat2(const vecN<T,2>& v) : base(v) {}
-    inline Tmat2(const vecN<T,2>& v0,
+    constexpr Tmat2() {}
+    constexpr Tmat2(const my_type& that) : base(that) {}
+    constexpr Tmat2(const base& that) : base(that) {}
+    constexpr Tmat2(const vecN<T,2>& v) : base(v) {}
+    constexpr Tmat2(const vecN<T,2>& v0,
                  const vecN<T,2>& v1)
     {
         base::data[0] = v0;
@@ -992,7 +1100,7 @@ public:
 
 typedef Tmat2<float> mat2;
 
-static inline mat4 frustum(float left, float right, float bottom, float top, float n, float f)
+static constexpr mat4 frustum(float left, float right, float bottom, float top, float n, float f)
 {
     mat4 result(mat4::identity());
 
@@ -1034,16 +1142,16 @@ static inline mat4 perspective(float fovy, float aspect, float n, float f)
     return result;
 }
 
-static inline mat4 ortho(float left, float right, float bottom, float top, float n, float f)
+static constexpr mat4 ortho(float left, float right, float bottom, float top, float n, float f)
 {
     return mat4( vec4(2.0f / (right - left), 0.0f, 0.0f, 0.0f),
                  vec4(0.0f, 2.0f / (top - bottom), 0.0f, 0.0f),
                  vec4(0.0f, 0.0f, 2.0f / (n - f), 0.0f),
-                 vec4((left + right) / (left - right), (bottom + top) / (bottom - top), (n + f) / (f - n), 1.0f) );
+                 vec4((left + right) / (left - right), (bottom + top) / (bottom - top), (n + f) / (n - f), 1.0f) );
 }
 
 template <typename T>
-static inline Tmat4<T> translate(T x, T y, T z)
+static constexpr Tmat4<T> translate(T x, T y, T z)
 {
     return Tmat4<T>(Tvec4<T>(1.0f, 0.0f, 0.0f, 0.0f),
                     Tvec4<T>(0.0f, 1.0f, 0.0f, 0.0f),
@@ -1052,7 +1160,7 @@ static inline Tmat4<T> translate(T x, T y, T z)
 }
 
 template <typename T>
-static inline Tmat4<T> translate(const vecN<T,3>& v)
+static constexpr Tmat4<T> translate(const vecN<T,3>& v)
 {
     return translate(v[0], v[1], v[2]);
 }
@@ -1062,7 +1170,7 @@ static inline Tmat4<T> lookat(const vecN<T,3>& eye, const vecN<T,3>& center, con
 {
     const Tvec3<T> f = normalize(center - eye);
     const Tvec3<T> upN = normalize(up);
-    const Tvec3<T> s = cross(f, upN);
+    const Tvec3<T> s = normalize(cross(f, upN));
     const Tvec3<T> u = cross(s, f);
     const Tmat4<T> M = Tmat4<T>(Tvec4<T>(s[0], u[0], -f[0], T(0)),
                                 Tvec4<T>(s[1], u[1], -f[1], T(0)),
@@ -1073,7 +1181,7 @@ static inline Tmat4<T> lookat(const vecN<T,3>& eye, const vecN<T,3>& center, con
 }
 
 template <typename T>
-static inline Tmat4<T> scale(T x, T y, T z)
+static constexpr Tmat4<T> scale(T x, T y, T z)
 {
     return Tmat4<T>(Tvec4<T>(x, 0.0f, 0.0f, 0.0f),
                     Tvec4<T>(0.0f, y, 0.0f, 0.0f),
@@ -1082,13 +1190,13 @@ static inline Tmat4<T> scale(T x, T y, T z)
 }
 
 template <typename T>
-static inline Tmat4<T> scale(const Tvec3<T>& v)
+static constexpr Tmat4<T> scale(const Tvec3<T>& v)
 {
     return scale(v[0], v[1], v[2]);
 }
 
 template <typename T>
-static inline Tmat4<T> scale(T x)
+static constexpr Tmat4<T> scale(T x)
 {
     return Tmat4<T>(Tvec4<T>(x, 0.0f, 0.0f, 0.0f),
                     Tvec4<T>(0.0f, x, 0.0f, 0.0f),
@@ -1136,7 +1244,7 @@ static inline Tmat4<T> rotate(T angle_x, T angle_y, T angle_z)
 #endif
 
 template <typename T>
-static inline T min(T a, T b)
+static constexpr T min(T a, T b)
 {
     return a < b ? a : b;
 }
@@ -1146,18 +1254,17 @@ static inline T min(T a, T b)
 #endif
 
 template <typename T>
-static inline T max(T a, T b)
+static constexpr T max(T a, T b)
 {
     return a >= b ? a : b;
 }
 
 template <typename T, const int N>
-static inline vecN<T,N> min(const vecN<T,N>& x, const vecN<T,N>& y)
+static constexpr vecN<T,N> min(const vecN<T,N>& x, const vecN<T,N>& y)
 {
     vecN<T,N> t;
-    int n;
 
-    for (n = 0; n < N; n++)
+    for (int n = 0; n < N; n++)
     {
         t[n] = min(x[n], y[n]);
     }
@@ -1166,12 +1273,11 @@ static inline vecN<T,N> min(const vecN<T,N>& x, const vecN<T,N>& y)
 }
 
 template <typename T, const int N>
-static inline vecN<T,N> max(const vecN<T,N>& x, const vecN<T,N>& y)
+static constexpr vecN<T,N> max(const vecN<T,N>& x, const vecN<T,N>& y)
 {
     vecN<T,N> t;
-    int n;
 
-    for (n = 0; n < N; n++)
+    for (int n = 0; n < N; n++)
     {
         t[n] = max<T>(x[n], y[n]);
     }
@@ -1180,13 +1286,13 @@ static inline vecN<T,N> max(const vecN<T,N>& x, const vecN<T,N>& y)
 }
 
 template <typename T, const int N>
-static inline vecN<T,N> clamp(const vecN<T,N>& x, const vecN<T,N>& minVal, const vecN<T,N>& maxVal)
+static constexpr vecN<T,N> clamp(const vecN<T,N>& x, const vecN<T,N>& minVal, const vecN<T,N>& maxVal)
 {
     return min<T>(max<T>(x, minVal), maxVal);
 }
 
 template <typename T, const int N>
-static inline vecN<T,N> smoothstep(const vecN<T,N>& edge0, const vecN<T,N>& edge1, const vecN<T,N>& x)
+static constexpr vecN<T,N> smoothstep(const vecN<T,N>& edge0, const vecN<T,N>& edge1, const vecN<T,N>& x)
 {
     vecN<T,N> t;
     t = clamp((x - edge0) / (edge1 - edge0), vecN<T,N>(T(0)), vecN<T,N>(T(1)));
@@ -1194,7 +1300,7 @@ static inline vecN<T,N> smoothstep(const vecN<T,N>& edge0, const vecN<T,N>& edge
 }
 
 template <typename T, const int S>
-static inline vecN<T,S> reflect(const vecN<T,S>& I, const vecN<T,S>& N)
+static constexpr vecN<T,S> reflect(const vecN<T,S>& I, const vecN<T,S>& N)
 {
     return I - 2 * dot(N, I) * N;
 }
@@ -1215,14 +1321,13 @@ static inline vecN<T,S> refract(const vecN<T,S>& I, const vecN<T,S>& N, T eta)
 }
 
 template <typename T, const int N, const int M>
-static inline matNM<T,N,M> matrixCompMult(const matNM<T,N,M>& x, const matNM<T,N,M>& y)
+static constexpr matNM<T,N,M> matrixCompMult(const matNM<T,N,M>& x, const matNM<T,N,M>& y)
 {
     matNM<T,N,M> result;
-    int i, j;
 
-    for (j = 0; j < M; ++j)
+    for (int j = 0; j < M; ++j)
     {
-        for (i = 0; i < N; ++i)
+        for (int i = 0; i < N; ++i)
         {
             result[i][j] = x[i][j] * y[i][j];
         }
@@ -1232,14 +1337,13 @@ static inline matNM<T,N,M> matrixCompMult(const matNM<T,N,M>& x, const matNM<T,N
 }
 
 template <typename T, const int N, const int M>
-static inline vecN<T,N> operator*(const vecN<T,M>& vec, const matNM<T,N,M>& mat)
+static constexpr vecN<T,N> operator*(const vecN<T,M>& vec, const matNM<T,N,M>& mat)
 {
-    int n, m;
     vecN<T,N> result(T(0));
 
-    for (m = 0; m < M; m++)
+    for (int m = 0; m < M; m++)
     {
-        for (n = 0; n < N; n++)
+        for (int n = 0; n < N; n++)
         {
             result[n] += vec[m] * mat[n][m];
         }
@@ -1248,13 +1352,23 @@ static inline vecN<T,N> operator*(const vecN<T,M>& vec, const matNM<T,N,M>& mat)
     return result;
 }
 
+static VMATH_SIMD_CONSTEXPR vecN<float,4> operator*(const vecN<float,4>& vec, const matNM<float,4,4>& mat)
+{
+    VMATH_IF_CONSTANT_EVALUATED((operator*<float,4,4>(vec, mat)));
+
+    vecN<float,4> result;
+
+    mat4_transform_transposed(&result[0], mat, vec);
+
+    return result;
+}
+
 template <typename T, const int N>
-static inline vecN<T,N> operator/(const T s, const vecN<T,N>& v)
+static constexpr vecN<T,N> operator/(const T s, const vecN<T,N>& v)
 {
-    int n;
     vecN<T,N> result;
 
-    for (n = 0; n < N; n++)
+    for (int n = 0; n < N; n++)
     {
         result[n] = s / v[n];
     }
@@ -1289,23 +1403,384 @@ static inline void quaternionToMatrix(const Tquaternion<T>& q, matNM<T,4,4>& m)
 */
 
 template <typename T>
-static inline void quaternionToMatrix(const Tquaternion<T>& q, matNM<T,4,4>& m)
+static constexpr void quaternionToMatrix(const Tquaternion<T>& q, matNM<T,4,4>& m)
 {
     m = q.asMatrix();
 }
 
+// Inverses, normal matrices and translate * rotate * scale. The templates
+// work for any type (a dmat4 makes a good reference for the float ones);
+// float matrices use the SSE kernels in vmathkernels.h instead. A singular
+// matrix has no inverse and gets the identity back, so check determinant
+// first where that matters.
+template <typename T>
+static constexpr T determinant(const matNM<T,4,4>& m)
+{
+    const T t0 = m[2][0] * m[3][1] - m[3][0] * m[2][1], t1 = m[2][0] * m[3][2] - m[3][0] * m[2][2];
+    const T t2 = m[2][0] * m[3][3] - m[3][0] * m[2][3], t3 = m[2][1] * m[3][2] - m[3][1] * m[2][2];
+    const T t4 = m[2][1] * m[3][3] - m[3][1] * m[2][3], t5 = m[2][2] * m[3][3] - m[3][2] * m[2][3];
+
+    return m[0][0] * (m[1][1] * t5 - m[1][2] * t4 + m[1][3] * t3) -
+           m[0][1] * (m[1][0] * t5 - m[1][2] * t2 + m[1][3] * t1) +
+           m[0][2] * (m[1][0] * t4 - m[1][1] * t2 + m[1][3] * t0) -
+           m[0][3] * (m[1][0] * t3 - m[1][1] * t1 + m[1][2] * t0);
+}
+
+template <typename T>
+static constexpr Tmat4<T> inverse(const matNM<T,4,4>& m)
+{
+    const vecN<T,4>& a = m[0];
+    const vecN<T,4>& b = m[1];
+    const vecN<T,4>& c = m[2];
+    const vecN<T,4>& d = m[3];
+    const T s0 = a[0] * b[1] - b[0] * a[1], s1 = a[0] * b[2] - b[0] * a[2];
+    const T s2 = a[0] * b[3] - b[0] * a[3], s3 = a[1] * b[2] - b[1] * a[2];
+    const T s4 = a[1] * b[3] - b[1] * a[3], s5 = a[2] * b[3] - b[2] * a[3];
+    const T t0 = c[0] * d[1] - d[0] * c[1], t1 = c[0] * d[2] - d[0] * c[2];
+    const T t2 = c[0] * d[3] - d[0] * c[3], t3 = c[1] * d[2] - d[1] * c[2];
+    const T t4 = c[1] * d[3] - d[1] * c[3], t5 = c[2] * d[3] - d[2] * c[3];
+    Tmat4<T> result;
+
+    result[0][0] = b[1] * t5 - b[2] * t4 + b[3] * t3;
+    result[1][0] = -(b[0] * t5 - b[2] * t2 + b[3] * t1);
+    result[2][0] = b[0] * t4 - b[1] * t2 + b[3] * t0;
+    result[3][0] = -(b[0] * t3 - b[1] * t1 + b[2] * t0);
+
+    const T det = a[0] * result[0][0] + a[1] * result[1][0] + a[2] * result[2][0] + a[3] * result[3][0];
+
+    if (det == T(0))
+        return Tmat4<T>::identity();
+
+    result[0][1] = -(a[1] * t5 - a[2] * t4 + a[3] * t3);
+    result[1][1] = a[0] * t5 - a[2] * t2 + a[3] * t1;
+    result[2][1] = -(a[0] * t4 - a[1] * t2 + a[3] * t0);
+    result[3][1] = a[0] * t3 - a[1] * t1 + a[2] * t0;
+    result[0][2] = d[1] * s5 - d[2] * s4 + d[3] * s3;
+    result[1][2] = -(d[0] * s5 - d[2] * s2 + d[3] * s1);
+    result[2][2] = d[0] * s4 - d[1] * s2 + d[3] * s0;
+    result[3][2] = -(d[0] * s3 - d[1] * s1 + d[2] * s0);
+    result[0][3] = -(c[1] * s5 - c[2] * s4 + c[3] * s3);
+    result[1][3] = c[0] * s5 - c[2] * s2 + c[3] * s1;
+    result[2][3] = -(c[0] * s4 - c[1] * s2 + c[3] * s0);
+    result[3][3] = c[0] * s3 - c[1] * s1 + c[2] * s0;
+
+    return result * (T(1) / det);
+}
+
+// The inverse transpose of the upper 3x3 of m, which takes normals to
+// where m takes the surfaces they belong to. mat3(m) only does that while
+// m's scale is the same in every direction. Its columns are the cross
+// products of m's first three columns over their determinant.
+template <typename T>
+static constexpr Tmat3<T> inverseTranspose3x3(const matNM<T,4,4>& m)
+{
+    const Tvec3<T> c0(m[0][0], m[0][1], m[0][2]);
+    const Tvec3<T> c1(m[1][0], m[1][1], m[1][2]);
+    const Tvec3<T> c2(m[2][0], m[2][1], m[2][2]);
+    const Tvec3<T> r0 = cross(c1, c2);
+    const T det = dot(c0, r0);
+
+    if (det == T(0))
+        return Tmat3<T>::identity();
+
+    const T scale = T(1) / det;
+
+    return Tmat3<T>(r0 * scale, cross(c2, c0) * scale, cross(c0, c1) * scale);
+}
+
+// The inverse of a matrix whose last row is 0, 0, 0, 1 - any mix of
+// rotations, scales, shears and translations. The rows of the inverse of
+// the upper 3x3 are the columns of its inverse transpose, and the
+// translation goes back through them.
+template <typename T>
+static constexpr Tmat4<T> affineInverse(const matNM<T,4,4>& m)
+{
+    const Tvec3<T> c0(m[0][0], m[0][1], m[0][2]);
+    const Tvec3<T> c1(m[1][0], m[1][1], m[1][2]);
+    const Tvec3<T> c2(m[2][0], m[2][1], m[2][2]);
+    const Tvec3<T> t(m[3][0], m[3][1], m[3][2]);
+    Tvec3<T> r0 = cross(c1, c2);
+    const T det = dot(c0, r0);
+
+    if (det == T(0))
+        return Tmat4<T>::identity();
+
+    const T scale = T(1) / det;
+    const Tvec3<T> r1 = cross(c2, c0) * scale;
+    const Tvec3<T> r2 = cross(c0, c1) * scale;
+
+    r0 *= scale;
+
+    return Tmat4<T>(Tvec4<T>(r0[0], r1[0], r2[0], T(0)),
+                    Tvec4<T>(r0[1], r1[1], r2[1], T(0)),
+                    Tvec4<T>(r0[2], r1[2], r2[2], T(0)),
+                    Tvec4<T>(-dot(r0, t), -dot(r1, t), -dot(r2, t), T(1)));
+}
+
+static VMATH_SIMD_CONSTEXPR float determinant(const matNM<float,4,4>& m)
+{
+    VMATH_IF_CONSTANT_EVALUATED(determinant<float>(m));
+
+    return mat4_determinant(m);
+}
+
+static VMATH_SIMD_CONSTEXPR Tmat4<float> inverse(const matNM<float,4,4>& m)
+{
+    VMATH_IF_CONSTANT_EVALUATED(inverse<float>(m));
+
+    Tmat4<float> result;
+
+    if (mat4_inverse(&result[0][0], m) == 0.0f)
+        return Tmat4<float>::identity();
+
+    return result;
+}
+
+static VMATH_SIMD_CONSTEXPR Tmat3<float> inverseTranspose3x3(const matNM<float,4,4>& m)
+{
+    VMATH_IF_CONSTANT_EVALUATED(inverseTranspose3x3<float>(m));
+
+    Tmat3<float> result;
+
+    if (mat4_inverse_transpose3x3(&result[0][0], m) == 0.0f)
+        return Tmat3<float>::identity();
+
+    return result;
+}
+
+static VMATH_SIMD_CONSTEXPR Tmat4<float> affineInverse(const matNM<float,4,4>& m)
+{
+    VMATH_IF_CONSTANT_EVALUATED(affineInverse<float>(m));
+
+    Tmat4<float> result;
+
+    if (mat4_affine_inverse(&result[0][0], m) == 0.0f)
+        return Tmat4<float>::identity();
+
+    return result;
+}
+
+// Batches of 'count' matrices. 'result' may be 'm' for the mat4 ones. Each
+// returns how many of the matrices were singular (and got the identity).
+// With AVX, inverse does two matrices at a time.
+static inline int inverse(const mat4 * m, mat4 * result, int count)
+{
+    static_assert(sizeof(mat4) == 16 * sizeof(float), "mat4 must be 16 packed floats");
+
+    return mat4_inverse_batch(&result[0][0][0], m[0], count);
+}
+
+static inline int affineInverse(const mat4 * m, mat4 * result, int count)
+{
+    int singular = 0;
+    int n;
+
+    for (n = 0; n < count; n++)
+    {
+        if (mat4_affine_inverse(&result[n][0][0], m[n]) == 0.0f)
+        {
+            result[n] = mat4::identity();
+            singular++;
+        }
+    }
+
+    return singular;
+}
+
+static inline int inverseTranspose3x3(const mat4 * m, mat3 * result, int count)
+{
+    static_assert(sizeof(mat3) == 9 * sizeof(float), "mat3 must be 9 packed floats");
+    int singular = 0;
+    int n;
+
+    for (n = 0; n < count; n++)
+    {
+        if (mat4_inverse_transpose3x3(&result[n][0][0], m[n]) == 0.0f)
+        {
+            result[n] = mat3::identity();
+            singular++;
+        }
+    }
+
+    return singular;
+}
+
+// Builds translate(t) * rotation * scale(s), the order of a JointPose in
+// vskeleton.h. The rotation is that of the unit quaternion q = (x, y, z, w),
+// w real, taking v to q v q* by the quaternion product above.
 template <typename T>
-static inline T mix(const T& A, const T& B, typename T::element_type t)
+static constexpr Tmat4<T> composeTRS(const vecN<T,3>& t, const Tquaternion<T>& q, const vecN<T,3>& s)
 {
-    return B + t * (B - A);
+    const T x = q[0], y = q[1], z = q[2], w = q[3];
+
+    return Tmat4<T>(Tvec4<T>((T(1) - T(2) * (y * y + z * z)) * s[0], T(2) * (x * y + w * z) * s[0], T(2) * (x * z - w * y) * s[0], T(0)),
+                    Tvec4<T>(T(2) * (x * y - w * z) * s[1], (T(1) - T(2) * (x * x + z * z)) * s[1], T(2) * (y * z + w * x) * s[1], T(0)),
+                    Tvec4<T>(T(2) * (x * z + w * y) * s[2], T(2) * (y * z - w * x) * s[2], (T(1) - T(2) * (x * x + y * y)) * s[2], T(0)),
+                    Tvec4<T>(t[0], t[1], t[2], T(1)));
 }
 
+// Splits an affine m back into what composeTRS takes. The scales are the
+// lengths of the first three columns, x made negative if m is a reflection,
+// and the rotation comes from the largest of the quaternion's elements, as
+// found from the trace and diagonal of what's left. Shear can't be split
+// this way and is lost. Returns false, and sets nothing, if a scale is zero.
 template <typename T>
-static inline T mix(const T& A, const T& B, const T& t)
+static inline bool decomposeTRS(const matNM<T,4,4>& m, vecN<T,3>& t, Tquaternion<T>& q, vecN<T,3>& s)
 {
-    return B + t * (B - A);
+    Tvec3<T> c0(m[0][0], m[0][1], m[0][2]);
+    Tvec3<T> c1(m[1][0], m[1][1], m[1][2]);
+    Tvec3<T> c2(m[2][0], m[2][1], m[2][2]);
+    T sx = length(c0);
+    const T sy = length(c1);
+    const T sz = length(c2);
+
+    if (sx == T(0) || sy == T(0) || sz == T(0))
+        return false;
+
+    if (dot(c0, cross(c1, c2)) < T(0))
+        sx = -sx;
+
+    c0 /= sx;
+    c1 /= sy;
+    c2 /= sz;
+
+    // r_ij is row i, column j of the rotation
+    const T r00 = c0[0], r10 = c0[1], r20 = c0[2];
+    const T r01 = c1[0], r11 = c1[1], r21 = c1[2];
+    const T r02 = c2[0], r12 = c2[1], r22 = c2[2];
+    const T trace = r00 + r11 + r22;
+    T x, y, z, w;
+
+    if (trace > T(0))
+    {
+        const T k = T(0.5) / sqrt(trace + T(1));
+
+        w = T(0.25) / k;
+        x = (r21 - r12) * k;
+        y = (r02 - r20) * k;
+        z = (r10 - r01) * k;
+    }
+    else if (r00 > r11 && r00 > r22)
+    {
+        const T k = T(0.5) / sqrt(T(1) + r00 - r11 - r22);
+
+        w = (r21 - r12) * k;
+        x = T(0.25) / k;
+        y = (r01 + r10) * k;
+        z = (r02 + r20) * k;
+    }
+    else if (r11 > r22)
+    {
+        const T k = T(0.5) / sqrt(T(1) + r11 - r00 - r22);
+
+        w = (r02 - r20) * k;
+        x = (r01 + r10) * k;
+        y = T(0.25) / k;
+        z = (r12 + r21) * k;
+    }
+    else
+    {
+        const T k = T(0.5) / sqrt(T(1) + r22 - r00 - r11);
+
+        w = (r10 - r01) * k;
+        x = (r02 + r20) * k;
+        y = (r12 + r21) * k;
+        z = T(0.25) / k;
+    }
+
+    const T scale = T(1) / sqrt(x * x + y * y + z * z + w * w);
+
+    t = Tvec3<T>(m[3][0], m[3][1], m[3][2]);
+    q = Tquaternion<T>(x * scale, y * scale, z * scale, w * scale);
+    s = Tvec3<T>(sx, sy, sz);
+
+    return true;
 }
 
+// Distributions over the counter-based streams. Each value depends only on
+// the key and its counter, so they can be generated in any order or in
+// parallel and come out the same. random_normal uses Box-Muller: values
+// 2n and 2n + 1 share counters 2n and 2n + 1. random_on_sphere uses counters
+// 2n and 2n + 1.
+static constexpr float random_uniform(unsigned int key, unsigned int counter)
+{
+    return random_bits_to_float(random_bits(key, counter));
+}
+
+// The transforms from random bits, shared with the bulk fills in vrandom.h
+static inline float random_normal_from_bits(unsigned int even, unsigned int odd, bool second)
+{
+    const float u = 1.0f - random_bits_to_float(even);      // (0, 1], for the log
+    const float v = random_bits_to_float(odd);
+    const float r = sqrtf(-2.0f * logf(u));
+    const float theta = 6.28318530717958647692f * v;
+
+    return r * (second ? sinf(theta) : cosf(theta));
+}
+
+static inline vec3 random_on_sphere_from_bits(unsigned int even, unsigned int odd)
+{
+    const float z = 1.0f - 2.0f * random_bits_to_float(even);
+    const float phi = 6.28318530717958647692f * random_bits_to_float(odd);
+    const float s = 1.0f - z * z;
+    const float r = s > 0.0f ? sqrtf(s) : 0.0f;
+
+    return vec3(r * cosf(phi), r * sinf(phi), z);
+}
+
+static inline float random_normal(unsigned int key, unsigned int counter)
+{
+    const unsigned int pair = counter & ~1u;
+
+    return random_normal_from_bits(random_bits(key, pair), random_bits(key, pair + 1), (counter & 1) != 0);
+}
+
+static inline vec3 random_on_sphere(unsigned int key, unsigned int counter)
+{
+    return random_on_sphere_from_bits(random_bits(key, counter * 2), random_bits(key, counter * 2 + 1));
+}
+
+template <typename T>
+static constexpr T mix(const T& A, const T& B, typename T::element_type t)
+{
+    return A + t * (B - A);
+}
+
+template <typename T>
+static constexpr T mix(const T& A, const T& B, const T& t)
+{
+    return A + t * (B - A);
+}
+
+// Everything but the trigonometry, square roots and the shared random
+// sequence is constexpr, so constant transforms and tables can be worked
+// out by the compiler and kept in read-only data. These check that it
+// still is, and that it gets the right answers, where the mat4 products
+// can be constexpr at all.
+#ifdef VMATH_HAS_CONSTANT_EVALUATED
+namespace constexpr_checks
+{
+
+static constexpr mat4 model = translate(1.0f, 2.0f, 3.0f) * scale(2.0f, 4.0f, 8.0f);
+static constexpr vec4 corner = vec4(1.0f, 1.0f, 1.0f, 1.0f) * model.transpose();
+static constexpr mat4 model_inverse = inverse(model);
+static constexpr mat4 view_inverse = affineInverse(model);
+static constexpr mat4 projection = ortho(-1.0f, 1.0f, -1.0f, 1.0f, 1.0f, 3.0f);
+
+static_assert(mat4::identity()[2][2] == 1.0f && mat4::identity()[2][3] == 0.0f, "identity");
+static_assert(corner[0] == 3.0f && corner[1] == 6.0f && corner[2] == 11.0f && corner[3] == 1.0f, "translate * scale");
+static_assert(determinant(model) == 64.0f, "determinant");
+static_assert(model_inverse[0][0] == 0.5f && model_inverse[3][2] == -0.375f, "inverse");
+static_assert(view_inverse[1][1] == 0.25f && view_inverse[3][1] == -0.5f, "affineInverse");
+static_assert(projection[2][2] == -1.0f && projection[3][2] == -2.0f, "ortho");
+static_assert(cross(vec3(1.0f, 0.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f))[2] == 1.0f, "cross");
+static_assert((quaternion(0.0f, 0.0f, 1.0f, 0.0f) * quaternion(0.0f, 0.0f, 1.0f, 0.0f))[3] == -1.0f, "quaternion product");
+static_assert(random_bits(0, 0) == 0x6627E8D5u, "Philox4x32-10 known answer");
+static_assert(random_uniform(1, 2) >= 0.0f && random_uniform(1, 2) < 1.0f, "random_uniform");
+
+}
+#endif
+
 };
 
 #endif /* __VMATH_H__ */
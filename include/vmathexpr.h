@@ -0,0 +1,530 @@
+#ifndef __VMATHEXPR_H__
+#define __VMATHEXPR_H__
+
+#include "vmath.h"
+
+#include <type_traits>
+
+// Opt-in expression templates for vmath, in namespace vmath::expr. Nothing
+// in vmath.h changes; code that wants them asks for them by name.
+//
+// Vectors: lazy(v) wraps a vecN so that arithmetic on it builds a tree of
+// small objects instead of a vecN per operator. The tree is evaluated, one
+// element at a time in a single loop, when it's assigned to a vecN:
+//
+//     vec4 r = lazy(a) * s + b - c * d;
+//
+// The tree refers to the vecNs it was built from, so it must be evaluated
+// before they go away - don't keep one in an 'auto' variable.
+//
+// Matrices: rotate, translate and scale here make small structured types
+// that know which of their elements are zero or one, rather than mat4s.
+// Their products stay structured - two rotations make a 3x3 linear map, a
+// rotation and a translation an affine one - and the constant elements
+// drop out of the arithmetic, so a chain of them costs a fraction of the
+// 4x4 products. to_mat4 makes a mat4 of one, and they multiply with mat4s
+// either side using only their non-constant elements.
+
+namespace vmath
+{
+
+namespace expr
+{
+
+// Vector expressions. Each node has an element_type, a size and an
+// operator[] that works out one element. With SSE, packet() works out all
+// four elements of a float expression at once, which is how those are
+// evaluated; it's only instantiated for them.
+template <typename E>
+struct VecExpr
+{
+    inline const E& self(void) const { return static_cast<const E&>(*this); }
+};
+
+template <typename T, const int N>
+struct VecLeaf : public VecExpr<VecLeaf<T,N> >
+{
+    typedef T element_type;
+    enum { size = N };
+
+    inline explicit VecLeaf(const vecN<T,N>& v_) : v(v_) {}
+    inline T operator[](int n) const { return v[n]; }
+#if defined(VMATH_SSE2)
+    inline __m128 packet(void) const { return _mm_loadu_ps(&v[0]); }
+#endif
+
+    const vecN<T,N>& v;
+};
+
+template <typename T, const int N>
+struct VecScalar : public VecExpr<VecScalar<T,N> >
+{
+    typedef T element_type;
+    enum { size = N };
+
+    inline explicit VecScalar(T s_) : s(s_) {}
+    inline T operator[](int) const { return s; }
+#if defined(VMATH_SSE2)
+    inline __m128 packet(void) const { return _mm_set1_ps(s); }
+#endif
+
+    T s;
+};
+
+#if defined(VMATH_SSE2)
+struct OpAdd { template <typename T> static inline T apply(T a, T b) { return a + b; } static inline __m128 apply(__m128 a, __m128 b) { return _mm_add_ps(a, b); } };
+struct OpSub { template <typename T> static inline T apply(T a, T b) { return a - b; } static inline __m128 apply(__m128 a, __m128 b) { return _mm_sub_ps(a, b); } };
+struct OpMul { template <typename T> static inline T apply(T a, T b) { return a * b; } static inline __m128 apply(__m128 a, __m128 b) { return _mm_mul_ps(a, b); } };
+struct OpDiv { template <typename T> static inline T apply(T a, T b) { return a / b; } static inline __m128 apply(__m128 a, __m128 b) { return _mm_div_ps(a, b); } };
+#else
+struct OpAdd { template <typename T> static inline T apply(T a, T b) { return a + b; } };
+struct OpSub { template <typename T> static inline T apply(T a, T b) { return a - b; } };
+struct OpMul { template <typename T> static inline T apply(T a, T b) { return a * b; } };
+struct OpDiv { template <typename T> static inline T apply(T a, T b) { return a / b; } };
+#endif
+
+// Evaluates an expression into a vecN, or a Tvec2, 3 or 4
+template <typename V, typename E>
+static inline V evaluate_as(const VecExpr<E>& e);
+
+template <typename Op, typename A, typename B>
+struct VecBinary : public VecExpr<VecBinary<Op,A,B> >
+{
+    typedef typename A::element_type element_type;
+    enum { size = A::size };
+
+    inline VecBinary(const A& a_, const B& b_) : a(a_), b(b_) {}
+    inline element_type operator[](int n) const { return Op::apply(a[n], b[n]); }
+#if defined(VMATH_SSE2)
+    inline __m128 packet(void) const { return Op::apply(a.packet(), b.packet()); }
+#endif
+    template <typename V, typename = typename std::enable_if<std::is_base_of<vecN<element_type,size>, V>::value>::type>
+    inline operator V() const { return evaluate_as<V>(*this); }
+
+    const A a;
+    const B b;
+};
+
+template <typename A>
+struct VecNegate : public VecExpr<VecNegate<A> >
+{
+    typedef typename A::element_type element_type;
+    enum { size = A::size };
+
+    inline explicit VecNegate(const A& a_) : a(a_) {}
+    inline element_type operator[](int n) const { return -a[n]; }
+#if defined(VMATH_SSE2)
+    inline __m128 packet(void) const { return _mm_xor_ps(_mm_set1_ps(-0.0f), a.packet()); }
+#endif
+    template <typename V, typename = typename std::enable_if<std::is_base_of<vecN<element_type,size>, V>::value>::type>
+    inline operator V() const { return evaluate_as<V>(*this); }
+
+    const A a;
+};
+
+template <typename T, const int N>
+struct Evaluator
+{
+    template <typename V, typename E>
+    static inline void evaluate(V& result, const E& e)
+    {
+        int n;
+
+        for (n = 0; n < N; n++)
+            result[n] = e[n];
+    }
+};
+
+#if defined(VMATH_SSE2)
+template <>
+struct Evaluator<float,4>
+{
+    template <typename V, typename E>
+    static inline void evaluate(V& result, const E& e)
+    {
+        _mm_storeu_ps(&result[0], e.packet());
+    }
+};
+#endif
+
+template <typename V, typename E>
+static inline V evaluate_as(const VecExpr<E>& e)
+{
+    V result;
+
+    Evaluator<typename E::element_type, E::size>::evaluate(result, e.self());
+
+    return result;
+}
+
+template <typename E>
+static inline vecN<typename E::element_type, E::size> evaluate(const VecExpr<E>& e)
+{
+    return evaluate_as<vecN<typename E::element_type, E::size> >(e);
+}
+
+template <typename T, const int N>
+static inline VecLeaf<T,N> lazy(const vecN<T,N>& v)
+{
+    return VecLeaf<T,N>(v);
+}
+
+#define VMATH_EXPR_OPERATOR(op, Op)                                                             \
+template <typename A, typename B>                                                               \
+static inline VecBinary<Op,A,B> operator op(const VecExpr<A>& a, const VecExpr<B>& b)           \
+{                                                                                               \
+    return VecBinary<Op,A,B>(a.self(), b.self());                                               \
+}                                                                                               \
+                                                                                                \
+template <typename A, typename T, const int N>                                                  \
+static inline VecBinary<Op,A,VecLeaf<T,N> > operator op(const VecExpr<A>& a, const vecN<T,N>& b) \
+{                                                                                               \
+    return VecBinary<Op,A,VecLeaf<T,N> >(a.self(), VecLeaf<T,N>(b));                            \
+}                                                                                               \
+                                                                                                \
+template <typename T, const int N, typename B>                                                  \
+static inline VecBinary<Op,VecLeaf<T,N>,B> operator op(const vecN<T,N>& a, const VecExpr<B>& b) \
+{                                                                                               \
+    return VecBinary<Op,VecLeaf<T,N>,B>(VecLeaf<T,N>(a), b.self());                             \
+}                                                                                               \
+                                                                                                \
+template <typename A>                                                                           \
+static inline VecBinary<Op,A,VecScalar<typename A::element_type,A::size> >                      \
+operator op(const VecExpr<A>& a, typename A::element_type s)                                    \
+{                                                                                               \
+    typedef VecScalar<typename A::element_type,A::size> S;                                      \
+    return VecBinary<Op,A,S>(a.self(), S(s));                                                   \
+}                                                                                               \
+                                                                                                \
+template <typename B>                                                                           \
+static inline VecBinary<Op,VecScalar<typename B::element_type,B::size>,B>                       \
+operator op(typename B::element_type s, const VecExpr<B>& b)                                    \
+{                                                                                               \
+    typedef VecScalar<typename B::element_type,B::size> S;                                      \
+    return VecBinary<Op,S,B>(S(s), b.self());                                                   \
+}
+
+VMATH_EXPR_OPERATOR(+, OpAdd)
+VMATH_EXPR_OPERATOR(-, OpSub)
+VMATH_EXPR_OPERATOR(*, OpMul)
+VMATH_EXPR_OPERATOR(/, OpDiv)
+
+#undef VMATH_EXPR_OPERATOR
+
+template <typename A>
+static inline VecNegate<A> operator-(const VecExpr<A>& a)
+{
+    return VecNegate<A>(a.self());
+}
+
+// The dot product of two expressions, in the same single loop
+template <typename A, typename B>
+static inline typename A::element_type dot(const VecExpr<A>& a, const VecExpr<B>& b)
+{
+    typename A::element_type result(0);
+    int n;
+
+    for (n = 0; n < A::size; n++)
+        result += a.self()[n] * b.self()[n];
+
+    return result;
+}
+
+// Structured matrices. Each is a 4x4 whose last row is 0, 0, 0, 1. The
+// upper 3x3 is given by column(j), padded to four elements with a zero, or
+// element by element by linear(column, row); the rest of the last column
+// by translation(row) or translation_column(). StructureOf says which
+// parts each one has, and the products skip the rest at compile time:
+// adding a zero or multiplying by one isn't something the compiler may
+// drop from float arithmetic by itself. 'diagonal' means the upper 3x3 has
+// nothing off its diagonal, which is then all diagonal() has. The columns
+// combine as vector expressions, so float ones are SSE.
+template <typename T>
+struct Translation
+{
+    inline T linear(int column, int row) const { return column == row ? T(1) : T(0); }
+    inline Tvec4<T> column(int j) const { return Tvec4<T>(T(j == 0), T(j == 1), T(j == 2), T(0)); }
+    inline Tvec4<T> diagonal(void) const { return Tvec4<T>(T(1), T(1), T(1), T(0)); }
+    inline T translation(int row) const { return t[row]; }
+    inline Tvec4<T> translation_column(void) const { return Tvec4<T>(t[0], t[1], t[2], T(0)); }
+
+    T t[3];
+};
+
+template <typename T>
+struct Scale
+{
+    inline T linear(int column, int row) const { return column == row ? s[row] : T(0); }
+    inline Tvec4<T> column(int j) const { return Tvec4<T>(j == 0 ? s[0] : T(0), j == 1 ? s[1] : T(0), j == 2 ? s[2] : T(0), T(0)); }
+    inline Tvec4<T> diagonal(void) const { return Tvec4<T>(s[0], s[1], s[2], T(0)); }
+    inline T translation(int) const { return T(0); }
+    inline Tvec4<T> translation_column(void) const { return Tvec4<T>(T(0)); }
+
+    T s[3];
+};
+
+template <typename T>
+struct Linear
+{
+    inline T linear(int column, int row) const { return m[column][row]; }
+    inline const vecN<T,4>& column(int j) const { return m[j]; }
+    inline Tvec4<T> diagonal(void) const { return Tvec4<T>(m[0][0], m[1][1], m[2][2], T(0)); }
+    inline T translation(int) const { return T(0); }
+    inline Tvec4<T> translation_column(void) const { return Tvec4<T>(T(0)); }
+
+    vecN<T,4> m[3];
+};
+
+template <typename T>
+struct Affine
+{
+    inline T linear(int column, int row) const { return m[column][row]; }
+    inline const vecN<T,4>& column(int j) const { return m[j]; }
+    inline Tvec4<T> diagonal(void) const { return Tvec4<T>(m[0][0], m[1][1], m[2][2], T(0)); }
+    inline T translation(int row) const { return t[row]; }
+    inline const vecN<T,4>& translation_column(void) const { return t; }
+
+    vecN<T,4> m[3];
+    vecN<T,4> t;
+};
+
+template <typename S> struct StructureOf {};
+template <typename T> struct StructureOf<Translation<T> > { typedef T element; enum { linear = 0, translation = 1, diagonal = 1 }; };
+template <typename T> struct StructureOf<Scale<T> > { typedef T element; enum { linear = 1, translation = 0, diagonal = 1 }; };
+template <typename T> struct StructureOf<Linear<T> > { typedef T element; enum { linear = 1, translation = 0, diagonal = 0 }; };
+template <typename T> struct StructureOf<Affine<T> > { typedef T element; enum { linear = 1, translation = 1, diagonal = 0 }; };
+
+template <typename T, int linear, int translation, int diagonal> struct StructureWith { typedef Affine<T> type; };
+template <typename T> struct StructureWith<T, 0, 1, 1> { typedef Translation<T> type; };
+template <typename T> struct StructureWith<T, 1, 0, 1> { typedef Scale<T> type; };
+template <typename T> struct StructureWith<T, 1, 0, 0> { typedef Linear<T> type; };
+
+template <typename A, typename B>
+struct ProductOf
+{
+    typedef typename StructureOf<A>::element element;
+    typedef typename StructureWith<element,
+                                   StructureOf<A>::linear | StructureOf<B>::linear,
+                                   StructureOf<A>::translation | StructureOf<B>::translation,
+                                   StructureOf<A>::diagonal & StructureOf<B>::diagonal>::type type;
+};
+
+// Column j of the upper 3x3 of a * b
+template <typename A, typename B>
+static inline vecN<typename StructureOf<A>::element,4> product_column(const A& a, const B& b, int j)
+{
+    if (!StructureOf<B>::linear)
+        return a.column(j);
+    if (!StructureOf<A>::linear)
+        return b.column(j);
+    if (StructureOf<B>::diagonal)
+        return lazy(a.column(j)) * b.linear(j, j);
+    if (StructureOf<A>::diagonal)
+        return lazy(a.diagonal()) * b.column(j);
+
+    return lazy(a.column(0)) * b.linear(j, 0) + lazy(a.column(1)) * b.linear(j, 1) + lazy(a.column(2)) * b.linear(j, 2);
+}
+
+// The translation of a * b
+template <typename A, typename B>
+static inline vecN<typename StructureOf<A>::element,4> product_translation(const A& a, const B& b)
+{
+    if (!StructureOf<B>::translation)
+        return a.translation_column();
+
+    if (!StructureOf<A>::linear)
+        return lazy(a.translation_column()) + b.translation_column();
+    if (StructureOf<A>::diagonal)
+    {
+        if (!StructureOf<A>::translation)
+            return lazy(a.diagonal()) * b.translation_column();
+        return lazy(a.diagonal()) * b.translation_column() + a.translation_column();
+    }
+    if (!StructureOf<A>::translation)
+        return lazy(a.column(0)) * b.translation(0) + lazy(a.column(1)) * b.translation(1) + lazy(a.column(2)) * b.translation(2);
+
+    return lazy(a.column(0)) * b.translation(0) + lazy(a.column(1)) * b.translation(1) + lazy(a.column(2)) * b.translation(2) +
+           a.translation_column();
+}
+
+template <typename T>
+static inline void store_product(Translation<T>& r, const Translation<T>& a, const Translation<T>& b)
+{
+    r.t[0] = a.t[0] + b.t[0];
+    r.t[1] = a.t[1] + b.t[1];
+    r.t[2] = a.t[2] + b.t[2];
+}
+
+template <typename T>
+static inline void store_product(Scale<T>& r, const Scale<T>& a, const Scale<T>& b)
+{
+    r.s[0] = a.s[0] * b.s[0];
+    r.s[1] = a.s[1] * b.s[1];
+    r.s[2] = a.s[2] * b.s[2];
+}
+
+template <typename T, typename A, typename B>
+static inline void store_product(Linear<T>& r, const A& a, const B& b)
+{
+    r.m[0] = product_column(a, b, 0);
+    r.m[1] = product_column(a, b, 1);
+    r.m[2] = product_column(a, b, 2);
+}
+
+template <typename T, typename A, typename B>
+static inline void store_product(Affine<T>& r, const A& a, const B& b)
+{
+    r.m[0] = product_column(a, b, 0);
+    r.m[1] = product_column(a, b, 1);
+    r.m[2] = product_column(a, b, 2);
+    r.t = product_translation(a, b);
+}
+
+template <typename A, typename B, typename T = typename StructureOf<A>::element, typename U = typename StructureOf<B>::element>
+static inline typename ProductOf<A,B>::type operator*(const A& a, const B& b)
+{
+    typename ProductOf<A,B>::type result;
+
+    store_product(result, a, b);
+
+    return result;
+}
+
+// The 4x4 matrix of any of them
+template <typename S>
+static inline Tmat4<typename StructureOf<S>::element> to_mat4(const S& s)
+{
+    typedef typename StructureOf<S>::element T;
+    Tmat4<T> result;
+
+    result[0] = s.column(0);
+    result[1] = s.column(1);
+    result[2] = s.column(2);
+    result[3] = s.translation_column();
+    result[3][3] = T(1);
+
+    return result;
+}
+
+// mat4 * structure: the first three columns mix only three of m's, and the
+// last adds m's own
+template <typename S>
+static inline Tmat4<typename StructureOf<S>::element> operator*(const matNM<typename StructureOf<S>::element,4,4>& m, const S& s)
+{
+    typedef typename StructureOf<S>::element T;
+    Tmat4<T> result;
+    int j;
+
+    for (j = 0; j < 3; j++)
+    {
+        if (!StructureOf<S>::linear)
+            result[j] = m[j];
+        else if (StructureOf<S>::diagonal)
+            result[j] = lazy(m[j]) * s.linear(j, j);
+        else
+            result[j] = lazy(m[0]) * s.linear(j, 0) + lazy(m[1]) * s.linear(j, 1) + lazy(m[2]) * s.linear(j, 2);
+    }
+
+    if (StructureOf<S>::translation)
+        result[3] = lazy(m[0]) * s.translation(0) + lazy(m[1]) * s.translation(1) + lazy(m[2]) * s.translation(2) + m[3];
+    else
+        result[3] = m[3];
+
+    return result;
+}
+
+// structure * mat4: each column of m through the structure, whose last row
+// leaves the fourth element alone
+template <typename S>
+static inline Tmat4<typename StructureOf<S>::element> operator*(const S& s, const matNM<typename StructureOf<S>::element,4,4>& m)
+{
+    typedef typename StructureOf<S>::element T;
+    Tmat4<T> result;
+    int j;
+
+    for (j = 0; j < 4; j++)
+    {
+        const vecN<T,4>& c = m[j];
+
+        if (!StructureOf<S>::linear)
+            result[j] = c;
+        else if (StructureOf<S>::diagonal)
+            result[j] = lazy(s.diagonal()) * c;
+        else
+            result[j] = lazy(s.column(0)) * c[0] + lazy(s.column(1)) * c[1] + lazy(s.column(2)) * c[2];
+
+        if (StructureOf<S>::translation)
+            result[j] = lazy(s.translation_column()) * c[3] + result[j];
+        result[j][3] = c[3];
+    }
+
+    return result;
+}
+
+// The factories, with the same arguments as vmath's
+template <typename T>
+static inline Translation<T> translate(T x, T y, T z)
+{
+    Translation<T> result;
+
+    result.t[0] = x;
+    result.t[1] = y;
+    result.t[2] = z;
+
+    return result;
+}
+
+template <typename T>
+static inline Translation<T> translate(const vecN<T,3>& v)
+{
+    return translate(v[0], v[1], v[2]);
+}
+
+template <typename T>
+static inline Scale<T> scale(T x, T y, T z)
+{
+    Scale<T> result;
+
+    result.s[0] = x;
+    result.s[1] = y;
+    result.s[2] = z;
+
+    return result;
+}
+
+template <typename T>
+static inline Scale<T> scale(const vecN<T,3>& v)
+{
+    return scale(v[0], v[1], v[2]);
+}
+
+template <typename T>
+static inline Scale<T> scale(T s)
+{
+    return scale(s, s, s);
+}
+
+template <typename T>
+static inline Linear<T> rotate(T angle, T x, T y, T z)
+{
+    const Tmat4<T> r = vmath::rotate(angle, x, y, z);
+    Linear<T> result;
+
+    result.m[0] = r[0];
+    result.m[1] = r[1];
+    result.m[2] = r[2];
+
+    return result;
+}
+
+template <typename T>
+static inline Linear<T> rotate(T angle, const vecN<T,3>& v)
+{
+    return rotate(angle, v[0], v[1], v[2]);
+}
+
+};
+
+};
+
+#endif /* __VMATHEXPR_H__ */
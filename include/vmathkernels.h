@@ -0,0 +1,548 @@
+#ifndef __VMATHKERNELS_H__
+#define __VMATHKERNELS_H__
+
+#include "vsimd.h"
+
+// 4x4 float matrix kernels shared by vmath.h and the Angel-style mat.h, so
+// that both get the same SSE code (and any improvement to it).
+//
+// A matrix is 16 floats: four vectors of four, kept 16-byte aligned by both
+// libraries so that each vector is one load. The kernels treat the vectors
+// as columns, which is how vmath::mat4 stores them. mat.h stores rows, so
+// the bytes of an Angel mat4 are the vmath layout of its transpose; it uses
+// the kernels on that basis, and the _transposed variants let the two kinds
+// be multiplied together without converting either first. Results may
+// overwrite any of the operands. Loads and stores are unaligned ones, which
+// cost nothing extra on aligned data, so any 16 floats will do.
+
+#if defined(VMATH_SSE2)
+
+// result = a * b, from the columns of each
+static inline void mat4_multiply_columns(float * result,
+                                         __m128 a0, __m128 a1, __m128 a2, __m128 a3,
+                                         __m128 b0, __m128 b1, __m128 b2, __m128 b3)
+{
+    __m128 c[4];
+    const __m128 b[4] = { b0, b1, b2, b3 };
+    int i;
+
+    for (i = 0; i < 4; i++)
+    {
+        c[i] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a0, _mm_shuffle_ps(b[i], b[i], _MM_SHUFFLE(0, 0, 0, 0))),
+                                     _mm_mul_ps(a1, _mm_shuffle_ps(b[i], b[i], _MM_SHUFFLE(1, 1, 1, 1)))),
+                          _mm_add_ps(_mm_mul_ps(a2, _mm_shuffle_ps(b[i], b[i], _MM_SHUFFLE(2, 2, 2, 2))),
+                                     _mm_mul_ps(a3, _mm_shuffle_ps(b[i], b[i], _MM_SHUFFLE(3, 3, 3, 3)))));
+    }
+
+    for (i = 0; i < 4; i++)
+        _mm_storeu_ps(result + i * 4, c[i]);
+}
+
+#else
+
+// result = op(a) * op(b), where op transposes if asked
+static inline void mat4_multiply_scalar(float * result, const float * a, const float * b,
+                                        bool transpose_a, bool transpose_b)
+{
+    float c[16];
+    int i, j, k;
+
+    for (j = 0; j < 4; j++)
+    {
+        for (i = 0; i < 4; i++)
+        {
+            float sum = 0.0f;
+
+            for (k = 0; k < 4; k++)
+                sum += (transpose_a ? a[i * 4 + k] : a[k * 4 + i]) * (transpose_b ? b[k * 4 + j] : b[j * 4 + k]);
+            c[j * 4 + i] = sum;
+        }
+    }
+
+    for (i = 0; i < 16; i++)
+        result[i] = c[i];
+}
+
+#endif
+
+// result = a * b
+static inline void mat4_multiply(float * result, const float * a, const float * b)
+{
+#if defined(VMATH_SSE2)
+    mat4_multiply_columns(result,
+                          _mm_loadu_ps(a), _mm_loadu_ps(a + 4), _mm_loadu_ps(a + 8), _mm_loadu_ps(a + 12),
+                          _mm_loadu_ps(b), _mm_loadu_ps(b + 4), _mm_loadu_ps(b + 8), _mm_loadu_ps(b + 12));
+#else
+    mat4_multiply_scalar(result, a, b, false, false);
+#endif
+}
+
+// result = transpose(a) * b
+static inline void mat4_multiply_transposed_a(float * result, const float * a, const float * b)
+{
+#if defined(VMATH_SSE2)
+    __m128 a0 = _mm_loadu_ps(a), a1 = _mm_loadu_ps(a + 4), a2 = _mm_loadu_ps(a + 8), a3 = _mm_loadu_ps(a + 12);
+
+    _MM_TRANSPOSE4_PS(a0, a1, a2, a3);
+    mat4_multiply_columns(result, a0, a1, a2, a3,
+                          _mm_loadu_ps(b), _mm_loadu_ps(b + 4), _mm_loadu_ps(b + 8), _mm_loadu_ps(b + 12));
+#else
+    mat4_multiply_scalar(result, a, b, true, false);
+#endif
+}
+
+// result = a * transpose(b)
+static inline void mat4_multiply_transposed_b(float * result, const float * a, const float * b)
+{
+#if defined(VMATH_SSE2)
+    __m128 b0 = _mm_loadu_ps(b), b1 = _mm_loadu_ps(b + 4), b2 = _mm_loadu_ps(b + 8), b3 = _mm_loadu_ps(b + 12);
+
+    _MM_TRANSPOSE4_PS(b0, b1, b2, b3);
+    mat4_multiply_columns(result,
+                          _mm_loadu_ps(a), _mm_loadu_ps(a + 4), _mm_loadu_ps(a + 8), _mm_loadu_ps(a + 12),
+                          b0, b1, b2, b3);
+#else
+    mat4_multiply_scalar(result, a, b, false, true);
+#endif
+}
+
+static inline void mat4_transpose(float * result, const float * m)
+{
+#if defined(VMATH_SSE2)
+    __m128 m0 = _mm_loadu_ps(m), m1 = _mm_loadu_ps(m + 4), m2 = _mm_loadu_ps(m + 8), m3 = _mm_loadu_ps(m + 12);
+
+    _MM_TRANSPOSE4_PS(m0, m1, m2, m3);
+    _mm_storeu_ps(result, m0);
+    _mm_storeu_ps(result + 4, m1);
+    _mm_storeu_ps(result + 8, m2);
+    _mm_storeu_ps(result + 12, m3);
+#else
+    float t[16];
+    int i, j;
+
+    for (i = 0; i < 4; i++)
+        for (j = 0; j < 4; j++)
+            t[i * 4 + j] = m[j * 4 + i];
+    for (i = 0; i < 16; i++)
+        result[i] = t[i];
+#endif
+}
+
+// result = m * v
+static inline void mat4_transform(float * result, const float * m, const float * v)
+{
+#if defined(VMATH_SSE2)
+    const __m128 x = _mm_loadu_ps(v);
+
+    _mm_storeu_ps(result, _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(m), _mm_shuffle_ps(x, x, _MM_SHUFFLE(0, 0, 0, 0))),
+                                                _mm_mul_ps(_mm_loadu_ps(m + 4), _mm_shuffle_ps(x, x, _MM_SHUFFLE(1, 1, 1, 1)))),
+                                     _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(m + 8), _mm_shuffle_ps(x, x, _MM_SHUFFLE(2, 2, 2, 2))),
+                                                _mm_mul_ps(_mm_loadu_ps(m + 12), _mm_shuffle_ps(x, x, _MM_SHUFFLE(3, 3, 3, 3))))));
+#else
+    const float x = v[0], y = v[1], z = v[2], w = v[3];
+    int i;
+
+    for (i = 0; i < 4; i++)
+        result[i] = m[i] * x + m[4 + i] * y + m[8 + i] * z + m[12 + i] * w;
+#endif
+}
+
+// result = transpose(m) * v: the dot product of v with each vector of m
+static inline void mat4_transform_transposed(float * result, const float * m, const float * v)
+{
+#if defined(VMATH_SSE2)
+    const __m128 x = _mm_loadu_ps(v);
+    __m128 m0 = _mm_loadu_ps(m), m1 = _mm_loadu_ps(m + 4), m2 = _mm_loadu_ps(m + 8), m3 = _mm_loadu_ps(m + 12);
+
+    _MM_TRANSPOSE4_PS(m0, m1, m2, m3);
+    _mm_storeu_ps(result, _mm_add_ps(_mm_add_ps(_mm_mul_ps(m0, _mm_shuffle_ps(x, x, _MM_SHUFFLE(0, 0, 0, 0))),
+                                                _mm_mul_ps(m1, _mm_shuffle_ps(x, x, _MM_SHUFFLE(1, 1, 1, 1)))),
+                                     _mm_add_ps(_mm_mul_ps(m2, _mm_shuffle_ps(x, x, _MM_SHUFFLE(2, 2, 2, 2))),
+                                                _mm_mul_ps(m3, _mm_shuffle_ps(x, x, _MM_SHUFFLE(3, 3, 3, 3))))));
+#else
+    const float x = v[0], y = v[1], z = v[2], w = v[3];
+    float r[4];
+    int i;
+
+    for (i = 0; i < 4; i++)
+        r[i] = m[i * 4] * x + m[i * 4 + 1] * y + m[i * 4 + 2] * z + m[i * 4 + 3] * w;
+    for (i = 0; i < 4; i++)
+        result[i] = r[i];
+#endif
+}
+
+// Writes the inverse of m to 'result' and returns the determinant, by the
+// adjugate from the 2x2 minors of the first and last pair of vectors. If
+// the determinant is zero, 'result' is left alone. The inverse of the
+// transpose is the transpose of the inverse, so this is the same for rows.
+static inline float mat4_inverse(float * result, const float * m)
+{
+#if defined(VMATH_SSE2)
+#define VMATH_SHUFFLE(v, x, y, z, w) _mm_shuffle_ps(v, v, _MM_SHUFFLE(w, z, y, x))
+    const __m128 a = _mm_loadu_ps(m), b = _mm_loadu_ps(m + 4), c = _mm_loadu_ps(m + 8), d = _mm_loadu_ps(m + 12);
+
+    // Each vector picked three ways: elements 1000, 2211 and 3332
+    const __m128 ap = VMATH_SHUFFLE(a, 1, 0, 0, 0), aq = VMATH_SHUFFLE(a, 2, 2, 1, 1), ar = VMATH_SHUFFLE(a, 3, 3, 3, 2);
+    const __m128 bp = VMATH_SHUFFLE(b, 1, 0, 0, 0), bq = VMATH_SHUFFLE(b, 2, 2, 1, 1), br = VMATH_SHUFFLE(b, 3, 3, 3, 2);
+    const __m128 cp = VMATH_SHUFFLE(c, 1, 0, 0, 0), cq = VMATH_SHUFFLE(c, 2, 2, 1, 1), cr = VMATH_SHUFFLE(c, 3, 3, 3, 2);
+    const __m128 dp = VMATH_SHUFFLE(d, 1, 0, 0, 0), dq = VMATH_SHUFFLE(d, 2, 2, 1, 1), dr = VMATH_SHUFFLE(d, 3, 3, 3, 2);
+#undef VMATH_SHUFFLE
+
+    // The 2x2 minors of a and b, and of c and d, in the same three orders
+    const __m128 sa = _mm_sub_ps(_mm_mul_ps(aq, br), _mm_mul_ps(bq, ar));
+    const __m128 sb = _mm_sub_ps(_mm_mul_ps(ap, br), _mm_mul_ps(bp, ar));
+    const __m128 sc = _mm_sub_ps(_mm_mul_ps(ap, bq), _mm_mul_ps(bp, aq));
+    const __m128 ta = _mm_sub_ps(_mm_mul_ps(cq, dr), _mm_mul_ps(dq, cr));
+    const __m128 tb = _mm_sub_ps(_mm_mul_ps(cp, dr), _mm_mul_ps(dp, cr));
+    const __m128 tc = _mm_sub_ps(_mm_mul_ps(cp, dq), _mm_mul_ps(dp, cq));
+
+    // The cofactors, a vector of the adjugate from each vector of m
+    const __m128 plus = _mm_setr_ps(1.0f, -1.0f, 1.0f, -1.0f);
+    const __m128 minus = _mm_setr_ps(-1.0f, 1.0f, -1.0f, 1.0f);
+    __m128 i0 = _mm_mul_ps(plus, _mm_add_ps(_mm_sub_ps(_mm_mul_ps(bp, ta), _mm_mul_ps(bq, tb)), _mm_mul_ps(br, tc)));
+    __m128 i1 = _mm_mul_ps(minus, _mm_add_ps(_mm_sub_ps(_mm_mul_ps(ap, ta), _mm_mul_ps(aq, tb)), _mm_mul_ps(ar, tc)));
+    __m128 i2 = _mm_mul_ps(plus, _mm_add_ps(_mm_sub_ps(_mm_mul_ps(dp, sa), _mm_mul_ps(dq, sb)), _mm_mul_ps(dr, sc)));
+    __m128 i3 = _mm_mul_ps(minus, _mm_add_ps(_mm_sub_ps(_mm_mul_ps(cp, sa), _mm_mul_ps(cq, sb)), _mm_mul_ps(cr, sc)));
+
+    // The determinant is the first vector dotted with its cofactors
+    __m128 det = _mm_mul_ps(a, i0);
+
+    det = _mm_add_ps(det, _mm_shuffle_ps(det, det, _MM_SHUFFLE(2, 3, 0, 1)));
+    det = _mm_add_ps(det, _mm_shuffle_ps(det, det, _MM_SHUFFLE(1, 0, 3, 2)));
+
+    const float determinant = _mm_cvtss_f32(det);
+
+    if (determinant == 0.0f)
+        return 0.0f;
+
+    const __m128 scale = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+    _MM_TRANSPOSE4_PS(i0, i1, i2, i3);
+    _mm_storeu_ps(result, _mm_mul_ps(i0, scale));
+    _mm_storeu_ps(result + 4, _mm_mul_ps(i1, scale));
+    _mm_storeu_ps(result + 8, _mm_mul_ps(i2, scale));
+    _mm_storeu_ps(result + 12, _mm_mul_ps(i3, scale));
+
+    return determinant;
+#else
+    const float * a = m;
+    const float * b = m + 4;
+    const float * c = m + 8;
+    const float * d = m + 12;
+    const float s0 = a[0] * b[1] - b[0] * a[1], s1 = a[0] * b[2] - b[0] * a[2];
+    const float s2 = a[0] * b[3] - b[0] * a[3], s3 = a[1] * b[2] - b[1] * a[2];
+    const float s4 = a[1] * b[3] - b[1] * a[3], s5 = a[2] * b[3] - b[2] * a[3];
+    const float t0 = c[0] * d[1] - d[0] * c[1], t1 = c[0] * d[2] - d[0] * c[2];
+    const float t2 = c[0] * d[3] - d[0] * c[3], t3 = c[1] * d[2] - d[1] * c[2];
+    const float t4 = c[1] * d[3] - d[1] * c[3], t5 = c[2] * d[3] - d[2] * c[3];
+    float r[16];
+    int i;
+
+    r[0] = b[1] * t5 - b[2] * t4 + b[3] * t3;
+    r[4] = -(b[0] * t5 - b[2] * t2 + b[3] * t1);
+    r[8] = b[0] * t4 - b[1] * t2 + b[3] * t0;
+    r[12] = -(b[0] * t3 - b[1] * t1 + b[2] * t0);
+
+    const float determinant = a[0] * r[0] + a[1] * r[4] + a[2] * r[8] + a[3] * r[12];
+
+    if (determinant == 0.0f)
+        return 0.0f;
+
+    r[1] = -(a[1] * t5 - a[2] * t4 + a[3] * t3);
+    r[5] = a[0] * t5 - a[2] * t2 + a[3] * t1;
+    r[9] = -(a[0] * t4 - a[1] * t2 + a[3] * t0);
+    r[13] = a[0] * t3 - a[1] * t1 + a[2] * t0;
+    r[2] = d[1] * s5 - d[2] * s4 + d[3] * s3;
+    r[6] = -(d[0] * s5 - d[2] * s2 + d[3] * s1);
+    r[10] = d[0] * s4 - d[1] * s2 + d[3] * s0;
+    r[14] = -(d[0] * s3 - d[1] * s1 + d[2] * s0);
+    r[3] = -(c[1] * s5 - c[2] * s4 + c[3] * s3);
+    r[7] = c[0] * s5 - c[2] * s2 + c[3] * s1;
+    r[11] = -(c[0] * s4 - c[1] * s2 + c[3] * s0);
+    r[15] = c[0] * s3 - c[1] * s1 + c[2] * s0;
+
+    for (i = 0; i < 16; i++)
+        result[i] = r[i] / determinant;
+
+    return determinant;
+#endif
+}
+
+// The determinant of m, as mat4_inverse finds it
+static inline float mat4_determinant(const float * m)
+{
+#if defined(VMATH_SSE2)
+#define VMATH_SHUFFLE(v, x, y, z, w) _mm_shuffle_ps(v, v, _MM_SHUFFLE(w, z, y, x))
+    const __m128 a = _mm_loadu_ps(m), b = _mm_loadu_ps(m + 4), c = _mm_loadu_ps(m + 8), d = _mm_loadu_ps(m + 12);
+    const __m128 bp = VMATH_SHUFFLE(b, 1, 0, 0, 0), bq = VMATH_SHUFFLE(b, 2, 2, 1, 1), br = VMATH_SHUFFLE(b, 3, 3, 3, 2);
+    const __m128 cp = VMATH_SHUFFLE(c, 1, 0, 0, 0), cq = VMATH_SHUFFLE(c, 2, 2, 1, 1), cr = VMATH_SHUFFLE(c, 3, 3, 3, 2);
+    const __m128 dp = VMATH_SHUFFLE(d, 1, 0, 0, 0), dq = VMATH_SHUFFLE(d, 2, 2, 1, 1), dr = VMATH_SHUFFLE(d, 3, 3, 3, 2);
+#undef VMATH_SHUFFLE
+    const __m128 ta = _mm_sub_ps(_mm_mul_ps(cq, dr), _mm_mul_ps(dq, cr));
+    const __m128 tb = _mm_sub_ps(_mm_mul_ps(cp, dr), _mm_mul_ps(dp, cr));
+    const __m128 tc = _mm_sub_ps(_mm_mul_ps(cp, dq), _mm_mul_ps(dp, cq));
+    const __m128 i0 = _mm_mul_ps(_mm_setr_ps(1.0f, -1.0f, 1.0f, -1.0f),
+                                 _mm_add_ps(_mm_sub_ps(_mm_mul_ps(bp, ta), _mm_mul_ps(bq, tb)), _mm_mul_ps(br, tc)));
+    __m128 det = _mm_mul_ps(a, i0);
+
+    det = _mm_add_ps(det, _mm_shuffle_ps(det, det, _MM_SHUFFLE(2, 3, 0, 1)));
+    det = _mm_add_ps(det, _mm_shuffle_ps(det, det, _MM_SHUFFLE(1, 0, 3, 2)));
+
+    return _mm_cvtss_f32(det);
+#else
+    const float * a = m;
+    const float * b = m + 4;
+    const float * c = m + 8;
+    const float * d = m + 12;
+    const float t0 = c[0] * d[1] - d[0] * c[1], t1 = c[0] * d[2] - d[0] * c[2];
+    const float t2 = c[0] * d[3] - d[0] * c[3], t3 = c[1] * d[2] - d[1] * c[2];
+    const float t4 = c[1] * d[3] - d[1] * c[3], t5 = c[2] * d[3] - d[2] * c[3];
+
+    return a[0] * (b[1] * t5 - b[2] * t4 + b[3] * t3) -
+           a[1] * (b[0] * t5 - b[2] * t2 + b[3] * t1) +
+           a[2] * (b[0] * t4 - b[1] * t2 + b[3] * t0) -
+           a[3] * (b[0] * t3 - b[1] * t1 + b[2] * t0);
+#endif
+}
+
+#if defined(VMATH_SSE2)
+
+// The cross product of the first three elements of a and b. The last
+// element is zero if a's and b's are finite.
+static inline __m128 mat4_cross_columns(__m128 a, __m128 b)
+{
+    const __m128 t = _mm_sub_ps(_mm_mul_ps(a, _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1))),
+                                _mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1)), b));
+
+    return _mm_shuffle_ps(t, t, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+#endif
+
+// The inverse of an affine m, one whose last row is 0, 0, 0, 1: the upper
+// 3x3 is inverted from the cross products of its columns, which are the
+// rows of its adjugate, and the translation is taken back through it.
+// Returns the determinant of the 3x3 and leaves 'result' alone if it's
+// zero. Unlike mat4_inverse this is for columns only.
+static inline float mat4_affine_inverse(float * result, const float * m)
+{
+#if defined(VMATH_SSE2)
+    const __m128 c0 = _mm_loadu_ps(m), c1 = _mm_loadu_ps(m + 4), c2 = _mm_loadu_ps(m + 8), t = _mm_loadu_ps(m + 12);
+    __m128 r0 = mat4_cross_columns(c1, c2);
+    __m128 r1 = mat4_cross_columns(c2, c0);
+    __m128 r2 = mat4_cross_columns(c0, c1);
+    __m128 det = _mm_mul_ps(c0, r0);
+
+    det = _mm_add_ps(det, _mm_shuffle_ps(det, det, _MM_SHUFFLE(2, 3, 0, 1)));
+    det = _mm_add_ps(det, _mm_shuffle_ps(det, det, _MM_SHUFFLE(1, 0, 3, 2)));
+
+    const float determinant = _mm_cvtss_f32(det);
+
+    if (determinant == 0.0f)
+        return 0.0f;
+
+    const __m128 scale = _mm_div_ps(_mm_set1_ps(1.0f), det);
+    __m128 r3 = _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f);
+
+    r0 = _mm_mul_ps(r0, scale);
+    r1 = _mm_mul_ps(r1, scale);
+    r2 = _mm_mul_ps(r2, scale);
+
+    // The rows of the inverse become its columns, with a last element of
+    // zero, and r3 becomes 0, 0, 0, 1
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+
+    const __m128 moved = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r0, _mm_shuffle_ps(t, t, _MM_SHUFFLE(0, 0, 0, 0))),
+                                               _mm_mul_ps(r1, _mm_shuffle_ps(t, t, _MM_SHUFFLE(1, 1, 1, 1)))),
+                                    _mm_mul_ps(r2, _mm_shuffle_ps(t, t, _MM_SHUFFLE(2, 2, 2, 2))));
+
+    _mm_storeu_ps(result, r0);
+    _mm_storeu_ps(result + 4, r1);
+    _mm_storeu_ps(result + 8, r2);
+    _mm_storeu_ps(result + 12, _mm_sub_ps(r3, moved));
+
+    return determinant;
+#else
+    const float * c0 = m;
+    const float * c1 = m + 4;
+    const float * c2 = m + 8;
+    const float * t = m + 12;
+    float r[9];
+    int i;
+
+    r[0] = c1[1] * c2[2] - c1[2] * c2[1];
+    r[1] = c1[2] * c2[0] - c1[0] * c2[2];
+    r[2] = c1[0] * c2[1] - c1[1] * c2[0];
+
+    const float determinant = c0[0] * r[0] + c0[1] * r[1] + c0[2] * r[2];
+
+    if (determinant == 0.0f)
+        return 0.0f;
+
+    r[3] = c2[1] * c0[2] - c2[2] * c0[1];
+    r[4] = c2[2] * c0[0] - c2[0] * c0[2];
+    r[5] = c2[0] * c0[1] - c2[1] * c0[0];
+    r[6] = c0[1] * c1[2] - c0[2] * c1[1];
+    r[7] = c0[2] * c1[0] - c0[0] * c1[2];
+    r[8] = c0[0] * c1[1] - c0[1] * c1[0];
+
+    const float scale = 1.0f / determinant;
+    const float tx = t[0], ty = t[1], tz = t[2];
+
+    // r holds the rows of the inverse
+    for (i = 0; i < 3; i++)
+    {
+        result[i * 4 + 0] = r[i] * scale;
+        result[i * 4 + 1] = r[i + 3] * scale;
+        result[i * 4 + 2] = r[i + 6] * scale;
+        result[i * 4 + 3] = 0.0f;
+    }
+
+    for (i = 0; i < 3; i++)
+        result[12 + i] = -(result[i] * tx + result[4 + i] * ty + result[8 + i] * tz);
+    result[15] = 1.0f;
+
+    return determinant;
+#endif
+}
+
+// The normal matrix of m: the inverse transpose of its upper 3x3, as nine
+// floats, three columns of three. Those columns are the cross products of
+// the columns of m over the determinant, which is returned; if it's zero,
+// 'result' is left alone.
+static inline float mat4_inverse_transpose3x3(float * result, const float * m)
+{
+#if defined(VMATH_SSE2)
+    const __m128 c0 = _mm_loadu_ps(m), c1 = _mm_loadu_ps(m + 4), c2 = _mm_loadu_ps(m + 8);
+    const __m128 mask = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+    const __m128 r0 = mat4_cross_columns(c1, c2);
+    __m128 det = _mm_and_ps(_mm_mul_ps(c0, r0), mask);
+
+    det = _mm_add_ps(det, _mm_shuffle_ps(det, det, _MM_SHUFFLE(2, 3, 0, 1)));
+    det = _mm_add_ps(det, _mm_shuffle_ps(det, det, _MM_SHUFFLE(1, 0, 3, 2)));
+
+    const float determinant = _mm_cvtss_f32(det);
+
+    if (determinant == 0.0f)
+        return 0.0f;
+
+    const __m128 scale = _mm_div_ps(_mm_set1_ps(1.0f), det);
+    const __m128 r2 = _mm_mul_ps(mat4_cross_columns(c0, c1), scale);
+
+    // Overlapping stores, each one's last element replaced by the next
+    _mm_storeu_ps(result, _mm_mul_ps(r0, scale));
+    _mm_storeu_ps(result + 3, _mm_mul_ps(mat4_cross_columns(c2, c0), scale));
+    _mm_storel_pi((__m64 *)(result + 6), r2);
+    _mm_store_ss(result + 8, _mm_movehl_ps(r2, r2));
+
+    return determinant;
+#else
+    const float * c0 = m;
+    const float * c1 = m + 4;
+    const float * c2 = m + 8;
+    float r[9];
+    int i;
+
+    r[0] = c1[1] * c2[2] - c1[2] * c2[1];
+    r[1] = c1[2] * c2[0] - c1[0] * c2[2];
+    r[2] = c1[0] * c2[1] - c1[1] * c2[0];
+
+    const float determinant = c0[0] * r[0] + c0[1] * r[1] + c0[2] * r[2];
+
+    if (determinant == 0.0f)
+        return 0.0f;
+
+    r[3] = c2[1] * c0[2] - c2[2] * c0[1];
+    r[4] = c2[2] * c0[0] - c2[0] * c0[2];
+    r[5] = c2[0] * c0[1] - c2[1] * c0[0];
+    r[6] = c0[1] * c1[2] - c0[2] * c1[1];
+    r[7] = c0[2] * c1[0] - c0[0] * c1[2];
+    r[8] = c0[0] * c1[1] - c0[1] * c1[0];
+
+    const float scale = 1.0f / determinant;
+
+    for (i = 0; i < 9; i++)
+        result[i] = r[i] * scale;
+
+    return determinant;
+#endif
+}
+
+// Inverts 'count' matrices from 'm' into 'result', which may be the same
+// array. Singular ones become the identity; returns how many there were.
+// With AVX, two matrices go through mat4_inverse's shuffles at once, one in
+// each half of the registers, as its shuffles never cross between halves.
+static inline int mat4_inverse_batch(float * result, const float * m, int count)
+{
+    static const float identity[16] = { 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f,
+                                        0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f };
+    int singular = 0;
+    int i;
+
+#if defined(VMATH_AVX)
+#define VMATH_SHUFFLE(v, x, y, z, w) _mm256_shuffle_ps(v, v, _MM_SHUFFLE(w, z, y, x))
+#define VMATH_LOAD(n) _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(m + (n))), _mm_loadu_ps(m + 16 + (n)), 1)
+    const __m256 plus = _mm256_setr_ps(1.0f, -1.0f, 1.0f, -1.0f, 1.0f, -1.0f, 1.0f, -1.0f);
+    const __m256 minus = _mm256_setr_ps(-1.0f, 1.0f, -1.0f, 1.0f, -1.0f, 1.0f, -1.0f, 1.0f);
+
+    for (; count >= 2; count -= 2, m += 32, result += 32)
+    {
+        const __m256 a = VMATH_LOAD(0), b = VMATH_LOAD(4), c = VMATH_LOAD(8), d = VMATH_LOAD(12);
+        const __m256 ap = VMATH_SHUFFLE(a, 1, 0, 0, 0), aq = VMATH_SHUFFLE(a, 2, 2, 1, 1), ar = VMATH_SHUFFLE(a, 3, 3, 3, 2);
+        const __m256 bp = VMATH_SHUFFLE(b, 1, 0, 0, 0), bq = VMATH_SHUFFLE(b, 2, 2, 1, 1), br = VMATH_SHUFFLE(b, 3, 3, 3, 2);
+        const __m256 cp = VMATH_SHUFFLE(c, 1, 0, 0, 0), cq = VMATH_SHUFFLE(c, 2, 2, 1, 1), cr = VMATH_SHUFFLE(c, 3, 3, 3, 2);
+        const __m256 dp = VMATH_SHUFFLE(d, 1, 0, 0, 0), dq = VMATH_SHUFFLE(d, 2, 2, 1, 1), dr = VMATH_SHUFFLE(d, 3, 3, 3, 2);
+        const __m256 sa = _mm256_sub_ps(_mm256_mul_ps(aq, br), _mm256_mul_ps(bq, ar));
+        const __m256 sb = _mm256_sub_ps(_mm256_mul_ps(ap, br), _mm256_mul_ps(bp, ar));
+        const __m256 sc = _mm256_sub_ps(_mm256_mul_ps(ap, bq), _mm256_mul_ps(bp, aq));
+        const __m256 ta = _mm256_sub_ps(_mm256_mul_ps(cq, dr), _mm256_mul_ps(dq, cr));
+        const __m256 tb = _mm256_sub_ps(_mm256_mul_ps(cp, dr), _mm256_mul_ps(dp, cr));
+        const __m256 tc = _mm256_sub_ps(_mm256_mul_ps(cp, dq), _mm256_mul_ps(dp, cq));
+        const __m256 i0 = _mm256_mul_ps(plus, _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(bp, ta), _mm256_mul_ps(bq, tb)), _mm256_mul_ps(br, tc)));
+        const __m256 i1 = _mm256_mul_ps(minus, _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(ap, ta), _mm256_mul_ps(aq, tb)), _mm256_mul_ps(ar, tc)));
+        const __m256 i2 = _mm256_mul_ps(plus, _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(dp, sa), _mm256_mul_ps(dq, sb)), _mm256_mul_ps(dr, sc)));
+        const __m256 i3 = _mm256_mul_ps(minus, _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(cp, sa), _mm256_mul_ps(cq, sb)), _mm256_mul_ps(cr, sc)));
+        __m256 det = _mm256_mul_ps(a, i0);
+
+        det = _mm256_add_ps(det, _mm256_shuffle_ps(det, det, _MM_SHUFFLE(2, 3, 0, 1)));
+        det = _mm256_add_ps(det, _mm256_shuffle_ps(det, det, _MM_SHUFFLE(1, 0, 3, 2)));
+
+        const __m256 scale = _mm256_div_ps(_mm256_set1_ps(1.0f), det);
+
+        // The transpose, within each half
+        const __m256 u0 = _mm256_unpacklo_ps(i0, i1), u1 = _mm256_unpackhi_ps(i0, i1);
+        const __m256 u2 = _mm256_unpacklo_ps(i2, i3), u3 = _mm256_unpackhi_ps(i2, i3);
+        __m256 r[4];
+
+        r[0] = _mm256_mul_ps(_mm256_shuffle_ps(u0, u2, _MM_SHUFFLE(1, 0, 1, 0)), scale);
+        r[1] = _mm256_mul_ps(_mm256_shuffle_ps(u0, u2, _MM_SHUFFLE(3, 2, 3, 2)), scale);
+        r[2] = _mm256_mul_ps(_mm256_shuffle_ps(u1, u3, _MM_SHUFFLE(1, 0, 1, 0)), scale);
+        r[3] = _mm256_mul_ps(_mm256_shuffle_ps(u1, u3, _MM_SHUFFLE(3, 2, 3, 2)), scale);
+
+        const int bad = _mm256_movemask_ps(_mm256_cmp_ps(det, _mm256_setzero_ps(), _CMP_EQ_OQ));
+
+        for (i = 0; i < 4; i++)
+        {
+            _mm_storeu_ps(result + i * 4, (bad & 0x01) ? _mm_loadu_ps(identity + i * 4) : _mm256_castps256_ps128(r[i]));
+            _mm_storeu_ps(result + 16 + i * 4, (bad & 0x10) ? _mm_loadu_ps(identity + i * 4) : _mm256_extractf128_ps(r[i], 1));
+        }
+        singular += (bad & 0x01) + ((bad >> 4) & 1);
+    }
+#undef VMATH_LOAD
+#undef VMATH_SHUFFLE
+#endif
+
+    for (; count > 0; count--, m += 16, result += 16)
+    {
+        if (mat4_inverse(result, m) == 0.0f)
+        {
+            for (i = 0; i < 16; i++)
+                result[i] = identity[i];
+            singular++;
+        }
+    }
+
+    return singular;
+}
+
+#endif /* __VMATHKERNELS_H__ */
@@ -0,0 +1,140 @@
+#ifndef __VOCCLUSION_H__
+#define __VOCCLUSION_H__
+
+#include "vgl.h"
+#include "vmath.h"
+#include "vbm.h"
+
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Culls instances hidden behind a few large occluders, on the CPU. The
+// occluders (the coarsest level of detail of each VBObject added, or a
+// coarser mesh made by BuildOccluder) are rasterized into a low resolution masked depth buffer. Its tiles are 32x8
+// pixels. Each holds a farthest depth for the whole tile and a working
+// layer: a coverage mask of one bit per pixel with its own farthest depth.
+// When the working layer covers the whole tile it replaces the tile's depth.
+// Instance bounding boxes are then tested against the tiles they touch, and
+// against the working layers where they fall behind them.
+//
+// Submit hands a frame to a worker thread, so the culling overlaps whatever
+// the calling thread (and the GPU, still busy with the previous frame) is
+// doing; Wait collects the result. Occluding objects must be loaded with
+// VBM_LOAD_KEEP_DATA and stay alive until Wait returns.
+
+#define OCCLUSION_TILE_WIDTH    32
+#define OCCLUSION_TILE_HEIGHT   8
+
+struct OcclusionStats
+{
+    unsigned int    occluder_triangles; // Triangles rasterized
+    unsigned int    tested;             // Instances tested
+    unsigned int    culled;             // ... of which were hidden
+    float           culled_percent;
+    float           rasterize_time;     // Microseconds spent rasterizing occluders
+    float           test_time;          // Microseconds spent testing instances
+    float           total_time;         // Microseconds from Submit to the result being ready
+};
+
+class OcclusionCuller
+{
+public:
+    OcclusionCuller(void);
+    virtual ~OcclusionCuller(void);
+
+    // Resolution of the masked buffer, rounded up to whole tiles. Unless
+    // 'threaded' is false, starts the worker thread; otherwise Submit does
+    // the work itself before returning.
+    bool Initialize(int width = 512, int height = 256, bool threaded = true);
+    void Free(void);
+
+    // Occluders for the next Submit. They're kept until ClearOccluders. Both
+    // wait for a frame in flight to finish first.
+    void ClearOccluders(void);
+    void AddOccluder(const VBObject& object, const vmath::mat4& model);
+
+    // Simplifies the coarsest level of detail of 'object' (all of it, for a
+    // model without levels) to at most 'max_triangles' triangles, which
+    // AddOccluder then uses in its place. Occluders have to be cheap more
+    // than they have to be close, and culling is only safe if they don't
+    // cover anything the object doesn't, so the simplified mesh is pulled
+    // in along its normals by the simplification error. Call it after
+    // Initialize, with the object loaded with VBM_LOAD_KEEP_DATA or
+    // VBM_LOAD_CPU_ONLY. Returns false if there's no data to simplify.
+    bool BuildOccluder(const VBObject& object, unsigned int max_triangles = 1000);
+
+    // Starts culling 'count' instances, each the box 'bounds' transformed by
+    // one of 'matrices' (which are copied). Waits for any earlier frame.
+    void Submit(const vmath::mat4& view_projection, const VBM_BOUNDS& bounds,
+                const vmath::mat4 * matrices, unsigned int count);
+
+    // Waits for the result of Submit. Writes the indices of the instances
+    // that may be visible to 'visible', in increasing order, and returns how
+    // many there are. Boxes entirely off screen are culled too; boxes that
+    // cross the near plane are always visible.
+    unsigned int Wait(unsigned int * visible);
+
+    const OcclusionStats& GetStats(void) const { return m_stats; }
+
+    int GetWidth(void) const { return m_width; }
+    int GetHeight(void) const { return m_height; }
+
+protected:
+    struct Tile
+    {
+        unsigned int    mask[OCCLUSION_TILE_HEIGHT];
+        float           z[2];       // Farthest depth of the tile, then of the masked layer
+    };
+
+    struct Occluder
+    {
+        const VBObject *    object;
+        unsigned int        frame;
+        vmath::mat4         model;
+        int                 mesh;       // Index into m_meshes, or -1 for the object itself
+    };
+
+    // A simplified stand-in for an object, three floats a vertex
+    struct OccluderMesh
+    {
+        const VBObject *            object;
+        std::vector<float>          positions;
+        std::vector<unsigned int>   indices;
+    };
+
+    void Run(void);
+    void Cull(void);
+    void RasterizeTriangle(const vmath::vec4 * clip);
+    bool TestBox(const vmath::mat4& mvp, const VBM_BOUNDS& bounds) const;
+
+    int                 m_width;
+    int                 m_height;
+    int                 m_tiles_x;
+    int                 m_tiles_y;
+    std::vector<Tile>   m_tiles;
+
+    std::vector<Occluder>       m_occluders;
+    std::vector<OccluderMesh>   m_meshes;
+
+    // The frame being worked on
+    vmath::mat4                 m_view_projection;
+    VBM_BOUNDS                  m_bounds;
+    std::vector<vmath::mat4>    m_matrices;
+    std::vector<unsigned int>   m_visible;
+
+    std::thread                 m_thread;
+    std::mutex                  m_mutex;
+    std::condition_variable     m_condition;
+    bool                        m_pending;
+    bool                        m_busy;
+    bool                        m_quit;
+
+    std::chrono::high_resolution_clock::time_point  m_submit_time;
+
+    OcclusionStats      m_stats;
+};
+
+#endif /* __VOCCLUSION_H__ */
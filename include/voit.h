@@ -0,0 +1,155 @@
+#ifndef __VOIT_H__
+#define __VOIT_H__
+
+#include "vgl.h"
+
+#include <stddef.h>
+#include <vector>
+
+// Storage for order independent transparency. The transparent geometry is
+// drawn between Begin and End with a program written for the current mode,
+// then a full screen pass drawn after BindForResolve composites it.
+//
+// OIT_LINKED_LIST  - per-pixel lists of fragments. Head pointers are in an
+//                    r32ui image at unit 0, fragments (uvec4) in an
+//                    rgba32ui image buffer at unit 1 and the allocation
+//                    counter in atomic counter binding 0. The counter starts
+//                    at 1 so that 0 can terminate the lists. Build shaders
+//                    must drop fragments at or beyond imageSize(list_buffer);
+//                    the counter still counts them, and the store is grown
+//                    a couple of frames later once the count is read back.
+// OIT_K_BUFFER     - a fixed number of fragment slots per pixel. The r32ui
+//                    image at unit 0 counts the fragments in each pixel and
+//                    slot n of pixel (x, y) is element
+//                    (y * width + x) * k + n of the image buffer at unit 1,
+//                    where k = imageSize(list_buffer) / (width * height).
+//                    Memory is bounded; fragments beyond k are dropped.
+// OIT_WEIGHTED_BLENDED - weighted blended transparency. No per-fragment
+//                    storage at all: draw buffer 0 accumulates weighted
+//                    premultiplied color (rgba16f, additive) and draw
+//                    buffer 1 the product of the transmittances (r8). The
+//                    resolve pass reads them from texture units 0 and 1.
+//
+// The linked list and k-buffer modes also count every fragment with the
+// atomic counter, which provides the statistics.
+//
+// Their resolve shaders sort the nearest OIT_RESOLVE_FRONT_K fragments of
+// a pixel exactly and composite them front to back; any farther ones are
+// blended behind them as a tail, by their alpha weighted average color.
+// ResolveReference does the same on the CPU, or an exact sort of every
+// fragment, over a store read back with Capture.
+enum OITMode
+{
+    OIT_LINKED_LIST,
+    OIT_K_BUFFER,
+    OIT_WEIGHTED_BLENDED
+};
+
+struct OITStats
+{
+    unsigned int    fragments;              // Fragments generated in the last frame read back
+    float           fragments_per_pixel;    // ... divided by the size of the framebuffer
+    unsigned int    capacity;               // Fragments that the store can hold
+    unsigned int    overflow_frames;        // Frames that generated more fragments than fit
+    unsigned int    fallback_count;         // Times the memory budget forced OIT_K_BUFFER
+    size_t          memory_in_use;          // Bytes held by all of the buffers and images
+};
+
+#define OIT_RESOLVE_FRONT_K     32
+
+struct OITResolveStats
+{
+    unsigned int    pixels;                 // Pixels with at least one fragment
+    unsigned int    fragments;              // Fragments resolved
+    unsigned int    max_fragments;          // Most fragments in a single pixel
+    unsigned int    tail_fragments;         // Fragments blended approximately, behind the front k
+    float           time;                   // Microseconds taken
+    float           fragments_per_ms;
+};
+
+class OITBuffer
+{
+public:
+    OITBuffer(void);
+    virtual ~OITBuffer(void);
+
+    bool Initialize(GLsizei width, GLsizei height, OITMode mode = OIT_LINKED_LIST, unsigned int k = 8);
+    void Free(void);
+    void Resize(GLsizei width, GLsizei height);
+
+    void SetMode(OITMode mode);
+    OITMode GetMode(void) const { return m_mode; }
+
+    // Upper bound on the bytes used for fragment storage in linked list
+    // mode (0 for no limit). If the scene needs more than this for several
+    // frames in a row and fallback is enabled, the buffer switches itself
+    // to OIT_K_BUFFER, which trades the farthest fragments for bounded
+    // memory.
+    void SetMemoryBudget(size_t bytes, bool fallback = true)
+    {
+        m_memory_budget = bytes;
+        m_fallback = fallback;
+    }
+
+    void Begin(void);
+    void End(void);
+    void BindForResolve(void);
+
+    const OITStats& GetStats(void) const { return m_stats; }
+
+    // Reads back the head (or count) image and the fragment store, four
+    // words per fragment, as the last frame left them. Call after End;
+    // this waits for the GPU. Fails in OIT_WEIGHTED_BLENDED mode.
+    bool Capture(std::vector<GLuint>& heads, std::vector<GLuint>& fragments) const;
+
+    // Resolves a captured store of 'capacity' fragments into 'colors', an
+    // RGBA float per pixel with the rows bottom up, as glReadPixels returns
+    // them. With 'exact' every fragment is sorted and blended back to
+    // front; otherwise the result follows the resolve shaders.
+    static void ResolveReference(OITMode mode, const GLuint * heads, const GLuint * fragments,
+                                 unsigned int capacity, GLsizei width, GLsizei height,
+                                 bool exact, float * colors, OITResolveStats * stats = NULL);
+
+protected:
+    enum
+    {
+        READBACK_LATENCY = 3,
+        SHRINK_DELAY = 120,
+        FALLBACK_DELAY = 8,
+        MIN_CAPACITY = 256 * 1024
+    };
+
+    void AllocateImages(void);
+    void AllocateStore(unsigned int capacity);
+    void ReadBackCounter(void);
+    void UpdateMemoryInUse(void);
+
+    OITMode         m_mode;
+    GLsizei         m_width;
+    GLsizei         m_height;
+    unsigned int    m_k;
+
+    GLuint          m_head_texture;
+    GLuint          m_list_buffer;
+    GLuint          m_list_texture;
+    GLuint          m_counter_buffer;
+
+    GLuint          m_weighted_fbo;
+    GLuint          m_accum_texture;
+    GLuint          m_reveal_texture;
+    GLint           m_previous_fbo;
+
+    // Ring of copies of the counter, read once their fences have passed
+    GLuint          m_readback_buffer[READBACK_LATENCY];
+    GLsync          m_readback_fence[READBACK_LATENCY];
+    unsigned int    m_readback_index;
+
+    size_t          m_memory_budget;
+    bool            m_fallback;
+    unsigned int    m_underused_frames;
+    unsigned int    m_over_budget_frames;
+
+    OITStats        m_stats;
+};
+
+#endif /* __VOIT_H__ */
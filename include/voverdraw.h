@@ -0,0 +1,103 @@
+#ifndef __VOVERDRAW_H__
+#define __VOVERDRAW_H__
+
+#include "vgl.h"
+
+#include <stdio.h>
+
+// Measures overdraw. Wrap the draws to be measured in Begin and End; while
+// they run, an r32ui image the size of the framebuffer is bound to image
+// unit 0 (or the unit given to Initialize) and their fragment shaders
+// count themselves with
+//
+//     imageAtomicAdd(overdraw_image, ivec2(gl_FragCoord.xy), 1u);
+//
+// End reduces the counts to a histogram, either with a compute shader or
+// by reading the whole image back and reducing it on the CPU. Either way
+// the results travel back through buffers guarded by fences and are
+// picked up a few frames later, so measuring never stalls the pipeline.
+
+#define OVERDRAW_HISTOGRAM_SIZE 256     // Counts of 255 and up share the last bin
+
+struct OverdrawStats
+{
+    unsigned int        frame;          // Frame (numbered by End) that these describe
+    unsigned int        pixels;         // Pixels in the image
+    unsigned int        covered;        // Pixels drawn at least once
+    unsigned long long  fragments;      // Total fragments counted
+    float               mean;           // Fragments per pixel
+    float               covered_mean;   // Fragments per covered pixel
+    unsigned int        max;            // Greatest count in any pixel
+    unsigned int        p50;            // Percentiles of the counts of covered pixels.
+    unsigned int        p90;            // They come from the histogram, so they
+    unsigned int        p99;            // saturate at OVERDRAW_HISTOGRAM_SIZE - 1.
+    unsigned int        histogram[OVERDRAW_HISTOGRAM_SIZE];
+};
+
+class OverdrawCounter
+{
+public:
+    OverdrawCounter(void);
+    virtual ~OverdrawCounter(void);
+
+    bool Initialize(GLsizei width, GLsizei height, GLuint image_unit = 0);
+    void Free(void);
+    void Resize(GLsizei width, GLsizei height);
+
+    // Reduce on the CPU rather than with the compute shader
+    void SetCPUReduction(bool cpu) { m_cpu_reduction = cpu; }
+    bool GetCPUReduction(void) const { return m_cpu_reduction; }
+
+    // Writes a line of comma separated statistics for every frame that
+    // completes to 'file' (NULL to stop). A header line is written first.
+    void SetOutput(FILE * file);
+
+    void Begin(void);
+    void End(void);
+
+    // Picks up any results that have arrived. Begin calls this too.
+    // Returns true if the statistics changed.
+    bool Poll(void);
+
+    const OverdrawStats& GetStats(void) const { return m_stats; }
+    GLuint GetCounterTexture(void) const { return m_counter_texture; }
+
+    // The CPU reduction. Fills in everything in 'stats' but 'frame'.
+    static void Reduce(const GLuint * counts, unsigned int count, OverdrawStats& stats);
+
+protected:
+    enum
+    {
+        READBACK_LATENCY = 3
+    };
+
+    struct Readback
+    {
+        GLuint          buffer;
+        GLsync          fence;
+        unsigned int    frame;
+        unsigned int    pixels;
+        bool            cpu;
+    };
+
+    void AllocateImage(void);
+    void Finish(const Readback& readback);
+    static void Percentiles(OverdrawStats& stats);
+
+    GLsizei         m_width;
+    GLsizei         m_height;
+    GLuint          m_image_unit;
+    bool            m_cpu_reduction;
+
+    GLuint          m_counter_texture;
+    GLuint          m_reduce_program;
+    GLuint          m_result_buffer;
+
+    Readback        m_readback[READBACK_LATENCY];
+    unsigned int    m_frame;
+
+    FILE *          m_output;
+    OverdrawStats   m_stats;
+};
+
+#endif /* __VOVERDRAW_H__ */
@@ -0,0 +1,204 @@
+#ifndef __VPACK_H__
+#define __VPACK_H__
+
+#include "vmath.h"
+
+#include <stddef.h>
+#include <string.h>
+
+// Conversions that shrink vertex data: floats to halves and back, unit
+// normals to octahedral coordinates or 10:10:10:2 snorm, and floats to
+// UNORM and SNORM integers of eight or sixteen bits. The single-value
+// versions are here, depend on nothing but vmath.h and so can be used by
+// the exporters and obj2vbm; the bulk versions in vpack.cpp give the same
+// bits, a few at a time.
+//
+// Halves round to nearest even, as F16C does. Infinities stay infinite,
+// NaNs keep as much of their payload as fits and become quiet, and values
+// too small for a normal half become denormals. Normalized integers follow
+// the GL rules: UNORM n is round(x * (2^n - 1)), SNORM n is
+// round(x * (2^(n - 1) - 1)), and the most negative SNORM reads back as -1.
+// Everything rounds to nearest even.
+
+namespace vmath
+{
+
+// How far the decoded values are from the originals. For normals and
+// other vectors it's the length of the difference.
+struct QuantizeError
+{
+    float           max_error;
+    float           rms_error;
+    size_t          clamped;            // Values outside the range, which were clamped
+};
+
+static inline unsigned int float_bits(float f)
+{
+    unsigned int u;
+
+    memcpy(&u, &f, sizeof(u));
+
+    return u;
+}
+
+static inline float bits_float(unsigned int u)
+{
+    float f;
+
+    memcpy(&f, &u, sizeof(f));
+
+    return f;
+}
+
+static inline unsigned short float_to_half(float f)
+{
+    const unsigned int bits = float_bits(f);
+    const unsigned int sign = (bits >> 16) & 0x8000;
+    const unsigned int magnitude = bits & 0x7FFFFFFF;
+
+    // 65520 and up round to infinity; NaNs keep the top of their payload
+    if (magnitude >= 0x47800000)
+    {
+        if (magnitude > 0x7F800000)
+            return (unsigned short)(sign | 0x7E00 | ((magnitude >> 13) & 0x3FF));
+
+        return (unsigned short)(sign | 0x7C00);
+    }
+
+    // Below 2^-14 the result is denormal. Adding 0.5 lines the bits up
+    // with the half's mantissa and has the FPU do the rounding.
+    if (magnitude < 0x38800000)
+        return (unsigned short)(sign | (float_bits(bits_float(magnitude) + 0.5f) - 0x3F000000));
+
+    // Rebias the exponent and round to nearest even; a carry out of the
+    // mantissa bumps the exponent, as it should
+    return (unsigned short)(sign | ((magnitude + 0xC8000FFF + ((magnitude >> 13) & 1)) >> 13));
+}
+
+static inline float half_to_float(unsigned short h)
+{
+    const unsigned int sign = (unsigned int)(h & 0x8000) << 16;
+    const unsigned int exponent = h & 0x7C00;
+    const unsigned int mantissa = h & 0x3FF;
+
+    if (exponent == 0x7C00)
+        return bits_float(sign | 0x7F800000 | (mantissa << 13) | (mantissa != 0 ? 0x400000 : 0));
+
+    // Denormals (and zero) are mantissa * 2^-24
+    if (exponent == 0)
+        return bits_float(sign | float_bits(float(mantissa) * (1.0f / 16777216.0f)));
+
+    return bits_float(sign | (((unsigned int)(h & 0x7FFF) << 13) + 0x38000000));
+}
+
+// Rounds to nearest even for |f| < 2^22, which covers everything these
+// scale to: adding 1.5 * 2^23 leaves no bits below the point. It needs
+// strict float arithmetic (not /fp:fast or -ffast-math), and is much
+// quicker than nearbyintf, which is a library call.
+static inline float round_to_even(float f)
+{
+    return (f + 12582912.0f) - 12582912.0f;
+}
+
+static inline int quantize_unorm(float f, int bits)
+{
+    const float scale = float((1 << bits) - 1);
+
+    return (int)round_to_even(vmath::min(vmath::max(f, 0.0f), 1.0f) * scale);
+}
+
+static inline int quantize_snorm(float f, int bits)
+{
+    const float scale = float((1 << (bits - 1)) - 1);
+
+    return (int)round_to_even(vmath::min(vmath::max(f, -1.0f), 1.0f) * scale);
+}
+
+static inline float dequantize_unorm(int q, int bits)
+{
+    return float(q) / float((1 << bits) - 1);
+}
+
+static inline float dequantize_snorm(int q, int bits)
+{
+    return vmath::max(float(q) / float((1 << (bits - 1)) - 1), -1.0f);
+}
+
+// GL_INT_2_10_10_10_REV, normalized: x in the low ten bits, w in the top two
+static inline unsigned int pack_snorm_2_10_10_10(const vec4& v)
+{
+    return ((unsigned int)quantize_snorm(v[0], 10) & 0x3FF) |
+           (((unsigned int)quantize_snorm(v[1], 10) & 0x3FF) << 10) |
+           (((unsigned int)quantize_snorm(v[2], 10) & 0x3FF) << 20) |
+           (((unsigned int)quantize_snorm(v[3], 2) & 0x3) << 30);
+}
+
+static inline vec4 unpack_snorm_2_10_10_10(unsigned int p)
+{
+    // Shift each field to the top and back down to sign extend it
+    return vec4(dequantize_snorm((int)(p << 22) >> 22, 10),
+                dequantize_snorm((int)(p << 12) >> 22, 10),
+                dequantize_snorm((int)(p << 2) >> 22, 10),
+                dequantize_snorm((int)p >> 30, 2));
+}
+
+// Octahedral normals: the unit sphere is projected onto the octahedron
+// |x| + |y| + |z| = 1, whose lower half is folded out over the corners of
+// the upper half's square. The square's coordinates are stored as two
+// 16-bit SNORMs, u in the low half. That's within 0.004 degrees of the
+// original everywhere, in half the space of three floats.
+static inline unsigned int pack_octahedral(const vec3& n)
+{
+    const float l1 = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+    const float scale = l1 > 0.0f ? 1.0f / l1 : 0.0f;
+    const float u = n[0] * scale;
+    const float v = n[1] * scale;
+
+    // Both ways are worked out and one picked, rather than branching on
+    // the sign of z, which is as good as random across a mesh
+    const float fold_u = copysignf(1.0f - fabsf(v), u);
+    const float fold_v = copysignf(1.0f - fabsf(u), v);
+    const bool lower = n[2] < 0.0f;
+
+    return ((unsigned int)quantize_snorm(lower ? fold_u : u, 16) & 0xFFFF) |
+           ((unsigned int)quantize_snorm(lower ? fold_v : v, 16) << 16);
+}
+
+static inline vec3 unpack_octahedral(unsigned int p)
+{
+    const float u = dequantize_snorm((short)(p & 0xFFFF), 16);
+    const float v = dequantize_snorm((short)(p >> 16), 16);
+    const float z = 1.0f - fabsf(u) - fabsf(v);
+    const float t = vmath::max(-z, 0.0f);
+
+    return normalize(vec3(u - copysignf(t, u), v - copysignf(t, v), z));
+}
+
+// Bulk versions. The half conversions use F16C where the compiler targets
+// it and SSE2 otherwise; the quantizers and normal packs use SSE2. Pass
+// 'error' to have the results decoded again and compared with the input.
+void float_to_half(unsigned short * out, const float * in, size_t count);
+void half_to_float(float * out, const unsigned short * in, size_t count);
+
+void quantize_unorm8(unsigned char * out, const float * in, size_t count, QuantizeError * error = NULL);
+void quantize_unorm16(unsigned short * out, const float * in, size_t count, QuantizeError * error = NULL);
+void quantize_snorm8(signed char * out, const float * in, size_t count, QuantizeError * error = NULL);
+void quantize_snorm16(short * out, const float * in, size_t count, QuantizeError * error = NULL);
+
+void dequantize_unorm8(float * out, const unsigned char * in, size_t count);
+void dequantize_unorm16(float * out, const unsigned short * in, size_t count);
+void dequantize_snorm8(float * out, const signed char * in, size_t count);
+void dequantize_snorm16(float * out, const short * in, size_t count);
+
+// Normals get a w of zero; tangents keep theirs, which is normally +1 or
+// -1 for the handedness of the bitangent
+void pack_snorm_2_10_10_10(unsigned int * out, const vec3 * in, size_t count, QuantizeError * error = NULL);
+void pack_snorm_2_10_10_10(unsigned int * out, const vec4 * in, size_t count, QuantizeError * error = NULL);
+void unpack_snorm_2_10_10_10(vec4 * out, const unsigned int * in, size_t count);
+
+void pack_octahedral(unsigned int * out, const vec3 * in, size_t count, QuantizeError * error = NULL);
+void unpack_octahedral(vec3 * out, const unsigned int * in, size_t count);
+
+};
+
+#endif /* __VPACK_H__ */
@@ -0,0 +1,130 @@
+#ifndef __VPRIMITIVES_H__
+#define __VPRIMITIVES_H__
+
+#include "vgl.h"
+
+// Compute shader building blocks over shader storage buffers: exclusive
+// prefix sum, stream compaction, segmented reduction and histogram. They
+// replace a single atomic counter wherever items are appended to a queue,
+// which serializes every invocation on one address, with a scan that
+// gives each item its place directly and keeps them in order.
+//
+// The scan runs in a single pass with decoupled look-back (Merrill and
+// Garland, "Single-pass Parallel Prefix Scan with Decoupled Look-back"):
+// workgroups take tiles of 1024 elements in launch order, publish their
+// tile's sum, then add up their predecessors' published sums (or the first
+// complete prefix they meet) instead of waiting for a second dispatch.
+// Compaction is the same pass scanning the flags and scattering the kept
+// elements.
+//
+// Every primitive has a CPU reference that produces the same bits: the
+// integer results wrap the same way, and the float reduction adds in the
+// same order as the shader (which marks its sums precise), given IEEE
+// additions that don't flush denormals.
+//
+// Each call waits for earlier shader storage writes and leaves its results
+// visible to later shader storage reads. Callers that use the results any
+// other way (as vertices, indices or indirect commands) issue the barrier
+// for that themselves.
+
+enum PrimitiveType
+{
+    PRIMITIVE_UINT,
+    PRIMITIVE_FLOAT
+};
+
+class GPUPrimitives
+{
+public:
+    GPUPrimitives(void);
+    virtual ~GPUPrimitives(void);
+
+    // Scans and compactions are limited to 'max_elements' elements
+    bool Initialize(unsigned int max_elements);
+    void Free(void);
+
+    // Writes the exclusive prefix sum of 'count' uints of 'input' to
+    // 'output', which may be the same buffer. If 'total' is nonzero, the
+    // sum of all of them is written to uint 'total_index' of it.
+    void ExclusiveScan(GLuint input, GLuint output, unsigned int count,
+                       GLuint total = 0, unsigned int total_index = 0);
+
+    // Copies each of 'count' elements of 'input', 'element_words' uints
+    // each, whose uint in 'flags' is nonzero to 'output', in order. The
+    // number kept is written to uint 'total_index' of 'total', if nonzero.
+    void Compact(GLuint input, GLuint flags, GLuint output, unsigned int count,
+                 GLuint total = 0, unsigned int total_index = 0, unsigned int element_words = 1);
+
+    // Sums each of 'segment_count' segments of 'values' (uint or float).
+    // Segment n is elements offsets[n] .. offsets[n + 1] - 1, so 'offsets'
+    // holds segment_count + 1 uints. One workgroup reduces each segment.
+    void SegmentedReduce(GLuint values, GLuint offsets, unsigned int segment_count,
+                         GLuint sums, PrimitiveType type = PRIMITIVE_UINT);
+
+    // Counts 'count' uints of 'values' into 'bin_count' uint bins by
+    // value >> 'shift'; values beyond the last bin are ignored. The bins
+    // are cleared first unless 'accumulate' is set. Up to SHARED_BINS bins
+    // are counted in shared memory before going to the buffer.
+    void Histogram(GLuint values, unsigned int count, GLuint bins, unsigned int bin_count,
+                   unsigned int shift = 0, bool accumulate = false);
+
+    // CPU references. The scan and compaction return the total.
+    static unsigned int ExclusiveScanReference(const GLuint * input, GLuint * output, unsigned int count);
+    static unsigned int CompactReference(const GLuint * input, const GLuint * flags, GLuint * output,
+                                         unsigned int count, unsigned int element_words = 1);
+    static void SegmentedReduceReference(const GLuint * values, const GLuint * offsets,
+                                         unsigned int segment_count, GLuint * sums);
+    static void SegmentedReduceReference(const float * values, const GLuint * offsets,
+                                         unsigned int segment_count, float * sums);
+    static void HistogramReference(const GLuint * values, unsigned int count, GLuint * bins,
+                                   unsigned int bin_count, unsigned int shift = 0, bool accumulate = false);
+
+    enum
+    {
+        GROUP_SIZE = 256,
+        TILE_SIZE = 1024,                   // Elements scanned by each workgroup
+        SHARED_BINS = 4096,
+        MAX_GROUPS = 65535
+    };
+
+protected:
+    enum
+    {
+        PROGRAM_SCAN,
+        PROGRAM_COMPACT,
+        PROGRAM_REDUCE_UINT,
+        PROGRAM_REDUCE_FLOAT,
+        PROGRAM_HISTOGRAM,
+        PROGRAM_TOTAL
+    };
+
+    void BeginScan(unsigned int count);
+
+    GLuint          m_programs[PROGRAM_TOTAL];
+
+    // Tile counter, then the status, sum and inclusive prefix of each tile
+    GLuint          m_tile_state_buffer;
+    unsigned int    m_max_elements;
+
+    struct
+    {
+        GLint count;
+        GLint total_index;
+        GLint element_words;
+        GLint write_total;
+    } m_scan_uniforms[2];
+
+    struct
+    {
+        GLint first_segment;
+    } m_reduce_uniforms[2];
+
+    struct
+    {
+        GLint count;
+        GLint bin_count;
+        GLint shift;
+    } m_histogram_uniforms;
+};
+
+#endif /* __VPRIMITIVES_H__ */
@@ -0,0 +1,38 @@
+#ifndef __VRANDOM_H__
+#define __VRANDOM_H__
+
+#include "vmath.h"
+
+// Bulk fills from the counter-based streams in vmath.h. Element i of each
+// fill is exactly what the scalar function returns for counter 'first' + i,
+// so a large array can be split across threads (or filled piecemeal) and
+// come out bit for bit the same. Vectors take their components from
+// consecutive counters: component j of element i of a vec3 fill is scalar
+// value 3 * ('first' + i) + j. On-sphere fills are the exception, using
+// random_on_sphere's own numbering.
+//
+// Philox blocks are generated four (SSE2) or eight (AVX2) at a time; the
+// transforms to each distribution are scalar.
+
+namespace vmath
+{
+
+// random_bits
+void random_fill_bits(unsigned int * out, unsigned int count, unsigned int key, unsigned int first);
+
+// lo + (hi - lo) * random_uniform
+void random_fill_uniform(float * out, unsigned int count, unsigned int key, unsigned int first, float lo = 0.0f, float hi = 1.0f);
+void random_fill_uniform(vec3 * out, unsigned int count, unsigned int key, unsigned int first, float lo = 0.0f, float hi = 1.0f);
+void random_fill_uniform(vec4 * out, unsigned int count, unsigned int key, unsigned int first, float lo = 0.0f, float hi = 1.0f);
+
+// mean + deviation * random_normal
+void random_fill_normal(float * out, unsigned int count, unsigned int key, unsigned int first, float mean = 0.0f, float deviation = 1.0f);
+void random_fill_normal(vec3 * out, unsigned int count, unsigned int key, unsigned int first, float mean = 0.0f, float deviation = 1.0f);
+void random_fill_normal(vec4 * out, unsigned int count, unsigned int key, unsigned int first, float mean = 0.0f, float deviation = 1.0f);
+
+// radius * random_on_sphere
+void random_fill_on_sphere(vec3 * out, unsigned int count, unsigned int key, unsigned int first, float radius = 1.0f);
+
+};
+
+#endif /* __VRANDOM_H__ */
@@ -0,0 +1,152 @@
+#ifndef __VRASTER_H__
+#define __VRASTER_H__
+
+#include "vgl.h"
+#include "vmath.h"
+#include "vbm.h"
+#include "vermilion.h"
+
+#include <vector>
+
+class JobSystem;
+
+// Renders VBObjects on the CPU, so that reference images can be produced on
+// machines without a GPU. Load the objects with VBM_LOAD_CPU_ONLY (or
+// VBM_LOAD_KEEP_DATA) so that their vertex data stays in memory.
+//
+// Draw transforms, clips and sets up triangles across a JobSystem and sorts
+// them into bins of RASTER_TILE_SIZE square tiles; Finish rasterizes the
+// tiles with JobSystem::ParallelFor, so idle threads steal runs of tiles
+// from busy ones. Within a tile, triangles are walked in 8x8 pixel blocks,
+// rows of eight pixels at a time. A block is skipped outright if the
+// triangle lies behind the farthest depth already in it.
+//
+// Shading is a single directional light in view space, modulating the
+// draw color and, optionally, a texture. The depth test is GL_LESS and
+// triangles are counterclockwise-front, as OpenGL does by default.
+
+#define RASTER_TILE_SIZE    64
+#define RASTER_BLOCK_SIZE   8
+
+struct RasterStats
+{
+    unsigned int    triangles;          // Triangles submitted
+    unsigned int    culled;             // Back facing, degenerate, clipped away or off screen
+    unsigned int    bin_entries;        // Triangle-tile pairs binned
+    unsigned int    blocks_tested;      // 8x8 blocks a triangle's bounds touched
+    unsigned int    blocks_rejected;    // ... of which were skipped by the depth early-out
+    unsigned int    pixels_shaded;      // Pixels that passed the depth test
+    float           setup_time;         // Microseconds spent in Draw
+    float           raster_time;        // Microseconds spent in Finish
+};
+
+class SoftwareRasterizer
+{
+public:
+    SoftwareRasterizer(void);
+    virtual ~SoftwareRasterizer(void);
+
+    bool Initialize(int width, int height);
+    void Free(void);
+
+    // Fills the color and depth buffers, discarding anything not yet
+    // finished. Also resets the statistics.
+    void Clear(const vmath::vec4& color, float depth = 1.0f);
+
+    void SetCullFace(bool cull) { m_cull_face = cull; }
+
+    // Direction towards the light, in view space
+    void SetLightDirection(const vmath::vec3& direction);
+
+    // Modulates subsequent draws with the base level of 'image' (nearest
+    // filtering, repeat wrapping) using the mesh's first texture coordinate.
+    // Only 8-bit RGB(A) and BGR(A) 2D images are supported; returns false
+    // for anything else. NULL turns texturing off. The image must outlive
+    // the following Finish.
+    bool SetTexture(const vglImageData * image);
+
+    // Queues frame 'frame' of 'object'. Attribute 0 must be the position,
+    // attribute 1 the normal and attribute 2 (if present) the texture
+    // coordinate, as written by obj2vbm.
+    void Draw(JobSystem& jobs, const VBObject& object, unsigned int frame,
+              const vmath::mat4& model_view, const vmath::mat4& projection,
+              const vmath::vec4& color = vmath::vec4(1.0f));
+
+    // Rasterizes everything drawn since the last Clear or Finish
+    void Finish(JobSystem& jobs);
+
+    // Copies the color buffer into 'image' as a GL_RGBA / GL_UNSIGNED_BYTE
+    // 2D image, bottom row first. Release it with vglUnloadImage.
+    void ReadImage(vglImageData * image) const;
+
+    int GetWidth(void) const { return m_width; }
+    int GetHeight(void) const { return m_height; }
+
+    // Rows are GetStride() pixels apart
+    int GetStride(void) const { return m_stride; }
+    const unsigned int * GetColorBuffer(void) const { return &m_color[0]; }
+    const float * GetDepthBuffer(void) const { return &m_depth[0]; }
+
+    const RasterStats& GetStats(void) const { return m_stats; }
+
+protected:
+    // A triangle ready to rasterize. Edge i is opposite vertex i; its
+    // function edge[i][0] * x + edge[i][1] * y + edge[i][2] is positive
+    // inside and, divided by the area, is the barycentric weight of vertex
+    // i. Depth is a plane in window space; the other attributes are
+    // interpolated perspective-correctly from their values divided by w.
+    struct Triangle
+    {
+        vmath::vec3     edge[3];
+        bool            top_left[3];
+        float           inv_area;
+        vmath::vec3     z;              // Depth plane
+        float           inv_w[3];
+        vmath::vec3     normal[3];      // View space normal / w
+        vmath::vec2     uv[3];          // Texture coordinate / w
+        float           z_min;
+        int             min_x, min_y, max_x, max_y;
+        unsigned int    draw;
+    };
+
+    struct DrawState
+    {
+        vmath::vec4         color;
+        const vglImageData* texture;
+    };
+
+    struct Vertex
+    {
+        vmath::vec4     clip;
+        vmath::vec3     normal;
+        vmath::vec2     uv;
+    };
+
+    bool SetupTriangle(const Vertex * v, Triangle& triangle) const;
+    void Bin(unsigned int index);
+    void RasterizeTile(int tile, unsigned int& blocks_tested, unsigned int& blocks_rejected, unsigned int& pixels_shaded);
+    unsigned int Shade(const Triangle& triangle, float x, float y) const;
+    void UpdateBlockDepth(int block_x, int block_y);
+
+    int                 m_width;
+    int                 m_height;
+    int                 m_stride;           // Width rounded up to whole blocks
+    int                 m_tiles_x;
+    int                 m_tiles_y;
+    int                 m_blocks_x;
+
+    bool                m_cull_face;
+    vmath::vec3         m_light;
+    const vglImageData* m_texture;
+
+    std::vector<unsigned int>                   m_color;
+    std::vector<float>                          m_depth;
+    std::vector<float>                          m_block_depth;  // Farthest depth in each 8x8 block
+    std::vector<Triangle>                       m_triangles;
+    std::vector<DrawState>                      m_draws;
+    std::vector< std::vector<unsigned int> >    m_bins;
+
+    RasterStats         m_stats;
+};
+
+#endif /* __VRASTER_H__ */
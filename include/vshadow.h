@@ -0,0 +1,41 @@
+#ifndef __VSHADOW_H__
+#define __VSHADOW_H__
+
+#include "vmath.h"
+
+namespace vmath
+{
+
+// Distributes 'count' shadow cascades between the view-space distances
+// 'n' and 'f' using the practical split scheme: a blend of the logarithmic
+// and uniform distributions, weighted towards the logarithmic one by
+// 'lambda' (0 to 1). Writes count + 1 distances, starting at n and ending
+// at f.
+void cascadeSplits(float n, float f, unsigned int count, float lambda, float * splits);
+
+// Computes the world-space corners of the slice of a camera's frustum that
+// lies between the view-space distances 'slice_near' and 'slice_far'. The
+// projection must be a perspective one (as made by frustum or perspective)
+// and the view matrix must be rigid (as made by lookat). The four near
+// corners come first, counter-clockwise from bottom left, then the four
+// far corners in the same order. Returns the radius of their bounding
+// sphere about their centroid, found in view space so that it depends on
+// the projection and distances alone: the world-space corners of a camera
+// far from the origin are too rounded to give the same radius twice.
+float frustumSliceCorners(const mat4& view_matrix, const mat4& projection_matrix,
+                          float slice_near, float slice_far, vec3 corners[8]);
+
+// Fits an orthographic projection, in the space of 'light_view_matrix',
+// around the sphere of 'radius' (from frustumSliceCorners) about the
+// centroid of 'corners'. Using a sphere keeps the size of the projection
+// fixed as the camera moves and turns, and its center is snapped to whole
+// texels of a 'resolution' sized shadow map so that static casters
+// rasterize identically from frame to frame rather than shimmering.
+// 'caster_distance' pulls the near plane towards the light to take in
+// casters that lie outside the slice.
+mat4 cascadeProjection(const vec3 corners[8], float radius, const mat4& light_view_matrix,
+                       unsigned int resolution, float caster_distance);
+
+};
+
+#endif /* __VSHADOW_H__ */
@@ -0,0 +1,93 @@
+#ifndef __VSIMD_H__
+#define __VSIMD_H__
+
+// Compile-time selection of the SIMD instruction sets used by the vmath
+// kernels. Everything that uses these has a scalar fallback, so define
+// VMATH_NO_SIMD to force the portable paths (for validation, say). Beyond
+// SSE2 they follow the compiler's target: -mavx2 -mf16c or /arch:AVX2,
+// which the VERMILION_AVX2 CMake option sets.
+
+#ifndef VMATH_NO_SIMD
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define VMATH_SSE2      1
+#include <emmintrin.h>
+#endif
+
+// MSVC only says __AVX__ and __AVX2__, which imply the others
+#if defined(__SSE4_1__) || defined(__AVX__)
+#define VMATH_SSE41     1
+#include <smmintrin.h>
+#endif
+
+#if defined(__AVX__)
+#define VMATH_AVX       1
+#include <immintrin.h>
+#endif
+
+#if defined(__AVX2__)
+#define VMATH_AVX2      1
+#endif
+
+#if defined(__F16C__) || (defined(_MSC_VER) && defined(__AVX2__))
+#define VMATH_F16C      1
+#endif
+
+// Kernels that pay for a newer instruction set than the build targets can
+// be compiled for it alone with VMATH_TARGET and picked at run time with
+// vmath_cpu_has_sse41() and vmath_cpu_has_avx2()
+#if defined(VMATH_SSE2)
+#define VMATH_DISPATCH  1
+#include <immintrin.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+
+// MSVC takes any intrinsic anywhere
+#define VMATH_TARGET(isa)
+
+static inline bool vmath_cpu_has_sse41(void)
+{
+    int info[4];
+
+    __cpuid(info, 1);
+
+    return (info[2] & (1 << 19)) != 0;
+}
+
+static inline bool vmath_cpu_has_avx2(void)
+{
+    int info[4];
+
+    // The OS must save the YMM registers as well as the CPU having them
+    __cpuid(info, 1);
+    if ((info[2] & (1 << 27)) == 0 || (_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(info, 7, 0);
+
+    return (info[1] & (1 << 5)) != 0;
+}
+#else
+#define VMATH_TARGET(isa)   __attribute__((target(isa)))
+
+static inline bool vmath_cpu_has_sse41(void)
+{
+    return __builtin_cpu_supports("sse4.1") != 0;
+}
+
+static inline bool vmath_cpu_has_avx2(void)
+{
+    return __builtin_cpu_supports("avx2") != 0;
+}
+#endif
+#endif
+
+#endif /* VMATH_NO_SIMD */
+
+#if defined(_MSC_VER)
+#define VMATH_ALIGN(n)  __declspec(align(n))
+#else
+#define VMATH_ALIGN(n)  __attribute__((aligned(n)))
+#endif
+
+#endif /* __VSIMD_H__ */
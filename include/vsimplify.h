@@ -0,0 +1,97 @@
+#ifndef __VSIMPLIFY_H__
+#define __VSIMPLIFY_H__
+
+#include <vector>
+#include <queue>
+
+// Quadric error metric simplification (Garland and Heckbert) of indexed
+// triangle meshes. Each collapse merges one vertex into a neighbor without
+// moving or creating vertices, so every level shares the original vertex
+// buffer and differs only in its index list, and carrying on from one level
+// gives the next one down.
+//
+// Vertices that share a position lie on a UV or normal seam and are never
+// moved; given normals, neither are vertices across a crease sharper than
+// 60 degrees. Collapses that would flip a triangle or make the mesh
+// non-manifold are skipped, and open edges are held in place, so a target
+// may not be reached.
+//
+// Nothing here depends on OpenGL, so obj2vbm can build it too.
+
+class MeshSimplifier
+{
+public:
+    // 'positions' and 'normals' (which may be NULL) hold 'vertex_count'
+    // vertices of 'stride' floats, x, y and z first. Both are copied.
+    MeshSimplifier(const float * positions, const float * normals, unsigned int vertex_count, unsigned int stride,
+                   const unsigned int * indices, unsigned int index_count);
+
+    // Collapses edges until no more than 'target_triangles' remain. Returns
+    // the largest distance from an original vertex to the simplified
+    // surface around the vertex it was merged into.
+    float Simplify(unsigned int target_triangles);
+
+    void GetIndices(std::vector<unsigned int>& indices) const;
+    unsigned int GetTriangleCount(void) const { return m_live_triangles; }
+
+    // The largest distance, as Simplify measures it, of the vertices merged
+    // into 'vertex' so far
+    float GetVertexError(unsigned int vertex) const { return m_vertex_error[vertex]; }
+
+protected:
+    struct Point
+    {
+        float x, y, z;
+    };
+
+    struct Quadric
+    {
+        double a[10];
+
+        Quadric(void);
+
+        // The plane nx * x + ny * y + nz * z + d = 0, scaled by w
+        Quadric(double nx, double ny, double nz, double d, double w = 1.0);
+
+        Quadric& operator+=(const Quadric& q);
+        double Evaluate(const Point& p) const;
+    };
+
+    struct Collapse
+    {
+        double          cost;
+        unsigned int    from;
+        unsigned int    to;
+        unsigned int    stamp;
+
+        bool operator<(const Collapse& that) const { return cost > that.cost; }
+    };
+
+    bool HasVertex(unsigned int t, unsigned int v) const
+    {
+        return m_triangles[t * 3] == v || m_triangles[t * 3 + 1] == v || m_triangles[t * 3 + 2] == v;
+    }
+
+    void Neighbors(unsigned int v, std::vector<unsigned int>& out) const;
+    void PushCollapse(unsigned int from, unsigned int to);
+    bool IsValid(unsigned int from, unsigned int to) const;
+    void DoCollapse(unsigned int from, unsigned int to);
+    float MeasureError(void);
+
+    std::vector<Point>                          m_positions;
+    std::vector<Point>                          m_normals;
+    std::vector<unsigned int>                   m_triangles;
+    std::vector<bool>                           m_triangle_alive;
+    std::vector<bool>                           m_vertex_alive;
+    std::vector<bool>                           m_locked;
+    std::vector<unsigned int>                   m_stamp;
+    std::vector<Quadric>                        m_quadrics;
+    std::vector<unsigned int>                   m_merged_into;
+    std::vector<float>                          m_vertex_error;
+    std::vector< std::vector<unsigned int> >    m_vertex_triangles;
+    std::priority_queue<Collapse>               m_heap;
+    unsigned int                                m_live_triangles;
+    float                                       m_max_error;
+};
+
+#endif /* __VSIMPLIFY_H__ */
@@ -0,0 +1,220 @@
+#ifndef __VSKELETON_H__
+#define __VSKELETON_H__
+
+#include "vgl.h"
+#include "vmath.h"
+#include "vbm.h"
+
+#include <vector>
+
+class JobSystem;
+
+// Skeletal animation. A Skeleton holds a joint hierarchy (parents first,
+// as in VBM files) and its clips. Sampling a clip gives every joint's pose
+// relative to its parent; walking the hierarchy turns those into a palette
+// of skinning transforms, model space from bind space, one per joint. The
+// palette then deforms the mesh by linear blend skinning (blending
+// matrices) or dual quaternion skinning (blending rigid transforms, which
+// doesn't collapse at twisting joints but ignores scale), either on the
+// CPU or in a vertex shader reading the palette from a storage buffer.
+//
+// The sampler, the hierarchy walk and both skinning methods use SSE where
+// available, one joint or vertex per iteration with its four components
+// in a register. CrowdAnimator runs them for many characters at once
+// across a JobSystem.
+
+#define SKELETON_MAX_JOINTS     256
+
+// Pose of a joint relative to its parent. The w of translation and scale
+// is unused.
+struct JointPose
+{
+    vmath::vec4     rotation;       // Unit quaternion (x, y, z, w)
+    vmath::vec4     translation;
+    vmath::vec4     scale;
+};
+
+// Rigid transform as a unit dual quaternion. The rotation is 'real'; the
+// translation t is 2 * dual * conjugate(real).
+struct DualQuaternion
+{
+    vmath::vec4     real;
+    vmath::vec4     dual;
+};
+
+enum SkeletonInterpolation
+{
+    SKELETON_NLERP,                 // Normalized lerp; cheap, fine for closely spaced keys
+    SKELETON_SLERP                  // Constant angular velocity between keys
+};
+
+enum SkinningMethod
+{
+    SKINNING_LINEAR,
+    SKINNING_DUAL_QUATERNION
+};
+
+class Skeleton
+{
+public:
+    Skeleton(void);
+    virtual ~Skeleton(void);
+
+    // Copies the skeleton and clips of 'object'. Fails if it has none.
+    bool Initialize(const VBObject& object);
+
+    // Takes 'count' joints, stored parents first
+    bool Initialize(const VBM_JOINT * joints, unsigned int count);
+    void Free(void);
+
+    // Adds a clip of 'key_count' keys of every joint, key by key, evenly
+    // spaced over 'duration' seconds. Returns its index.
+    unsigned int AddClip(const char * name, float duration, const VBM_JOINT_POSE * keys, unsigned int key_count);
+
+    unsigned int GetJointCount(void) const { return (unsigned int)m_parents.size(); }
+    int GetParent(unsigned int joint) const { return m_parents[joint]; }
+    const char * GetJointName(unsigned int joint) const { return m_names[joint].name; }
+
+    unsigned int GetClipCount(void) const { return (unsigned int)m_clips.size(); }
+    float GetClipDuration(unsigned int clip) const { return m_clips[clip].duration; }
+
+    // Index of the clip called 'name', or -1
+    int FindClip(const char * name) const;
+
+    // Poses of the joints as bound to the mesh
+    void GetBindPose(JointPose * local) const;
+
+    // Samples 'clip' at 'time' seconds, wrapping around at its end
+    void Sample(unsigned int clip, float time, JointPose * local,
+                SkeletonInterpolation interpolation = SKELETON_NLERP) const;
+
+    // Cross-fades from 'a' to 'b' by 't', e.g. between two sampled clips
+    void Blend(const JointPose * a, const JointPose * b, float t, JointPose * out) const;
+
+    // Walks the hierarchy, producing the skinning transform of each joint:
+    // its model space transform times its inverse bind matrix
+    void ComputeSkinningMatrices(const JointPose * local, vmath::mat4 * palette) const;
+
+    // The rigid part of each of 'count' skinning matrices
+    static void ToDualQuaternions(const vmath::mat4 * palette, DualQuaternion * dual_quaternions, unsigned int count);
+
+protected:
+    struct Name
+    {
+        char name[32];
+    };
+
+    struct Clip
+    {
+        Name            name;
+        float           duration;
+        unsigned int    key_count;
+        unsigned int    first_key;
+    };
+
+    std::vector<int>            m_parents;
+    std::vector<Name>           m_names;
+    std::vector<JointPose>      m_bind_pose;
+    std::vector<vmath::mat4>    m_inverse_bind;
+    std::vector<Clip>           m_clips;
+    std::vector<JointPose>      m_keys;
+};
+
+// The attributes that skinning reads. Positions may have three or four
+// components; w is taken to be one.
+struct SkinnedMesh
+{
+    const float *   positions;
+    unsigned int    position_components;
+    const float *   normals;        // Three components, or NULL
+    const float *   joints;         // Four joint indices, stored as floats
+    const float *   weights;        // Four weights, summing to one
+    unsigned int    vertex_count;
+
+    // Finds the position (attribute 0), "normal", "joints" and "weights"
+    // attributes of an object loaded with VBM_LOAD_KEEP_DATA or
+    // VBM_LOAD_CPU_ONLY
+    bool FromVBM(const VBObject& object);
+};
+
+// Deform 'mesh' by 'palette', writing a position (w of one) and a normal
+// (w of zero, not normalized) for each vertex
+void SkinLinear(const SkinnedMesh& mesh, const vmath::mat4 * palette, vmath::vec4 * out);
+void SkinDualQuaternion(const SkinnedMesh& mesh, const DualQuaternion * palette, vmath::vec4 * out);
+
+// Animation state of one character of a crowd
+struct CharacterState
+{
+    unsigned int    clip;
+    float           time;
+};
+
+struct SkinningStats
+{
+    unsigned int    characters;
+    unsigned int    joints;             // Per character
+    unsigned int    vertices;           // Per character; zero unless skinned on the CPU
+    float           evaluate_time;      // Microseconds sampling clips and walking hierarchies
+    float           skinning_time;      // Microseconds skinning on the CPU
+    float           upload_time;        // Microseconds writing the palettes or vertices to buffers
+    float           characters_per_ms;  // Characters evaluated (and skinned) per millisecond
+};
+
+// Animates a crowd of characters sharing a skeleton and a mesh. Update
+// evaluates each character's palette on the job system and, to skin on
+// the CPU, deforms its copy of the mesh too. Upload then writes either
+// the palettes or the deformed vertices to storage buffers for drawing.
+//
+// The palette buffer holds a mat4 per joint (linear blend skinning) or
+// two vec4s, real then dual (dual quaternion skinning), character by
+// character. The vertex buffer holds a position and a normal per vertex,
+// character by character.
+class CrowdAnimator
+{
+public:
+    CrowdAnimator(void);
+    virtual ~CrowdAnimator(void);
+
+    // 'mesh' may be NULL to skin only on the GPU. Both it and 'skeleton'
+    // must outlive the animator. With 'create_buffers' false no OpenGL
+    // objects are made and Upload does nothing, to animate on the CPU alone.
+    bool Initialize(const Skeleton * skeleton, const SkinnedMesh * mesh, unsigned int max_characters,
+                    bool create_buffers = true);
+    void Free(void);
+
+    void Update(JobSystem& jobs, const CharacterState * characters, unsigned int count,
+                SkinningMethod method, bool skin_on_cpu,
+                SkeletonInterpolation interpolation = SKELETON_NLERP);
+
+    // Writes the results of the last Update to the palette or vertex buffer
+    void Upload(void);
+
+    GLuint GetPaletteBuffer(void) const { return m_palette_buffer; }
+    GLuint GetVertexBuffer(void) const { return m_vertex_buffer; }
+
+    const vmath::mat4 * GetMatrixPalettes(void) const { return m_matrices.size() ? &m_matrices[0] : NULL; }
+    const DualQuaternion * GetDualQuaternionPalettes(void) const { return m_dual_quaternions.size() ? &m_dual_quaternions[0] : NULL; }
+    const vmath::vec4 * GetSkinnedVertices(void) const { return m_vertices.size() ? &m_vertices[0] : NULL; }
+
+    const SkinningStats& GetStats(void) const { return m_stats; }
+
+protected:
+    const Skeleton *                m_skeleton;
+    const SkinnedMesh *             m_mesh;
+    unsigned int                    m_max_characters;
+
+    unsigned int                    m_count;
+    SkinningMethod                  m_method;
+    bool                            m_skinned_on_cpu;
+
+    std::vector<vmath::mat4>        m_matrices;
+    std::vector<DualQuaternion>     m_dual_quaternions;
+    std::vector<vmath::vec4>        m_vertices;
+
+    GLuint                          m_palette_buffer;
+    GLuint                          m_vertex_buffer;
+
+    SkinningStats                   m_stats;
+};
+
+#endif /* __VSKELETON_H__ */
@@ -0,0 +1,170 @@
+#ifndef __VSORT_H__
+#define __VSORT_H__
+
+#include "vgl.h"
+#include "vmath.h"
+
+#include <vector>
+
+class JobSystem;
+
+// Depth sorting for drawing transparent sprites back to front.
+//
+// Each sprite's view space depth is turned into a 32-bit key whose
+// unsigned order is the order of the floats, and the keys are sorted
+// together with the sprite indices by a least significant digit radix
+// sort. The sorted indices are a permutation for glDrawElements; the
+// positions themselves never move.
+
+// Flips a float's bits so that comparing them as unsigned integers orders
+// them as floats: negative values have every bit flipped, others only the
+// sign bit
+static inline unsigned int float_to_sort_key(float f)
+{
+    union { float f; unsigned int u; } bits;
+
+    bits.f = f;
+
+    return bits.u ^ ((bits.u & 0x80000000u) ? 0xFFFFFFFFu : 0x80000000u);
+}
+
+static inline float sort_key_to_float(unsigned int key)
+{
+    union { float f; unsigned int u; } bits;
+
+    bits.u = key ^ ((key & 0x80000000u) ? 0x80000000u : 0xFFFFFFFFu);
+
+    return bits.f;
+}
+
+// Writes the sort key of the view space z of each of 'count' positions
+// under 'model_view', and its index into 'values'. Ascending keys are
+// farthest first. Four positions at a time with SSE, split across 'jobs'.
+void compute_depth_keys(JobSystem& jobs, const vmath::vec4 * positions, unsigned int count,
+                        const vmath::mat4& model_view, unsigned int * keys, unsigned int * values);
+
+// Stable LSD radix sort of 32-bit keys, eight bits per pass, carrying a
+// 32-bit value with each key. Each pass splits the keys into one block
+// per piece of work: the blocks count their digits in parallel, a prefix
+// sum over the counts gives every block its place for each digit, and the
+// blocks then scatter in parallel. Passes whose digit is the same for
+// every key are skipped. The scratch arrays are kept between sorts.
+class RadixSorter
+{
+public:
+    RadixSorter(void);
+    virtual ~RadixSorter(void);
+
+    void Sort(JobSystem& jobs, unsigned int * keys, unsigned int * values, unsigned int count);
+
+    // Passes that were needed by the last Sort (at most four)
+    unsigned int GetPassCount(void) const { return m_passes; }
+
+protected:
+    enum
+    {
+        RADIX_BITS = 8,
+        RADIX_SIZE = 1 << RADIX_BITS,
+        MIN_BLOCK_SIZE = 16 * 1024,
+        BLOCKS_PER_THREAD = 4
+    };
+
+    std::vector<unsigned int>   m_keys;
+    std::vector<unsigned int>   m_values;
+    std::vector<unsigned int>   m_histograms;
+    unsigned int                m_passes;
+};
+
+struct SpriteSortStats
+{
+    unsigned int    sprites;
+    bool            gpu;                // Sorted by the compute shaders
+    unsigned int    passes;             // Radix passes (CPU only)
+    float           depth_time;         // Microseconds computing keys on the CPU
+    float           sort_time;          // Microseconds sorting on the CPU, or issuing the GPU sort
+    float           upload_time;        // Microseconds writing the permutation to the index buffer
+    float           sprites_per_ms;     // Sprites sorted (and uploaded) per millisecond on the CPU
+};
+
+// Keeps a set of sprite positions and the index buffer that draws them back
+// to front. Sort either computes keys and sorts on the CPU and uploads the
+// permutation, or, with SetUseGPU, runs the same LSD radix sort in compute
+// shaders (four bits per pass, eight passes) so that neither the positions
+// nor the keys leave the GPU. Either way, draw with
+//
+//     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sorter.GetIndexBuffer());
+//     glDrawElements(GL_POINTS, count, GL_UNSIGNED_INT, NULL);
+//
+// sourcing the positions from GetPositionBuffer (a vec4 per sprite).
+class SpriteSorter
+{
+public:
+    SpriteSorter(void);
+    virtual ~SpriteSorter(void);
+
+    // Without 'gpu', no compute shaders are built and SetUseGPU does nothing
+    bool Initialize(unsigned int max_sprites, bool gpu = true);
+    void Free(void);
+
+    // Copies 'count' positions to the CPU and GPU copies
+    void SetPositions(const vmath::vec4 * positions, unsigned int count);
+    void SetSpriteCount(unsigned int count) { m_count = count < m_position_count ? count : m_position_count; }
+    unsigned int GetSpriteCount(void) const { return m_count; }
+
+    void SetUseGPU(bool gpu) { m_use_gpu = gpu && m_programs[0] != 0; }
+    bool GetUseGPU(void) const { return m_use_gpu; }
+
+    void Sort(JobSystem& jobs, const vmath::mat4& model_view);
+
+    GLuint GetPositionBuffer(void) const { return m_position_buffer; }
+    GLuint GetIndexBuffer(void) const { return m_value_buffers[0]; }
+
+    const SpriteSortStats& GetStats(void) const { return m_stats; }
+
+protected:
+    enum
+    {
+        PROGRAM_DEPTH,
+        PROGRAM_COUNT,
+        PROGRAM_SCAN,
+        PROGRAM_SCATTER,
+        PROGRAM_TOTAL,
+
+        GROUP_SIZE = 256,
+        GPU_RADIX_BITS = 4,
+        GPU_RADIX_SIZE = 1 << GPU_RADIX_BITS
+    };
+
+    void SortOnGPU(const vmath::mat4& model_view);
+
+    unsigned int                m_max_sprites;
+    unsigned int                m_position_count;
+    unsigned int                m_count;
+    bool                        m_use_gpu;
+
+    std::vector<vmath::vec4>    m_positions;
+    std::vector<unsigned int>   m_keys;
+    std::vector<unsigned int>   m_values;
+    RadixSorter                 m_sorter;
+
+    GLuint                      m_programs[PROGRAM_TOTAL];
+    GLuint                      m_position_buffer;
+    GLuint                      m_key_buffers[2];
+    GLuint                      m_value_buffers[2];   // The first is the index buffer
+    GLuint                      m_histogram_buffer;
+
+    struct
+    {
+        GLint depth_row;
+        GLint depth_count;
+        GLint count_count;
+        GLint count_shift;
+        GLint scan_size;
+        GLint scatter_count;
+        GLint scatter_shift;
+    } m_uniforms;
+
+    SpriteSortStats             m_stats;
+};
+
+#endif /* __VSORT_H__ */
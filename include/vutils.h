@@ -3,7 +3,7 @@
 
 #include "vgl.h"
 
-void vglAttachShaderSource(GLuint prog, GLenum type, const char * source)
+static inline void vglAttachShaderSource(GLuint prog, GLenum type, const char * source)
 {
     GLuint sh;
 
@@ -2,8 +2,11 @@
 
 #include "vbm.h"
 #include "vgl.h"
+#include "vpack.h"
+#include "vcodec.h"
 
 #include <stdio.h>
+#include <string.h>
 
 VBObject::VBObject(void)
     : m_vao(0),
@@ -11,9 +14,17 @@ VBObject::VBObject(void)
       m_index_buffer(0),
       m_attrib(0),
       m_frame(0),
-      m_material(0)
+      m_lod(0),
+      m_bounds(0),
+      m_joints(0),
+      m_clips(0),
+      m_clip_keys(0),
+      m_clip_first_key(0),
+      m_material(0),
+      m_vertex_data(0),
+      m_index_data(0)
 {
-
+    memset(&m_skeleton, 0, sizeof(m_skeleton));
 }
 
 VBObject::~VBObject(void)
@@ -21,7 +32,67 @@ VBObject::~VBObject(void)
     Free();
 }
 
-bool VBObject::LoadFromVBM(const char * filename, int vertexIndex, int normalIndex, int texCoord0Index)
+void VBObject::CalculateBounds(const float * positions, unsigned int components, const unsigned int * indices, unsigned int first, unsigned int count, VBM_BOUNDS& bounds)
+{
+    unsigned int i;
+    float r2 = 0.0f;
+
+    memset(&bounds, 0, sizeof(bounds));
+
+    if (count == 0)
+        return;
+
+    const float * p = positions + (indices ? indices[first] : first) * components;
+    bounds.min.x = bounds.max.x = p[0];
+    bounds.min.y = bounds.max.y = p[1];
+    bounds.min.z = bounds.max.z = p[2];
+
+    for (i = first; i < first + count; i++)
+    {
+        p = positions + (indices ? indices[i] : i) * components;
+        bounds.min.x = vmath::min(bounds.min.x, p[0]); bounds.max.x = vmath::max(bounds.max.x, p[0]);
+        bounds.min.y = vmath::min(bounds.min.y, p[1]); bounds.max.y = vmath::max(bounds.max.y, p[1]);
+        bounds.min.z = vmath::min(bounds.min.z, p[2]); bounds.max.z = vmath::max(bounds.max.z, p[2]);
+    }
+
+    // Sphere around the center of the box, just big enough to hold every vertex
+    bounds.center.x = (bounds.min.x + bounds.max.x) * 0.5f;
+    bounds.center.y = (bounds.min.y + bounds.max.y) * 0.5f;
+    bounds.center.z = (bounds.min.z + bounds.max.z) * 0.5f;
+
+    for (i = first; i < first + count; i++)
+    {
+        p = positions + (indices ? indices[i] : i) * components;
+        const float dx = p[0] - bounds.center.x;
+        const float dy = p[1] - bounds.center.y;
+        const float dz = p[2] - bounds.center.z;
+        r2 = vmath::max(r2, dx * dx + dy * dy + dz * dz);
+    }
+
+    bounds.radius = sqrtf(r2);
+}
+
+// The type 'attrib' is uploaded as with VBM_LOAD_PACK_VERTICES. Unit
+// normals lose a tenth of a degree at most in ten bits a component, and
+// halves place texture coordinates between 0 and 1 to within 1/2048, a
+// texel of a 2048 texture. Anything else stays as it is in the file.
+GLenum VBObject::GetPackedType(const VBM_ATTRIB_HEADER& attrib)
+{
+    if (attrib.type != GL_FLOAT)
+        return attrib.type;
+
+    if (strncmp(attrib.name, "normal", sizeof(attrib.name)) == 0 && attrib.components == 3)
+        return GL_INT_2_10_10_10_REV;
+
+    // obj2vbm names them "texcoord"; the meshes in media/ call them "map1"
+    if ((strncmp(attrib.name, "texcoord", sizeof(attrib.name)) == 0 || strncmp(attrib.name, "map1", sizeof(attrib.name)) == 0) &&
+        (attrib.components == 2 || attrib.components == 4))
+        return GL_HALF_FLOAT;
+
+    return attrib.type;
+}
+
+bool VBObject::LoadFromVBM(const char * filename, int vertexIndex, int normalIndex, int texCoord0Index, unsigned int flags)
 {
     FILE * f = NULL;
 
@@ -40,76 +111,271 @@ bool VBObject::LoadFromVBM(const char * filename, int vertexIndex, int normalInd
 
     VBM_HEADER_OLD * oldHeader = (VBM_HEADER_OLD *)data;
     VBM_HEADER * header = (VBM_HEADER *)data;
-    raw_data = data + header->size + header->num_attribs * sizeof(VBM_ATTRIB_HEADER) + header->num_frames * sizeof(VBM_FRAME_HEADER);
     VBM_ATTRIB_HEADER * attrib_header = (VBM_ATTRIB_HEADER *)(data + header->size);
     VBM_FRAME_HEADER * frame_header = (VBM_FRAME_HEADER *)(data + header->size + header->num_attribs * sizeof(VBM_ATTRIB_HEADER));
     unsigned int total_data_size = 0;
+    unsigned int i;
 
-    if (header->magic == 0x314d4253)
+    if (header->magic == VBM_MAGIC_CURRENT)
     {
         memset(&m_header, 0, sizeof(m_header));
         memcpy(&m_header, header, header->size > sizeof(VBM_HEADER) ? sizeof(VBM_HEADER) : header->size);
     }
     else
     {
-        memcpy(&m_header, oldHeader, sizeof(VBM_HEADER));
+        memset(&m_header, 0, sizeof(m_header));
+        memcpy(&m_header, oldHeader, sizeof(VBM_HEADER_OLD));
         m_header.num_vertices = oldHeader->num_vertices;
         m_header.num_indices = oldHeader->num_indices;
         m_header.index_type = oldHeader->index_type;
         m_header.num_materials = oldHeader->num_materials;
         m_header.flags = oldHeader->flags;
+        m_header.num_lods = 0;
     }
     m_attrib = new VBM_ATTRIB_HEADER[m_header.num_attribs];
     memcpy(m_attrib, attrib_header, m_header.num_attribs * sizeof(VBM_ATTRIB_HEADER));
     m_frame = new VBM_FRAME_HEADER[m_header.num_frames];
     memcpy(m_frame, frame_header, m_header.num_frames * sizeof(VBM_FRAME_HEADER));
 
-    glGenVertexArrays(1, &m_vao);
-    glBindVertexArray(m_vao);
-    glGenBuffers(1, &m_attribute_buffer);
-    glBindBuffer(GL_ARRAY_BUFFER, m_attribute_buffer);
+    // Level of detail headers, if present, sit between the frames and the vertex data
+    if ((m_header.flags & VBM_FLAG_HAS_LODS) == 0)
+        m_header.num_lods = 0;
+    if (m_header.num_lods != 0)
+    {
+        m_lod = new VBM_LOD_HEADER[m_header.num_lods];
+        memcpy(m_lod, frame_header + m_header.num_frames, m_header.num_lods * sizeof(VBM_LOD_HEADER));
+    }
 
-    unsigned int i;
+    raw_data = (unsigned char *)(frame_header + m_header.num_frames) + m_header.num_lods * sizeof(VBM_LOD_HEADER);
 
-    for (i = 0; i < m_header.num_attribs; i++) {
-        total_data_size += m_attrib[i].components * sizeof(GLfloat) * m_header.num_vertices;
+    // Per-frame bounds follow the level of detail headers. Older files don't
+    // have them, so calculate them from the positions (attribute 0) instead,
+    // once the skeleton has been skipped.
+    m_bounds = new VBM_BOUNDS[m_header.num_frames];
+    if (m_header.flags & VBM_FLAG_HAS_BOUNDS)
+    {
+        memcpy(m_bounds, raw_data, m_header.num_frames * sizeof(VBM_BOUNDS));
+        raw_data += m_header.num_frames * sizeof(VBM_BOUNDS);
+    }
+
+    // Then the skeleton and its clips
+    memset(&m_skeleton, 0, sizeof(m_skeleton));
+    if (m_header.flags & VBM_FLAG_HAS_SKELETON)
+    {
+        unsigned int total_keys = 0;
+
+        memcpy(&m_skeleton, raw_data, sizeof(VBM_SKELETON_HEADER));
+        raw_data += sizeof(VBM_SKELETON_HEADER);
+
+        m_joints = new VBM_JOINT[m_skeleton.num_joints];
+        memcpy(m_joints, raw_data, m_skeleton.num_joints * sizeof(VBM_JOINT));
+        raw_data += m_skeleton.num_joints * sizeof(VBM_JOINT);
+
+        // Find out how many keys there are in all, then gather them up
+        const unsigned char * clip_data = raw_data;
+
+        m_clips = new VBM_CLIP_HEADER[m_skeleton.num_clips];
+        m_clip_first_key = new unsigned int[m_skeleton.num_clips];
+        for (i = 0; i < m_skeleton.num_clips; i++)
+        {
+            memcpy(&m_clips[i], clip_data, sizeof(VBM_CLIP_HEADER));
+            m_clip_first_key[i] = total_keys;
+            total_keys += m_clips[i].num_keys * m_skeleton.num_joints;
+            clip_data += sizeof(VBM_CLIP_HEADER) + m_clips[i].num_keys * m_skeleton.num_joints * sizeof(VBM_JOINT_POSE);
+        }
+
+        m_clip_keys = new VBM_JOINT_POSE[total_keys];
+        for (i = 0; i < m_skeleton.num_clips; i++)
+        {
+            const unsigned int keys = m_clips[i].num_keys * m_skeleton.num_joints;
+
+            raw_data += sizeof(VBM_CLIP_HEADER);
+            memcpy(m_clip_keys + m_clip_first_key[i], raw_data, keys * sizeof(VBM_JOINT_POSE));
+            raw_data += keys * sizeof(VBM_JOINT_POSE);
+        }
+    }
+
+    // Compressed files are decoded into the layout of an uncompressed one,
+    // after which they load like any other
+    unsigned char * decoded_data = NULL;
+
+    if (m_header.flags & VBM_FLAG_HAS_COMPRESSION)
+    {
+        decoded_data = DecodeStreams(raw_data, data + filesize);
+        if (decoded_data == NULL)
+        {
+            delete [] data;
+            Free();
+            return false;
+        }
+        raw_data = decoded_data;
     }
 
-    glBufferData(GL_ARRAY_BUFFER, total_data_size, raw_data, GL_STATIC_DRAW);
+    if ((m_header.flags & VBM_FLAG_HAS_BOUNDS) != 0)
+    {
+        // Already read
+    }
+    else if (m_header.num_attribs != 0)
+    {
+        const float * positions = (const float *)raw_data;
+        const unsigned int components = m_attrib[0].components;
+        const unsigned int * indices = NULL;
+        GLuint * wide_indices = NULL;
+
+        for (i = 0; i < m_header.num_attribs; i++)
+            total_data_size += m_attrib[i].components * sizeof(GLfloat) * m_header.num_vertices;
+        if (m_header.num_indices != 0 && m_header.index_type == GL_UNSIGNED_SHORT)
+        {
+            // CalculateBounds takes 32-bit indices
+            const GLushort * short_indices = (const GLushort *)(raw_data + total_data_size);
 
-    total_data_size = 0;
+            wide_indices = new GLuint[m_header.num_indices];
+            for (i = 0; i < m_header.num_indices; i++)
+                wide_indices[i] = short_indices[i];
+            indices = wide_indices;
+        }
+        else if (m_header.num_indices != 0)
+        {
+            indices = (const unsigned int *)(raw_data + total_data_size);
+        }
+        total_data_size = 0;
+
+        for (i = 0; i < m_header.num_frames; i++)
+            CalculateBounds(positions, components, indices, m_frame[i].first, m_frame[i].count, m_bounds[i]);
+        CalculateBounds(positions, components, NULL, 0, m_header.num_vertices, m_header.bounds);
+
+        delete [] wide_indices;
+    }
+    else
+    {
+        memset(m_bounds, 0, m_header.num_frames * sizeof(VBM_BOUNDS));
+    }
 
     for (i = 0; i < m_header.num_attribs; i++) {
-        int attribIndex = i;
-
-        if(attribIndex == 0)
-            attribIndex = vertexIndex;
-        else if(attribIndex == 1)
-            attribIndex = normalIndex;
-         else if(attribIndex == 2)
-            attribIndex = texCoord0Index;
-
-        glVertexAttribPointer(attribIndex, m_attrib[i].components, m_attrib[i].type, GL_FALSE, 0, (GLvoid *)total_data_size);
-        glEnableVertexAttribArray(attribIndex);
-        total_data_size += m_attrib[i].components * sizeof(GLfloat) * header->num_vertices;
-    }
-
-    if (m_header.num_indices) {
-        glGenBuffers(1, &m_index_buffer);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_index_buffer);
-        unsigned int element_size;
-        switch (header->index_type) {
-            case GL_UNSIGNED_SHORT:
-                element_size = sizeof(GLushort);
-                break;
-            default:
-                element_size = sizeof(GLuint);
-                break;
+        total_data_size += m_attrib[i].components * sizeof(GLfloat) * m_header.num_vertices;
+    }
+
+    if (flags & (VBM_LOAD_KEEP_DATA | VBM_LOAD_CPU_ONLY))
+    {
+        m_vertex_data = new float[total_data_size / sizeof(float)];
+        memcpy(m_vertex_data, raw_data, total_data_size);
+
+        if (m_header.num_indices)
+        {
+            m_index_data = new GLuint[m_header.num_indices];
+            if (header->index_type == GL_UNSIGNED_SHORT)
+            {
+                const GLushort * short_indices = (const GLushort *)(raw_data + total_data_size);
+                for (i = 0; i < m_header.num_indices; i++)
+                    m_index_data[i] = short_indices[i];
+            }
+            else
+            {
+                memcpy(m_index_data, raw_data + total_data_size, m_header.num_indices * sizeof(GLuint));
+            }
         }
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_header.num_indices * element_size, raw_data + total_data_size, GL_STATIC_DRAW);
     }
 
-    glBindVertexArray(0);
+    if ((flags & VBM_LOAD_CPU_ONLY) == 0)
+    {
+        glGenVertexArrays(1, &m_vao);
+        glBindVertexArray(m_vao);
+        glGenBuffers(1, &m_attribute_buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, m_attribute_buffer);
+
+        if (flags & VBM_LOAD_PACK_VERTICES)
+        {
+            // Lay the attributes out one after another as before, but
+            // each in its packed type
+            size_t packed_size = 0;
+
+            for (i = 0; i < m_header.num_attribs; i++) {
+                const GLenum type = GetPackedType(m_attrib[i]);
+
+                if (type == GL_INT_2_10_10_10_REV)
+                    packed_size += sizeof(GLuint) * m_header.num_vertices;
+                else if (type == GL_HALF_FLOAT)
+                    packed_size += m_attrib[i].components * sizeof(GLushort) * m_header.num_vertices;
+                else
+                    packed_size += m_attrib[i].components * sizeof(GLfloat) * m_header.num_vertices;
+            }
+
+            unsigned char * packed_data = new unsigned char [packed_size];
+            const float * source = (const float *)raw_data;
+            size_t offset = 0;
+
+            for (i = 0; i < m_header.num_attribs; i++) {
+                const GLenum type = GetPackedType(m_attrib[i]);
+                const unsigned int values = m_attrib[i].components * m_header.num_vertices;
+                int attribIndex = i;
+
+                if(attribIndex == 0)
+                    attribIndex = vertexIndex;
+                else if(attribIndex == 1)
+                    attribIndex = normalIndex;
+                 else if(attribIndex == 2)
+                    attribIndex = texCoord0Index;
+
+                if (type == GL_INT_2_10_10_10_REV) {
+                    vmath::pack_snorm_2_10_10_10((GLuint *)(packed_data + offset), (const vmath::vec3 *)source, m_header.num_vertices);
+                    glVertexAttribPointer(attribIndex, 4, type, GL_TRUE, 0, (GLvoid *)offset);
+                    offset += sizeof(GLuint) * m_header.num_vertices;
+                } else if (type == GL_HALF_FLOAT) {
+                    vmath::float_to_half((GLushort *)(packed_data + offset), source, values);
+                    glVertexAttribPointer(attribIndex, m_attrib[i].components, type, GL_FALSE, 0, (GLvoid *)offset);
+                    offset += values * sizeof(GLushort);
+                } else {
+                    memcpy(packed_data + offset, source, values * sizeof(GLfloat));
+                    glVertexAttribPointer(attribIndex, m_attrib[i].components, type, GL_FALSE, 0, (GLvoid *)offset);
+                    offset += values * sizeof(GLfloat);
+                }
+                glEnableVertexAttribArray(attribIndex);
+                source += values;
+            }
+
+            glBufferData(GL_ARRAY_BUFFER, packed_size, packed_data, GL_STATIC_DRAW);
+
+            delete [] packed_data;
+        }
+        else
+        {
+            glBufferData(GL_ARRAY_BUFFER, total_data_size, raw_data, GL_STATIC_DRAW);
+
+            total_data_size = 0;
+
+            for (i = 0; i < m_header.num_attribs; i++) {
+                int attribIndex = i;
+
+                if(attribIndex == 0)
+                    attribIndex = vertexIndex;
+                else if(attribIndex == 1)
+                    attribIndex = normalIndex;
+                 else if(attribIndex == 2)
+                    attribIndex = texCoord0Index;
+
+                glVertexAttribPointer(attribIndex, m_attrib[i].components, m_attrib[i].type, GL_FALSE, 0, (GLvoid *)total_data_size);
+                glEnableVertexAttribArray(attribIndex);
+                total_data_size += m_attrib[i].components * sizeof(GLfloat) * header->num_vertices;
+            }
+        }
+
+        if (m_header.num_indices) {
+            glGenBuffers(1, &m_index_buffer);
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_index_buffer);
+            unsigned int element_size;
+            switch (header->index_type) {
+                case GL_UNSIGNED_SHORT:
+                    element_size = sizeof(GLushort);
+                    break;
+                default:
+                    element_size = sizeof(GLuint);
+                    break;
+            }
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_header.num_indices * element_size, raw_data + total_data_size, GL_STATIC_DRAW);
+        }
+
+        glBindVertexArray(0);
+    }
 
     if (m_header.num_materials != 0)
     {
@@ -129,19 +395,135 @@ bool VBObject::LoadFromVBM(const char * filename, int vertexIndex, int normalInd
     }
     */
 
+    delete [] decoded_data;
     delete [] data;
 
     return true;
 }
 
+// Decodes the streams of a compressed file: every attribute's vertex data,
+// then the indices, then whatever follows (the materials) copied as it is.
+// Returns NULL if the streams are damaged or don't match the header.
+unsigned char * VBObject::DecodeStreams(const unsigned char * in, const unsigned char * end) const
+{
+    const unsigned int index_size = m_header.index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+    const unsigned int num_streams = m_header.num_attribs + (m_header.num_indices != 0 ? 1 : 0);
+    const unsigned char * p = in;
+    VBM_STREAM_HEADER stream;
+    size_t decoded_size = 0;
+    size_t padded;
+    unsigned int i;
+
+    // Find the end of the streams first, to know how much follows them
+    for (i = 0; i < num_streams; i++)
+    {
+        if (end - p < (ptrdiff_t)sizeof(stream))
+            return NULL;
+        memcpy(&stream, p, sizeof(stream));
+        p += sizeof(stream);
+        // Check the size before rounding it up, which could wrap
+        if ((size_t)(end - p) < stream.size)
+            return NULL;
+        padded = ((size_t)stream.size + 3) & ~(size_t)3;
+        if ((size_t)(end - p) < padded)
+            return NULL;
+        p += padded;
+    }
+
+    for (i = 0; i < m_header.num_attribs; i++)
+        decoded_size += m_attrib[i].components * sizeof(GLfloat) * m_header.num_vertices;
+    decoded_size += m_header.num_indices * index_size;
+
+    unsigned char * out = new unsigned char [decoded_size + (end - p)];
+    size_t offset = 0;
+    bool ok = true;
+
+    p = in;
+    for (i = 0; i < num_streams && ok; i++)
+    {
+        memcpy(&stream, p, sizeof(stream));
+        p += sizeof(stream);
+        padded = ((size_t)stream.size + 3) & ~(size_t)3;
+
+        // The first pass checked these, but don't let a decoder read past
+        // the end if that ever changes
+        if ((size_t)(end - p) < stream.size || (size_t)(end - p) < padded)
+        {
+            ok = false;
+            break;
+        }
+
+        if (i < m_header.num_attribs)
+        {
+            const size_t size = m_attrib[i].components * sizeof(GLfloat) * m_header.num_vertices;
+
+            if (stream.codec == VBM_CODEC_DELTA)
+                ok = vbm_decode_vertices(out + offset, m_attrib[i].components, m_header.num_vertices, p, stream.size);
+            else if (stream.codec == VBM_CODEC_NONE && stream.size == size)
+                memcpy(out + offset, p, size);
+            else
+                ok = false;
+            offset += size;
+        }
+        else
+        {
+            const size_t size = m_header.num_indices * index_size;
+
+            if (stream.codec == VBM_CODEC_FAN)
+            {
+                // Coded as 32-bit values whatever their type. Damage in a
+                // plane stored raw can't be seen by the decoder, so check
+                // that what comes out points at real vertices.
+                GLuint * indices = index_size == sizeof(GLuint) ? (GLuint *)(out + offset) : new GLuint [m_header.num_indices];
+                unsigned int j;
+
+                ok = vbm_decode_indices(indices, m_header.num_indices, p, stream.size);
+                for (j = 0; j < m_header.num_indices && ok; j++)
+                    ok = indices[j] < m_header.num_vertices;
+                if (index_size != sizeof(GLuint))
+                {
+                    for (j = 0; j < m_header.num_indices; j++)
+                        ((GLushort *)(out + offset))[j] = (GLushort)indices[j];
+                    delete [] indices;
+                }
+            }
+            else if (stream.codec == VBM_CODEC_NONE && stream.size == size)
+            {
+                memcpy(out + offset, p, size);
+            }
+            else
+            {
+                ok = false;
+            }
+            offset += size;
+        }
+
+        p += padded;
+    }
+
+    if (!ok)
+    {
+        delete [] out;
+        return NULL;
+    }
+
+    memcpy(out + offset, p, end - p);
+
+    return out;
+}
+
 bool VBObject::Free(void)
 {
-    glDeleteBuffers(1, &m_index_buffer);
-    m_index_buffer = 0;
-    glDeleteBuffers(1, &m_attribute_buffer);
-    m_attribute_buffer = 0;
-    glDeleteVertexArrays(1, &m_vao);
-    m_vao = 0;
+    // Objects loaded with VBM_LOAD_CPU_ONLY may not have a context to talk to
+    if (m_vao != 0)
+    {
+        glDeleteBuffers(1, &m_index_buffer);
+        m_index_buffer = 0;
+        glDeleteBuffers(1, &m_attribute_buffer);
+        m_attribute_buffer = 0;
+        glDeleteVertexArrays(1, &m_vao);
+        m_vao = 0;
+    }
 
     delete [] m_attrib;
     m_attrib = NULL;
@@ -149,12 +531,81 @@ bool VBObject::Free(void)
     delete [] m_frame;
     m_frame = NULL;
 
+    delete [] m_lod;
+    m_lod = NULL;
+
+    delete [] m_bounds;
+    m_bounds = NULL;
+
+    delete [] m_joints;
+    m_joints = NULL;
+
+    delete [] m_clips;
+    m_clips = NULL;
+
+    delete [] m_clip_keys;
+    m_clip_keys = NULL;
+
+    delete [] m_clip_first_key;
+    m_clip_first_key = NULL;
+
+    memset(&m_skeleton, 0, sizeof(m_skeleton));
+
     delete [] m_material;
     m_material = NULL;
 
+    delete [] m_vertex_data;
+    m_vertex_data = NULL;
+
+    delete [] m_index_data;
+    m_index_data = NULL;
+
     return true;
 }
 
+unsigned int VBObject::SelectLOD(float screen_size, float max_pixel_error) const
+{
+    unsigned int i;
+
+    if (m_header.num_lods == 0)
+        return 0;
+
+    // Error is stored relative to the bounding radius, which covers half the screen size
+    for (i = m_header.num_lods; i > 0; i--)
+    {
+        if (m_lod[i - 1].error * screen_size * 0.5f <= max_pixel_error)
+            return m_lod[i - 1].frame;
+    }
+
+    return m_lod[0].frame;
+}
+
+void VBObject::GetDrawCommand(unsigned int frame_index, unsigned int instances, GLuint command[5]) const
+{
+    memset(command, 0, 5 * sizeof(GLuint));
+
+    if (frame_index >= m_header.num_frames)
+        return;
+
+    command[0] = m_frame[frame_index].count;
+    command[1] = instances;
+    command[2] = m_frame[frame_index].first;
+}
+
+void VBObject::RenderIndirect(GLuint indirect_buffer, GLintptr offset)
+{
+    glBindVertexArray(m_vao);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer);
+
+    if (m_header.num_indices)
+        glDrawElementsIndirect(GL_TRIANGLES, GetIndexType(), (const GLvoid *)offset);
+    else
+        glDrawArraysIndirect(GL_TRIANGLES, (const GLvoid *)offset);
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindVertexArray(0);
+}
+
 void VBObject::Render(unsigned int frame_index, unsigned int instances)
 {
     if (frame_index >= m_header.num_frames)
@@ -186,17 +637,47 @@ void VBObject::Render(unsigned int frame_index, unsigned int instances)
     else
     */
     {
+        const GLenum index_type = GetIndexType();
+        const size_t first_byte = m_frame[frame_index].first * (index_type == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint));
+
         if (instances) {
             if (m_header.num_indices)
-                glDrawElementsInstanced(GL_TRIANGLES, m_frame[frame_index].count, GL_UNSIGNED_INT, (GLvoid *)(m_frame[frame_index].first * sizeof(GLuint)), instances);
+                glDrawElementsInstanced(GL_TRIANGLES, m_frame[frame_index].count, index_type, (GLvoid *)first_byte, instances);
             else
                 glDrawArraysInstanced(GL_TRIANGLES, m_frame[frame_index].first, m_frame[frame_index].count, instances);
         } else {
             if (m_header.num_indices)
-                glDrawElements(GL_TRIANGLES, m_frame[frame_index].count, GL_UNSIGNED_INT, (GLvoid *)(m_frame[frame_index].first * sizeof(GLuint)));
+                glDrawElements(GL_TRIANGLES, m_frame[frame_index].count, index_type, (GLvoid *)first_byte);
             else
                 glDrawArrays(GL_TRIANGLES, m_frame[frame_index].first, m_frame[frame_index].count);
         }
     }
     glBindVertexArray(0);
 }
+
+int VBObject::FindAttribute(const char * name) const
+{
+    unsigned int i;
+
+    for (i = 0; i < m_header.num_attribs; i++)
+    {
+        if (strncmp(m_attrib[i].name, name, sizeof(m_attrib[i].name)) == 0)
+            return (int)i;
+    }
+
+    return -1;
+}
+
+const float * VBObject::GetAttributeData(unsigned int index) const
+{
+    const float * data = m_vertex_data;
+    unsigned int i;
+
+    if (data == NULL || index >= m_header.num_attribs)
+        return NULL;
+
+    for (i = 0; i < index; i++)
+        data += m_attrib[i].components * m_header.num_vertices;
+
+    return data;
+}
@@ -0,0 +1,539 @@
+#include "vcluster.h"
+#include "vjobs.h"
+#include "vsimd.h"
+#include "vutils.h"
+
+#include <math.h>
+#include <string.h>
+#include <chrono>
+
+using namespace vmath;
+
+// One work group per froxel. Its invocations stride through the lights,
+// collect the ones that touch the froxel in shared memory, then reserve
+// space in the index list for all of them at once.
+static const char assign_source[] =
+    "#version 430 core\n"
+    "\n"
+    "#define CLUSTER_MAX_LIGHTS 256\n"
+    "\n"
+    "layout (local_size_x = 64) in;\n"
+    "\n"
+    "layout (std430, binding = 0) readonly buffer CLUSTER_LIGHTS\n"
+    "{\n"
+    "    vec4 lights[];\n"
+    "};\n"
+    "\n"
+    "layout (std430, binding = 1) writeonly buffer CLUSTER_RANGES\n"
+    "{\n"
+    "    uvec2 clusters[];\n"
+    "};\n"
+    "\n"
+    "layout (std430, binding = 2) writeonly buffer CLUSTER_INDICES\n"
+    "{\n"
+    "    uint light_indices[];\n"
+    "};\n"
+    "\n"
+    "layout (std430, binding = 3) readonly buffer CLUSTER_BOUNDS\n"
+    "{\n"
+    "    vec4 bounds[];\n"
+    "};\n"
+    "\n"
+    "layout (std430, binding = 4) buffer CLUSTER_COUNTER\n"
+    "{\n"
+    "    uint next_index;\n"
+    "};\n"
+    "\n"
+    "uniform uint light_count;\n"
+    "uniform uint max_indices;\n"
+    "\n"
+    "shared uint cluster_lights[CLUSTER_MAX_LIGHTS];\n"
+    "shared uint cluster_count;\n"
+    "shared uint cluster_offset;\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    uint cluster = gl_WorkGroupID.x +\n"
+    "                   (gl_WorkGroupID.y + gl_WorkGroupID.z * gl_NumWorkGroups.y) * gl_NumWorkGroups.x;\n"
+    "    vec3 bmin = bounds[cluster * 2].xyz;\n"
+    "    vec3 bmax = bounds[cluster * 2 + 1].xyz;\n"
+    "    uint i;\n"
+    "\n"
+    "    if (gl_LocalInvocationIndex == 0)\n"
+    "        cluster_count = 0;\n"
+    "\n"
+    "    memoryBarrierShared();\n"
+    "    barrier();\n"
+    "\n"
+    "    for (i = gl_LocalInvocationIndex; i < light_count; i += gl_WorkGroupSize.x)\n"
+    "    {\n"
+    "        vec4 light = lights[i * 2];\n"
+    "        vec3 d = max(max(bmin - light.xyz, light.xyz - bmax), vec3(0.0));\n"
+    "\n"
+    "        if (dot(d, d) <= light.w * light.w)\n"
+    "        {\n"
+    "            uint slot = atomicAdd(cluster_count, 1u);\n"
+    "            if (slot < CLUSTER_MAX_LIGHTS)\n"
+    "                cluster_lights[slot] = i;\n"
+    "        }\n"
+    "    }\n"
+    "\n"
+    "    memoryBarrierShared();\n"
+    "    barrier();\n"
+    "\n"
+    "    uint count = min(cluster_count, uint(CLUSTER_MAX_LIGHTS));\n"
+    "\n"
+    "    if (gl_LocalInvocationIndex == 0)\n"
+    "        cluster_offset = atomicAdd(next_index, count);\n"
+    "\n"
+    "    memoryBarrierShared();\n"
+    "    barrier();\n"
+    "\n"
+    "    uint offset = cluster_offset;\n"
+    "\n"
+    "    // Out of room in the index list\n"
+    "    if (offset >= max_indices)\n"
+    "        count = 0;\n"
+    "    else if (offset + count > max_indices)\n"
+    "        count = max_indices - offset;\n"
+    "\n"
+    "    for (i = gl_LocalInvocationIndex; i < count; i += gl_WorkGroupSize.x)\n"
+    "        light_indices[offset + i] = cluster_lights[i];\n"
+    "\n"
+    "    if (gl_LocalInvocationIndex == 0)\n"
+    "        clusters[cluster] = uvec2(offset, count);\n"
+    "}\n";
+
+ClusteredLighting::ClusteredLighting(void)
+    : m_max_lights(0),
+      m_max_light_indices(0),
+      m_program(0),
+      m_light_count_loc(-1),
+      m_max_indices_loc(-1),
+      m_params_buffer(0),
+      m_light_buffer(0),
+      m_range_buffer(0),
+      m_index_buffer(0),
+      m_bounds_buffer(0),
+      m_counter_buffer(0)
+{
+    m_grid[0] = m_grid[1] = m_grid[2] = 0;
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+ClusteredLighting::~ClusteredLighting(void)
+{
+    Free();
+}
+
+bool ClusteredLighting::Initialize(unsigned int grid_x, unsigned int grid_y, unsigned int grid_z,
+                                   unsigned int max_lights, unsigned int max_light_indices)
+{
+    const unsigned int cluster_count = grid_x * grid_y * grid_z;
+    GLint linked = GL_FALSE;
+
+    Free();
+
+    m_program = glCreateProgram();
+    vglAttachShaderSource(m_program, GL_COMPUTE_SHADER, assign_source);
+    glLinkProgram(m_program);
+    glGetProgramiv(m_program, GL_LINK_STATUS, &linked);
+
+    if (!linked)
+    {
+        Free();
+        return false;
+    }
+
+    m_light_count_loc = glGetUniformLocation(m_program, "light_count");
+    m_max_indices_loc = glGetUniformLocation(m_program, "max_indices");
+
+    m_grid[0] = grid_x;
+    m_grid[1] = grid_y;
+    m_grid[2] = grid_z;
+    m_max_lights = max_lights;
+    m_max_light_indices = max_light_indices ? max_light_indices : cluster_count * 64;
+
+    m_bounds_min.resize(cluster_count);
+    m_bounds_max.resize(cluster_count);
+
+    GLuint buffers[6];
+    glGenBuffers(6, buffers);
+    m_params_buffer = buffers[0];
+    m_light_buffer = buffers[1];
+    m_range_buffer = buffers[2];
+    m_index_buffer = buffers[3];
+    m_bounds_buffer = buffers[4];
+    m_counter_buffer = buffers[5];
+
+    glBindBuffer(GL_UNIFORM_BUFFER, m_params_buffer);
+    glBufferStorage(GL_UNIFORM_BUFFER, 3 * sizeof(vec4), NULL, GL_DYNAMIC_STORAGE_BIT);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_light_buffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, max_lights * 2 * sizeof(vec4), NULL, GL_DYNAMIC_STORAGE_BIT);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_range_buffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, cluster_count * 2 * sizeof(GLuint), NULL, GL_DYNAMIC_STORAGE_BIT);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_index_buffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, m_max_light_indices * sizeof(GLuint), NULL, GL_DYNAMIC_STORAGE_BIT);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_bounds_buffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, cluster_count * 2 * sizeof(vec4), NULL, GL_DYNAMIC_STORAGE_BIT);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_counter_buffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), NULL, 0);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    return true;
+}
+
+void ClusteredLighting::Free(void)
+{
+    GLuint buffers[6] = { m_params_buffer, m_light_buffer, m_range_buffer, m_index_buffer, m_bounds_buffer, m_counter_buffer };
+
+    glDeleteBuffers(6, buffers);
+    m_params_buffer = m_light_buffer = m_range_buffer = m_index_buffer = m_bounds_buffer = m_counter_buffer = 0;
+
+    glDeleteProgram(m_program);
+    m_program = 0;
+
+    m_lights.clear();
+    m_view_lights.clear();
+    m_bounds_min.clear();
+    m_bounds_max.clear();
+}
+
+void ClusteredLighting::SetProjection(const mat4& projection, float n, float f, GLsizei width, GLsizei height)
+{
+    const unsigned int gx = m_grid[0], gy = m_grid[1], gz = m_grid[2];
+    const float log_depth = logf(f / n);
+    unsigned int x, y, z;
+    int i;
+
+    if (m_program == 0)
+        return;
+
+    for (z = 0; z < gz; z++)
+    {
+        // Exponential slices keep froxels roughly cubical
+        const float d0 = n * powf(f / n, float(z) / float(gz));
+        const float d1 = n * powf(f / n, float(z + 1) / float(gz));
+
+        for (y = 0; y < gy; y++)
+        {
+            for (x = 0; x < gx; x++)
+            {
+                const unsigned int c = x + (y + z * gy) * gx;
+                vec4 bmin(1e30f, 1e30f, 1e30f, 0.0f);
+                vec4 bmax(-1e30f, -1e30f, -1e30f, 0.0f);
+
+                // Unproject the corners of the tile at both depths. For a
+                // perspective projection clip-space w is the view depth.
+                for (i = 0; i < 8; i++)
+                {
+                    const float xn = -1.0f + 2.0f * float(x + (i & 1)) / float(gx);
+                    const float yn = -1.0f + 2.0f * float(y + ((i >> 1) & 1)) / float(gy);
+                    const float d = (i & 4) ? d1 : d0;
+                    const vec4 p(d * (xn + projection[2][0]) / projection[0][0],
+                                 d * (yn + projection[2][1]) / projection[1][1],
+                                 -d, 0.0f);
+
+                    for (int j = 0; j < 3; j++)
+                    {
+                        bmin[j] = min(bmin[j], p[j]);
+                        bmax[j] = max(bmax[j], p[j]);
+                    }
+                }
+
+                m_bounds_min[c] = bmin;
+                m_bounds_max[c] = bmax;
+            }
+        }
+    }
+
+    std::vector<vec4> bounds(gx * gy * gz * 2);
+    for (x = 0; x < gx * gy * gz; x++)
+    {
+        bounds[x * 2] = m_bounds_min[x];
+        bounds[x * 2 + 1] = m_bounds_max[x];
+    }
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_bounds_buffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, bounds.size() * sizeof(vec4), &bounds[0]);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    const GLuint grid[4] = { gx, gy, gz, 0 };
+    const vec4 depth(float(gz) / log_depth, -float(gz) * logf(n) / log_depth, n, f);
+    const vec4 tile(float(gx) / float(width), float(gy) / float(height), 0.0f, 0.0f);
+
+    glBindBuffer(GL_UNIFORM_BUFFER, m_params_buffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(grid), grid);
+    glBufferSubData(GL_UNIFORM_BUFFER, sizeof(vec4), sizeof(vec4), depth);
+    glBufferSubData(GL_UNIFORM_BUFFER, 2 * sizeof(vec4), sizeof(vec4), tile);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void ClusteredLighting::SetLights(const ClusterLight * lights, unsigned int count)
+{
+    if (count > m_max_lights)
+        count = m_max_lights;
+
+    m_lights.assign(lights, lights + count);
+}
+
+void ClusteredLighting::Update(JobSystem& jobs, const mat4& view_matrix, bool use_cpu)
+{
+    const unsigned int count = (unsigned int)m_lights.size();
+    const unsigned int stride = (count + 7) & ~7u;
+    const unsigned int cluster_count = m_grid[0] * m_grid[1] * m_grid[2];
+    const mat4& v = view_matrix;
+    std::vector<vec4> gpu_lights(count * 2);
+    unsigned int i;
+
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+    // Move the lights into view space, once for the shaders and once as
+    // separate components for the CPU assignment
+    m_view_lights.resize(stride * 4);
+    float * x = &m_view_lights[0];
+    float * y = x + stride;
+    float * z = y + stride;
+    float * r = z + stride;
+
+    for (i = 0; i < count; i++)
+    {
+        const vec4& p = m_lights[i].position;
+
+        x[i] = v[0][0] * p[0] + v[1][0] * p[1] + v[2][0] * p[2] + v[3][0];
+        y[i] = v[0][1] * p[0] + v[1][1] * p[1] + v[2][1] * p[2] + v[3][1];
+        z[i] = v[0][2] * p[0] + v[1][2] * p[1] + v[2][2] * p[2] + v[3][2];
+        r[i] = p[3];
+
+        gpu_lights[i * 2] = vec4(x[i], y[i], z[i], r[i]);
+        gpu_lights[i * 2 + 1] = m_lights[i].color;
+    }
+
+    if (count != 0)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_light_buffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count * 2 * sizeof(vec4), &gpu_lights[0]);
+    }
+
+    m_stats.lights = count;
+
+    if (use_cpu)
+    {
+        std::vector<GLuint> ranges(cluster_count * 2);
+        std::vector<GLuint> indices(m_max_light_indices);
+
+        const unsigned int index_count = AssignReference(jobs, x, y, z, r, count, &m_bounds_min[0], &m_bounds_max[0],
+                                                         m_grid[0], m_grid[1], m_grid[2],
+                                                         &ranges[0], &indices[0], m_max_light_indices, &m_stats);
+
+        m_stats.assign_time = std::chrono::duration<float, std::micro>(std::chrono::high_resolution_clock::now() - start).count();
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_range_buffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, ranges.size() * sizeof(GLuint), &ranges[0]);
+        if (index_count != 0)
+        {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_index_buffer);
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, index_count * sizeof(GLuint), &indices[0]);
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        return;
+    }
+
+    static const GLuint zero = 0;
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_counter_buffer);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glUseProgram(m_program);
+    glUniform1ui(m_light_count_loc, count);
+    glUniform1ui(m_max_indices_loc, m_max_light_indices);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_light_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_range_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_index_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_bounds_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_counter_buffer);
+
+    glDispatchCompute(m_grid[0], m_grid[1], m_grid[2]);
+
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void ClusteredLighting::Bind(void)
+{
+    glBindBufferBase(GL_UNIFORM_BUFFER, 0, m_params_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_light_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_range_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_index_buffer);
+}
+
+// Appends the indices of the lights in x, y, z, r (count of them, padded
+// to a multiple of eight) that touch the box to 'list'. Returns the new
+// length of the list, which never exceeds CLUSTER_MAX_LIGHTS, although up
+// to eight entries past the end may be written.
+static unsigned int cullLights(const vec4& bmin, const vec4& bmax,
+                               const float * x, const float * y, const float * z, const float * r,
+                               const GLuint * light_index, unsigned int count, GLuint * list)
+{
+    unsigned int i = 0;
+    unsigned int n = 0;
+    int j;
+
+#if defined(VMATH_AVX)
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 minx = _mm256_set1_ps(bmin[0]), maxx = _mm256_set1_ps(bmax[0]);
+    const __m256 miny = _mm256_set1_ps(bmin[1]), maxy = _mm256_set1_ps(bmax[1]);
+    const __m256 minz = _mm256_set1_ps(bmin[2]), maxz = _mm256_set1_ps(bmax[2]);
+
+    for (; i + 8 <= count && n < CLUSTER_MAX_LIGHTS; i += 8)
+    {
+        const __m256 lx = _mm256_loadu_ps(x + i);
+        const __m256 ly = _mm256_loadu_ps(y + i);
+        const __m256 lz = _mm256_loadu_ps(z + i);
+        const __m256 lr = _mm256_loadu_ps(r + i);
+
+        // Distance from each light to the nearest point of the box
+        const __m256 dx = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(minx, lx), _mm256_sub_ps(lx, maxx)), zero);
+        const __m256 dy = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(miny, ly), _mm256_sub_ps(ly, maxy)), zero);
+        const __m256 dz = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(minz, lz), _mm256_sub_ps(lz, maxz)), zero);
+        const __m256 d2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+
+        const int mask = _mm256_movemask_ps(_mm256_cmp_ps(d2, _mm256_mul_ps(lr, lr), _CMP_LE_OQ));
+        for (j = 0; j < 8; j++)
+        {
+            list[n] = light_index[i + j];
+            n += (mask >> j) & 1;
+        }
+    }
+#elif defined(VMATH_SSE2)
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 minx = _mm_set1_ps(bmin[0]), maxx = _mm_set1_ps(bmax[0]);
+    const __m128 miny = _mm_set1_ps(bmin[1]), maxy = _mm_set1_ps(bmax[1]);
+    const __m128 minz = _mm_set1_ps(bmin[2]), maxz = _mm_set1_ps(bmax[2]);
+
+    for (; i + 4 <= count && n < CLUSTER_MAX_LIGHTS; i += 4)
+    {
+        const __m128 lx = _mm_loadu_ps(x + i);
+        const __m128 ly = _mm_loadu_ps(y + i);
+        const __m128 lz = _mm_loadu_ps(z + i);
+        const __m128 lr = _mm_loadu_ps(r + i);
+
+        const __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minx, lx), _mm_sub_ps(lx, maxx)), zero);
+        const __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(miny, ly), _mm_sub_ps(ly, maxy)), zero);
+        const __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minz, lz), _mm_sub_ps(lz, maxz)), zero);
+        const __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+        const int mask = _mm_movemask_ps(_mm_cmple_ps(d2, _mm_mul_ps(lr, lr)));
+        for (j = 0; j < 4; j++)
+        {
+            list[n] = light_index[i + j];
+            n += (mask >> j) & 1;
+        }
+    }
+#endif
+
+    for (; i < count && n < CLUSTER_MAX_LIGHTS; i++)
+    {
+        const float dx = max(max(bmin[0] - x[i], x[i] - bmax[0]), 0.0f);
+        const float dy = max(max(bmin[1] - y[i], y[i] - bmax[1]), 0.0f);
+        const float dz = max(max(bmin[2] - z[i], z[i] - bmax[2]), 0.0f);
+
+        if (dx * dx + dy * dy + dz * dz <= r[i] * r[i])
+            list[n++] = light_index[i];
+    }
+
+    return n < CLUSTER_MAX_LIGHTS ? n : CLUSTER_MAX_LIGHTS;
+}
+
+unsigned int ClusteredLighting::AssignReference(JobSystem& jobs, const float * x, const float * y, const float * z, const float * r,
+                                                unsigned int light_count,
+                                                const vec4 * bounds_min, const vec4 * bounds_max,
+                                                unsigned int grid_x, unsigned int grid_y, unsigned int grid_z,
+                                                GLuint * ranges, GLuint * indices, unsigned int max_indices,
+                                                ClusterStats * stats)
+{
+    const unsigned int slice_size = grid_x * grid_y;
+    const unsigned int cluster_count = slice_size * grid_z;
+    const unsigned int stride = (light_count + 7) & ~7u;
+    std::vector<GLuint> lists(size_t(cluster_count) * (CLUSTER_MAX_LIGHTS + 8));
+    std::vector<GLuint> counts(cluster_count);
+
+    // Slices are independent, so spread them over the job system's threads,
+    // one at a time as they vary a lot in how many lights reach them
+    jobs.ParallelFor(grid_z, 1, [&](unsigned int first, unsigned int last)
+    {
+        std::vector<float> candidates(stride * 4);
+        std::vector<GLuint> candidate_index(stride);
+        float * cx = candidates.data();
+        float * cy = cx + stride;
+        float * cz = cy + stride;
+        float * cr = cz + stride;
+        unsigned int slice;
+
+        for (slice = first; slice < last; slice++)
+        {
+            // Every froxel of a slice spans the same depths. Gather the
+            // lights that reach them once, rather than testing every light
+            // against every froxel.
+            const float zmin = bounds_min[slice * slice_size][2];
+            const float zmax = bounds_max[slice * slice_size][2];
+            unsigned int n = 0;
+            unsigned int i;
+
+            for (i = 0; i < light_count; i++)
+            {
+                cx[n] = x[i];
+                cy[n] = y[i];
+                cz[n] = z[i];
+                cr[n] = r[i];
+                candidate_index[n] = i;
+                n += (z[i] - r[i] <= zmax && z[i] + r[i] >= zmin) ? 1 : 0;
+            }
+
+            for (i = 0; i < slice_size; i++)
+            {
+                const unsigned int c = slice * slice_size + i;
+
+                counts[c] = n ? cullLights(bounds_min[c], bounds_max[c], cx, cy, cz, cr,
+                                           &candidate_index[0], n, &lists[size_t(c) * (CLUSTER_MAX_LIGHTS + 8)]) : 0;
+            }
+        }
+    });
+
+    // Concatenate the lists
+    unsigned int offset = 0;
+    unsigned int longest = 0;
+    unsigned int overflowed = 0;
+    unsigned int c;
+
+    for (c = 0; c < cluster_count; c++)
+    {
+        unsigned int count = counts[c];
+
+        if (count >= CLUSTER_MAX_LIGHTS)
+            overflowed++;
+        if (count > longest)
+            longest = count;
+        if (count > max_indices - offset)
+            count = max_indices - offset;
+
+        memcpy(indices + offset, &lists[size_t(c) * (CLUSTER_MAX_LIGHTS + 8)], count * sizeof(GLuint));
+        ranges[c * 2] = offset;
+        ranges[c * 2 + 1] = count;
+        offset += count;
+    }
+
+    if (stats != 0)
+    {
+        stats->light_indices = offset;
+        stats->max_cluster_lights = longest;
+        stats->average_cluster_lights = float(offset) / float(cluster_count);
+        stats->overflowed_clusters = overflowed;
+    }
+
+    return offset;
+}
@@ -0,0 +1,1075 @@
+#include "vcodec.h"
+#include "vsimd.h"
+
+#include <string.h>
+
+#define RANS_PROB_BITS      12
+#define RANS_PROB_SCALE     (1 << RANS_PROB_BITS)
+#define RANS_L              (1u << 16)          // States stay in [RANS_L, 2^32)
+#define RANS_STATES         32
+#define DECODE_PIECE        4096                // Values decoded at a time, a whole number of rounds
+
+// How each byte plane is stored
+enum PlaneMode
+{
+    PLANE_RAW,                                  // The bytes as they are
+    PLANE_CONSTANT,                             // One byte, repeated
+    PLANE_RANS,                                 // Frequencies, then the coded words
+    PLANE_PACKED                                // Short codes for the commonest bytes, escapes for the rest
+};
+
+static inline unsigned int zigzag(unsigned int d)
+{
+    return (d << 1) ^ (unsigned int)((int)d >> 31);
+}
+
+static inline unsigned int unzigzag(unsigned int z)
+{
+    return (z >> 1) ^ (0u - (z & 1));
+}
+
+static inline unsigned int read_u16(const unsigned char * p)
+{
+    unsigned short u;
+
+    memcpy(&u, p, sizeof(u));
+
+    return u;
+}
+
+static inline unsigned int read_u32(const unsigned char * p)
+{
+    unsigned int u;
+
+    memcpy(&u, p, sizeof(u));
+
+    return u;
+}
+
+static inline void write_u16(std::vector<unsigned char>& out, unsigned int u)
+{
+    out.push_back((unsigned char)u);
+    out.push_back((unsigned char)(u >> 8));
+}
+
+static inline void write_u32(std::vector<unsigned char>& out, unsigned int u)
+{
+    write_u16(out, u & 0xFFFF);
+    write_u16(out, u >> 16);
+}
+
+// Scales the counts of the bytes in a plane of 'total' to frequencies that
+// sum to RANS_PROB_SCALE, keeping every byte that occurs at one or more
+static void normalize_frequencies(const size_t counts[256], size_t total, unsigned int freq[256])
+{
+    unsigned int sum = 0;
+    int largest = 0;
+    int s;
+
+    for (s = 0; s < 256; s++)
+    {
+        freq[s] = 0;
+        if (counts[s] != 0)
+        {
+            freq[s] = (unsigned int)((double)counts[s] * RANS_PROB_SCALE / (double)total);
+            if (freq[s] == 0)
+                freq[s] = 1;
+        }
+        sum += freq[s];
+        if (counts[s] > counts[largest])
+            largest = s;
+    }
+
+    // Rounding leaves the sum a little off. Make it up from the most
+    // frequent bytes, which notice it least.
+    if (sum < RANS_PROB_SCALE)
+        freq[largest] += RANS_PROB_SCALE - sum;
+
+    while (sum > RANS_PROB_SCALE)
+    {
+        int most = 0;
+
+        for (s = 1; s < 256; s++)
+        {
+            if (freq[s] > freq[most])
+                most = s;
+        }
+        freq[most]--;
+        sum--;
+    }
+}
+
+// rANS, as in Fabian Giesen's rans_word: 32-bit states, renormalized by
+// 16-bit words. Byte i goes through state i % RANS_STATES. The encoder
+// runs backwards and the decoder forwards, so the words are written in
+// the reverse of the order they're read in, states last.
+static void rans_encode(std::vector<unsigned char>& out, const unsigned char * plane, size_t count, const unsigned int freq[256])
+{
+    std::vector<unsigned short> words;
+    unsigned int start[256];
+    unsigned int x[RANS_STATES];
+    unsigned int sum = 0;
+    size_t i;
+    int s;
+
+    for (s = 0; s < 256; s++)
+    {
+        start[s] = sum;
+        sum += freq[s];
+    }
+
+    for (s = 0; s < RANS_STATES; s++)
+        x[s] = RANS_L;
+
+    words.reserve(count + 2 * RANS_STATES);
+
+    for (i = count; i-- > 0;)
+    {
+        unsigned int& state = x[i % RANS_STATES];
+        const unsigned int f = freq[plane[i]];
+
+        if (state >= ((RANS_L >> RANS_PROB_BITS) << 16) * f)
+        {
+            words.push_back((unsigned short)state);
+            state >>= 16;
+        }
+        state = ((state / f) << RANS_PROB_BITS) + state % f + start[plane[i]];
+    }
+
+    for (s = RANS_STATES; s-- > 0;)
+    {
+        words.push_back((unsigned short)(x[s] >> 16));
+        words.push_back((unsigned short)x[s]);
+    }
+
+    write_u32(out, (unsigned int)words.size());
+    for (i = words.size(); i-- > 0;)
+        write_u16(out, words[i]);
+}
+
+// Packed planes give each byte a code of 'bits' (one, two or four) bits,
+// packed from the lowest bit of each byte up. The commonest bytes get all
+// the codes but the last, which is an escape: the byte it stands for is
+// one of those stored, in order, after the codes.
+static size_t packed_size(const size_t counts[256], const unsigned char order[], size_t count, int bits)
+{
+    const int escape = (1 << bits) - 1;
+    size_t escapes = count;
+    int j;
+
+    for (j = 0; j < escape; j++)
+        escapes -= counts[order[j]];
+
+    return 2 + escape + 4 + (count * bits + 7) / 8 + escapes;
+}
+
+static void pack_plane(std::vector<unsigned char>& out, const unsigned char * plane, size_t count, const unsigned char order[], int bits)
+{
+    const int escape = (1 << bits) - 1;
+    std::vector<unsigned char> escaped;
+    unsigned char code[256];
+    unsigned int packed = 0;
+    size_t i;
+    int j;
+
+    memset(code, escape, sizeof(code));
+    for (j = 0; j < escape; j++)
+        code[order[j]] = (unsigned char)j;
+
+    for (i = 0; i < count; i++)
+    {
+        if (code[plane[i]] == escape)
+            escaped.push_back(plane[i]);
+    }
+
+    out.push_back(PLANE_PACKED);
+    out.push_back((unsigned char)bits);
+    out.insert(out.end(), order, order + escape);
+    write_u32(out, (unsigned int)escaped.size());
+
+    for (i = 0; i < count; i++)
+    {
+        packed |= (unsigned int)code[plane[i]] << ((i * bits) & 7);
+        if (((i + 1) * bits & 7) == 0)
+        {
+            out.push_back((unsigned char)packed);
+            packed = 0;
+        }
+    }
+    if ((count * bits & 7) != 0)
+        out.push_back((unsigned char)packed);
+
+    out.insert(out.end(), escaped.begin(), escaped.end());
+}
+
+static void encode_plane(std::vector<unsigned char>& out, const unsigned char * plane, size_t count)
+{
+    static const int widths[] = { 1, 2, 4 };
+    size_t counts[256] = { 0 };
+    unsigned int freq[256];
+    unsigned char order[15];
+    bool taken[256] = { false };
+    size_t best = count + 1;
+    int bits = 8;
+    size_t i;
+    int j, s;
+
+    for (i = 0; i < count; i++)
+        counts[plane[i]]++;
+
+    if (count == 0 || counts[plane[0]] == count)
+    {
+        out.push_back(PLANE_CONSTANT);
+        out.push_back(count != 0 ? plane[0] : 0);
+        return;
+    }
+
+    // The commonest bytes, for the packed codes
+    for (j = 0; j < 15; j++)
+    {
+        int most = -1;
+
+        for (s = 0; s < 256; s++)
+        {
+            if (!taken[s] && (most < 0 || counts[s] > counts[most]))
+                most = s;
+        }
+        order[j] = (unsigned char)most;
+        taken[most] = true;
+    }
+
+    // The smallest of the cheap ways to store the plane: as it is or packed
+    for (j = 0; j < 3; j++)
+    {
+        const size_t size = packed_size(counts, order, count, widths[j]);
+
+        if (size < best)
+        {
+            best = size;
+            bits = widths[j];
+        }
+    }
+
+    // Frequencies as a bitmap of the bytes that occur and a 16-bit
+    // frequency for each of them
+    std::vector<unsigned char> rans;
+    unsigned char present[32] = { 0 };
+
+    normalize_frequencies(counts, count, freq);
+
+    rans.push_back(PLANE_RANS);
+    for (s = 0; s < 256; s++)
+    {
+        if (freq[s] != 0)
+            present[s >> 3] |= (unsigned char)(1 << (s & 7));
+    }
+    rans.insert(rans.end(), present, present + sizeof(present));
+    for (s = 0; s < 256; s++)
+    {
+        if (freq[s] != 0)
+            write_u16(rans, freq[s]);
+    }
+    rans_encode(rans, plane, count, freq);
+
+    // rANS decodes several times slower than the others, so it has to
+    // save a quarter of the plane on top of what they do to be used
+    if (rans.size() + count / 4 < best)
+    {
+        out.insert(out.end(), rans.begin(), rans.end());
+    }
+    else if (bits != 8)
+    {
+        pack_plane(out, plane, count, order, bits);
+    }
+    else
+    {
+        out.push_back(PLANE_RAW);
+        out.insert(out.end(), plane, plane + count);
+    }
+}
+
+// Decoding table entries hold the byte in bits 0-7, the slot's offset from
+// the start of the byte's range in bits 8-19 and its frequency - 1 above
+static bool build_decode_table(unsigned int table[RANS_PROB_SCALE], const unsigned int freq[256])
+{
+    unsigned int start = 0;
+    unsigned int k;
+    int s;
+
+    for (s = 0; s < 256; s++)
+    {
+        if (freq[s] > RANS_PROB_SCALE - start)
+            return false;
+        for (k = 0; k < freq[s]; k++)
+            table[start + k] = (unsigned int)s | (k << 8) | ((freq[s] - 1) << 20);
+        start += freq[s];
+    }
+
+    return start == RANS_PROB_SCALE;
+}
+
+// Decoding goes a round of RANS_STATES bytes at a time while the input
+// still holds the most words a round can take, leaving the states in 'x'
+// and returning how many bytes were decoded. Every state that falls below
+// RANS_L takes the next word, in state order.
+typedef size_t (*RansRounds)(unsigned char * plane, size_t count, const unsigned int * table, unsigned int x[RANS_STATES], const unsigned char *& in, const unsigned char * end);
+
+// Without branches on the refills, which are as good as random
+static size_t rans_rounds(unsigned char * plane, size_t count, const unsigned int * table, unsigned int x[RANS_STATES], const unsigned char *& in, const unsigned char * end)
+{
+    const unsigned char * word = in;
+    size_t i;
+    int s;
+
+    for (i = 0; count - i >= RANS_STATES && end - word >= 2 * RANS_STATES; i += RANS_STATES)
+    {
+        for (s = 0; s < RANS_STATES; s++)
+        {
+            const unsigned int entry = table[x[s] & (RANS_PROB_SCALE - 1)];
+            const unsigned int state = ((entry >> 20) + 1) * (x[s] >> RANS_PROB_BITS) + ((entry >> 8) & (RANS_PROB_SCALE - 1));
+            const unsigned int renorm = state < RANS_L;
+
+            // Arithmetic rather than ?:, which compilers tend to make a branch
+            plane[i + s] = (unsigned char)entry;
+            x[s] = (state << (renorm * 16)) | (read_u16(word) & (0u - renorm));
+            word += 2 * renorm;
+        }
+    }
+
+    in = word;
+
+    return i;
+
+}
+
+#if defined(VMATH_DISPATCH)
+// For each mask of the lanes that need a word, which of a run of
+// consecutive words each lane takes (lane j takes the one after those of
+// the set lanes below it) and how many are taken; and for four lanes, the
+// same as a byte shuffle that zero-extends the words into the lanes
+struct RenormPermutes
+{
+    int lane[256][8];
+    int words[256];
+    unsigned char bytes[16][16];
+
+    RenormPermutes(void)
+    {
+        int mask, j;
+
+        for (mask = 0; mask < 256; mask++)
+        {
+            int next = 0;
+
+            for (j = 0; j < 8; j++)
+            {
+                lane[mask][j] = next;
+                if (mask & (1 << j))
+                    next++;
+            }
+            words[mask] = next;
+        }
+
+        for (mask = 0; mask < 16; mask++)
+        {
+            for (j = 0; j < 4; j++)
+            {
+                const bool takes = (mask & (1 << j)) != 0;
+
+                bytes[mask][j * 4 + 0] = takes ? (unsigned char)(lane[mask][j] * 2) : 0x80;
+                bytes[mask][j * 4 + 1] = takes ? (unsigned char)(lane[mask][j] * 2 + 1) : 0x80;
+                bytes[mask][j * 4 + 2] = 0x80;
+                bytes[mask][j * 4 + 3] = 0x80;
+            }
+        }
+    }
+};
+
+static const RenormPermutes renorm_permutes;
+
+// Four states to a register, looked up one at a time as there's no gather.
+// All of the registers are decoded before any is refilled: the refills go
+// one after the other, each reading where the last left off.
+VMATH_TARGET("sse4.1")
+static size_t rans_rounds_sse41(unsigned char * plane, size_t count, const unsigned int * table, unsigned int x[RANS_STATES], const unsigned char *& in, const unsigned char * end)
+{
+    const unsigned char * word = in;
+    const __m128i slot_mask = _mm_set1_epi32(RANS_PROB_SCALE - 1);
+    const __m128i low_bytes = _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    __m128i state[RANS_STATES / 4];
+    unsigned int slot[RANS_STATES];
+    size_t i;
+    int r;
+
+    for (r = 0; r < RANS_STATES / 4; r++)
+        state[r] = _mm_loadu_si128((const __m128i *)(x + r * 4));
+
+    for (i = 0; count - i >= RANS_STATES && end - word >= 2 * RANS_STATES; i += RANS_STATES)
+    {
+        for (r = 0; r < RANS_STATES / 4; r++)
+            _mm_storeu_si128((__m128i *)(slot + r * 4), _mm_and_si128(state[r], slot_mask));
+
+        for (r = 0; r < RANS_STATES / 4; r++)
+        {
+            __m128i entry = _mm_cvtsi32_si128((int)table[slot[r * 4]]);
+
+            entry = _mm_insert_epi32(entry, (int)table[slot[r * 4 + 1]], 1);
+            entry = _mm_insert_epi32(entry, (int)table[slot[r * 4 + 2]], 2);
+            entry = _mm_insert_epi32(entry, (int)table[slot[r * 4 + 3]], 3);
+
+            const __m128i freq = _mm_add_epi32(_mm_srli_epi32(entry, 20), _mm_set1_epi32(1));
+            const __m128i bias = _mm_and_si128(_mm_srli_epi32(entry, 8), slot_mask);
+            const int bytes = _mm_cvtsi128_si32(_mm_shuffle_epi8(entry, low_bytes));
+
+            state[r] = _mm_add_epi32(_mm_mullo_epi32(freq, _mm_srli_epi32(state[r], RANS_PROB_BITS)), bias);
+            memcpy(plane + i + r * 4, &bytes, 4);
+        }
+
+        for (r = 0; r < RANS_STATES / 4; r++)
+        {
+            const __m128i renorm = _mm_cmpeq_epi32(_mm_srli_epi32(state[r], 16), _mm_setzero_si128());
+            const int mask = _mm_movemask_ps(_mm_castsi128_ps(renorm));
+            const __m128i next = _mm_shuffle_epi8(_mm_loadl_epi64((const __m128i *)word), _mm_loadu_si128((const __m128i *)renorm_permutes.bytes[mask]));
+
+            state[r] = _mm_blendv_epi8(state[r], _mm_or_si128(_mm_slli_epi32(state[r], 16), next), renorm);
+            word += 2 * renorm_permutes.words[mask];
+        }
+    }
+
+    for (r = 0; r < RANS_STATES / 4; r++)
+        _mm_storeu_si128((__m128i *)(x + r * 4), state[r]);
+
+    in = word;
+
+    return i;
+
+}
+
+// The same eight states to a register, looked up with a gather
+VMATH_TARGET("avx2")
+static size_t rans_rounds_avx2(unsigned char * plane, size_t count, const unsigned int * table, unsigned int x[RANS_STATES], const unsigned char *& in, const unsigned char * end)
+{
+    const unsigned char * word = in;
+    const __m256i slot_mask = _mm256_set1_epi32(RANS_PROB_SCALE - 1);
+    __m256i state[RANS_STATES / 8];
+    size_t i;
+    int r;
+
+    for (r = 0; r < RANS_STATES / 8; r++)
+        state[r] = _mm256_loadu_si256((const __m256i *)(x + r * 8));
+
+    for (i = 0; count - i >= RANS_STATES && end - word >= 2 * RANS_STATES; i += RANS_STATES)
+    {
+        for (r = 0; r < RANS_STATES / 8; r++)
+        {
+            const __m256i entry = _mm256_i32gather_epi32((const int *)table, _mm256_and_si256(state[r], slot_mask), 4);
+            const __m256i freq = _mm256_add_epi32(_mm256_srli_epi32(entry, 20), _mm256_set1_epi32(1));
+            const __m256i bias = _mm256_and_si256(_mm256_srli_epi32(entry, 8), slot_mask);
+            const __m256i bytes = _mm256_and_si256(entry, _mm256_set1_epi32(0xFF));
+            const __m256i packed = _mm256_packus_epi16(_mm256_packus_epi32(bytes, bytes), _mm256_setzero_si256());
+
+            state[r] = _mm256_add_epi32(_mm256_mullo_epi32(freq, _mm256_srli_epi32(state[r], RANS_PROB_BITS)), bias);
+            _mm_storel_epi64((__m128i *)(plane + i + r * 8), _mm_unpacklo_epi32(_mm256_castsi256_si128(packed), _mm256_extracti128_si256(packed, 1)));
+        }
+
+        for (r = 0; r < RANS_STATES / 8; r++)
+        {
+            const __m256i renorm = _mm256_cmpeq_epi32(_mm256_srli_epi32(state[r], 16), _mm256_setzero_si256());
+            const int mask = _mm256_movemask_ps(_mm256_castsi256_ps(renorm));
+            const __m256i next = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)word));
+            const __m256i lanes = _mm256_loadu_si256((const __m256i *)renorm_permutes.lane[mask]);
+            const __m256i refilled = _mm256_or_si256(_mm256_slli_epi32(state[r], 16), _mm256_permutevar8x32_epi32(next, lanes));
+
+            state[r] = _mm256_blendv_epi8(state[r], refilled, renorm);
+            word += 2 * renorm_permutes.words[mask];
+        }
+    }
+
+    for (r = 0; r < RANS_STATES / 8; r++)
+        _mm256_storeu_si256((__m256i *)(x + r * 8), state[r]);
+
+    in = word;
+
+    return i;
+
+}
+#endif
+
+// The widest of the above that the CPU runs
+static RansRounds select_rans_rounds(void)
+{
+#if defined(VMATH_DISPATCH)
+    if (vmath_cpu_has_avx2())
+        return rans_rounds_avx2;
+    if (vmath_cpu_has_sse41())
+        return rans_rounds_sse41;
+#endif
+
+    return rans_rounds;
+}
+
+// A plane being decoded a piece at a time
+struct PlaneReader
+{
+    int mode;
+    const unsigned char * in;                   // The raw bytes, the constant byte, the codes or the next coded word
+    const unsigned char * end;                  // The end of the coded words
+    unsigned int x[RANS_STATES];
+    unsigned int table[RANS_PROB_SCALE];
+    int bits;                                   // Of each packed code
+    const unsigned char * escape;               // The next escaped byte
+    const unsigned char * escape_end;
+    unsigned char symbols[16];                  // The byte each packed code stands for, zero for the escape
+};
+
+// Sixteen codes at a time while sixteen escaped bytes remain, without
+// branches on the escapes, and returns how many were decoded
+static size_t unpack(PlaneReader& plane, unsigned char * out, const unsigned char * codes, size_t count)
+{
+    const unsigned int escape = (1u << plane.bits) - 1;
+    const unsigned char * next = plane.escape;
+    size_t i;
+    int j;
+
+    for (i = 0; count - i >= 16 && plane.escape_end - next >= 16; i += 16)
+    {
+        for (j = 0; j < 16; j++)
+        {
+            const unsigned int code = (codes[(i + j) * plane.bits / 8] >> ((i + j) * plane.bits & 7)) & escape;
+            const unsigned int escaped = code == escape;
+
+            out[i + j] = (unsigned char)(plane.symbols[code] | (*next & (0u - escaped)));
+            next += escaped;
+        }
+    }
+
+    plane.escape = next;
+
+    return i;
+}
+
+#if defined(VMATH_DISPATCH)
+// For each mask of eight bytes, a shuffle that spreads the bytes at the
+// start of a register over the bytes set in the mask, and how many it takes
+struct EscapeSpreads
+{
+    unsigned char bytes[256][8];
+    int count[256];
+
+    EscapeSpreads(void)
+    {
+        int mask, j;
+
+        for (mask = 0; mask < 256; mask++)
+        {
+            count[mask] = 0;
+            for (j = 0; j < 8; j++)
+                bytes[mask][j] = (mask & (1 << j)) ? (unsigned char)count[mask]++ : 0x80;
+        }
+    }
+};
+
+static const EscapeSpreads escape_spreads;
+
+// Sixteen packed codes at a time, while they and sixteen escaped bytes
+// remain: the codes become bytes by a shuffle, the escapes zero, and the
+// escaped bytes are shuffled into place. Returns how many were decoded.
+template <int bits>
+VMATH_TARGET("sse4.1")
+static size_t unpack_sse41(PlaneReader& plane, unsigned char * out, const unsigned char * codes, size_t count)
+{
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i code_bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    const unsigned char * escape = plane.escape;
+    __m128i low, high;
+    size_t i;
+    int j;
+
+    // The bytes that a code stands for or, for two bits, that the low and
+    // high codes of a nibble do
+    if (bits == 2)
+    {
+        unsigned char table[2][16];
+
+        for (j = 0; j < 16; j++)
+        {
+            table[0][j] = plane.symbols[j & 3];
+            table[1][j] = plane.symbols[j >> 2];
+        }
+        low = _mm_loadu_si128((const __m128i *)table[0]);
+        high = _mm_loadu_si128((const __m128i *)table[1]);
+    }
+    else
+    {
+        low = high = _mm_loadu_si128((const __m128i *)plane.symbols);
+    }
+
+    for (i = 0; count - i >= 16 && plane.escape_end - escape >= 16; i += 16)
+    {
+        __m128i bytes, escapes;
+
+        if (bits == 1)
+        {
+            const __m128i c = _mm_shuffle_epi8(_mm_cvtsi32_si128((int)read_u16(codes + i / 8)),
+                                               _mm_setr_epi8(0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1));
+
+            escapes = _mm_cmpeq_epi8(_mm_and_si128(c, code_bits), code_bits);
+            bytes = _mm_andnot_si128(escapes, _mm_shuffle_epi8(low, _mm_setzero_si128()));
+        }
+        else if (bits == 2)
+        {
+            const __m128i c = _mm_cvtsi32_si128((int)read_u32(codes + i / 4));
+            const __m128i n = _mm_unpacklo_epi8(_mm_and_si128(c, nibble), _mm_and_si128(_mm_srli_epi16(c, 4), nibble));
+            const __m128i first = _mm_and_si128(n, _mm_set1_epi8(3));
+            const __m128i second = _mm_and_si128(n, _mm_set1_epi8(12));
+
+            bytes = _mm_unpacklo_epi8(_mm_shuffle_epi8(low, n), _mm_shuffle_epi8(high, n));
+            escapes = _mm_unpacklo_epi8(_mm_cmpeq_epi8(first, _mm_set1_epi8(3)), _mm_cmpeq_epi8(second, _mm_set1_epi8(12)));
+        }
+        else
+        {
+            const __m128i c = _mm_loadl_epi64((const __m128i *)(codes + i / 2));
+            const __m128i n = _mm_unpacklo_epi8(_mm_and_si128(c, nibble), _mm_and_si128(_mm_srli_epi16(c, 4), nibble));
+
+            bytes = _mm_shuffle_epi8(low, n);
+            escapes = _mm_cmpeq_epi8(n, nibble);
+        }
+
+        const int mask = _mm_movemask_epi8(escapes);
+        const __m128i first = _mm_shuffle_epi8(_mm_loadl_epi64((const __m128i *)escape),
+                                               _mm_loadl_epi64((const __m128i *)escape_spreads.bytes[mask & 0xFF]));
+
+        escape += escape_spreads.count[mask & 0xFF];
+
+        const __m128i second = _mm_shuffle_epi8(_mm_loadl_epi64((const __m128i *)escape),
+                                                _mm_loadl_epi64((const __m128i *)escape_spreads.bytes[mask >> 8]));
+
+        escape += escape_spreads.count[mask >> 8];
+        _mm_storeu_si128((__m128i *)(out + i), _mm_or_si128(bytes, _mm_unpacklo_epi64(first, second)));
+    }
+
+    plane.escape = escape;
+
+    return i;
+}
+#endif
+
+// Reads the header of a plane of 'count' bytes and steps over its data
+static bool open_plane(PlaneReader& plane, size_t count, const unsigned char *& in, const unsigned char * end)
+{
+    if (in == end)
+        return false;
+
+    plane.mode = *in++;
+    plane.in = in;
+
+    switch (plane.mode)
+    {
+        case PLANE_RAW:
+            if ((size_t)(end - in) < count)
+                return false;
+            in += count;
+            return true;
+
+        case PLANE_CONSTANT:
+            if (in == end)
+                return false;
+            in++;
+            return true;
+
+        case PLANE_PACKED:
+        {
+            const unsigned char * order;
+            size_t escapes, codes;
+            int escape;
+
+            if (in == end)
+                return false;
+            plane.bits = *in++;
+            if (plane.bits != 1 && plane.bits != 2 && plane.bits != 4)
+                return false;
+
+            escape = (1 << plane.bits) - 1;
+            if (end - in < escape + 4)
+                return false;
+            order = in;
+            escapes = read_u32(in + escape);
+            in += escape + 4;
+
+            codes = (count * plane.bits + 7) / 8;
+            if ((size_t)(end - in) < codes || (size_t)(end - in) - codes < escapes)
+                return false;
+            plane.in = in;
+            plane.escape = in + codes;
+            plane.escape_end = plane.escape + escapes;
+            in = plane.escape_end;
+
+            memset(plane.symbols, 0, sizeof(plane.symbols));
+            memcpy(plane.symbols, order, escape);
+            return true;
+        }
+
+        case PLANE_RANS:
+        {
+            unsigned int freq[256];
+            const unsigned char * present = in;
+            size_t words;
+            int s;
+
+            if (end - in < 32)
+                return false;
+            in += 32;
+
+            for (s = 0; s < 256; s++)
+            {
+                freq[s] = 0;
+                if (present[s >> 3] & (1 << (s & 7)))
+                {
+                    if (end - in < 2)
+                        return false;
+                    freq[s] = read_u16(in);
+                    in += 2;
+                }
+            }
+
+            if (!build_decode_table(plane.table, freq) || end - in < 4)
+                return false;
+
+            words = read_u32(in);
+            in += 4;
+            if ((size_t)(end - in) / 2 < words || words < 2 * RANS_STATES)
+                return false;
+
+            for (s = 0; s < RANS_STATES; s++)
+                plane.x[s] = read_u32(in + s * 4);
+            plane.in = in + RANS_STATES * 4;
+            plane.end = in + words * 2;
+            in = plane.end;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Decodes the plane's bytes from 'first' to 'first' + 'count' into 'out'
+// and returns where they are, which for raw planes is where they lie; NULL
+// if the plane is damaged. The pieces must come in order and all but the
+// last be whole rounds of the states.
+static const unsigned char * read_plane(PlaneReader& plane, unsigned char * out, size_t first, size_t count)
+{
+    static const RansRounds rounds = select_rans_rounds();
+#if defined(VMATH_DISPATCH)
+    static const bool sse41 = vmath_cpu_has_sse41();
+#endif
+    size_t i;
+
+    switch (plane.mode)
+    {
+        case PLANE_RAW:
+            return plane.in + first;
+
+        case PLANE_CONSTANT:
+            memset(out, *plane.in, count);
+            return out;
+
+        case PLANE_PACKED:
+        {
+            const unsigned char * codes = plane.in + first * plane.bits / 8;
+            const unsigned int escape = (1u << plane.bits) - 1;
+
+#if defined(VMATH_DISPATCH)
+            if (sse41)
+            {
+                i = plane.bits == 1 ? unpack_sse41<1>(plane, out, codes, count) :
+                    plane.bits == 2 ? unpack_sse41<2>(plane, out, codes, count) :
+                                      unpack_sse41<4>(plane, out, codes, count);
+            }
+            else
+#endif
+            {
+                i = unpack(plane, out, codes, count);
+            }
+
+            // The rest one at a time, checking for the end of the escapes
+            for (; i < count; i++)
+            {
+                const unsigned int code = (codes[i * plane.bits / 8] >> (i * plane.bits & 7)) & escape;
+
+                if (code != escape)
+                {
+                    out[i] = plane.symbols[code];
+                }
+                else
+                {
+                    if (plane.escape == plane.escape_end)
+                        return NULL;
+                    out[i] = *plane.escape++;
+                }
+            }
+            return out;
+        }
+    }
+
+    // The rest one at a time, checking for the end of the input
+    for (i = rounds(out, count, plane.table, plane.x, plane.in, plane.end); i < count; i++)
+    {
+        unsigned int& state = plane.x[i % RANS_STATES];
+        const unsigned int entry = plane.table[state & (RANS_PROB_SCALE - 1)];
+
+        out[i] = (unsigned char)entry;
+        state = ((entry >> 20) + 1) * (state >> RANS_PROB_BITS) + ((entry >> 8) & (RANS_PROB_SCALE - 1));
+        if (state < RANS_L)
+        {
+            if (plane.end - plane.in < 2)
+                return NULL;
+            state = (state << 16) | read_u16(plane.in);
+            plane.in += 2;
+        }
+    }
+
+    return out;
+}
+
+// Every state ends where the encoder started it, with every word used
+static bool close_plane(const PlaneReader& plane)
+{
+    int s;
+
+    if (plane.mode == PLANE_PACKED)
+        return plane.escape == plane.escape_end;
+    if (plane.mode != PLANE_RANS)
+        return true;
+
+    for (s = 0; s < RANS_STATES; s++)
+    {
+        if (plane.x[s] != RANS_L)
+            return false;
+    }
+
+    return plane.in == plane.end;
+}
+
+// Splits zigzagged differences into byte planes and codes each of them
+static void encode_differences(std::vector<unsigned char>& out, const unsigned int * differences, size_t count)
+{
+    unsigned char * planes = new unsigned char [count * 4];
+    size_t i;
+    int b;
+
+    for (i = 0; i < count; i++)
+    {
+        for (b = 0; b < 4; b++)
+            planes[b * count + i] = (unsigned char)(differences[i] >> (b * 8));
+    }
+
+    for (b = 0; b < 4; b++)
+        encode_plane(out, planes + b * count, count);
+
+    delete [] planes;
+}
+
+#if defined(VMATH_SSE2)
+// Adds each of four differences to the value 'stride' (one to four) before
+// it, given the four values before them in 'previous'
+static inline __m128i add_previous(__m128i d, __m128i previous, int stride)
+{
+    switch (stride)
+    {
+        case 1:
+            d = _mm_add_epi32(d, _mm_slli_si128(d, 4));
+            d = _mm_add_epi32(d, _mm_slli_si128(d, 8));
+            return _mm_add_epi32(d, _mm_shuffle_epi32(previous, _MM_SHUFFLE(3, 3, 3, 3)));
+
+        case 2:
+            d = _mm_add_epi32(d, _mm_slli_si128(d, 8));
+            return _mm_add_epi32(d, _mm_shuffle_epi32(previous, _MM_SHUFFLE(3, 2, 3, 2)));
+
+        case 3:
+            // The last lane is also three after the first
+            d = _mm_add_epi32(d, _mm_slli_si128(d, 12));
+            return _mm_add_epi32(d, _mm_shuffle_epi32(previous, _MM_SHUFFLE(1, 3, 2, 1)));
+    }
+
+    return _mm_add_epi32(d, previous);
+}
+
+// Undoes the zigzag of four values and stores them, summed with 'stride'
+template <int stride>
+static inline void store_differences(unsigned int * out, __m128i z, __m128i& previous)
+{
+    const __m128i d = _mm_xor_si128(_mm_srli_epi32(z, 1), _mm_sub_epi32(_mm_setzero_si128(), _mm_and_si128(z, _mm_set1_epi32(1))));
+
+    if (stride != 0)
+    {
+        previous = add_previous(d, previous, stride);
+        _mm_storeu_si128((__m128i *)out, previous);
+    }
+    else
+    {
+        _mm_storeu_si128((__m128i *)out, d);
+    }
+}
+
+// Interleaves the planes' bytes into 32-bit values sixteen at a time,
+// which the compiler keeps in registers when the stride is a constant,
+// and returns how many it did
+template <int stride>
+static size_t interleave_planes(unsigned int * piece, const unsigned char * const bytes[4], size_t n, __m128i& previous)
+{
+    size_t i;
+
+    for (i = 0; n - i >= 16; i += 16)
+    {
+        const __m128i b0 = _mm_loadu_si128((const __m128i *)(bytes[0] + i));
+        const __m128i b1 = _mm_loadu_si128((const __m128i *)(bytes[1] + i));
+        const __m128i b2 = _mm_loadu_si128((const __m128i *)(bytes[2] + i));
+        const __m128i b3 = _mm_loadu_si128((const __m128i *)(bytes[3] + i));
+        const __m128i lo0 = _mm_unpacklo_epi8(b0, b1);
+        const __m128i lo1 = _mm_unpackhi_epi8(b0, b1);
+        const __m128i hi0 = _mm_unpacklo_epi8(b2, b3);
+        const __m128i hi1 = _mm_unpackhi_epi8(b2, b3);
+
+        store_differences<stride>(piece + i, _mm_unpacklo_epi16(lo0, hi0), previous);
+        store_differences<stride>(piece + i + 4, _mm_unpackhi_epi16(lo0, hi0), previous);
+        store_differences<stride>(piece + i + 8, _mm_unpacklo_epi16(lo1, hi1), previous);
+        store_differences<stride>(piece + i + 12, _mm_unpackhi_epi16(lo1, hi1), previous);
+    }
+
+    return i;
+}
+#endif
+
+// Decodes the planes and puts the differences back together, a piece at a
+// time so that the planes' bytes stay in the cache. With a 'stride', each
+// difference is added to the value that many before it; otherwise the
+// differences are left for the caller.
+static bool decode_differences(unsigned int * values, size_t count, size_t stride, const unsigned char * in, size_t size)
+{
+    const unsigned char * end = in + size;
+    PlaneReader * planes = new PlaneReader [4];
+    unsigned char scratch[4][DECODE_PIECE];
+    const unsigned char * bytes[4];
+    bool ok = true;
+    size_t first, i, j;
+    int b;
+
+    for (b = 0; b < 4 && ok; b++)
+        ok = open_plane(planes[b], count, in, end);
+
+#if defined(VMATH_SSE2)
+    __m128i previous = _mm_setzero_si128();
+#endif
+
+    for (first = 0; first < count && ok; first += DECODE_PIECE)
+    {
+        const size_t n = count - first < DECODE_PIECE ? count - first : (size_t)DECODE_PIECE;
+        unsigned int * piece = values + first;
+
+        for (b = 0; b < 4 && ok; b++)
+        {
+            bytes[b] = read_plane(planes[b], scratch[b], first, n);
+            ok = bytes[b] != NULL;
+        }
+        if (!ok)
+            break;
+
+        i = 0;
+
+#if defined(VMATH_SSE2)
+        // Vertices of up to four components are summed as they're stored,
+        // and those of more afterwards
+        switch (stride)
+        {
+            case 1:  i = interleave_planes<1>(piece, bytes, n, previous); break;
+            case 2:  i = interleave_planes<2>(piece, bytes, n, previous); break;
+            case 3:  i = interleave_planes<3>(piece, bytes, n, previous); break;
+            case 4:  i = interleave_planes<4>(piece, bytes, n, previous); break;
+            default: i = interleave_planes<0>(piece, bytes, n, previous); break;
+        }
+
+        if (stride > 4)
+        {
+            for (j = first < stride ? stride : first; j < first + i; j++)
+                values[j] += values[j - stride];
+        }
+#endif
+
+        for (; i < n; i++)
+        {
+            piece[i] = unzigzag(bytes[0][i] | (bytes[1][i] << 8) | (bytes[2][i] << 16) | ((unsigned int)bytes[3][i] << 24));
+            if (stride != 0 && first + i >= stride)
+                piece[i] += values[first + i - stride];
+        }
+    }
+
+    for (b = 0; b < 4 && ok; b++)
+        ok = close_plane(planes[b]);
+
+    delete [] planes;
+
+    return ok && in == end;
+}
+
+void vbm_encode_vertices(std::vector<unsigned char>& out, const void * vertices, unsigned int components, unsigned int count)
+{
+    const size_t values = (size_t)components * count;
+    const unsigned int * v = (const unsigned int *)vertices;
+    std::vector<unsigned int> differences(values);
+    size_t i;
+
+    for (i = 0; i < values; i++)
+        differences[i] = zigzag(v[i] - (i >= components ? v[i - components] : 0));
+
+    encode_differences(out, values != 0 ? &differences[0] : NULL, values);
+}
+
+bool vbm_decode_vertices(void * vertices, unsigned int components, unsigned int count, const unsigned char * in, size_t size)
+{
+    return decode_differences((unsigned int *)vertices, (size_t)components * count, components, in, size);
+}
+
+void vbm_encode_indices(std::vector<unsigned char>& out, const unsigned int * indices, unsigned int count)
+{
+    std::vector<unsigned int> differences(count);
+    const unsigned int triangles = count / 3;
+    unsigned int previous = 0;
+    unsigned int i;
+
+    for (i = 0; i < triangles * 3; i += 3)
+    {
+        differences[i] = zigzag(indices[i] - previous);
+        differences[i + 1] = zigzag(indices[i + 1] - indices[i]);
+        differences[i + 2] = zigzag(indices[i + 2] - indices[i]);
+        previous = indices[i];
+    }
+
+    // Anything left over that isn't a triangle follows on from the last index
+    for (; i < count; i++)
+        differences[i] = zigzag(indices[i] - (i != 0 ? indices[i - 1] : 0));
+
+    encode_differences(out, count != 0 ? &differences[0] : NULL, count);
+}
+
+bool vbm_decode_indices(unsigned int * indices, unsigned int count, const unsigned char * in, size_t size)
+{
+    const unsigned int triangles = count / 3;
+    unsigned int previous = 0;
+    unsigned int i;
+
+    if (!decode_differences(indices, count, 0, in, size))
+        return false;
+
+    for (i = 0; i < triangles * 3; i += 3)
+    {
+        previous += indices[i];
+        indices[i] = previous;
+        indices[i + 1] += previous;
+        indices[i + 2] += previous;
+    }
+
+    for (; i < count; i++)
+        indices[i] += i != 0 ? indices[i - 1] : 0;
+
+    return true;
+}
@@ -0,0 +1,230 @@
+#include "vcull.h"
+#include "vsimd.h"
+
+namespace vmath
+{
+
+void frustumPlanes(const mat4& m, vec4 planes[6])
+{
+    // Matrices are column-major, so gather the rows first
+    const vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    const vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    const vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    const vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+    int i;
+
+    planes[0] = row3 + row0;        // Left
+    planes[1] = row3 - row0;        // Right
+    planes[2] = row3 + row1;        // Bottom
+    planes[3] = row3 - row1;        // Top
+    planes[4] = row3 + row2;        // Near
+    planes[5] = row3 - row2;        // Far
+
+    for (i = 0; i < 6; i++)
+    {
+        const float l = sqrtf(planes[i][0] * planes[i][0] +
+                              planes[i][1] * planes[i][1] +
+                              planes[i][2] * planes[i][2]);
+        if (l != 0.0f)
+            planes[i] /= l;
+    }
+}
+
+void transformSpheres(const vec4& sphere, const mat4 * matrices, unsigned int count,
+                      float * x, float * y, float * z, float * r)
+{
+    unsigned int i;
+
+    for (i = 0; i < count; i++)
+    {
+        const mat4& m = matrices[i];
+        const float sx = m[0][0] * m[0][0] + m[0][1] * m[0][1] + m[0][2] * m[0][2];
+        const float sy = m[1][0] * m[1][0] + m[1][1] * m[1][1] + m[1][2] * m[1][2];
+        const float sz = m[2][0] * m[2][0] + m[2][1] * m[2][1] + m[2][2] * m[2][2];
+
+        x[i] = m[0][0] * sphere[0] + m[1][0] * sphere[1] + m[2][0] * sphere[2] + m[3][0];
+        y[i] = m[0][1] * sphere[0] + m[1][1] * sphere[1] + m[2][1] * sphere[2] + m[3][1];
+        z[i] = m[0][2] * sphere[0] + m[1][2] * sphere[1] + m[2][2] * sphere[2] + m[3][2];
+        r[i] = sphere[3] * sqrtf(max(max(sx, sy), sz));
+    }
+}
+
+// Scalar test of one sphere, used for the leftovers at the end of the arrays
+static inline bool sphereVisible(const vec4 planes[6], float x, float y, float z, float r)
+{
+    for (int p = 0; p < 6; p++)
+    {
+        if (planes[p][0] * x + planes[p][1] * y + planes[p][2] * z + planes[p][3] < -r)
+            return false;
+    }
+
+    return true;
+}
+
+static inline bool boxVisible(const vec4 planes[6], float cx, float cy, float cz, float ex, float ey, float ez)
+{
+    for (int p = 0; p < 6; p++)
+    {
+        const float d = planes[p][0] * cx + planes[p][1] * cy + planes[p][2] * cz + planes[p][3];
+        const float e = fabsf(planes[p][0]) * ex + fabsf(planes[p][1]) * ey + fabsf(planes[p][2]) * ez;
+        if (d < -e)
+            return false;
+    }
+
+    return true;
+}
+
+unsigned int cullSpheres(const vec4 planes[6],
+                         const float * x, const float * y, const float * z, const float * r,
+                         unsigned int count, unsigned int * visible)
+{
+    unsigned int i = 0;
+    unsigned int n = 0;
+    int j, p;
+
+#if defined(VMATH_AVX)
+    __m256 pa[6], pb[6], pc[6], pd[6];
+
+    for (p = 0; p < 6; p++)
+    {
+        pa[p] = _mm256_set1_ps(planes[p][0]);
+        pb[p] = _mm256_set1_ps(planes[p][1]);
+        pc[p] = _mm256_set1_ps(planes[p][2]);
+        pd[p] = _mm256_set1_ps(planes[p][3]);
+    }
+
+    for (; i + 8 <= count; i += 8)
+    {
+        const __m256 sx = _mm256_loadu_ps(x + i);
+        const __m256 sy = _mm256_loadu_ps(y + i);
+        const __m256 sz = _mm256_loadu_ps(z + i);
+        const __m256 nr = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(r + i));
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+        for (p = 0; p < 6; p++)
+        {
+            __m256 d = _mm256_add_ps(_mm256_mul_ps(pa[p], sx), pd[p]);
+            d = _mm256_add_ps(d, _mm256_mul_ps(pb[p], sy));
+            d = _mm256_add_ps(d, _mm256_mul_ps(pc[p], sz));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, nr, _CMP_GE_OQ));
+        }
+
+        // Append the surviving lanes without branching
+        const int mask = _mm256_movemask_ps(inside);
+        for (j = 0; j < 8; j++)
+        {
+            visible[n] = i + j;
+            n += (mask >> j) & 1;
+        }
+    }
+#elif defined(VMATH_SSE2)
+    __m128 pa[6], pb[6], pc[6], pd[6];
+
+    for (p = 0; p < 6; p++)
+    {
+        pa[p] = _mm_set1_ps(planes[p][0]);
+        pb[p] = _mm_set1_ps(planes[p][1]);
+        pc[p] = _mm_set1_ps(planes[p][2]);
+        pd[p] = _mm_set1_ps(planes[p][3]);
+    }
+
+    for (; i + 4 <= count; i += 4)
+    {
+        const __m128 sx = _mm_loadu_ps(x + i);
+        const __m128 sy = _mm_loadu_ps(y + i);
+        const __m128 sz = _mm_loadu_ps(z + i);
+        const __m128 nr = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(r + i));
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+        for (p = 0; p < 6; p++)
+        {
+            __m128 d = _mm_add_ps(_mm_mul_ps(pa[p], sx), pd[p]);
+            d = _mm_add_ps(d, _mm_mul_ps(pb[p], sy));
+            d = _mm_add_ps(d, _mm_mul_ps(pc[p], sz));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(d, nr));
+        }
+
+        const int mask = _mm_movemask_ps(inside);
+        for (j = 0; j < 4; j++)
+        {
+            visible[n] = i + j;
+            n += (mask >> j) & 1;
+        }
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        if (sphereVisible(planes, x[i], y[i], z[i], r[i]))
+            visible[n++] = i;
+    }
+
+    return n;
+}
+
+unsigned int cullBoxes(const vec4 planes[6],
+                       const float * cx, const float * cy, const float * cz,
+                       const float * ex, const float * ey, const float * ez,
+                       unsigned int count, unsigned int * visible)
+{
+    unsigned int i = 0;
+    unsigned int n = 0;
+    int j, p;
+
+#if defined(VMATH_SSE2)
+    const __m128 sign_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    __m128 pa[6], pb[6], pc[6], pd[6];
+    __m128 aa[6], ab[6], ac[6];
+
+    for (p = 0; p < 6; p++)
+    {
+        pa[p] = _mm_set1_ps(planes[p][0]);
+        pb[p] = _mm_set1_ps(planes[p][1]);
+        pc[p] = _mm_set1_ps(planes[p][2]);
+        pd[p] = _mm_set1_ps(planes[p][3]);
+        aa[p] = _mm_and_ps(pa[p], sign_mask);
+        ab[p] = _mm_and_ps(pb[p], sign_mask);
+        ac[p] = _mm_and_ps(pc[p], sign_mask);
+    }
+
+    for (; i + 4 <= count; i += 4)
+    {
+        const __m128 x = _mm_loadu_ps(cx + i);
+        const __m128 y = _mm_loadu_ps(cy + i);
+        const __m128 z = _mm_loadu_ps(cz + i);
+        const __m128 hx = _mm_loadu_ps(ex + i);
+        const __m128 hy = _mm_loadu_ps(ey + i);
+        const __m128 hz = _mm_loadu_ps(ez + i);
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+        for (p = 0; p < 6; p++)
+        {
+            // Distance of the center plus the projected radius of the box
+            __m128 d = _mm_add_ps(_mm_mul_ps(pa[p], x), pd[p]);
+            d = _mm_add_ps(d, _mm_mul_ps(pb[p], y));
+            d = _mm_add_ps(d, _mm_mul_ps(pc[p], z));
+            __m128 e = _mm_mul_ps(aa[p], hx);
+            e = _mm_add_ps(e, _mm_mul_ps(ab[p], hy));
+            e = _mm_add_ps(e, _mm_mul_ps(ac[p], hz));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(d, e), _mm_setzero_ps()));
+        }
+
+        const int mask = _mm_movemask_ps(inside);
+        for (j = 0; j < 4; j++)
+        {
+            visible[n] = i + j;
+            n += (mask >> j) & 1;
+        }
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        if (boxVisible(planes, cx[i], cy[i], cz[i], ex[i], ey[i], ez[i]))
+            visible[n++] = i;
+    }
+
+    return n;
+}
+
+};
@@ -1,6 +1,9 @@
 #include "vapp.h"
 
 #include <time.h>
+#include <math.h>
+#include <chrono>
+#include <thread>
 
 void VermilionApplication::window_size_callback(GLFWwindow* window, int width, int height)
 {
@@ -30,10 +33,127 @@ unsigned int VermilionApplication::app_time()
 
     return (unsigned int)(currentTime - m_appStartTime);
 #else
-    return 0;
+    struct timeval now;
+
+    gettimeofday(&now, nullptr);
+
+    return (unsigned int)((now.tv_sec - m_appStartTime.tv_sec) * 1000 + (now.tv_usec - m_appStartTime.tv_usec) / 1000);
 #endif
 }
 
+double VermilionApplication::app_seconds()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count() - m_clockStart;
+}
+
+void VermilionApplication::SetFixedTimestep(double step, unsigned int max_steps)
+{
+    m_fixedStep = step > 0.0 ? step : 0.0;
+    m_maxSteps = max_steps ? max_steps : 1;
+    m_accumulator = 0.0;
+    m_alpha = 1.0f;
+}
+
+void VermilionApplication::SetSwapInterval(int interval)
+{
+    glfwSwapInterval(interval);
+}
+
+void VermilionApplication::SetFrameLimit(double fps, double spin)
+{
+    m_frameLimit = fps > 0.0 ? 1.0 / fps : 0.0;
+    m_spinTime = spin > 0.0 ? spin : 0.0;
+    m_frameDeadline = 0.0;
+}
+
+void VermilionApplication::RunFrame(void)
+{
+    const double start = app_seconds();
+    const double elapsed = m_lastFrameStart < 0.0 ? 0.0 : start - m_lastFrameStart;
+    unsigned int updates = 0;
+    int i;
+
+    m_lastFrameStart = start;
+
+    if (m_fixedStep > 0.0)
+    {
+        m_accumulator += elapsed;
+
+        while (m_accumulator >= m_fixedStep && updates < m_maxSteps)
+        {
+            Update(m_fixedStep);
+            m_accumulator -= m_fixedStep;
+            updates++;
+        }
+
+        // Too far behind to catch up; keep the fraction so that the
+        // interpolation doesn't jump
+        if (m_accumulator >= m_fixedStep)
+        {
+            const double dropped = floor(m_accumulator / m_fixedStep);
+            m_frameStats.dropped_updates += (unsigned int)dropped;
+            m_accumulator -= dropped * m_fixedStep;
+        }
+
+        m_alpha = (float)(m_accumulator / m_fixedStep);
+    }
+    else
+    {
+        Update(elapsed);
+        updates = 1;
+        m_alpha = 1.0f;
+    }
+
+    Display();
+
+    const double end = app_seconds();
+
+    // Sleep for most of what's left of the frame and spin for the rest.
+    // Deadlines follow on from each other so that the rate doesn't drift,
+    // unless a frame ran so long that the next deadline has passed too.
+    if (m_frameLimit > 0.0)
+    {
+        if (m_frameDeadline <= 0.0 || end > m_frameDeadline + m_frameLimit)
+            m_frameDeadline = start;
+        m_frameDeadline += m_frameLimit;
+
+        const double sleep = m_frameDeadline - m_spinTime - end;
+        if (sleep > 0.0)
+            std::this_thread::sleep_for(std::chrono::duration<double>(sleep));
+
+        while (app_seconds() < m_frameDeadline)
+            std::this_thread::yield();
+    }
+
+    // The first frame has no previous one to measure from, so the history
+    // holds the frame times of frames 1 onwards
+    if (m_frameStats.frames != 0)
+    {
+        const unsigned int count = m_frameStats.frames < VAPP_FRAME_HISTORY ? m_frameStats.frames : VAPP_FRAME_HISTORY;
+        double sum = 0.0, sum_squares = 0.0;
+
+        m_frameHistory[(m_frameStats.frames - 1) % VAPP_FRAME_HISTORY] = elapsed;
+        m_frameStats.minimum = m_frameStats.maximum = elapsed;
+        for (i = 0; i < (int)count; i++)
+        {
+            const double t = m_frameHistory[i];
+            sum += t;
+            sum_squares += t * t;
+            m_frameStats.minimum = t < m_frameStats.minimum ? t : m_frameStats.minimum;
+            m_frameStats.maximum = t > m_frameStats.maximum ? t : m_frameStats.maximum;
+        }
+
+        m_frameStats.average = sum / count;
+        m_frameStats.deviation = sqrt(fabs(sum_squares / count - m_frameStats.average * m_frameStats.average));
+        m_frameStats.fps = m_frameStats.average > 0.0 ? 1.0 / m_frameStats.average : 0.0;
+    }
+
+    m_frameStats.frames++;
+    m_frameStats.updates = updates;
+    m_frameStats.frame_time = elapsed;
+    m_frameStats.cpu_time = end - start;
+}
+
 void VermilionApplication::Initialize(const char * title)
 {
 #ifdef _WIN32
@@ -41,6 +161,9 @@ void VermilionApplication::Initialize(const char * title)
 #else
     gettimeofday(&m_appStartTime, nullptr);
 #endif
+    m_clockStart = app_seconds();
+
+    m_jobs.Initialize();
 
     glfwInit();
 
@@ -0,0 +1,255 @@
+#include "vgpucull.h"
+#include "vcull.h"
+#include "vhiz.h"
+#include "vutils.h"
+
+#include <string>
+#include <string.h>
+
+using namespace vmath;
+
+static const char cull_header[] =
+    "#version 430 core\n"
+    "\n"
+    "layout (local_size_x = 64) in;\n"
+    "\n"
+    "#define HIZ_BINDING 4\n";
+
+// Follows the Hi-Z test source
+static const char cull_source[] =
+    "layout (std430, binding = 0) readonly buffer INSTANCES\n"
+    "{\n"
+    "    mat4 instance_matrix[];\n"
+    "};\n"
+    "\n"
+    "layout (std430, binding = 1) writeonly buffer VISIBLE_MATRICES\n"
+    "{\n"
+    "    mat4 visible_matrix[];\n"
+    "};\n"
+    "\n"
+    "layout (std430, binding = 2) writeonly buffer VISIBLE_INDICES\n"
+    "{\n"
+    "    uint visible_index[];\n"
+    "};\n"
+    "\n"
+    // Only the instance count (second word) of the draw command is touched,
+    // which is where both indirect command layouts keep it
+    "layout (std430, binding = 3) buffer COMMAND\n"
+    "{\n"
+    "    uint count;\n"
+    "    uint instance_count;\n"
+    "} command;\n"
+    "\n"
+    "uniform vec4 frustum_planes[6];\n"
+    "uniform vec4 bounding_sphere;\n"
+    "uniform uint instance_count;\n"
+    "\n"
+    "uniform mat4 view_projection;\n"
+    "uniform bool use_hiz;\n"
+    "\n"
+    "bool occluded(vec3 center, float radius)\n"
+    "{\n"
+    "    vec3 lo = vec3(1.0);\n"
+    "    vec3 hi = vec3(-1.0);\n"
+    "\n"
+    // Project the corners of the box around the sphere. Anything that
+    // reaches behind the eye is considered visible.
+    "    for (int i = 0; i < 8; i++)\n"
+    "    {\n"
+    "        vec3 corner = center + radius * vec3((i & 1) != 0 ? 1.0 : -1.0,\n"
+    "                                             (i & 2) != 0 ? 1.0 : -1.0,\n"
+    "                                             (i & 4) != 0 ? 1.0 : -1.0);\n"
+    "        vec4 clip = view_projection * vec4(corner, 1.0);\n"
+    "        if (clip.w <= 0.0)\n"
+    "            return false;\n"
+    "        vec3 ndc = clip.xyz / clip.w;\n"
+    "        lo = min(lo, ndc);\n"
+    "        hi = max(hi, ndc);\n"
+    "    }\n"
+    "\n"
+    "    vec2 window_lo = (lo.xy * 0.5 + 0.5) * vec2(hiz_size);\n"
+    "    vec2 window_hi = (hi.xy * 0.5 + 0.5) * vec2(hiz_size);\n"
+    "\n"
+    "    return !hiz_visible(vec4(window_lo, window_hi), lo.z * 0.5 + 0.5);\n"
+    "}\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    uint i = gl_GlobalInvocationID.x;\n"
+    "\n"
+    "    if (i >= instance_count)\n"
+    "        return;\n"
+    "\n"
+    "    mat4 m = instance_matrix[i];\n"
+    "    vec3 center = (m * vec4(bounding_sphere.xyz, 1.0)).xyz;\n"
+    "    float scale = max(max(dot(m[0].xyz, m[0].xyz), dot(m[1].xyz, m[1].xyz)), dot(m[2].xyz, m[2].xyz));\n"
+    "    float radius = bounding_sphere.w * sqrt(scale);\n"
+    "\n"
+    "    for (int p = 0; p < 6; p++)\n"
+    "    {\n"
+    "        if (dot(frustum_planes[p].xyz, center) + frustum_planes[p].w < -radius)\n"
+    "            return;\n"
+    "    }\n"
+    "\n"
+    "    if (use_hiz && occluded(center, radius))\n"
+    "        return;\n"
+    "\n"
+    "    uint slot = atomicAdd(command.instance_count, 1u);\n"
+    "    visible_matrix[slot] = m;\n"
+    "    visible_index[slot] = i;\n"
+    "}\n";
+
+GPUInstanceCuller::GPUInstanceCuller(void)
+    : m_program(0),
+      m_instance_buffer(0),
+      m_visible_matrix_buffer(0),
+      m_visible_index_buffer(0),
+      m_command_buffer(0),
+      m_hiz(NULL),
+      m_max_instances(0),
+      m_instance_count(0)
+{
+
+}
+
+GPUInstanceCuller::~GPUInstanceCuller(void)
+{
+    Free();
+}
+
+bool GPUInstanceCuller::Initialize(unsigned int max_instances)
+{
+    GLint linked = GL_FALSE;
+
+    Free();
+
+    const std::string source = std::string(cull_header) + HiZPyramid::GetTestSource() + cull_source;
+
+    m_program = glCreateProgram();
+    vglAttachShaderSource(m_program, GL_COMPUTE_SHADER, source.c_str());
+    glLinkProgram(m_program);
+    glGetProgramiv(m_program, GL_LINK_STATUS, &linked);
+
+    if (!linked)
+    {
+        Free();
+        return false;
+    }
+
+    m_uniforms.frustum_planes = glGetUniformLocation(m_program, "frustum_planes");
+    m_uniforms.bounding_sphere = glGetUniformLocation(m_program, "bounding_sphere");
+    m_uniforms.instance_count = glGetUniformLocation(m_program, "instance_count");
+    m_uniforms.view_projection = glGetUniformLocation(m_program, "view_projection");
+    m_uniforms.use_hiz = glGetUniformLocation(m_program, "use_hiz");
+
+    m_max_instances = max_instances;
+
+    GLuint buffers[4];
+    glGenBuffers(4, buffers);
+    m_instance_buffer = buffers[0];
+    m_visible_matrix_buffer = buffers[1];
+    m_visible_index_buffer = buffers[2];
+    m_command_buffer = buffers[3];
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_instance_buffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, max_instances * sizeof(mat4), NULL, GL_DYNAMIC_STORAGE_BIT);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_visible_matrix_buffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, max_instances * sizeof(mat4), NULL, 0);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_visible_index_buffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, max_instances * sizeof(GLuint), NULL, 0);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_command_buffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, 5 * sizeof(GLuint), NULL, GL_DYNAMIC_STORAGE_BIT);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    return true;
+}
+
+void GPUInstanceCuller::Free(void)
+{
+    GLuint buffers[4] = { m_instance_buffer, m_visible_matrix_buffer, m_visible_index_buffer, m_command_buffer };
+
+    glDeleteBuffers(4, buffers);
+    m_instance_buffer = m_visible_matrix_buffer = m_visible_index_buffer = m_command_buffer = 0;
+
+    glDeleteProgram(m_program);
+    m_program = 0;
+
+    m_max_instances = 0;
+    m_instance_count = 0;
+}
+
+void GPUInstanceCuller::SetInstances(const mat4 * matrices, unsigned int count, unsigned int first)
+{
+    if (first >= m_max_instances)
+        return;
+    if (count > m_max_instances - first)
+        count = m_max_instances - first;
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_instance_buffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, first * sizeof(mat4), count * sizeof(mat4), matrices);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    if (first + count > m_instance_count)
+        m_instance_count = first + count;
+}
+
+void GPUInstanceCuller::Cull(const VBObject& object, unsigned int frame_index, const mat4& view_projection)
+{
+    GLuint command[5];
+    vec4 planes[6];
+
+    // Start from zero instances - the compute shader counts them up
+    object.GetDrawCommand(frame_index, 0, command);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_command_buffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(command), command);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    frustumPlanes(view_projection, planes);
+
+    glUseProgram(m_program);
+    glUniform4fv(m_uniforms.frustum_planes, 6, planes[0]);
+    glUniform4fv(m_uniforms.bounding_sphere, 1, object.GetBoundingSphere(frame_index));
+    glUniform1ui(m_uniforms.instance_count, m_instance_count);
+    glUniformMatrix4fv(m_uniforms.view_projection, 1, GL_FALSE, view_projection);
+    glUniform1i(m_uniforms.use_hiz, m_hiz != NULL);
+
+    if (m_hiz != NULL)
+        m_hiz->Bind(m_program, 4);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_instance_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_visible_matrix_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_visible_index_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_command_buffer);
+
+    glDispatchCompute((m_instance_count + 63) / 64, 1, 1);
+
+    // The results are consumed as draw commands and instance data
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT |
+                    GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT |
+                    GL_TEXTURE_FETCH_BARRIER_BIT |
+                    GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void GPUInstanceCuller::Render(VBObject& object)
+{
+    object.RenderIndirect(m_command_buffer);
+}
+
+unsigned int GPUInstanceCuller::CullReference(const mat4 * matrices, unsigned int count,
+                                              const vec4& sphere, const mat4& view_projection,
+                                              unsigned int * visible)
+{
+    vec4 planes[6];
+    float * x = new float[count * 4];
+    float * y = x + count;
+    float * z = y + count;
+    float * r = z + count;
+
+    frustumPlanes(view_projection, planes);
+    transformSpheres(sphere, matrices, count, x, y, z, r);
+    unsigned int visible_count = cullSpheres(planes, x, y, z, r, count, visible);
+
+    delete [] x;
+
+    return visible_count;
+}
@@ -0,0 +1,583 @@
+#include "vhiz.h"
+#include "vjobs.h"
+#include "vutils.h"
+
+#include <string>
+#include <string.h>
+#include <math.h>
+
+using namespace vmath;
+
+// Declarations shared by the builder and anything testing against the
+// pyramid. Level n is ceil(size / 2^n) texels in each direction.
+static const char common_source[] =
+    "uniform ivec2 hiz_size;\n"
+    "uniform int hiz_levels;\n"
+    "uniform uint hiz_offset[16];\n"
+    "\n"
+    "ivec2 hiz_level_size(int level)\n"
+    "{\n"
+    "    return (hiz_size + (1 << level) - 1) >> level;\n"
+    "}\n"
+    "\n"
+    "uint hiz_index(int level, ivec2 p)\n"
+    "{\n"
+    "    return hiz_offset[level] + uint(p.y * hiz_level_size(level).x + p.x);\n"
+    "}\n"
+    "\n";
+
+static const char test_source[] =
+    "layout (std430, binding = HIZ_BINDING) readonly buffer HIZ_PYRAMID\n"
+    "{\n"
+    "    float hiz_depth[];\n"
+    "};\n"
+    "\n"
+    "%COMMON%"
+    "float hiz_fetch(int level, ivec2 p)\n"
+    "{\n"
+    "    return hiz_depth[hiz_index(level, p)];\n"
+    "}\n"
+    "\n"
+    "bool hiz_visible(vec4 rect, float z)\n"
+    "{\n"
+    "    if (rect.z < 0.0 || rect.w < 0.0 || rect.x >= float(hiz_size.x) || rect.y >= float(hiz_size.y))\n"
+    "        return false;\n"
+    "\n"
+    "    ivec2 lo = clamp(ivec2(floor(rect.xy)), ivec2(0), hiz_size - 1);\n"
+    "    ivec2 hi = clamp(ivec2(floor(rect.zw)), ivec2(0), hiz_size - 1);\n"
+    "\n"
+    // The finest level at which the rectangle touches at most 2x2 texels.
+    // The last level is a single texel, so this always terminates.
+    "    int level = 0;\n"
+    "    while (level < hiz_levels - 1 && any(greaterThan((hi >> level) - (lo >> level), ivec2(1))))\n"
+    "        level++;\n"
+    "\n"
+    "    lo >>= level;\n"
+    "    hi >>= level;\n"
+    "\n"
+    "    float farthest = max(max(hiz_fetch(level, lo), hiz_fetch(level, ivec2(hi.x, lo.y))),\n"
+    "                         max(hiz_fetch(level, ivec2(lo.x, hi.y)), hiz_fetch(level, hi)));\n"
+    "\n"
+    "    return z <= farthest;\n"
+    "}\n"
+    "\n";
+
+// Each workgroup reduces a 64x64 tile to a single texel of level 6: levels
+// 0 to 2 in registers (4x4 texels per thread), 3 to 6 in shared memory.
+// The last workgroup to finish, found with an atomic counter, then carries
+// on through the remaining levels on its own.
+static const char build_source[] =
+    "#version 430 core\n"
+    "\n"
+    "layout (local_size_x = 256) in;\n"
+    "\n"
+    "layout (binding = 0) uniform sampler2D depth_texture;\n"
+    "\n"
+    "layout (std430, binding = 0) coherent buffer HIZ_PYRAMID\n"
+    "{\n"
+    "    float hiz_depth[];\n"
+    "};\n"
+    "\n"
+    "layout (std430, binding = 1) coherent buffer HIZ_COUNTER\n"
+    "{\n"
+    "    uint groups_done;\n"
+    "};\n"
+    "\n"
+    "%COMMON%"
+    "shared float tile[16][16];\n"
+    "shared bool last_group;\n"
+    "\n"
+    "void store(int level, ivec2 p, float d)\n"
+    "{\n"
+    "    if (level < hiz_levels && all(lessThan(p, hiz_level_size(level))))\n"
+    "        hiz_depth[hiz_index(level, p)] = d;\n"
+    "}\n"
+    "\n"
+    // Texels past the edge don't exist. Reading them as the nearest
+    // possible depth leaves them out of the maximum.
+    "float load(int level, ivec2 p)\n"
+    "{\n"
+    "    return all(lessThan(p, hiz_level_size(level))) ? hiz_depth[hiz_index(level, p)] : 0.0;\n"
+    "}\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    int t = int(gl_LocalInvocationIndex);\n"
+    "    ivec2 group = ivec2(gl_WorkGroupID.xy);\n"
+    "    ivec2 local = ivec2(t & 15, t >> 4);\n"
+    "    ivec2 base = group * 64 + local * 4;\n"
+    "    float d2 = 0.0;\n"
+    "\n"
+    "    for (int by = 0; by < 2; by++)\n"
+    "    {\n"
+    "        for (int bx = 0; bx < 2; bx++)\n"
+    "        {\n"
+    "            float d1 = 0.0;\n"
+    "            for (int y = 0; y < 2; y++)\n"
+    "            {\n"
+    "                for (int x = 0; x < 2; x++)\n"
+    "                {\n"
+    "                    ivec2 p = base + ivec2(bx * 2 + x, by * 2 + y);\n"
+    "                    float d = all(lessThan(p, hiz_size)) ? texelFetch(depth_texture, p, 0).x : 0.0;\n"
+    "                    store(0, p, d);\n"
+    "                    d1 = max(d1, d);\n"
+    "                }\n"
+    "            }\n"
+    "            store(1, (base >> 1) + ivec2(bx, by), d1);\n"
+    "            d2 = max(d2, d1);\n"
+    "        }\n"
+    "    }\n"
+    "\n"
+    "    store(2, base >> 2, d2);\n"
+    "    tile[local.y][local.x] = d2;\n"
+    "    barrier();\n"
+    "\n"
+    "    for (int level = 3, n = 8; level <= 6; level++, n >>= 1)\n"
+    "    {\n"
+    "        ivec2 q = ivec2(t % n, t / n);\n"
+    "        float d = 0.0;\n"
+    "\n"
+    "        if (t < n * n)\n"
+    "        {\n"
+    "            d = max(max(tile[q.y * 2][q.x * 2], tile[q.y * 2][q.x * 2 + 1]),\n"
+    "                    max(tile[q.y * 2 + 1][q.x * 2], tile[q.y * 2 + 1][q.x * 2 + 1]));\n"
+    "        }\n"
+    "        barrier();\n"
+    "\n"
+    "        if (t < n * n)\n"
+    "        {\n"
+    "            tile[q.y][q.x] = d;\n"
+    "            store(level, group * n + q, d);\n"
+    "        }\n"
+    "        barrier();\n"
+    "    }\n"
+    "\n"
+    // A single workgroup covers everything up to level 6
+    "    if (hiz_levels <= 7)\n"
+    "        return;\n"
+    "\n"
+    "    memoryBarrierBuffer();\n"
+    "    if (t == 0)\n"
+    "        last_group = atomicAdd(groups_done, 1u) == gl_NumWorkGroups.x * gl_NumWorkGroups.y - 1u;\n"
+    "    barrier();\n"
+    "\n"
+    "    if (!last_group)\n"
+    "        return;\n"
+    "\n"
+    "    for (int level = 7; level < hiz_levels; level++)\n"
+    "    {\n"
+    "        ivec2 size = hiz_level_size(level);\n"
+    "\n"
+    "        for (int i = t; i < size.x * size.y; i += 256)\n"
+    "        {\n"
+    "            ivec2 p = ivec2(i % size.x, i / size.x);\n"
+    "            float d = max(max(load(level - 1, p * 2), load(level - 1, p * 2 + ivec2(1, 0))),\n"
+    "                          max(load(level - 1, p * 2 + ivec2(0, 1)), load(level - 1, p * 2 + ivec2(1, 1))));\n"
+    "            store(level, p, d);\n"
+    "        }\n"
+    "\n"
+    "        memoryBarrierBuffer();\n"
+    "        barrier();\n"
+    "    }\n"
+    "\n"
+    "    if (t == 0)\n"
+    "        groups_done = 0u;\n"
+    "}\n";
+
+static const char test_main_source[] =
+    "#version 430 core\n"
+    "\n"
+    "layout (local_size_x = 64) in;\n"
+    "\n"
+    "#define HIZ_BINDING 0\n"
+    "%TEST%"
+    "struct Box\n"
+    "{\n"
+    "    vec4 lo;\n"
+    "    vec4 hi;\n"
+    "};\n"
+    "\n"
+    "layout (std430, binding = 1) readonly buffer BOXES\n"
+    "{\n"
+    "    Box boxes[];\n"
+    "};\n"
+    "\n"
+    "layout (std430, binding = 2) writeonly buffer VISIBILITY\n"
+    "{\n"
+    "    uint visibility[];\n"
+    "};\n"
+    "\n"
+    "uniform uint box_count;\n"
+    "uniform uint output_stride;\n"
+    "uniform uint output_offset;\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    uint i = gl_GlobalInvocationID.x;\n"
+    "\n"
+    "    if (i >= box_count)\n"
+    "        return;\n"
+    "\n"
+    "    Box box = boxes[i];\n"
+    "    visibility[i * output_stride + output_offset] = hiz_visible(vec4(box.lo.xy, box.hi.xy), box.lo.z) ? 1u : 0u;\n"
+    "}\n";
+
+static std::string expand(const char * source, const char * name, const char * text)
+{
+    std::string result(source);
+    size_t pos = result.find(name);
+
+    if (pos != std::string::npos)
+        result.replace(pos, strlen(name), text);
+
+    return result;
+}
+
+static GLuint build_program(const std::string& source)
+{
+    GLint linked = GL_FALSE;
+    GLuint program = glCreateProgram();
+
+    vglAttachShaderSource(program, GL_COMPUTE_SHADER, source.c_str());
+    glLinkProgram(program);
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+
+    if (!linked)
+    {
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    return program;
+}
+
+static inline int level_extent(int size, int level)
+{
+    return (size + (1 << level) - 1) >> level;
+}
+
+HiZPyramid::HiZPyramid(void)
+    : m_width(0),
+      m_height(0),
+      m_levels(0),
+      m_build_program(0),
+      m_test_program(0),
+      m_pyramid_buffer(0),
+      m_counter_buffer(0)
+{
+    memset(m_offsets, 0, sizeof(m_offsets));
+    memset(&m_test_uniforms, 0, sizeof(m_test_uniforms));
+}
+
+HiZPyramid::~HiZPyramid(void)
+{
+    Free();
+}
+
+const char * HiZPyramid::GetTestSource(void)
+{
+    static const std::string source = expand(test_source, "%COMMON%", common_source);
+
+    return source.c_str();
+}
+
+bool HiZPyramid::Initialize(GLsizei width, GLsizei height)
+{
+    static const GLuint zero = 0;
+
+    Free();
+
+    m_build_program = build_program(expand(build_source, "%COMMON%", common_source));
+    m_test_program = build_program(expand(test_main_source, "%TEST%", GetTestSource()));
+
+    if (m_build_program == 0 || m_test_program == 0)
+    {
+        Free();
+        return false;
+    }
+
+    m_test_uniforms.box_count = glGetUniformLocation(m_test_program, "box_count");
+    m_test_uniforms.output_stride = glGetUniformLocation(m_test_program, "output_stride");
+    m_test_uniforms.output_offset = glGetUniformLocation(m_test_program, "output_offset");
+
+    glGenBuffers(1, &m_counter_buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_counter_buffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), &zero, 0);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    m_width = width;
+    m_height = height;
+    AllocatePyramid();
+
+    return true;
+}
+
+void HiZPyramid::Free(void)
+{
+    glDeleteProgram(m_build_program);
+    glDeleteProgram(m_test_program);
+    glDeleteBuffers(1, &m_pyramid_buffer);
+    glDeleteBuffers(1, &m_counter_buffer);
+
+    m_build_program = 0;
+    m_test_program = 0;
+    m_pyramid_buffer = 0;
+    m_counter_buffer = 0;
+    m_levels = 0;
+}
+
+void HiZPyramid::Resize(GLsizei width, GLsizei height)
+{
+    m_width = width;
+    m_height = height;
+
+    if (m_build_program != 0)
+        AllocatePyramid();
+}
+
+void HiZPyramid::AllocatePyramid(void)
+{
+    unsigned int size;
+
+    m_levels = LevelCount(m_width, m_height);
+    size = LevelOffsets(m_width, m_height, m_offsets);
+
+    // Start out with everything at the far plane, which hides nothing
+    float * far_plane = new float[size];
+    for (unsigned int i = 0; i < size; i++)
+        far_plane[i] = 1.0f;
+
+    glDeleteBuffers(1, &m_pyramid_buffer);
+    glGenBuffers(1, &m_pyramid_buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_pyramid_buffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, size * sizeof(float), far_plane, 0);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    delete [] far_plane;
+}
+
+void HiZPyramid::Bind(GLuint program, GLuint binding) const
+{
+    glUniform2i(glGetUniformLocation(program, "hiz_size"), m_width, m_height);
+    glUniform1i(glGetUniformLocation(program, "hiz_levels"), m_levels);
+    glUniform1uiv(glGetUniformLocation(program, "hiz_offset"), HIZ_MAX_LEVELS, m_offsets);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, m_pyramid_buffer);
+}
+
+void HiZPyramid::Build(GLuint depth_texture)
+{
+    glUseProgram(m_build_program);
+    Bind(m_build_program, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_counter_buffer);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, depth_texture);
+
+    // The depth was most likely just rendered
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_FRAMEBUFFER_BARRIER_BIT);
+    glDispatchCompute(level_extent(m_width, 6), level_extent(m_height, 6), 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void HiZPyramid::Test(GLuint box_buffer, unsigned int count, GLuint output_buffer,
+                      unsigned int output_stride, unsigned int output_offset)
+{
+    glUseProgram(m_test_program);
+    Bind(m_test_program, 0);
+    glUniform1ui(m_test_uniforms.box_count, count);
+    glUniform1ui(m_test_uniforms.output_stride, output_stride);
+    glUniform1ui(m_test_uniforms.output_offset, output_offset);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, box_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, output_buffer);
+
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    glDispatchCompute((count + 63) / 64, 1, 1);
+
+    // The results may be read as draw commands or by later shaders
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+int HiZPyramid::LevelCount(GLsizei width, GLsizei height)
+{
+    int levels = 1;
+
+    while ((width > 1 || height > 1) && levels < HIZ_MAX_LEVELS)
+    {
+        width = level_extent(width, 1);
+        height = level_extent(height, 1);
+        levels++;
+    }
+
+    return levels;
+}
+
+unsigned int HiZPyramid::LevelOffsets(GLsizei width, GLsizei height, GLuint * offsets)
+{
+    const int levels = LevelCount(width, height);
+    unsigned int total = 0;
+    int level;
+
+    for (level = 0; level < HIZ_MAX_LEVELS; level++)
+    {
+        offsets[level] = total;
+        if (level < levels)
+            total += level_extent(width, level) * level_extent(height, level);
+    }
+
+    return total;
+}
+
+bool HiZPyramid::ProjectBox(const mat4& view_projection, const vec3& lo, const vec3& hi,
+                            GLsizei width, GLsizei height, HiZBox& box)
+{
+    vec3 ndc_lo(1.0f);
+    vec3 ndc_hi(-1.0f);
+    int i, j;
+
+    for (i = 0; i < 8; i++)
+    {
+        const vec3 corner((i & 1) ? hi[0] : lo[0], (i & 2) ? hi[1] : lo[1], (i & 4) ? hi[2] : lo[2]);
+        float clip[4];
+
+        for (j = 0; j < 4; j++)
+        {
+            clip[j] = view_projection[0][j] * corner[0] +
+                      view_projection[1][j] * corner[1] +
+                      view_projection[2][j] * corner[2] +
+                      view_projection[3][j];
+        }
+
+        if (clip[3] <= 0.0f)
+        {
+            box.min = vec4(0.0f, 0.0f, 0.0f, 0.0f);
+            box.max = vec4(float(width), float(height), 1.0f, 0.0f);
+            return false;
+        }
+
+        for (j = 0; j < 3; j++)
+        {
+            const float v = clip[j] / clip[3];
+            if (v < ndc_lo[j])
+                ndc_lo[j] = v;
+            if (v > ndc_hi[j])
+                ndc_hi[j] = v;
+        }
+    }
+
+    box.min = vec4((ndc_lo[0] * 0.5f + 0.5f) * float(width),
+                   (ndc_lo[1] * 0.5f + 0.5f) * float(height),
+                   ndc_lo[2] * 0.5f + 0.5f, 0.0f);
+    box.max = vec4((ndc_hi[0] * 0.5f + 0.5f) * float(width),
+                   (ndc_hi[1] * 0.5f + 0.5f) * float(height),
+                   ndc_hi[2] * 0.5f + 0.5f, 0.0f);
+
+    return true;
+}
+
+void HiZPyramid::BuildReference(JobSystem& jobs, const float * depth, GLsizei width, GLsizei height, float * pyramid)
+{
+    GLuint offsets[HIZ_MAX_LEVELS];
+    const int levels = LevelCount(width, height);
+    int level;
+
+    LevelOffsets(width, height, offsets);
+    memcpy(pyramid, depth, width * height * sizeof(float));
+
+    for (level = 1; level < levels; level++)
+    {
+        const int src_width = level_extent(width, level - 1);
+        const int src_height = level_extent(height, level - 1);
+        const int dst_width = level_extent(width, level);
+        const int dst_height = level_extent(height, level);
+        const float * src = pyramid + offsets[level - 1];
+        float * dst = pyramid + offsets[level];
+
+        // Rows of at least 4096 texels a piece; smaller levels run inline
+        jobs.ParallelFor(dst_height, (4095 + dst_width) / dst_width, [&](unsigned int begin, unsigned int end)
+        {
+            int y, x;
+
+            for (y = int(begin); y < int(end); y++)
+            {
+                const float * row0 = src + 2 * y * src_width;
+                const float * row1 = 2 * y + 1 < src_height ? row0 + src_width : NULL;
+
+                for (x = 0; x < dst_width; x++)
+                {
+                    const int x0 = 2 * x;
+                    const bool has_x1 = x0 + 1 < src_width;
+                    float d = row0[x0];
+
+                    if (has_x1 && row0[x0 + 1] > d)
+                        d = row0[x0 + 1];
+                    if (row1 != NULL)
+                    {
+                        if (row1[x0] > d)
+                            d = row1[x0];
+                        if (has_x1 && row1[x0 + 1] > d)
+                            d = row1[x0 + 1];
+                    }
+
+                    dst[y * dst_width + x] = d;
+                }
+            }
+        });
+    }
+}
+
+void HiZPyramid::TestReference(JobSystem& jobs, const float * pyramid, GLsizei width, GLsizei height,
+                               const HiZBox * boxes, unsigned int count, GLuint * visible)
+{
+    GLuint offsets[HIZ_MAX_LEVELS];
+    const int levels = LevelCount(width, height);
+
+    LevelOffsets(width, height, offsets);
+
+    // Batches of 1024 boxes; fewer run inline
+    jobs.ParallelFor(count, 1024, [&](unsigned int begin, unsigned int end)
+    {
+        unsigned int i;
+
+        for (i = begin; i < end; i++)
+        {
+            const HiZBox& box = boxes[i];
+
+            if (box.max[0] < 0.0f || box.max[1] < 0.0f || box.min[0] >= float(width) || box.min[1] >= float(height))
+            {
+                visible[i] = 0;
+                continue;
+            }
+
+            int x0 = (int)floorf(box.min[0]), y0 = (int)floorf(box.min[1]);
+            int x1 = (int)floorf(box.max[0]), y1 = (int)floorf(box.max[1]);
+
+            x0 = x0 < 0 ? 0 : x0 > width - 1 ? width - 1 : x0;
+            y0 = y0 < 0 ? 0 : y0 > height - 1 ? height - 1 : y0;
+            x1 = x1 < 0 ? 0 : x1 > width - 1 ? width - 1 : x1;
+            y1 = y1 < 0 ? 0 : y1 > height - 1 ? height - 1 : y1;
+
+            int level = 0;
+            while (level < levels - 1 && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1))
+                level++;
+
+            const float * texels = pyramid + offsets[level];
+            const int stride = level_extent(width, level);
+
+            x0 >>= level;
+            y0 >>= level;
+            x1 >>= level;
+            y1 >>= level;
+
+            float farthest = texels[y0 * stride + x0];
+            if (texels[y0 * stride + x1] > farthest)
+                farthest = texels[y0 * stride + x1];
+            if (texels[y1 * stride + x0] > farthest)
+                farthest = texels[y1 * stride + x0];
+            if (texels[y1 * stride + x1] > farthest)
+                farthest = texels[y1 * stride + x1];
+
+            visible[i] = box.min[2] <= farthest ? 1 : 0;
+        }
+    });
+}
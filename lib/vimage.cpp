@@ -0,0 +1,752 @@
+#include "vimage.h"
+#include "vjobs.h"
+#include "vsimd.h"
+#include "vutils.h"
+
+#include <string>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+
+// The CPU filters must round each product before adding it, as the shaders'
+// precise sums do, so products and sums are never fused here
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#elif defined(__GNUC__)
+#pragma GCC optimize ("fp-contract=off")
+#endif
+
+// One pass of the separable convolution: filters a row and writes it down
+// a column of the output. Each workgroup loads its tile and the apron
+// either side into shared memory, clamping to the ends of the row.
+static const char convolve_source[] =
+    "layout (local_size_x = 256) in;\n"
+    "\n"
+    "#define TILE_SIZE          256\n"
+    "\n"
+    "layout (rgba32f, binding = 0) uniform readonly image2D input_image;\n"
+    "layout (rgba32f, binding = 1) uniform writeonly image2D output_image;\n"
+    "\n"
+    "layout (std430, binding = 0) readonly buffer WEIGHTS\n"
+    "{\n"
+    "    float weights[];\n"
+    "};\n"
+    "\n"
+    "uniform int radius;\n"
+    "\n"
+    "#if SHARED\n"
+    "shared vec4 tile[TILE_SIZE + 2 * MAX_SHARED_RADIUS];\n"
+    "#endif\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    ivec2 size = imageSize(input_image);\n"
+    "    int y = int(gl_WorkGroupID.y);\n"
+    "    int first = int(gl_WorkGroupID.x) * TILE_SIZE;\n"
+    "    int t = int(gl_LocalInvocationID.x);\n"
+    "    int x = first + t;\n"
+    "    int i;\n"
+    "    precise vec4 sum = vec4(0.0);\n"
+    "\n"
+    "#if SHARED\n"
+    "    for (i = t; i < TILE_SIZE + 2 * radius; i += TILE_SIZE)\n"
+    "        tile[i] = imageLoad(input_image, ivec2(clamp(first - radius + i, 0, size.x - 1), y));\n"
+    "\n"
+    "    barrier();\n"
+    "\n"
+    "    if (x >= size.x)\n"
+    "        return;\n"
+    "\n"
+    "    for (i = 0; i <= 2 * radius; i++)\n"
+    "        sum += weights[i] * tile[t + i];\n"
+    "#else\n"
+    "    if (x >= size.x)\n"
+    "        return;\n"
+    "\n"
+    "    for (i = 0; i <= 2 * radius; i++)\n"
+    "        sum += weights[i] * imageLoad(input_image, ivec2(clamp(x - radius + i, 0, size.x - 1), y));\n"
+    "#endif\n"
+    "\n"
+    "    imageStore(output_image, ivec2(y, x), sum);\n"
+    "}\n";
+
+// One pass of the summed-area table: a running sum along a row, written
+// down a column. An invocation per row; neighbouring invocations read
+// neighbouring rows, which tiled image memory keeps close together, and
+// write neighbouring texels.
+static const char scan_source[] =
+    "layout (local_size_x = 64) in;\n"
+    "\n"
+    "layout (rgba32f, binding = 0) uniform readonly image2D input_image;\n"
+    "layout (rgba32f, binding = 1) uniform writeonly image2D output_image;\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    ivec2 size = imageSize(input_image);\n"
+    "    int y = int(gl_GlobalInvocationID.x);\n"
+    "    int x;\n"
+    "    precise vec4 sum = vec4(0.0);\n"
+    "\n"
+    "    if (y >= size.y)\n"
+    "        return;\n"
+    "\n"
+    "    for (x = 0; x < size.x; x++)\n"
+    "    {\n"
+    "        sum += imageLoad(input_image, ivec2(x, y));\n"
+    "        imageStore(output_image, ivec2(y, x), sum);\n"
+    "    }\n"
+    "}\n";
+
+// Box blur from a summed-area table: the box's sum is four corners of the
+// table, scaled by one over the area of the box that's inside the image
+static const char box_blur_source[] =
+    "layout (local_size_x = 16, local_size_y = 16) in;\n"
+    "\n"
+    "layout (rgba32f, binding = 0) uniform readonly image2D sat_image;\n"
+    "layout (rgba32f, binding = 1) uniform writeonly image2D output_image;\n"
+    "\n"
+    "layout (std430, binding = 0) readonly buffer BOX_SCALES\n"
+    "{\n"
+    "    float box_scales[];\n"
+    "};\n"
+    "\n"
+    "uniform int radius;\n"
+    "\n"
+    "vec4 sat(int x, int y)\n"
+    "{\n"
+    "    return (x < 0 || y < 0) ? vec4(0.0) : imageLoad(sat_image, ivec2(x, y));\n"
+    "}\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    ivec2 size = imageSize(sat_image);\n"
+    "    ivec2 pos = ivec2(gl_GlobalInvocationID.xy);\n"
+    "\n"
+    "    if (pos.x >= size.x || pos.y >= size.y)\n"
+    "        return;\n"
+    "\n"
+    "    ivec2 lo = max(pos - radius, ivec2(0)) - 1;\n"
+    "    ivec2 hi = min(pos + radius, size - 1);\n"
+    "    precise vec4 sum = sat(hi.x, hi.y) - sat(lo.x, hi.y) - sat(hi.x, lo.y) + sat(lo.x, lo.y);\n"
+    "    precise float scale = box_scales[pos.x] * box_scales[size.x + pos.y];\n"
+    "    precise vec4 result = sum * scale;\n"
+    "\n"
+    "    imageStore(output_image, pos, result);\n"
+    "}\n";
+
+static GLuint build_program(const char * header, const char * source)
+{
+    const std::string text = std::string("#version 430 core\n\n") + header + source;
+    GLint linked = GL_FALSE;
+    GLuint program = glCreateProgram();
+
+    vglAttachShaderSource(program, GL_COMPUTE_SHADER, text.c_str());
+    glLinkProgram(program);
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+
+    if (!linked)
+    {
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    return program;
+}
+
+void create_rgba32f_image(vglImageData * image, GLsizei width, GLsizei height)
+{
+    const GLsizeiptr size = (GLsizeiptr)width * height * 4 * sizeof(float);
+
+    memset(image, 0, sizeof(*image));
+    image->target = GL_TEXTURE_2D;
+    image->internalFormat = GL_RGBA32F;
+    image->format = GL_RGBA;
+    image->type = GL_FLOAT;
+    image->swizzle[0] = GL_RED;
+    image->swizzle[1] = GL_GREEN;
+    image->swizzle[2] = GL_BLUE;
+    image->swizzle[3] = GL_ALPHA;
+    image->mipLevels = 1;
+    image->slices = 1;
+    image->sliceStride = size;
+    image->totalDataSize = size;
+    image->mip[0].width = width;
+    image->mip[0].height = height;
+    image->mip[0].depth = 1;
+    image->mip[0].mipStride = size;
+    image->mip[0].data = new unsigned char[size];
+}
+
+bool convert_image_to_rgba32f(const vglImageData * image, vglImageData * result, int level)
+{
+    const vglImageMipData& mip = image->mip[level];
+    const bool swapped = image->format == GL_BGR || image->format == GL_BGRA;
+    GLsizei i, count;
+    float * pixels;
+    int components;
+    int c;
+
+    switch (image->format)
+    {
+        case GL_RED: components = 1; break;
+        case GL_RG: components = 2; break;
+        case GL_RGB: case GL_BGR: components = 3; break;
+        case GL_RGBA: case GL_BGRA: components = 4; break;
+        default: return false;
+    }
+
+    if (image->target != GL_TEXTURE_2D || level >= image->mipLevels || mip.data == NULL ||
+        (image->type != GL_UNSIGNED_BYTE && image->type != GL_UNSIGNED_SHORT && image->type != GL_FLOAT))
+        return false;
+
+    create_rgba32f_image(result, mip.width, mip.height);
+    pixels = (float *)result->mip[0].data;
+    count = mip.width * mip.height;
+
+    for (i = 0; i < count; i++)
+    {
+        float * pixel = pixels + i * 4;
+
+        pixel[0] = pixel[1] = pixel[2] = 0.0f;
+        pixel[3] = 1.0f;
+
+        for (c = 0; c < components; c++)
+        {
+            const int n = i * components + c;
+            const int d = (swapped && c < 3) ? 2 - c : c;
+
+            switch (image->type)
+            {
+                case GL_UNSIGNED_BYTE:
+                    pixel[d] = ((const unsigned char *)mip.data)[n] * (1.0f / 255.0f);
+                    break;
+                case GL_UNSIGNED_SHORT:
+                    pixel[d] = ((const unsigned short *)mip.data)[n] * (1.0f / 65535.0f);
+                    break;
+                default:
+                    pixel[d] = ((const float *)mip.data)[n];
+                    break;
+            }
+        }
+    }
+
+    return true;
+}
+
+int gaussian_kernel(float sigma, std::vector<float>& weights, int radius)
+{
+    float total = 0.0f;
+    int i;
+
+    if (radius < 0)
+        radius = sigma > 0.0f ? (int)ceilf(3.0f * sigma) : 0;
+
+    weights.resize(2 * radius + 1);
+
+    for (i = -radius; i <= radius; i++)
+    {
+        weights[i + radius] = sigma > 0.0f ? expf(-(float)(i * i) / (2.0f * sigma * sigma)) : (i == 0 ? 1.0f : 0.0f);
+        total += weights[i + radius];
+    }
+
+    for (i = 0; i <= 2 * radius; i++)
+        weights[i] /= total;
+
+    return radius;
+}
+
+// result[i] = the sum over taps k of weights[k] * sources[k][i], adding
+// the taps in order from zero, for 'count' floats. The sums stay in
+// registers across the taps.
+static void convolve_span(float * result, const float * const * sources, const float * weights,
+                          int taps, unsigned int count)
+{
+    unsigned int i = 0;
+    int k;
+
+#if defined(VMATH_AVX)
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 sum = _mm256_setzero_ps();
+
+        for (k = 0; k < taps; k++)
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(weights[k]), _mm256_loadu_ps(sources[k] + i)));
+        _mm256_storeu_ps(result + i, sum);
+    }
+#endif
+#if defined(VMATH_SSE2)
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 sum = _mm_setzero_ps();
+
+        for (k = 0; k < taps; k++)
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(sources[k] + i)));
+        _mm_storeu_ps(result + i, sum);
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        float sum = 0.0f;
+
+        for (k = 0; k < taps; k++)
+            sum = sum + weights[k] * sources[k][i];
+        result[i] = sum;
+    }
+}
+
+// dst[i] = a[i] + b[i] for 'count' floats: a row of the summed-area table
+// from the one above it
+static void add_rows(float * dst, const float * a, const float * b, unsigned int count)
+{
+    unsigned int i = 0;
+
+#if defined(VMATH_AVX)
+    for (; i + 8 <= count; i += 8)
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i)));
+#endif
+#if defined(VMATH_SSE2)
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+#endif
+
+    for (; i < count; i++)
+        dst[i] = a[i] + b[i];
+}
+
+static bool is_rgba32f(const vglImageData * image)
+{
+    return image->format == GL_RGBA && image->type == GL_FLOAT && image->mip[0].data != NULL;
+}
+
+static void prepare_output(const vglImageData * input, vglImageData * output)
+{
+    if (output->mip[0].data != NULL)
+    {
+        if (is_rgba32f(output) &&
+            output->mip[0].width == input->mip[0].width &&
+            output->mip[0].height == input->mip[0].height)
+            return;
+
+        vglUnloadImage(output);
+    }
+
+    create_rgba32f_image(output, input->mip[0].width, input->mip[0].height);
+}
+
+// Rows for each piece of work, aiming at 16K pixels
+static unsigned int row_grain(GLsizei width)
+{
+    return std::max(1u, 16384u / (unsigned int)std::max(width, 1));
+}
+
+ImageProcessor::ImageProcessor(void)
+    : m_radius(0),
+      m_box_width(0),
+      m_box_height(0),
+      m_box_radius(-1),
+      m_weight_buffer(0),
+      m_box_scale_buffer(0),
+      m_transpose_texture(0),
+      m_transpose_width(0),
+      m_transpose_height(0)
+{
+    m_weights.push_back(1.0f);
+    memset(m_programs, 0, sizeof(m_programs));
+    memset(m_convolve_uniforms, 0, sizeof(m_convolve_uniforms));
+    memset(&m_box_uniforms, 0, sizeof(m_box_uniforms));
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+ImageProcessor::~ImageProcessor(void)
+{
+    Free();
+}
+
+bool ImageProcessor::Initialize(bool gpu)
+{
+    char header[128];
+    int i;
+
+    Free();
+
+    if (!gpu)
+        return true;
+
+    sprintf(header, "#define SHARED 1\n#define MAX_SHARED_RADIUS %d\n\n", MAX_SHARED_RADIUS);
+    m_programs[PROGRAM_CONVOLVE_SHARED] = build_program(header, convolve_source);
+    m_programs[PROGRAM_CONVOLVE_DIRECT] = build_program("#define SHARED 0\n\n", convolve_source);
+    m_programs[PROGRAM_SCAN] = build_program("", scan_source);
+    m_programs[PROGRAM_BOX_BLUR] = build_program("", box_blur_source);
+
+    for (i = 0; i < PROGRAM_TOTAL; i++)
+    {
+        if (m_programs[i] == 0)
+        {
+            for (i = 0; i < PROGRAM_TOTAL; i++)
+                glDeleteProgram(m_programs[i]);
+            memset(m_programs, 0, sizeof(m_programs));
+            return false;
+        }
+    }
+
+    for (i = 0; i < 2; i++)
+        m_convolve_uniforms[i].radius = glGetUniformLocation(m_programs[PROGRAM_CONVOLVE_SHARED + i], "radius");
+    m_box_uniforms.radius = glGetUniformLocation(m_programs[PROGRAM_BOX_BLUR], "radius");
+
+    glGenBuffers(1, &m_weight_buffer);
+    glGenBuffers(1, &m_box_scale_buffer);
+
+    SetKernel(&m_weights[0], m_radius);
+
+    return true;
+}
+
+void ImageProcessor::Free(void)
+{
+    int i;
+
+    // Nothing was made without a context, so don't touch GL
+    if (m_weight_buffer != 0)
+    {
+        for (i = 0; i < PROGRAM_TOTAL; i++)
+            glDeleteProgram(m_programs[i]);
+
+        glDeleteBuffers(1, &m_weight_buffer);
+        glDeleteBuffers(1, &m_box_scale_buffer);
+        glDeleteTextures(1, &m_transpose_texture);
+    }
+
+    memset(m_programs, 0, sizeof(m_programs));
+    m_weight_buffer = 0;
+    m_box_scale_buffer = 0;
+    m_transpose_texture = 0;
+    m_transpose_width = 0;
+    m_transpose_height = 0;
+    m_box_radius = -1;
+}
+
+void ImageProcessor::SetKernel(const float * weights, int radius)
+{
+    if (weights != &m_weights[0])
+        m_weights.assign(weights, weights + 2 * radius + 1);
+    m_radius = radius;
+
+    if (m_weight_buffer != 0)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_weight_buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, m_weights.size() * sizeof(float), &m_weights[0], GL_STATIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+}
+
+void ImageProcessor::PrepareTranspose(GLsizei width, GLsizei height)
+{
+    if (m_transpose_texture != 0 && m_transpose_width == height && m_transpose_height == width)
+        return;
+
+    // Immutable storage can't be resized, so start again
+    glDeleteTextures(1, &m_transpose_texture);
+    glGenTextures(1, &m_transpose_texture);
+    glBindTexture(GL_TEXTURE_2D, m_transpose_texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, height, width);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    m_transpose_width = height;
+    m_transpose_height = width;
+}
+
+void ImageProcessor::PrepareBoxScales(GLsizei width, GLsizei height, int radius)
+{
+    GLsizei i;
+
+    if (m_box_width == width && m_box_height == height && m_box_radius == radius)
+        return;
+
+    m_box_scales.resize(width + height);
+
+    for (i = 0; i < width; i++)
+        m_box_scales[i] = 1.0f / (float)(std::min(i + radius, width - 1) - std::max(i - radius, 0) + 1);
+    for (i = 0; i < height; i++)
+        m_box_scales[width + i] = 1.0f / (float)(std::min(i + radius, height - 1) - std::max(i - radius, 0) + 1);
+
+    if (m_box_scale_buffer != 0)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_box_scale_buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, m_box_scales.size() * sizeof(float), &m_box_scales[0], GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    m_box_width = width;
+    m_box_height = height;
+    m_box_radius = radius;
+}
+
+void ImageProcessor::Convolve(GLuint input, GLuint output, GLsizei width, GLsizei height)
+{
+    const int variant = m_radius <= MAX_SHARED_RADIUS ? 0 : 1;
+
+    if (m_programs[0] == 0)
+        return;
+
+    PrepareTranspose(width, height);
+
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+    glUseProgram(m_programs[PROGRAM_CONVOLVE_SHARED + variant]);
+    glUniform1i(m_convolve_uniforms[variant].radius, m_radius);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_weight_buffer);
+
+    // Rows into the columns of the transpose...
+    glBindImageTexture(0, input, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+    glBindImageTexture(1, m_transpose_texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+    glDispatchCompute((width + TILE_SIZE - 1) / TILE_SIZE, height, 1);
+
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+    // ...and its rows, the original columns, back again
+    glBindImageTexture(0, m_transpose_texture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+    glBindImageTexture(1, output, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+    glDispatchCompute((height + TILE_SIZE - 1) / TILE_SIZE, width, 1);
+
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+}
+
+void ImageProcessor::SummedAreaTable(GLuint input, GLuint output, GLsizei width, GLsizei height)
+{
+    if (m_programs[0] == 0)
+        return;
+
+    PrepareTranspose(width, height);
+
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+    glUseProgram(m_programs[PROGRAM_SCAN]);
+
+    glBindImageTexture(0, input, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+    glBindImageTexture(1, m_transpose_texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+    glDispatchCompute((height + SCAN_GROUP_SIZE - 1) / SCAN_GROUP_SIZE, 1, 1);
+
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+    glBindImageTexture(0, m_transpose_texture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+    glBindImageTexture(1, output, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+    glDispatchCompute((width + SCAN_GROUP_SIZE - 1) / SCAN_GROUP_SIZE, 1, 1);
+
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+}
+
+void ImageProcessor::BoxBlur(GLuint sat, GLuint output, GLsizei width, GLsizei height, int radius)
+{
+    if (m_programs[0] == 0)
+        return;
+
+    PrepareBoxScales(width, height, radius);
+
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+    glUseProgram(m_programs[PROGRAM_BOX_BLUR]);
+    glUniform1i(m_box_uniforms.radius, radius);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_box_scale_buffer);
+    glBindImageTexture(0, sat, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
+    glBindImageTexture(1, output, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+    glDispatchCompute((width + BOX_GROUP_SIZE - 1) / BOX_GROUP_SIZE,
+                      (height + BOX_GROUP_SIZE - 1) / BOX_GROUP_SIZE, 1);
+
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+}
+
+bool ImageProcessor::Convolve(JobSystem& jobs, const vglImageData * input, vglImageData * output)
+{
+    if (!is_rgba32f(input))
+        return false;
+
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    const GLsizei width = input->mip[0].width;
+    const GLsizei height = input->mip[0].height;
+    const unsigned int row_floats = width * 4;
+    const int radius = m_radius;
+    const float * weights = &m_weights[0];
+    const float * source = (const float *)input->mip[0].data;
+    float * rows;
+    float * result;
+
+    prepare_output(input, output);
+    m_rows.resize((size_t)row_floats * height);
+    rows = &m_rows[0];
+    result = (float *)output->mip[0].data;
+
+    // Along the rows. Each row is copied out with its apron, like the
+    // shader's tile, so that tap k of every pixel is k pixels further on.
+    jobs.ParallelFor(height, row_grain(width), [&](unsigned int begin, unsigned int end)
+    {
+        std::vector<float> padded((width + 2 * radius) * 4);
+        std::vector<const float *> sources(2 * radius + 1);
+        unsigned int y;
+        int i;
+
+        for (i = 0; i <= 2 * radius; i++)
+            sources[i] = &padded[i * 4];
+
+        for (y = begin; y < end; y++)
+        {
+            const float * row = source + (size_t)y * row_floats;
+
+            for (i = 0; i < width + 2 * radius; i++)
+                memcpy(&padded[i * 4], row + std::min(std::max(i - radius, 0), width - 1) * 4, 4 * sizeof(float));
+
+            convolve_span(rows + (size_t)y * row_floats, &sources[0], weights, 2 * radius + 1, row_floats);
+        }
+    });
+
+    // Down the columns, a row at a time, with the rows of the first pass
+    // as the taps, so that each pixel's sum is made in the same order
+    jobs.ParallelFor(height, row_grain(width), [&](unsigned int begin, unsigned int end)
+    {
+        std::vector<const float *> sources(2 * radius + 1);
+        unsigned int y;
+        int k;
+
+        for (y = begin; y < end; y++)
+        {
+            for (k = 0; k <= 2 * radius; k++)
+                sources[k] = rows + (size_t)std::min(std::max((int)y - radius + k, 0), height - 1) * row_floats;
+
+            convolve_span(result + (size_t)y * row_floats, &sources[0], weights, 2 * radius + 1, row_floats);
+        }
+    });
+
+    m_stats.width = width;
+    m_stats.height = height;
+    m_stats.radius = radius;
+    m_stats.time = std::chrono::duration<float, std::micro>(std::chrono::high_resolution_clock::now() - start).count();
+    m_stats.megapixels_per_second = m_stats.time > 0.0f ? (float)width * height / m_stats.time : 0.0f;
+
+    return true;
+}
+
+bool ImageProcessor::SummedAreaTable(JobSystem& jobs, const vglImageData * input, vglImageData * output)
+{
+    enum { COLUMN_FLOATS = 256 };
+
+    if (!is_rgba32f(input))
+        return false;
+
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    const GLsizei width = input->mip[0].width;
+    const GLsizei height = input->mip[0].height;
+    const unsigned int row_floats = width * 4;
+    const float * source = (const float *)input->mip[0].data;
+    float * result;
+
+    prepare_output(input, output);
+    result = (float *)output->mip[0].data;
+
+    // Running sums along the rows
+    jobs.ParallelFor(height, row_grain(width), [&](unsigned int begin, unsigned int end)
+    {
+        unsigned int y;
+        GLsizei x;
+
+        for (y = begin; y < end; y++)
+        {
+            const float * row = source + (size_t)y * row_floats;
+            float * sum = result + (size_t)y * row_floats;
+            static const float zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+            add_rows(sum, zero, row, 4);
+            for (x = 1; x < width; x++)
+                add_rows(sum + x * 4, sum + (x - 1) * 4, row + x * 4, 4);
+        }
+    });
+
+    // Then down the columns in place, in strips a few pixels wide so that
+    // each piece of work adds a row at a time
+    jobs.ParallelFor((row_floats + COLUMN_FLOATS - 1) / COLUMN_FLOATS, 1, [&](unsigned int begin, unsigned int end)
+    {
+        const unsigned int first = begin * COLUMN_FLOATS;
+        const unsigned int count = std::min(end * COLUMN_FLOATS, row_floats) - first;
+        std::vector<float> zero(count, 0.0f);
+        GLsizei y;
+
+        add_rows(result + first, &zero[0], result + first, count);
+        for (y = 1; y < height; y++)
+            add_rows(result + (size_t)y * row_floats + first,
+                     result + (size_t)(y - 1) * row_floats + first,
+                     result + (size_t)y * row_floats + first, count);
+    });
+
+    m_stats.width = width;
+    m_stats.height = height;
+    m_stats.radius = 0;
+    m_stats.time = std::chrono::duration<float, std::micro>(std::chrono::high_resolution_clock::now() - start).count();
+    m_stats.megapixels_per_second = m_stats.time > 0.0f ? (float)width * height / m_stats.time : 0.0f;
+
+    return true;
+}
+
+bool ImageProcessor::BoxBlur(JobSystem& jobs, const vglImageData * sat, vglImageData * output, int radius)
+{
+    if (!is_rgba32f(sat))
+        return false;
+
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    const GLsizei width = sat->mip[0].width;
+    const GLsizei height = sat->mip[0].height;
+    const unsigned int row_floats = width * 4;
+    const float * table = (const float *)sat->mip[0].data;
+    const float * scales;
+    float * result;
+
+    PrepareBoxScales(width, height, radius);
+    scales = &m_box_scales[0];
+    prepare_output(sat, output);
+    result = (float *)output->mip[0].data;
+
+    jobs.ParallelFor(height, row_grain(width), [&](unsigned int begin, unsigned int end)
+    {
+        static const float zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        unsigned int y;
+        GLsizei x;
+
+        for (y = begin; y < end; y++)
+        {
+            const int lo_y = std::max((int)y - radius, 0) - 1;
+            const int hi_y = std::min((int)y + radius, height - 1);
+            const float * lo_row = lo_y < 0 ? NULL : table + (size_t)lo_y * row_floats;
+            const float * hi_row = table + (size_t)hi_y * row_floats;
+            float * out = result + (size_t)y * row_floats;
+
+            for (x = 0; x < width; x++)
+            {
+                const int lo_x = std::max(x - radius, 0) - 1;
+                const int hi_x = std::min(x + radius, width - 1);
+                const float * a = hi_row + hi_x * 4;
+                const float * b = lo_x < 0 ? zero : hi_row + lo_x * 4;
+                const float * c = lo_row == NULL ? zero : lo_row + hi_x * 4;
+                const float * d = (lo_row == NULL || lo_x < 0) ? zero : lo_row + lo_x * 4;
+                const float scale = scales[x] * scales[width + y];
+#if defined(VMATH_SSE2)
+                __m128 sum = _mm_add_ps(_mm_sub_ps(_mm_sub_ps(_mm_loadu_ps(a), _mm_loadu_ps(b)), _mm_loadu_ps(c)), _mm_loadu_ps(d));
+
+                _mm_storeu_ps(out + x * 4, _mm_mul_ps(sum, _mm_set1_ps(scale)));
+#else
+                int i;
+
+                for (i = 0; i < 4; i++)
+                    out[x * 4 + i] = (a[i] - b[i] - c[i] + d[i]) * scale;
+#endif
+            }
+        }
+    });
+
+    m_stats.width = width;
+    m_stats.height = height;
+    m_stats.radius = radius;
+    m_stats.time = std::chrono::duration<float, std::micro>(std::chrono::high_resolution_clock::now() - start).count();
+    m_stats.megapixels_per_second = m_stats.time > 0.0f ? (float)width * height / m_stats.time : 0.0f;
+
+    return true;
+}
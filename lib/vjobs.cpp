@@ -0,0 +1,476 @@
+#include "vjobs.h"
+
+#include <algorithm>
+
+// The system and per-thread state of the calling thread, if it belongs to one
+static thread_local const JobSystem *   t_system = NULL;
+static thread_local void *              t_thread = NULL;
+
+bool JobSystem::Queue::Push(Job * job)
+{
+    const long b = m_bottom.load(std::memory_order_relaxed);
+    const long t = m_top.load(std::memory_order_acquire);
+
+    if (b - t >= JOB_QUEUE_SIZE)
+        return false;
+
+    m_jobs[b & (JOB_QUEUE_SIZE - 1)].store(job, std::memory_order_relaxed);
+    m_bottom.store(b + 1, std::memory_order_release);
+
+    return true;
+}
+
+JobSystem::Job * JobSystem::Queue::Pop(void)
+{
+    const long b = m_bottom.load(std::memory_order_relaxed) - 1;
+    m_bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    long t = m_top.load(std::memory_order_relaxed);
+    Job * job = NULL;
+
+    if (t <= b)
+    {
+        job = m_jobs[b & (JOB_QUEUE_SIZE - 1)].load(std::memory_order_relaxed);
+
+        // The last job; race the thieves for it
+        if (t == b)
+        {
+            if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                job = NULL;
+            m_bottom.store(b + 1, std::memory_order_relaxed);
+        }
+    }
+    else
+    {
+        m_bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    return job;
+}
+
+JobSystem::Job * JobSystem::Queue::Steal(void)
+{
+    long t = m_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const long b = m_bottom.load(std::memory_order_acquire);
+
+    if (t >= b)
+        return NULL;
+
+    Job * job = m_jobs[t & (JOB_QUEUE_SIZE - 1)].load(std::memory_order_relaxed);
+
+    if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        return NULL;
+
+    return job;
+}
+
+bool JobSystem::Queue::IsEmpty(void) const
+{
+    const long t = m_top.load(std::memory_order_acquire);
+    const long b = m_bottom.load(std::memory_order_acquire);
+
+    return t >= b;
+}
+
+JobSystem::JobSystem(void)
+    : m_running(false),
+      m_sleeping(0),
+      m_wakeups(0)
+{
+}
+
+JobSystem::~JobSystem(void)
+{
+    Free();
+}
+
+bool JobSystem::Initialize(int threads)
+{
+    unsigned int i;
+
+    Free();
+
+    if (threads <= 0)
+        threads = (int)std::thread::hardware_concurrency();
+    if (threads <= 0)
+        threads = 1;
+
+    for (i = 0; i < (unsigned int)threads; i++)
+    {
+        Thread * thread = new Thread;
+        unsigned int j;
+
+        // Every slot starts out finished, and so free
+        for (j = 0; j < JOB_POOL_SIZE; j++)
+            thread->pool[j].unfinished.store(0, std::memory_order_relaxed);
+
+        thread->next_job = 0;
+        thread->random = 0x9E3779B9u * (i + 1);
+        thread->executed = 0;
+        thread->stolen = 0;
+        thread->inline_runs = 0;
+        thread->pool_full = 0;
+        m_threads.push_back(thread);
+    }
+
+    // The calling thread is thread 0
+    t_system = this;
+    t_thread = m_threads[0];
+
+    m_running = true;
+    for (i = 1; i < (unsigned int)threads; i++)
+        m_workers.push_back(std::thread(&JobSystem::WorkerMain, this, i));
+
+    return true;
+}
+
+void JobSystem::Free(void)
+{
+    unsigned int i;
+
+    if (m_running)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_running = false;
+        }
+        m_condition.notify_all();
+    }
+
+    for (i = 0; i < m_workers.size(); i++)
+        m_workers[i].join();
+    m_workers.clear();
+
+    for (i = 0; i < m_threads.size(); i++)
+        delete m_threads[i];
+    m_threads.clear();
+
+    if (t_system == this)
+    {
+        t_system = NULL;
+        t_thread = NULL;
+    }
+}
+
+JobSystem::Thread * JobSystem::CurrentThread(void) const
+{
+    return t_system == this ? (Thread *)t_thread : NULL;
+}
+
+JobSystem::Job * JobSystem::Allocate(void)
+{
+    Thread * thread = CurrentThread();
+    Job * job = &thread->pool[thread->next_job & (JOB_POOL_SIZE - 1)];
+
+    // The slot a full lap back may still be queued, running or waited on.
+    // The ring hands slots out oldest first, so if this one is busy the
+    // pool is as good as full.
+    if (job->unfinished.load(std::memory_order_acquire) != 0)
+    {
+        thread->pool_full.fetch_add(1, std::memory_order_relaxed);
+        return NULL;
+    }
+
+    thread->next_job++;
+
+    job->range_function = NULL;
+    job->parent = NULL;
+    job->unfinished.store(1, std::memory_order_relaxed);
+    job->dependencies.store(1, std::memory_order_relaxed);
+    job->dependent_count = 0;
+
+    return job;
+}
+
+JobSystem::Job * JobSystem::Create(const std::function<void()>& function, Job * parent)
+{
+    Job * job = Allocate();
+
+    if (job == NULL)
+        return NULL;
+
+    job->function = function;
+    job->parent = parent;
+    if (parent != NULL)
+        parent->unfinished.fetch_add(1, std::memory_order_relaxed);
+
+    return job;
+}
+
+bool JobSystem::AddDependency(Job * job, Job * prerequisite)
+{
+    if (prerequisite->dependent_count >= JOB_MAX_DEPENDENTS)
+        return false;
+
+    prerequisite->dependents[prerequisite->dependent_count++] = job;
+    job->dependencies.fetch_add(1, std::memory_order_relaxed);
+
+    return true;
+}
+
+void JobSystem::Run(Job * job)
+{
+    if (job->dependencies.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        Push(job);
+}
+
+void JobSystem::Wait(const Job * job)
+{
+    Thread * thread = CurrentThread();
+
+    while (!IsFinished(job))
+    {
+        Job * next = GetJob(thread);
+
+        if (next != NULL)
+            Execute(next);
+        else
+            std::this_thread::yield();
+    }
+}
+
+bool JobSystem::IsFinished(const Job * job) const
+{
+    return job->unfinished.load(std::memory_order_acquire) == 0;
+}
+
+void JobSystem::ParallelFor(unsigned int count, unsigned int grain,
+                            const std::function<void(unsigned int, unsigned int)>& function)
+{
+    if (count == 0)
+        return;
+
+    // Enough pieces to keep every thread busy, but few enough that a large
+    // range with a small grain can't run through the pool
+    grain = std::max(grain, (count + JOB_MAX_RANGE_PIECES - 1) / JOB_MAX_RANGE_PIECES);
+    grain = std::max(grain, 1u);
+
+    // Not worth a job, or not called from one of our threads
+    Job * job = count > grain && CurrentThread() != NULL ? Allocate() : NULL;
+
+    if (job == NULL)
+    {
+        function(0, count);
+        return;
+    }
+
+    job->range_function = &function;
+    job->begin = 0;
+    job->end = count;
+    job->grain = grain;
+
+    Run(job);
+    Wait(job);
+}
+
+JobStats JobSystem::GetStats(void) const
+{
+    JobStats stats = { (unsigned int)m_threads.size(), 0, 0, 0, 0 };
+    unsigned int i;
+
+    for (i = 0; i < m_threads.size(); i++)
+    {
+        stats.executed += m_threads[i]->executed.load(std::memory_order_relaxed);
+        stats.stolen += m_threads[i]->stolen.load(std::memory_order_relaxed);
+        stats.inline_runs += m_threads[i]->inline_runs.load(std::memory_order_relaxed);
+        stats.pool_full += m_threads[i]->pool_full.load(std::memory_order_relaxed);
+    }
+
+    return stats;
+}
+
+void JobSystem::ResetStats(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < m_threads.size(); i++)
+    {
+        m_threads[i]->executed = 0;
+        m_threads[i]->stolen = 0;
+        m_threads[i]->inline_runs = 0;
+        m_threads[i]->pool_full = 0;
+    }
+}
+
+JobSystem::Job * JobSystem::GetJob(Thread * thread)
+{
+    const unsigned int count = (unsigned int)m_threads.size();
+    Job * job = thread->queue.Pop();
+    unsigned int i;
+
+    if (job != NULL || count < 2)
+        return job;
+
+    // Start at a random victim so that thieves spread out
+    thread->random ^= thread->random << 13;
+    thread->random ^= thread->random >> 17;
+    thread->random ^= thread->random << 5;
+
+    for (i = 0; i < count; i++)
+    {
+        Thread * victim = m_threads[(thread->random + i) % count];
+
+        if (victim == thread)
+            continue;
+
+        job = victim->queue.Steal();
+        if (job != NULL)
+        {
+            thread->stolen.fetch_add(1, std::memory_order_relaxed);
+            return job;
+        }
+    }
+
+    return NULL;
+}
+
+bool JobSystem::HasQueuedJobs(void) const
+{
+    unsigned int i;
+
+    for (i = 0; i < m_threads.size(); i++)
+    {
+        if (!m_threads[i]->queue.IsEmpty())
+            return true;
+    }
+
+    return false;
+}
+
+void JobSystem::Push(Job * job)
+{
+    Thread * thread = CurrentThread();
+
+    if (!thread->queue.Push(job))
+    {
+        thread->inline_runs.fetch_add(1, std::memory_order_relaxed);
+        Execute(job);
+        return;
+    }
+
+    // Either this sees a worker that has gone to sleep, or that worker sees
+    // the job when it looks again after saying it's going to sleep
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_sleeping.load(std::memory_order_relaxed) > 0)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_wakeups++;
+        }
+        m_condition.notify_one();
+    }
+}
+
+void JobSystem::Execute(Job * job)
+{
+    if (job->range_function != NULL)
+        RunRange(this, job);
+    else
+        job->function();
+
+    CurrentThread()->executed.fetch_add(1, std::memory_order_relaxed);
+    Finish(job);
+}
+
+void JobSystem::Finish(Job * job)
+{
+    // Once the job is seen to have finished its slot can be reused, so
+    // read what's needed first. Neither changes once the job is running.
+    Job * const parent = job->parent;
+    Job * dependents[JOB_MAX_DEPENDENTS];
+    const int dependent_count = job->dependent_count;
+    int i;
+
+    for (i = 0; i < dependent_count; i++)
+        dependents[i] = job->dependents[i];
+
+    if (job->unfinished.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+
+    for (i = 0; i < dependent_count; i++)
+    {
+        if (dependents[i]->dependencies.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            Push(dependents[i]);
+    }
+
+    if (parent != NULL)
+        Finish(parent);
+}
+
+void JobSystem::RunRange(JobSystem * system, Job * job)
+{
+    unsigned int begin = job->begin;
+    unsigned int end = job->end;
+
+    // Hand off the upper half until what's left is one grain. The pieces
+    // are children of this job, so it doesn't finish before them. If the
+    // pool is full, whatever is left runs here.
+    while (end - begin > job->grain)
+    {
+        const unsigned int middle = begin + (end - begin) / 2;
+        Job * child = system->Allocate();
+
+        if (child == NULL)
+            break;
+
+        child->range_function = job->range_function;
+        child->begin = middle;
+        child->end = end;
+        child->grain = job->grain;
+        child->parent = job;
+        job->unfinished.fetch_add(1, std::memory_order_relaxed);
+
+        system->Run(child);
+        end = middle;
+    }
+
+    (*job->range_function)(begin, end);
+}
+
+void JobSystem::WorkerMain(unsigned int index)
+{
+    Thread * thread = m_threads[index];
+    unsigned int idle = 0;
+
+    t_system = this;
+    t_thread = thread;
+
+    while (m_running.load(std::memory_order_relaxed))
+    {
+        Job * job = GetJob(thread);
+
+        if (job != NULL)
+        {
+            Execute(job);
+            idle = 0;
+            continue;
+        }
+
+        // Spin for a little while in case more work turns up, then sleep
+        // until a push or Free wakes us. Pushes only wake anyone when a
+        // worker is asleep, so say so first and then look for work once
+        // more: a job pushed before that is found, and one pushed after it
+        // bumps m_wakeups, which can't happen until we're waiting as it
+        // takes m_mutex.
+        if (++idle < 64)
+        {
+            std::this_thread::yield();
+        }
+        else
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            const unsigned int wakeups = m_wakeups;
+
+            m_sleeping.fetch_add(1, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!HasQueuedJobs())
+                m_condition.wait(lock, [&] { return m_wakeups != wakeups || !m_running.load(std::memory_order_relaxed); });
+            m_sleeping.fetch_sub(1);
+            idle = 0;
+        }
+    }
+
+    t_system = NULL;
+    t_thread = NULL;
+}
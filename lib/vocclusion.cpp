@@ -0,0 +1,653 @@
+#include "vocclusion.h"
+#include "vsimplify.h"
+#include "vsimd.h"
+
+#include <algorithm>
+#include <map>
+#include <string.h>
+#include <math.h>
+
+using namespace vmath;
+
+// vmath has no matrix * vector; columns are m[0] to m[3]
+static inline vec4 transform(const mat4& m, const vec4& v)
+{
+    return m[0] * v[0] + m[1] * v[1] + m[2] * v[2] + m[3] * v[3];
+}
+
+static inline float min3(float a, float b, float c)
+{
+    return a < b ? (a < c ? a : c) : (b < c ? b : c);
+}
+
+static inline float max3(float a, float b, float c)
+{
+    return a > b ? (a > c ? a : c) : (b > c ? b : c);
+}
+
+static inline float clampf(float x, float lo, float hi)
+{
+    return x < lo ? lo : x > hi ? hi : x;
+}
+
+static inline vec3 load3(const float * p)
+{
+    return vec3(p[0], p[1], p[2]);
+}
+
+OcclusionCuller::OcclusionCuller(void)
+    : m_width(0),
+      m_height(0),
+      m_tiles_x(0),
+      m_tiles_y(0),
+      m_pending(false),
+      m_busy(false),
+      m_quit(false)
+{
+    memset(&m_bounds, 0, sizeof(m_bounds));
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+OcclusionCuller::~OcclusionCuller(void)
+{
+    Free();
+}
+
+bool OcclusionCuller::Initialize(int width, int height, bool threaded)
+{
+    Free();
+
+    if (width <= 0 || height <= 0)
+        return false;
+
+    m_tiles_x = (width + OCCLUSION_TILE_WIDTH - 1) / OCCLUSION_TILE_WIDTH;
+    m_tiles_y = (height + OCCLUSION_TILE_HEIGHT - 1) / OCCLUSION_TILE_HEIGHT;
+    m_width = m_tiles_x * OCCLUSION_TILE_WIDTH;
+    m_height = m_tiles_y * OCCLUSION_TILE_HEIGHT;
+    m_tiles.resize(m_tiles_x * m_tiles_y);
+
+    m_quit = false;
+    if (threaded)
+        m_thread = std::thread(&OcclusionCuller::Run, this);
+
+    return true;
+}
+
+void OcclusionCuller::Free(void)
+{
+    if (m_thread.joinable())
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_quit = true;
+        }
+        m_condition.notify_all();
+        m_thread.join();
+    }
+
+    m_pending = false;
+    m_busy = false;
+    m_tiles.clear();
+    m_occluders.clear();
+    m_meshes.clear();
+    m_matrices.clear();
+    m_visible.clear();
+    m_width = m_height = 0;
+    m_tiles_x = m_tiles_y = 0;
+}
+
+void OcclusionCuller::ClearOccluders(void)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (m_busy)
+        m_condition.wait(lock);
+
+    m_occluders.clear();
+}
+
+void OcclusionCuller::AddOccluder(const VBObject& object, const mat4& model)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (m_busy)
+        m_condition.wait(lock);
+
+    // A screen size of zero picks the coarsest level of detail
+    Occluder occluder = { &object, object.SelectLOD(0.0f), model, -1 };
+    size_t i;
+
+    for (i = 0; i < m_meshes.size(); i++)
+    {
+        if (m_meshes[i].object == &object)
+            occluder.mesh = (int)i;
+    }
+
+    m_occluders.push_back(occluder);
+}
+
+bool OcclusionCuller::BuildOccluder(const VBObject& object, unsigned int max_triangles)
+{
+    const float * positions = object.GetAttributeData(0);
+    const unsigned int components = object.GetAttributeComponents(0);
+    const GLuint * indices = object.GetIndexData();
+    const unsigned int frame = object.SelectLOD(0.0f);
+    const unsigned int first = object.GetFirstVertex(frame);
+    const unsigned int count = object.GetVertexCount(frame) / 3 * 3;
+    std::map<std::vector<float>, unsigned int> welded;
+    std::vector<float> key(3);
+    std::vector<unsigned int> corners;
+    std::vector<vec3> normals;
+    std::vector<float> offsets;
+    OccluderMesh mesh;
+    double volume = 0.0;
+    unsigned int i, j;
+
+    if (positions == NULL)
+        return false;
+
+    if (count / 3 <= max_triangles)
+        return true;
+
+    // Seams and creases don't matter to an occluder, so the vertices that
+    // share a position are welded to let the simplifier take the surface
+    // apart freely. Triangles that weld to a line go.
+    mesh.object = &object;
+    for (i = 0; i < count; i += 3)
+    {
+        unsigned int v[3];
+
+        for (j = 0; j < 3; j++)
+        {
+            const float * p = positions + (indices ? indices[first + i + j] : first + i + j) * components;
+
+            key.assign(p, p + 3);
+            std::map<std::vector<float>, unsigned int>::iterator it = welded.find(key);
+            if (it == welded.end())
+            {
+                it = welded.insert(std::make_pair(key, (unsigned int)welded.size())).first;
+                mesh.positions.insert(mesh.positions.end(), p, p + 3);
+            }
+            v[j] = it->second;
+        }
+
+        if (v[0] != v[1] && v[1] != v[2] && v[2] != v[0])
+            corners.insert(corners.end(), v, v + 3);
+    }
+
+    if (corners.empty())
+        return false;
+
+    MeshSimplifier simplifier(&mesh.positions[0], NULL, (unsigned int)welded.size(), 3,
+                              &corners[0], (unsigned int)corners.size());
+    simplifier.Simplify(max_triangles);
+    simplifier.GetIndices(mesh.indices);
+    if (mesh.indices.empty())
+        return false;
+
+    // Area weighted vertex normals, and the sign of the volume to tell
+    // which way they point. Each vertex moves in by the largest error of
+    // the corners of the triangles around it.
+    normals.assign(welded.size(), vec3(0.0f));
+    offsets.assign(welded.size(), 0.0f);
+    for (i = 0; i < mesh.indices.size(); i += 3)
+    {
+        const unsigned int * v = &mesh.indices[i];
+        const vec3 p0 = load3(&mesh.positions[v[0] * 3]);
+        const vec3 n = cross(load3(&mesh.positions[v[1] * 3]) - p0, load3(&mesh.positions[v[2] * 3]) - p0);
+        const float error = max3(simplifier.GetVertexError(v[0]), simplifier.GetVertexError(v[1]),
+                                 simplifier.GetVertexError(v[2]));
+
+        volume += dot(p0, n);
+        for (j = 0; j < 3; j++)
+        {
+            normals[v[j]] += n;
+            offsets[v[j]] = std::max(offsets[v[j]], error);
+        }
+    }
+
+    for (i = 0; i < normals.size(); i++)
+    {
+        const float l = length(normals[i]);
+
+        if (l == 0.0f)
+            continue;
+
+        const vec3 offset = normals[i] * ((volume > 0.0 ? -offsets[i] : offsets[i]) / l);
+
+        for (j = 0; j < 3; j++)
+            mesh.positions[i * 3 + j] += offset[j];
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (m_busy)
+        m_condition.wait(lock);
+
+    for (i = 0; i < m_meshes.size(); i++)
+    {
+        if (m_meshes[i].object == &object)
+        {
+            m_meshes[i] = mesh;
+            return true;
+        }
+    }
+
+    m_meshes.push_back(mesh);
+
+    return true;
+}
+
+void OcclusionCuller::Submit(const mat4& view_projection, const VBM_BOUNDS& bounds,
+                             const mat4 * matrices, unsigned int count)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (m_busy)
+        m_condition.wait(lock);
+
+    m_submit_time = std::chrono::high_resolution_clock::now();
+    m_view_projection = view_projection;
+    m_bounds = bounds;
+    m_matrices.assign(matrices, matrices + count);
+
+    if (!m_thread.joinable())
+    {
+        Cull();
+        return;
+    }
+
+    m_pending = true;
+    m_busy = true;
+    lock.unlock();
+    m_condition.notify_all();
+}
+
+unsigned int OcclusionCuller::Wait(unsigned int * visible)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (m_busy)
+        m_condition.wait(lock);
+
+    if (!m_visible.empty())
+        memcpy(visible, &m_visible[0], m_visible.size() * sizeof(unsigned int));
+
+    return (unsigned int)m_visible.size();
+}
+
+void OcclusionCuller::Run(void)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    for (;;)
+    {
+        while (!m_pending && !m_quit)
+            m_condition.wait(lock);
+
+        if (!m_pending)
+            break;
+
+        // Submit and the occluder functions wait for m_busy to clear, so
+        // nothing else touches the frame while it's unlocked
+        m_pending = false;
+        lock.unlock();
+        Cull();
+        lock.lock();
+        m_busy = false;
+        m_condition.notify_all();
+    }
+}
+
+void OcclusionCuller::Cull(void)
+{
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    const unsigned int count = (unsigned int)m_matrices.size();
+    unsigned int triangles = 0;
+    unsigned int i;
+    int j, k;
+
+    // Nothing is covered yet, so the whole tile is at the far plane
+    for (i = 0; i < m_tiles.size(); i++)
+    {
+        memset(m_tiles[i].mask, 0, sizeof(m_tiles[i].mask));
+        m_tiles[i].z[0] = 1.0f;
+        m_tiles[i].z[1] = 0.0f;
+    }
+
+    for (i = 0; i < m_occluders.size(); i++)
+    {
+        const Occluder& occluder = m_occluders[i];
+        const VBObject& object = *occluder.object;
+        const OccluderMesh * mesh = occluder.mesh >= 0 ? &m_meshes[occluder.mesh] : NULL;
+        const float * positions = mesh ? &mesh->positions[0] : object.GetAttributeData(0);
+        const unsigned int components = mesh ? 3 : object.GetAttributeComponents(0);
+        const GLuint * indices = mesh ? &mesh->indices[0] : object.GetIndexData();
+        const unsigned int first = mesh ? 0 : object.GetFirstVertex(occluder.frame);
+        const int n = (int)((mesh ? mesh->indices.size() : object.GetVertexCount(occluder.frame)) / 3);
+        const mat4 mvp = m_view_projection * occluder.model;
+
+        if (positions == NULL)
+            continue;
+
+        for (j = 0; j < n; j++)
+        {
+            vec4 clip[3];
+
+            for (k = 0; k < 3; k++)
+            {
+                const unsigned int index = indices ? indices[first + j * 3 + k] : first + j * 3 + k;
+                const float * p = positions + index * components;
+                clip[k] = transform(mvp, vec4(p[0], p[1], p[2], components > 3 ? p[3] : 1.0f));
+            }
+
+            RasterizeTriangle(clip);
+        }
+
+        triangles += n;
+    }
+
+    std::chrono::high_resolution_clock::time_point rasterized = std::chrono::high_resolution_clock::now();
+
+    m_visible.clear();
+    for (i = 0; i < count; i++)
+    {
+        if (m_tiles.empty() || TestBox(m_view_projection * m_matrices[i], m_bounds))
+            m_visible.push_back(i);
+    }
+
+    std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+
+    m_stats.occluder_triangles = triangles;
+    m_stats.tested = count;
+    m_stats.culled = count - (unsigned int)m_visible.size();
+    m_stats.culled_percent = count ? 100.0f * (float)m_stats.culled / (float)count : 0.0f;
+    m_stats.rasterize_time = std::chrono::duration<float, std::micro>(rasterized - start).count();
+    m_stats.test_time = std::chrono::duration<float, std::micro>(end - rasterized).count();
+    m_stats.total_time = std::chrono::duration<float, std::micro>(end - m_submit_time).count();
+}
+
+void OcclusionCuller::RasterizeTriangle(const vec4 * clip)
+{
+    vec3 v[3];
+    int i;
+
+    // Occluders only ever need to be conservative, so triangles reaching
+    // behind the near plane are dropped rather than clipped
+    for (i = 0; i < 3; i++)
+    {
+        if (clip[i][3] <= 0.0f || clip[i][2] < -clip[i][3])
+            return;
+
+        const float inv_w = 1.0f / clip[i][3];
+        v[i] = vec3((clip[i][0] * inv_w * 0.5f + 0.5f) * (float)m_width,
+                    (clip[i][1] * inv_w * 0.5f + 0.5f) * (float)m_height,
+                    clip[i][2] * inv_w * 0.5f + 0.5f);
+    }
+
+    // Counterclockwise is front facing; back faces and slivers are skipped
+    const float area = (v[1][0] - v[0][0]) * (v[2][1] - v[0][1]) - (v[2][0] - v[0][0]) * (v[1][1] - v[0][1]);
+    if (!(area > 0.0f))
+        return;
+
+    const float bound_min_x = clampf(floorf(min3(v[0][0], v[1][0], v[2][0])), 0.0f, (float)m_width);
+    const float bound_max_x = clampf(ceilf(max3(v[0][0], v[1][0], v[2][0])), 0.0f, (float)m_width);
+    const float bound_min_y = clampf(floorf(min3(v[0][1], v[1][1], v[2][1])), 0.0f, (float)m_height);
+    const float bound_max_y = clampf(ceilf(max3(v[0][1], v[1][1], v[2][1])), 0.0f, (float)m_height);
+
+    if (bound_min_x >= bound_max_x || bound_min_y >= bound_max_y)
+        return;
+
+    // Edge i is opposite vertex i and is positive inside. Everything is
+    // relative to vertex 0 to keep the constant terms small; there, edge 0
+    // is the (doubled) area and the other two are zero.
+    float edge_a[3], edge_b[3];
+    const float edge_c[3] = { area, 0.0f, 0.0f };
+
+    for (i = 0; i < 3; i++)
+    {
+        const vec3& p = v[(i + 1) % 3];
+        const vec3& q = v[(i + 2) % 3];
+        edge_a[i] = p[1] - q[1];
+        edge_b[i] = q[0] - p[0];
+    }
+
+    // Depth plane, and the range the triangle can't leave
+    const float dz1 = v[1][2] - v[0][2];
+    const float dz2 = v[2][2] - v[0][2];
+    const float z_dx = (dz1 * (v[2][1] - v[0][1]) - dz2 * (v[1][1] - v[0][1])) / area;
+    const float z_dy = (dz2 * (v[1][0] - v[0][0]) - dz1 * (v[2][0] - v[0][0])) / area;
+    const float vertex_z_min = min3(v[0][2], v[1][2], v[2][2]);
+    const float vertex_z_max = max3(v[0][2], v[1][2], v[2][2]);
+
+    const int tile_min_x = (int)bound_min_x / OCCLUSION_TILE_WIDTH;
+    const int tile_max_x = ((int)bound_max_x - 1) / OCCLUSION_TILE_WIDTH;
+    const int tile_min_y = (int)bound_min_y / OCCLUSION_TILE_HEIGHT;
+    const int tile_max_y = ((int)bound_max_y - 1) / OCCLUSION_TILE_HEIGHT;
+
+    for (int ty = tile_min_y; ty <= tile_max_y; ty++)
+    {
+        // First covered pixel and one past the last in each row of the tile
+        // row, sampling at pixel centers. Edges exactly through a center
+        // leave it uncovered, which only ever loses coverage.
+        VMATH_ALIGN(32) int span_begin[OCCLUSION_TILE_HEIGHT];
+        VMATH_ALIGN(32) int span_end[OCCLUSION_TILE_HEIGHT];
+        const float row_y = (float)(ty * OCCLUSION_TILE_HEIGHT) + 0.5f - v[0][1];
+        const float far_left = (float)m_width + 1.0f;
+
+#if defined(VMATH_AVX2)
+        const __m256 dy = _mm256_add_ps(_mm256_set1_ps(row_y), _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f));
+        __m256 left = _mm256_set1_ps(-1.0f);
+        __m256 right = _mm256_set1_ps(far_left);
+
+        for (i = 0; i < 3; i++)
+        {
+            const __m256 t = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(edge_b[i]), dy), _mm256_set1_ps(edge_c[i]));
+            if (edge_a[i] != 0.0f)
+            {
+                const __m256 x = _mm256_sub_ps(_mm256_set1_ps(v[0][0]), _mm256_div_ps(t, _mm256_set1_ps(edge_a[i])));
+                if (edge_a[i] > 0.0f)
+                    left = _mm256_max_ps(left, x);
+                else
+                    right = _mm256_min_ps(right, x);
+            }
+            else
+            {
+                left = _mm256_blendv_ps(left, _mm256_set1_ps(far_left), _mm256_cmp_ps(t, _mm256_setzero_ps(), _CMP_LE_OQ));
+            }
+        }
+
+        left = _mm256_min_ps(left, _mm256_set1_ps(far_left));
+        right = _mm256_max_ps(right, _mm256_set1_ps(-1.0f));
+        _mm256_store_si256((__m256i *)span_begin,
+                           _mm256_add_epi32(_mm256_cvttps_epi32(_mm256_floor_ps(_mm256_sub_ps(left, _mm256_set1_ps(0.5f)))), _mm256_set1_epi32(1)));
+        _mm256_store_si256((__m256i *)span_end,
+                           _mm256_cvttps_epi32(_mm256_ceil_ps(_mm256_sub_ps(right, _mm256_set1_ps(0.5f)))));
+#else
+        for (int r = 0; r < OCCLUSION_TILE_HEIGHT; r++)
+        {
+            const float dy = row_y + (float)r;
+            float left = -1.0f;
+            float right = far_left;
+
+            for (i = 0; i < 3; i++)
+            {
+                const float t = edge_b[i] * dy + edge_c[i];
+                if (edge_a[i] != 0.0f)
+                {
+                    const float x = v[0][0] - t / edge_a[i];
+                    if (edge_a[i] > 0.0f)
+                        left = left > x ? left : x;
+                    else
+                        right = right < x ? right : x;
+                }
+                else if (t <= 0.0f)
+                {
+                    left = far_left;
+                }
+            }
+
+            left = left < far_left ? left : far_left;
+            right = right > -1.0f ? right : -1.0f;
+            span_begin[r] = (int)floorf(left - 0.5f) + 1;
+            span_end[r] = (int)ceilf(right - 0.5f);
+        }
+#endif
+
+        for (int tx = tile_min_x; tx <= tile_max_x; tx++)
+        {
+            Tile& tile = m_tiles[ty * m_tiles_x + tx];
+            const int base = tx * OCCLUSION_TILE_WIDTH;
+
+            // The plane's range over the part of the tile inside the
+            // triangle's bounds contains the triangle's range there
+            const float x0 = (bound_min_x > (float)base ? bound_min_x : (float)base) - v[0][0];
+            const float x1 = (bound_max_x < (float)(base + OCCLUSION_TILE_WIDTH) ? bound_max_x : (float)(base + OCCLUSION_TILE_WIDTH)) - v[0][0];
+            const float y0 = (bound_min_y > (float)(ty * OCCLUSION_TILE_HEIGHT) ? bound_min_y : (float)(ty * OCCLUSION_TILE_HEIGHT)) - v[0][1];
+            const float y1 = (bound_max_y < (float)((ty + 1) * OCCLUSION_TILE_HEIGHT) ? bound_max_y : (float)((ty + 1) * OCCLUSION_TILE_HEIGHT)) - v[0][1];
+            const float zx0 = z_dx * x0, zx1 = z_dx * x1;
+            const float zy0 = z_dy * y0, zy1 = z_dy * y1;
+            float z_min = v[0][2] + (zx0 < zx1 ? zx0 : zx1) + (zy0 < zy1 ? zy0 : zy1);
+            float z_max = v[0][2] + (zx0 > zx1 ? zx0 : zx1) + (zy0 > zy1 ? zy0 : zy1);
+            z_min = z_min > vertex_z_min ? z_min : vertex_z_min;
+            z_max = z_max < vertex_z_max ? z_max : vertex_z_max;
+
+            // Entirely behind what's already known to cover the tile
+            if (z_min >= tile.z[0])
+                continue;
+
+            VMATH_ALIGN(32) unsigned int mask[OCCLUSION_TILE_HEIGHT];
+
+#if defined(VMATH_AVX2)
+            const __m256i ones = _mm256_set1_epi32(-1);
+            const __m256i zero = _mm256_setzero_si256();
+            const __m256i width = _mm256_set1_epi32(OCCLUSION_TILE_WIDTH);
+            const __m256i begin = _mm256_min_epi32(_mm256_max_epi32(_mm256_sub_epi32(_mm256_load_si256((const __m256i *)span_begin), _mm256_set1_epi32(base)), zero), width);
+            const __m256i end = _mm256_min_epi32(_mm256_max_epi32(_mm256_sub_epi32(_mm256_load_si256((const __m256i *)span_end), _mm256_set1_epi32(base)), zero), width);
+            // Variable shifts of 32 or more give zero, which is what an
+            // empty span needs
+            const __m256i coverage = _mm256_and_si256(_mm256_sllv_epi32(ones, begin), _mm256_srlv_epi32(ones, _mm256_sub_epi32(width, end)));
+
+            if (_mm256_testz_si256(coverage, coverage))
+                continue;
+            _mm256_store_si256((__m256i *)mask, coverage);
+#else
+            unsigned int any = 0;
+            for (int r = 0; r < OCCLUSION_TILE_HEIGHT; r++)
+            {
+                int begin = span_begin[r] - base;
+                int end = span_end[r] - base;
+                begin = begin < 0 ? 0 : begin > OCCLUSION_TILE_WIDTH ? OCCLUSION_TILE_WIDTH : begin;
+                end = end < 0 ? 0 : end > OCCLUSION_TILE_WIDTH ? OCCLUSION_TILE_WIDTH : end;
+                mask[r] = (begin >= 32 ? 0u : ~0u << begin) & (end <= 0 ? 0u : ~0u >> (32 - end));
+                any |= mask[r];
+            }
+
+            if (any == 0)
+                continue;
+#endif
+
+            // Start the working layer over if this triangle is farther from
+            // it than it is from the tile's depth; merging would only make
+            // the layer useless
+            if (z_max - tile.z[1] > tile.z[0] - tile.z[1])
+            {
+                memset(tile.mask, 0, sizeof(tile.mask));
+                tile.z[1] = 0.0f;
+            }
+
+            tile.z[1] = tile.z[1] > z_max ? tile.z[1] : z_max;
+
+            unsigned int full = ~0u;
+            for (int r = 0; r < OCCLUSION_TILE_HEIGHT; r++)
+            {
+                tile.mask[r] |= mask[r];
+                full &= tile.mask[r];
+            }
+
+            // A fully covered working layer becomes the tile's depth
+            if (full == ~0u)
+            {
+                tile.z[0] = tile.z[0] < tile.z[1] ? tile.z[0] : tile.z[1];
+                tile.z[1] = 0.0f;
+                memset(tile.mask, 0, sizeof(tile.mask));
+            }
+        }
+    }
+}
+
+bool OcclusionCuller::TestBox(const mat4& mvp, const VBM_BOUNDS& bounds) const
+{
+    float min_x = 1e30f, min_y = 1e30f, min_z = 1e30f;
+    float max_x = -1e30f, max_y = -1e30f;
+    int i;
+
+    for (i = 0; i < 8; i++)
+    {
+        const vec4 corner((i & 1) ? bounds.max.x : bounds.min.x,
+                          (i & 2) ? bounds.max.y : bounds.min.y,
+                          (i & 4) ? bounds.max.z : bounds.min.z,
+                          1.0f);
+        const vec4 clip = transform(mvp, corner);
+
+        if (clip[3] <= 0.0f || clip[2] < -clip[3])
+            return true;
+
+        const float inv_w = 1.0f / clip[3];
+        const float x = clip[0] * inv_w;
+        const float y = clip[1] * inv_w;
+        const float z = clip[2] * inv_w;
+
+        min_x = x < min_x ? x : min_x;
+        max_x = x > max_x ? x : max_x;
+        min_y = y < min_y ? y : min_y;
+        max_y = y > max_y ? y : max_y;
+        min_z = z < min_z ? z : min_z;
+    }
+
+    if (min_x > 1.0f || max_x < -1.0f || min_y > 1.0f || max_y < -1.0f || min_z > 1.0f)
+        return false;
+
+    const float x0 = clampf((min_x * 0.5f + 0.5f) * (float)m_width, 0.0f, (float)m_width - 1.0f);
+    const float x1 = clampf((max_x * 0.5f + 0.5f) * (float)m_width, 0.0f, (float)m_width - 1.0f);
+    const float y0 = clampf((min_y * 0.5f + 0.5f) * (float)m_height, 0.0f, (float)m_height - 1.0f);
+    const float y1 = clampf((max_y * 0.5f + 0.5f) * (float)m_height, 0.0f, (float)m_height - 1.0f);
+    const float z = min_z * 0.5f + 0.5f;
+
+    const int tile_min_x = (int)x0 / OCCLUSION_TILE_WIDTH;
+    const int tile_max_x = (int)x1 / OCCLUSION_TILE_WIDTH;
+    const int tile_min_y = (int)y0 / OCCLUSION_TILE_HEIGHT;
+    const int tile_max_y = (int)y1 / OCCLUSION_TILE_HEIGHT;
+
+    // Pixels in a tile's working layer are covered up to its depth and the
+    // rest up to the tile's depth, so a box in front of the tile's depth is
+    // still hidden where its pixels are all in the layer and behind it
+    for (int ty = tile_min_y; ty <= tile_max_y; ty++)
+    {
+        const int row_min = ty == tile_min_y ? (int)y0 - ty * OCCLUSION_TILE_HEIGHT : 0;
+        const int row_max = ty == tile_max_y ? (int)y1 - ty * OCCLUSION_TILE_HEIGHT : OCCLUSION_TILE_HEIGHT - 1;
+
+        for (int tx = tile_min_x; tx <= tile_max_x; tx++)
+        {
+            const Tile& tile = m_tiles[ty * m_tiles_x + tx];
+
+            if (z >= tile.z[0])
+                continue;
+
+            if (z < tile.z[1])
+                return true;
+
+            const int column_min = tx == tile_min_x ? (int)x0 - tx * OCCLUSION_TILE_WIDTH : 0;
+            const int column_max = tx == tile_max_x ? (int)x1 - tx * OCCLUSION_TILE_WIDTH : OCCLUSION_TILE_WIDTH - 1;
+            const unsigned int columns = (~0u << column_min) & (~0u >> (OCCLUSION_TILE_WIDTH - 1 - column_max));
+
+            for (int r = row_min; r <= row_max; r++)
+            {
+                if ((tile.mask[r] & columns) != columns)
+                    return true;
+            }
+        }
+    }
+
+    return false;
+}
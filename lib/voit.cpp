@@ -0,0 +1,627 @@
+#include "voit.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+
+// Each fragment is a uvec4: next pointer, color, depth and an extra color
+#define OIT_FRAGMENT_SIZE   (4 * sizeof(GLuint))
+
+OITBuffer::OITBuffer(void)
+    : m_mode(OIT_LINKED_LIST),
+      m_width(0),
+      m_height(0),
+      m_k(0),
+      m_head_texture(0),
+      m_list_buffer(0),
+      m_list_texture(0),
+      m_counter_buffer(0),
+      m_weighted_fbo(0),
+      m_accum_texture(0),
+      m_reveal_texture(0),
+      m_previous_fbo(0),
+      m_readback_index(0),
+      m_memory_budget(0),
+      m_fallback(true),
+      m_underused_frames(0),
+      m_over_budget_frames(0)
+{
+    memset(m_readback_buffer, 0, sizeof(m_readback_buffer));
+    memset(m_readback_fence, 0, sizeof(m_readback_fence));
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+OITBuffer::~OITBuffer(void)
+{
+    Free();
+}
+
+bool OITBuffer::Initialize(GLsizei width, GLsizei height, OITMode mode, unsigned int k)
+{
+    Free();
+
+    m_width = width;
+    m_height = height;
+    m_k = k;
+    m_mode = mode;
+
+    glGenBuffers(1, &m_counter_buffer);
+    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, m_counter_buffer);
+    glBufferStorage(GL_ATOMIC_COUNTER_BUFFER, sizeof(GLuint), NULL, 0);
+    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+
+    glGenBuffers(READBACK_LATENCY, m_readback_buffer);
+    for (int i = 0; i < READBACK_LATENCY; i++)
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_readback_buffer[i]);
+        glBufferData(GL_COPY_WRITE_BUFFER, sizeof(GLuint), NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    glGenBuffers(1, &m_list_buffer);
+    glGenTextures(1, &m_list_texture);
+
+    AllocateImages();
+    SetMode(mode);
+
+    return true;
+}
+
+void OITBuffer::Free(void)
+{
+    int i;
+
+    for (i = 0; i < READBACK_LATENCY; i++)
+    {
+        if (m_readback_fence[i])
+            glDeleteSync(m_readback_fence[i]);
+        m_readback_fence[i] = 0;
+    }
+
+    if (m_counter_buffer == 0)
+        return;
+
+    glDeleteBuffers(READBACK_LATENCY, m_readback_buffer);
+    glDeleteBuffers(1, &m_counter_buffer);
+    glDeleteBuffers(1, &m_list_buffer);
+    glDeleteTextures(1, &m_list_texture);
+    glDeleteTextures(1, &m_head_texture);
+    glDeleteTextures(1, &m_accum_texture);
+    glDeleteTextures(1, &m_reveal_texture);
+    glDeleteFramebuffers(1, &m_weighted_fbo);
+
+    memset(m_readback_buffer, 0, sizeof(m_readback_buffer));
+    m_counter_buffer = m_list_buffer = m_list_texture = 0;
+    m_head_texture = m_accum_texture = m_reveal_texture = m_weighted_fbo = 0;
+
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+void OITBuffer::Resize(GLsizei width, GLsizei height)
+{
+    if (width == m_width && height == m_height)
+        return;
+
+    m_width = width;
+    m_height = height;
+
+    if (m_counter_buffer == 0)
+        return;
+
+    AllocateImages();
+
+    // The k-buffer's store is tied to the size of the framebuffer
+    if (m_mode == OIT_K_BUFFER)
+        AllocateStore(m_width * m_height * m_k);
+}
+
+void OITBuffer::SetMode(OITMode mode)
+{
+    m_mode = mode;
+    m_underused_frames = 0;
+    m_over_budget_frames = 0;
+
+    switch (mode)
+    {
+        case OIT_LINKED_LIST:
+            // Start from one fragment per pixel and let the
+            // feedback from the counter size it from there
+            AllocateStore(m_width * m_height > MIN_CAPACITY ? m_width * m_height : MIN_CAPACITY);
+            break;
+        case OIT_K_BUFFER:
+            AllocateStore(m_width * m_height * m_k);
+            break;
+        case OIT_WEIGHTED_BLENDED:
+            AllocateStore(0);
+            break;
+    }
+}
+
+void OITBuffer::AllocateImages(void)
+{
+    static const GLenum draw_buffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+
+    // Immutable storage can't be resized, so start from fresh names
+    glDeleteTextures(1, &m_head_texture);
+    glDeleteTextures(1, &m_accum_texture);
+    glDeleteTextures(1, &m_reveal_texture);
+
+    glGenTextures(1, &m_head_texture);
+    glBindTexture(GL_TEXTURE_2D, m_head_texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32UI, m_width, m_height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glGenTextures(1, &m_accum_texture);
+    glBindTexture(GL_TEXTURE_2D, m_accum_texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, m_width, m_height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glGenTextures(1, &m_reveal_texture);
+    glBindTexture(GL_TEXTURE_2D, m_reveal_texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_R8, m_width, m_height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    if (m_weighted_fbo == 0)
+        glGenFramebuffers(1, &m_weighted_fbo);
+
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &m_previous_fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_weighted_fbo);
+    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, m_accum_texture, 0);
+    glFramebufferTexture(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, m_reveal_texture, 0);
+    glDrawBuffers(2, draw_buffers);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_previous_fbo);
+
+    UpdateMemoryInUse();
+}
+
+void OITBuffer::AllocateStore(unsigned int capacity)
+{
+    // A buffer texture needs at least one element
+    const GLsizeiptr size = (capacity ? capacity : 1) * OIT_FRAGMENT_SIZE;
+
+    glBindBuffer(GL_TEXTURE_BUFFER, m_list_buffer);
+    glBufferData(GL_TEXTURE_BUFFER, size, NULL, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    // Re-attach so that the texture picks up the new size
+    glBindTexture(GL_TEXTURE_BUFFER, m_list_texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32UI, m_list_buffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+    m_stats.capacity = capacity;
+    UpdateMemoryInUse();
+}
+
+void OITBuffer::UpdateMemoryInUse(void)
+{
+    const size_t pixels = size_t(m_width) * size_t(m_height);
+
+    m_stats.memory_in_use = pixels * sizeof(GLuint) +                       // Heads
+                            size_t(m_stats.capacity) * OIT_FRAGMENT_SIZE +  // Fragments
+                            pixels * (4 * 2 + 1) +                          // Weighted targets
+                            (1 + READBACK_LATENCY) * sizeof(GLuint);        // Counters
+}
+
+void OITBuffer::Begin(void)
+{
+    static const GLuint zero = 0;
+    static const GLuint one = 1;
+    static const GLfloat accum_clear[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    static const GLfloat reveal_clear[] = { 1.0f, 0.0f, 0.0f, 0.0f };
+
+    ReadBackCounter();
+
+    if (m_mode == OIT_WEIGHTED_BLENDED)
+    {
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &m_previous_fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_weighted_fbo);
+        glClearBufferfv(GL_COLOR, 0, accum_clear);
+        glClearBufferfv(GL_COLOR, 1, reveal_clear);
+
+        glEnable(GL_BLEND);
+        glBlendFunci(0, GL_ONE, GL_ONE);
+        glBlendFunci(1, GL_ZERO, GL_ONE_MINUS_SRC_COLOR);
+        return;
+    }
+
+    // Clear the heads (or counts) and reset the allocator. Index 0 is
+    // reserved to terminate the lists.
+    glClearTexImage(m_head_texture, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, m_counter_buffer);
+    glClearBufferData(GL_ATOMIC_COUNTER_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT,
+                      m_mode == OIT_LINKED_LIST ? &one : &zero);
+    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, 0);
+
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_ATOMIC_COUNTER_BARRIER_BIT);
+
+    glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 0, m_counter_buffer);
+    glBindImageTexture(0, m_head_texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+    glBindImageTexture(1, m_list_texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32UI);
+}
+
+void OITBuffer::End(void)
+{
+    if (m_mode == OIT_WEIGHTED_BLENDED)
+    {
+        glDisable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ZERO);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_previous_fbo);
+        return;
+    }
+
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_ATOMIC_COUNTER_BARRIER_BIT);
+
+    // Queue a copy of the counter. It is read back a few frames from now,
+    // once the GPU has passed the fence, so the CPU never waits for it.
+    const unsigned int slot = m_readback_index % READBACK_LATENCY;
+
+    if (m_readback_fence[slot] == 0)
+    {
+        glBindBuffer(GL_COPY_READ_BUFFER, m_counter_buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_readback_buffer[slot]);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(GLuint));
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        m_readback_fence[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        m_readback_index++;
+    }
+}
+
+void OITBuffer::BindForResolve(void)
+{
+    if (m_mode == OIT_WEIGHTED_BLENDED)
+    {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, m_accum_texture);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, m_reveal_texture);
+        glActiveTexture(GL_TEXTURE0);
+        return;
+    }
+
+    glBindImageTexture(0, m_head_texture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32UI);
+    glBindImageTexture(1, m_list_texture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32UI);
+}
+
+void OITBuffer::ReadBackCounter(void)
+{
+    int i;
+
+    // Drain every copy that has landed, oldest first
+    for (i = 0; i < READBACK_LATENCY; i++)
+    {
+        const unsigned int slot = (m_readback_index + i) % READBACK_LATENCY;
+        GLuint count;
+
+        if (m_readback_fence[slot] == 0)
+            continue;
+
+        if (glClientWaitSync(m_readback_fence[slot], 0, 0) == GL_TIMEOUT_EXPIRED)
+            break;
+
+        glDeleteSync(m_readback_fence[slot]);
+        m_readback_fence[slot] = 0;
+
+        glBindBuffer(GL_COPY_READ_BUFFER, m_readback_buffer[slot]);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(GLuint), &count);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+        if (m_mode == OIT_LINKED_LIST && count > 0)
+            count--;
+
+        m_stats.fragments = count;
+        m_stats.fragments_per_pixel = float(count) / float(m_width * m_height);
+
+        if (count > m_stats.capacity)
+            m_stats.overflow_frames++;
+
+        if (m_mode != OIT_LINKED_LIST)
+            continue;
+
+        // Grow with some headroom as soon as the store overflows, but only
+        // give memory back after it has been mostly idle for a while
+        const unsigned int budget = m_memory_budget ? (unsigned int)(m_memory_budget / OIT_FRAGMENT_SIZE) : 0xFFFFFFFFu;
+
+        if (count > m_stats.capacity)
+        {
+            unsigned int capacity = count + count / 2;
+
+            m_underused_frames = 0;
+
+            if (capacity > budget)
+            {
+                capacity = budget;
+                if (m_fallback && ++m_over_budget_frames >= FALLBACK_DELAY)
+                {
+                    m_stats.fallback_count++;
+                    SetMode(OIT_K_BUFFER);
+                    return;
+                }
+            }
+
+            if (capacity > m_stats.capacity)
+                AllocateStore(capacity);
+        }
+        else
+        {
+            m_over_budget_frames = 0;
+
+            if (count < m_stats.capacity / 4 && m_stats.capacity > MIN_CAPACITY)
+            {
+                if (++m_underused_frames >= SHRINK_DELAY)
+                {
+                    m_underused_frames = 0;
+                    AllocateStore(count * 2 > MIN_CAPACITY ? count * 2 : (unsigned int)MIN_CAPACITY);
+                }
+            }
+            else
+            {
+                m_underused_frames = 0;
+            }
+        }
+    }
+}
+
+bool OITBuffer::Capture(std::vector<GLuint>& heads, std::vector<GLuint>& fragments) const
+{
+    if (m_mode == OIT_WEIGHTED_BLENDED || m_counter_buffer == 0)
+        return false;
+
+    const unsigned int capacity = m_stats.capacity ? m_stats.capacity : 1;
+
+    glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    heads.resize(size_t(m_width) * size_t(m_height));
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, m_head_texture);
+    glGetTexImage(GL_TEXTURE_2D, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &heads[0]);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    fragments.resize(size_t(capacity) * 4);
+    glBindBuffer(GL_TEXTURE_BUFFER, m_list_buffer);
+    glGetBufferSubData(GL_TEXTURE_BUFFER, 0, capacity * OIT_FRAGMENT_SIZE, &fragments[0]);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    return true;
+}
+
+// Accumulates the fragments of one pixel as the resolve shaders do. Keys
+// are (depth bits, fragment index); depths are positive, so their bits
+// sort as the floats do.
+class OITReferenceResolver
+{
+public:
+    OITReferenceResolver(const GLuint * fragments)
+        : m_fragments(fragments),
+          m_count(0),
+          m_tail_fragments(0),
+          m_tail_alpha(0.0f),
+          m_tail_transmittance(1.0f)
+    {
+        memset(m_tail_color, 0, sizeof(m_tail_color));
+    }
+
+    void Add(GLuint index)
+    {
+        Key key = { m_fragments[index * 4 + 2], index };
+
+        if (m_count < OIT_RESOLVE_FRONT_K)
+        {
+            m_keys[m_count++] = key;
+            if (m_count == OIT_RESOLVE_FRONT_K)
+                SortNetwork(OIT_RESOLVE_FRONT_K);
+        }
+        else if (key.depth < m_keys[OIT_RESOLVE_FRONT_K - 1].depth)
+        {
+            for (unsigned int i = 0; i < OIT_RESOLVE_FRONT_K; i++)
+            {
+                if (key.depth < m_keys[i].depth)
+                    std::swap(key, m_keys[i]);
+            }
+
+            AddToTail(key.index);
+        }
+        else
+        {
+            AddToTail(index);
+        }
+    }
+
+    unsigned int Finish(float * color)
+    {
+        float transmittance = 1.0f;
+        float coverage;
+        unsigned int i;
+        int c;
+
+        if (m_count < OIT_RESOLVE_FRONT_K)
+        {
+            const unsigned int n = m_count <= 8 ? 8 : m_count <= 16 ? 16 : 32;
+
+            for (i = m_count; i < n; i++)
+            {
+                m_keys[i].depth = 0xFFFFFFFFu;
+                m_keys[i].index = 0;
+            }
+
+            SortNetwork(n);
+        }
+
+        for (c = 0; c < 4; c++)
+            color[c] = 0.0f;
+
+        for (i = 0; i < m_count; i++)
+        {
+            const GLuint * fragment = m_fragments + m_keys[i].index * 4;
+            const float alpha = Unpack(fragment[1], 3);
+
+            for (c = 0; c < 4; c++)
+                color[c] += transmittance * (Unpack(fragment[1], c) * alpha + Unpack(fragment[3], c));
+            transmittance *= 1.0f - alpha;
+        }
+
+        coverage = transmittance * (1.0f - m_tail_transmittance) / std::max(m_tail_alpha, 1e-5f);
+        for (c = 0; c < 4; c++)
+            color[c] += m_tail_color[c] * coverage;
+
+        return m_tail_fragments;
+    }
+
+    static float Unpack(GLuint packed, int component)
+    {
+        return float((packed >> (component * 8)) & 0xFF) / 255.0f;
+    }
+
+private:
+    struct Key
+    {
+        GLuint  depth;
+        GLuint  index;
+    };
+
+    void CompareSwap(unsigned int a, unsigned int b)
+    {
+        if (m_keys[a].depth > m_keys[b].depth)
+            std::swap(m_keys[a], m_keys[b]);
+    }
+
+    // The same bitonic network as the shaders, so ties land the same way
+    void SortNetwork(unsigned int n)
+    {
+        unsigned int i, j, k;
+
+        for (k = 2; k <= n; k <<= 1)
+        {
+            for (j = k >> 1; j > 0; j >>= 1)
+            {
+                for (i = 0; i < n; i++)
+                {
+                    const unsigned int l = i ^ j;
+
+                    if (l > i)
+                    {
+                        if ((i & k) == 0)
+                            CompareSwap(i, l);
+                        else
+                            CompareSwap(l, i);
+                    }
+                }
+            }
+        }
+    }
+
+    void AddToTail(GLuint index)
+    {
+        const GLuint * fragment = m_fragments + index * 4;
+        const float alpha = Unpack(fragment[1], 3);
+
+        for (int c = 0; c < 4; c++)
+            m_tail_color[c] += Unpack(fragment[1], c) * alpha + Unpack(fragment[3], c);
+        m_tail_alpha += alpha;
+        m_tail_transmittance *= 1.0f - alpha;
+        m_tail_fragments++;
+    }
+
+    const GLuint *  m_fragments;
+    Key             m_keys[OIT_RESOLVE_FRONT_K];
+    unsigned int    m_count;
+    unsigned int    m_tail_fragments;
+    float           m_tail_color[4];
+    float           m_tail_alpha;
+    float           m_tail_transmittance;
+};
+
+// Sorts 'indices' farthest first and blends them back to front, as the
+// original resolve shaders did but without a limit on their number
+static void resolve_exact(const GLuint * fragments, std::vector<GLuint>& indices, float * color)
+{
+    std::stable_sort(indices.begin(), indices.end(), [fragments](GLuint a, GLuint b)
+    {
+        return fragments[a * 4 + 2] > fragments[b * 4 + 2];
+    });
+
+    for (int c = 0; c < 4; c++)
+        color[c] = 0.0f;
+
+    for (size_t i = 0; i < indices.size(); i++)
+    {
+        const GLuint * fragment = fragments + indices[i] * 4;
+        const float alpha = OITReferenceResolver::Unpack(fragment[1], 3);
+
+        for (int c = 0; c < 4; c++)
+        {
+            const float modulator = OITReferenceResolver::Unpack(fragment[1], c);
+
+            color[c] = color[c] + (modulator - color[c]) * alpha + OITReferenceResolver::Unpack(fragment[3], c);
+        }
+    }
+}
+
+void OITBuffer::ResolveReference(OITMode mode, const GLuint * heads, const GLuint * fragments,
+                                 unsigned int capacity, GLsizei width, GLsizei height,
+                                 bool exact, float * colors, OITResolveStats * stats)
+{
+    const std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    const unsigned int pixels = (unsigned int)(width * height);
+    const unsigned int k = pixels ? capacity / pixels : 0;
+    std::vector<GLuint> indices;
+    OITResolveStats s;
+    unsigned int p;
+
+    memset(&s, 0, sizeof(s));
+
+    for (p = 0; p < pixels; p++)
+    {
+        float * color = colors + p * 4;
+        unsigned int count = 0;
+
+        indices.clear();
+
+        if (mode == OIT_K_BUFFER)
+        {
+            count = std::min(heads[p], k);
+            for (unsigned int n = 0; n < count; n++)
+                indices.push_back(p * k + n);
+        }
+        else if (mode == OIT_LINKED_LIST)
+        {
+            // Bound the walk in case the capture caught a broken list
+            for (GLuint index = heads[p]; index != 0 && index < capacity && count < capacity; count++)
+            {
+                indices.push_back(index);
+                index = fragments[index * 4];
+            }
+        }
+
+        if (exact)
+        {
+            resolve_exact(fragments, indices, color);
+        }
+        else
+        {
+            OITReferenceResolver resolver(fragments);
+
+            for (size_t i = 0; i < indices.size(); i++)
+                resolver.Add(indices[i]);
+            s.tail_fragments += resolver.Finish(color);
+        }
+
+        if (count)
+            s.pixels++;
+        s.fragments += count;
+        s.max_fragments = std::max(s.max_fragments, count);
+    }
+
+    s.time = std::chrono::duration<float, std::micro>(std::chrono::high_resolution_clock::now() - start).count();
+    s.fragments_per_ms = s.time > 0.0f ? float(s.fragments) * 1000.0f / s.time : 0.0f;
+
+    if (stats)
+        *stats = s;
+}
@@ -0,0 +1,417 @@
+#include "voverdraw.h"
+#include "vsimd.h"
+#include "vutils.h"
+
+#include <string.h>
+
+// Builds the histogram in shared memory, then merges it into the global
+// one with one atomic per non-empty bin. The 64-bit total is kept as two
+// words, carrying by hand.
+static const char reduce_source[] =
+    "#version 430 core\n"
+    "\n"
+    "layout (local_size_x = 16, local_size_y = 16) in;\n"
+    "\n"
+    "layout (binding = 0, r32ui) readonly uniform uimage2D overdraw_image;\n"
+    "\n"
+    "layout (std430, binding = 0) buffer RESULT\n"
+    "{\n"
+    "    uint histogram[256];\n"
+    "    uint max_count;\n"
+    "    uint sum_low;\n"
+    "    uint sum_high;\n"
+    "};\n"
+    "\n"
+    "shared uint local_histogram[256];\n"
+    "shared uint local_max;\n"
+    "shared uint local_sum;\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    uint i = gl_LocalInvocationIndex;\n"
+    "    ivec2 P = ivec2(gl_GlobalInvocationID.xy);\n"
+    "\n"
+    "    local_histogram[i] = 0;\n"
+    "    if (i == 0)\n"
+    "    {\n"
+    "        local_max = 0;\n"
+    "        local_sum = 0;\n"
+    "    }\n"
+    "\n"
+    "    memoryBarrierShared();\n"
+    "    barrier();\n"
+    "\n"
+    "    if (all(lessThan(P, imageSize(overdraw_image))))\n"
+    "    {\n"
+    "        uint count = imageLoad(overdraw_image, P).x;\n"
+    "\n"
+    "        atomicAdd(local_histogram[min(count, 255u)], 1u);\n"
+    "        atomicMax(local_max, count);\n"
+    "        atomicAdd(local_sum, count);\n"
+    "    }\n"
+    "\n"
+    "    memoryBarrierShared();\n"
+    "    barrier();\n"
+    "\n"
+    "    if (local_histogram[i] != 0)\n"
+    "        atomicAdd(histogram[i], local_histogram[i]);\n"
+    "\n"
+    "    if (i == 0)\n"
+    "    {\n"
+    "        uint old = atomicAdd(sum_low, local_sum);\n"
+    "        if (old + local_sum < old)\n"
+    "            atomicAdd(sum_high, 1u);\n"
+    "        atomicMax(max_count, local_max);\n"
+    "    }\n"
+    "}\n";
+
+// Layout of RESULT
+#define RESULT_WORDS    (OVERDRAW_HISTOGRAM_SIZE + 3)
+
+OverdrawCounter::OverdrawCounter(void)
+    : m_width(0),
+      m_height(0),
+      m_image_unit(0),
+      m_cpu_reduction(false),
+      m_counter_texture(0),
+      m_reduce_program(0),
+      m_result_buffer(0),
+      m_frame(0),
+      m_output(NULL)
+{
+    memset(m_readback, 0, sizeof(m_readback));
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+OverdrawCounter::~OverdrawCounter(void)
+{
+    Free();
+}
+
+bool OverdrawCounter::Initialize(GLsizei width, GLsizei height, GLuint image_unit)
+{
+    GLint linked = GL_FALSE;
+    int i;
+
+    Free();
+
+    m_width = width;
+    m_height = height;
+    m_image_unit = image_unit;
+
+    m_reduce_program = glCreateProgram();
+    vglAttachShaderSource(m_reduce_program, GL_COMPUTE_SHADER, reduce_source);
+    glLinkProgram(m_reduce_program);
+    glGetProgramiv(m_reduce_program, GL_LINK_STATUS, &linked);
+
+    if (!linked)
+    {
+        Free();
+        return false;
+    }
+
+    glGenBuffers(1, &m_result_buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_result_buffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, RESULT_WORDS * sizeof(GLuint), NULL, 0);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    for (i = 0; i < READBACK_LATENCY; i++)
+    {
+        glGenBuffers(1, &m_readback[i].buffer);
+    }
+
+    AllocateImage();
+
+    return true;
+}
+
+void OverdrawCounter::Free(void)
+{
+    int i;
+
+    for (i = 0; i < READBACK_LATENCY; i++)
+    {
+        if (m_readback[i].fence)
+            glDeleteSync(m_readback[i].fence);
+        glDeleteBuffers(1, &m_readback[i].buffer);
+    }
+    memset(m_readback, 0, sizeof(m_readback));
+
+    glDeleteTextures(1, &m_counter_texture);
+    glDeleteBuffers(1, &m_result_buffer);
+    glDeleteProgram(m_reduce_program);
+
+    m_counter_texture = 0;
+    m_result_buffer = 0;
+    m_reduce_program = 0;
+}
+
+void OverdrawCounter::Resize(GLsizei width, GLsizei height)
+{
+    m_width = width;
+    m_height = height;
+
+    if (m_reduce_program != 0)
+        AllocateImage();
+}
+
+void OverdrawCounter::AllocateImage(void)
+{
+    glDeleteTextures(1, &m_counter_texture);
+
+    glGenTextures(1, &m_counter_texture);
+    glBindTexture(GL_TEXTURE_2D, m_counter_texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32UI, m_width, m_height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void OverdrawCounter::SetOutput(FILE * file)
+{
+    m_output = file;
+
+    if (m_output != NULL)
+        fprintf(m_output, "frame,pixels,covered,fragments,mean,covered_mean,max,p50,p90,p99\n");
+}
+
+void OverdrawCounter::Begin(void)
+{
+    static const GLuint zero = 0;
+
+    Poll();
+
+    glClearTexImage(m_counter_texture, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    glBindImageTexture(m_image_unit, m_counter_texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+}
+
+void OverdrawCounter::End(void)
+{
+    static const GLuint zero = 0;
+    Readback& readback = m_readback[m_frame % READBACK_LATENCY];
+    const unsigned int frame = m_frame++;
+
+    // The results for this slot from READBACK_LATENCY frames ago haven't
+    // arrived yet. Skip this frame rather than wait for them.
+    if (readback.fence != 0)
+        return;
+
+    readback.frame = frame;
+    readback.pixels = m_width * m_height;
+    readback.cpu = m_cpu_reduction;
+
+    if (m_cpu_reduction)
+    {
+        // Copy the whole image into the pixel pack buffer
+        glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT | GL_PIXEL_BUFFER_BARRIER_BIT);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, readback.pixels * sizeof(GLuint), NULL, GL_STREAM_READ);
+        glBindTexture(GL_TEXTURE_2D, m_counter_texture);
+        glGetTexImage(GL_TEXTURE_2D, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+    else
+    {
+        // Reduce on the GPU and copy back just the histogram
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_result_buffer);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        glUseProgram(m_reduce_program);
+        glBindImageTexture(0, m_counter_texture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32UI);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_result_buffer);
+        glDispatchCompute((m_width + 15) / 16, (m_height + 15) / 16, 1);
+        glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+        glBindBuffer(GL_COPY_READ_BUFFER, m_result_buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, readback.buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, RESULT_WORDS * sizeof(GLuint), NULL, GL_STREAM_READ);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, RESULT_WORDS * sizeof(GLuint));
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+bool OverdrawCounter::Poll(void)
+{
+    bool updated = false;
+    int i;
+
+    // Oldest first, stopping at the first one that isn't ready
+    for (i = 0; i < READBACK_LATENCY; i++)
+    {
+        Readback& readback = m_readback[(m_frame + i) % READBACK_LATENCY];
+
+        if (readback.fence == 0)
+            continue;
+
+        if (glClientWaitSync(readback.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+            break;
+
+        glDeleteSync(readback.fence);
+        readback.fence = 0;
+
+        Finish(readback);
+        updated = true;
+    }
+
+    return updated;
+}
+
+void OverdrawCounter::Finish(const Readback& readback)
+{
+    if (readback.cpu)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        const GLuint * counts = (const GLuint *)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                                                                 readback.pixels * sizeof(GLuint),
+                                                                 GL_MAP_READ_BIT);
+        if (counts != NULL)
+        {
+            Reduce(counts, readback.pixels, m_stats);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+    else
+    {
+        GLuint result[RESULT_WORDS];
+
+        glBindBuffer(GL_COPY_READ_BUFFER, readback.buffer);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(result), result);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+        memcpy(m_stats.histogram, result, sizeof(m_stats.histogram));
+        m_stats.max = result[OVERDRAW_HISTOGRAM_SIZE];
+        m_stats.fragments = (unsigned long long)result[OVERDRAW_HISTOGRAM_SIZE + 2] << 32 |
+                            result[OVERDRAW_HISTOGRAM_SIZE + 1];
+        m_stats.pixels = readback.pixels;
+        Percentiles(m_stats);
+    }
+
+    m_stats.frame = readback.frame;
+
+    if (m_output != NULL)
+    {
+        fprintf(m_output, "%u,%u,%u,%llu,%.4f,%.4f,%u,%u,%u,%u\n",
+                m_stats.frame, m_stats.pixels, m_stats.covered, m_stats.fragments,
+                m_stats.mean, m_stats.covered_mean, m_stats.max,
+                m_stats.p50, m_stats.p90, m_stats.p99);
+    }
+}
+
+void OverdrawCounter::Percentiles(OverdrawStats& stats)
+{
+    const unsigned long long covered = stats.pixels - stats.histogram[0];
+    const unsigned long long p50 = (covered * 50 + 99) / 100;
+    const unsigned long long p90 = (covered * 90 + 99) / 100;
+    const unsigned long long p99 = (covered * 99 + 99) / 100;
+    unsigned long long total = 0;
+    int i;
+
+    stats.covered = (unsigned int)covered;
+    stats.mean = stats.pixels ? float(stats.fragments) / float(stats.pixels) : 0.0f;
+    stats.covered_mean = covered ? float(stats.fragments) / float(covered) : 0.0f;
+    stats.p50 = stats.p90 = stats.p99 = 0;
+
+    if (covered == 0)
+        return;
+
+    // The smallest count that at least p% of covered pixels don't exceed
+    for (i = 1; i < OVERDRAW_HISTOGRAM_SIZE; i++)
+    {
+        const unsigned long long next = total + stats.histogram[i];
+
+        if (total < p50 && next >= p50)
+            stats.p50 = i;
+        if (total < p90 && next >= p90)
+            stats.p90 = i;
+        if (total < p99 && next >= p99)
+            stats.p99 = i;
+
+        total = next;
+    }
+}
+
+void OverdrawCounter::Reduce(const GLuint * counts, unsigned int count, OverdrawStats& stats)
+{
+    // Four interleaved histograms, so that runs of equal counts (which are
+    // the norm in an image) don't serialize on one bin
+    unsigned int histogram[4][OVERDRAW_HISTOGRAM_SIZE];
+    unsigned long long sum = 0;
+    unsigned int max_count = 0;
+    unsigned int i = 0;
+    int j;
+
+    memset(histogram, 0, sizeof(histogram));
+
+#if defined(VMATH_SSE2)
+    // Sum and maximum four at a time. The 32-bit lane sums are flushed
+    // before they can overflow for any count below 2^22.
+    __m128i vmax = _mm_setzero_si128();
+
+    while (i + 4 <= count)
+    {
+        const unsigned int end = (count - i) / 4 > 1024 ? i + 4096 : i + ((count - i) & ~3u);
+        __m128i vsum = _mm_setzero_si128();
+
+        for (; i < end; i += 4)
+        {
+            const __m128i c = _mm_loadu_si128((const __m128i *)(counts + i));
+
+            vsum = _mm_add_epi32(vsum, c);
+#if defined(VMATH_SSE41)
+            vmax = _mm_max_epu32(vmax, c);
+#else
+            // Unsigned compare by flipping the sign bits
+            const __m128i bias = _mm_set1_epi32(0x80000000);
+            const __m128i gt = _mm_cmpgt_epi32(_mm_xor_si128(c, bias), _mm_xor_si128(vmax, bias));
+            vmax = _mm_or_si128(_mm_and_si128(gt, c), _mm_andnot_si128(gt, vmax));
+#endif
+
+            histogram[0][counts[i + 0] < OVERDRAW_HISTOGRAM_SIZE ? counts[i + 0] : OVERDRAW_HISTOGRAM_SIZE - 1]++;
+            histogram[1][counts[i + 1] < OVERDRAW_HISTOGRAM_SIZE ? counts[i + 1] : OVERDRAW_HISTOGRAM_SIZE - 1]++;
+            histogram[2][counts[i + 2] < OVERDRAW_HISTOGRAM_SIZE ? counts[i + 2] : OVERDRAW_HISTOGRAM_SIZE - 1]++;
+            histogram[3][counts[i + 3] < OVERDRAW_HISTOGRAM_SIZE ? counts[i + 3] : OVERDRAW_HISTOGRAM_SIZE - 1]++;
+        }
+
+        VMATH_ALIGN(16) unsigned int lanes[4];
+        _mm_store_si128((__m128i *)lanes, vsum);
+        sum += (unsigned long long)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+
+    VMATH_ALIGN(16) unsigned int lanes[4];
+    _mm_store_si128((__m128i *)lanes, vmax);
+    for (j = 0; j < 4; j++)
+    {
+        if (lanes[j] > max_count)
+            max_count = lanes[j];
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        const unsigned int c = counts[i];
+
+        sum += c;
+        if (c > max_count)
+            max_count = c;
+        histogram[i & 3][c < OVERDRAW_HISTOGRAM_SIZE ? c : OVERDRAW_HISTOGRAM_SIZE - 1]++;
+    }
+
+    for (j = 0; j < OVERDRAW_HISTOGRAM_SIZE; j++)
+    {
+        stats.histogram[j] = histogram[0][j] + histogram[1][j] + histogram[2][j] + histogram[3][j];
+    }
+
+    stats.pixels = count;
+    stats.fragments = sum;
+    stats.max = max_count;
+    Percentiles(stats);
+}
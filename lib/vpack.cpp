@@ -0,0 +1,498 @@
+#include "vpack.h"
+#include "vsimd.h"
+
+namespace vmath
+{
+
+#if defined(VMATH_SSE2)
+// float_to_half for four floats, in the low 16 bits of each lane
+static inline __m128i float_to_half_sse2(__m128 f)
+{
+    const __m128i bits = _mm_castps_si128(f);
+    const __m128i sign = _mm_and_si128(_mm_srli_epi32(bits, 16), _mm_set1_epi32(0x8000));
+    const __m128i magnitude = _mm_and_si128(bits, _mm_set1_epi32(0x7FFFFFFF));
+
+    const __m128i odd = _mm_and_si128(_mm_srli_epi32(magnitude, 13), _mm_set1_epi32(1));
+    const __m128i normal = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(magnitude, _mm_set1_epi32((int)0xC8000FFF)), odd), 13);
+    const __m128i denormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(magnitude), _mm_set1_ps(0.5f))), _mm_set1_epi32(0x3F000000));
+    const __m128i nan = _mm_or_si128(_mm_set1_epi32(0x7E00), _mm_and_si128(_mm_srli_epi32(magnitude, 13), _mm_set1_epi32(0x3FF)));
+
+    // The magnitudes are positive, so signed compares are fine
+    const __m128i is_denormal = _mm_cmplt_epi32(magnitude, _mm_set1_epi32(0x38800000));
+    const __m128i is_large = _mm_cmpgt_epi32(magnitude, _mm_set1_epi32(0x477FFFFF));
+    const __m128i is_nan = _mm_cmpgt_epi32(magnitude, _mm_set1_epi32(0x7F800000));
+
+    __m128i result = _mm_or_si128(_mm_and_si128(is_denormal, denormal), _mm_andnot_si128(is_denormal, normal));
+    const __m128i large = _mm_or_si128(_mm_and_si128(is_nan, nan), _mm_andnot_si128(is_nan, _mm_set1_epi32(0x7C00)));
+
+    result = _mm_or_si128(_mm_and_si128(is_large, large), _mm_andnot_si128(is_large, result));
+
+    return _mm_or_si128(result, sign);
+}
+
+// Packs the low halves of eight lanes, which packs_epi32 would saturate
+// unless they are sign extended first
+static inline __m128i pack_low_halves(__m128i a, __m128i b)
+{
+    return _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16), _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+}
+
+// half_to_float for four halves, in the low 16 bits of each lane
+static inline __m128 half_to_float_sse2(__m128i h)
+{
+    const __m128i sign = _mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(0x8000)), 16);
+    const __m128i exponent = _mm_and_si128(h, _mm_set1_epi32(0x7C00));
+    const __m128i mantissa = _mm_and_si128(h, _mm_set1_epi32(0x3FF));
+    const __m128i shifted = _mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(0x7FFF)), 13);
+
+    const __m128i normal = _mm_add_epi32(shifted, _mm_set1_epi32(0x38000000));
+    const __m128i denormal = _mm_castps_si128(_mm_mul_ps(_mm_cvtepi32_ps(mantissa), _mm_set1_ps(1.0f / 16777216.0f)));
+    const __m128i quiet = _mm_andnot_si128(_mm_cmpeq_epi32(mantissa, _mm_setzero_si128()), _mm_set1_epi32(0x400000));
+    const __m128i special = _mm_or_si128(_mm_or_si128(_mm_set1_epi32(0x7F800000), _mm_slli_epi32(mantissa, 13)), quiet);
+
+    const __m128i is_denormal = _mm_cmpeq_epi32(exponent, _mm_setzero_si128());
+    const __m128i is_special = _mm_cmpeq_epi32(exponent, _mm_set1_epi32(0x7C00));
+
+    __m128i result = _mm_or_si128(_mm_and_si128(is_denormal, denormal), _mm_andnot_si128(is_denormal, normal));
+
+    result = _mm_or_si128(_mm_and_si128(is_special, special), _mm_andnot_si128(is_special, result));
+
+    return _mm_castsi128_ps(_mm_or_si128(result, sign));
+}
+#endif
+
+void float_to_half(unsigned short * out, const float * in, size_t count)
+{
+    size_t i = 0;
+
+#if defined(VMATH_F16C) && defined(VMATH_AVX)
+    for (; count - i >= 8; i += 8)
+        _mm_storeu_si128((__m128i *)(out + i), _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT));
+#elif defined(VMATH_SSE2)
+    for (; count - i >= 8; i += 8)
+    {
+        const __m128i lo = float_to_half_sse2(_mm_loadu_ps(in + i));
+        const __m128i hi = float_to_half_sse2(_mm_loadu_ps(in + i + 4));
+
+        _mm_storeu_si128((__m128i *)(out + i), pack_low_halves(lo, hi));
+    }
+#endif
+
+    for (; i < count; i++)
+        out[i] = float_to_half(in[i]);
+}
+
+void half_to_float(float * out, const unsigned short * in, size_t count)
+{
+    size_t i = 0;
+
+#if defined(VMATH_F16C) && defined(VMATH_AVX)
+    for (; count - i >= 8; i += 8)
+        _mm256_storeu_ps(out + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(in + i))));
+#elif defined(VMATH_SSE2)
+    for (; count - i >= 8; i += 8)
+    {
+        const __m128i h = _mm_loadu_si128((const __m128i *)(in + i));
+
+        _mm_storeu_ps(out + i, half_to_float_sse2(_mm_unpacklo_epi16(h, _mm_setzero_si128())));
+        _mm_storeu_ps(out + i + 4, half_to_float_sse2(_mm_unpackhi_epi16(h, _mm_setzero_si128())));
+    }
+#endif
+
+    for (; i < count; i++)
+        out[i] = half_to_float(in[i]);
+}
+
+// Error accumulation over the values of one call
+class ErrorMeter
+{
+public:
+    ErrorMeter(QuantizeError * error)
+        : m_error(error), m_max(0.0f), m_sum(0.0), m_count(0), m_clamped(0)
+    {
+    }
+
+    ~ErrorMeter(void)
+    {
+        if (m_error == NULL)
+            return;
+
+        m_error->max_error = m_max;
+        m_error->rms_error = m_count != 0 ? float(sqrt(m_sum / double(m_count))) : 0.0f;
+        m_error->clamped = m_clamped;
+    }
+
+    void Add(float error)
+    {
+        m_max = vmath::max(m_max, error);
+        m_sum += double(error) * double(error);
+        m_count++;
+    }
+
+    void Clamp(float f, float lo, float hi)
+    {
+        // NaNs fail both tests and count as clamped too
+        if (!(f >= lo && f <= hi))
+            m_clamped++;
+    }
+
+private:
+    QuantizeError * m_error;
+    float           m_max;
+    double          m_sum;
+    size_t          m_count;
+    size_t          m_clamped;
+};
+
+// Scalar quantization and its error, shared by all the widths. 'T' is the
+// integer type of the result.
+template <typename T, bool is_signed, int bits>
+static void quantize_scalar(T * out, const float * in, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++)
+        out[i] = (T)(is_signed ? quantize_snorm(in[i], bits) : quantize_unorm(in[i], bits));
+}
+
+template <typename T, bool is_signed, int bits>
+static void measure_quantize(const T * out, const float * in, size_t count, QuantizeError * error)
+{
+    ErrorMeter meter(error);
+    size_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        const float decoded = is_signed ? dequantize_snorm(out[i], bits) : dequantize_unorm(out[i], bits);
+
+        meter.Clamp(in[i], is_signed ? -1.0f : 0.0f, 1.0f);
+        meter.Add(fabsf(decoded - in[i]));
+    }
+}
+
+#if defined(VMATH_SSE2)
+// Four clamped, scaled and rounded values. cvtps_epi32 rounds to nearest
+// even in the default rounding mode, as round_to_even does.
+static inline __m128i quantize_sse2(const float * in, __m128 lo, __m128 hi, __m128 scale)
+{
+    return _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in), lo), hi), scale));
+}
+#endif
+
+void quantize_unorm8(unsigned char * out, const float * in, size_t count, QuantizeError * error)
+{
+    size_t i = 0;
+
+#if defined(VMATH_SSE2)
+    const __m128 lo = _mm_setzero_ps(), hi = _mm_set1_ps(1.0f), scale = _mm_set1_ps(255.0f);
+
+    for (; count - i >= 16; i += 16)
+    {
+        const __m128i a = _mm_packs_epi32(quantize_sse2(in + i, lo, hi, scale), quantize_sse2(in + i + 4, lo, hi, scale));
+        const __m128i b = _mm_packs_epi32(quantize_sse2(in + i + 8, lo, hi, scale), quantize_sse2(in + i + 12, lo, hi, scale));
+
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packus_epi16(a, b));
+    }
+#endif
+
+    quantize_scalar<unsigned char, false, 8>(out + i, in + i, count - i);
+
+    if (error != NULL)
+        measure_quantize<unsigned char, false, 8>(out, in, count, error);
+}
+
+void quantize_unorm16(unsigned short * out, const float * in, size_t count, QuantizeError * error)
+{
+    size_t i = 0;
+
+#if defined(VMATH_SSE2)
+    const __m128 lo = _mm_setzero_ps(), hi = _mm_set1_ps(1.0f), scale = _mm_set1_ps(65535.0f);
+
+    for (; count - i >= 8; i += 8)
+        _mm_storeu_si128((__m128i *)(out + i), pack_low_halves(quantize_sse2(in + i, lo, hi, scale), quantize_sse2(in + i + 4, lo, hi, scale)));
+#endif
+
+    quantize_scalar<unsigned short, false, 16>(out + i, in + i, count - i);
+
+    if (error != NULL)
+        measure_quantize<unsigned short, false, 16>(out, in, count, error);
+}
+
+void quantize_snorm8(signed char * out, const float * in, size_t count, QuantizeError * error)
+{
+    size_t i = 0;
+
+#if defined(VMATH_SSE2)
+    const __m128 lo = _mm_set1_ps(-1.0f), hi = _mm_set1_ps(1.0f), scale = _mm_set1_ps(127.0f);
+
+    for (; count - i >= 16; i += 16)
+    {
+        const __m128i a = _mm_packs_epi32(quantize_sse2(in + i, lo, hi, scale), quantize_sse2(in + i + 4, lo, hi, scale));
+        const __m128i b = _mm_packs_epi32(quantize_sse2(in + i + 8, lo, hi, scale), quantize_sse2(in + i + 12, lo, hi, scale));
+
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi16(a, b));
+    }
+#endif
+
+    quantize_scalar<signed char, true, 8>(out + i, in + i, count - i);
+
+    if (error != NULL)
+        measure_quantize<signed char, true, 8>(out, in, count, error);
+}
+
+void quantize_snorm16(short * out, const float * in, size_t count, QuantizeError * error)
+{
+    size_t i = 0;
+
+#if defined(VMATH_SSE2)
+    const __m128 lo = _mm_set1_ps(-1.0f), hi = _mm_set1_ps(1.0f), scale = _mm_set1_ps(32767.0f);
+
+    for (; count - i >= 8; i += 8)
+        _mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(quantize_sse2(in + i, lo, hi, scale), quantize_sse2(in + i + 4, lo, hi, scale)));
+#endif
+
+    quantize_scalar<short, true, 16>(out + i, in + i, count - i);
+
+    if (error != NULL)
+        measure_quantize<short, true, 16>(out, in, count, error);
+}
+
+void dequantize_unorm8(float * out, const unsigned char * in, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++)
+        out[i] = dequantize_unorm(in[i], 8);
+}
+
+void dequantize_unorm16(float * out, const unsigned short * in, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++)
+        out[i] = dequantize_unorm(in[i], 16);
+}
+
+void dequantize_snorm8(float * out, const signed char * in, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++)
+        out[i] = dequantize_snorm(in[i], 8);
+}
+
+void dequantize_snorm16(float * out, const short * in, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++)
+        out[i] = dequantize_snorm(in[i], 16);
+}
+
+static void clamp_vector(ErrorMeter& meter, const float * v, int components)
+{
+    int j;
+
+    for (j = 0; j < components; j++)
+        meter.Clamp(v[j], -1.0f, 1.0f);
+}
+
+#if defined(VMATH_SSE2)
+// The vector packs work on four vectors at a time, with their x, y and z
+// in separate registers. Each step is the scalar one, in the same order,
+// so the results are the same bits. max(a, b) is written max_ps(b, a)
+// where vmath::max's a >= b ? a : b differs on zeros of either sign.
+static inline void load_vec3x4(const vec3 * in, __m128& x, __m128& y, __m128& z)
+{
+    const __m128 a = _mm_loadu_ps(&in[0][0]);       // x0 y0 z0 x1
+    const __m128 b = _mm_loadu_ps(&in[1][1]);       // y1 z1 x2 y2
+    const __m128 c = _mm_loadu_ps(&in[2][2]);       // z2 x3 y3 z3
+    const __m128 xy_lo = _mm_shuffle_ps(a, _mm_shuffle_ps(a, b, _MM_SHUFFLE(0, 0, 3, 3)), _MM_SHUFFLE(2, 0, 1, 0));
+    const __m128 xy_hi = _mm_shuffle_ps(b, c, _MM_SHUFFLE(2, 1, 3, 2));
+
+    x = _mm_shuffle_ps(xy_lo, xy_hi, _MM_SHUFFLE(2, 0, 2, 0));
+    y = _mm_shuffle_ps(xy_lo, xy_hi, _MM_SHUFFLE(3, 1, 3, 1));
+    z = _mm_shuffle_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(1, 1, 2, 2)), _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 0, 0)), _MM_SHUFFLE(2, 0, 2, 0));
+}
+
+static inline void store_vec3x4(vec3 * out, __m128 x, __m128 y, __m128 z)
+{
+    const __m128 xy_lo = _mm_unpacklo_ps(x, y);     // x0 y0 x1 y1
+    const __m128 xy_hi = _mm_unpackhi_ps(x, y);     // x2 y2 x3 y3
+
+    _mm_storeu_ps(&out[0][0], _mm_shuffle_ps(xy_lo, _mm_shuffle_ps(z, xy_lo, _MM_SHUFFLE(2, 2, 0, 0)), _MM_SHUFFLE(2, 0, 1, 0)));
+    _mm_storeu_ps(&out[1][1], _mm_shuffle_ps(_mm_shuffle_ps(xy_lo, z, _MM_SHUFFLE(1, 1, 3, 3)), xy_hi, _MM_SHUFFLE(1, 0, 2, 0)));
+    _mm_storeu_ps(&out[2][2], _mm_shuffle_ps(_mm_shuffle_ps(z, xy_hi, _MM_SHUFFLE(2, 2, 2, 2)), _mm_shuffle_ps(xy_hi, z, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(2, 0, 2, 0)));
+}
+
+static inline __m128 abs_ps(__m128 f)
+{
+    return _mm_andnot_ps(_mm_set1_ps(-0.0f), f);
+}
+
+static inline __m128 copysign_ps(__m128 magnitude, __m128 sign)
+{
+    return _mm_or_ps(_mm_andnot_ps(_mm_set1_ps(-0.0f), magnitude), _mm_and_ps(_mm_set1_ps(-0.0f), sign));
+}
+
+static inline __m128 select_ps(__m128 mask, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+static inline __m128i quantize_snorm_sse2(__m128 f, float scale)
+{
+    return _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(f, _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f)), _mm_set1_ps(scale)));
+}
+
+static inline __m128 dequantize_snorm_sse2(__m128i q, float scale)
+{
+    return _mm_max_ps(_mm_set1_ps(-1.0f), _mm_div_ps(_mm_cvtepi32_ps(q), _mm_set1_ps(scale)));
+}
+
+static inline __m128i pack_snorm_2_10_10_10_sse2(__m128 x, __m128 y, __m128 z, __m128 w)
+{
+    const __m128i mask = _mm_set1_epi32(0x3FF);
+    const __m128i qx = _mm_and_si128(quantize_snorm_sse2(x, 511.0f), mask);
+    const __m128i qy = _mm_slli_epi32(_mm_and_si128(quantize_snorm_sse2(y, 511.0f), mask), 10);
+    const __m128i qz = _mm_slli_epi32(_mm_and_si128(quantize_snorm_sse2(z, 511.0f), mask), 20);
+    const __m128i qw = _mm_slli_epi32(quantize_snorm_sse2(w, 1.0f), 30);
+
+    return _mm_or_si128(_mm_or_si128(qx, qy), _mm_or_si128(qz, qw));
+}
+#endif
+
+void pack_snorm_2_10_10_10(unsigned int * out, const vec3 * in, size_t count, QuantizeError * error)
+{
+    size_t i = 0;
+
+#if defined(VMATH_SSE2)
+    for (; count - i >= 4; i += 4)
+    {
+        __m128 x, y, z;
+
+        load_vec3x4(in + i, x, y, z);
+        _mm_storeu_si128((__m128i *)(out + i), pack_snorm_2_10_10_10_sse2(x, y, z, _mm_setzero_ps()));
+    }
+#endif
+
+    for (; i < count; i++)
+        out[i] = pack_snorm_2_10_10_10(vec4(in[i], 0.0f));
+
+    if (error != NULL)
+    {
+        ErrorMeter meter(error);
+
+        for (i = 0; i < count; i++)
+        {
+            const vec4 decoded = unpack_snorm_2_10_10_10(out[i]);
+
+            clamp_vector(meter, in[i], 3);
+            meter.Add(length(vec3(decoded[0], decoded[1], decoded[2]) - in[i]));
+        }
+    }
+}
+
+void pack_snorm_2_10_10_10(unsigned int * out, const vec4 * in, size_t count, QuantizeError * error)
+{
+    size_t i = 0;
+
+#if defined(VMATH_SSE2)
+    for (; count - i >= 4; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(&in[i][0]);
+        __m128 y = _mm_loadu_ps(&in[i + 1][0]);
+        __m128 z = _mm_loadu_ps(&in[i + 2][0]);
+        __m128 w = _mm_loadu_ps(&in[i + 3][0]);
+
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+        _mm_storeu_si128((__m128i *)(out + i), pack_snorm_2_10_10_10_sse2(x, y, z, w));
+    }
+#endif
+
+    for (; i < count; i++)
+        out[i] = pack_snorm_2_10_10_10(in[i]);
+
+    if (error != NULL)
+    {
+        ErrorMeter meter(error);
+
+        for (i = 0; i < count; i++)
+        {
+            clamp_vector(meter, in[i], 4);
+            meter.Add(length(unpack_snorm_2_10_10_10(out[i]) - in[i]));
+        }
+    }
+}
+
+void unpack_snorm_2_10_10_10(vec4 * out, const unsigned int * in, size_t count)
+{
+    size_t i;
+
+    for (i = 0; i < count; i++)
+        out[i] = unpack_snorm_2_10_10_10(in[i]);
+}
+
+void pack_octahedral(unsigned int * out, const vec3 * in, size_t count, QuantizeError * error)
+{
+    size_t i = 0;
+
+#if defined(VMATH_SSE2)
+    for (; count - i >= 4; i += 4)
+    {
+        __m128 x, y, z;
+
+        load_vec3x4(in + i, x, y, z);
+
+        const __m128 l1 = _mm_add_ps(_mm_add_ps(abs_ps(x), abs_ps(y)), abs_ps(z));
+        const __m128 scale = _mm_and_ps(_mm_cmpgt_ps(l1, _mm_setzero_ps()), _mm_div_ps(_mm_set1_ps(1.0f), l1));
+        const __m128 u = _mm_mul_ps(x, scale);
+        const __m128 v = _mm_mul_ps(y, scale);
+        const __m128 fold_u = copysign_ps(_mm_sub_ps(_mm_set1_ps(1.0f), abs_ps(v)), u);
+        const __m128 fold_v = copysign_ps(_mm_sub_ps(_mm_set1_ps(1.0f), abs_ps(u)), v);
+        const __m128 lower = _mm_cmplt_ps(z, _mm_setzero_ps());
+        const __m128i qu = quantize_snorm_sse2(select_ps(lower, fold_u, u), 32767.0f);
+        const __m128i qv = quantize_snorm_sse2(select_ps(lower, fold_v, v), 32767.0f);
+
+        _mm_storeu_si128((__m128i *)(out + i), _mm_or_si128(_mm_and_si128(qu, _mm_set1_epi32(0xFFFF)), _mm_slli_epi32(qv, 16)));
+    }
+#endif
+
+    for (; i < count; i++)
+        out[i] = pack_octahedral(in[i]);
+
+    // Against the normalized input, which is all the packing keeps
+    if (error != NULL)
+    {
+        ErrorMeter meter(error);
+
+        for (i = 0; i < count; i++)
+            meter.Add(length(unpack_octahedral(out[i]) - normalize(in[i])));
+    }
+}
+
+void unpack_octahedral(vec3 * out, const unsigned int * in, size_t count)
+{
+    size_t i = 0;
+
+#if defined(VMATH_SSE2)
+    for (; count - i >= 4; i += 4)
+    {
+        const __m128i p = _mm_loadu_si128((const __m128i *)(in + i));
+        const __m128 u = dequantize_snorm_sse2(_mm_srai_epi32(_mm_slli_epi32(p, 16), 16), 32767.0f);
+        const __m128 v = dequantize_snorm_sse2(_mm_srai_epi32(p, 16), 32767.0f);
+        const __m128 z = _mm_sub_ps(_mm_sub_ps(_mm_set1_ps(1.0f), abs_ps(u)), abs_ps(v));
+        const __m128 t = _mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(_mm_setzero_ps(), z));
+        const __m128 x = _mm_sub_ps(u, copysign_ps(t, u));
+        const __m128 y = _mm_sub_ps(v, copysign_ps(t, v));
+        const __m128 l = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+
+        store_vec3x4(out + i, _mm_div_ps(x, l), _mm_div_ps(y, l), _mm_div_ps(z, l));
+    }
+#endif
+
+    for (; i < count; i++)
+        out[i] = unpack_octahedral(in[i]);
+}
+
+};
@@ -0,0 +1,593 @@
+#include "vprimitives.h"
+#include "vutils.h"
+
+#include <string>
+#include <string.h>
+
+// Scan and compaction. Each workgroup takes the next tile, scans it in
+// shared memory, then its first invocation publishes the tile's sum and
+// looks back over its predecessors for the prefix. A status word per tile
+// says whether its sum (1) or its inclusive prefix (2) is ready; values
+// are written before their status and read after it.
+static const char scan_source[] =
+    "layout (local_size_x = 256) in;\n"
+    "\n"
+    "#define ITEMS              4\n"
+    "#define TILE_SIZE          1024u\n"
+    "#define STATUS_AGGREGATE   1u\n"
+    "#define STATUS_PREFIX      2u\n"
+    "\n"
+    "layout (std430, binding = 0) readonly buffer INPUT\n"
+    "{\n"
+    "    uint input_data[];\n"
+    "};\n"
+    "\n"
+    "layout (std430, binding = 1) readonly buffer FLAGS\n"
+    "{\n"
+    "    uint flags[];\n"
+    "};\n"
+    "\n"
+    "layout (std430, binding = 2) writeonly buffer OUTPUT\n"
+    "{\n"
+    "    uint output_data[];\n"
+    "};\n"
+    "\n"
+    "layout (std430, binding = 3) coherent buffer TILE_STATE\n"
+    "{\n"
+    "    uint tile_counter;\n"
+    "    uint tile_state[];\n"
+    "};\n"
+    "\n"
+    "layout (std430, binding = 4) writeonly buffer TOTAL\n"
+    "{\n"
+    "    uint total[];\n"
+    "};\n"
+    "\n"
+    "uniform uint count;\n"
+    "uniform uint total_index;\n"
+    "uniform uint element_words;\n"
+    "uniform bool write_total;\n"
+    "\n"
+    "shared uint tile_index;\n"
+    "shared uint tile_prefix;\n"
+    "shared uint partial[256];\n"
+    "\n"
+    "void publish(uint tile, uint status, uint value)\n"
+    "{\n"
+    "    tile_state[tile * 3u + status] = value;\n"
+    "    memoryBarrierBuffer();\n"
+    "    atomicExchange(tile_state[tile * 3u], status);\n"
+    "}\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    uint t = gl_LocalInvocationIndex;\n"
+    "    uint v[ITEMS];\n"
+    "    uint sum = 0u;\n"
+    "    int i;\n"
+    "\n"
+    // Tiles are numbered in the order the workgroups start, so every
+    // predecessor is already running when a tile looks back
+    "    if (t == 0u)\n"
+    "        tile_index = atomicAdd(tile_counter, 1u);\n"
+    "    barrier();\n"
+    "\n"
+    "    uint tile = tile_index;\n"
+    "    uint first = tile * TILE_SIZE + t * uint(ITEMS);\n"
+    "\n"
+    "    for (i = 0; i < ITEMS; i++)\n"
+    "    {\n"
+    "        uint j = first + uint(i);\n"
+    "\n"
+    "        v[i] = 0u;\n"
+    "        if (j < count)\n"
+    "        {\n"
+    "#if COMPACT\n"
+    "            v[i] = flags[j] != 0u ? 1u : 0u;\n"
+    "#else\n"
+    "            v[i] = input_data[j];\n"
+    "#endif\n"
+    "        }\n"
+    "        sum += v[i];\n"
+    "    }\n"
+    "\n"
+    "    partial[t] = sum;\n"
+    "    barrier();\n"
+    "\n"
+    "    for (uint offset = 1u; offset < 256u; offset <<= 1)\n"
+    "    {\n"
+    "        uint p = t >= offset ? partial[t - offset] : 0u;\n"
+    "        barrier();\n"
+    "        partial[t] += p;\n"
+    "        barrier();\n"
+    "    }\n"
+    "\n"
+    "    if (t == 0u)\n"
+    "    {\n"
+    "        uint aggregate = partial[255];\n"
+    "        uint prefix = 0u;\n"
+    "\n"
+    "        if (tile == 0u)\n"
+    "        {\n"
+    "            publish(tile, STATUS_PREFIX, aggregate);\n"
+    "        }\n"
+    "        else\n"
+    "        {\n"
+    "            publish(tile, STATUS_AGGREGATE, aggregate);\n"
+    "\n"
+    "            int look = int(tile) - 1;\n"
+    "\n"
+    "            while (look >= 0)\n"
+    "            {\n"
+    "                uint status = atomicOr(tile_state[uint(look) * 3u], 0u);\n"
+    "\n"
+    "                if (status == 0u)\n"
+    "                    continue;\n"
+    "\n"
+    "                memoryBarrierBuffer();\n"
+    "                prefix += atomicOr(tile_state[uint(look) * 3u + status], 0u);\n"
+    "\n"
+    "                if (status == STATUS_PREFIX)\n"
+    "                    break;\n"
+    "\n"
+    "                look--;\n"
+    "            }\n"
+    "\n"
+    "            publish(tile, STATUS_PREFIX, prefix + aggregate);\n"
+    "        }\n"
+    "\n"
+    "        tile_prefix = prefix;\n"
+    "    }\n"
+    "    barrier();\n"
+    "\n"
+    "    uint running = tile_prefix + partial[t] - sum;\n"
+    "\n"
+    "    for (i = 0; i < ITEMS; i++)\n"
+    "    {\n"
+    "        uint j = first + uint(i);\n"
+    "\n"
+    "        if (j < count)\n"
+    "        {\n"
+    "#if COMPACT\n"
+    "            if (v[i] != 0u)\n"
+    "            {\n"
+    "                for (uint w = 0u; w < element_words; w++)\n"
+    "                    output_data[running * element_words + w] = input_data[j * element_words + w];\n"
+    "            }\n"
+    "#else\n"
+    "            output_data[j] = running;\n"
+    "#endif\n"
+    "        }\n"
+    "        running += v[i];\n"
+    "    }\n"
+    "\n"
+    "    if (write_total && t == 255u && tile == gl_NumWorkGroups.x - 1u)\n"
+    "        total[total_index] = running;\n"
+    "}\n";
+
+// One workgroup per segment. Invocation t adds elements t, t + 256, ...
+// in order, then the partial sums are added in a tree.
+static const char reduce_source[] =
+    "layout (local_size_x = 256) in;\n"
+    "\n"
+    "layout (std430, binding = 0) readonly buffer VALUES\n"
+    "{\n"
+    "    TYPE values[];\n"
+    "};\n"
+    "\n"
+    "layout (std430, binding = 1) readonly buffer OFFSETS\n"
+    "{\n"
+    "    uint offsets[];\n"
+    "};\n"
+    "\n"
+    "layout (std430, binding = 2) writeonly buffer SUMS\n"
+    "{\n"
+    "    TYPE sums[];\n"
+    "};\n"
+    "\n"
+    "uniform uint first_segment;\n"
+    "\n"
+    "shared TYPE partial[256];\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    uint t = gl_LocalInvocationIndex;\n"
+    "    uint segment = first_segment + gl_WorkGroupID.x;\n"
+    "    uint end = offsets[segment + 1u];\n"
+    "    precise TYPE sum = TYPE(0);\n"
+    "\n"
+    "    for (uint i = offsets[segment] + t; i < end; i += 256u)\n"
+    "        sum += values[i];\n"
+    "\n"
+    "    partial[t] = sum;\n"
+    "    barrier();\n"
+    "\n"
+    "    for (uint offset = 128u; offset > 0u; offset >>= 1)\n"
+    "    {\n"
+    "        if (t < offset)\n"
+    "        {\n"
+    "            precise TYPE s = partial[t] + partial[t + offset];\n"
+    "            partial[t] = s;\n"
+    "        }\n"
+    "        barrier();\n"
+    "    }\n"
+    "\n"
+    "    if (t == 0u)\n"
+    "        sums[segment] = partial[0];\n"
+    "}\n";
+
+static const char histogram_source[] =
+    "layout (local_size_x = 256) in;\n"
+    "\n"
+    "#define SHARED_BINS 4096u\n"
+    "\n"
+    "layout (std430, binding = 0) readonly buffer VALUES\n"
+    "{\n"
+    "    uint values[];\n"
+    "};\n"
+    "\n"
+    "layout (std430, binding = 1) buffer BINS\n"
+    "{\n"
+    "    uint bins[];\n"
+    "};\n"
+    "\n"
+    "uniform uint count;\n"
+    "uniform uint bin_count;\n"
+    "uniform uint shift;\n"
+    "\n"
+    "shared uint local_bins[SHARED_BINS];\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    uint t = gl_LocalInvocationIndex;\n"
+    "    bool use_shared = bin_count <= SHARED_BINS;\n"
+    "    uint i;\n"
+    "\n"
+    "    for (i = t; i < SHARED_BINS; i += 256u)\n"
+    "        local_bins[i] = 0u;\n"
+    "    barrier();\n"
+    "\n"
+    "    for (i = gl_GlobalInvocationID.x; i < count; i += gl_NumWorkGroups.x * 256u)\n"
+    "    {\n"
+    "        uint bin = values[i] >> shift;\n"
+    "\n"
+    "        if (bin < bin_count)\n"
+    "        {\n"
+    "            if (use_shared)\n"
+    "                atomicAdd(local_bins[bin], 1u);\n"
+    "            else\n"
+    "                atomicAdd(bins[bin], 1u);\n"
+    "        }\n"
+    "    }\n"
+    "    barrier();\n"
+    "\n"
+    "    if (use_shared)\n"
+    "    {\n"
+    "        for (i = t; i < bin_count; i += 256u)\n"
+    "        {\n"
+    "            if (local_bins[i] != 0u)\n"
+    "                atomicAdd(bins[i], local_bins[i]);\n"
+    "        }\n"
+    "    }\n"
+    "}\n";
+
+static GLuint build_program(const char * header, const char * source)
+{
+    const std::string text = std::string("#version 430 core\n\n") + header + source;
+    GLint linked = GL_FALSE;
+    GLuint program = glCreateProgram();
+
+    vglAttachShaderSource(program, GL_COMPUTE_SHADER, text.c_str());
+    glLinkProgram(program);
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+
+    if (!linked)
+    {
+        glDeleteProgram(program);
+        return 0;
+    }
+
+    return program;
+}
+
+GPUPrimitives::GPUPrimitives(void)
+    : m_tile_state_buffer(0),
+      m_max_elements(0)
+{
+    memset(m_programs, 0, sizeof(m_programs));
+    memset(m_scan_uniforms, 0, sizeof(m_scan_uniforms));
+    memset(m_reduce_uniforms, 0, sizeof(m_reduce_uniforms));
+    memset(&m_histogram_uniforms, 0, sizeof(m_histogram_uniforms));
+}
+
+GPUPrimitives::~GPUPrimitives(void)
+{
+    Free();
+}
+
+bool GPUPrimitives::Initialize(unsigned int max_elements)
+{
+    int i;
+
+    Free();
+
+    m_programs[PROGRAM_SCAN] = build_program("#define COMPACT 0\n\n", scan_source);
+    m_programs[PROGRAM_COMPACT] = build_program("#define COMPACT 1\n\n", scan_source);
+    m_programs[PROGRAM_REDUCE_UINT] = build_program("#define TYPE uint\n\n", reduce_source);
+    m_programs[PROGRAM_REDUCE_FLOAT] = build_program("#define TYPE float\n\n", reduce_source);
+    m_programs[PROGRAM_HISTOGRAM] = build_program("", histogram_source);
+
+    for (i = 0; i < PROGRAM_TOTAL; i++)
+    {
+        if (m_programs[i] == 0)
+        {
+            Free();
+            return false;
+        }
+    }
+
+    for (i = 0; i < 2; i++)
+    {
+        const GLuint program = m_programs[PROGRAM_SCAN + i];
+
+        m_scan_uniforms[i].count = glGetUniformLocation(program, "count");
+        m_scan_uniforms[i].total_index = glGetUniformLocation(program, "total_index");
+        m_scan_uniforms[i].element_words = glGetUniformLocation(program, "element_words");
+        m_scan_uniforms[i].write_total = glGetUniformLocation(program, "write_total");
+
+        m_reduce_uniforms[i].first_segment = glGetUniformLocation(m_programs[PROGRAM_REDUCE_UINT + i], "first_segment");
+    }
+
+    m_histogram_uniforms.count = glGetUniformLocation(m_programs[PROGRAM_HISTOGRAM], "count");
+    m_histogram_uniforms.bin_count = glGetUniformLocation(m_programs[PROGRAM_HISTOGRAM], "bin_count");
+    m_histogram_uniforms.shift = glGetUniformLocation(m_programs[PROGRAM_HISTOGRAM], "shift");
+
+    // A tile per workgroup, and a single dispatch
+    if (max_elements > MAX_GROUPS * TILE_SIZE)
+        max_elements = MAX_GROUPS * TILE_SIZE;
+
+    m_max_elements = max_elements;
+
+    const unsigned int tiles = (max_elements + TILE_SIZE - 1) / TILE_SIZE;
+
+    glGenBuffers(1, &m_tile_state_buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_tile_state_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, (1 + 3 * tiles) * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    return true;
+}
+
+void GPUPrimitives::Free(void)
+{
+    int i;
+
+    for (i = 0; i < PROGRAM_TOTAL; i++)
+        glDeleteProgram(m_programs[i]);
+    memset(m_programs, 0, sizeof(m_programs));
+
+    glDeleteBuffers(1, &m_tile_state_buffer);
+    m_tile_state_buffer = 0;
+    m_max_elements = 0;
+}
+
+void GPUPrimitives::BeginScan(unsigned int count)
+{
+    static const GLuint zero = 0;
+    const unsigned int tiles = (count + TILE_SIZE - 1) / TILE_SIZE;
+
+    // Reset the tile counter and every tile's status
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_tile_state_buffer);
+    glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, (1 + 3 * tiles) * sizeof(GLuint),
+                         GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_tile_state_buffer);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void GPUPrimitives::ExclusiveScan(GLuint input, GLuint output, unsigned int count,
+                                  GLuint total, unsigned int total_index)
+{
+    if (count > m_max_elements)
+        count = m_max_elements;
+    if (count == 0)
+        return;
+
+    BeginScan(count);
+
+    glUseProgram(m_programs[PROGRAM_SCAN]);
+    glUniform1ui(m_scan_uniforms[0].count, count);
+    glUniform1ui(m_scan_uniforms[0].total_index, total_index);
+    glUniform1ui(m_scan_uniforms[0].element_words, 1);
+    glUniform1i(m_scan_uniforms[0].write_total, total != 0);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, input);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, output);
+    if (total)
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, total);
+
+    glDispatchCompute((count + TILE_SIZE - 1) / TILE_SIZE, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void GPUPrimitives::Compact(GLuint input, GLuint flags, GLuint output, unsigned int count,
+                            GLuint total, unsigned int total_index, unsigned int element_words)
+{
+    if (count > m_max_elements)
+        count = m_max_elements;
+    if (count == 0)
+        return;
+
+    BeginScan(count);
+
+    glUseProgram(m_programs[PROGRAM_COMPACT]);
+    glUniform1ui(m_scan_uniforms[1].count, count);
+    glUniform1ui(m_scan_uniforms[1].total_index, total_index);
+    glUniform1ui(m_scan_uniforms[1].element_words, element_words);
+    glUniform1i(m_scan_uniforms[1].write_total, total != 0);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, input);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, flags);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, output);
+    if (total)
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, total);
+
+    glDispatchCompute((count + TILE_SIZE - 1) / TILE_SIZE, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void GPUPrimitives::SegmentedReduce(GLuint values, GLuint offsets, unsigned int segment_count,
+                                    GLuint sums, PrimitiveType type)
+{
+    const int variant = type == PRIMITIVE_FLOAT ? 1 : 0;
+    unsigned int first;
+
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    glUseProgram(m_programs[PROGRAM_REDUCE_UINT + variant]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, values);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, offsets);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, sums);
+
+    // A workgroup per segment, in as many dispatches as that takes
+    for (first = 0; first < segment_count; first += MAX_GROUPS)
+    {
+        const unsigned int groups = segment_count - first < MAX_GROUPS ? segment_count - first : (unsigned int)MAX_GROUPS;
+
+        glUniform1ui(m_reduce_uniforms[variant].first_segment, first);
+        glDispatchCompute(groups, 1, 1);
+    }
+
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void GPUPrimitives::Histogram(GLuint values, unsigned int count, GLuint bins, unsigned int bin_count,
+                              unsigned int shift, bool accumulate)
+{
+    static const GLuint zero = 0;
+
+    if (!accumulate)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, bins);
+        glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, 0, bin_count * sizeof(GLuint),
+                             GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    if (count == 0)
+        return;
+
+    // Enough workgroups to fill the GPU, but few enough that merging their
+    // shared bins into the buffer stays cheap
+    unsigned int groups = (count + 64 * GROUP_SIZE - 1) / (64 * GROUP_SIZE);
+
+    if (groups > 512)
+        groups = 512;
+
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    glUseProgram(m_programs[PROGRAM_HISTOGRAM]);
+    glUniform1ui(m_histogram_uniforms.count, count);
+    glUniform1ui(m_histogram_uniforms.bin_count, bin_count);
+    glUniform1ui(m_histogram_uniforms.shift, shift);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, values);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, bins);
+    glDispatchCompute(groups, 1, 1);
+
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+unsigned int GPUPrimitives::ExclusiveScanReference(const GLuint * input, GLuint * output, unsigned int count)
+{
+    GLuint running = 0;
+    unsigned int i;
+
+    for (i = 0; i < count; i++)
+    {
+        const GLuint v = input[i];
+
+        output[i] = running;
+        running += v;
+    }
+
+    return running;
+}
+
+unsigned int GPUPrimitives::CompactReference(const GLuint * input, const GLuint * flags, GLuint * output,
+                                             unsigned int count, unsigned int element_words)
+{
+    unsigned int kept = 0;
+    unsigned int i;
+
+    for (i = 0; i < count; i++)
+    {
+        if (flags[i] != 0)
+        {
+            memcpy(output + kept * element_words, input + i * element_words, element_words * sizeof(GLuint));
+            kept++;
+        }
+    }
+
+    return kept;
+}
+
+// The shader's order of additions: strided partial sums, then a tree
+template <typename T>
+static void segmented_reduce(const T * values, const GLuint * offsets, unsigned int segment_count, T * sums)
+{
+    T partial[GPUPrimitives::GROUP_SIZE];
+    unsigned int segment, t, offset;
+
+    for (segment = 0; segment < segment_count; segment++)
+    {
+        const GLuint end = offsets[segment + 1];
+
+        for (t = 0; t < GPUPrimitives::GROUP_SIZE; t++)
+        {
+            T sum = T(0);
+
+            for (GLuint i = offsets[segment] + t; i < end; i += GPUPrimitives::GROUP_SIZE)
+                sum = sum + values[i];
+
+            partial[t] = sum;
+        }
+
+        for (offset = GPUPrimitives::GROUP_SIZE / 2; offset > 0; offset >>= 1)
+        {
+            for (t = 0; t < offset; t++)
+                partial[t] = partial[t] + partial[t + offset];
+        }
+
+        sums[segment] = partial[0];
+    }
+}
+
+void GPUPrimitives::SegmentedReduceReference(const GLuint * values, const GLuint * offsets,
+                                             unsigned int segment_count, GLuint * sums)
+{
+    segmented_reduce(values, offsets, segment_count, sums);
+}
+
+void GPUPrimitives::SegmentedReduceReference(const float * values, const GLuint * offsets,
+                                             unsigned int segment_count, float * sums)
+{
+    segmented_reduce(values, offsets, segment_count, sums);
+}
+
+void GPUPrimitives::HistogramReference(const GLuint * values, unsigned int count, GLuint * bins,
+                                       unsigned int bin_count, unsigned int shift, bool accumulate)
+{
+    unsigned int i;
+
+    if (!accumulate)
+        memset(bins, 0, bin_count * sizeof(GLuint));
+
+    for (i = 0; i < count; i++)
+    {
+        const GLuint bin = values[i] >> shift;
+
+        if (bin < bin_count)
+            bins[bin]++;
+    }
+}
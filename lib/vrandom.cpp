@@ -0,0 +1,229 @@
+#include "vrandom.h"
+#include "vsimd.h"
+
+#include <string.h>
+
+namespace vmath
+{
+
+// Bits are generated this many at a time for the distributions that need
+// pairs of them
+#define RANDOM_CHUNK    1024
+
+#if defined(VMATH_SSE2)
+// The high and low halves of a * m in each lane. SSE2 only multiplies the
+// even lanes, so the odd lanes are shifted down and done separately.
+static inline void mulhilo(__m128i a, __m128i m, __m128i& hi, __m128i& lo)
+{
+    const __m128i even = _mm_mul_epu32(a, m);
+    const __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), m);
+
+    lo = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(3, 1, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(3, 1, 2, 0)));
+    hi = _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(2, 0, 3, 1)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(2, 0, 3, 1)));
+}
+
+// Philox4x32-10 for the four blocks from 'block', written out in order
+static void philox4x32_x4(unsigned int * out, unsigned int block, unsigned int key)
+{
+    const __m128i m0 = _mm_set1_epi32((int)0xD2511F53);
+    const __m128i m1 = _mm_set1_epi32((int)0xCD9E8D57);
+    __m128i c0 = _mm_add_epi32(_mm_set1_epi32((int)block), _mm_setr_epi32(0, 1, 2, 3));
+    __m128i c1 = _mm_setzero_si128();
+    __m128i c2 = _mm_setzero_si128();
+    __m128i c3 = _mm_setzero_si128();
+    unsigned int key0 = key, key1 = 0;
+    int i;
+
+    for (i = 0; i < 10; i++)
+    {
+        __m128i hi0, lo0, hi1, lo1;
+
+        mulhilo(c0, m0, hi0, lo0);
+        mulhilo(c2, m1, hi1, lo1);
+
+        c0 = _mm_xor_si128(_mm_xor_si128(hi1, c1), _mm_set1_epi32((int)key0));
+        c2 = _mm_xor_si128(_mm_xor_si128(hi0, c3), _mm_set1_epi32((int)key1));
+        c1 = lo1;
+        c3 = lo0;
+
+        key0 += 0x9E3779B9u;
+        key1 += 0xBB67AE85u;
+    }
+
+    // Lane n of c0 to c3 is block n; transpose so each block is contiguous
+    const __m128i t0 = _mm_unpacklo_epi32(c0, c1);
+    const __m128i t1 = _mm_unpacklo_epi32(c2, c3);
+    const __m128i t2 = _mm_unpackhi_epi32(c0, c1);
+    const __m128i t3 = _mm_unpackhi_epi32(c2, c3);
+
+    _mm_storeu_si128((__m128i *)(out + 0), _mm_unpacklo_epi64(t0, t1));
+    _mm_storeu_si128((__m128i *)(out + 4), _mm_unpackhi_epi64(t0, t1));
+    _mm_storeu_si128((__m128i *)(out + 8), _mm_unpacklo_epi64(t2, t3));
+    _mm_storeu_si128((__m128i *)(out + 12), _mm_unpackhi_epi64(t2, t3));
+}
+#endif
+
+#if defined(VMATH_AVX2)
+static inline void mulhilo(__m256i a, __m256i m, __m256i& hi, __m256i& lo)
+{
+    const __m256i even = _mm256_mul_epu32(a, m);
+    const __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), m);
+
+    lo = _mm256_unpacklo_epi32(_mm256_shuffle_epi32(even, _MM_SHUFFLE(3, 1, 2, 0)), _mm256_shuffle_epi32(odd, _MM_SHUFFLE(3, 1, 2, 0)));
+    hi = _mm256_unpacklo_epi32(_mm256_shuffle_epi32(even, _MM_SHUFFLE(2, 0, 3, 1)), _mm256_shuffle_epi32(odd, _MM_SHUFFLE(2, 0, 3, 1)));
+}
+
+static void philox4x32_x8(unsigned int * out, unsigned int block, unsigned int key)
+{
+    const __m256i m0 = _mm256_set1_epi32((int)0xD2511F53);
+    const __m256i m1 = _mm256_set1_epi32((int)0xCD9E8D57);
+    __m256i c0 = _mm256_add_epi32(_mm256_set1_epi32((int)block), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    __m256i c1 = _mm256_setzero_si256();
+    __m256i c2 = _mm256_setzero_si256();
+    __m256i c3 = _mm256_setzero_si256();
+    unsigned int key0 = key, key1 = 0;
+    int i;
+
+    for (i = 0; i < 10; i++)
+    {
+        __m256i hi0, lo0, hi1, lo1;
+
+        mulhilo(c0, m0, hi0, lo0);
+        mulhilo(c2, m1, hi1, lo1);
+
+        c0 = _mm256_xor_si256(_mm256_xor_si256(hi1, c1), _mm256_set1_epi32((int)key0));
+        c2 = _mm256_xor_si256(_mm256_xor_si256(hi0, c3), _mm256_set1_epi32((int)key1));
+        c1 = lo1;
+        c3 = lo0;
+
+        key0 += 0x9E3779B9u;
+        key1 += 0xBB67AE85u;
+    }
+
+    // The unpacks work within 128-bit halves, leaving blocks n and n + 4
+    // together in each register
+    const __m256i t0 = _mm256_unpacklo_epi32(c0, c1);
+    const __m256i t1 = _mm256_unpacklo_epi32(c2, c3);
+    const __m256i t2 = _mm256_unpackhi_epi32(c0, c1);
+    const __m256i t3 = _mm256_unpackhi_epi32(c2, c3);
+    const __m256i r0 = _mm256_unpacklo_epi64(t0, t1);
+    const __m256i r1 = _mm256_unpackhi_epi64(t0, t1);
+    const __m256i r2 = _mm256_unpacklo_epi64(t2, t3);
+    const __m256i r3 = _mm256_unpackhi_epi64(t2, t3);
+
+    _mm256_storeu_si256((__m256i *)(out + 0), _mm256_permute2x128_si256(r0, r1, 0x20));
+    _mm256_storeu_si256((__m256i *)(out + 8), _mm256_permute2x128_si256(r2, r3, 0x20));
+    _mm256_storeu_si256((__m256i *)(out + 16), _mm256_permute2x128_si256(r0, r1, 0x31));
+    _mm256_storeu_si256((__m256i *)(out + 24), _mm256_permute2x128_si256(r2, r3, 0x31));
+}
+#endif
+
+void random_fill_bits(unsigned int * out, unsigned int count, unsigned int key, unsigned int first)
+{
+    unsigned int i = 0;
+
+    // Up to the start of a block
+    for (; i < count && ((first + i) & 3) != 0; i++)
+        out[i] = random_bits(key, first + i);
+
+    unsigned int block = (first + i) >> 2;
+
+#if defined(VMATH_AVX2)
+    for (; count - i >= 32; i += 32, block += 8)
+        philox4x32_x8(out + i, block, key);
+#endif
+
+#if defined(VMATH_SSE2)
+    for (; count - i >= 16; i += 16, block += 4)
+        philox4x32_x4(out + i, block, key);
+#endif
+
+    for (; count - i >= 4; i += 4, block++)
+    {
+        const unsigned int counter[4] = { block, 0, 0, 0 };
+        philox4x32(counter, key, 0, out + i);
+    }
+
+    for (; i < count; i++)
+        out[i] = random_bits(key, first + i);
+}
+
+void random_fill_uniform(float * out, unsigned int count, unsigned int key, unsigned int first, float lo, float hi)
+{
+    unsigned int i;
+
+    // Generate the bits in place and convert them
+    random_fill_bits((unsigned int *)out, count, key, first);
+
+    for (i = 0; i < count; i++)
+    {
+        unsigned int bits;
+
+        memcpy(&bits, &out[i], sizeof(bits));
+        out[i] = lo + (hi - lo) * random_bits_to_float(bits);
+    }
+}
+
+void random_fill_uniform(vec3 * out, unsigned int count, unsigned int key, unsigned int first, float lo, float hi)
+{
+    random_fill_uniform(&out[0][0], count * 3, key, first * 3, lo, hi);
+}
+
+void random_fill_uniform(vec4 * out, unsigned int count, unsigned int key, unsigned int first, float lo, float hi)
+{
+    random_fill_uniform(&out[0][0], count * 4, key, first * 4, lo, hi);
+}
+
+void random_fill_normal(float * out, unsigned int count, unsigned int key, unsigned int first, float mean, float deviation)
+{
+    unsigned int bits[RANDOM_CHUNK];
+    const unsigned int end = first + count;
+    unsigned int start;
+
+    // Values come in pairs from a pair of counters, so chunks start on even
+    // counters
+    for (start = first & ~1u; start < end; start += RANDOM_CHUNK)
+    {
+        const unsigned int chunk_end = end - start > RANDOM_CHUNK ? start + RANDOM_CHUNK : end;
+        unsigned int counter;
+
+        random_fill_bits(bits, ((chunk_end - start) + 1) & ~1u, key, start);
+
+        for (counter = start > first ? start : first; counter < chunk_end; counter++)
+        {
+            const unsigned int pair = (counter - start) & ~1u;
+            out[counter - first] = mean + deviation * random_normal_from_bits(bits[pair], bits[pair + 1], (counter & 1) != 0);
+        }
+    }
+}
+
+void random_fill_normal(vec3 * out, unsigned int count, unsigned int key, unsigned int first, float mean, float deviation)
+{
+    random_fill_normal(&out[0][0], count * 3, key, first * 3, mean, deviation);
+}
+
+void random_fill_normal(vec4 * out, unsigned int count, unsigned int key, unsigned int first, float mean, float deviation)
+{
+    random_fill_normal(&out[0][0], count * 4, key, first * 4, mean, deviation);
+}
+
+void random_fill_on_sphere(vec3 * out, unsigned int count, unsigned int key, unsigned int first, float radius)
+{
+    unsigned int bits[RANDOM_CHUNK];
+    unsigned int done = 0;
+
+    while (done < count)
+    {
+        const unsigned int n = count - done > RANDOM_CHUNK / 2 ? RANDOM_CHUNK / 2 : count - done;
+        unsigned int i;
+
+        random_fill_bits(bits, n * 2, key, (first + done) * 2);
+
+        for (i = 0; i < n; i++)
+            out[done + i] = random_on_sphere_from_bits(bits[i * 2], bits[i * 2 + 1]) * radius;
+
+        done += n;
+    }
+}
+
+};
@@ -0,0 +1,661 @@
+#include "vraster.h"
+#include "vsimd.h"
+#include "vjobs.h"
+
+#include <string.h>
+#include <math.h>
+#include <atomic>
+#include <chrono>
+
+using namespace vmath;
+
+// vmath has no matrix * vector; columns are m[0] to m[3]
+static inline vec4 transform(const mat4& m, const vec4& v)
+{
+    return m[0] * v[0] + m[1] * v[1] + m[2] * v[2] + m[3] * v[3];
+}
+
+static inline unsigned int pack_color(float r, float g, float b, float a)
+{
+    unsigned char bytes[4];
+    unsigned int packed;
+
+    bytes[0] = (unsigned char)(r <= 0.0f ? 0.0f : r >= 1.0f ? 255.0f : r * 255.0f + 0.5f);
+    bytes[1] = (unsigned char)(g <= 0.0f ? 0.0f : g >= 1.0f ? 255.0f : g * 255.0f + 0.5f);
+    bytes[2] = (unsigned char)(b <= 0.0f ? 0.0f : b >= 1.0f ? 255.0f : b * 255.0f + 0.5f);
+    bytes[3] = (unsigned char)(a <= 0.0f ? 0.0f : a >= 1.0f ? 255.0f : a * 255.0f + 0.5f);
+    memcpy(&packed, bytes, sizeof(packed));
+
+    return packed;
+}
+
+SoftwareRasterizer::SoftwareRasterizer(void)
+    : m_width(0),
+      m_height(0),
+      m_stride(0),
+      m_tiles_x(0),
+      m_tiles_y(0),
+      m_blocks_x(0),
+      m_cull_face(true),
+      m_light(0.0f, 0.0f, 1.0f),
+      m_texture(NULL)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+SoftwareRasterizer::~SoftwareRasterizer(void)
+{
+    Free();
+}
+
+bool SoftwareRasterizer::Initialize(int width, int height)
+{
+    Free();
+
+    if (width <= 0 || height <= 0)
+        return false;
+
+    m_width = width;
+    m_height = height;
+    m_stride = (width + RASTER_BLOCK_SIZE - 1) & ~(RASTER_BLOCK_SIZE - 1);
+    m_tiles_x = (width + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+    m_tiles_y = (height + RASTER_TILE_SIZE - 1) / RASTER_TILE_SIZE;
+    m_blocks_x = m_stride / RASTER_BLOCK_SIZE;
+
+    m_color.resize(m_stride * m_height);
+    m_depth.resize(m_stride * m_height);
+    m_block_depth.resize(m_blocks_x * ((m_height + RASTER_BLOCK_SIZE - 1) / RASTER_BLOCK_SIZE));
+    m_bins.resize(m_tiles_x * m_tiles_y);
+
+    Clear(vec4(0.0f, 0.0f, 0.0f, 0.0f));
+
+    return true;
+}
+
+void SoftwareRasterizer::Free(void)
+{
+    std::vector<unsigned int>().swap(m_color);
+    std::vector<float>().swap(m_depth);
+    std::vector<float>().swap(m_block_depth);
+    std::vector<Triangle>().swap(m_triangles);
+    std::vector<DrawState>().swap(m_draws);
+    std::vector< std::vector<unsigned int> >().swap(m_bins);
+
+    m_width = m_height = m_stride = 0;
+    m_tiles_x = m_tiles_y = m_blocks_x = 0;
+}
+
+void SoftwareRasterizer::Clear(const vec4& color, float depth)
+{
+    const unsigned int packed = pack_color(color[0], color[1], color[2], color[3]);
+    const int size = (int)m_color.size();
+    int i;
+
+    for (i = 0; i < size; i++)
+    {
+        m_color[i] = packed;
+        m_depth[i] = depth;
+    }
+
+    for (i = 0; i < (int)m_block_depth.size(); i++)
+        m_block_depth[i] = depth;
+
+    for (i = 0; i < (int)m_bins.size(); i++)
+        m_bins[i].clear();
+
+    m_triangles.clear();
+    m_draws.clear();
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+void SoftwareRasterizer::SetLightDirection(const vec3& direction)
+{
+    m_light = normalize(direction);
+}
+
+bool SoftwareRasterizer::SetTexture(const vglImageData * image)
+{
+    m_texture = NULL;
+
+    if (image == NULL)
+        return true;
+
+    if (image->type != GL_UNSIGNED_BYTE || image->mip[0].data == NULL ||
+        (image->target != GL_TEXTURE_2D && image->target != GL_TEXTURE_RECTANGLE))
+        return false;
+
+    switch (image->format)
+    {
+        case GL_RGB:
+        case GL_BGR:
+        case GL_RGBA:
+        case GL_BGRA:
+            m_texture = image;
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool SoftwareRasterizer::SetupTriangle(const Vertex * v, Triangle& triangle) const
+{
+    float x[3], y[3], z[3], w[3];
+    int order[3] = { 0, 1, 2 };
+    int i;
+
+    for (i = 0; i < 3; i++)
+    {
+        w[i] = 1.0f / v[i].clip[3];
+        x[i] = (v[i].clip[0] * w[i] * 0.5f + 0.5f) * float(m_width);
+        y[i] = (v[i].clip[1] * w[i] * 0.5f + 0.5f) * float(m_height);
+        z[i] = v[i].clip[2] * w[i] * 0.5f + 0.5f;
+    }
+
+    float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+
+    if (area == 0.0f || (area < 0.0f && m_cull_face))
+        return false;
+
+    // Wind back faces the other way round so that inside is positive
+    if (area < 0.0f)
+    {
+        order[1] = 2;
+        order[2] = 1;
+        area = -area;
+    }
+
+    float min_x = x[0], max_x = x[0], min_y = y[0], max_y = y[0];
+    for (i = 1; i < 3; i++)
+    {
+        min_x = x[i] < min_x ? x[i] : min_x;
+        max_x = x[i] > max_x ? x[i] : max_x;
+        min_y = y[i] < min_y ? y[i] : min_y;
+        max_y = y[i] > max_y ? y[i] : max_y;
+    }
+
+    // Pixels whose centers fall inside the bounds, on screen
+    triangle.min_x = (int)ceilf(min_x - 0.5f);
+    triangle.max_x = (int)floorf(max_x - 0.5f);
+    triangle.min_y = (int)ceilf(min_y - 0.5f);
+    triangle.max_y = (int)floorf(max_y - 0.5f);
+
+    triangle.min_x = triangle.min_x < 0 ? 0 : triangle.min_x;
+    triangle.min_y = triangle.min_y < 0 ? 0 : triangle.min_y;
+    triangle.max_x = triangle.max_x > m_width - 1 ? m_width - 1 : triangle.max_x;
+    triangle.max_y = triangle.max_y > m_height - 1 ? m_height - 1 : triangle.max_y;
+
+    if (triangle.min_x > triangle.max_x || triangle.min_y > triangle.max_y)
+        return false;
+
+    // Work relative to the corner of the bounds. Far from the origin the
+    // constant terms of the planes grow large enough to swamp the depth.
+    for (i = 0; i < 3; i++)
+    {
+        x[i] -= float(triangle.min_x);
+        y[i] -= float(triangle.min_y);
+    }
+
+    triangle.inv_area = 1.0f / area;
+    triangle.z = vec3(0.0f);
+    triangle.z_min = 1.0f;
+
+    for (i = 0; i < 3; i++)
+    {
+        const int a = order[i];
+        const int b = order[(i + 1) % 3];
+        const int c = order[(i + 2) % 3];
+        const float ea = y[b] - y[c];
+        const float eb = x[c] - x[b];
+
+        triangle.edge[i] = vec3(ea, eb, x[b] * y[c] - x[c] * y[b]);
+        triangle.top_left[i] = ea > 0.0f || (ea == 0.0f && eb < 0.0f);
+
+        triangle.z += triangle.edge[i] * (z[a] * triangle.inv_area);
+        triangle.z_min = z[a] < triangle.z_min ? z[a] : triangle.z_min;
+
+        triangle.inv_w[i] = w[a];
+        triangle.normal[i] = v[a].normal * w[a];
+        triangle.uv[i] = v[a].uv * w[a];
+    }
+
+    return triangle.z_min < 1.0f;
+}
+
+void SoftwareRasterizer::Draw(JobSystem& jobs, const VBObject& object, unsigned int frame,
+                              const mat4& model_view, const mat4& projection,
+                              const vec4& color)
+{
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+    const float * positions = object.GetAttributeData(0);
+    const float * normals = object.GetAttributeData(1);
+    const float * uvs = object.GetAttributeCount() > 2 ? object.GetAttributeData(2) : NULL;
+    const unsigned int position_components = object.GetAttributeComponents(0);
+    const unsigned int normal_components = object.GetAttributeComponents(1);
+    const unsigned int uv_components = object.GetAttributeComponents(2);
+    const GLuint * indices = object.GetIndexData();
+    const unsigned int first = object.GetFirstVertex(frame);
+    const int count = (int)(frame < object.GetFrameCount() ? object.GetVertexCount(frame) / 3 : 0);
+    const mat4 mvp = projection * model_view;
+    int i;
+
+    if (positions == NULL || count == 0)
+        return;
+
+    DrawState draw = { color, m_texture };
+    m_draws.push_back(draw);
+
+    // Each triangle becomes at most two after clipping to the near plane
+    std::vector<Triangle> triangles(count * 2);
+    std::vector<unsigned char> valid(count * 2);
+
+    // Each triangle has its own pair of slots, so any thread can set up any
+    // range of them
+    jobs.ParallelFor((unsigned int)count, 256, [&](unsigned int begin, unsigned int end)
+    {
+        for (unsigned int k = begin; k < end; k++)
+        {
+            const int i = (int)k;
+            Vertex in[3];
+            Vertex out[4];
+            int n = 0;
+            int j;
+
+            for (j = 0; j < 3; j++)
+            {
+                const unsigned int index = indices ? indices[first + i * 3 + j] : first + i * 3 + j;
+                const float * p = positions + index * position_components;
+                const vec4 position(p[0], p[1], p[2], position_components > 3 ? p[3] : 1.0f);
+
+                in[j].clip = transform(mvp, position);
+                in[j].normal = vec3(0.0f, 0.0f, 1.0f);
+                in[j].uv = vec2(0.0f, 0.0f);
+
+                if (normals != NULL && normal_components >= 3)
+                {
+                    const float * q = normals + index * normal_components;
+                    const vec4 normal = transform(model_view, vec4(q[0], q[1], q[2], 0.0f));
+                    in[j].normal = vec3(normal[0], normal[1], normal[2]);
+                }
+
+                if (uvs != NULL && uv_components >= 2)
+                {
+                    const float * q = uvs + index * uv_components;
+                    in[j].uv = vec2(q[0], q[1]);
+                }
+            }
+
+            // Clip against the near plane (z >= -w). The other planes are
+            // handled by the bounds and the depth test.
+            for (j = 0; j < 3; j++)
+            {
+                const Vertex& a = in[j];
+                const Vertex& b = in[(j + 1) % 3];
+                const float da = a.clip[2] + a.clip[3];
+                const float db = b.clip[2] + b.clip[3];
+
+                if (da >= 0.0f)
+                    out[n++] = a;
+
+                if ((da >= 0.0f) != (db >= 0.0f))
+                {
+                    const float t = da / (da - db);
+                    out[n].clip = mix(a.clip, b.clip, t);
+                    out[n].normal = mix(a.normal, b.normal, t);
+                    out[n].uv = mix(a.uv, b.uv, t);
+                    n++;
+                }
+            }
+
+            valid[i * 2 + 0] = n >= 3 && SetupTriangle(out, triangles[i * 2 + 0]);
+            if (n == 4)
+            {
+                out[1] = out[2];
+                out[2] = out[3];
+                valid[i * 2 + 1] = SetupTriangle(out, triangles[i * 2 + 1]);
+            }
+            else
+            {
+                valid[i * 2 + 1] = 0;
+            }
+        }
+    });
+
+    // Binning in submission order keeps the result independent of threading
+    for (i = 0; i < count * 2; i++)
+    {
+        if (valid[i])
+        {
+            triangles[i].draw = (unsigned int)m_draws.size() - 1;
+            m_triangles.push_back(triangles[i]);
+            Bin((unsigned int)m_triangles.size() - 1);
+        }
+        else if ((i & 1) == 0)
+        {
+            m_stats.culled++;
+        }
+    }
+
+    m_stats.triangles += count;
+    m_stats.setup_time += std::chrono::duration<float, std::micro>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void SoftwareRasterizer::Bin(unsigned int index)
+{
+    const Triangle& triangle = m_triangles[index];
+    const int tx0 = triangle.min_x / RASTER_TILE_SIZE;
+    const int tx1 = triangle.max_x / RASTER_TILE_SIZE;
+    const int ty0 = triangle.min_y / RASTER_TILE_SIZE;
+    const int ty1 = triangle.max_y / RASTER_TILE_SIZE;
+    int tx, ty, i;
+
+    for (ty = ty0; ty <= ty1; ty++)
+    {
+        for (tx = tx0; tx <= tx1; tx++)
+        {
+            bool outside = false;
+
+            // Skip tiles entirely outside one of the edges, judged at the
+            // pixel center where that edge is greatest
+            for (i = 0; i < 3 && !outside; i++)
+            {
+                const vec3& e = triangle.edge[i];
+                const float x = float(tx * RASTER_TILE_SIZE - triangle.min_x) + (e[0] > 0.0f ? RASTER_TILE_SIZE - 0.5f : 0.5f);
+                const float y = float(ty * RASTER_TILE_SIZE - triangle.min_y) + (e[1] > 0.0f ? RASTER_TILE_SIZE - 0.5f : 0.5f);
+                outside = e[0] * x + e[1] * y + e[2] < 0.0f;
+            }
+
+            if (!outside)
+            {
+                m_bins[ty * m_tiles_x + tx].push_back(index);
+                m_stats.bin_entries++;
+            }
+        }
+    }
+}
+
+void SoftwareRasterizer::Finish(JobSystem& jobs)
+{
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+    // A tile at a time at the finest. ParallelFor halves the range as it
+    // goes, so a thread that runs out takes over half of another's tiles.
+    const int tile_count = m_tiles_x * m_tiles_y;
+    std::atomic<unsigned int> blocks_tested(0);
+    std::atomic<unsigned int> blocks_rejected(0);
+    std::atomic<unsigned int> pixels_shaded(0);
+    int t;
+
+    jobs.ParallelFor((unsigned int)tile_count, 1, [&](unsigned int begin, unsigned int end)
+    {
+        unsigned int tested = 0;
+        unsigned int rejected = 0;
+        unsigned int shaded = 0;
+
+        for (unsigned int tile = begin; tile < end; tile++)
+            RasterizeTile((int)tile, tested, rejected, shaded);
+
+        blocks_tested.fetch_add(tested, std::memory_order_relaxed);
+        blocks_rejected.fetch_add(rejected, std::memory_order_relaxed);
+        pixels_shaded.fetch_add(shaded, std::memory_order_relaxed);
+    });
+
+    for (t = 0; t < tile_count; t++)
+        m_bins[t].clear();
+    m_triangles.clear();
+    m_draws.clear();
+
+    m_stats.blocks_tested += blocks_tested.load();
+    m_stats.blocks_rejected += blocks_rejected.load();
+    m_stats.pixels_shaded += pixels_shaded.load();
+    m_stats.raster_time += std::chrono::duration<float, std::micro>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+void SoftwareRasterizer::RasterizeTile(int tile, unsigned int& blocks_tested, unsigned int& blocks_rejected, unsigned int& pixels_shaded)
+{
+    const std::vector<unsigned int>& bin = m_bins[tile];
+    const int tile_x = (tile % m_tiles_x) * RASTER_TILE_SIZE;
+    const int tile_y = (tile / m_tiles_x) * RASTER_TILE_SIZE;
+    size_t n;
+
+    for (n = 0; n < bin.size(); n++)
+    {
+        const Triangle& triangle = m_triangles[bin[n]];
+        const int x0 = triangle.min_x > tile_x ? triangle.min_x : tile_x;
+        const int y0 = triangle.min_y > tile_y ? triangle.min_y : tile_y;
+        const int x1 = triangle.max_x < tile_x + RASTER_TILE_SIZE - 1 ? triangle.max_x : tile_x + RASTER_TILE_SIZE - 1;
+        const int y1 = triangle.max_y < tile_y + RASTER_TILE_SIZE - 1 ? triangle.max_y : tile_y + RASTER_TILE_SIZE - 1;
+        int bx, by, x, y, i;
+
+        for (by = y0 & ~(RASTER_BLOCK_SIZE - 1); by <= y1; by += RASTER_BLOCK_SIZE)
+        {
+            for (bx = x0 & ~(RASTER_BLOCK_SIZE - 1); bx <= x1; bx += RASTER_BLOCK_SIZE)
+            {
+                const int block = (by / RASTER_BLOCK_SIZE) * m_blocks_x + bx / RASTER_BLOCK_SIZE;
+                bool outside = false;
+                bool written = false;
+
+                blocks_tested++;
+
+                // Hierarchical early-out: the nearest point of the triangle
+                // is behind everything already in the block
+                if (triangle.z_min >= m_block_depth[block])
+                {
+                    blocks_rejected++;
+                    continue;
+                }
+
+                for (i = 0; i < 3 && !outside; i++)
+                {
+                    const vec3& e = triangle.edge[i];
+                    const float cx = float(bx - triangle.min_x) + (e[0] > 0.0f ? RASTER_BLOCK_SIZE - 0.5f : 0.5f);
+                    const float cy = float(by - triangle.min_y) + (e[1] > 0.0f ? RASTER_BLOCK_SIZE - 0.5f : 0.5f);
+                    outside = e[0] * cx + e[1] * cy + e[2] < 0.0f;
+                }
+
+                if (outside)
+                    continue;
+
+                const int row_start = by > y0 ? by : y0;
+                const int row_end = by + RASTER_BLOCK_SIZE - 1 < y1 ? by + RASTER_BLOCK_SIZE - 1 : y1;
+
+                for (y = row_start; y <= row_end; y++)
+                {
+                    const float fx = float(bx - triangle.min_x);
+                    const float fy = float(y - triangle.min_y) + 0.5f;
+                    float * depth = &m_depth[y * m_stride + bx];
+                    unsigned int * color = &m_color[y * m_stride + bx];
+                    unsigned int mask = 0;
+
+#if defined(VMATH_AVX)
+                    const __m256 xs = _mm256_add_ps(_mm256_set1_ps(fx),
+                                                    _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f));
+                    const __m256 zero = _mm256_setzero_ps();
+                    __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+                    for (i = 0; i < 3; i++)
+                    {
+                        const vec3& e = triangle.edge[i];
+                        const __m256 value = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(e[0]), xs),
+                                                           _mm256_set1_ps(e[1] * fy + e[2]));
+                        const __m256 edge_in = triangle.top_left[i] ? _mm256_cmp_ps(value, zero, _CMP_GE_OQ)
+                                                                    : _mm256_cmp_ps(value, zero, _CMP_GT_OQ);
+                        inside = _mm256_and_ps(inside, edge_in);
+                    }
+
+                    const __m256 z = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(triangle.z[0]), xs),
+                                                   _mm256_set1_ps(triangle.z[1] * fy + triangle.z[2]));
+                    const __m256 old_z = _mm256_loadu_ps(depth);
+                    const __m256 pass = _mm256_and_ps(inside, _mm256_cmp_ps(z, old_z, _CMP_LT_OQ));
+
+                    mask = (unsigned int)_mm256_movemask_ps(pass);
+                    if (mask != 0)
+                        _mm256_storeu_ps(depth, _mm256_blendv_ps(old_z, z, pass));
+#elif defined(VMATH_SSE2)
+                    int half;
+
+                    for (half = 0; half < 2; half++)
+                    {
+                        const __m128 xs = _mm_add_ps(_mm_set1_ps(fx + float(half * 4)), _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f));
+                        const __m128 zero = _mm_setzero_ps();
+                        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+                        for (i = 0; i < 3; i++)
+                        {
+                            const vec3& e = triangle.edge[i];
+                            const __m128 value = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(e[0]), xs),
+                                                            _mm_set1_ps(e[1] * fy + e[2]));
+                            const __m128 edge_in = triangle.top_left[i] ? _mm_cmpge_ps(value, zero)
+                                                                        : _mm_cmpgt_ps(value, zero);
+                            inside = _mm_and_ps(inside, edge_in);
+                        }
+
+                        const __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(triangle.z[0]), xs),
+                                                    _mm_set1_ps(triangle.z[1] * fy + triangle.z[2]));
+                        const __m128 old_z = _mm_loadu_ps(depth + half * 4);
+                        const __m128 pass = _mm_and_ps(inside, _mm_cmplt_ps(z, old_z));
+                        const unsigned int bits = (unsigned int)_mm_movemask_ps(pass);
+
+                        if (bits != 0)
+                        {
+                            _mm_storeu_ps(depth + half * 4, _mm_or_ps(_mm_and_ps(pass, z), _mm_andnot_ps(pass, old_z)));
+                            mask |= bits << (half * 4);
+                        }
+                    }
+#else
+                    for (x = 0; x < RASTER_BLOCK_SIZE; x++)
+                    {
+                        const float px = fx + (float(x) + 0.5f);
+                        bool inside = true;
+
+                        for (i = 0; i < 3; i++)
+                        {
+                            const vec3& e = triangle.edge[i];
+                            const float value = e[0] * px + (e[1] * fy + e[2]);
+                            inside = inside && (triangle.top_left[i] ? value >= 0.0f : value > 0.0f);
+                        }
+
+                        const float z = triangle.z[0] * px + (triangle.z[1] * fy + triangle.z[2]);
+                        if (inside && z < depth[x])
+                        {
+                            depth[x] = z;
+                            mask |= 1u << x;
+                        }
+                    }
+#endif
+
+                    for (x = 0; mask != 0; x++, mask >>= 1)
+                    {
+                        if (mask & 1)
+                        {
+                            color[x] = Shade(triangle, fx + (float(x) + 0.5f), fy);
+                            pixels_shaded++;
+                            written = true;
+                        }
+                    }
+                }
+
+                if (written)
+                    UpdateBlockDepth(bx / RASTER_BLOCK_SIZE, by / RASTER_BLOCK_SIZE);
+            }
+        }
+    }
+}
+
+void SoftwareRasterizer::UpdateBlockDepth(int block_x, int block_y)
+{
+    const int x0 = block_x * RASTER_BLOCK_SIZE;
+    const int y0 = block_y * RASTER_BLOCK_SIZE;
+    const int x1 = x0 + RASTER_BLOCK_SIZE < m_width ? x0 + RASTER_BLOCK_SIZE : m_width;
+    const int y1 = y0 + RASTER_BLOCK_SIZE < m_height ? y0 + RASTER_BLOCK_SIZE : m_height;
+    float farthest = 0.0f;
+    int x, y;
+
+    for (y = y0; y < y1; y++)
+    {
+        const float * depth = &m_depth[y * m_stride];
+        for (x = x0; x < x1; x++)
+            farthest = depth[x] > farthest ? depth[x] : farthest;
+    }
+
+    m_block_depth[block_y * m_blocks_x + block_x] = farthest;
+}
+
+unsigned int SoftwareRasterizer::Shade(const Triangle& triangle, float x, float y) const
+{
+    const DrawState& draw = m_draws[triangle.draw];
+    float b[3];
+    int i;
+
+    for (i = 0; i < 3; i++)
+        b[i] = (triangle.edge[i][0] * x + triangle.edge[i][1] * y + triangle.edge[i][2]) * triangle.inv_area;
+
+    const float w = 1.0f / (b[0] * triangle.inv_w[0] + b[1] * triangle.inv_w[1] + b[2] * triangle.inv_w[2]);
+    vec3 normal = (triangle.normal[0] * b[0] + triangle.normal[1] * b[1] + triangle.normal[2] * b[2]) * w;
+    const float length2 = dot(normal, normal);
+
+    float intensity = 0.2f;
+    if (length2 > 0.0f)
+    {
+        const float diffuse = dot(normal, m_light) / sqrtf(length2);
+        intensity += diffuse > 0.0f ? 0.8f * diffuse : 0.0f;
+    }
+
+    vec4 color = draw.color * intensity;
+    color[3] = draw.color[3];
+
+    if (draw.texture != NULL)
+    {
+        const vglImageMipData& mip = draw.texture->mip[0];
+        const vec2 uv = (triangle.uv[0] * b[0] + triangle.uv[1] * b[1] + triangle.uv[2] * b[2]) * w;
+        const float u = uv[0] - floorf(uv[0]);
+        const float v = uv[1] - floorf(uv[1]);
+        int tx = (int)(u * float(mip.width));
+        int ty = (int)(v * float(mip.height));
+        tx = tx < mip.width ? tx : mip.width - 1;
+        ty = ty < mip.height ? ty : mip.height - 1;
+
+        const bool has_alpha = draw.texture->format == GL_RGBA || draw.texture->format == GL_BGRA;
+        const bool swapped = draw.texture->format == GL_BGR || draw.texture->format == GL_BGRA;
+        const int texel_size = has_alpha ? 4 : 3;
+        const int row_size = (mip.width * texel_size + 3) & ~3;
+        const unsigned char * texel = (const unsigned char *)mip.data + ty * row_size + tx * texel_size;
+
+        color[0] *= texel[swapped ? 2 : 0] * (1.0f / 255.0f);
+        color[1] *= texel[1] * (1.0f / 255.0f);
+        color[2] *= texel[swapped ? 0 : 2] * (1.0f / 255.0f);
+        if (has_alpha)
+            color[3] *= texel[3] * (1.0f / 255.0f);
+    }
+
+    return pack_color(color[0], color[1], color[2], color[3]);
+}
+
+void SoftwareRasterizer::ReadImage(vglImageData * image) const
+{
+    const GLsizeiptr size = m_width * m_height * 4;
+    unsigned char * data = new unsigned char[size];
+    int y;
+
+    for (y = 0; y < m_height; y++)
+        memcpy(data + y * m_width * 4, &m_color[y * m_stride], m_width * 4);
+
+    memset(image, 0, sizeof(*image));
+    image->target = GL_TEXTURE_2D;
+    image->internalFormat = GL_RGBA8;
+    image->format = GL_RGBA;
+    image->type = GL_UNSIGNED_BYTE;
+    image->swizzle[0] = GL_RED;
+    image->swizzle[1] = GL_GREEN;
+    image->swizzle[2] = GL_BLUE;
+    image->swizzle[3] = GL_ALPHA;
+    image->mipLevels = 1;
+    image->slices = 1;
+    image->sliceStride = size;
+    image->totalDataSize = size;
+    image->mip[0].width = m_width;
+    image->mip[0].height = m_height;
+    image->mip[0].depth = 1;
+    image->mip[0].mipStride = size;
+    image->mip[0].data = data;
+}
@@ -0,0 +1,99 @@
+#include "vshadow.h"
+
+#include <math.h>
+
+namespace vmath
+{
+
+void cascadeSplits(float n, float f, unsigned int count, float lambda, float * splits)
+{
+    unsigned int i;
+
+    splits[0] = n;
+
+    for (i = 1; i < count; i++)
+    {
+        const float s = float(i) / float(count);
+        const float log_split = n * powf(f / n, s);
+        const float uniform_split = n + (f - n) * s;
+
+        splits[i] = lambda * log_split + (1.0f - lambda) * uniform_split;
+    }
+
+    splits[count] = f;
+}
+
+float frustumSliceCorners(const mat4& view_matrix, const mat4& projection_matrix,
+                          float slice_near, float slice_far, vec3 corners[8])
+{
+    static const float ndc[4][2] =
+    {
+        { -1.0f, -1.0f }, { 1.0f, -1.0f }, { 1.0f, 1.0f }, { -1.0f, 1.0f }
+    };
+    const mat4& p = projection_matrix;
+    const mat4& v = view_matrix;
+    vec3 view_corners[8];
+    vec3 center(0.0f);
+    float radius = 0.0f;
+    int i, j;
+
+    for (i = 0; i < 8; i++)
+    {
+        // Unproject to view space. For a perspective projection the
+        // clip-space w is the distance along the view direction.
+        const float d = i < 4 ? slice_near : slice_far;
+
+        view_corners[i] = vec3(d * (ndc[i & 3][0] + p[2][0]) / p[0][0],
+                               d * (ndc[i & 3][1] + p[2][1]) / p[1][1],
+                               -d);
+        center += view_corners[i];
+
+        const vec3 e = view_corners[i] - vec3(v[3][0], v[3][1], v[3][2]);
+
+        // The view matrix is rigid, so its inverse rotation is its
+        // transpose
+        for (j = 0; j < 3; j++)
+        {
+            corners[i][j] = v[j][0] * e[0] + v[j][1] * e[1] + v[j][2] * e[2];
+        }
+    }
+    center /= 8.0f;
+
+    for (i = 0; i < 8; i++)
+    {
+        radius = max(radius, length(view_corners[i] - center));
+    }
+
+    // Round the radius up so that it covers the world-space corners'
+    // rounding as well
+    return ceilf(radius * 16.0f) / 16.0f;
+}
+
+mat4 cascadeProjection(const vec3 corners[8], float radius, const mat4& light_view_matrix,
+                       unsigned int resolution, float caster_distance)
+{
+    vec3 center(0.0f);
+    int i;
+
+    for (i = 0; i < 8; i++)
+    {
+        center += corners[i];
+    }
+    center /= 8.0f;
+
+    const mat4& l = light_view_matrix;
+    const vec3 c(l[0][0] * center[0] + l[1][0] * center[1] + l[2][0] * center[2] + l[3][0],
+                 l[0][1] * center[0] + l[1][1] * center[1] + l[2][1] * center[2] + l[3][1],
+                 l[0][2] * center[0] + l[1][2] * center[1] + l[2][2] * center[2] + l[3][2]);
+    const float texel = 2.0f * radius / float(resolution);
+    const float x = floorf(c[0] / texel) * texel;
+    const float y = floorf(c[1] / texel) * texel;
+
+    // The light looks down -z. Centering the projection and translating
+    // separately keeps its scale exact, where x + radius - (x - radius)
+    // would round differently as x moves.
+    return ortho(-radius, radius, -radius, radius, -c[2] - radius - caster_distance, -c[2] + radius) *
+           translate(-x, -y, 0.0f);
+}
+
+};
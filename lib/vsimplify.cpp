@@ -0,0 +1,402 @@
+#include "vsimplify.h"
+
+#include <algorithm>
+#include <map>
+
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+MeshSimplifier::Quadric::Quadric(void)
+{
+    memset(a, 0, sizeof(a));
+}
+
+MeshSimplifier::Quadric::Quadric(double nx, double ny, double nz, double d, double w)
+{
+    a[0] = w * nx * nx; a[1] = w * nx * ny; a[2] = w * nx * nz; a[3] = w * nx * d;
+    a[4] = w * ny * ny; a[5] = w * ny * nz; a[6] = w * ny * d;
+    a[7] = w * nz * nz; a[8] = w * nz * d;
+    a[9] = w * d * d;
+}
+
+MeshSimplifier::Quadric& MeshSimplifier::Quadric::operator+=(const Quadric& q)
+{
+    for (int i = 0; i < 10; i++)
+        a[i] += q.a[i];
+    return *this;
+}
+
+double MeshSimplifier::Quadric::Evaluate(const Point& p) const
+{
+    const double x = p.x, y = p.y, z = p.z;
+
+    return a[0] * x * x + 2.0 * a[1] * x * y + 2.0 * a[2] * x * z + 2.0 * a[3] * x +
+           a[4] * y * y + 2.0 * a[5] * y * z + 2.0 * a[6] * y +
+           a[7] * z * z + 2.0 * a[8] * z +
+           a[9];
+}
+
+template <typename P>
+static inline P triangle_normal(const P& p0, const P& p1, const P& p2)
+{
+    P n;
+    const float ux = p1.x - p0.x, uy = p1.y - p0.y, uz = p1.z - p0.z;
+    const float vx = p2.x - p0.x, vy = p2.y - p0.y, vz = p2.z - p0.z;
+
+    n.x = uy * vz - uz * vy;
+    n.y = uz * vx - ux * vz;
+    n.z = ux * vy - uy * vx;
+
+    return n;
+}
+
+MeshSimplifier::MeshSimplifier(const float * positions, const float * normals, unsigned int vertex_count, unsigned int stride,
+                               const unsigned int * indices, unsigned int index_count)
+    : m_positions(vertex_count),
+      m_normals(normals ? vertex_count : 0),
+      m_triangles(indices, indices + index_count),
+      m_triangle_alive(index_count / 3, true),
+      m_vertex_alive(vertex_count, true),
+      m_locked(vertex_count, false),
+      m_stamp(vertex_count, 0),
+      m_quadrics(vertex_count),
+      m_merged_into(vertex_count),
+      m_vertex_error(vertex_count, 0.0f),
+      m_vertex_triangles(vertex_count),
+      m_live_triangles(index_count / 3),
+      m_max_error(0.0f)
+{
+    const std::vector<Point>& pos = m_positions;
+    std::map< std::pair<unsigned int, unsigned int>, unsigned int > edges;
+    std::map< std::vector<float>, unsigned int > position_map;
+    size_t i, t;
+
+    for (i = 0; i < vertex_count; i++)
+    {
+        memcpy(&m_positions[i], positions + i * stride, sizeof(Point));
+        if (normals)
+            memcpy(&m_normals[i], normals + i * stride, sizeof(Point));
+        m_merged_into[i] = (unsigned int)i;
+    }
+
+    // Vertices that share a position with another vertex lie on a UV or
+    // normal seam. Lock them so that seams are never pulled apart.
+    for (i = 0; i < pos.size(); i++)
+    {
+        std::vector<float> key(3);
+        key[0] = pos[i].x; key[1] = pos[i].y; key[2] = pos[i].z;
+        std::map< std::vector<float>, unsigned int >::iterator it = position_map.find(key);
+        if (it != position_map.end())
+        {
+            m_locked[i] = true;
+            m_locked[it->second] = true;
+        }
+        else
+        {
+            position_map[key] = (unsigned int)i;
+        }
+    }
+
+    for (t = 0; t < m_triangles.size() / 3; t++)
+    {
+        const unsigned int * v = &m_triangles[t * 3];
+        Point n = triangle_normal(pos[v[0]], pos[v[1]], pos[v[2]]);
+        double len = sqrt((double)n.x * n.x + (double)n.y * n.y + (double)n.z * n.z);
+
+        for (i = 0; i < 3; i++)
+        {
+            m_vertex_triangles[v[i]].push_back((unsigned int)t);
+            unsigned int a = v[i], b = v[(i + 1) % 3];
+            edges[std::make_pair(std::min(a, b), std::max(a, b))]++;
+        }
+
+        if (len == 0.0)
+            continue;
+
+        Quadric q(n.x / len, n.y / len, n.z / len,
+                  -(n.x * pos[v[0]].x + n.y * pos[v[0]].y + n.z * pos[v[0]].z) / len);
+
+        for (i = 0; i < 3; i++)
+            m_quadrics[v[i]] += q;
+    }
+
+    // Open edges get a heavily weighted plane perpendicular to the face so
+    // that silhouettes and holes keep their shape
+    for (t = 0; t < m_triangles.size() / 3; t++)
+    {
+        const unsigned int * v = &m_triangles[t * 3];
+        Point n = triangle_normal(pos[v[0]], pos[v[1]], pos[v[2]]);
+
+        for (i = 0; i < 3; i++)
+        {
+            unsigned int a = v[i], b = v[(i + 1) % 3];
+            if (edges[std::make_pair(std::min(a, b), std::max(a, b))] != 1)
+                continue;
+
+            // e x n is perpendicular to the edge and lies in the face plane
+            double ex = pos[b].x - pos[a].x, ey = pos[b].y - pos[a].y, ez = pos[b].z - pos[a].z;
+            double px = ey * n.z - ez * n.y;
+            double py = ez * n.x - ex * n.z;
+            double pz = ex * n.y - ey * n.x;
+            double len = sqrt(px * px + py * py + pz * pz);
+            if (len == 0.0)
+                continue;
+            px /= len; py /= len; pz /= len;
+
+            Quadric q(px, py, pz, -(px * pos[a].x + py * pos[a].y + pz * pos[a].z), 1000.0);
+            m_quadrics[a] += q;
+            m_quadrics[b] += q;
+        }
+    }
+
+    for (t = 0; t < m_triangles.size() / 3; t++)
+    {
+        for (i = 0; i < 3; i++)
+        {
+            PushCollapse(m_triangles[t * 3 + i], m_triangles[t * 3 + (i + 1) % 3]);
+            PushCollapse(m_triangles[t * 3 + (i + 1) % 3], m_triangles[t * 3 + i]);
+        }
+    }
+}
+
+void MeshSimplifier::Neighbors(unsigned int v, std::vector<unsigned int>& out) const
+{
+    out.clear();
+
+    for (size_t i = 0; i < m_vertex_triangles[v].size(); i++)
+    {
+        unsigned int t = m_vertex_triangles[v][i];
+        if (!m_triangle_alive[t] || !HasVertex(t, v))
+            continue;
+        for (int j = 0; j < 3; j++)
+        {
+            unsigned int w = m_triangles[t * 3 + j];
+            if (w != v && std::find(out.begin(), out.end(), w) == out.end())
+                out.push_back(w);
+        }
+    }
+}
+
+void MeshSimplifier::PushCollapse(unsigned int from, unsigned int to)
+{
+    if (m_locked[from])
+        return;
+
+    // Don't merge across creases - that would smear the shading normals
+    if (!m_normals.empty())
+    {
+        const Point& n0 = m_normals[from];
+        const Point& n1 = m_normals[to];
+        float d = n0.x * n1.x + n0.y * n1.y + n0.z * n1.z;
+        float l = sqrtf((n0.x * n0.x + n0.y * n0.y + n0.z * n0.z) * (n1.x * n1.x + n1.y * n1.y + n1.z * n1.z));
+        if (d < 0.5f * l)
+            return;
+    }
+
+    Quadric q = m_quadrics[from];
+    q += m_quadrics[to];
+
+    Collapse c;
+    c.cost = std::max(q.Evaluate(m_positions[to]), 0.0);
+    c.from = from;
+    c.to = to;
+    c.stamp = m_stamp[from] + m_stamp[to];
+    m_heap.push(c);
+}
+
+bool MeshSimplifier::IsValid(unsigned int from, unsigned int to) const
+{
+    std::vector<unsigned int> n0, n1;
+    size_t i, shared_vertices = 0, shared_triangles = 0;
+
+    // Link condition - the collapse must not create non-manifold geometry
+    Neighbors(from, n0);
+    Neighbors(to, n1);
+    for (i = 0; i < n0.size(); i++)
+    {
+        if (std::find(n1.begin(), n1.end(), n0[i]) != n1.end())
+            shared_vertices++;
+    }
+
+    for (i = 0; i < m_vertex_triangles[from].size(); i++)
+    {
+        unsigned int t = m_vertex_triangles[from][i];
+        if (!m_triangle_alive[t] || !HasVertex(t, from))
+            continue;
+
+        if (HasVertex(t, to))
+        {
+            shared_triangles++;
+            continue;
+        }
+
+        // Reject the collapse if any surviving triangle would flip over
+        Point p[3];
+        for (int j = 0; j < 3; j++)
+            p[j] = m_positions[m_triangles[t * 3 + j]];
+        Point before = triangle_normal(p[0], p[1], p[2]);
+        for (int j = 0; j < 3; j++)
+        {
+            if (m_triangles[t * 3 + j] == from)
+                p[j] = m_positions[to];
+        }
+        Point after = triangle_normal(p[0], p[1], p[2]);
+
+        float d = before.x * after.x + before.y * after.y + before.z * after.z;
+        float l = sqrtf((before.x * before.x + before.y * before.y + before.z * before.z) *
+                        (after.x * after.x + after.y * after.y + after.z * after.z));
+        if (l == 0.0f || d < 0.2f * l)
+            return false;
+    }
+
+    return shared_triangles != 0 && shared_vertices == shared_triangles;
+}
+
+void MeshSimplifier::DoCollapse(unsigned int from, unsigned int to)
+{
+    size_t i;
+
+    for (i = 0; i < m_vertex_triangles[from].size(); i++)
+    {
+        unsigned int t = m_vertex_triangles[from][i];
+        if (!m_triangle_alive[t] || !HasVertex(t, from))
+            continue;
+
+        if (HasVertex(t, to))
+        {
+            m_triangle_alive[t] = false;
+            m_live_triangles--;
+            continue;
+        }
+
+        for (int j = 0; j < 3; j++)
+        {
+            if (m_triangles[t * 3 + j] == from)
+                m_triangles[t * 3 + j] = to;
+        }
+        m_vertex_triangles[to].push_back(t);
+    }
+
+    m_vertex_alive[from] = false;
+    m_vertex_triangles[from].clear();
+    m_quadrics[to] += m_quadrics[from];
+    m_merged_into[from] = to;
+    m_stamp[to]++;
+
+    std::vector<unsigned int> n;
+    Neighbors(to, n);
+    for (i = 0; i < n.size(); i++)
+    {
+        PushCollapse(n[i], to);
+        PushCollapse(to, n[i]);
+    }
+}
+
+float MeshSimplifier::Simplify(unsigned int target_triangles)
+{
+    while (m_live_triangles > target_triangles && !m_heap.empty())
+    {
+        Collapse c = m_heap.top();
+        m_heap.pop();
+
+        if (!m_vertex_alive[c.from] || !m_vertex_alive[c.to] ||
+            c.stamp != m_stamp[c.from] + m_stamp[c.to])
+            continue;
+
+        if (!IsValid(c.from, c.to))
+            continue;
+
+        DoCollapse(c.from, c.to);
+    }
+
+    return MeasureError();
+}
+
+// Distance from p to the triangle abc (Ericson, Real-Time Collision Detection)
+template <typename P>
+static float point_triangle_distance(const P& p, const P& a, const P& b, const P& c)
+{
+    const float abx = b.x - a.x, aby = b.y - a.y, abz = b.z - a.z;
+    const float acx = c.x - a.x, acy = c.y - a.y, acz = c.z - a.z;
+    const float apx = p.x - a.x, apy = p.y - a.y, apz = p.z - a.z;
+    const float bpx = p.x - b.x, bpy = p.y - b.y, bpz = p.z - b.z;
+    const float cpx = p.x - c.x, cpy = p.y - c.y, cpz = p.z - c.z;
+    float v, w;
+
+    const float d1 = abx * apx + aby * apy + abz * apz;
+    const float d2 = acx * apx + acy * apy + acz * apz;
+    const float d3 = abx * bpx + aby * bpy + abz * bpz;
+    const float d4 = acx * bpx + acy * bpy + acz * bpz;
+    const float d5 = abx * cpx + aby * cpy + abz * cpz;
+    const float d6 = acx * cpx + acy * cpy + acz * cpz;
+    const float va = d3 * d6 - d5 * d4;
+    const float vb = d5 * d2 - d1 * d6;
+    const float vc = d1 * d4 - d3 * d2;
+
+    if (d1 <= 0.0f && d2 <= 0.0f)
+        v = 0.0f, w = 0.0f;
+    else if (d3 >= 0.0f && d4 <= d3)
+        v = 1.0f, w = 0.0f;
+    else if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+        v = d1 / (d1 - d3), w = 0.0f;
+    else if (d6 >= 0.0f && d5 <= d6)
+        v = 0.0f, w = 1.0f;
+    else if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+        v = 0.0f, w = d2 / (d2 - d6);
+    else if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+        w = (d4 - d3) / ((d4 - d3) + (d5 - d6)), v = 1.0f - w;
+    else
+        v = vb / (va + vb + vc), w = vc / (va + vb + vc);
+
+    const float dx = apx - abx * v - acx * w;
+    const float dy = apy - aby * v - acy * w;
+    const float dz = apz - abz * v - acz * w;
+
+    return sqrtf(dx * dx + dy * dy + dz * dz);
+}
+
+float MeshSimplifier::MeasureError(void)
+{
+    size_t v, i;
+
+    for (v = 0; v < m_positions.size(); v++)
+    {
+        unsigned int r = (unsigned int)v;
+        while (m_merged_into[r] != r)
+            r = m_merged_into[r];
+        m_merged_into[v] = r;
+
+        if (r == v)
+            continue;
+
+        float d = FLT_MAX;
+        for (i = 0; i < m_vertex_triangles[r].size(); i++)
+        {
+            unsigned int t = m_vertex_triangles[r][i];
+            if (!m_triangle_alive[t] || !HasVertex(t, r))
+                continue;
+            d = std::min(d, point_triangle_distance(m_positions[v], m_positions[m_triangles[t * 3]],
+                                                    m_positions[m_triangles[t * 3 + 1]], m_positions[m_triangles[t * 3 + 2]]));
+        }
+
+        if (d != FLT_MAX)
+        {
+            m_vertex_error[r] = std::max(m_vertex_error[r], d);
+            m_max_error = std::max(m_max_error, d);
+        }
+    }
+
+    return m_max_error;
+}
+
+void MeshSimplifier::GetIndices(std::vector<unsigned int>& indices) const
+{
+    indices.clear();
+
+    for (size_t t = 0; t < m_triangle_alive.size(); t++)
+    {
+        if (m_triangle_alive[t])
+            indices.insert(indices.end(), &m_triangles[t * 3], &m_triangles[t * 3] + 3);
+    }
+}
@@ -0,0 +1,800 @@
+#include "vskeleton.h"
+#include "vjobs.h"
+#include "vsimd.h"
+
+#include <string.h>
+#include <chrono>
+
+static void to_joint_pose(const VBM_JOINT_POSE& in, JointPose& out)
+{
+    out.rotation = vmath::vec4(in.rotation.x, in.rotation.y, in.rotation.z, in.rotation.w);
+    out.translation = vmath::vec4(in.translation.x, in.translation.y, in.translation.z, 0.0f);
+    out.scale = vmath::vec4(in.scale.x, in.scale.y, in.scale.z, 0.0f);
+}
+
+#if defined(VMATH_SSE2)
+// a . b in every lane
+static inline __m128 dot4(__m128 a, __m128 b)
+{
+    __m128 m = _mm_mul_ps(a, b);
+
+    m = _mm_add_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    return _mm_add_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+}
+
+// a x b, with a w of zero
+static inline __m128 cross3(__m128 a, __m128 b)
+{
+    const __m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+    const __m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+    const __m128 c = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+
+    return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+static inline __m128 splat(__m128 a, int lane)
+{
+    switch (lane)
+    {
+        case 0: return _mm_shuffle_ps(a, a, _MM_SHUFFLE(0, 0, 0, 0));
+        case 1: return _mm_shuffle_ps(a, a, _MM_SHUFFLE(1, 1, 1, 1));
+        case 2: return _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 2, 2, 2));
+        default: return _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+}
+#endif
+
+// Interpolates two joint poses, taking the rotation the short way round
+static inline void interpolate(const JointPose& a, const JointPose& b, float t, bool slerp, JointPose& out)
+{
+#if defined(VMATH_SSE2)
+    const __m128 q0 = _mm_loadu_ps(&a.rotation[0]);
+    __m128 q1 = _mm_loadu_ps(&b.rotation[0]);
+    __m128 d = dot4(q0, q1);
+    const __m128 sign = _mm_and_ps(d, _mm_set1_ps(-0.0f));
+    __m128 w0 = _mm_set1_ps(1.0f - t);
+    __m128 w1 = _mm_set1_ps(t);
+
+    q1 = _mm_xor_ps(q1, sign);
+    d = _mm_xor_ps(d, sign);
+
+    if (slerp)
+    {
+        const float cos_theta = _mm_cvtss_f32(d);
+
+        // Nearly parallel; the lerp is as good and sinf(theta) is tiny
+        if (cos_theta < 0.9995f)
+        {
+            const float theta = acosf(cos_theta);
+            const float s = 1.0f / sinf(theta);
+
+            w0 = _mm_set1_ps(sinf((1.0f - t) * theta) * s);
+            w1 = _mm_set1_ps(sinf(t * theta) * s);
+        }
+    }
+
+    __m128 q = _mm_add_ps(_mm_mul_ps(q0, w0), _mm_mul_ps(q1, w1));
+    q = _mm_div_ps(q, _mm_sqrt_ps(dot4(q, q)));
+    _mm_storeu_ps(&out.rotation[0], q);
+
+    const __m128 vt = _mm_set1_ps(t);
+    const __m128 t0 = _mm_loadu_ps(&a.translation[0]);
+    const __m128 s0 = _mm_loadu_ps(&a.scale[0]);
+
+    _mm_storeu_ps(&out.translation[0], _mm_add_ps(t0, _mm_mul_ps(vt, _mm_sub_ps(_mm_loadu_ps(&b.translation[0]), t0))));
+    _mm_storeu_ps(&out.scale[0], _mm_add_ps(s0, _mm_mul_ps(vt, _mm_sub_ps(_mm_loadu_ps(&b.scale[0]), s0))));
+#else
+    float d = a.rotation[0] * b.rotation[0] + a.rotation[1] * b.rotation[1] +
+              a.rotation[2] * b.rotation[2] + a.rotation[3] * b.rotation[3];
+    float sign = 1.0f;
+    float w0 = 1.0f - t;
+    float w1 = t;
+    float length = 0.0f;
+    int i;
+
+    if (d < 0.0f)
+    {
+        sign = -1.0f;
+        d = -d;
+    }
+
+    if (slerp && d < 0.9995f)
+    {
+        const float theta = acosf(d);
+        const float s = 1.0f / sinf(theta);
+
+        w0 = sinf((1.0f - t) * theta) * s;
+        w1 = sinf(t * theta) * s;
+    }
+
+    for (i = 0; i < 4; i++)
+    {
+        out.rotation[i] = a.rotation[i] * w0 + b.rotation[i] * sign * w1;
+        length += out.rotation[i] * out.rotation[i];
+    }
+
+    length = sqrtf(length);
+    for (i = 0; i < 4; i++)
+    {
+        out.rotation[i] /= length;
+        out.translation[i] = a.translation[i] + t * (b.translation[i] - a.translation[i]);
+        out.scale[i] = a.scale[i] + t * (b.scale[i] - a.scale[i]);
+    }
+#endif
+}
+
+// Column major matrix of a joint pose: translate * rotate * scale
+static inline void pose_to_matrix(const JointPose& pose, float * m)
+{
+    const float x = pose.rotation[0];
+    const float y = pose.rotation[1];
+    const float z = pose.rotation[2];
+    const float w = pose.rotation[3];
+    const float sx = pose.scale[0];
+    const float sy = pose.scale[1];
+    const float sz = pose.scale[2];
+
+    m[0] = (1.0f - 2.0f * (y * y + z * z)) * sx;
+    m[1] = 2.0f * (x * y + w * z) * sx;
+    m[2] = 2.0f * (x * z - w * y) * sx;
+    m[3] = 0.0f;
+
+    m[4] = 2.0f * (x * y - w * z) * sy;
+    m[5] = (1.0f - 2.0f * (x * x + z * z)) * sy;
+    m[6] = 2.0f * (y * z + w * x) * sy;
+    m[7] = 0.0f;
+
+    m[8] = 2.0f * (x * z + w * y) * sz;
+    m[9] = 2.0f * (y * z - w * x) * sz;
+    m[10] = (1.0f - 2.0f * (x * x + y * y)) * sz;
+    m[11] = 0.0f;
+
+    m[12] = pose.translation[0];
+    m[13] = pose.translation[1];
+    m[14] = pose.translation[2];
+    m[15] = 1.0f;
+}
+
+// out = a * b, all column major. 'out' may not alias either input.
+static inline void multiply_matrices(const float * a, const float * b, float * out)
+{
+#if defined(VMATH_SSE2)
+    const __m128 a0 = _mm_loadu_ps(a);
+    const __m128 a1 = _mm_loadu_ps(a + 4);
+    const __m128 a2 = _mm_loadu_ps(a + 8);
+    const __m128 a3 = _mm_loadu_ps(a + 12);
+    int i;
+
+    for (i = 0; i < 4; i++)
+    {
+        const __m128 column = _mm_loadu_ps(b + i * 4);
+
+        _mm_storeu_ps(out + i * 4, _mm_add_ps(_mm_add_ps(_mm_mul_ps(a0, splat(column, 0)), _mm_mul_ps(a1, splat(column, 1))),
+                                              _mm_add_ps(_mm_mul_ps(a2, splat(column, 2)), _mm_mul_ps(a3, splat(column, 3)))));
+    }
+#else
+    int i, j;
+
+    for (i = 0; i < 4; i++)
+    {
+        for (j = 0; j < 4; j++)
+            out[i * 4 + j] = a[j] * b[i * 4] + a[4 + j] * b[i * 4 + 1] + a[8 + j] * b[i * 4 + 2] + a[12 + j] * b[i * 4 + 3];
+    }
+#endif
+}
+
+Skeleton::Skeleton(void)
+{
+}
+
+Skeleton::~Skeleton(void)
+{
+    Free();
+}
+
+bool Skeleton::Initialize(const VBObject& object)
+{
+    unsigned int i;
+
+    if (object.GetJointCount() == 0 || !Initialize(object.GetJoints(), object.GetJointCount()))
+        return false;
+
+    for (i = 0; i < object.GetClipCount(); i++)
+    {
+        const VBM_CLIP_HEADER& clip = object.GetClip(i);
+
+        AddClip(clip.name, clip.duration, object.GetClipKeys(i), clip.num_keys);
+    }
+
+    return true;
+}
+
+bool Skeleton::Initialize(const VBM_JOINT * joints, unsigned int count)
+{
+    unsigned int i;
+
+    Free();
+
+    if (count == 0 || count > SKELETON_MAX_JOINTS)
+        return false;
+
+    // The hierarchy is walked in order, so parents must come first
+    for (i = 0; i < count; i++)
+    {
+        if (joints[i].parent >= (int)i)
+            return false;
+    }
+
+    m_parents.resize(count);
+    m_names.resize(count);
+    m_bind_pose.resize(count);
+    m_inverse_bind.resize(count);
+
+    for (i = 0; i < count; i++)
+    {
+        m_parents[i] = joints[i].parent < 0 ? -1 : joints[i].parent;
+        memcpy(m_names[i].name, joints[i].name, sizeof(m_names[i].name));
+        m_names[i].name[sizeof(m_names[i].name) - 1] = 0;
+        to_joint_pose(joints[i].bind_pose, m_bind_pose[i]);
+        memcpy(&m_inverse_bind[i][0][0], joints[i].inverse_bind, sizeof(joints[i].inverse_bind));
+    }
+
+    return true;
+}
+
+void Skeleton::Free(void)
+{
+    m_parents.clear();
+    m_names.clear();
+    m_bind_pose.clear();
+    m_inverse_bind.clear();
+    m_clips.clear();
+    m_keys.clear();
+}
+
+unsigned int Skeleton::AddClip(const char * name, float duration, const VBM_JOINT_POSE * keys, unsigned int key_count)
+{
+    const unsigned int joint_count = GetJointCount();
+    Clip clip;
+    unsigned int i;
+
+    memset(&clip, 0, sizeof(clip));
+    strncpy(clip.name.name, name, sizeof(clip.name.name) - 1);
+    clip.duration = duration;
+    clip.key_count = key_count;
+    clip.first_key = (unsigned int)m_keys.size();
+
+    m_keys.resize(m_keys.size() + key_count * joint_count);
+    for (i = 0; i < key_count * joint_count; i++)
+        to_joint_pose(keys[i], m_keys[clip.first_key + i]);
+
+    m_clips.push_back(clip);
+
+    return (unsigned int)m_clips.size() - 1;
+}
+
+int Skeleton::FindClip(const char * name) const
+{
+    unsigned int i;
+
+    for (i = 0; i < m_clips.size(); i++)
+    {
+        if (strncmp(m_clips[i].name.name, name, sizeof(m_clips[i].name.name)) == 0)
+            return (int)i;
+    }
+
+    return -1;
+}
+
+void Skeleton::GetBindPose(JointPose * local) const
+{
+    unsigned int i;
+
+    for (i = 0; i < m_bind_pose.size(); i++)
+        local[i] = m_bind_pose[i];
+}
+
+void Skeleton::Sample(unsigned int clip, float time, JointPose * local, SkeletonInterpolation interpolation) const
+{
+    const Clip& c = m_clips[clip];
+    const unsigned int joint_count = GetJointCount();
+    unsigned int i;
+
+    if (c.key_count < 2 || c.duration <= 0.0f)
+    {
+        if (c.key_count == 0)
+            GetBindPose(local);
+        else
+            for (i = 0; i < joint_count; i++)
+                local[i] = m_keys[c.first_key + i];
+        return;
+    }
+
+    time = fmodf(time, c.duration);
+    if (time < 0.0f)
+        time += c.duration;
+
+    const float position = time / c.duration * float(c.key_count - 1);
+    unsigned int key = (unsigned int)position;
+
+    if (key > c.key_count - 2)
+        key = c.key_count - 2;
+
+    const float t = position - float(key);
+    const JointPose * a = &m_keys[c.first_key + key * joint_count];
+    const JointPose * b = a + joint_count;
+    const bool slerp = interpolation == SKELETON_SLERP;
+
+    for (i = 0; i < joint_count; i++)
+        interpolate(a[i], b[i], t, slerp, local[i]);
+}
+
+void Skeleton::Blend(const JointPose * a, const JointPose * b, float t, JointPose * out) const
+{
+    const unsigned int joint_count = GetJointCount();
+    unsigned int i;
+
+    for (i = 0; i < joint_count; i++)
+        interpolate(a[i], b[i], t, false, out[i]);
+}
+
+void Skeleton::ComputeSkinningMatrices(const JointPose * local, vmath::mat4 * palette) const
+{
+    const unsigned int joint_count = GetJointCount();
+    VMATH_ALIGN(16) float model[SKELETON_MAX_JOINTS][16];
+    VMATH_ALIGN(16) float matrix[16];
+    unsigned int i;
+
+    for (i = 0; i < joint_count; i++)
+    {
+        const int parent = m_parents[i];
+
+        if (parent < 0)
+        {
+            pose_to_matrix(local[i], model[i]);
+        }
+        else
+        {
+            pose_to_matrix(local[i], matrix);
+            multiply_matrices(model[parent], matrix, model[i]);
+        }
+
+        multiply_matrices(model[i], &m_inverse_bind[i][0][0], &palette[i][0][0]);
+    }
+}
+
+void Skeleton::ToDualQuaternions(const vmath::mat4 * palette, DualQuaternion * dual_quaternions, unsigned int count)
+{
+    unsigned int i;
+
+    for (i = 0; i < count; i++)
+    {
+        const vmath::mat4& m = palette[i];
+        float r[3][3];
+        float q[4];
+        int column, row;
+
+        // Rotation part with any scale divided out. r[row][column].
+        for (column = 0; column < 3; column++)
+        {
+            const float length = sqrtf(m[column][0] * m[column][0] + m[column][1] * m[column][1] + m[column][2] * m[column][2]);
+            const float scale = length > 0.0f ? 1.0f / length : 0.0f;
+
+            for (row = 0; row < 3; row++)
+                r[row][column] = m[column][row] * scale;
+        }
+
+        // Shepperd's method, dividing by the largest of the four candidates
+        const float trace = r[0][0] + r[1][1] + r[2][2];
+
+        if (trace > 0.0f)
+        {
+            const float s = sqrtf(trace + 1.0f) * 2.0f;
+            q[3] = 0.25f * s;
+            q[0] = (r[2][1] - r[1][2]) / s;
+            q[1] = (r[0][2] - r[2][0]) / s;
+            q[2] = (r[1][0] - r[0][1]) / s;
+        }
+        else if (r[0][0] > r[1][1] && r[0][0] > r[2][2])
+        {
+            const float s = sqrtf(1.0f + r[0][0] - r[1][1] - r[2][2]) * 2.0f;
+            q[3] = (r[2][1] - r[1][2]) / s;
+            q[0] = 0.25f * s;
+            q[1] = (r[0][1] + r[1][0]) / s;
+            q[2] = (r[0][2] + r[2][0]) / s;
+        }
+        else if (r[1][1] > r[2][2])
+        {
+            const float s = sqrtf(1.0f + r[1][1] - r[0][0] - r[2][2]) * 2.0f;
+            q[3] = (r[0][2] - r[2][0]) / s;
+            q[0] = (r[0][1] + r[1][0]) / s;
+            q[1] = 0.25f * s;
+            q[2] = (r[1][2] + r[2][1]) / s;
+        }
+        else
+        {
+            const float s = sqrtf(1.0f + r[2][2] - r[0][0] - r[1][1]) * 2.0f;
+            q[3] = (r[1][0] - r[0][1]) / s;
+            q[0] = (r[0][2] + r[2][0]) / s;
+            q[1] = (r[1][2] + r[2][1]) / s;
+            q[2] = 0.25f * s;
+        }
+
+        // dual = (t, 0) * real / 2
+        const float tx = m[3][0];
+        const float ty = m[3][1];
+        const float tz = m[3][2];
+
+        dual_quaternions[i].real = vmath::vec4(q[0], q[1], q[2], q[3]);
+        dual_quaternions[i].dual = vmath::vec4(0.5f * (q[3] * tx + ty * q[2] - tz * q[1]),
+                                               0.5f * (q[3] * ty + tz * q[0] - tx * q[2]),
+                                               0.5f * (q[3] * tz + tx * q[1] - ty * q[0]),
+                                               -0.5f * (tx * q[0] + ty * q[1] + tz * q[2]));
+    }
+}
+
+bool SkinnedMesh::FromVBM(const VBObject& object)
+{
+    const int normal = object.FindAttribute("normal");
+    const int joint = object.FindAttribute("joints");
+    const int weight = object.FindAttribute("weights");
+
+    if (joint < 0 || weight < 0 ||
+        object.GetAttributeComponents((unsigned int)joint) != 4 ||
+        object.GetAttributeComponents((unsigned int)weight) != 4)
+        return false;
+
+    positions = object.GetAttributeData(0);
+    position_components = object.GetAttributeComponents(0);
+    normals = normal >= 0 && object.GetAttributeComponents((unsigned int)normal) == 3 ? object.GetAttributeData((unsigned int)normal) : NULL;
+    joints = object.GetAttributeData((unsigned int)joint);
+    weights = object.GetAttributeData((unsigned int)weight);
+    vertex_count = object.GetAttributeVertexCount();
+
+    return positions != NULL && position_components >= 3;
+}
+
+void SkinLinear(const SkinnedMesh& mesh, const vmath::mat4 * palette, vmath::vec4 * out)
+{
+    unsigned int i;
+    int j;
+
+    for (i = 0; i < mesh.vertex_count; i++)
+    {
+        const float * p = mesh.positions + i * mesh.position_components;
+        const float * n = mesh.normals != NULL ? mesh.normals + i * 3 : NULL;
+        const float * joints = mesh.joints + i * 4;
+        const float * weights = mesh.weights + i * 4;
+
+#if defined(VMATH_SSE2)
+        __m128 c0 = _mm_setzero_ps();
+        __m128 c1 = _mm_setzero_ps();
+        __m128 c2 = _mm_setzero_ps();
+        __m128 c3 = _mm_setzero_ps();
+
+        // Blend the matrices, then transform once
+        for (j = 0; j < 4; j++)
+        {
+            if (weights[j] == 0.0f)
+                continue;
+
+            const float * m = &palette[(int)joints[j]][0][0];
+            const __m128 w = _mm_set1_ps(weights[j]);
+
+            c0 = _mm_add_ps(c0, _mm_mul_ps(w, _mm_loadu_ps(m)));
+            c1 = _mm_add_ps(c1, _mm_mul_ps(w, _mm_loadu_ps(m + 4)));
+            c2 = _mm_add_ps(c2, _mm_mul_ps(w, _mm_loadu_ps(m + 8)));
+            c3 = _mm_add_ps(c3, _mm_mul_ps(w, _mm_loadu_ps(m + 12)));
+        }
+
+        _mm_storeu_ps(&out[i * 2][0], _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(p[0])), _mm_mul_ps(c1, _mm_set1_ps(p[1]))),
+                                                 _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(p[2])), c3)));
+
+        if (n != NULL)
+            _mm_storeu_ps(&out[i * 2 + 1][0], _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(n[0])), _mm_mul_ps(c1, _mm_set1_ps(n[1]))),
+                                                         _mm_mul_ps(c2, _mm_set1_ps(n[2]))));
+        else
+            _mm_storeu_ps(&out[i * 2 + 1][0], _mm_setzero_ps());
+#else
+        float m[16] = { 0.0f };
+        int k;
+
+        for (j = 0; j < 4; j++)
+        {
+            if (weights[j] == 0.0f)
+                continue;
+
+            const float * joint = &palette[(int)joints[j]][0][0];
+
+            for (k = 0; k < 16; k++)
+                m[k] += weights[j] * joint[k];
+        }
+
+        for (k = 0; k < 4; k++)
+        {
+            out[i * 2][k] = m[k] * p[0] + m[4 + k] * p[1] + m[8 + k] * p[2] + m[12 + k];
+            out[i * 2 + 1][k] = n != NULL ? m[k] * n[0] + m[4 + k] * n[1] + m[8 + k] * n[2] : 0.0f;
+        }
+#endif
+    }
+}
+
+void SkinDualQuaternion(const SkinnedMesh& mesh, const DualQuaternion * palette, vmath::vec4 * out)
+{
+    unsigned int i;
+    int j;
+
+    for (i = 0; i < mesh.vertex_count; i++)
+    {
+        const float * p = mesh.positions + i * mesh.position_components;
+        const float * n = mesh.normals != NULL ? mesh.normals + i * 3 : NULL;
+        const float * joints = mesh.joints + i * 4;
+        const float * weights = mesh.weights + i * 4;
+        const DualQuaternion& pivot = palette[(int)joints[0]];
+
+#if defined(VMATH_SSE2)
+        const __m128 pivot_real = _mm_loadu_ps(&pivot.real[0]);
+        __m128 real = _mm_setzero_ps();
+        __m128 dual = _mm_setzero_ps();
+
+        // Blend in the same hemisphere as the first joint, so that q and -q
+        // (the same rotation) don't cancel out
+        for (j = 0; j < 4; j++)
+        {
+            if (weights[j] == 0.0f)
+                continue;
+
+            const DualQuaternion& q = palette[(int)joints[j]];
+            const __m128 r = _mm_loadu_ps(&q.real[0]);
+            const __m128 sign = _mm_and_ps(dot4(r, pivot_real), _mm_set1_ps(-0.0f));
+            const __m128 w = _mm_xor_ps(_mm_set1_ps(weights[j]), sign);
+
+            real = _mm_add_ps(real, _mm_mul_ps(w, r));
+            dual = _mm_add_ps(dual, _mm_mul_ps(w, _mm_loadu_ps(&q.dual[0])));
+        }
+
+        const __m128 length = _mm_sqrt_ps(dot4(real, real));
+        real = _mm_div_ps(real, length);
+        dual = _mm_div_ps(dual, length);
+
+        const __m128 two = _mm_set1_ps(2.0f);
+        const __m128 real_w = splat(real, 3);
+        const __m128 translation = _mm_mul_ps(two, _mm_add_ps(_mm_sub_ps(_mm_mul_ps(real_w, dual), _mm_mul_ps(splat(dual, 3), real)),
+                                                               cross3(real, dual)));
+        const __m128 position = _mm_setr_ps(p[0], p[1], p[2], 0.0f);
+        const __m128 rotated = _mm_add_ps(position, _mm_mul_ps(two, cross3(real, _mm_add_ps(cross3(real, position), _mm_mul_ps(real_w, position)))));
+
+        _mm_storeu_ps(&out[i * 2][0], _mm_add_ps(_mm_add_ps(rotated, translation), _mm_setr_ps(0.0f, 0.0f, 0.0f, 1.0f)));
+
+        if (n != NULL)
+        {
+            const __m128 normal = _mm_setr_ps(n[0], n[1], n[2], 0.0f);
+            _mm_storeu_ps(&out[i * 2 + 1][0], _mm_add_ps(normal, _mm_mul_ps(two, cross3(real, _mm_add_ps(cross3(real, normal), _mm_mul_ps(real_w, normal))))));
+        }
+        else
+        {
+            _mm_storeu_ps(&out[i * 2 + 1][0], _mm_setzero_ps());
+        }
+#else
+        float real[4] = { 0.0f };
+        float dual[4] = { 0.0f };
+        int k;
+
+        for (j = 0; j < 4; j++)
+        {
+            if (weights[j] == 0.0f)
+                continue;
+
+            const DualQuaternion& q = palette[(int)joints[j]];
+            const float d = q.real[0] * pivot.real[0] + q.real[1] * pivot.real[1] + q.real[2] * pivot.real[2] + q.real[3] * pivot.real[3];
+            const float w = d < 0.0f ? -weights[j] : weights[j];
+
+            for (k = 0; k < 4; k++)
+            {
+                real[k] += w * q.real[k];
+                dual[k] += w * q.dual[k];
+            }
+        }
+
+        const float length = sqrtf(real[0] * real[0] + real[1] * real[1] + real[2] * real[2] + real[3] * real[3]);
+
+        for (k = 0; k < 4; k++)
+        {
+            real[k] /= length;
+            dual[k] /= length;
+        }
+
+        const vmath::vec3 r(real[0], real[1], real[2]);
+        const vmath::vec3 d(dual[0], dual[1], dual[2]);
+        const vmath::vec3 translation = (d * real[3] - r * dual[3] + vmath::cross(r, d)) * 2.0f;
+        const vmath::vec3 position(p[0], p[1], p[2]);
+        const vmath::vec3 rotated = position + vmath::cross(r, vmath::cross(r, position) + position * real[3]) * 2.0f;
+
+        out[i * 2] = vmath::vec4(rotated + translation, 1.0f);
+
+        if (n != NULL)
+        {
+            const vmath::vec3 normal(n[0], n[1], n[2]);
+            out[i * 2 + 1] = vmath::vec4(normal + vmath::cross(r, vmath::cross(r, normal) + normal * real[3]) * 2.0f, 0.0f);
+        }
+        else
+        {
+            out[i * 2 + 1] = vmath::vec4(0.0f);
+        }
+#endif
+    }
+}
+
+CrowdAnimator::CrowdAnimator(void)
+    : m_skeleton(NULL),
+      m_mesh(NULL),
+      m_max_characters(0),
+      m_count(0),
+      m_method(SKINNING_LINEAR),
+      m_skinned_on_cpu(false),
+      m_palette_buffer(0),
+      m_vertex_buffer(0)
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+CrowdAnimator::~CrowdAnimator(void)
+{
+    Free();
+}
+
+bool CrowdAnimator::Initialize(const Skeleton * skeleton, const SkinnedMesh * mesh, unsigned int max_characters,
+                               bool create_buffers)
+{
+    Free();
+
+    const unsigned int joint_count = skeleton->GetJointCount();
+
+    m_skeleton = skeleton;
+    m_mesh = mesh;
+    m_max_characters = max_characters;
+
+    m_matrices.resize(max_characters * joint_count);
+    m_dual_quaternions.resize(max_characters * joint_count);
+    if (mesh != NULL)
+        m_vertices.resize(max_characters * mesh->vertex_count * 2);
+
+    if (!create_buffers)
+        return true;
+
+    // Room for whichever palette is bigger
+    glGenBuffers(1, &m_palette_buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_palette_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, max_characters * joint_count * sizeof(vmath::mat4), NULL, GL_STREAM_DRAW);
+
+    if (mesh != NULL)
+    {
+        glGenBuffers(1, &m_vertex_buffer);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_vertex_buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, m_vertices.size() * sizeof(vmath::vec4), NULL, GL_STREAM_DRAW);
+    }
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    return true;
+}
+
+void CrowdAnimator::Free(void)
+{
+    if (m_palette_buffer != 0)
+        glDeleteBuffers(1, &m_palette_buffer);
+    m_palette_buffer = 0;
+    if (m_vertex_buffer != 0)
+        glDeleteBuffers(1, &m_vertex_buffer);
+    m_vertex_buffer = 0;
+
+    m_matrices.clear();
+    m_dual_quaternions.clear();
+    m_vertices.clear();
+
+    m_skeleton = NULL;
+    m_mesh = NULL;
+    m_max_characters = 0;
+    m_count = 0;
+}
+
+void CrowdAnimator::Update(JobSystem& jobs, const CharacterState * characters, unsigned int count,
+                           SkinningMethod method, bool skin_on_cpu, SkeletonInterpolation interpolation)
+{
+    const unsigned int joint_count = m_skeleton->GetJointCount();
+    const bool dual_quaternions = method == SKINNING_DUAL_QUATERNION;
+
+    if (count > m_max_characters)
+        count = m_max_characters;
+    if (m_mesh == NULL)
+        skin_on_cpu = false;
+
+    m_count = count;
+    m_method = method;
+    m_skinned_on_cpu = skin_on_cpu;
+
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+    // Each character's hierarchy is walked in order, but the characters
+    // are independent
+    jobs.ParallelFor(count, 16, [&](unsigned int begin, unsigned int end)
+    {
+        JointPose local[SKELETON_MAX_JOINTS];
+        unsigned int i;
+
+        for (i = begin; i < end; i++)
+        {
+            vmath::mat4 * palette = &m_matrices[i * joint_count];
+
+            m_skeleton->Sample(characters[i].clip, characters[i].time, local, interpolation);
+            m_skeleton->ComputeSkinningMatrices(local, palette);
+            if (dual_quaternions)
+                Skeleton::ToDualQuaternions(palette, &m_dual_quaternions[i * joint_count], joint_count);
+        }
+    });
+
+    std::chrono::high_resolution_clock::time_point evaluated = std::chrono::high_resolution_clock::now();
+
+    if (skin_on_cpu)
+    {
+        const unsigned int vertex_count = m_mesh->vertex_count;
+
+        jobs.ParallelFor(count, 1, [&](unsigned int begin, unsigned int end)
+        {
+            unsigned int i;
+
+            for (i = begin; i < end; i++)
+            {
+                if (dual_quaternions)
+                    SkinDualQuaternion(*m_mesh, &m_dual_quaternions[i * joint_count], &m_vertices[i * vertex_count * 2]);
+                else
+                    SkinLinear(*m_mesh, &m_matrices[i * joint_count], &m_vertices[i * vertex_count * 2]);
+            }
+        });
+    }
+
+    std::chrono::high_resolution_clock::time_point skinned = std::chrono::high_resolution_clock::now();
+
+    m_stats.characters = count;
+    m_stats.joints = joint_count;
+    m_stats.vertices = skin_on_cpu ? m_mesh->vertex_count : 0;
+    m_stats.evaluate_time = std::chrono::duration<float, std::micro>(evaluated - start).count();
+    m_stats.skinning_time = std::chrono::duration<float, std::micro>(skinned - evaluated).count();
+    m_stats.characters_per_ms = m_stats.evaluate_time + m_stats.skinning_time > 0.0f ?
+                                float(count) * 1000.0f / (m_stats.evaluate_time + m_stats.skinning_time) : 0.0f;
+}
+
+void CrowdAnimator::Upload(void)
+{
+    if (m_palette_buffer == 0)
+        return;
+
+    const unsigned int joint_count = m_skeleton->GetJointCount();
+
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+    // Orphan the old contents so the upload doesn't wait for draws still
+    // reading them
+    if (m_skinned_on_cpu)
+    {
+        const GLsizeiptr size = m_count * m_mesh->vertex_count * 2 * sizeof(vmath::vec4);
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_vertex_buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, m_vertices.size() * sizeof(vmath::vec4), NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size, &m_vertices[0]);
+    }
+    else
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_palette_buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, m_matrices.size() * sizeof(vmath::mat4), NULL, GL_STREAM_DRAW);
+        if (m_method == SKINNING_DUAL_QUATERNION)
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, m_count * joint_count * sizeof(DualQuaternion), &m_dual_quaternions[0]);
+        else
+            glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, m_count * joint_count * sizeof(vmath::mat4), &m_matrices[0]);
+    }
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    m_stats.upload_time = std::chrono::duration<float, std::micro>(std::chrono::high_resolution_clock::now() - start).count();
+}
@@ -0,0 +1,635 @@
+#include "vsort.h"
+#include "vjobs.h"
+#include "vsimd.h"
+#include "vutils.h"
+
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+using namespace vmath;
+
+// Keys of the view space depths, sprite indices alongside
+static const char depth_source[] =
+    "#version 430 core\n"
+    "\n"
+    "layout (local_size_x = 256) in;\n"
+    "\n"
+    "layout (std430, binding = 3) writeonly buffer KEYS\n"
+    "{\n"
+    "    uint keys[];\n"
+    "};\n"
+    "\n"
+    "layout (std430, binding = 4) writeonly buffer VALUES\n"
+    "{\n"
+    "    uint values[];\n"
+    "};\n"
+    "\n"
+    "layout (std430, binding = 5) readonly buffer POSITIONS\n"
+    "{\n"
+    "    vec4 positions[];\n"
+    "};\n"
+    "\n"
+    "uniform vec4 depth_row;\n"
+    "uniform uint count;\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    uint i = gl_GlobalInvocationID.x;\n"
+    "\n"
+    "    if (i >= count)\n"
+    "        return;\n"
+    "\n"
+    "    uint bits = floatBitsToUint(dot(depth_row, positions[i]));\n"
+    "\n"
+    "    keys[i] = bits ^ ((bits & 0x80000000u) != 0u ? 0xFFFFFFFFu : 0x80000000u);\n"
+    "    values[i] = i;\n"
+    "}\n";
+
+// Counts the digits of each workgroup's keys. The counts are stored digit
+// by digit, so that an exclusive scan over the whole array gives each
+// workgroup the first place of each of its digits.
+static const char count_source[] =
+    "#version 430 core\n"
+    "\n"
+    "layout (local_size_x = 256) in;\n"
+    "\n"
+    "layout (std430, binding = 0) readonly buffer KEYS\n"
+    "{\n"
+    "    uint keys[];\n"
+    "};\n"
+    "\n"
+    "layout (std430, binding = 2) writeonly buffer HISTOGRAM\n"
+    "{\n"
+    "    uint histogram[];\n"
+    "};\n"
+    "\n"
+    "uniform uint count;\n"
+    "uniform uint shift;\n"
+    "\n"
+    "shared uint local_histogram[16];\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    uint i = gl_GlobalInvocationID.x;\n"
+    "    uint t = gl_LocalInvocationIndex;\n"
+    "\n"
+    "    if (t < 16u)\n"
+    "        local_histogram[t] = 0u;\n"
+    "    barrier();\n"
+    "\n"
+    "    if (i < count)\n"
+    "        atomicAdd(local_histogram[(keys[i] >> shift) & 15u], 1u);\n"
+    "    barrier();\n"
+    "\n"
+    "    if (t < 16u)\n"
+    "        histogram[t * gl_NumWorkGroups.x + gl_WorkGroupID.x] = local_histogram[t];\n"
+    "}\n";
+
+// Exclusive scan of the histogram in place by a single workgroup. Each
+// thread sums a contiguous run, the run totals are scanned in shared
+// memory, then each thread writes out its run.
+static const char scan_source[] =
+    "#version 430 core\n"
+    "\n"
+    "layout (local_size_x = 1024) in;\n"
+    "\n"
+    "layout (std430, binding = 2) buffer HISTOGRAM\n"
+    "{\n"
+    "    uint histogram[];\n"
+    "};\n"
+    "\n"
+    "uniform uint size;\n"
+    "\n"
+    "shared uint partial[1024];\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    uint t = gl_LocalInvocationIndex;\n"
+    "    uint run = (size + 1023u) / 1024u;\n"
+    "    uint begin = min(t * run, size);\n"
+    "    uint end = min(begin + run, size);\n"
+    "    uint sum = 0u;\n"
+    "    uint i;\n"
+    "\n"
+    "    for (i = begin; i < end; i++)\n"
+    "        sum += histogram[i];\n"
+    "\n"
+    "    partial[t] = sum;\n"
+    "    barrier();\n"
+    "\n"
+    "    for (uint offset = 1u; offset < 1024u; offset <<= 1)\n"
+    "    {\n"
+    "        uint v = t >= offset ? partial[t - offset] : 0u;\n"
+    "        barrier();\n"
+    "        partial[t] += v;\n"
+    "        barrier();\n"
+    "    }\n"
+    "\n"
+    "    uint running = partial[t] - sum;\n"
+    "\n"
+    "    for (i = begin; i < end; i++)\n"
+    "    {\n"
+    "        uint v = histogram[i];\n"
+    "        histogram[i] = running;\n"
+    "        running += v;\n"
+    "    }\n"
+    "}\n";
+
+// Moves each key to its workgroup's place for its digit plus its rank
+// among the keys of the workgroup with that digit, which keeps the sort
+// stable. The ranks come from a scan of one-hot digit counters, sixteen
+// 16-bit counters packed into two uvec4s per thread.
+static const char scatter_source[] =
+    "#version 430 core\n"
+    "\n"
+    "layout (local_size_x = 256) in;\n"
+    "\n"
+    "layout (std430, binding = 0) readonly buffer KEYS_IN\n"
+    "{\n"
+    "    uint keys_in[];\n"
+    "};\n"
+    "\n"
+    "layout (std430, binding = 1) readonly buffer VALUES_IN\n"
+    "{\n"
+    "    uint values_in[];\n"
+    "};\n"
+    "\n"
+    "layout (std430, binding = 2) readonly buffer HISTOGRAM\n"
+    "{\n"
+    "    uint histogram[];\n"
+    "};\n"
+    "\n"
+    "layout (std430, binding = 3) writeonly buffer KEYS_OUT\n"
+    "{\n"
+    "    uint keys_out[];\n"
+    "};\n"
+    "\n"
+    "layout (std430, binding = 4) writeonly buffer VALUES_OUT\n"
+    "{\n"
+    "    uint values_out[];\n"
+    "};\n"
+    "\n"
+    "uniform uint count;\n"
+    "uniform uint shift;\n"
+    "\n"
+    "shared uvec4 counts_lo[256];\n"
+    "shared uvec4 counts_hi[256];\n"
+    "\n"
+    "void main(void)\n"
+    "{\n"
+    "    uint i = gl_GlobalInvocationID.x;\n"
+    "    uint t = gl_LocalInvocationIndex;\n"
+    "    uint key = 0u;\n"
+    "    uint value = 0u;\n"
+    "    uint digit = 16u;\n"
+    "    uvec4 lo = uvec4(0u);\n"
+    "    uvec4 hi = uvec4(0u);\n"
+    "\n"
+    "    if (i < count)\n"
+    "    {\n"
+    "        key = keys_in[i];\n"
+    "        value = values_in[i];\n"
+    "        digit = (key >> shift) & 15u;\n"
+    "\n"
+    "        if (digit < 8u)\n"
+    "            lo[digit >> 1] = 1u << ((digit & 1u) * 16u);\n"
+    "        else\n"
+    "            hi[(digit >> 1) & 3u] = 1u << ((digit & 1u) * 16u);\n"
+    "    }\n"
+    "\n"
+    "    counts_lo[t] = lo;\n"
+    "    counts_hi[t] = hi;\n"
+    "    barrier();\n"
+    "\n"
+    "    for (uint offset = 1u; offset < 256u; offset <<= 1)\n"
+    "    {\n"
+    "        uvec4 a = uvec4(0u);\n"
+    "        uvec4 b = uvec4(0u);\n"
+    "\n"
+    "        if (t >= offset)\n"
+    "        {\n"
+    "            a = counts_lo[t - offset];\n"
+    "            b = counts_hi[t - offset];\n"
+    "        }\n"
+    "        barrier();\n"
+    "        counts_lo[t] += a;\n"
+    "        counts_hi[t] += b;\n"
+    "        barrier();\n"
+    "    }\n"
+    "\n"
+    "    if (digit < 16u)\n"
+    "    {\n"
+    "        uvec4 counts = digit < 8u ? counts_lo[t] : counts_hi[t];\n"
+    "        uint rank = ((counts[(digit >> 1) & 3u] >> ((digit & 1u) * 16u)) & 0xFFFFu) - 1u;\n"
+    "        uint destination = histogram[digit * gl_NumWorkGroups.x + gl_WorkGroupID.x] + rank;\n"
+    "\n"
+    "        keys_out[destination] = key;\n"
+    "        values_out[destination] = value;\n"
+    "    }\n"
+    "}\n";
+
+#if defined(VMATH_SSE2)
+static inline __m128i sort_keys(__m128 f)
+{
+    const __m128i bits = _mm_castps_si128(f);
+    const __m128i mask = _mm_or_si128(_mm_srai_epi32(bits, 31), _mm_set1_epi32((int)0x80000000));
+
+    return _mm_xor_si128(bits, mask);
+}
+#endif
+
+void compute_depth_keys(JobSystem& jobs, const vec4 * positions, unsigned int count,
+                        const mat4& model_view, unsigned int * keys, unsigned int * values)
+{
+    // View space z is the third row of the matrix times the position
+    const vec4 row(model_view[0][2], model_view[1][2], model_view[2][2], model_view[3][2]);
+
+    jobs.ParallelFor(count, 64 * 1024, [&](unsigned int begin, unsigned int end)
+    {
+        unsigned int i = begin;
+
+#if defined(VMATH_SSE2)
+        const __m128 r0 = _mm_set1_ps(row[0]);
+        const __m128 r1 = _mm_set1_ps(row[1]);
+        const __m128 r2 = _mm_set1_ps(row[2]);
+        const __m128 r3 = _mm_set1_ps(row[3]);
+        const __m128i step = _mm_set1_epi32(4);
+        __m128i index = _mm_add_epi32(_mm_set1_epi32((int)begin), _mm_setr_epi32(0, 1, 2, 3));
+
+        for (; i + 4 <= end; i += 4)
+        {
+            __m128 x = _mm_loadu_ps(&positions[i + 0][0]);
+            __m128 y = _mm_loadu_ps(&positions[i + 1][0]);
+            __m128 z = _mm_loadu_ps(&positions[i + 2][0]);
+            __m128 w = _mm_loadu_ps(&positions[i + 3][0]);
+
+            _MM_TRANSPOSE4_PS(x, y, z, w);
+
+            const __m128 depth = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, r0), _mm_mul_ps(y, r1)),
+                                            _mm_add_ps(_mm_mul_ps(z, r2), _mm_mul_ps(w, r3)));
+
+            _mm_storeu_si128((__m128i *)(keys + i), sort_keys(depth));
+            _mm_storeu_si128((__m128i *)(values + i), index);
+            index = _mm_add_epi32(index, step);
+        }
+#endif
+
+        for (; i < end; i++)
+        {
+            const vec4& p = positions[i];
+
+            keys[i] = float_to_sort_key(p[0] * row[0] + p[1] * row[1] + p[2] * row[2] + p[3] * row[3]);
+            values[i] = i;
+        }
+    });
+}
+
+RadixSorter::RadixSorter(void)
+    : m_passes(0)
+{
+
+}
+
+RadixSorter::~RadixSorter(void)
+{
+
+}
+
+void RadixSorter::Sort(JobSystem& jobs, unsigned int * keys, unsigned int * values, unsigned int count)
+{
+    m_passes = 0;
+
+    if (count < 2)
+        return;
+
+    if (m_keys.size() < count)
+    {
+        m_keys.resize(count);
+        m_values.resize(count);
+    }
+
+    // Blocks are fixed for the whole sort, as each pass's scatter has to
+    // walk the same ranges that were counted
+    unsigned int blocks = jobs.GetThreadCount() * BLOCKS_PER_THREAD;
+    const unsigned int max_blocks = (count + MIN_BLOCK_SIZE - 1) / MIN_BLOCK_SIZE;
+
+    if (blocks > max_blocks)
+        blocks = max_blocks;
+    if (blocks == 0)
+        blocks = 1;
+
+    const unsigned int block_size = (count + blocks - 1) / blocks;
+
+    blocks = (count + block_size - 1) / block_size;
+    m_histograms.resize(blocks * RADIX_SIZE);
+
+    unsigned int * histograms = &m_histograms[0];
+    unsigned int * source_keys = keys;
+    unsigned int * source_values = values;
+    unsigned int * dest_keys = &m_keys[0];
+    unsigned int * dest_values = &m_values[0];
+    unsigned int shift;
+
+    for (shift = 0; shift < 32; shift += RADIX_BITS)
+    {
+        jobs.ParallelFor(blocks, 1, [&](unsigned int begin, unsigned int end)
+        {
+            for (unsigned int b = begin; b < end; b++)
+            {
+                unsigned int * histogram = histograms + b * RADIX_SIZE;
+                const unsigned int last = std::min((b + 1) * block_size, count);
+
+                memset(histogram, 0, RADIX_SIZE * sizeof(unsigned int));
+                for (unsigned int i = b * block_size; i < last; i++)
+                    histogram[(source_keys[i] >> shift) & (RADIX_SIZE - 1)]++;
+            }
+        });
+
+        // Turn the counts into places: digit by digit, then block by block
+        unsigned int total = 0;
+        bool trivial = false;
+
+        for (unsigned int d = 0; d < RADIX_SIZE; d++)
+        {
+            unsigned int digit_total = 0;
+
+            for (unsigned int b = 0; b < blocks; b++)
+            {
+                const unsigned int n = histograms[b * RADIX_SIZE + d];
+
+                histograms[b * RADIX_SIZE + d] = total;
+                total += n;
+                digit_total += n;
+            }
+
+            if (digit_total == count)
+                trivial = true;
+        }
+
+        if (trivial)
+            continue;
+
+        jobs.ParallelFor(blocks, 1, [&](unsigned int begin, unsigned int end)
+        {
+            for (unsigned int b = begin; b < end; b++)
+            {
+                unsigned int * place = histograms + b * RADIX_SIZE;
+                const unsigned int last = std::min((b + 1) * block_size, count);
+
+                for (unsigned int i = b * block_size; i < last; i++)
+                {
+                    const unsigned int j = place[(source_keys[i] >> shift) & (RADIX_SIZE - 1)]++;
+
+                    dest_keys[j] = source_keys[i];
+                    dest_values[j] = source_values[i];
+                }
+            }
+        });
+
+        std::swap(source_keys, dest_keys);
+        std::swap(source_values, dest_values);
+        m_passes++;
+    }
+
+    // An odd number of passes leaves the result in the scratch arrays
+    if (source_keys != keys)
+    {
+        jobs.ParallelFor(count, 256 * 1024, [&](unsigned int begin, unsigned int end)
+        {
+            memcpy(keys + begin, source_keys + begin, (end - begin) * sizeof(unsigned int));
+            memcpy(values + begin, source_values + begin, (end - begin) * sizeof(unsigned int));
+        });
+    }
+}
+
+SpriteSorter::SpriteSorter(void)
+    : m_max_sprites(0),
+      m_position_count(0),
+      m_count(0),
+      m_use_gpu(false),
+      m_position_buffer(0),
+      m_histogram_buffer(0)
+{
+    memset(m_programs, 0, sizeof(m_programs));
+    memset(m_key_buffers, 0, sizeof(m_key_buffers));
+    memset(m_value_buffers, 0, sizeof(m_value_buffers));
+    memset(&m_uniforms, 0, sizeof(m_uniforms));
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+SpriteSorter::~SpriteSorter(void)
+{
+    Free();
+}
+
+bool SpriteSorter::Initialize(unsigned int max_sprites, bool gpu)
+{
+    static const char * const sources[PROGRAM_TOTAL] = { depth_source, count_source, scan_source, scatter_source };
+    int i;
+
+    Free();
+
+    m_max_sprites = max_sprites;
+    m_keys.resize(max_sprites);
+    m_values.resize(max_sprites);
+
+    glGenBuffers(1, &m_position_buffer);
+    glGenBuffers(2, m_key_buffers);
+    glGenBuffers(2, m_value_buffers);
+    glGenBuffers(1, &m_histogram_buffer);
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_position_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, max_sprites * sizeof(vec4), NULL, GL_STATIC_DRAW);
+
+    for (i = 0; i < 2; i++)
+    {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_value_buffers[i]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, max_sprites * sizeof(GLuint), NULL, GL_STREAM_DRAW);
+    }
+
+    if (gpu)
+    {
+        const unsigned int groups = (max_sprites + GROUP_SIZE - 1) / GROUP_SIZE;
+
+        for (i = 0; i < 2; i++)
+        {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_key_buffers[i]);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, max_sprites * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+        }
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_histogram_buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, groups * GPU_RADIX_SIZE * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+
+        for (i = 0; i < PROGRAM_TOTAL; i++)
+        {
+            GLint linked = GL_FALSE;
+
+            m_programs[i] = glCreateProgram();
+            vglAttachShaderSource(m_programs[i], GL_COMPUTE_SHADER, sources[i]);
+            glLinkProgram(m_programs[i]);
+            glGetProgramiv(m_programs[i], GL_LINK_STATUS, &linked);
+
+            if (!linked)
+            {
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+                Free();
+                return false;
+            }
+        }
+
+        m_uniforms.depth_row = glGetUniformLocation(m_programs[PROGRAM_DEPTH], "depth_row");
+        m_uniforms.depth_count = glGetUniformLocation(m_programs[PROGRAM_DEPTH], "count");
+        m_uniforms.count_count = glGetUniformLocation(m_programs[PROGRAM_COUNT], "count");
+        m_uniforms.count_shift = glGetUniformLocation(m_programs[PROGRAM_COUNT], "shift");
+        m_uniforms.scan_size = glGetUniformLocation(m_programs[PROGRAM_SCAN], "size");
+        m_uniforms.scatter_count = glGetUniformLocation(m_programs[PROGRAM_SCATTER], "count");
+        m_uniforms.scatter_shift = glGetUniformLocation(m_programs[PROGRAM_SCATTER], "shift");
+    }
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    return true;
+}
+
+void SpriteSorter::Free(void)
+{
+    int i;
+
+    for (i = 0; i < PROGRAM_TOTAL; i++)
+        glDeleteProgram(m_programs[i]);
+    memset(m_programs, 0, sizeof(m_programs));
+
+    if (m_position_buffer)
+    {
+        glDeleteBuffers(1, &m_position_buffer);
+        glDeleteBuffers(2, m_key_buffers);
+        glDeleteBuffers(2, m_value_buffers);
+        glDeleteBuffers(1, &m_histogram_buffer);
+    }
+
+    m_position_buffer = m_histogram_buffer = 0;
+    memset(m_key_buffers, 0, sizeof(m_key_buffers));
+    memset(m_value_buffers, 0, sizeof(m_value_buffers));
+
+    m_max_sprites = m_position_count = m_count = 0;
+    m_use_gpu = false;
+    m_positions.clear();
+    m_keys.clear();
+    m_values.clear();
+}
+
+void SpriteSorter::SetPositions(const vec4 * positions, unsigned int count)
+{
+    if (count > m_max_sprites)
+        count = m_max_sprites;
+
+    m_positions.assign(positions, positions + count);
+    m_position_count = m_count = count;
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_position_buffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(vec4), positions);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void SpriteSorter::Sort(JobSystem& jobs, const mat4& model_view)
+{
+    m_stats.sprites = m_count;
+    m_stats.gpu = m_use_gpu;
+
+    if (m_use_gpu)
+    {
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+        SortOnGPU(model_view);
+
+        m_stats.passes = 32 / GPU_RADIX_BITS;
+        m_stats.depth_time = 0.0f;
+        m_stats.sort_time = std::chrono::duration<float, std::micro>(std::chrono::high_resolution_clock::now() - start).count();
+        m_stats.upload_time = 0.0f;
+        m_stats.sprites_per_ms = 0.0f;
+        return;
+    }
+
+    if (m_count == 0)
+        return;
+
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+
+    compute_depth_keys(jobs, &m_positions[0], m_count, model_view, &m_keys[0], &m_values[0]);
+
+    std::chrono::high_resolution_clock::time_point keyed = std::chrono::high_resolution_clock::now();
+
+    m_sorter.Sort(jobs, &m_keys[0], &m_values[0], m_count);
+
+    std::chrono::high_resolution_clock::time_point sorted = std::chrono::high_resolution_clock::now();
+
+    // Only the permutation goes to the GPU. Orphan the old one in case
+    // draws are still reading it.
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_value_buffers[0]);
+    glBufferData(GL_COPY_WRITE_BUFFER, m_max_sprites * sizeof(GLuint), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, 0, m_count * sizeof(GLuint), &m_values[0]);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    std::chrono::high_resolution_clock::time_point uploaded = std::chrono::high_resolution_clock::now();
+
+    m_stats.passes = m_sorter.GetPassCount();
+    m_stats.depth_time = std::chrono::duration<float, std::micro>(keyed - start).count();
+    m_stats.sort_time = std::chrono::duration<float, std::micro>(sorted - keyed).count();
+    m_stats.upload_time = std::chrono::duration<float, std::micro>(uploaded - sorted).count();
+    m_stats.sprites_per_ms = float(m_count) * 1000.0f / std::max(std::chrono::duration<float, std::micro>(uploaded - start).count(), 1.0f);
+}
+
+void SpriteSorter::SortOnGPU(const mat4& model_view)
+{
+    const unsigned int groups = (m_count + GROUP_SIZE - 1) / GROUP_SIZE;
+    unsigned int pass;
+
+    if (groups == 0)
+        return;
+
+    // Keys and indices start out in the first pair of buffers. Each pass
+    // moves them to the other pair; after an even number of passes they
+    // are back in the first, whose indices are the index buffer.
+    glUseProgram(m_programs[PROGRAM_DEPTH]);
+    glUniform4f(m_uniforms.depth_row, model_view[0][2], model_view[1][2], model_view[2][2], model_view[3][2]);
+    glUniform1ui(m_uniforms.depth_count, m_count);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_key_buffers[0]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_value_buffers[0]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, m_position_buffer);
+    glDispatchCompute(groups, 1, 1);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_histogram_buffer);
+
+    for (pass = 0; pass < 32 / GPU_RADIX_BITS; pass++)
+    {
+        const unsigned int in = pass & 1;
+        const unsigned int shift = pass * GPU_RADIX_BITS;
+
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_key_buffers[in]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_value_buffers[in]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_key_buffers[in ^ 1]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_value_buffers[in ^ 1]);
+
+        glUseProgram(m_programs[PROGRAM_COUNT]);
+        glUniform1ui(m_uniforms.count_count, m_count);
+        glUniform1ui(m_uniforms.count_shift, shift);
+        glDispatchCompute(groups, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        glUseProgram(m_programs[PROGRAM_SCAN]);
+        glUniform1ui(m_uniforms.scan_size, groups * GPU_RADIX_SIZE);
+        glDispatchCompute(1, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        glUseProgram(m_programs[PROGRAM_SCATTER]);
+        glUniform1ui(m_uniforms.scatter_count, m_count);
+        glUniform1ui(m_uniforms.scatter_shift, shift);
+        glDispatchCompute(groups, 1, 1);
+    }
+
+    glMemoryBarrier(GL_ELEMENT_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+    glUseProgram(0);
+}
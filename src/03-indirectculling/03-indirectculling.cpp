@@ -0,0 +1,282 @@
+/* $URL$
+   $Rev$
+   $Author$
+   $Date$
+   $Id$
+ */
+
+#include "vapp.h"
+#include "vutils.h"
+
+#include "vmath.h"
+
+#include "vbm.h"
+#include "vgpucull.h"
+#include "vhiz.h"
+
+#include <stdio.h>
+
+using namespace vmath;
+
+#define INSTANCE_COUNT 4096
+
+BEGIN_APP_DECLARATION(IndirectCullingExample)
+    // Override functions from base class
+    virtual void Initialize(const char * title);
+    virtual void Display(bool auto_redraw);
+    virtual void Finalize(void);
+    virtual void Resize(int width, int height);
+    virtual void OnKey(int key, int scancode, int action, int mods);
+
+    void CreateFramebuffer(void);
+
+    // Member variables
+    float aspect;
+    int current_width;
+    int current_height;
+
+    // The scene is drawn off screen so that its depth can be read back
+    // into the Hi-Z pyramid for the next frame's culling
+    GLuint fbo;
+    GLuint color_texture;
+    GLuint depth_texture;
+    bool use_hiz;
+
+    GLuint render_prog;
+    GLint view_matrix_loc;
+    GLint projection_matrix_loc;
+
+    VBObject object;
+    GPUInstanceCuller culler;
+    HiZPyramid hiz;
+END_APP_DECLARATION()
+
+DEFINE_APP(IndirectCullingExample, "GPU Instance Culling Example")
+
+void IndirectCullingExample::Initialize(const char * title)
+{
+    int n;
+
+    fbo = 0;
+    color_texture = 0;
+    depth_texture = 0;
+    use_hiz = true;
+
+    base::Initialize(title);
+
+    render_prog = glCreateProgram();
+
+    static const char render_vs[] =
+        "#version 430 core\n"
+        "\n"
+        "layout (location = 0) in vec4 position;\n"
+        "layout (location = 1) in vec3 normal;\n"
+        "\n"
+        "// The index of the instance before culling, used to pick its color\n"
+        "layout (location = 2) in uint instance_index;\n"
+        "\n"
+        "// The compacted per-instance transform (locations 3 to 6)\n"
+        "layout (location = 3) in mat4 model_matrix;\n"
+        "\n"
+        "uniform mat4 view_matrix;\n"
+        "uniform mat4 projection_matrix;\n"
+        "\n"
+        "out VERTEX\n"
+        "{\n"
+        "    vec3    normal;\n"
+        "    vec4    color;\n"
+        "} vertex;\n"
+        "\n"
+        "void main(void)\n"
+        "{\n"
+        "    mat4 model_view_matrix = view_matrix * model_matrix;\n"
+        "    float n = float(instance_index);\n"
+        "\n"
+        "    gl_Position = projection_matrix * (model_view_matrix * position);\n"
+        "    vertex.normal = mat3(model_view_matrix) * normal;\n"
+        "    vertex.color = vec4(0.5 + 0.25 * (sin(n / 4.0 + 1.0) + 1.0),\n"
+        "                        0.5 + 0.25 * (sin(n / 5.0 + 2.0) + 1.0),\n"
+        "                        0.5 + 0.25 * (sin(n / 6.0 + 3.0) + 1.0),\n"
+        "                        1.0);\n"
+        "}\n";
+
+    static const char render_fs[] =
+        "#version 430 core\n"
+        "\n"
+        "layout (location = 0) out vec4 color;\n"
+        "\n"
+        "in VERTEX\n"
+        "{\n"
+        "    vec3    normal;\n"
+        "    vec4    color;\n"
+        "} vertex;\n"
+        "\n"
+        "void main(void)\n"
+        "{\n"
+        "    color = vertex.color * (0.1 + abs(vertex.normal.z)) + vec4(0.8, 0.9, 0.7, 1.0) * pow(abs(vertex.normal.z), 40.0);\n"
+        "}\n";
+
+    vglAttachShaderSource(render_prog, GL_VERTEX_SHADER, render_vs);
+    vglAttachShaderSource(render_prog, GL_FRAGMENT_SHADER, render_fs);
+
+    glLinkProgram(render_prog);
+    glUseProgram(render_prog);
+
+    view_matrix_loc = glGetUniformLocation(render_prog, "view_matrix");
+    projection_matrix_loc = glGetUniformLocation(render_prog, "projection_matrix");
+
+    object.LoadFromVBM("media/armadillo_low.vbm", 0, 1, 2);
+
+    culler.Initialize(INSTANCE_COUNT);
+
+    // The instances don't move, so their transforms are uploaded once and
+    // stay on the GPU. Lay them out on a grid.
+    mat4 * matrices = new mat4[INSTANCE_COUNT];
+
+    for (n = 0; n < INSTANCE_COUNT; n++)
+    {
+        float x = float(n % 64) - 31.5f;
+        float z = float(n / 64) - 31.5f;
+
+        matrices[n] = translate(x * 120.0f, 0.0f, z * 120.0f) *
+                      rotate(float(n) * 37.0f, 0.0f, 1.0f, 0.0f);
+    }
+
+    culler.SetInstances(matrices, INSTANCE_COUNT);
+
+    delete [] matrices;
+
+    // Source the instanced attributes straight from the culler's compacted
+    // outputs. The draw never sees the culled instances at all.
+    object.BindVertexArray();
+
+    glBindBuffer(GL_ARRAY_BUFFER, culler.GetVisibleIndexBuffer());
+    glVertexAttribIPointer(2, 1, GL_UNSIGNED_INT, 0, NULL);
+    glEnableVertexAttribArray(2);
+    glVertexAttribDivisor(2, 1);
+
+    glBindBuffer(GL_ARRAY_BUFFER, culler.GetVisibleMatrixBuffer());
+    for (int i = 0; i < 4; i++)
+    {
+        glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(mat4), (void *)(sizeof(vec4) * i));
+        glEnableVertexAttribArray(3 + i);
+        glVertexAttribDivisor(3 + i, 1);
+    }
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glGenFramebuffers(1, &fbo);
+    CreateFramebuffer();
+
+    hiz.Initialize(current_width, current_height);
+    culler.SetHiZ(&hiz);
+}
+
+void IndirectCullingExample::CreateFramebuffer(void)
+{
+    glDeleteTextures(1, &color_texture);
+    glDeleteTextures(1, &depth_texture);
+
+    glGenTextures(1, &color_texture);
+    glBindTexture(GL_TEXTURE_2D, color_texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, current_width, current_height);
+
+    glGenTextures(1, &depth_texture);
+    glBindTexture(GL_TEXTURE_2D, depth_texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, current_width, current_height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, color_texture, 0);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_texture, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void IndirectCullingExample::Display(bool auto_redraw)
+{
+    float t = float(app_time() & 0x3FFFF) / float(0x3FFFF);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    glEnable(GL_CULL_FACE);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LEQUAL);
+
+    // Fly around over the grid, looking outwards so that most of it is
+    // behind the camera or off to the side
+    vec3 eye(cosf(t * 6.2831853f) * 1500.0f, 300.0f, sinf(t * 6.2831853f) * 1500.0f);
+    mat4 view_matrix(lookat(eye, eye * 2.0f - vec3(0.0f, 300.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f)));
+    mat4 projection_matrix(frustum(-1.0f, 1.0f, -aspect, aspect, 1.0f, 5000.0f));
+
+    // The pyramid still holds last frame's depth. The camera moves slowly
+    // enough for that to be a good guess at what hides what.
+    culler.SetHiZ(use_hiz ? &hiz : NULL);
+    culler.Cull(object, 0, projection_matrix * view_matrix);
+
+    glUseProgram(render_prog);
+
+    glUniformMatrix4fv(view_matrix_loc, 1, GL_FALSE, view_matrix);
+    glUniformMatrix4fv(projection_matrix_loc, 1, GL_FALSE, projection_matrix);
+
+    culler.Render(object);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    if (use_hiz)
+        hiz.Build(depth_texture);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    glBlitFramebuffer(0, 0, current_width, current_height,
+                      0, 0, current_width, current_height,
+                      GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+    base::Display();
+}
+
+void IndirectCullingExample::Finalize(void)
+{
+    glUseProgram(0);
+    glDeleteProgram(render_prog);
+    culler.Free();
+    hiz.Free();
+    object.Free();
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteTextures(1, &color_texture);
+    glDeleteTextures(1, &depth_texture);
+}
+
+void IndirectCullingExample::Resize(int width, int height)
+{
+    glViewport(0, 0 , width, height);
+
+    current_width = width;
+    current_height = height;
+    aspect = float(height) / float(width);
+
+    if (fbo != 0)
+    {
+        CreateFramebuffer();
+        hiz.Resize(width, height);
+    }
+}
+
+void IndirectCullingExample::OnKey(int key, int scancode, int action, int mods)
+{
+    if (action == GLFW_PRESS)
+    {
+        switch (key)
+        {
+            case GLFW_KEY_H:
+                use_hiz = !use_hiz;
+                printf("Hi-Z occlusion culling %s\n", use_hiz ? "on" : "off");
+                return;
+        }
+    }
+
+    base::OnKey(key, scancode, action, mods);
+}
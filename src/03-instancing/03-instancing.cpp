@@ -11,9 +11,12 @@
 #include "vmath.h"
 
 #include "vbm.h"
+#include "vcull.h"
 
 #include <stdio.h>
 
+#define INSTANCE_COUNT 200
+
 BEGIN_APP_DECLARATION(InstancingExample)
     // Override functions from base class
     virtual void Initialize(const char * title);
@@ -44,13 +47,15 @@ BEGIN_APP_DECLARATION(InstancingExample)
     GLint triangle_count_loc;
     GLint time_step_loc;
 
+    // Per-instance colors, kept on the CPU so that they can be compacted
+    // along with the weights of the instances that survive culling
+    vmath::vec4 colors[INSTANCE_COUNT];
+
     VBObject object;
 END_APP_DECLARATION()
 
 DEFINE_APP(InstancingExample, "Instancing Example")
 
-#define INSTANCE_COUNT 200
-
 static unsigned int seed = 0x13371337;
 
 static inline float random_float()
@@ -155,8 +160,6 @@ void InstancingExample::Initialize(const char * title)
     object.BindVertexArray();
 
     // Generate the colors of the objects
-    vmath::vec4 colors[INSTANCE_COUNT];
-
     for (n = 0; n < INSTANCE_COUNT; n++)
     {
         float a = float(n) / 4.0f;
@@ -182,10 +185,11 @@ void InstancingExample::Initialize(const char * title)
     glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, 0, NULL);
     glEnableVertexAttribArray(3);
 
-    // Same with the instance color array
+    // Same with the instance color array, which is rewritten with the
+    // colors of the visible instances every frame
     glGenBuffers(1, &color_vbo);
     glBindBuffer(GL_ARRAY_BUFFER, color_vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(colors), colors, GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(colors), colors, GL_DYNAMIC_DRAW);
 
     glVertexAttribDivisor(4, 1);
     glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, 0, NULL);
@@ -224,10 +228,6 @@ void InstancingExample::Display(bool auto_redraw)
         weights[n][3] = 0.5f * (sinf(t * 6.28318531f * 13.0f + a + b) + 1.0f);
     }
 
-    // Bind the weight VBO and change its data
-    glBindBuffer(GL_ARRAY_BUFFER, weight_vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(weights), weights, GL_DYNAMIC_DRAW);
-
     // Clear
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -236,9 +236,6 @@ void InstancingExample::Display(bool auto_redraw)
     glEnable(GL_DEPTH_TEST);
     glDepthFunc(GL_LEQUAL);
 
-    // Activate instancing program
-    glUseProgram(render_prog);
-
     // Set four model matrices
     vmath::mat4 model_matrix[4];
 
@@ -252,15 +249,57 @@ void InstancingExample::Display(bool auto_redraw)
                            vmath::scale(0.01f));
     }
 
-    glUniformMatrix4fv(render_model_matrix_loc, 4, GL_FALSE, model_matrix[0]);
-
     // Set up the projection matrix
     vmath::mat4 projection_matrix(vmath::frustum(-1.0f, 1.0f, -aspect, aspect, 1.0f, 5000.0f) * vmath::translate(0.0f, 0.0f, -100.0f));
 
+    // Each instance's matrix, blended from the four as the vertex shader
+    // does. The normalized weights sum to more than one, and so does the
+    // blend's bottom row, which the divide by w takes out; dividing the
+    // blend by the sum makes the same matrix with a bottom row of 0 0 0 1.
+    // A blend of rotations can shear, which stretches a sphere by up to
+    // sqrt(3) times the longest column that transformSpheres scales by, so
+    // the object's sphere is grown by that much to stay conservative.
+    vmath::mat4 matrices[INSTANCE_COUNT];
+    vmath::vec4 sphere = object.GetBoundingSphere();
+
+    for (n = 0; n < INSTANCE_COUNT; n++)
+    {
+        const vmath::vec4 w = vmath::normalize(weights[n]);
+
+        matrices[n] = (model_matrix[0] * w[0] + model_matrix[1] * w[1] + model_matrix[2] * w[2] + model_matrix[3] * w[3]) *
+                      (1.0f / (w[0] + w[1] + w[2] + w[3]));
+    }
+    sphere[3] *= 1.7320508f;
+
+    // Cull the instances' bounding spheres against the view frustum
+    vmath::vec4 planes[6];
+    float sphere_x[INSTANCE_COUNT], sphere_y[INSTANCE_COUNT], sphere_z[INSTANCE_COUNT], sphere_r[INSTANCE_COUNT];
+    unsigned int visible[INSTANCE_COUNT];
+
+    vmath::frustumPlanes(projection_matrix, planes);
+    vmath::transformSpheres(sphere, matrices, INSTANCE_COUNT, sphere_x, sphere_y, sphere_z, sphere_r);
+    unsigned int visible_count = vmath::cullSpheres(planes, sphere_x, sphere_y, sphere_z, sphere_r, INSTANCE_COUNT, visible);
+
+    // Upload only the weights and colors of the visible instances
+    glBindBuffer(GL_ARRAY_BUFFER, weight_vbo);
+    vmath::vec4 * visible_weights = (vmath::vec4 *)glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
+    vmath::compactInstances(weights, visible, visible_count, visible_weights);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+
+    glBindBuffer(GL_ARRAY_BUFFER, color_vbo);
+    vmath::vec4 * visible_colors = (vmath::vec4 *)glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
+    vmath::compactInstances(colors, visible, visible_count, visible_colors);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+
+    // Activate instancing program
+    glUseProgram(render_prog);
+
+    glUniformMatrix4fv(render_model_matrix_loc, 4, GL_FALSE, model_matrix[0]);
     glUniformMatrix4fv(render_projection_matrix_loc, 1, GL_FALSE, projection_matrix);
 
-    // Render INSTANCE_COUNT objects
-    object.Render(0, INSTANCE_COUNT);
+    // Render the visible objects
+    if (visible_count != 0)
+        object.Render(0, visible_count);
 
     base::Display();
 }
@@ -11,11 +11,14 @@
 #include "vmath.h"
 
 #include "vbm.h"
+#include "vcull.h"
 
 #include <stdio.h>
 
 using namespace vmath;
 
+#define INSTANCE_COUNT 100
+
 BEGIN_APP_DECLARATION(InstancingExample)
     // Override functions from base class
     virtual void Initialize(const char * title);
@@ -33,13 +36,15 @@ BEGIN_APP_DECLARATION(InstancingExample)
     GLint view_matrix_loc;
     GLint projection_matrix_loc;
 
+    // Per-instance colors, kept on the CPU so that they can be compacted
+    // along with the matrices of the instances that survive culling
+    vec4 colors[INSTANCE_COUNT];
+
     VBObject object;
 END_APP_DECLARATION()
 
 DEFINE_APP(InstancingExample, "Instancing Example")
 
-#define INSTANCE_COUNT 100
-
 void InstancingExample::Initialize(const char * title)
 {
     int n;
@@ -151,8 +156,6 @@ void InstancingExample::Initialize(const char * title)
     */
 
     // Generate the colors of the objects
-    vec4 colors[INSTANCE_COUNT];
-
     for (n = 0; n < INSTANCE_COUNT; n++)
     {
         float a = float(n) / 4.0f;
@@ -227,11 +230,8 @@ void InstancingExample::Display(bool auto_redraw)
     glEnable(GL_DEPTH_TEST);
     glDepthFunc(GL_LEQUAL);
 
-    // Bind the weight VBO and change its data
-    glBindBuffer(GL_ARRAY_BUFFER, model_matrix_buffer);
-
     // Set model matrices for each instance
-    mat4 * matrices = (mat4 *)glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
+    mat4 matrices[INSTANCE_COUNT];
 
     for (n = 0; n < INSTANCE_COUNT; n++)
     {
@@ -245,20 +245,39 @@ void InstancingExample::Display(bool auto_redraw)
                       translate(10.0f + a, 40.0f + b, 50.0f + c);
     }
 
+    // Set up the view and projection matrices
+    mat4 view_matrix(translate(0.0f, 0.0f, -1500.0f) * rotate(t * 360.0f * 2.0f, 0.0f, 1.0f, 0.0f));
+    mat4 projection_matrix(frustum(-1.0f, 1.0f, -aspect, aspect, 1.0f, 5000.0f));
+
+    // Cull the instances' bounding spheres against the view frustum
+    vec4 planes[6];
+    float sphere_x[INSTANCE_COUNT], sphere_y[INSTANCE_COUNT], sphere_z[INSTANCE_COUNT], sphere_r[INSTANCE_COUNT];
+    unsigned int visible[INSTANCE_COUNT];
+
+    frustumPlanes(projection_matrix * view_matrix, planes);
+    transformSpheres(object.GetBoundingSphere(), matrices, INSTANCE_COUNT, sphere_x, sphere_y, sphere_z, sphere_r);
+    unsigned int visible_count = cullSpheres(planes, sphere_x, sphere_y, sphere_z, sphere_r, INSTANCE_COUNT, visible);
+
+    // Upload only the matrices and colors of the visible instances
+    glBindBuffer(GL_ARRAY_BUFFER, model_matrix_buffer);
+    mat4 * visible_matrices = (mat4 *)glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
+    compactInstances(matrices, visible, visible_count, visible_matrices);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+
+    glBindBuffer(GL_ARRAY_BUFFER, color_buffer);
+    vec4 * visible_colors = (vec4 *)glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
+    compactInstances(colors, visible, visible_count, visible_colors);
     glUnmapBuffer(GL_ARRAY_BUFFER);
 
     // Activate instancing program
     glUseProgram(render_prog);
 
-    // Set up the view and projection matrices
-    mat4 view_matrix(translate(0.0f, 0.0f, -1500.0f) * rotate(t * 360.0f * 2.0f, 0.0f, 1.0f, 0.0f));
-    mat4 projection_matrix(frustum(-1.0f, 1.0f, -aspect, aspect, 1.0f, 5000.0f));
-
     glUniformMatrix4fv(view_matrix_loc, 1, GL_FALSE, view_matrix);
     glUniformMatrix4fv(projection_matrix_loc, 1, GL_FALSE, projection_matrix);
 
-    // Render INSTANCE_COUNT objects
-    object.Render(0, INSTANCE_COUNT);
+    // Render the visible objects
+    if (visible_count != 0)
+        object.Render(0, visible_count);
 
     lookat(vec3(0.0f, 0.0f, 0.0f), vec3(1.0f, 0.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f));
 
@@ -9,19 +9,27 @@
 #include "vutils.h"
 
 #include "vmath.h"
+#include "vmathexpr.h"
 
 #include "vbm.h"
+#include "vcull.h"
+#include "vocclusion.h"
 
 #include <stdio.h>
 
 using namespace vmath;
 
+#define INSTANCE_COUNT 100
+#define OCCLUDER_COUNT 6
+#define OCCLUDER_TRIANGLES 1000
+
 BEGIN_APP_DECLARATION(InstanceIDExample)
     // Override functions from base class
     virtual void Initialize(const char * title);
     virtual void Display(bool auto_redraw);
     virtual void Finalize(void);
     virtual void Resize(int width, int height);
+    virtual void OnKey(int key, int scancode, int action, int mods);
 
     // Member variables
     float aspect;
@@ -35,13 +43,19 @@ BEGIN_APP_DECLARATION(InstanceIDExample)
     GLint view_matrix_loc;
     GLint projection_matrix_loc;
 
+    // Compacted with the matrices in Display
+    vec4 colors[INSTANCE_COUNT];
+
     VBObject object;
+
+    // The nearest few instances hide the ones behind them
+    OcclusionCuller occlusion;
+    bool occlusion_culling;
+    bool print_stats;
 END_APP_DECLARATION()
 
 DEFINE_APP(InstanceIDExample, "gl_InstanceID Example")
 
-#define INSTANCE_COUNT 100
-
 void InstanceIDExample::Initialize(const char * title)
 {
     int n;
@@ -148,7 +162,14 @@ void InstanceIDExample::Initialize(const char * title)
     glUniform1i(model_matrix_tbo_loc, 1);
 
     // Load the object
-    object.LoadFromVBM("media/armadillo_low.vbm", 0, 1, 2);
+    object.LoadFromVBM("media/armadillo_low.vbm", 0, 1, 2, VBM_LOAD_KEEP_DATA);
+
+    // The armadillo has no levels of detail, so give the culler a coarse
+    // version of it to rasterize
+    occlusion.Initialize();
+    occlusion.BuildOccluder(object, OCCLUDER_TRIANGLES);
+    occlusion_culling = true;
+    print_stats = false;
 
     /*
 
@@ -183,8 +204,6 @@ void InstanceIDExample::Initialize(const char * title)
     glBindTexture(GL_TEXTURE_BUFFER, color_tbo);
 
     // Generate the colors of the objects
-    vec4 colors[INSTANCE_COUNT];
-
     for (n = 0; n < INSTANCE_COUNT; n++)
     {
         float a = float(n) / 4.0f;
@@ -200,7 +219,7 @@ void InstanceIDExample::Initialize(const char * title)
     // Create the buffer, initialize it and attach it to the buffer texture
     glGenBuffers(1, &color_buffer);
     glBindBuffer(GL_TEXTURE_BUFFER, color_buffer);
-    glBufferData(GL_TEXTURE_BUFFER, sizeof(colors), colors, GL_STATIC_DRAW);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(colors), colors, GL_DYNAMIC_DRAW);
     glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, color_buffer);
 
     // Now do the same thing with a TBO for the model matrices. The buffer object
@@ -230,24 +249,117 @@ void InstanceIDExample::Display(bool auto_redraw)
     static const vec3 Z(0.0f, 0.0f, 1.0f);
     int n;
 
-    // Set model matrices for each instance
+    // Set model matrices for each instance, spread over the job system's
+    // threads
     mat4 matrices[INSTANCE_COUNT];
 
-    for (n = 0; n < INSTANCE_COUNT; n++)
+    GetJobSystem().ParallelFor(INSTANCE_COUNT, 16, [&](unsigned int begin, unsigned int end)
+    {
+        unsigned int i;
+
+        for (i = begin; i < end; i++)
+        {
+            float a = 50.0f * float(i) / 4.0f;
+            float b = 50.0f * float(i) / 5.0f;
+            float c = 50.0f * float(i) / 6.0f;
+
+            // Two 3x3 products and a 3x3 times a vector, rather than three
+            // 4x4 products
+            matrices[i] = vmath::expr::to_mat4(vmath::expr::rotate(a + t * 360.0f, 1.0f, 0.0f, 0.0f) *
+                                               vmath::expr::rotate(b + t * 360.0f, 0.0f, 1.0f, 0.0f) *
+                                               vmath::expr::rotate(c + t * 360.0f, 0.0f, 0.0f, 1.0f) *
+                                               vmath::expr::translate(10.0f + a, 40.0f + b, 50.0f + c));
+        }
+    });
+
+    // Set up the view and projection matrices
+    mat4 view_matrix(vmath::translate(0.0f, 0.0f, -1500.0f) * vmath::rotate(t * 360.0f * 2.0f, 0.0f, 1.0f, 0.0f));
+    mat4 projection_matrix(frustum(-1.0f, 1.0f, -aspect, aspect, 1.0f, 5000.0f));
+
+    // Start the occlusion culling on its own thread. It works on boxes, so
+    // it's done for every instance while the frustum culling runs here.
+    if (occlusion_culling)
+    {
+        float depth[INSTANCE_COUNT];
+        bool chosen[INSTANCE_COUNT] = { false };
+        int i;
+
+        for (n = 0; n < INSTANCE_COUNT; n++)
+        {
+            const vec4& origin = matrices[n][3];
+            depth[n] = -(view_matrix[0][2] * origin[0] + view_matrix[1][2] * origin[1] + view_matrix[2][2] * origin[2] + view_matrix[3][2]);
+        }
+
+        occlusion.ClearOccluders();
+        for (i = 0; i < OCCLUDER_COUNT; i++)
+        {
+            int nearest = -1;
+
+            for (n = 0; n < INSTANCE_COUNT; n++)
+            {
+                if (!chosen[n] && depth[n] > 0.0f && (nearest < 0 || depth[n] < depth[nearest]))
+                    nearest = n;
+            }
+
+            if (nearest < 0)
+                break;
+
+            chosen[nearest] = true;
+            occlusion.AddOccluder(object, matrices[nearest]);
+        }
+
+        occlusion.Submit(projection_matrix * view_matrix, object.GetBounds(), matrices, INSTANCE_COUNT);
+    }
+
+    // Cull the instances' bounding spheres against the view frustum. The
+    // shader indexes the TBOs with gl_InstanceID, so the colors need to be
+    // compacted in the same order as the matrices.
+    vec4 planes[6];
+    float sphere_x[INSTANCE_COUNT], sphere_y[INSTANCE_COUNT], sphere_z[INSTANCE_COUNT], sphere_r[INSTANCE_COUNT];
+    unsigned int visible[INSTANCE_COUNT];
+    mat4 visible_matrices[INSTANCE_COUNT];
+    vec4 visible_colors[INSTANCE_COUNT];
+
+    frustumPlanes(projection_matrix * view_matrix, planes);
+    transformSpheres(object.GetBoundingSphere(), matrices, INSTANCE_COUNT, sphere_x, sphere_y, sphere_z, sphere_r);
+    unsigned int visible_count = cullSpheres(planes, sphere_x, sphere_y, sphere_z, sphere_r, INSTANCE_COUNT, visible);
+
+    // Keep the instances that survived both, in the same order
+    if (occlusion_culling)
     {
-        float a = 50.0f * float(n) / 4.0f;
-        float b = 50.0f * float(n) / 5.0f;
-        float c = 50.0f * float(n) / 6.0f;
-
-        matrices[n] = vmath::rotate(a + t * 360.0f, 1.0f, 0.0f, 0.0f) *
-                      vmath::rotate(b + t * 360.0f, 0.0f, 1.0f, 0.0f) *
-                      vmath::rotate(c + t * 360.0f, 0.0f, 0.0f, 1.0f) *
-                      vmath::translate(10.0f + a, 40.0f + b, 50.0f + c);
+        unsigned int unoccluded[INSTANCE_COUNT];
+        unsigned int unoccluded_count = occlusion.Wait(unoccluded);
+        unsigned int i, j = 0, count = 0;
+
+        for (i = 0; i < visible_count; i++)
+        {
+            while (j < unoccluded_count && unoccluded[j] < visible[i])
+                j++;
+            if (j < unoccluded_count && unoccluded[j] == visible[i])
+                visible[count++] = visible[i];
+        }
+
+        if (print_stats)
+        {
+            const OcclusionStats& stats = occlusion.GetStats();
+            printf("Frustum: %u visible, occlusion: %u of %u culled (%.1f%%), %u occluder triangles, "
+                   "rasterize %.0f us, test %.0f us, total %.0f us, drawing %u\n",
+                   visible_count, stats.culled, stats.tested, stats.culled_percent, stats.occluder_triangles,
+                   stats.rasterize_time, stats.test_time, stats.total_time, count);
+            print_stats = false;
+        }
+
+        visible_count = count;
     }
 
+    compactInstances(matrices, visible, visible_count, visible_matrices);
+    compactInstances(colors, visible, visible_count, visible_colors);
+
     // Bind the weight VBO and change its data
     glBindBuffer(GL_TEXTURE_BUFFER, model_matrix_buffer);
-    glBufferData(GL_TEXTURE_BUFFER, sizeof(matrices), matrices, GL_DYNAMIC_DRAW);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, visible_count * sizeof(mat4), visible_matrices);
+    glBindBuffer(GL_TEXTURE_BUFFER, color_buffer);
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, visible_count * sizeof(vec4), visible_colors);
 
     // Clear
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -260,15 +372,12 @@ void InstanceIDExample::Display(bool auto_redraw)
     // Activate instancing program
     glUseProgram(render_prog);
 
-    // Set up the view and projection matrices
-    mat4 view_matrix(vmath::translate(0.0f, 0.0f, -1500.0f) * vmath::rotate(t * 360.0f * 2.0f, 0.0f, 1.0f, 0.0f));
-    mat4 projection_matrix(frustum(-1.0f, 1.0f, -aspect, aspect, 1.0f, 5000.0f));
-
     glUniformMatrix4fv(view_matrix_loc, 1, GL_FALSE, view_matrix);
     glUniformMatrix4fv(projection_matrix_loc, 1, GL_FALSE, projection_matrix);
 
-    // Render INSTANCE_COUNT objects
-    object.Render(0, INSTANCE_COUNT);
+    // Render the visible objects
+    if (visible_count != 0)
+        object.Render(0, visible_count);
 
     base::Display();
 }
@@ -279,6 +388,7 @@ void InstanceIDExample::Finalize(void)
     glDeleteProgram(render_prog);
     glDeleteBuffers(1, &color_buffer);
     glDeleteBuffers(1, &model_matrix_buffer);
+    occlusion.Free();
 }
 
 void InstanceIDExample::Resize(int width, int height)
@@ -287,3 +397,22 @@ void InstanceIDExample::Resize(int width, int height)
 
     aspect = float(height) / float(width);
 }
+
+void InstanceIDExample::OnKey(int key, int scancode, int action, int mods)
+{
+    if (action == GLFW_PRESS)
+    {
+        switch (key)
+        {
+            case GLFW_KEY_O:
+                occlusion_culling = !occlusion_culling;
+                printf("Occlusion culling %s\n", occlusion_culling ? "on" : "off");
+                return;
+            case GLFW_KEY_S:
+                print_stats = true;
+                return;
+        }
+    }
+
+    base::OnKey(key, scancode, action, mods);
+}
@@ -10,13 +10,35 @@
 
 #include "vmath.h"
 
+#include "vsort.h"
+#include "vjobs.h"
+
 #include "LoadShaders.h"
 
 #include <stdio.h>
+#include <vector>
 
 using namespace vmath;
 
-#define POINT_COUNT 4
+// The sprite count starts at POINT_COUNT and can be scaled by factors of
+// four up to MAX_POINT_COUNT
+#define POINT_COUNT 16384
+#define MAX_POINT_COUNT (1024 * 1024)
+
+enum SortMode
+{
+    SORT_NONE,
+    SORT_CPU,
+    SORT_GPU,
+    SORT_MODE_COUNT
+};
+
+static const char * const sort_mode_names[] =
+{
+    "unsorted",
+    "sorted on the CPU",
+    "sorted on the GPU"
+};
 
 BEGIN_APP_DECLARATION(PointSpriteExample)
     // Override functions from base class
@@ -24,14 +46,21 @@ BEGIN_APP_DECLARATION(PointSpriteExample)
     virtual void Display(bool auto_redraw);
     virtual void Finalize(void);
     virtual void Resize(int width, int height);
+    virtual void OnKey(int key, int scancode, int action, int mods);
+
+    void PrintStats(void);
 
     // Member variables
     float aspect;
     GLuint render_prog;
     GLuint vao[1];
-    GLuint vbo[1];
     GLuint sprite_texture;
 
+    // Owns the positions and the index buffer that draws them back to front
+    SpriteSorter sorter;
+    int sort_mode;
+    bool print_stats;
+
     GLint render_model_matrix_loc;
     GLint render_projection_matrix_loc;
 END_APP_DECLARATION()
@@ -91,28 +120,31 @@ void PointSpriteExample::Initialize(const char * title)
     render_model_matrix_loc = glGetUniformLocation(render_prog, "model_matrix");
     render_projection_matrix_loc = glGetUniformLocation(render_prog, "projection_matrix");
 
-    // A single triangle
-    static vec4 * vertex_positions;
+    // Without compute shaders the sprites can still be sorted on the CPU
+    if (!sorter.Initialize(MAX_POINT_COUNT, true))
+        sorter.Initialize(MAX_POINT_COUNT, false);
 
-    // Set up the vertex attributes
-    glGenVertexArrays(1, vao);
-    glBindVertexArray(vao[0]);
-
-    glGenBuffers(1, vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo[0]);
-    glBufferData(GL_ARRAY_BUFFER, POINT_COUNT * sizeof(vec4), NULL, GL_STATIC_DRAW);
+    std::vector<vec4> vertex_positions(MAX_POINT_COUNT);
 
-    vertex_positions = (vec4 *)glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY);
-    for (int n = 0; n < POINT_COUNT; n++)
+    for (int n = 0; n < MAX_POINT_COUNT; n++)
     {
         vertex_positions[n] = vec4(random_float() * 2.0f - 1.0f, random_float() * 2.0f - 1.0f, random_float() * 2.0f - 1.0f, 1.0f);
     }
-    glUnmapBuffer(GL_ARRAY_BUFFER);
 
+    sorter.SetPositions(&vertex_positions[0], MAX_POINT_COUNT);
+    sorter.SetSpriteCount(POINT_COUNT);
+    sort_mode = SORT_CPU;
+    print_stats = false;
+
+    // Set up the vertex attributes. The positions live in the sorter's
+    // buffer and the order comes from its index buffer.
+    glGenVertexArrays(1, vao);
+    glBindVertexArray(vao[0]);
+
+    glBindBuffer(GL_ARRAY_BUFFER, sorter.GetPositionBuffer());
     glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, NULL);
-    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 0, (const GLvoid *)sizeof(vertex_positions));
     glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sorter.GetIndexBuffer());
 
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 }
@@ -142,16 +174,40 @@ void PointSpriteExample::Display(bool auto_redraw)
 
     glBindTexture(GL_TEXTURE_2D, sprite_texture);
 
+    // Alpha blending is only right back to front
     glEnable(GL_BLEND);
-    glBlendFunc(GL_ONE, GL_ONE);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     glEnable(GL_PROGRAM_POINT_SIZE);
     glPointSize(32.0f);
 
-    // Draw Arrays...
     model_matrix = translate(0.0f, 0.0f, -2.0f) *
                    rotate(t * 360.0f, Y) * rotate(t * 720.0f, Z);
     glUniformMatrix4fv(render_model_matrix_loc, 1, GL_FALSE, model_matrix);
-    glDrawArrays(GL_POINTS, 0, POINT_COUNT);
+
+    glBindVertexArray(vao[0]);
+
+    if (sort_mode == SORT_NONE)
+    {
+        glDrawArrays(GL_POINTS, 0, sorter.GetSpriteCount());
+    }
+    else
+    {
+        // The view matrix is the identity, so the model matrix is enough
+        // to find view space depths
+        sorter.SetUseGPU(sort_mode == SORT_GPU);
+        sorter.Sort(GetJobSystem(), model_matrix);
+
+        glUseProgram(render_prog);
+        glDrawElements(GL_POINTS, sorter.GetSpriteCount(), GL_UNSIGNED_INT, NULL);
+
+        if (print_stats)
+        {
+            PrintStats();
+            print_stats = false;
+        }
+    }
+
+    glDisable(GL_BLEND);
 
     base::Display();
 }
@@ -161,7 +217,7 @@ void PointSpriteExample::Finalize(void)
     glUseProgram(0);
     glDeleteProgram(render_prog);
     glDeleteVertexArrays(1, vao);
-    glDeleteBuffers(1, vbo);
+    sorter.Free();
 }
 
 void PointSpriteExample::Resize(int width, int height)
@@ -170,3 +226,50 @@ void PointSpriteExample::Resize(int width, int height)
 
     aspect = float(height) / float(width);
 }
+
+void PointSpriteExample::PrintStats(void)
+{
+    const SpriteSortStats& stats = sorter.GetStats();
+
+    if (stats.gpu)
+    {
+        printf("%u sprites sorted on the GPU in %u passes, %.1f us to issue\n",
+               stats.sprites, stats.passes, stats.sort_time);
+        return;
+    }
+
+    printf("%u sprites: keys %.1f us, sort %.1f us (%u passes), upload %.1f us, %.0f sprites/ms\n",
+           stats.sprites, stats.depth_time, stats.sort_time, stats.passes, stats.upload_time, stats.sprites_per_ms);
+}
+
+void PointSpriteExample::OnKey(int key, int scancode, int action, int mods)
+{
+    if (action == GLFW_PRESS)
+    {
+        switch (key)
+        {
+            case GLFW_KEY_M:
+                sort_mode = (sort_mode + 1) % SORT_MODE_COUNT;
+                sorter.SetUseGPU(sort_mode == SORT_GPU);
+                if (sort_mode == SORT_GPU && !sorter.GetUseGPU())
+                    sort_mode = SORT_NONE;
+                printf("Sprites %s\n", sort_mode_names[sort_mode]);
+                return;
+            case GLFW_KEY_EQUAL:
+                if (sorter.GetSpriteCount() * 4 <= MAX_POINT_COUNT)
+                    sorter.SetSpriteCount(sorter.GetSpriteCount() * 4);
+                printf("%u sprites\n", sorter.GetSpriteCount());
+                return;
+            case GLFW_KEY_MINUS:
+                if (sorter.GetSpriteCount() >= 16)
+                    sorter.SetSpriteCount(sorter.GetSpriteCount() / 4);
+                printf("%u sprites\n", sorter.GetSpriteCount());
+                return;
+            case GLFW_KEY_S:
+                print_stats = true;
+                return;
+        }
+    }
+
+    base::OnKey(key, scancode, action, mods);
+}
@@ -17,6 +17,7 @@
 BEGIN_APP_DECLARATION(TransformFeedbackExample)
     // Override functions from base class
     virtual void Initialize(const char * title);
+    virtual void Update(double dt);
     virtual void Display(bool auto_redraw);
     virtual void Finalize(void);
     virtual void Resize(int width, int height);
@@ -44,40 +45,33 @@ BEGIN_APP_DECLARATION(TransformFeedbackExample)
     GLint triangle_count_loc;
     GLint time_step_loc;
 
+    // The simulation runs in fixed steps, so it behaves the same at any
+    // frame rate. Display draws the model between the last two steps.
+    double simulation_time;
+    unsigned int step_count;
+
     VBObject object;
 END_APP_DECLARATION()
 
 DEFINE_APP(TransformFeedbackExample, "TransformFeedback Example")
 
 const int point_count = 5000;
-static unsigned int seed = 0x13371337;
-
-static inline float random_float()
-{
-    float res;
-    unsigned int tmp;
-
-    seed *= 16807;
+const double time_step = 1.0 / 60.0;
 
-    tmp = seed ^ (seed >> 4) ^ (seed << 15);
-
-    *((unsigned int *) &res) = (tmp >> 9) | 0x3F800000;
-
-    return (res - 1.0f);
-}
+// Keys of the random streams for the particles' directions and speeds
+static const unsigned int direction_key = 0x13371337;
+static const unsigned int speed_key = 0x13371338;
 
-static vmath::vec3 random_vector(float minmag = 0.0f, float maxmag = 1.0f)
+// Point 'n's random vector. It only depends on 'n', so the points can be
+// set up in any order, on any thread.
+static vmath::vec3 random_vector(unsigned int n, float minmag = 0.0f, float maxmag = 1.0f)
 {
-    vmath::vec3 randomvec(random_float() * 2.0f - 1.0f, random_float() * 2.0f - 1.0f, random_float() * 2.0f - 1.0f);
-    randomvec = normalize(randomvec);
-    randomvec *= (random_float() * (maxmag - minmag) + minmag);
-
-    return randomvec;
+    return vmath::random_on_sphere(direction_key, n) * (vmath::random_uniform(speed_key, n) * (maxmag - minmag) + minmag);
 }
 
 void TransformFeedbackExample::Initialize(const char * title)
 {
-    int i, j;
+    int i;
 
     base::Initialize(title);
 
@@ -273,12 +267,17 @@ void TransformFeedbackExample::Initialize(const char * title)
                 vmath::vec3 velocity;
             } * buffer = (buffer_t *)glMapBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, GL_WRITE_ONLY);
 
-            for (j = 0; j < point_count; j++)
+            GetJobSystem().ParallelFor(point_count, 1024, [buffer](unsigned int begin, unsigned int end)
             {
-                buffer[j].velocity = random_vector();
-                buffer[j].position = vmath::vec4(buffer[j].velocity + vmath::vec3(-0.5f, 40.0f, 0.0f), 1.0f);
-                buffer[j].velocity = vmath::vec3(buffer[j].velocity[0], buffer[j].velocity[1] * 0.3f, buffer[j].velocity[2] * 0.3f);
-            }
+                unsigned int n;
+
+                for (n = begin; n < end; n++)
+                {
+                    vmath::vec3 v = random_vector(n);
+                    buffer[n].position = vmath::vec4(v + vmath::vec3(-0.5f, 40.0f, 0.0f), 1.0f);
+                    buffer[n].velocity = vmath::vec3(v[0], v[1] * 0.3f, v[2] * 0.3f);
+                }
+            });
 
             glUnmapBuffer(GL_TRANSFORM_FEEDBACK_BUFFER);
         }
@@ -308,6 +307,12 @@ void TransformFeedbackExample::Initialize(const char * title)
     glClearDepth(1.0f);
 
     object.LoadFromVBM("media/armadillo_low.vbm", 0, 1, 2);
+
+    simulation_time = 0.0;
+    step_count = 0;
+
+    SetFixedTimestep(time_step);
+    SetSwapInterval(1);
 }
 
 static inline int min(int a, int b)
@@ -315,69 +320,85 @@ static inline int min(int a, int b)
     return a < b ? a : b;
 }
 
-void TransformFeedbackExample::Display(bool auto_redraw)
+// The model turns once every 0x3FFFF milliseconds
+static vmath::mat4 model_rotation(double time)
 {
-    static int frame_count = 0;
-    float t = float(app_time() & 0x3FFFF) / float(0x3FFFF);
-    static float q = 0.0f;
-    static const vmath::vec3 X(1.0f, 0.0f, 0.0f);
-    static const vmath::vec3 Y(0.0f, 1.0f, 0.0f);
-    static const vmath::vec3 Z(0.0f, 0.0f, 1.0f);
+    float t = float(fmod(time * 1000.0, double(0x3FFFF)) / double(0x3FFFF));
+
+    return vmath::scale(0.3f) *
+           vmath::rotate(t * 360.0f, 0.0f, 1.0f, 0.0f) *
+           vmath::rotate(t * 360.0f * 3.0f, 0.0f, 0.0f, 1.0f);
+}
 
+void TransformFeedbackExample::Update(double dt)
+{
     vmath::mat4 projection_matrix(vmath::frustum(-1.0f, 1.0f, -aspect, aspect, 1.0f, 5000.0f) * vmath::translate(0.0f, 0.0f, -100.0f));
-    vmath::mat4 model_matrix(vmath::scale(0.3f) *
-                             vmath::rotate(t * 360.0f, 0.0f, 1.0f, 0.0f) *
-                             vmath::rotate(t * 360.0f * 3.0f, 0.0f, 0.0f, 1.0f));
 
-    glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+    simulation_time += dt;
 
-    glEnable(GL_CULL_FACE);
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LEQUAL);
+    // Nothing is drawn here; both passes only capture
+    glEnable(GL_RASTERIZER_DISCARD);
 
+    // Capture the model's world space triangles for the collision tests
     glUseProgram(render_prog);
-    glUniformMatrix4fv(render_model_matrix_loc, 1, GL_FALSE, model_matrix);
+    glUniformMatrix4fv(render_model_matrix_loc, 1, GL_FALSE, model_rotation(simulation_time));
     glUniformMatrix4fv(render_projection_matrix_loc, 1, GL_FALSE, projection_matrix);
 
-    glBindVertexArray(render_vao);
-
     glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, geometry_vbo);
 
     glBeginTransformFeedback(GL_TRIANGLES);
     object.Render();
     glEndTransformFeedback();
 
+    // Move the particles from one buffer into the other
     glUseProgram(update_prog);
-    model_matrix = vmath::mat4::identity();
-    glUniformMatrix4fv(model_matrix_loc, 1, GL_FALSE, model_matrix);
+    glUniformMatrix4fv(model_matrix_loc, 1, GL_FALSE, vmath::mat4::identity());
     glUniformMatrix4fv(projection_matrix_loc, 1, GL_FALSE, projection_matrix);
     glUniform1i(triangle_count_loc, object.GetVertexCount() / 3);
+    glUniform1f(time_step_loc, float(dt * 2000.0 * 1000.0 / double(0x3FFFF)));
 
-    if (t > q)
-    {
-        glUniform1f(time_step_loc, (t - q) * 2000.0f);
-    }
-
-    q = t;
-
-    if ((frame_count & 1) != 0)
-    {
-        glBindVertexArray(vao[1]);
-        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, vbo[0]);
-    }
-    else
-    {
-        glBindVertexArray(vao[0]);
-        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, vbo[1]);
-    }
+    glBindVertexArray(vao[step_count & 1]);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, vbo[(step_count & 1) ^ 1]);
 
     glBeginTransformFeedback(GL_POINTS);
-    glDrawArrays(GL_POINTS, 0, min(point_count, (frame_count >> 3)));
+    glDrawArrays(GL_POINTS, 0, min(point_count, (step_count >> 3)));
     glEndTransformFeedback();
 
     glBindVertexArray(0);
 
-    frame_count++;
+    glDisable(GL_RASTERIZER_DISCARD);
+
+    step_count++;
+}
+
+void TransformFeedbackExample::Display(bool auto_redraw)
+{
+    vmath::mat4 projection_matrix(vmath::frustum(-1.0f, 1.0f, -aspect, aspect, 1.0f, 5000.0f) * vmath::translate(0.0f, 0.0f, -100.0f));
+    double time = simulation_time - (1.0 - GetInterpolationAlpha()) * time_step;
+
+    glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+
+    glEnable(GL_CULL_FACE);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LEQUAL);
+
+    glUseProgram(render_prog);
+    glUniformMatrix4fv(render_model_matrix_loc, 1, GL_FALSE, model_rotation(time > 0.0 ? time : 0.0));
+    glUniformMatrix4fv(render_projection_matrix_loc, 1, GL_FALSE, projection_matrix);
+
+    object.Render();
+
+    // Draw the particles where the last step left them. With no triangles
+    // to test against, the update shader just transforms them.
+    if (step_count != 0)
+    {
+        glUseProgram(update_prog);
+        glUniform1i(triangle_count_loc, 0);
+
+        glBindVertexArray(vao[step_count & 1]);
+        glDrawArrays(GL_POINTS, 0, min(point_count, ((step_count - 1) >> 3)));
+    }
+    glBindVertexArray(0);
 
     base::Display();
 }
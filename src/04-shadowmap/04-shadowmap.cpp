@@ -11,15 +11,23 @@
 #include "vmath.h"
 
 #include "vbm.h"
+#include "vcull.h"
+#include "vshadow.h"
 #include "LoadShaders.h"
 
 #include <stdio.h>
 
 using namespace vmath;
 
-#define FRUSTUM_DEPTH       800.0f
+#define FRUSTUM_DEPTH       2000.0f
 #define DEPTH_TEXTURE_SIZE  2048
 
+// The number of cascades must match the shaders in media/shaders/shadowmap
+#define CASCADE_COUNT       4
+#define CASCADE_LAMBDA      0.75f
+
+#define INSTANCE_COUNT 100
+
 BEGIN_APP_DECLARATION(ShadowMapExample)
     // Override functions from base class
     virtual void Initialize(const char * title);
@@ -30,14 +38,15 @@ BEGIN_APP_DECLARATION(ShadowMapExample)
     // Member variables
     float aspect;
 
-    // Program to render from the light's position
+    // Program to render from the light's position into all of the cascades
     GLuint render_light_prog;
     struct
     {
-        GLint model_view_projection_matrix;
+        GLint cascade_matrix;
     } render_light_uniforms;
 
-    // FBO to render depth with
+    // FBO to render depth with. The depth texture is an array with one
+    // layer per cascade.
     GLuint  depth_fbo;
     GLuint  depth_texture;
 
@@ -45,11 +54,11 @@ BEGIN_APP_DECLARATION(ShadowMapExample)
     GLuint render_scene_prog;
     struct
     {
-        GLint model_matrix;
         GLint view_matrix;
         GLint projection_matrix;
         GLint shadow_matrix;
-        GLint light_position;
+        GLint cascade_far;
+        GLint light_direction;
         GLint material_ambient;
         GLint material_diffuse;
         GLint material_specular;
@@ -62,34 +71,40 @@ BEGIN_APP_DECLARATION(ShadowMapExample)
 
     VBObject object;
 
+    // Per-instance data, refilled for each pass with the instances that
+    // survive culling for that pass
+    GLuint  model_matrix_buffer;
+    GLuint  cascade_mask_buffer;
+
     GLint current_width;
     GLint current_height;
 
-    void DrawScene(bool depth_only = false);
+    void UploadInstances(const mat4 * matrices, const GLuint * masks, unsigned int count);
+    void DrawScene(bool depth_only, unsigned int instance_count);
 END_APP_DECLARATION()
 
-DEFINE_APP(ShadowMapExample, "Shadow Mapping Example")
-
-#define INSTANCE_COUNT 100
+DEFINE_APP(ShadowMapExample, "Cascaded Shadow Mapping Example")
 
 void ShadowMapExample::Initialize(const char * title)
 {
+    int i;
+
     base::Initialize(title);
 
     // Create the program for rendering the scene from the light's POV.
-    glCreateProgram();
-
+    // The geometry shader replicates each triangle into the cascades that
+    // its instance touches, so all cascades are rendered in one pass.
     ShaderInfo light_shaders[] =
     {
         { GL_VERTEX_SHADER, "media/shaders/shadowmap/shadowmap_shadow.vs.glsl" },
+        { GL_GEOMETRY_SHADER, "media/shaders/shadowmap/shadowmap_shadow.gs.glsl" },
         { GL_FRAGMENT_SHADER, "media/shaders/shadowmap/shadowmap_shadow.fs.glsl" },
         { GL_NONE }
     };
 
     render_light_prog = LoadShaders(light_shaders);
 
-    // Get the location of the projetion_matrix uniform
-    render_light_uniforms.model_view_projection_matrix = glGetUniformLocation(render_light_prog, "model_view_projection_matrix");
+    render_light_uniforms.cascade_matrix = glGetUniformLocation(render_light_prog, "cascade_matrix");
 
     // Create the program for rendering the scene from the viewer's position
     ShaderInfo scene_shaders[] =
@@ -102,11 +117,11 @@ void ShadowMapExample::Initialize(const char * title)
     render_scene_prog = LoadShaders(scene_shaders);
 
     // Get the locations of all the uniforms in the program
-    render_scene_uniforms.model_matrix = glGetUniformLocation(render_scene_prog, "model_matrix");
     render_scene_uniforms.view_matrix = glGetUniformLocation(render_scene_prog, "view_matrix");
     render_scene_uniforms.projection_matrix = glGetUniformLocation(render_scene_prog, "projection_matrix");
     render_scene_uniforms.shadow_matrix = glGetUniformLocation(render_scene_prog, "shadow_matrix");
-    render_scene_uniforms.light_position = glGetUniformLocation(render_scene_prog, "light_position");
+    render_scene_uniforms.cascade_far = glGetUniformLocation(render_scene_prog, "cascade_far");
+    render_scene_uniforms.light_direction = glGetUniformLocation(render_scene_prog, "light_direction");
     render_scene_uniforms.material_ambient = glGetUniformLocation(render_scene_prog, "material_ambient");
     render_scene_uniforms.material_diffuse = glGetUniformLocation(render_scene_prog, "material_diffuse");
     render_scene_uniforms.material_specular = glGetUniformLocation(render_scene_prog, "material_specular");
@@ -116,22 +131,23 @@ void ShadowMapExample::Initialize(const char * title)
     glUseProgram(render_scene_prog);
     glUniform1i(glGetUniformLocation(render_scene_prog, "depth_texture"), 0);
 
-    // Create a depth texture
+    // Create a depth texture with a layer for each cascade
     glGenTextures(1, &depth_texture);
-    glBindTexture(GL_TEXTURE_2D, depth_texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32, DEPTH_TEXTURE_SIZE, DEPTH_TEXTURE_SIZE, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-    // Create FBO to render depth into
+    glBindTexture(GL_TEXTURE_2D_ARRAY, depth_texture);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_DEPTH_COMPONENT32F, DEPTH_TEXTURE_SIZE, DEPTH_TEXTURE_SIZE, CASCADE_COUNT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    // Create FBO to render depth into. Attaching the whole array makes the
+    // framebuffer layered, so gl_Layer selects the cascade.
     glGenFramebuffers(1, &depth_fbo);
     glBindFramebuffer(GL_FRAMEBUFFER, depth_fbo);
-    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, depth_texture, 0);
+    glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depth_texture, 0);
     glDrawBuffer(GL_NONE);
 
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
@@ -139,10 +155,10 @@ void ShadowMapExample::Initialize(const char * title)
     // Upload geometry for the ground plane
     static const float ground_vertices[] =
     {
-        -500.0f, -50.0f, -500.0f, 1.0f,
-        -500.0f, -50.0f,  500.0f, 1.0f,
-         500.0f, -50.0f,  500.0f, 1.0f,
-         500.0f, -50.0f, -500.0f, 1.0f,
+        -1000.0f, -50.0f, -1000.0f, 1.0f,
+        -1000.0f, -50.0f,  1000.0f, 1.0f,
+         1000.0f, -50.0f,  1000.0f, 1.0f,
+         1000.0f, -50.0f, -1000.0f, 1.0f,
     };
 
     static const float ground_normals[] =
@@ -168,40 +184,143 @@ void ShadowMapExample::Initialize(const char * title)
 
     // Load the object
     object.LoadFromVBM("media/armadillo_low.vbm", 0, 1, 2);
+
+    // Add the per-instance model matrix (locations 3 to 6) and cascade
+    // mask (location 7) to the object's vertex array
+    object.BindVertexArray();
+
+    glGenBuffers(1, &model_matrix_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, model_matrix_buffer);
+    glBufferData(GL_ARRAY_BUFFER, INSTANCE_COUNT * sizeof(mat4), NULL, GL_DYNAMIC_DRAW);
+    for (i = 0; i < 4; i++)
+    {
+        glVertexAttribPointer(3 + i, 4, GL_FLOAT, GL_FALSE, sizeof(mat4), (void *)(sizeof(vec4) * i));
+        glEnableVertexAttribArray(3 + i);
+        glVertexAttribDivisor(3 + i, 1);
+    }
+
+    glGenBuffers(1, &cascade_mask_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, cascade_mask_buffer);
+    glBufferData(GL_ARRAY_BUFFER, INSTANCE_COUNT * sizeof(GLuint), NULL, GL_DYNAMIC_DRAW);
+    glVertexAttribIPointer(7, 1, GL_UNSIGNED_INT, 0, NULL);
+    glEnableVertexAttribArray(7);
+    glVertexAttribDivisor(7, 1);
+
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void ShadowMapExample::UploadInstances(const mat4 * matrices, const GLuint * masks, unsigned int count)
+{
+    // Orphan the old contents so that we don't wait for the previous pass
+    glBindBuffer(GL_ARRAY_BUFFER, model_matrix_buffer);
+    glBufferData(GL_ARRAY_BUFFER, INSTANCE_COUNT * sizeof(mat4), NULL, GL_DYNAMIC_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(mat4), matrices);
+
+    if (masks != NULL)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, cascade_mask_buffer);
+        glBufferData(GL_ARRAY_BUFFER, INSTANCE_COUNT * sizeof(GLuint), NULL, GL_DYNAMIC_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(GLuint), masks);
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 void ShadowMapExample::Display(bool auto_redraw)
 {
     float t = float(app_time() & 0xFFFF) / float(0xFFFF);
-    static float q = 0.0f;
-    static const vec3 X(1.0f, 0.0f, 0.0f);
     static const vec3 Y(0.0f, 1.0f, 0.0f);
-    static const vec3 Z(0.0f, 0.0f, 1.0f);
+    int i, n;
 
-    vec3 light_position = vec3(sinf(t * 6.0f * 3.141592f) * 300.0f, 200.0f, cosf(t * 4.0f * 3.141592f) * 100.0f + 250.0f);
+    // A directional light that wanders around the sky
+    vec3 light_direction = normalize(vec3(sinf(t * 2.0f * 3.141592f), 1.5f, cosf(t * 2.0f * 3.141592f)));
 
     // Setup
     glEnable(GL_CULL_FACE);
     glEnable(GL_DEPTH_TEST);
     glDepthFunc(GL_LEQUAL);
 
-    // Matrices for rendering the scene
-    mat4 scene_model_matrix = rotate(t * 720.0f, Y);
-    mat4 scene_view_matrix = translate(0.0f, 0.0f, -300.0f);
+    // A grid of instances, each spinning on the spot
+    mat4 matrices[INSTANCE_COUNT];
+
+    for (n = 0; n < INSTANCE_COUNT; n++)
+    {
+        matrices[n] = translate(float(n % 10) * 150.0f - 675.0f, 0.0f, float(n / 10) * 150.0f - 675.0f) *
+                      rotate(t * 720.0f + float(n) * 30.0f, Y);
+    }
+
+    // Matrices for rendering the scene. The camera circles the grid.
+    vec3 eye(sinf(t * 3.141592f) * 900.0f, 150.0f, cosf(t * 3.141592f) * 900.0f);
+    mat4 scene_view_matrix = lookat(eye, vec3(0.0f, -50.0f, 0.0f), Y);
     mat4 scene_projection_matrix = frustum(-1.0f, 1.0f, -aspect, aspect, 1.0f, FRUSTUM_DEPTH);
     const mat4 scale_bias_matrix = mat4(vec4(0.5f, 0.0f, 0.0f, 0.0f),
                                         vec4(0.0f, 0.5f, 0.0f, 0.0f),
                                         vec4(0.0f, 0.0f, 0.5f, 0.0f),
                                         vec4(0.5f, 0.5f, 0.5f, 1.0f));
 
-    // Matrices used when rendering from the light's position
-    mat4 light_view_matrix = lookat(light_position, vec3(0.0f), Y);
-    mat4 light_projection_matrix(frustum(-1.0f, 1.0f, -1.0f, 1.0f, 1.0f, FRUSTUM_DEPTH));
+    // The light's view is anchored at the origin rather than following the
+    // camera so that texel snapping in cascadeProjection keeps static
+    // shadows stable
+    mat4 light_view_matrix = lookat(light_direction, vec3(0.0f), Y);
+
+    // Split the view frustum and fit a projection to each slice
+    float splits[CASCADE_COUNT + 1];
+    mat4 cascade_matrices[CASCADE_COUNT];
+    mat4 shadow_matrices[CASCADE_COUNT];
+
+    cascadeSplits(1.0f, FRUSTUM_DEPTH, CASCADE_COUNT, CASCADE_LAMBDA, splits);
+
+    for (i = 0; i < CASCADE_COUNT; i++)
+    {
+        vec3 corners[8];
+        const float radius = frustumSliceCorners(scene_view_matrix, scene_projection_matrix, splits[i], splits[i + 1], corners);
+
+        cascade_matrices[i] = cascadeProjection(corners, radius, light_view_matrix, DEPTH_TEXTURE_SIZE, 1000.0f) * light_view_matrix;
+        shadow_matrices[i] = scale_bias_matrix * cascade_matrices[i];
+    }
+
+    // Cull the instances against each cascade. Each instance is drawn once
+    // and the geometry shader only emits it into the cascades set in its
+    // mask; instances that reach none of them are dropped altogether.
+    float sphere_x[INSTANCE_COUNT], sphere_y[INSTANCE_COUNT], sphere_z[INSTANCE_COUNT], sphere_r[INSTANCE_COUNT];
+    unsigned int visible[INSTANCE_COUNT];
+    GLuint masks[INSTANCE_COUNT];
+    vec4 planes[6];
+
+    transformSpheres(object.GetBoundingSphere(), matrices, INSTANCE_COUNT, sphere_x, sphere_y, sphere_z, sphere_r);
+
+    for (n = 0; n < INSTANCE_COUNT; n++)
+        masks[n] = 0;
+
+    for (i = 0; i < CASCADE_COUNT; i++)
+    {
+        frustumPlanes(cascade_matrices[i], planes);
+        unsigned int count = cullSpheres(planes, sphere_x, sphere_y, sphere_z, sphere_r, INSTANCE_COUNT, visible);
+        for (n = 0; n < (int)count; n++)
+            masks[visible[n]] |= 1u << i;
+    }
+
+    mat4 caster_matrices[INSTANCE_COUNT];
+    GLuint caster_masks[INSTANCE_COUNT];
+    unsigned int caster_count = 0;
+
+    for (n = 0; n < INSTANCE_COUNT; n++)
+    {
+        if (masks[n] != 0)
+        {
+            caster_matrices[caster_count] = matrices[n];
+            caster_masks[caster_count] = masks[n];
+            caster_count++;
+        }
+    }
+
+    UploadInstances(caster_matrices, caster_masks, caster_count);
 
     // Now we render from the light's position into the depth buffer.
     // Select the appropriate program
     glUseProgram(render_light_prog);
-    glUniformMatrix4fv(render_light_uniforms.model_view_projection_matrix, 1, GL_FALSE, light_projection_matrix * light_view_matrix * scene_model_matrix);
+    glUniformMatrix4fv(render_light_uniforms.cascade_matrix, CASCADE_COUNT, GL_FALSE, cascade_matrices[0]);
 
     // Bind the 'depth only' FBO and set the viewport to the size of the depth texture
     glBindFramebuffer(GL_FRAMEBUFFER, depth_fbo);
@@ -211,40 +330,50 @@ void ShadowMapExample::Display(bool auto_redraw)
     glClearDepth(1.0f);
     glClear(GL_DEPTH_BUFFER_BIT);
 
-    // Enable polygon offset to resolve depth-fighting isuses
+    // Enable polygon offset to resolve depth-fighting isuses. Depth clamping
+    // flattens casters that lie in front of a cascade's near plane onto it
+    // rather than clipping them away.
     glEnable(GL_POLYGON_OFFSET_FILL);
+    glEnable(GL_DEPTH_CLAMP);
     glPolygonOffset(2.0f, 4.0f);
     // Draw from the light's point of view
-    DrawScene(true);
+    DrawScene(true, caster_count);
+    glDisable(GL_DEPTH_CLAMP);
     glDisable(GL_POLYGON_OFFSET_FILL);
 
     // Restore the default framebuffer and field of view
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
     glViewport(0, 0, current_width, current_height);
 
+    // Cull the instances against the view frustum for the main pass
+    frustumPlanes(scene_projection_matrix * scene_view_matrix, planes);
+    unsigned int visible_count = cullSpheres(planes, sphere_x, sphere_y, sphere_z, sphere_r, INSTANCE_COUNT, visible);
+    compactInstances(matrices, visible, visible_count, caster_matrices);
+    UploadInstances(caster_matrices, NULL, visible_count);
+
     // Now render from the viewer's position
     glUseProgram(render_scene_prog);
     glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
 
     // Setup all the matrices
-    glUniformMatrix4fv(render_scene_uniforms.model_matrix, 1, GL_FALSE, scene_model_matrix);
+    vec4 eye_light_direction = vec4(light_direction, 0.0f) * scene_view_matrix.transpose();
     glUniformMatrix4fv(render_scene_uniforms.view_matrix, 1, GL_FALSE, scene_view_matrix);
     glUniformMatrix4fv(render_scene_uniforms.projection_matrix, 1, GL_FALSE, scene_projection_matrix);
-    glUniformMatrix4fv(render_scene_uniforms.shadow_matrix, 1, GL_FALSE, scale_bias_matrix * light_projection_matrix * light_view_matrix);
-    glUniform3fv(render_scene_uniforms.light_position, 1, light_position);
+    glUniformMatrix4fv(render_scene_uniforms.shadow_matrix, CASCADE_COUNT, GL_FALSE, shadow_matrices[0]);
+    glUniform1fv(render_scene_uniforms.cascade_far, CASCADE_COUNT, splits + 1);
+    glUniform3fv(render_scene_uniforms.light_direction, 1, vec3(eye_light_direction[0], eye_light_direction[1], eye_light_direction[2]));
 
     // Bind the depth texture
-    glBindTexture(GL_TEXTURE_2D, depth_texture);
-    glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, depth_texture);
 
     // Draw
-    DrawScene(false);
+    DrawScene(false, visible_count);
 
     // Done
     base::Display();
 }
 
-void ShadowMapExample::DrawScene(bool depth_only)
+void ShadowMapExample::DrawScene(bool depth_only, unsigned int instance_count)
 {
     // Set material properties for the object
     if (!depth_only)
@@ -255,17 +384,27 @@ void ShadowMapExample::DrawScene(bool depth_only)
         glUniform1f(render_scene_uniforms.material_specular_power, 25.0f);
     }
 
-    // Draw the object
-    object.Render();
+    // Draw the objects
+    if (instance_count != 0)
+        object.Render(0, instance_count);
+
+    // The ground only receives shadows, so it isn't drawn into the
+    // shadow map
+    if (depth_only)
+        return;
 
     // Set material properties for the ground
-    if (!depth_only)
-    {
-        glUniform3fv(render_scene_uniforms.material_ambient, 1, vec3(0.1f, 0.1f, 0.1f));
-        glUniform3fv(render_scene_uniforms.material_diffuse, 1, vec3(0.1f, 0.5f, 0.1f));
-        glUniform3fv(render_scene_uniforms.material_specular, 1, vec3(0.1f, 0.1f, 0.1f));
-        glUniform1f(render_scene_uniforms.material_specular_power, 3.0f);
-    }
+    glUniform3fv(render_scene_uniforms.material_ambient, 1, vec3(0.1f, 0.1f, 0.1f));
+    glUniform3fv(render_scene_uniforms.material_diffuse, 1, vec3(0.1f, 0.5f, 0.1f));
+    glUniform3fv(render_scene_uniforms.material_specular, 1, vec3(0.1f, 0.1f, 0.1f));
+    glUniform1f(render_scene_uniforms.material_specular_power, 3.0f);
+
+    // The ground has no per-instance arrays, so give it an identity
+    // model matrix through the current attribute values
+    glVertexAttrib4f(3, 1.0f, 0.0f, 0.0f, 0.0f);
+    glVertexAttrib4f(4, 0.0f, 1.0f, 0.0f, 0.0f);
+    glVertexAttrib4f(5, 0.0f, 0.0f, 1.0f, 0.0f);
+    glVertexAttrib4f(6, 0.0f, 0.0f, 0.0f, 1.0f);
 
     // Draw the ground
     glBindVertexArray(ground_vao);
@@ -280,6 +419,10 @@ void ShadowMapExample::Finalize(void)
     glDeleteProgram(render_scene_prog);
     glDeleteBuffers(1, &ground_vbo);
     glDeleteVertexArrays(1, &ground_vao);
+    glDeleteBuffers(1, &model_matrix_buffer);
+    glDeleteBuffers(1, &cascade_mask_buffer);
+    glDeleteFramebuffers(1, &depth_fbo);
+    glDeleteTextures(1, &depth_texture);
 }
 
 void ShadowMapExample::Resize(int width, int height)
@@ -0,0 +1,376 @@
+/* $URL$
+   $Rev$
+   $Author$
+   $Date$
+   $Id$
+ */
+
+#include "vapp.h"
+#include "vutils.h"
+
+#include "vmath.h"
+
+#include "vbm.h"
+#include "vskeleton.h"
+
+#include <stdio.h>
+#include <string.h>
+
+using namespace vmath;
+
+// A crowd of tentacles, each with its own skeleton pose. The tentacle, its
+// skeleton and a clip that waves it about come from a VBM file as vbmexport
+// writes skinned meshes (vbench -write skinning makes it); a second clip,
+// which twists it, is keyed here.
+enum
+{
+    KEY_COUNT           = 33,
+    GRID_WIDTH          = 48,
+    CHARACTER_COUNT     = GRID_WIDTH * GRID_WIDTH
+};
+
+static const char * const mode_names[] =
+{
+    "linear blend skinning on the GPU",
+    "dual quaternion skinning on the GPU",
+    "linear blend skinning on the CPU",
+    "dual quaternion skinning on the CPU"
+};
+
+BEGIN_APP_DECLARATION(SkinningExample)
+    // Override functions from base class
+    virtual void Initialize(const char * title);
+    virtual void Update(double dt);
+    virtual void Display(bool auto_redraw);
+    virtual void Finalize(void);
+    virtual void Resize(int width, int height);
+    virtual void OnKey(int key, int scancode, int action, int mods);
+
+    bool LoadTentacle(void);
+
+    // Member variables
+    float aspect;
+
+    GLuint render_prog;
+    GLint view_projection_loc;
+    GLint skinning_mode_loc;
+    GLint joint_count_loc;
+    GLint vertex_count_loc;
+    GLint grid_width_loc;
+
+    // Kept in memory too, for skinning on the CPU
+    VBObject object;
+
+    Skeleton skeleton;
+    SkinnedMesh mesh;
+    CrowdAnimator animator;
+    CharacterState characters[CHARACTER_COUNT];
+    float time_offsets[CHARACTER_COUNT];
+
+    double animation_time;
+    int mode;
+    unsigned int clip;
+    bool slerp;
+    bool print_stats;
+END_APP_DECLARATION()
+
+DEFINE_APP(SkinningExample, "Skeletal Animation Example")
+
+static void set_rotation(VBM_JOINT_POSE& pose, const vec3& axis, float angle)
+{
+    const vec3 a = normalize(axis) * sinf(angle * 0.5f);
+
+    pose.rotation.x = a[0];
+    pose.rotation.y = a[1];
+    pose.rotation.z = a[2];
+    pose.rotation.w = cosf(angle * 0.5f);
+}
+
+bool SkinningExample::LoadTentacle(void)
+{
+    if (!object.LoadFromVBM("media/tentacle.vbm", 0, 1, 2, VBM_LOAD_KEEP_DATA) ||
+        !skeleton.Initialize(object) || !mesh.FromVBM(object))
+    {
+        printf("Can't load the skinned tentacle from media/tentacle.vbm\n");
+        return false;
+    }
+
+    // "take" bends the chain back and forth about an axis that turns
+    // slowly, sending ripples up it. "twist" twists each joint about the
+    // bone, which is where linear blend skinning pinches and dual
+    // quaternions don't.
+    const unsigned int joint_count = skeleton.GetJointCount();
+    const VBM_JOINT * joints = object.GetJoints();
+    VBM_JOINT_POSE * keys = new VBM_JOINT_POSE[KEY_COUNT * joint_count];
+    unsigned int i;
+    int k;
+
+    for (k = 0; k < KEY_COUNT; k++)
+    {
+        const float phase = 6.2831853f * float(k) / float(KEY_COUNT - 1);
+
+        for (i = 0; i < joint_count; i++)
+        {
+            keys[k * joint_count + i] = joints[i].bind_pose;
+            set_rotation(keys[k * joint_count + i], vec3(0.15f * sinf(phase), 1.0f, 0.0f), 0.5f * sinf(phase));
+        }
+    }
+    skeleton.AddClip("twist", 3.0f, keys, KEY_COUNT);
+
+    delete [] keys;
+
+    return true;
+}
+
+void SkinningExample::Initialize(const char * title)
+{
+    int i;
+
+    base::Initialize(title);
+
+    render_prog = glCreateProgram();
+
+    // Mode 0 reads vertices skinned on the CPU; 1 and 2 skin here from
+    // the palette. Both palette bindings refer to the same buffer.
+    static const char render_vs[] =
+        "#version 430 core\n"
+        "\n"
+        "layout (location = 0) in vec4 position;\n"
+        "layout (location = 1) in vec3 normal;\n"
+        "layout (location = 2) in vec4 joints;\n"
+        "layout (location = 3) in vec4 weights;\n"
+        "\n"
+        "layout (std430, binding = 0) readonly buffer matrix_palette\n"
+        "{\n"
+        "    mat4 matrices[];\n"
+        "};\n"
+        "\n"
+        "layout (std430, binding = 1) readonly buffer dual_quaternion_palette\n"
+        "{\n"
+        "    vec4 dual_quaternions[];\n"
+        "};\n"
+        "\n"
+        "layout (std430, binding = 2) readonly buffer skinned_vertices\n"
+        "{\n"
+        "    vec4 skinned[];\n"
+        "};\n"
+        "\n"
+        "uniform mat4 view_projection;\n"
+        "uniform int skinning_mode;\n"
+        "uniform int joint_count;\n"
+        "uniform int vertex_count;\n"
+        "uniform int grid_width;\n"
+        "\n"
+        "out VERTEX\n"
+        "{\n"
+        "    vec3    normal;\n"
+        "    vec4    color;\n"
+        "} vertex;\n"
+        "\n"
+        "void main(void)\n"
+        "{\n"
+        "    ivec4 j = ivec4(joints) + gl_InstanceID * joint_count;\n"
+        "    vec4 p;\n"
+        "    vec3 n;\n"
+        "    int i;\n"
+        "\n"
+        "    if (skinning_mode == 0)\n"
+        "    {\n"
+        "        int v = (gl_InstanceID * vertex_count + gl_VertexID) * 2;\n"
+        "        p = skinned[v];\n"
+        "        n = skinned[v + 1].xyz;\n"
+        "    }\n"
+        "    else if (skinning_mode == 1)\n"
+        "    {\n"
+        "        mat4 m = matrices[j.x] * weights.x + matrices[j.y] * weights.y +\n"
+        "                 matrices[j.z] * weights.z + matrices[j.w] * weights.w;\n"
+        "        p = m * position;\n"
+        "        n = mat3(m) * normal;\n"
+        "    }\n"
+        "    else\n"
+        "    {\n"
+        "        vec4 pivot = dual_quaternions[j.x * 2];\n"
+        "        vec4 real = vec4(0.0);\n"
+        "        vec4 dual = vec4(0.0);\n"
+        "\n"
+        "        for (i = 0; i < 4; i++)\n"
+        "        {\n"
+        "            vec4 r = dual_quaternions[j[i] * 2];\n"
+        "            float w = dot(r, pivot) < 0.0 ? -weights[i] : weights[i];\n"
+        "            real += r * w;\n"
+        "            dual += dual_quaternions[j[i] * 2 + 1] * w;\n"
+        "        }\n"
+        "\n"
+        "        float l = length(real);\n"
+        "        real /= l;\n"
+        "        dual /= l;\n"
+        "\n"
+        "        vec3 t = 2.0 * (real.w * dual.xyz - dual.w * real.xyz + cross(real.xyz, dual.xyz));\n"
+        "        p = vec4(position.xyz + 2.0 * cross(real.xyz, cross(real.xyz, position.xyz) + real.w * position.xyz) + t, 1.0);\n"
+        "        n = normal + 2.0 * cross(real.xyz, cross(real.xyz, normal) + real.w * normal);\n"
+        "    }\n"
+        "\n"
+        "    vec2 cell = vec2(gl_InstanceID % grid_width, gl_InstanceID / grid_width) - vec2(0.5 * float(grid_width - 1));\n"
+        "    float k = float(gl_InstanceID);\n"
+        "\n"
+        "    p.xz += cell * 3.0;\n"
+        "    gl_Position = view_projection * p;\n"
+        "    vertex.normal = normalize(n);\n"
+        "    vertex.color = vec4(0.5 + 0.25 * (sin(k / 4.0 + 1.0) + 1.0),\n"
+        "                        0.5 + 0.25 * (sin(k / 5.0 + 2.0) + 1.0),\n"
+        "                        0.5 + 0.25 * (sin(k / 6.0 + 3.0) + 1.0),\n"
+        "                        1.0);\n"
+        "}\n";
+
+    static const char render_fs[] =
+        "#version 430 core\n"
+        "\n"
+        "layout (location = 0) out vec4 color;\n"
+        "\n"
+        "in VERTEX\n"
+        "{\n"
+        "    vec3    normal;\n"
+        "    vec4    color;\n"
+        "} vertex;\n"
+        "\n"
+        "void main(void)\n"
+        "{\n"
+        "    float l = abs(dot(normalize(vertex.normal), normalize(vec3(0.3, 1.0, 0.5))));\n"
+        "    color = vertex.color * (0.2 + 0.8 * l);\n"
+        "}\n";
+
+    vglAttachShaderSource(render_prog, GL_VERTEX_SHADER, render_vs);
+    vglAttachShaderSource(render_prog, GL_FRAGMENT_SHADER, render_fs);
+
+    glLinkProgram(render_prog);
+
+    view_projection_loc = glGetUniformLocation(render_prog, "view_projection");
+    skinning_mode_loc = glGetUniformLocation(render_prog, "skinning_mode");
+    joint_count_loc = glGetUniformLocation(render_prog, "joint_count");
+    vertex_count_loc = glGetUniformLocation(render_prog, "vertex_count");
+    grid_width_loc = glGetUniformLocation(render_prog, "grid_width");
+
+    if (LoadTentacle())
+        animator.Initialize(&skeleton, &mesh, CHARACTER_COUNT);
+
+    // Start everyone at a different point in the clip
+    for (i = 0; i < CHARACTER_COUNT; i++)
+        time_offsets[i] = random_uniform(0x5EED5EED, i) * 10.0f;
+
+    animation_time = 0.0;
+    mode = 0;
+    clip = 0;
+    slerp = false;
+    print_stats = false;
+}
+
+void SkinningExample::Update(double dt)
+{
+    animation_time += dt;
+}
+
+void SkinningExample::Display(bool auto_redraw)
+{
+    const SkinningMethod method = (mode & 1) ? SKINNING_DUAL_QUATERNION : SKINNING_LINEAR;
+    const bool cpu = mode >= 2;
+    int i;
+
+    // Nothing to animate if the tentacle didn't load
+    if (skeleton.GetJointCount() == 0)
+    {
+        base::Display();
+        return;
+    }
+
+    for (i = 0; i < CHARACTER_COUNT; i++)
+    {
+        characters[i].clip = clip;
+        characters[i].time = float(animation_time) + time_offsets[i];
+    }
+
+    animator.Update(GetJobSystem(), characters, CHARACTER_COUNT, method, cpu, slerp ? SKELETON_SLERP : SKELETON_NLERP);
+    animator.Upload();
+
+    if (print_stats)
+    {
+        const SkinningStats& stats = animator.GetStats();
+
+        printf("%u characters of %u joints, %s: evaluate %.0f us, skin %.0f us, upload %.0f us, %.1f characters/ms\n",
+               stats.characters, stats.joints, mode_names[mode],
+               stats.evaluate_time, stats.skinning_time, stats.upload_time, stats.characters_per_ms);
+        print_stats = false;
+    }
+
+    glClearColor(0.1f, 0.1f, 0.15f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    glDisable(GL_CULL_FACE);
+    glEnable(GL_DEPTH_TEST);
+    glDepthFunc(GL_LEQUAL);
+
+    const float t = float(animation_time) * 0.05f;
+    vec3 eye(cosf(t) * 110.0f, 45.0f, sinf(t) * 110.0f);
+    mat4 view_projection = frustum(-1.0f, 1.0f, -aspect, aspect, 1.0f, 500.0f) *
+                           lookat(eye, vec3(0.0f, 0.0f, 0.0f), vec3(0.0f, 1.0f, 0.0f));
+
+    glUseProgram(render_prog);
+
+    glUniformMatrix4fv(view_projection_loc, 1, GL_FALSE, view_projection);
+    glUniform1i(skinning_mode_loc, cpu ? 0 : method == SKINNING_LINEAR ? 1 : 2);
+    glUniform1i(joint_count_loc, skeleton.GetJointCount());
+    glUniform1i(vertex_count_loc, mesh.vertex_count);
+    glUniform1i(grid_width_loc, GRID_WIDTH);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, animator.GetPaletteBuffer());
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, animator.GetPaletteBuffer());
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, animator.GetVertexBuffer());
+
+    object.Render(0, CHARACTER_COUNT);
+
+    base::Display();
+}
+
+void SkinningExample::Finalize(void)
+{
+    glUseProgram(0);
+    glDeleteProgram(render_prog);
+    animator.Free();
+    skeleton.Free();
+    object.Free();
+}
+
+void SkinningExample::Resize(int width, int height)
+{
+    glViewport(0, 0 , width, height);
+
+    aspect = float(height) / float(width);
+}
+
+void SkinningExample::OnKey(int key, int scancode, int action, int mods)
+{
+    if (action == GLFW_PRESS)
+    {
+        switch (key)
+        {
+            case GLFW_KEY_M:
+                mode = (mode + 1) % 4;
+                printf("Using %s\n", mode_names[mode]);
+                return;
+            case GLFW_KEY_C:
+                if (skeleton.GetClipCount() == 0)
+                    return;
+                clip = (clip + 1) % skeleton.GetClipCount();
+                printf("Playing clip %u\n", clip);
+                return;
+            case GLFW_KEY_I:
+                slerp = !slerp;
+                printf("Interpolating keys with %s\n", slerp ? "slerp" : "nlerp");
+                return;
+            case GLFW_KEY_S:
+                print_stats = true;
+                return;
+        }
+    }
+
+    base::OnKey(key, scancode, action, mods);
+}
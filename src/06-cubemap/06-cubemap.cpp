@@ -21,6 +21,9 @@ BEGIN_APP_DECLARATION(CubeMapExample)
     virtual void Display(bool auto_redraw);
     virtual void Finalize(void);
     virtual void Resize(int width, int height);
+    virtual void OnKey(int key, int scancode, int action, int mods);
+
+    void LoadObject(void);
 
     // Member variables
     float aspect;
@@ -38,6 +41,7 @@ BEGIN_APP_DECLARATION(CubeMapExample)
     GLint object_mat_mv_loc;
 
     VBObject object;
+    bool pack_vertices;
 END_APP_DECLARATION()
 
 DEFINE_APP(CubeMapExample, "Cube Map Example")
@@ -175,7 +179,31 @@ void CubeMapExample::Initialize(const char * title)
 
     vglUnloadImage(&image);
 
-    object.LoadFromVBM("media/torus.vbm", 0, 1, 2);
+    pack_vertices = false;
+    LoadObject();
+}
+
+void CubeMapExample::LoadObject(void)
+{
+    object.Free();
+    object.LoadFromVBM("media/torus.vbm", 0, 1, 2, pack_vertices ? VBM_LOAD_PACK_VERTICES : 0);
+    printf("Vertices: %s\n", pack_vertices ? "packed" : "float");
+}
+
+void CubeMapExample::OnKey(int key, int scancode, int action, int mods)
+{
+    if (action == GLFW_PRESS)
+    {
+        switch (key)
+        {
+            case GLFW_KEY_P:
+                pack_vertices = !pack_vertices;
+                LoadObject();
+                return;
+        }
+    }
+
+    base::OnKey(key, scancode, action, mods);
 }
 
 void CubeMapExample::Display(bool auto_redraw)
@@ -11,10 +11,42 @@
 #include "vapp.h"
 #include "vutils.h"
 #include "vbm.h"
+#include "vcluster.h"
 
 #include "vmath.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+
+#define LIGHT_COUNT     1024
+#define NEAR_PLANE      0.1f
+#define FAR_PLANE       1000.0f
+#define PALETTE_SIZE    16
+
+// The lights' colors, worked out by the compiler from a counter-based
+// random stream and kept in read-only data
+struct LightPalette
+{
+    vmath::vec4 colors[PALETTE_SIZE];
+};
+
+static constexpr LightPalette make_light_palette(unsigned int key)
+{
+    LightPalette palette;
+
+    for (int i = 0; i < PALETTE_SIZE; i++)
+    {
+        palette.colors[i] = vmath::vec4(vmath::random_uniform(key, i * 3),
+                                        vmath::random_uniform(key, i * 3 + 1),
+                                        vmath::random_uniform(key, i * 3 + 2),
+                                        1.0f);
+    }
+
+    return palette;
+}
+
+static constexpr LightPalette light_palette = make_light_palette(0x1164u);
+static constexpr vmath::mat4 view_matrix = vmath::translate(0.0f, 0.0f, -60.0f);
 
 BEGIN_APP_DECLARATION(LightingExample)
     // Override functions from base class
@@ -22,6 +54,7 @@ BEGIN_APP_DECLARATION(LightingExample)
     virtual void Display(bool auto_redraw);
     virtual void Finalize(void);
     virtual void Resize(int width, int height);
+    virtual void OnKey(int key, int scancode, int action, int mods);
 
     // Texture for compute shader to write into
     GLuint  output_image;
@@ -32,18 +65,37 @@ BEGIN_APP_DECLARATION(LightingExample)
     // Uniform locations
     GLint   mv_mat_loc;
     GLint   prj_mat_loc;
+    GLint   nrm_mat_loc;
     GLint   col_amb_loc;
     GLint   col_diff_loc;
     GLint   col_spec_loc;
 
     // Object to render
     VBObject    object;
+
+    // Point lights, assigned to froxels every frame
+    ClusteredLighting   clusters;
+    ClusterLight        lights[LIGHT_COUNT];
+    float               light_speed[LIGHT_COUNT];
+    bool                use_cpu;
+
+    // Squash the torus, which mat3(model_matrix) would light wrongly
+    bool    squash;
+
+    int     current_width;
+    int     current_height;
+    float   aspect;
 END_APP_DECLARATION()
 
 DEFINE_APP(LightingExample, "Lighting Example")
 
 void LightingExample::Initialize(const char * title)
 {
+    int i;
+
+    use_cpu = false;
+    squash = false;
+
     base::Initialize(title);
 
     // Now create a simple program to visualize the result
@@ -54,19 +106,20 @@ void LightingExample::Initialize(const char * title)
         "\n"
         "uniform mat4 model_matrix;\n"
         "uniform mat4 proj_matrix;\n"
+        "uniform mat3 normal_matrix;\n"
         "\n"
         "layout (location = 0) in vec4 position;\n"
         "layout (location = 1) in vec3 normal;\n"
         "\n"
-        "out vec3 vs_worldpos;\n"
+        "out vec3 vs_viewpos;\n"
         "out vec3 vs_normal;\n"
         "\n"
         "void main(void)\n"
         "{\n"
-        "    vec4 position = proj_matrix * model_matrix * position;\n"
-        "    gl_Position = position;\n"
-        "    vs_worldpos = position.xyz;\n"
-        "    vs_normal = mat3(model_matrix) * normal;\n"
+        "    vec4 view_position = model_matrix * position;\n"
+        "    gl_Position = proj_matrix * view_position;\n"
+        "    vs_viewpos = view_position.xyz;\n"
+        "    vs_normal = normal_matrix * normal;\n"
         "}\n"
         ;
 
@@ -75,24 +128,68 @@ void LightingExample::Initialize(const char * title)
         "\n"
         "layout (location = 0) out vec4 color;\n"
         "\n"
-        "in vec3 vs_worldpos;\n"
+        "in vec3 vs_viewpos;\n"
         "in vec3 vs_normal;\n"
         "\n"
-        "uniform vec4 color_ambient = vec4(0.1, 0.2, 0.5, 1.0);\n"
-        "uniform vec4 color_diffuse = vec4(0.2, 0.3, 0.6, 1.0);\n"
-        "uniform vec4 color_specular = vec4(0.0); // vec4(1.0, 1.0, 1.0, 1.0);\n"
+        "uniform vec4 color_ambient = vec4(0.02, 0.02, 0.05, 1.0);\n"
+        "uniform vec4 color_diffuse = vec4(0.6, 0.6, 0.6, 1.0);\n"
+        "uniform vec4 color_specular = vec4(0.4, 0.4, 0.4, 1.0);\n"
         "uniform float shininess = 77.0f;\n"
         "\n"
-        "uniform vec3 light_position = vec3(12.0f, 32.0f, 560.0f);\n"
+        "// Froxel grid and light lists from ClusteredLighting\n"
+        "layout (std140, binding = 0) uniform CLUSTER_PARAMS\n"
+        "{\n"
+        "    uvec4 cluster_grid;\n"
+        "    vec4  cluster_depth;\n"
+        "    vec4  cluster_tile;\n"
+        "};\n"
+        "\n"
+        "layout (std430, binding = 0) readonly buffer CLUSTER_LIGHTS\n"
+        "{\n"
+        "    vec4 lights[];\n"
+        "};\n"
+        "\n"
+        "layout (std430, binding = 1) readonly buffer CLUSTER_RANGES\n"
+        "{\n"
+        "    uvec2 clusters[];\n"
+        "};\n"
+        "\n"
+        "layout (std430, binding = 2) readonly buffer CLUSTER_INDICES\n"
+        "{\n"
+        "    uint light_indices[];\n"
+        "};\n"
         "\n"
         "void main(void)\n"
         "{\n"
-        "    vec3 light_direction = normalize(light_position - vs_worldpos);\n"
+        "    // Find the froxel that this fragment is in\n"
+        "    uvec2 tile = min(uvec2(gl_FragCoord.xy * cluster_tile.xy), cluster_grid.xy - 1u);\n"
+        "    uint slice = uint(clamp(log(-vs_viewpos.z) * cluster_depth.x + cluster_depth.y, 0.0, float(cluster_grid.z - 1u)));\n"
+        "    uvec2 range = clusters[tile.x + (tile.y + slice * cluster_grid.y) * cluster_grid.x];\n"
+        "\n"
         "    vec3 normal = normalize(vs_normal);\n"
-        "    vec3 half_vector = normalize(light_direction + normalize(vs_worldpos));\n"
-        "    float diffuse = max(0.0, dot(normal, light_direction));\n"
-        "    float specular = pow(max(0.0, dot(vs_normal, half_vector)), shininess);\n"
-        "    color = color_ambient + diffuse * color_diffuse + specular * color_specular;\n"
+        "    vec3 view_direction = normalize(-vs_viewpos);\n"
+        "    vec3 result = color_ambient.rgb;\n"
+        "\n"
+        "    // Only the lights that can reach the froxel\n"
+        "    for (uint i = 0; i < range.y; i++)\n"
+        "    {\n"
+        "        uint light = light_indices[range.x + i];\n"
+        "        vec4 light_position = lights[light * 2];\n"
+        "        vec3 light_color = lights[light * 2 + 1].rgb;\n"
+        "\n"
+        "        vec3 light_direction = light_position.xyz - vs_viewpos;\n"
+        "        float distance = length(light_direction);\n"
+        "        float attenuation = clamp(1.0 - distance / light_position.w, 0.0, 1.0);\n"
+        "        light_direction /= distance;\n"
+        "\n"
+        "        vec3 half_vector = normalize(light_direction + view_direction);\n"
+        "        float diffuse = max(0.0, dot(normal, light_direction));\n"
+        "        float specular = pow(max(0.0, dot(normal, half_vector)), shininess);\n"
+        "        result += light_color * attenuation * attenuation *\n"
+        "                  (diffuse * color_diffuse.rgb + specular * color_specular.rgb);\n"
+        "    }\n"
+        "\n"
+        "    color = vec4(result, 1.0);\n"
         "}\n";
 
     vglAttachShaderSource(render_prog, GL_VERTEX_SHADER, render_vs);
@@ -102,26 +199,65 @@ void LightingExample::Initialize(const char * title)
 
     mv_mat_loc = glGetUniformLocation(render_prog, "model_matrix");
     prj_mat_loc = glGetUniformLocation(render_prog, "proj_matrix");
+    nrm_mat_loc = glGetUniformLocation(render_prog, "normal_matrix");
     col_amb_loc = glGetUniformLocation(render_prog, "color_ambient");
     col_diff_loc = glGetUniformLocation(render_prog, "color_diffuse");
     col_spec_loc = glGetUniformLocation(render_prog, "color_specular");
 
     object.LoadFromVBM("media/torus.vbm", 0, 1, 2);
+
+    // Scatter small colored lights through a slab around the torus. Their
+    // positions are animated in Display.
+    for (i = 0; i < LIGHT_COUNT; i++)
+    {
+        lights[i].position = vmath::vec4(float(rand() % 1000) * 0.06f - 30.0f,
+                                         float(rand() % 1000) * 0.06f - 30.0f,
+                                         float(rand() % 1000) * 0.02f - 10.0f,
+                                         3.0f + float(rand() % 1000) * 0.005f);
+        lights[i].color = light_palette.colors[rand() % PALETTE_SIZE];
+        light_speed[i] = float(rand() % 1000) * 0.002f - 1.0f;
+    }
+
+    clusters.Initialize(16, 9, 24, LIGHT_COUNT);
+    clusters.SetProjection(vmath::perspective(60.0f, aspect, NEAR_PLANE, FAR_PLANE), NEAR_PLANE, FAR_PLANE,
+                           current_width, current_height);
 }
 
 void LightingExample::Display(bool auto_redraw)
 {
     float time = float(app_time() & 0xFFFF) / float(0xFFFF);
+    ClusterLight moved[LIGHT_COUNT];
+    int i;
 
-    vmath::mat4 mv_matrix = vmath::translate(0.0f, 0.0f, -60.0f) *
+    vmath::mat4 mv_matrix = view_matrix *
                             vmath::rotate(987.0f * time * 3.14159f, vmath::vec3(0.0f, 0.0f, 1.0f)) *
-                            vmath::rotate(1234.0f * time * 3.14159f, vmath::vec3(1.0f, 0.0f, 0.0f));
-    vmath::mat4 prj_matrix = vmath::perspective(60.0f, 1.333f, 0.1f, 1000.0f);
+                            vmath::rotate(1234.0f * time * 3.14159f, vmath::vec3(1.0f, 0.0f, 0.0f)) *
+                            vmath::scale(1.0f, squash ? 0.3f : 1.0f, 1.0f);
+    vmath::mat3 normal_matrix = vmath::inverseTranspose3x3(mv_matrix);
+    vmath::mat4 prj_matrix = vmath::perspective(60.0f, aspect, NEAR_PLANE, FAR_PLANE);
+
+    // Swirl the lights around the z axis, each at its own speed
+    for (i = 0; i < LIGHT_COUNT; i++)
+    {
+        const float a = light_speed[i] * time * 100.0f;
+        const float s = sinf(a);
+        const float c = cosf(a);
+        const vmath::vec4& p = lights[i].position;
+
+        moved[i].position = vmath::vec4(p[0] * c - p[1] * s, p[0] * s + p[1] * c, p[2], p[3]);
+        moved[i].color = lights[i].color;
+    }
+
+    clusters.SetLights(moved, LIGHT_COUNT);
+    clusters.Update(GetJobSystem(), view_matrix, use_cpu);
 
     glUseProgram(render_prog);
 
     glUniformMatrix4fv(mv_mat_loc, 1, GL_FALSE, mv_matrix);
     glUniformMatrix4fv(prj_mat_loc, 1, GL_FALSE, prj_matrix);
+    glUniformMatrix3fv(nrm_mat_loc, 1, GL_FALSE, normal_matrix);
+
+    clusters.Bind();
 
     // Clear, select the rendering program and draw a full screen quad
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -140,9 +276,43 @@ void LightingExample::Finalize(void)
     glUseProgram(0);
     glDeleteProgram(render_prog);
     glDeleteTextures(1, &output_image);
+    clusters.Free();
 }
 
 void LightingExample::Resize(int width, int height)
 {
     glViewport(0, 0, width, height);
+
+    current_width = width;
+    current_height = height;
+    aspect = float(width) / float(height);
+
+    clusters.SetProjection(vmath::perspective(60.0f, aspect, NEAR_PLANE, FAR_PLANE), NEAR_PLANE, FAR_PLANE,
+                           width, height);
+}
+
+void LightingExample::OnKey(int key, int scancode, int action, int mods)
+{
+    if (action != GLFW_PRESS)
+        return;
+
+    switch (key)
+    {
+        // Switch between assigning lights with the compute shader and on
+        // the CPU
+        case 'C': use_cpu = !use_cpu;
+            break;
+        case 'N': squash = !squash;
+            break;
+        case 'S':
+            {
+                const ClusterStats& stats = clusters.GetStats();
+                printf("Clusters: %u lights, %u indices, %.2f per froxel (max %u, %u full), %.1f us on the CPU\n",
+                       stats.lights, stats.light_indices, stats.average_cluster_lights,
+                       stats.max_cluster_lights, stats.overflowed_clusters, stats.assign_time);
+            }
+            break;
+        default:
+            break;
+    }
 }
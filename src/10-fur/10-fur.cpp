@@ -10,9 +10,12 @@
 #include "vbm.h"
 
 #include "vmath.h"
+#include "vrandom.h"
+#include "vjobs.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <vector>
 
 BEGIN_APP_DECLARATION(FurApplication)
     // Override functions from base class
@@ -195,19 +198,29 @@ void FurApplication::Initialize(const char * title)
     unsigned char * tex = (unsigned char *)malloc(1024 * 1024 * 4);
     memset(tex, 0, 1024 * 1024 * 4);
 
-    int n, m;
+    // Two random words a strand, one for where and one for the color.
+    // They're counter-based, so the runs can be filled on any thread; the
+    // strands are then placed in order so that later layers win.
+    const unsigned int strands = 256 * 1270;
+    std::vector<unsigned int> bits(strands * 2);
+    unsigned int n;
 
-    for (n = 0; n < 256; n++)
+    GetJobSystem().ParallelFor(strands * 2, 16384, [&](unsigned int begin, unsigned int end)
     {
-        for (m = 0; m < 1270; m++)
-        {
-            int x = rand() & 0x3FF;
-            int y = rand() & 0x3FF;
-            tex[(y * 1024 + x) * 4 + 0] = (rand() & 0x3F) + 0xC0;
-            tex[(y * 1024 + x) * 4 + 1] = (rand() & 0x3F) + 0xC0;
-            tex[(y * 1024 + x) * 4 + 2] = (rand() & 0x3F) + 0xC0;
-            tex[(y * 1024 + x) * 4 + 3] = n;
-        }
+        vmath::random_fill_bits(&bits[begin], end - begin, 0xF0Fu, begin);
+    });
+
+    for (n = 0; n < strands; n++)
+    {
+        const unsigned int where = bits[n * 2 + 0];
+        const unsigned int color = bits[n * 2 + 1];
+        const unsigned int x = where & 0x3FF;
+        const unsigned int y = (where >> 10) & 0x3FF;
+
+        tex[(y * 1024 + x) * 4 + 0] = (color & 0x3F) + 0xC0;
+        tex[(y * 1024 + x) * 4 + 1] = ((color >> 6) & 0x3F) + 0xC0;
+        tex[(y * 1024 + x) * 4 + 2] = ((color >> 12) & 0x3F) + 0xC0;
+        tex[(y * 1024 + x) * 4 + 3] = n / 1270;
     }
 
     glBindTexture(GL_TEXTURE_2D, fur_texture);
@@ -11,13 +11,16 @@
 #include "vmath.h"
 
 #include "vbm.h"
+#include "voit.h"
 #include "LoadShaders.h"
 
 #include <stdio.h>
 #include <string>
 
-#define MAX_FRAMEBUFFER_WIDTH 2048
-#define MAX_FRAMEBUFFER_HEIGHT 2048
+// Linked lists may grow to this many bytes of fragments before the demo
+// falls back to a k-buffer with OIT_K fragments per pixel
+#define OIT_MEMORY_BUDGET (128 * 1024 * 1024)
+#define OIT_K 8
 
 namespace vtarga
 {
@@ -39,20 +42,11 @@ BEGIN_APP_DECLARATION(OITDemo)
     // Member variables
     float aspect;
 
-    // Program to construct the linked list (renders the transparent objects)
-    GLuint  list_build_program;
+    // Fragment storage (linked lists, k-buffer or weighted blending)
+    OITBuffer oit;
 
-    // Head pointer image and PBO for clearing it
-    GLuint  head_pointer_texture;
-    GLuint  head_pointer_clear_buffer;
-    // Atomic counter buffer
-    GLuint  atomic_counter_buffer;
-    // Linked list buffer
-    GLuint  linked_list_buffer;
-    GLuint  linked_list_texture;
-
-    // Program to render the scene
-    GLuint render_scene_prog;
+    // Programs to render the scene into the OIT buffer, one per OITMode
+    GLuint render_scene_prog[3];
     struct
     {
         GLint aspect;
@@ -60,10 +54,10 @@ BEGIN_APP_DECLARATION(OITDemo)
         GLint model_matrix;
         GLint view_matrix;
         GLint projection_matrix;
-    } render_scene_uniforms;
+    } render_scene_uniforms[3];
 
-    // Program to resolve 
-    GLuint resolve_program;
+    // Programs to resolve, one per OITMode
+    GLuint resolve_program[3];
 
     // Full Screen Quad
     GLuint  quad_vbo;
@@ -76,56 +70,26 @@ BEGIN_APP_DECLARATION(OITDemo)
 
     void DrawScene(void);
     void InitPrograms(void);
+    void PrintStats(void);
 END_APP_DECLARATION()
 
 DEFINE_APP(OITDemo, "Order Independent Transparency")
 
 void OITDemo::Initialize(const char * title)
 {
-    GLuint * data;
-    render_scene_prog = -1;
+    int i;
+
+    for (i = 0; i < 3; i++)
+        render_scene_prog[i] = resolve_program[i] = 0;
 
     base::Initialize(title);
 
     InitPrograms();
 
-    // Create head pointer texture
-    glActiveTexture(GL_TEXTURE0);
-    glGenTextures(1, &head_pointer_texture);
-    glBindTexture(GL_TEXTURE_2D, head_pointer_texture);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, MAX_FRAMEBUFFER_WIDTH, MAX_FRAMEBUFFER_HEIGHT, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-    glBindImageTexture(0, head_pointer_texture, 0, GL_TRUE, 0, GL_READ_WRITE, GL_R32UI);
-
-    // Create buffer for clearing the head pointer texture
-    glGenBuffers(1, &head_pointer_clear_buffer);
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, head_pointer_clear_buffer);
-    glBufferData(GL_PIXEL_UNPACK_BUFFER, MAX_FRAMEBUFFER_WIDTH * MAX_FRAMEBUFFER_HEIGHT * sizeof(GLuint), NULL, GL_STATIC_DRAW);
-    data = (GLuint *)glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
-    memset(data, 0x00, MAX_FRAMEBUFFER_WIDTH * MAX_FRAMEBUFFER_HEIGHT * sizeof(GLuint));
-    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
-
-    // Create the atomic counter buffer
-    glGenBuffers(1, &atomic_counter_buffer);
-    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, atomic_counter_buffer);
-    glBufferData(GL_ATOMIC_COUNTER_BUFFER, sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
-
-    // Create the linked list storage buffer
-    glGenBuffers(1, &linked_list_buffer);
-    glBindBuffer(GL_TEXTURE_BUFFER, linked_list_buffer);
-    glBufferData(GL_TEXTURE_BUFFER, MAX_FRAMEBUFFER_WIDTH * MAX_FRAMEBUFFER_HEIGHT * 3 * sizeof(vec4), NULL, GL_DYNAMIC_COPY);
-    glBindBuffer(GL_TEXTURE_BUFFER, 0);
-
-    // Bind it to a texture (for use as a TBO)
-    glGenTextures(1, &linked_list_texture);
-    glBindTexture(GL_TEXTURE_BUFFER, linked_list_texture);
-    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32UI, linked_list_buffer);
-    glBindTexture(GL_TEXTURE_BUFFER, 0);
-
-    glBindImageTexture(1, linked_list_texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32UI);
+    // The fragment store starts small and is sized from the number of
+    // fragments that each frame actually generates
+    oit.Initialize(current_width, current_height, OIT_LINKED_LIST, OIT_K);
+    oit.SetMemoryBudget(OIT_MEMORY_BUDGET);
 
     glGenVertexArrays(1, &quad_vao);
     glBindVertexArray(quad_vao);
@@ -151,33 +115,53 @@ void OITDemo::Initialize(const char * title)
 
 void OITDemo::InitPrograms()
 {
-    // Create the program for rendering the scene from the viewer's position
-    ShaderInfo scene_shaders[] =
+    static const char * const build_shaders[] =
     {
-        { GL_VERTEX_SHADER, "media/shaders/oit/build_lists.vs.glsl" },
-        { GL_FRAGMENT_SHADER, "media/shaders/oit/build_lists.fs.glsl" },
-        { GL_NONE }
+        "media/shaders/oit/build_lists.fs.glsl",
+        "media/shaders/oit/build_kbuffer.fs.glsl",
+        "media/shaders/oit/build_weighted.fs.glsl"
     };
-
-    if (render_scene_prog != -1)
-        glDeleteProgram(render_scene_prog);
-
-    render_scene_prog = LoadShaders(scene_shaders);
-
-    render_scene_uniforms.model_matrix = glGetUniformLocation(render_scene_prog, "model_matrix");
-    render_scene_uniforms.view_matrix = glGetUniformLocation(render_scene_prog, "view_matrix");
-    render_scene_uniforms.projection_matrix = glGetUniformLocation(render_scene_prog, "projection_matrix");
-    render_scene_uniforms.aspect = glGetUniformLocation(render_scene_prog, "aspect");
-    render_scene_uniforms.time = glGetUniformLocation(render_scene_prog, "time");
-
-    ShaderInfo resolve_shaders[] =
+    static const char * const resolve_shaders[] =
     {
-        { GL_VERTEX_SHADER, "media/shaders/oit/resolve_lists.vs.glsl" },
-        { GL_FRAGMENT_SHADER, "media/shaders/oit/resolve_lists.fs.glsl" },
-        { GL_NONE }
+        "media/shaders/oit/resolve_lists.fs.glsl",
+        "media/shaders/oit/resolve_kbuffer.fs.glsl",
+        "media/shaders/oit/resolve_weighted.fs.glsl"
     };
+    int i;
 
-    resolve_program = LoadShaders(resolve_shaders);
+    for (i = 0; i < 3; i++)
+    {
+        // Create the program for rendering the scene from the viewer's position
+        ShaderInfo scene_shaders[] =
+        {
+            { GL_VERTEX_SHADER, "media/shaders/oit/build_lists.vs.glsl" },
+            { GL_FRAGMENT_SHADER, build_shaders[i] },
+            { GL_NONE }
+        };
+
+        if (render_scene_prog[i] != 0)
+            glDeleteProgram(render_scene_prog[i]);
+
+        render_scene_prog[i] = LoadShaders(scene_shaders);
+
+        render_scene_uniforms[i].model_matrix = glGetUniformLocation(render_scene_prog[i], "model_matrix");
+        render_scene_uniforms[i].view_matrix = glGetUniformLocation(render_scene_prog[i], "view_matrix");
+        render_scene_uniforms[i].projection_matrix = glGetUniformLocation(render_scene_prog[i], "projection_matrix");
+        render_scene_uniforms[i].aspect = glGetUniformLocation(render_scene_prog[i], "aspect");
+        render_scene_uniforms[i].time = glGetUniformLocation(render_scene_prog[i], "time");
+
+        ShaderInfo resolve_shader_info[] =
+        {
+            { GL_VERTEX_SHADER, "media/shaders/oit/resolve_lists.vs.glsl" },
+            { GL_FRAGMENT_SHADER, resolve_shaders[i] },
+            { GL_NONE }
+        };
+
+        if (resolve_program[i] != 0)
+            glDeleteProgram(resolve_program[i]);
+
+        resolve_program[i] = LoadShaders(resolve_shader_info);
+    }
 }
 
 void OITDemo::Display(bool auto_redraw)
@@ -188,7 +172,7 @@ void OITDemo::Display(bool auto_redraw)
 
     t = (float)(current_time & 0xFFFFF) / (float)0x3FFF;
 
-    GLuint * data;
+    const OITMode mode = oit.GetMode();
 
     glDisable(GL_DEPTH_TEST);
     glDisable(GL_CULL_FACE);
@@ -196,25 +180,10 @@ void OITDemo::Display(bool auto_redraw)
     glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
     glClear(GL_COLOR_BUFFER_BIT);
 
-    // Reset atomic counter
-    glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 0, atomic_counter_buffer);
-    data = (GLuint *)glMapBuffer(GL_ATOMIC_COUNTER_BUFFER, GL_WRITE_ONLY);
-    data[0] = 0;
-    glUnmapBuffer(GL_ATOMIC_COUNTER_BUFFER);
-
-    // Clear head-pointer image
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, head_pointer_clear_buffer);
-    glBindTexture(GL_TEXTURE_2D, head_pointer_texture);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, current_width, current_height, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-    // Bind head-pointer image for read-write
-    glBindImageTexture(0, head_pointer_texture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+    // Clear the head pointers and counters and bind the fragment store
+    oit.Begin();
 
-    // Bind linked-list buffer for write
-    glBindImageTexture(1, linked_list_texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32UI);
-
-    glUseProgram(render_scene_prog);
+    glUseProgram(render_scene_prog[mode]);
 
     vmath::mat4 model_matrix = vmath::translate(0.0f, 0.0f, -20.0f) *
                                vmath::rotate(t * 360.0f, 0.0f, 0.0f, 1.0f) *
@@ -223,19 +192,26 @@ void OITDemo::Display(bool auto_redraw)
     vmath::mat4 view_matrix = vmath::mat4::identity();
     vmath::mat4 projection_matrix = vmath::frustum(-1.0f, 1.0f, aspect, -aspect, 1.0f, 40.f);
 
-    glUniformMatrix4fv(render_scene_uniforms.model_matrix, 1, GL_FALSE, model_matrix);
-    glUniformMatrix4fv(render_scene_uniforms.view_matrix, 1, GL_FALSE, view_matrix);
-    glUniformMatrix4fv(render_scene_uniforms.projection_matrix, 1, GL_FALSE, projection_matrix);
+    glUniformMatrix4fv(render_scene_uniforms[mode].model_matrix, 1, GL_FALSE, model_matrix);
+    glUniformMatrix4fv(render_scene_uniforms[mode].view_matrix, 1, GL_FALSE, view_matrix);
+    glUniformMatrix4fv(render_scene_uniforms[mode].projection_matrix, 1, GL_FALSE, projection_matrix);
 
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    // Weighted blending sets up its own blend state
+    if (mode != OIT_WEIGHTED_BLENDED)
+    {
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    }
 
     object.Render(0, 8 * 8 * 8);
 
     glDisable(GL_BLEND);
 
+    oit.End();
+
     glBindVertexArray(quad_vao);
-    glUseProgram(resolve_program);
+    glUseProgram(resolve_program[mode]);
+    oit.BindForResolve();
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
     // Done
@@ -249,10 +225,27 @@ void OITDemo::DrawScene(void)
     glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
 }
 
+void OITDemo::PrintStats(void)
+{
+    static const char * const mode_names[] = { "linked lists", "k-buffer", "weighted blended" };
+    const OITStats& stats = oit.GetStats();
+
+    printf("OIT: %s, %u fragments (%.2f per pixel), capacity %u, %u overflow frames, %u fallbacks, %.1f MB in use\n",
+           mode_names[oit.GetMode()], stats.fragments, stats.fragments_per_pixel, stats.capacity,
+           stats.overflow_frames, stats.fallback_count, float(stats.memory_in_use) / (1024.0f * 1024.0f));
+}
+
 void OITDemo::Finalize(void)
 {
+    int i;
+
     glUseProgram(0);
-    glDeleteProgram(render_scene_prog);
+    for (i = 0; i < 3; i++)
+    {
+        glDeleteProgram(render_scene_prog[i]);
+        glDeleteProgram(resolve_program[i]);
+    }
+    oit.Free();
     glDeleteBuffers(1, &quad_vbo);
     glDeleteVertexArrays(1, &quad_vao);
 }
@@ -264,13 +257,23 @@ void OITDemo::Resize(int width, int height)
 
     aspect = float(height) / float(width);
     glViewport(0, 0, current_width, current_height);
+
+    oit.Resize(current_width, current_height);
 }
 
 void OITDemo::OnKey(int key, int scancode, int action, int mods)
 {
+    if (action != GLFW_PRESS)
+        return;
+
     switch (key)
     {
-        case 'r': InitPrograms();
+        case 'R': InitPrograms();
+            break;
+        case 'M': oit.SetMode(OITMode((oit.GetMode() + 1) % 3));
+            PrintStats();
+            break;
+        case 'S': PrintStats();
             break;
         default:
             break;
@@ -11,14 +11,13 @@
 #include "vmath.h"
 
 #include "vbm.h"
+#include "voverdraw.h"
 #include "LoadShaders.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string>
 
-#define MAX_FRAMEBUFFER_WIDTH 2048
-#define MAX_FRAMEBUFFER_HEIGHT 2048
-
 namespace vtarga
 {
 extern unsigned char * load_targa(const char * filename, GLenum &format, int &width, int &height);
@@ -46,9 +45,9 @@ BEGIN_APP_DECLARATION(OverdrawCountExample)
     GLuint  image_palette_buffer;
     GLuint  image_palette_texture;
 
-    // Output image and PBO for clearing it
-    GLuint  overdraw_count_buffer;
-    GLuint  overdraw_count_clear_buffer;
+    // Counts fragments and reduces them to statistics
+    OverdrawCounter overdraw;
+    FILE *  overdraw_log;
 
     // Program to render the scene
     GLuint render_scene_prog;
@@ -82,6 +81,7 @@ DEFINE_APP(OverdrawCountExample, "Overdraw Count Example")
 void OverdrawCountExample::Initialize(const char * title)
 {
     render_scene_prog = -1;
+    overdraw_log = NULL;
 
     base::Initialize(title);
 
@@ -118,29 +118,38 @@ void OverdrawCountExample::Initialize(const char * title)
     glBindTexture(GL_TEXTURE_BUFFER, image_palette_texture);
     glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, image_palette_buffer);
 
+    // Heat ramp: black, blue, green, yellow, red, white at 0, 1, 2, 4, 8
+    // and 16+ fragments per pixel
+    static const vmath::vec4 ramp[] =
+    {
+        vmath::vec4(0.0f, 0.0f, 0.0f, 1.0f),
+        vmath::vec4(0.0f, 0.0f, 1.0f, 1.0f),
+        vmath::vec4(0.0f, 1.0f, 0.0f, 1.0f),
+        vmath::vec4(1.0f, 1.0f, 0.0f, 1.0f),
+        vmath::vec4(1.0f, 0.0f, 0.0f, 1.0f),
+        vmath::vec4(1.0f, 1.0f, 1.0f, 1.0f)
+    };
+
     vmath::vec4 * data = (vmath::vec4 *)glMapBuffer(GL_TEXTURE_BUFFER, GL_WRITE_ONLY);
-    for (int i = 0; i < 256; i++)
+    data[0] = ramp[0];
+    for (int i = 1; i < 256; i++)
     {
-        data[i] = vmath::vec4((float)i);
+        float x = log2f((float)(i < 16 ? i : 16));
+        int n = (int)x;
+        float f = x - (float)n;
+        data[i] = n < 4 ? vmath::mix(ramp[n + 1], ramp[n + 2], f) : ramp[5];
     }
     glUnmapBuffer(GL_TEXTURE_BUFFER);
 
-    // Create overdraw counter texture
-    glGenTextures(1, &overdraw_count_buffer);
-    glBindTexture(GL_TEXTURE_2D, overdraw_count_buffer);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, MAX_FRAMEBUFFER_WIDTH, MAX_FRAMEBUFFER_HEIGHT, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
-    glBindTexture(GL_TEXTURE_2D, 0);
+    overdraw.Initialize(current_width, current_height, 0);
 
-    // Create buffer for clearing the head pointer texture
-    glGenBuffers(1, &overdraw_count_clear_buffer);
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, overdraw_count_clear_buffer);
-    glBufferData(GL_PIXEL_UNPACK_BUFFER, MAX_FRAMEBUFFER_WIDTH * MAX_FRAMEBUFFER_HEIGHT * sizeof(GLuint), NULL, GL_STATIC_DRAW);
-
-    data = (vmath::vec4 *)glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
-    memset(data, 0x00, MAX_FRAMEBUFFER_WIDTH * MAX_FRAMEBUFFER_HEIGHT * sizeof(GLuint));
-    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    // Per-frame statistics for offline analysis
+    const char * log_name = getenv("VERMILION_OVERDRAW_LOG");
+    if (log_name != NULL)
+    {
+        overdraw_log = fopen(log_name, "w");
+        overdraw.SetOutput(overdraw_log);
+    }
 
     // Create VAO containing quad for the final blit
     glGenVertexArrays(1, &quad_vao);
@@ -210,14 +219,8 @@ void OverdrawCountExample::Display(bool auto_redraw)
     glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
     glClear(GL_COLOR_BUFFER_BIT);
 
-    // Clear output image
-    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, overdraw_count_clear_buffer);
-    glBindTexture(GL_TEXTURE_2D, overdraw_count_buffer);
-    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, current_width, current_height, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-    // Bind output image for read-write
-    glBindImageTexture(0, overdraw_count_buffer, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI);
+    // Clear the counts and bind them for the scene to increment
+    overdraw.Begin();
 
     // Render
     glUseProgram(render_scene_prog);
@@ -237,8 +240,15 @@ void OverdrawCountExample::Display(bool auto_redraw)
 
     object.Render(0, 8 * 8 * 8);
 
+    overdraw.End();
+
     glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
 
+    // Map the counts through the palette
+    glBindImageTexture(0, overdraw.GetCounterTexture(), 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32UI);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_BUFFER, image_palette_texture);
+
     glBindVertexArray(quad_vao);
     glUseProgram(resolve_program);
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
@@ -258,6 +268,14 @@ void OverdrawCountExample::Finalize(void)
 {
     glUseProgram(0);
     glDeleteProgram(render_scene_prog);
+    glDeleteProgram(resolve_program);
+    glDeleteTextures(1, &image_palette_texture);
+    glDeleteBuffers(1, &image_palette_buffer);
+
+    overdraw.SetOutput(NULL);
+    overdraw.Free();
+    if (overdraw_log != NULL)
+        fclose(overdraw_log);
     glDeleteBuffers(1, &quad_vbo);
     glDeleteVertexArrays(1, &quad_vao);
 }
@@ -269,6 +287,8 @@ void OverdrawCountExample::Resize(int width, int height)
 
     aspect = float(height) / float(width);
     glViewport(0, 0, current_width, current_height);
+
+    overdraw.Resize(current_width, current_height);
 }
 
 void OverdrawCountExample::OnKey(int key, int scancode, int action, int mods)
@@ -280,6 +300,20 @@ void OverdrawCountExample::OnKey(int key, int scancode, int action, int mods)
             case GLFW_KEY_R:
                 InitPrograms();
                 return;
+            case GLFW_KEY_C:
+                overdraw.SetCPUReduction(!overdraw.GetCPUReduction());
+                printf("Reducing overdraw on the %s\n", overdraw.GetCPUReduction() ? "CPU" : "GPU");
+                return;
+            case GLFW_KEY_S:
+                {
+                    const OverdrawStats& stats = overdraw.GetStats();
+                    printf("Frame %u: %u of %u pixels covered, %llu fragments\n"
+                           "  mean %.2f (%.2f over covered), max %u, p50 %u, p90 %u, p99 %u\n",
+                           stats.frame, stats.covered, stats.pixels, stats.fragments,
+                           stats.mean, stats.covered_mean, stats.max,
+                           stats.p50, stats.p90, stats.p99);
+                }
+                return;
         }
     }
 
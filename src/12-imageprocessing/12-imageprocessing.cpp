@@ -13,8 +13,22 @@
 #include "vbm.h"
 
 #include "vmath.h"
+#include "vimage.h"
 
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+enum FilterMode
+{
+    FILTER_GAUSSIAN,        // Separable convolution, rows then columns
+    FILTER_BOX,             // Box blur from a summed-area table
+    FILTER_COUNT
+};
+
+static const char * const filter_names[FILTER_COUNT] = { "Gaussian", "SAT box" };
 
 BEGIN_APP_DECLARATION(ImageProcessingComputeExample)
     // Override functions from base class
@@ -22,16 +36,26 @@ BEGIN_APP_DECLARATION(ImageProcessingComputeExample)
     virtual void Display(bool auto_redraw);
     virtual void Finalize(void);
     virtual void Resize(int width, int height);
+    virtual void OnKey(int key, int scancode, int action, int mods);
+
+    void SetRadius(int new_radius);
+    void RunFilter(void);
 
     // Member variables
-    GLuint  compute_prog;
-    GLuint  compute_shader;
+    ImageProcessor  processor;
+    FilterMode      mode;
+    int             radius;
+
+    // The image to process, as floats, and its size
+    vglImageData    source;
+    GLsizei         image_width;
+    GLsizei         image_height;
 
     // Texture to process
     GLuint  input_image;
 
-    // Texture for compute shader to write into
-    GLuint  intermediate_image;
+    // Textures for compute shader to write into
+    GLuint  sat_image;
     GLuint  output_image;
 
     // Program, vao and vbo to render a full screen quad
@@ -42,47 +66,74 @@ END_APP_DECLARATION()
 
 DEFINE_APP(ImageProcessingComputeExample, "Compute Shader Image Processing Example")
 
+// Something to filter if the image won't load or convert: soft gradients
+// under a grid of sharp edges, at a size that isn't a power of two
+static void make_test_pattern(vglImageData * image, GLsizei width, GLsizei height)
+{
+    float * pixels;
+    GLsizei x, y;
+
+    create_rgba32f_image(image, width, height);
+    pixels = (float *)image->mip[0].data;
+
+    for (y = 0; y < height; y++)
+    {
+        for (x = 0; x < width; x++)
+        {
+            float * pixel = pixels + (y * width + x) * 4;
+            const bool line = (x % 64) < 2 || (y % 64) < 2;
+
+            pixel[0] = line ? 1.0f : float(x) / float(width);
+            pixel[1] = line ? 1.0f : float(y) / float(height);
+            pixel[2] = line ? 1.0f : 0.5f + 0.5f * sinf(float(x + y) * 0.05f);
+            pixel[3] = 1.0f;
+        }
+    }
+}
+
+static GLuint create_float_texture(GLsizei width, GLsizei height)
+{
+    GLuint texture;
+
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    return texture;
+}
+
 void ImageProcessingComputeExample::Initialize(const char * title)
 {
+    vglImageData image;
+
     base::Initialize(title);
 
-    // Initialize our compute program
-    compute_prog = glCreateProgram();
+    processor.Initialize();
+    mode = FILTER_GAUSSIAN;
+    SetRadius(8);
 
-    static const char compute_shader_source[] =
-        "#version 430 core\n"
-        "\n"
-        "layout (local_size_x = 1024) in;\n"
-        "\n"
-        "layout (rgba32f, binding = 0) uniform image2D input_image;\n"
-        "layout (rgba32f, binding = 1) uniform image2D output_image;\n"
-        "\n"
-        "shared vec4 scanline[1024];\n"
-        "\n"
-        "void main(void)\n"
-        "{\n"
-        "    ivec2 pos = ivec2(gl_GlobalInvocationID.xy);\n"
-        "    scanline[pos.x] = imageLoad(input_image, pos);\n"
-        "    barrier();\n"
-        "    imageStore(output_image, pos.yx, scanline[min(pos.x + 1, 1023)] - scanline[max(pos.x - 1, 0)]);\n"
-        "}\n"
-    ;
-
-    vglAttachShaderSource(compute_prog, GL_COMPUTE_SHADER, compute_shader_source);
+    // Load an image to process. The filters work on floats, so convert it;
+    // whatever its size, the textures match it.
+    memset(&image, 0, sizeof(image));
+    memset(&source, 0, sizeof(source));
+    vglLoadImage("media/curiosity.dds", &image);
+    if (image.mip[0].data == NULL || !convert_image_to_rgba32f(&image, &source))
+        make_test_pattern(&source, 1000, 600);
+    if (image.mip[0].data != NULL)
+        vglUnloadImage(&image);
 
-    glLinkProgram(compute_prog);
+    image_width = source.mip[0].width;
+    image_height = source.mip[0].height;
 
-    // Load a texture to process
-    input_image = vglLoadTexture("media/curiosity.dds", 0, NULL);
+    input_image = create_float_texture(image_width, image_height);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, image_width, image_height, GL_RGBA, GL_FLOAT, source.mip[0].data);
 
-    glGenTextures(1, &intermediate_image);
-    glBindTexture(GL_TEXTURE_2D, intermediate_image);
-    glTexStorage2D(GL_TEXTURE_2D, 8, GL_RGBA32F, 1024, 1024);
+    sat_image = create_float_texture(image_width, image_height);
 
     // This is the texture that the compute program will write into
-    glGenTextures(1, &output_image);
-    glBindTexture(GL_TEXTURE_2D, output_image);
-    glTexStorage2D(GL_TEXTURE_2D, 8, GL_RGBA32F, 1024, 1024);
+    output_image = create_float_texture(image_width, image_height);
 
     // Now create a simple program to visualize the result
     render_prog = glCreateProgram();
@@ -92,21 +143,26 @@ void ImageProcessingComputeExample::Initialize(const char * title)
         "\n"
         "in vec4 vert;\n"
         "\n"
+        "out vec2 tc;\n"
+        "\n"
         "void main(void)\n"
         "{\n"
+        "    tc = vec2(vert.x, -vert.y) * 0.5 + 0.5;\n"
         "    gl_Position = vert;\n"
         "}\n";
 
     static const char render_fs[] =
         "#version 430 core\n"
         "\n"
+        "in vec2 tc;\n"
+        "\n"
         "layout (location = 0) out vec4 color;\n"
         "\n"
         "layout (binding = 0) uniform sampler2D output_image;\n"
         "\n"
         "void main(void)\n"
         "{\n"
-        "    color = abs(texture(output_image, vec2(1.0, -1.0) * vec2(gl_FragCoord.xy) / vec2(textureSize(output_image, 0)))) * 1.0;\n"
+        "    color = texture(output_image, tc);\n"
         "}\n";
 
     vglAttachShaderSource(render_prog, GL_VERTEX_SHADER, render_vs);
@@ -131,19 +187,35 @@ void ImageProcessingComputeExample::Initialize(const char * title)
     glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, NULL);
 }
 
-void ImageProcessingComputeExample::Display(bool auto_redraw)
+void ImageProcessingComputeExample::SetRadius(int new_radius)
 {
-    // Activate the compute program and bind the output texture image
-    glUseProgram(compute_prog);
-    glBindImageTexture(0, input_image, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
-    glBindImageTexture(1, intermediate_image, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
-    glDispatchCompute(1, 1024, 1);
+    std::vector<float> weights;
 
-    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    radius = std::max(new_radius, 0);
+    gaussian_kernel(float(radius) / 3.0f, weights, radius);
+    processor.SetKernel(&weights[0], radius);
+}
 
-    glBindImageTexture(0, intermediate_image, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
-    glBindImageTexture(1, output_image, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
-    glDispatchCompute(1, 1024, 1);
+void ImageProcessingComputeExample::RunFilter(void)
+{
+    if (mode == FILTER_GAUSSIAN)
+    {
+        processor.Convolve(input_image, output_image, image_width, image_height);
+    }
+    else
+    {
+        processor.SummedAreaTable(input_image, sat_image, image_width, image_height);
+        processor.BoxBlur(sat_image, output_image, image_width, image_height, radius);
+    }
+}
+
+void ImageProcessingComputeExample::Display(bool auto_redraw)
+{
+    RunFilter();
+
+    // The filters leave their results visible to image loads; sampling
+    // them needs its own barrier
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
 
     // Now bind the texture for rendering _from_
     glActiveTexture(GL_TEXTURE0);
@@ -152,6 +224,7 @@ void ImageProcessingComputeExample::Display(bool auto_redraw)
     // Clear, select the rendering program and draw a full screen quad
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glUseProgram(render_prog);
+    glBindVertexArray(render_vao);
     glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
 
     base::Display();
@@ -160,13 +233,41 @@ void ImageProcessingComputeExample::Display(bool auto_redraw)
 void ImageProcessingComputeExample::Finalize(void)
 {
     glUseProgram(0);
-    glDeleteProgram(compute_prog);
+    processor.Free();
     glDeleteProgram(render_prog);
+    glDeleteTextures(1, &input_image);
+    glDeleteTextures(1, &sat_image);
     glDeleteTextures(1, &output_image);
+    glDeleteBuffers(1, &render_vbo);
     glDeleteVertexArrays(1, &render_vao);
+    vglUnloadImage(&source);
 }
 
 void ImageProcessingComputeExample::Resize(int width, int height)
 {
     glViewport(0, 0, width, height);
 }
+
+void ImageProcessingComputeExample::OnKey(int key, int scancode, int action, int mods)
+{
+    if (action == GLFW_PRESS)
+    {
+        switch (key)
+        {
+            case GLFW_KEY_F:
+                mode = FilterMode((mode + 1) % FILTER_COUNT);
+                printf("Filter: %s, radius %d\n", filter_names[mode], radius);
+                return;
+            case GLFW_KEY_EQUAL:
+                SetRadius(radius < 4 ? radius + 1 : radius * 2);
+                printf("Filter: %s, radius %d\n", filter_names[mode], radius);
+                return;
+            case GLFW_KEY_MINUS:
+                SetRadius(radius <= 4 ? radius - 1 : radius / 2);
+                printf("Filter: %s, radius %d\n", filter_names[mode], radius);
+                return;
+        }
+    }
+
+    base::OnKey(key, scancode, action, mods);
+}
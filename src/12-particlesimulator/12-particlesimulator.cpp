@@ -14,15 +14,32 @@
 #include "vbm.h"
 
 #include "vmath.h"
+#include "vrandom.h"
+#include "vsimd.h"
 
 #include <stdio.h>
-
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+
+// The particle count defaults to PARTICLE_GROUP_SIZE * PARTICLE_GROUP_COUNT
+// and can be set with the VERMILION_PARTICLES environment variable (a count,
+// optionally followed by K or M). Set VERMILION_PARTICLE_INIT to "stream" to
+// fill the buffers through a ring of staging buffers, so that the GPU copies
+// each chunk while the next is being generated, rather than by mapping them
+// directly. Either way the chunks are generated on all threads. The groups
+// are dispatched in rows no longer than the GL's limit, which may be 65535,
+// one short of the groups of the largest count.
 enum
 {
     PARTICLE_GROUP_SIZE     = 1024,
     PARTICLE_GROUP_COUNT    = 8192,
-    PARTICLE_COUNT          = (PARTICLE_GROUP_SIZE * PARTICLE_GROUP_COUNT),
-    MAX_ATTRACTORS          = 64
+    MAX_PARTICLE_COUNT      = 64 * 1024 * 1024,
+    MAX_ATTRACTORS          = 64,
+    INIT_CHUNK_SIZE         = 64 * 1024,    // Particles per staging buffer
+    INIT_STAGING_COUNT      = 4,
+    INIT_BATCH_SIZE         = 4096,         // Particles generated at a time on one thread
+    INIT_MAX_PIECES         = 256           // Most ranges one fill is split into
 };
 
 BEGIN_APP_DECLARATION(ComputeParticleSimulator)
@@ -32,6 +49,12 @@ BEGIN_APP_DECLARATION(ComputeParticleSimulator)
     virtual void Finalize(void);
     virtual void Resize(int width, int height);
 
+    void InitializeParticles(GLuint buffer, bool velocity, bool streaming);
+
+    GLuint  particle_count;
+    GLuint  dispatch_width;                     // Groups in each row of the dispatch
+    GLuint  dispatch_height;
+
     // Compute program
     GLuint  compute_prog;
     GLint   dt_location;
@@ -74,84 +97,226 @@ END_APP_DECLARATION()
 
 DEFINE_APP(ComputeParticleSimulator, "Compute Shader Particle System")
 
-#define STRINGIZE(a) #a
-
-static inline float random_float()
+// Keys of the random streams. A particle's starting state only depends on
+// its index, so any chunk can be generated on any thread.
+enum
 {
-    float res;
-    unsigned int tmp;
-    static unsigned int seed = 0xFFFF0C59;
-
-    seed *= 16807;
+    KEY_POSITION_DIRECTION  = 0xFFFF0C59,
+    KEY_POSITION_DISTANCE,
+    KEY_POSITION_AGE,
+    KEY_VELOCITY_DIRECTION,
+    KEY_VELOCITY_SPEED,
+    KEY_ATTRACTOR_MASS
+};
 
-    tmp = seed ^ (seed >> 4) ^ (seed << 15);
+// Generates particles [first, first + count) into 'out': random directions
+// scaled by -10 to 10 and an age from 0 to 1 for positions, or by -0.1 to 0.1
+// and no age for velocities
+static void generate_particles(vmath::vec4 * out, unsigned int first, unsigned int count, bool velocity)
+{
+    vmath::vec3 direction[INIT_BATCH_SIZE];
+    float magnitude[INIT_BATCH_SIZE];
+    float age[INIT_BATCH_SIZE];
+    unsigned int i;
 
-    *((unsigned int *) &res) = (tmp >> 9) | 0x3F800000;
+    vmath::random_fill_on_sphere(direction, count, velocity ? KEY_VELOCITY_DIRECTION : KEY_POSITION_DIRECTION, first);
+    if (velocity)
+    {
+        vmath::random_fill_uniform(magnitude, count, KEY_VELOCITY_SPEED, first, -0.1f, 0.1f);
+        memset(age, 0, count * sizeof(float));
+    }
+    else
+    {
+        vmath::random_fill_uniform(magnitude, count, KEY_POSITION_DISTANCE, first, -10.0f, 10.0f);
+        vmath::random_fill_uniform(age, count, KEY_POSITION_AGE, first);
+    }
 
-    return (res - 1.0f);
+    for (i = 0; i < count; i++)
+        out[i] = vmath::vec4(direction[i] * magnitude[i], age[i]);
 }
 
-static vmath::vec3 random_vector(float minmag = 0.0f, float maxmag = 1.0f)
+// Copies into mapped buffer memory. That's usually write-combined, so
+// non-temporal stores that go straight out in whole lines beat plain ones.
+static void stream_copy(vmath::vec4 * dst, const vmath::vec4 * src, unsigned int count)
 {
-    vmath::vec3 randomvec(random_float() * 2.0f - 1.0f, random_float() * 2.0f - 1.0f, random_float() * 2.0f - 1.0f);
-    randomvec = normalize(randomvec);
-    randomvec *= (random_float() * (maxmag - minmag) + minmag);
+#if defined(VMATH_SSE2)
+    if (((size_t)dst & 15) == 0)
+    {
+        unsigned int i;
+
+        for (i = 0; i < count; i++)
+            _mm_stream_ps(&dst[i][0], _mm_loadu_ps(&src[i][0]));
+        _mm_sfence();
+
+        return;
+    }
+#endif
+
+    unsigned int i;
 
-    return randomvec;
+    for (i = 0; i < count; i++)
+        dst[i] = src[i];
 }
 
-void ComputeParticleSimulator::Initialize(const char * title)
+// Fills 'count' particles of mapped memory starting with particle 'first'
+static void fill_particles(JobSystem& jobs, vmath::vec4 * mapped, unsigned int first, unsigned int count, bool velocity)
 {
-    base::Initialize(title);
+    // Whole batches, and no more ranges than the threads need however many
+    // particles there are
+    const unsigned int batches = (count + INIT_BATCH_SIZE - 1) / INIT_BATCH_SIZE;
+    const unsigned int grain = INIT_BATCH_SIZE * ((batches + INIT_MAX_PIECES - 1) / INIT_MAX_PIECES);
 
-    int i;
+    jobs.ParallelFor(count, grain, [=](unsigned int begin, unsigned int end)
+    {
+        vmath::vec4 batch[INIT_BATCH_SIZE];
+        unsigned int i;
 
-    // Initialize our compute program
-    compute_prog = glCreateProgram();
+        for (i = begin; i < end; i += INIT_BATCH_SIZE)
+        {
+            const unsigned int n = end - i < INIT_BATCH_SIZE ? end - i : (unsigned int)INIT_BATCH_SIZE;
 
-    static const char compute_shader_source[] =
-        STRINGIZE(
-#version 430 core\n
+            generate_particles(batch, first + i, n, velocity);
+            stream_copy(mapped + i, batch, n);
+        }
+    });
+}
 
-layout (std140, binding = 0) uniform attractor_block
+void ComputeParticleSimulator::InitializeParticles(GLuint buffer, bool velocity, bool streaming)
 {
-    vec4 attractor[64]; // xyz = position, w = mass
-};
+    const GLsizeiptr size = particle_count * sizeof(vmath::vec4);
+
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_DYNAMIC_COPY);
 
-layout (local_size_x = 1024) in;
+    if (!streaming)
+    {
+        vmath::vec4 * mapped = (vmath::vec4 *)glMapBufferRange(GL_ARRAY_BUFFER,
+                                                               0,
+                                                               size,
+                                                               GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
 
-layout (rgba32f, binding = 0) uniform imageBuffer velocity_buffer;
-layout (rgba32f, binding = 1) uniform imageBuffer position_buffer;
+        if (mapped == NULL)
+            return;
 
-uniform float dt = 1.0;
+        fill_particles(GetJobSystem(), mapped, 0, particle_count, velocity);
 
-void main(void)
-{
-    vec4 vel = imageLoad(velocity_buffer, int(gl_GlobalInvocationID.x));
-    vec4 pos = imageLoad(position_buffer, int(gl_GlobalInvocationID.x));
+        glUnmapBuffer(GL_ARRAY_BUFFER);
 
+        return;
+    }
+
+    // Each chunk goes into the next staging buffer in the ring and is copied
+    // from there on the GPU. A staging buffer is only refilled once the
+    // fence after its last copy has passed.
+    GLuint staging[INIT_STAGING_COUNT];
+    GLsync fences[INIT_STAGING_COUNT] = { 0 };
+    GLuint first;
     int i;
 
-    pos.xyz += vel.xyz * dt;
-    pos.w -= 0.0001 * dt;
+    glGenBuffers(INIT_STAGING_COUNT, staging);
+    for (i = 0; i < INIT_STAGING_COUNT; i++)
+    {
+        glBindBuffer(GL_COPY_READ_BUFFER, staging[i]);
+        glBufferData(GL_COPY_READ_BUFFER, INIT_CHUNK_SIZE * sizeof(vmath::vec4), NULL, GL_STREAM_COPY);
+    }
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
 
-    for (i = 0; i < 4; i++)
+    for (first = 0, i = 0; first < particle_count; first += INIT_CHUNK_SIZE, i = (i + 1) % INIT_STAGING_COUNT)
     {
-        vec3 dist = (attractor[i].xyz - pos.xyz);
-        vel.xyz += dt * dt * attractor[i].w * normalize(dist) / (dot(dist, dist) + 10.0);
+        const GLuint count = particle_count - first < INIT_CHUNK_SIZE ? particle_count - first : (GLuint)INIT_CHUNK_SIZE;
+
+        if (fences[i] != 0)
+        {
+            glClientWaitSync(fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, ~GLuint64(0));
+            glDeleteSync(fences[i]);
+        }
+
+        glBindBuffer(GL_COPY_READ_BUFFER, staging[i]);
+        vmath::vec4 * mapped = (vmath::vec4 *)glMapBufferRange(GL_COPY_READ_BUFFER,
+                                                               0,
+                                                               count * sizeof(vmath::vec4),
+                                                               GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+
+        // Fill the whole buffer directly instead, below
+        if (mapped == NULL)
+            break;
+
+        fill_particles(GetJobSystem(), mapped, first, count, velocity);
+
+        glUnmapBuffer(GL_COPY_READ_BUFFER);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, first * sizeof(vmath::vec4), count * sizeof(vmath::vec4));
+        fences[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
     }
 
-    if (pos.w <= 0.0)
+    for (i = 0; i < INIT_STAGING_COUNT; i++)
     {
-        pos.xyz = -pos.xyz * 0.01;
-        vel.xyz *= 0.01;
-        pos.w += 1.0f;
+        if (fences[i] != 0)
+            glDeleteSync(fences[i]);
     }
 
-    imageStore(position_buffer, int(gl_GlobalInvocationID.x), pos);
-    imageStore(velocity_buffer, int(gl_GlobalInvocationID.x), vel);
+    glDeleteBuffers(INIT_STAGING_COUNT, staging);
+
+    if (first < particle_count)
+        InitializeParticles(buffer, velocity, false);
 }
-        );
+
+void ComputeParticleSimulator::Initialize(const char * title)
+{
+    base::Initialize(title);
+
+    int i;
+
+    // Initialize our compute program
+    compute_prog = glCreateProgram();
+
+    static const char compute_shader_source[] =
+        "#version 430 core\n"
+        "\n"
+        "layout (std140, binding = 0) uniform attractor_block\n"
+        "{\n"
+        "    vec4 attractor[64]; // xyz = position, w = mass\n"
+        "};\n"
+        "\n"
+        "layout (local_size_x = 1024) in;\n"
+        "\n"
+        "layout (rgba32f, binding = 0) uniform imageBuffer velocity_buffer;\n"
+        "layout (rgba32f, binding = 1) uniform imageBuffer position_buffer;\n"
+        "\n"
+        "uniform float dt = 1.0;\n"
+        "\n"
+        "void main(void)\n"
+        "{\n"
+        "    int index = int((gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x) * gl_WorkGroupSize.x + gl_LocalInvocationID.x);\n"
+        "\n"
+        "    // The last row of groups may run past the particles\n"
+        "    if (index >= imageSize(position_buffer))\n"
+        "        return;\n"
+        "\n"
+        "    vec4 vel = imageLoad(velocity_buffer, index);\n"
+        "    vec4 pos = imageLoad(position_buffer, index);\n"
+        "\n"
+        "    int i;\n"
+        "\n"
+        "    pos.xyz += vel.xyz * dt;\n"
+        "    pos.w -= 0.0001 * dt;\n"
+        "\n"
+        "    for (i = 0; i < 4; i++)\n"
+        "    {\n"
+        "        vec3 dist = (attractor[i].xyz - pos.xyz);\n"
+        "        vel.xyz += dt * dt * attractor[i].w * normalize(dist) / (dot(dist, dist) + 10.0);\n"
+        "    }\n"
+        "\n"
+        "    if (pos.w <= 0.0)\n"
+        "    {\n"
+        "        pos.xyz = -pos.xyz * 0.01;\n"
+        "        vel.xyz *= 0.01;\n"
+        "        pos.w += 1.0f;\n"
+        "    }\n"
+        "\n"
+        "    imageStore(position_buffer, index, pos);\n"
+        "    imageStore(velocity_buffer, index, vel);\n"
+        "}\n";
 
     vglAttachShaderSource(compute_prog, GL_COMPUTE_SHADER, compute_shader_source);
 
@@ -162,38 +327,50 @@ void main(void)
     glGenVertexArrays(1, &render_vao);
     glBindVertexArray(render_vao);
 
-    glGenBuffers(2, buffers);
-    glBindBuffer(GL_ARRAY_BUFFER, position_buffer);
-    glBufferData(GL_ARRAY_BUFFER, PARTICLE_COUNT * sizeof(vmath::vec4), NULL, GL_DYNAMIC_COPY);
-
-    vmath::vec4 * positions = (vmath::vec4 *)glMapBufferRange(GL_ARRAY_BUFFER,
-                                                              0,
-                                                              PARTICLE_COUNT * sizeof(vmath::vec4),
-                                                              GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    // Work out how many particles to simulate, in whole groups
+    const char * count_string = getenv("VERMILION_PARTICLES");
+    const char * init_string = getenv("VERMILION_PARTICLE_INIT");
+    const bool streaming = init_string != NULL && strcmp(init_string, "stream") == 0;
 
-    for (i = 0; i < PARTICLE_COUNT; i++)
+    particle_count = PARTICLE_GROUP_SIZE * PARTICLE_GROUP_COUNT;
+    if (count_string != NULL)
     {
-        positions[i] = vmath::vec4(random_vector(-10.0f, 10.0f), random_float());
+        char * suffix;
+        unsigned long count = strtoul(count_string, &suffix, 10);
+
+        if (*suffix == 'K' || *suffix == 'k')
+            count *= 1024;
+        else if (*suffix == 'M' || *suffix == 'm')
+            count *= 1024 * 1024;
+
+        count = count < PARTICLE_GROUP_SIZE ? (unsigned long)PARTICLE_GROUP_SIZE : count > MAX_PARTICLE_COUNT ? (unsigned long)MAX_PARTICLE_COUNT : count;
+        particle_count = (GLuint)((count + PARTICLE_GROUP_SIZE - 1) / PARTICLE_GROUP_SIZE * PARTICLE_GROUP_SIZE);
     }
 
-    glUnmapBuffer(GL_ARRAY_BUFFER);
+    // As few rows of groups as the limit allows, as evenly filled as can be
+    GLint max_groups;
+    const GLuint groups = particle_count / PARTICLE_GROUP_SIZE;
 
-    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, NULL);
-    glEnableVertexAttribArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, velocity_buffer);
-    glBufferData(GL_ARRAY_BUFFER, PARTICLE_COUNT * sizeof(vmath::vec4), NULL, GL_DYNAMIC_COPY);
+    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, 0, &max_groups);
+    dispatch_height = (groups + max_groups - 1) / max_groups;
+    dispatch_width = (groups + dispatch_height - 1) / dispatch_height;
 
-    vmath::vec4 * velocities = (vmath::vec4 *)glMapBufferRange(GL_ARRAY_BUFFER,
-                                                               0,
-                                                               PARTICLE_COUNT * sizeof(vmath::vec4),
-                                                               GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
 
-    for (i = 0; i < PARTICLE_COUNT; i++)
-    {
-        velocities[i] = vmath::vec4(random_vector(-0.1f, 0.1f), 0.0f);
-    }
+    glGenBuffers(2, buffers);
+    InitializeParticles(position_buffer, false, streaming);
+    InitializeParticles(velocity_buffer, true, streaming);
+    glFinish();
+
+    printf("Initialized %u particles in %.1f ms (%s, %u threads)\n",
+           particle_count,
+           std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count(),
+           streaming ? "staging ring" : "mapped",
+           GetJobSystem().GetThreadCount());
 
-    glUnmapBuffer(GL_ARRAY_BUFFER);
+    glBindBuffer(GL_ARRAY_BUFFER, position_buffer);
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, NULL);
+    glEnableVertexAttribArray(0);
 
     glGenTextures(2, tbos);
 
@@ -209,7 +386,7 @@ void main(void)
 
     for (i = 0; i < MAX_ATTRACTORS; i++)
     {
-        attractor_masses[i] = 0.5f + random_float() * 0.5f;
+        attractor_masses[i] = 0.5f + vmath::random_uniform(KEY_ATTRACTOR_MASS, i) * 0.5f;
     }
 
     glBindBufferBase(GL_UNIFORM_BUFFER, 0, attractor_buffer);
@@ -294,7 +471,7 @@ void ComputeParticleSimulator::Display(bool auto_redraw)
     // Set delta time
     glUniform1f(dt_location, delta_time);
     // Dispatch
-    glDispatchCompute(PARTICLE_GROUP_COUNT, 1, 1);
+    glDispatchCompute(dispatch_width, dispatch_height, 1);
 
     glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
 
@@ -311,7 +488,7 @@ void ComputeParticleSimulator::Display(bool auto_redraw)
     glEnable(GL_BLEND);
     glBlendFunc(GL_ONE, GL_ONE);
     // glPointSize(2.0f);
-    glDrawArrays(GL_POINTS, 0, PARTICLE_COUNT);
+    glDrawArrays(GL_POINTS, 0, particle_count);
 
     last_ticks = current_ticks;
 
@@ -12,6 +12,7 @@
 #include "vapp.h"
 #include "vutils.h"
 #include "vbm.h"
+#include "vprimitives.h"
 
 #include "vmath.h"
 
@@ -31,11 +32,15 @@ BEGIN_APP_DECLARATION(RayTracingExample)
     // Texture for compute shader to write into
     GLuint  output_image;
 
-    // Ray buffer
+    // Ray queue, and the rays spawned from it before compaction
     GLuint  ray_buffer[2];
 
-    // Append count buffer
-    GLuint  counter_buffer;
+    // Whether each spawned ray is kept, and the length of the queue
+    GLuint  flag_buffer;
+    GLuint  queue_count_buffer;
+
+    // Compacts the spawned rays into the next queue, in order
+    GPUPrimitives primitives;
 
     // Program, vao and vbo to render a quad
     GLuint  render_prog;
@@ -46,9 +51,20 @@ END_APP_DECLARATION()
 #define OUTPUT_LODS         9
 #define OUTPUT_SIZE_X       (1 << OUTPUT_LODS)
 #define OUTPUT_SIZE_Y       (1 << OUTPUT_LODS)
+#define RAY_COUNT           (OUTPUT_SIZE_X * OUTPUT_SIZE_Y)
+#define MAX_BOUNCES         3
 
 DEFINE_APP(RayTracingExample, "Compute Shader Raytracing Example")
 
+#pragma pack (push, 1)
+struct RAY
+{
+    vmath::ivec4    screen_origin;
+    vmath::vec4     world_origin;
+    vmath::vec4     world_direction;
+};
+#pragma pack (pop)
+
 #define RAY_ELEMENT                     \
     "struct RAY\n"                      \
     "{\n"                               \
@@ -68,11 +84,16 @@ void RayTracingExample::Initialize(const char * title)
     glBindBuffer(GL_SHADER_STORAGE_BUFFER, ray_buffer[1]);
     glBufferData(GL_SHADER_STORAGE_BUFFER, 64 * 1024 * 1024, NULL, GL_DYNAMIC_COPY);
 
-    static const GLuint zeros[] = { 0, 0 };
+    // Each ray spawns two, so there are twice as many flags as rays
+    glGenBuffers(1, &flag_buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, flag_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, 2 * RAY_COUNT * sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
+
+    glGenBuffers(1, &queue_count_buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, queue_count_buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), NULL, GL_DYNAMIC_COPY);
 
-    glGenBuffers(1, &counter_buffer);
-    glBindBuffer(GL_ATOMIC_COUNTER_BUFFER, counter_buffer);
-    glBufferData(GL_ATOMIC_COUNTER_BUFFER, sizeof(zeros), zeros, GL_DYNAMIC_COPY);
+    primitives.Initialize(2 * RAY_COUNT);
 
     // Initialize our compute program
     initializer_prog = glCreateProgram();
@@ -102,7 +123,7 @@ void RayTracingExample::Initialize(const char * title)
         "\n"
         "void main(void)\n"
         "{\n"
-        "    ray[gl_LocalInvocationID.y * 16 + gl_LocalInvocationID.x] = initialize_ray();\n"
+        "    ray[gl_GlobalInvocationID.y * gl_NumWorkGroups.x * 16 + gl_GlobalInvocationID.x] = initialize_ray();\n"
         "}\n"
     ;
 
@@ -128,27 +149,41 @@ void RayTracingExample::Initialize(const char * title)
         "    RAY    ray[];\n"
         "} output_buffer;\n"
         "\n"
-        "layout (binding = 0, offset = 0) uniform atomic_uint consume_counter;\n"
-        "layout (binding = 0, offset = 4) uniform atomic_uint append_counter;\n"
+        "layout (std430, binding = 2) writeonly buffer flag_buffer\n"
+        "{\n"
+        "    uint   keep[];\n"
+        "};\n"
+        "\n"
+        "layout (std430, binding = 3) readonly buffer queue_count_buffer\n"
+        "{\n"
+        "    uint   ray_count;\n"
+        "};\n"
         "\n"
         "layout (rgba32f, binding = 0) uniform image2D output_image;\n"
         "\n"
+        // Each ray spawns two in its own pair of slots and flags the ones
+        // worth tracing. Compaction then packs the kept ones, in order,
+        // into the next queue.
         "void main(void)\n"
         "{\n"
-        "    uint ray_index = atomicCounterIncrement(consume_counter);\n"
+        "    uint ray_index = gl_GlobalInvocationID.y * gl_NumWorkGroups.x * 16 + gl_GlobalInvocationID.x;\n"
         "\n"
-        "    RAY input_ray = input_buffer.ray[ray_index];\n"
+        "    if (ray_index >= ray_count)\n"
+        "    {\n"
+        "        keep[ray_index * 2] = keep[ray_index * 2 + 1] = 0;\n"
+        "        return;\n"
+        "    }\n"
         "\n"
-//        "    barrier();\n"
+        "    RAY input_ray = input_buffer.ray[ray_index];\n"
         "\n"
         "    {\n"
         "        imageStore(output_image, input_ray.screen_origin.xy, vec4(input_ray.world_direction.xyz, 1.0));\n"
-        "        ray_index = atomicCounterIncrement(append_counter);\n"
         "        input_ray.world_direction.x += 0.01;\n"
-        "        output_buffer.ray[ray_index] = input_ray;\n"
-        "        ray_index = atomicCounterIncrement(append_counter);\n"
+        "        output_buffer.ray[ray_index * 2] = input_ray;\n"
+        "        keep[ray_index * 2] = dot(input_ray.world_direction.xy, input_ray.world_direction.xy) < 0.02 ? 1 : 0;\n"
         "        input_ray.world_direction.y += 0.01;\n"
-        "        output_buffer.ray[ray_index] = input_ray;\n"
+        "        output_buffer.ray[ray_index * 2 + 1] = input_ray;\n"
+        "        keep[ray_index * 2 + 1] = dot(input_ray.world_direction.xy, input_ray.world_direction.xy) < 0.02 ? 1 : 0;\n"
         "    }\n"
         "}\n"
     };
@@ -212,15 +247,6 @@ void RayTracingExample::Initialize(const char * title)
     glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 0, NULL);
 }
 
-#pragma pack (push, 1)
-struct RAY
-{
-    vmath::ivec4    screen_origin;
-    vmath::vec4     world_origin;
-    vmath::vec4     world_direction;
-};
-#pragma pack (pop)
-
 void RayTracingExample::Display(bool auto_redraw)
 {
     // Activate the initialization compute program
@@ -228,26 +254,37 @@ void RayTracingExample::Display(bool auto_redraw)
     glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ray_buffer[0]);
     glDispatchCompute(OUTPUT_SIZE_X / 16, OUTPUT_SIZE_Y / 16, 1);
 
-    // Reset atomic counters
-    static const GLuint zeros[] = { 0, 0 };
+    // The first queue is every primary ray
+    static const GLuint ray_count = RAY_COUNT;
 
-    glBindBufferBase(GL_ATOMIC_COUNTER_BUFFER, 0, counter_buffer);
-    glBufferData(GL_ATOMIC_COUNTER_BUFFER, sizeof(zeros), zeros, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, queue_count_buffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(ray_count), &ray_count);
 
-    // 
     glBindImageTexture(0, output_image, 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
 
-    // Bind ray buffers
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ray_buffer[0]);
-    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, ray_buffer[1]);
+    // Each bounce traces the queue and compacts the rays it spawns into
+    // the next one. The length of the queue stays on the GPU; bounces are
+    // dispatched for the largest queue and the extra invocations return.
+    for (int bounce = 0; bounce < MAX_BOUNCES; bounce++)
+    {
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
 
-    // Bind the trace program
-    glUseProgram(trace_prog);
-    glDispatchCompute(OUTPUT_SIZE_X / 16, OUTPUT_SIZE_Y / 16, 1);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, ray_buffer[0]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, ray_buffer[1]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, flag_buffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, queue_count_buffer);
+
+        glUseProgram(trace_prog);
+        glDispatchCompute(OUTPUT_SIZE_X / 16, OUTPUT_SIZE_Y / 16, 1);
 
-    vmath::ivec2 * ptr = (vmath::ivec2 *)glMapBuffer(GL_ATOMIC_COUNTER_BUFFER, GL_READ_ONLY);
+        // Invocations past the end of the queue clear their flags, so all
+        // of them can be compacted without knowing its length. A queue
+        // longer than RAY_COUNT is cut short by the next dispatch.
+        primitives.Compact(ray_buffer[1], flag_buffer, ray_buffer[0], 2 * RAY_COUNT,
+                           queue_count_buffer, 0, sizeof(RAY) / sizeof(GLuint));
+    }
 
-    glUnmapBuffer(GL_ATOMIC_COUNTER_BUFFER);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
 
     // Now bind the texture for rendering _from_
     glBindTexture(GL_TEXTURE_2D, output_image);
@@ -264,7 +301,12 @@ void RayTracingExample::Finalize(void)
 {
     glUseProgram(0);
     glDeleteProgram(initializer_prog);
+    glDeleteProgram(trace_prog);
     glDeleteProgram(render_prog);
+    glDeleteBuffers(2, ray_buffer);
+    glDeleteBuffers(1, &flag_buffer);
+    glDeleteBuffers(1, &queue_count_buffer);
+    primitives.Free();
     glDeleteTextures(1, &output_image);
     glDeleteVertexArrays(1, &render_vao);
 }
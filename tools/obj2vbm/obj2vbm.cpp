@@ -6,6 +6,9 @@
 #include <algorithm>
 #include <map>
 
+#include <string.h>
+#include <math.h>
+
 #ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
 // #include <windows.h>
@@ -14,6 +17,11 @@
 #define VBM_FILE_TYPES_ONLY
 #include "vbm.h"
 
+// The stream codecs and the simplifier; build lib/vcodec.cpp and
+// lib/vsimplify.cpp along with this file
+#include "vcodec.h"
+#include "vsimplify.h"
+
 #define GL_NONE                     0x0000
 #define GL_UNSIGNED_SHORT           0x1403
 #define GL_UNSIGNED_INT             0x1405
@@ -26,6 +34,11 @@
 
 std::map<std::string, VBM_MATERIAL> materials;
 
+// -compress codes every stream, -compress=position,indices only those
+// named (attributes by name, and "indices")
+bool compress_file = false;
+std::vector<std::string> compressed_streams;
+
 void extract_vec3(const char * buf, VBM_VEC3F &v3)
 {
     switch (sscanf(buf, "%*s %f %f %f", &v3.x, &v3.y, &v3.z))
@@ -204,6 +217,92 @@ struct triangle
         : v_index(v), t_index(t), n_index(n), material(m) {}
 };
 
+// Bounding box and sphere of the vertices referenced by indices[first] to
+// indices[first + count - 1], or of vertices[first] onwards if indices is NULL
+void calculate_bounds(const std::vector<VBM_VEC4F>& vertices, const unsigned int * indices, unsigned int first, unsigned int count, VBM_BOUNDS& bounds)
+{
+    unsigned int i;
+    float r2 = 0.0f;
+
+    memset(&bounds, 0, sizeof(bounds));
+
+    if (count == 0)
+        return;
+
+    const VBM_VEC4F * v = &vertices[indices ? indices[first] : first];
+    bounds.min.x = bounds.max.x = v->x;
+    bounds.min.y = bounds.max.y = v->y;
+    bounds.min.z = bounds.max.z = v->z;
+
+    for (i = first; i < first + count; i++)
+    {
+        v = &vertices[indices ? indices[i] : i];
+        bounds.min.x = std::min(bounds.min.x, v->x); bounds.max.x = std::max(bounds.max.x, v->x);
+        bounds.min.y = std::min(bounds.min.y, v->y); bounds.max.y = std::max(bounds.max.y, v->y);
+        bounds.min.z = std::min(bounds.min.z, v->z); bounds.max.z = std::max(bounds.max.z, v->z);
+    }
+
+    bounds.center.x = (bounds.min.x + bounds.max.x) * 0.5f;
+    bounds.center.y = (bounds.min.y + bounds.max.y) * 0.5f;
+    bounds.center.z = (bounds.min.z + bounds.max.z) * 0.5f;
+
+    for (i = first; i < first + count; i++)
+    {
+        v = &vertices[indices ? indices[i] : i];
+        const float dx = v->x - bounds.center.x;
+        const float dy = v->y - bounds.center.y;
+        const float dz = v->z - bounds.center.z;
+        r2 = std::max(r2, dx * dx + dy * dy + dz * dz);
+    }
+
+    bounds.radius = sqrtf(r2);
+}
+
+// Writes the data of an attribute or the indices. Uncompressed files have
+// it as it is; in compressed files it's a stream, coded if -compress
+// asked for it.
+void write_stream(FILE * outfile, const char * name, const void * data, unsigned int components, unsigned int count, bool indices)
+{
+    const size_t size = (size_t)components * count * sizeof(float);
+
+    if (!compress_file)
+    {
+        fwrite(data, size, 1, outfile);
+        return;
+    }
+
+    static const unsigned char padding[4] = { 0 };
+    std::vector<unsigned char> encoded;
+    VBM_STREAM_HEADER stream_header;
+
+    if (compressed_streams.empty() || std::find(compressed_streams.begin(), compressed_streams.end(), name) != compressed_streams.end())
+    {
+        if (indices)
+            vbm_encode_indices(encoded, (const unsigned int *)data, count);
+        else
+            vbm_encode_vertices(encoded, data, components, count);
+    }
+
+    // Store anything that didn't shrink as it is
+    if (!encoded.empty() && encoded.size() < size)
+    {
+        stream_header.codec = indices ? VBM_CODEC_FAN : VBM_CODEC_DELTA;
+        stream_header.size = (unsigned int)encoded.size();
+        printf("%s: %u bytes, compressed to %u (%.1f%%)\n", name, (unsigned int)size, stream_header.size, 100.0f * stream_header.size / size);
+    }
+    else
+    {
+        stream_header.codec = VBM_CODEC_NONE;
+        stream_header.size = (unsigned int)size;
+        encoded.assign((const unsigned char *)data, (const unsigned char *)data + size);
+    }
+
+    fwrite(&stream_header, sizeof(stream_header), 1, outfile);
+    if (!encoded.empty())
+        fwrite(&encoded[0], encoded.size(), 1, outfile);
+    fwrite(padding, (4 - stream_header.size % 4) % 4, 1, outfile);
+}
+
 int main(int argc, char ** argv)
 {
     FILE * infile = fopen(argv[1], "rb");
@@ -228,10 +327,67 @@ int main(int argc, char ** argv)
     std::vector<unsigned int> normal_indices;
     std::vector<unsigned int> texcoord_indices;
     std::vector<triangle> triangles;
+    std::vector<float> lod_ratios;
 
-    if (argc >= 4 && argv[3] != NULL)
+    for (n = 3; n < argc; n++)
     {
-        parse_material_file(argv[3]);
+        if (!strcmp(argv[n], "-lod") || !strncmp(argv[n], "-lod=", 5))
+        {
+            // -lod builds the default chain, -lod=50,25,12.5 chooses the
+            // percentage of triangles kept at each level. Each level is
+            // simplified from the one before, so the percentages must fall.
+            p = argv[n] + 4;
+            lod_ratios.clear();
+            if (*p == '=')
+            {
+                do {
+                    const char * start = p + 1;
+                    const float ratio = (float)strtod(start, &p);
+
+                    if (p == start || !(ratio > 0.0f && ratio < 100.0f) ||
+                        (!lod_ratios.empty() && ratio >= lod_ratios.back()))
+                    {
+                        fprintf(stderr, "%s: each percentage must be between 0 and 100 and less than the one before\n", argv[n]);
+                        return 1;
+                    }
+                    lod_ratios.push_back(ratio);
+                } while (*p == ',');
+
+                if (*p != 0)
+                {
+                    fprintf(stderr, "%s: expected a comma separated list of percentages\n", argv[n]);
+                    return 1;
+                }
+            }
+            else
+            {
+                lod_ratios.push_back(50.0f);
+                lod_ratios.push_back(25.0f);
+                lod_ratios.push_back(12.5f);
+                lod_ratios.push_back(6.25f);
+            }
+        }
+        else if (!strcmp(argv[n], "-compress") || !strncmp(argv[n], "-compress=", 10))
+        {
+            p = argv[n] + 9;
+            compress_file = true;
+            while (*p == '=' || *p == ',')
+            {
+                const char * name = p + 1;
+
+                p = (char *)name + strcspn(name, ",");
+                compressed_streams.push_back(std::string(name, p - name));
+            }
+        }
+        else if (argv[n][0] == '-')
+        {
+            fprintf(stderr, "%s: unknown option\n", argv[n]);
+            return 1;
+        }
+        else
+        {
+            parse_material_file(argv[n]);
+        }
     }
 
     do {
@@ -571,6 +727,62 @@ int main(int argc, char ** argv)
         }
     }
 
+    // Build the level of detail chain. Each level carries on simplifying the
+    // previous one and its indices are appended after the full detail mesh.
+    std::vector<unsigned int> all_indices(indices);
+    std::vector<VBM_FRAME_HEADER> frames;
+    std::vector<VBM_LOD_HEADER> lods;
+    VBM_FRAME_HEADER frame_header;
+    VBM_LOD_HEADER lod_header;
+    VBM_BOUNDS file_bounds;
+
+    calculate_bounds(vertices, NULL, 0, (unsigned int)vertices.size(), file_bounds);
+
+    memset(&frame_header, 0, sizeof(frame_header));
+    frame_header.first = 0;
+    frame_header.count = indices.size();
+    frames.push_back(frame_header);
+
+    if (!lod_ratios.empty() && !can_do_indexed)
+    {
+        fprintf(stderr, "Levels of detail require an indexed mesh - skipping\n");
+    }
+    else if (!lod_ratios.empty())
+    {
+        const float radius = file_bounds.radius != 0.0f ? file_bounds.radius : 1.0f;
+
+        lod_header.frame = 0;
+        lod_header.error = 0.0f;
+        lods.push_back(lod_header);
+
+        const unsigned int full_triangles = (unsigned int)(indices.size() / 3);
+        MeshSimplifier simplifier(&vertices[0].x, normals.size() == vertices.size() ? &normals[0].x : NULL,
+                                  (unsigned int)vertices.size(), 4, &indices[0], (unsigned int)indices.size());
+        std::vector<unsigned int> level;
+
+        printf("LOD 0: %u triangles\n", full_triangles);
+
+        for (i = 0; i < lod_ratios.size(); i++)
+        {
+            float error = simplifier.Simplify((unsigned int)(full_triangles * lod_ratios[i] / 100.0f));
+            simplifier.GetIndices(level);
+
+            frame_header.first = (unsigned int)all_indices.size();
+            frame_header.count = (unsigned int)level.size();
+            all_indices.insert(all_indices.end(), level.begin(), level.end());
+
+            lod_header.frame = (unsigned int)frames.size();
+            lod_header.error = error / radius;
+            frames.push_back(frame_header);
+            lods.push_back(lod_header);
+
+            printf("LOD %u: %u triangles (%.1f%% of original), max error %f (%.3f%% of bounding radius)\n",
+                   (unsigned int)(i + 1), simplifier.GetTriangleCount(),
+                   100.0f * simplifier.GetTriangleCount() / full_triangles,
+                   error, 100.0f * lod_header.error);
+        }
+    }
+
     outfile = fopen(argv[2], "wb");
 
     VBM_HEADER file_header;
@@ -580,12 +792,13 @@ int main(int argc, char ** argv)
     strncpy(file_header.name, objectname.c_str(), sizeof(file_header.name) - 1);
     file_header.size = sizeof(file_header);
     file_header.num_attribs = num_attribs;
-    file_header.num_frames = 1;
+    file_header.num_frames = (unsigned int)frames.size();
     if (can_do_indexed)
     {
+        // Indices are always written as 32-bit values
         file_header.num_vertices = vertices.size();
-        file_header.num_indices = indices.size();
-        file_header.index_type = max_index > 0xFFFF ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+        file_header.num_indices = all_indices.size();
+        file_header.index_type = GL_UNSIGNED_INT;
     }
     else
     {
@@ -597,7 +810,14 @@ int main(int argc, char ** argv)
         file_header.flags |= VBM_FLAG_HAS_MATERIALS;
         file_header.num_materials = materials.size();
     }
-    file_header.num_chunks = (unsigned int)(chunk - &chunks[0]);
+    if (lods.size() != 0) {
+        file_header.flags |= VBM_FLAG_HAS_LODS;
+        file_header.num_lods = (unsigned int)lods.size();
+    }
+    file_header.flags |= VBM_FLAG_HAS_BOUNDS;
+    file_header.bounds = file_bounds;
+    if (compress_file)
+        file_header.flags |= VBM_FLAG_HAS_COMPRESSION;
 
     fwrite(&file_header, sizeof(file_header), 1, outfile);
 
@@ -630,12 +850,20 @@ int main(int argc, char ** argv)
         fwrite(&attrib_header, sizeof(attrib_header), 1, outfile);
     }
 
-    VBM_FRAME_HEADER frame_header;
+    fwrite(&frames[0], sizeof(VBM_FRAME_HEADER), frames.size(), outfile);
 
-    memset(&frame_header, 0, sizeof(frame_header));
-    frame_header.first = 0;
-    frame_header.count = indices.size();
-    fwrite(&frame_header, sizeof(frame_header), 1, outfile);
+    if (lods.size() != 0)
+        fwrite(&lods[0], sizeof(VBM_LOD_HEADER), lods.size(), outfile);
+
+    // Non-indexed meshes are expanded through real_vertex_indices, so that
+    // serves as the index list when measuring them
+    const unsigned int * bounds_indices = can_do_indexed ? &all_indices[0] : &real_vertex_indices[0];
+    for (i = 0; i < frames.size(); i++)
+    {
+        VBM_BOUNDS frame_bounds;
+        calculate_bounds(vertices, bounds_indices, frames[i].first, frames[i].count, frame_bounds);
+        fwrite(&frame_bounds, sizeof(frame_bounds), 1, outfile);
+    }
 
     std::vector<VBM_VEC4F>::iterator vert;
 
@@ -667,78 +895,64 @@ int main(int argc, char ** argv)
     mean_vec.y = (max_vec.y + min_vec.y) * 0.5f;
     mean_vec.z = (max_vec.z + min_vec.z) * 0.5f;
 
+    std::vector<float> vertex_data;
+    std::vector<float> normal_data;
+    std::vector<float> texcoord_data;
+
     if (can_do_indexed)
     {
         for (vert = vertices.begin(); vert != vertices.end(); vert++) {
-            vec = *vert;
-            fwrite(&vec, sizeof(float), 3, outfile);
+            vertex_data.push_back(vert->x);
+            vertex_data.push_back(vert->y);
+            vertex_data.push_back(vert->z);
         }
 
         for (vert = normals.begin(); vert != normals.end(); vert++) {
-            vec = *vert;
-            fwrite(&vec, sizeof(float), 3, outfile);
+            normal_data.push_back(vert->x);
+            normal_data.push_back(vert->y);
+            normal_data.push_back(vert->z);
         }
 
         for (vert = texcoords.begin(); vert != texcoords.end(); vert++)
         {
-            tc.x = vert->x;
-            tc.y = vert->y;
-            fwrite(&tc, sizeof(float), 2, outfile);
+            texcoord_data.push_back(vert->x);
+            texcoord_data.push_back(vert->y);
         }
-
-        fwrite(&indices[0], sizeof(int), indices.size(), outfile);
     }
     else
     {
-        std::vector<VBM_VEC3F> vertex_data;
         for (i = 0; i < real_vertex_indices.size(); i++)
         {
-            VBM_VEC3F v;
-            v.x = vertices[real_vertex_indices[i]].x;// - mean_vec.x;
-            v.y = vertices[real_vertex_indices[i]].y;// - mean_vec.y;
-            v.z = vertices[real_vertex_indices[i]].z;// - mean_vec.z;
-            vertex_data.push_back(v);
+            vertex_data.push_back(vertices[real_vertex_indices[i]].x);// - mean_vec.x;
+            vertex_data.push_back(vertices[real_vertex_indices[i]].y);// - mean_vec.y;
+            vertex_data.push_back(vertices[real_vertex_indices[i]].z);// - mean_vec.z;
         }
-        fwrite(&vertex_data[0], vertex_data.size(), sizeof(vertex_data[0]), outfile);
 
-        std::vector<VBM_VEC3F> normal_data;
-        for (i = 0; i < real_normal_indices.size(); i++)
+        for (i = 0; i < real_normal_indices.size() && normals.size() != 0; i++)
         {
-            VBM_VEC3F v;
             n = real_normal_indices[i];
-            if (n < normals.size())
-            {
-                v.x = normals[n].x;
-                v.y = normals[n].y;
-                v.z = normals[n].z;
-            }
-            else
-            {
-                v.x = v.y = v.z = 0.0f;
-            }
-            normal_data.push_back(v);
+            normal_data.push_back((size_t)n < normals.size() ? normals[n].x : 0.0f);
+            normal_data.push_back((size_t)n < normals.size() ? normals[n].y : 0.0f);
+            normal_data.push_back((size_t)n < normals.size() ? normals[n].z : 0.0f);
         }
-        fwrite(&normal_data[0], normal_data.size(), sizeof(normal_data[0]), outfile);
 
-        std::vector<VBM_VEC2F> texcoord_data;
-        for (i = 0; i < real_texcoord_indices.size(); i++)
+        for (i = 0; i < real_texcoord_indices.size() && texcoords.size() != 0; i++)
         {
-            VBM_VEC2F v;
             n = real_texcoord_indices[i];
-            if (n < texcoords.size())
-            {
-                v.x = texcoords[n].x;
-                v.y = texcoords[n].y;
-            }
-            else
-            {
-                v.x = v.y = 0.0f;
-            }
-            texcoord_data.push_back(v);
+            texcoord_data.push_back((size_t)n < texcoords.size() ? texcoords[n].x : 0.0f);
+            texcoord_data.push_back((size_t)n < texcoords.size() ? texcoords[n].y : 0.0f);
         }
-        fwrite(&texcoord_data[0], texcoord_data.size(), sizeof(texcoord_data[0]), outfile);
     }
 
+    if (vertices.size() != 0)
+        write_stream(outfile, "position", vertex_data.data(), 3, (unsigned int)(vertex_data.size() / 3), false);
+    if (normals.size() != 0)
+        write_stream(outfile, "normal", normal_data.data(), 3, (unsigned int)(normal_data.size() / 3), false);
+    if (texcoords.size() != 0)
+        write_stream(outfile, "texcoord", texcoord_data.data(), 2, (unsigned int)(texcoord_data.size() / 2), false);
+    if (can_do_indexed)
+        write_stream(outfile, "indices", all_indices.data(), 1, (unsigned int)all_indices.size(), true);
+
     for (auto it = materials.begin(); it != materials.end(); it++)
     {
         VBM_MATERIAL &mat = it->second;
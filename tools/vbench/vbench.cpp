@@ -0,0 +1,3954 @@
+// vbench: the validators and benchmarks for the library code that the
+// examples use. Run it from bin/, as the examples are, so that media/ is
+// found:
+//
+//     vbench                  runs everything
+//     vbench sort codec       runs the tests named
+//     vbench -list            lists the tests
+//     vbench -write raster    writes new reference images instead of
+//                             comparing against them
+//     vbench -write skinning  writes media/tentacle.vbm, then tests it
+//
+// Validators check the optimized paths against plain reference code or
+// stored images, and vbench exits with 1 if any of them fail. Benchmarks
+// print their timings.
+// Tests that compare the GPU with the CPU open a hidden window for a
+// context, and leave the GPU out when there isn't one.
+
+#include "vermilion.h"
+
+#include "vmath.h"
+#include "vmathexpr.h"
+#include "mat.h"
+#include "vjobs.h"
+#include "vrandom.h"
+#include "vbm.h"
+#include "vcodec.h"
+#include "vcull.h"
+#include "vgpucull.h"
+#include "vhiz.h"
+#include "vpack.h"
+#include "vprimitives.h"
+#include "vshadow.h"
+#include "vsimplify.h"
+#include "vskeleton.h"
+#include "vsort.h"
+#include "vimage.h"
+#include "vcluster.h"
+#include "voverdraw.h"
+#include "voit.h"
+#include "vocclusion.h"
+#include "vraster.h"
+
+#include <float.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+typedef std::chrono::high_resolution_clock bench_clock;
+
+static double seconds_since(bench_clock::time_point start)
+{
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+static bool report(const char * what, unsigned int failures)
+{
+    printf("%s %s (%u mismatches)\n", what, failures == 0 ? "passed" : "FAILED", failures);
+
+    return failures == 0;
+}
+
+// Set by -write: tests with reference images write them rather than compare
+static bool write_references = false;
+
+// Binary PPM, top row first, from RGBA rows given bottom row first as
+// OpenGL returns them
+static bool write_ppm(const char * filename, const unsigned char * rgba, int width, int height)
+{
+    FILE * f = fopen(filename, "wb");
+    int x, y;
+
+    if (f == NULL)
+        return false;
+
+    fprintf(f, "P6\n%d %d\n255\n", width, height);
+    for (y = height - 1; y >= 0; y--)
+    {
+        for (x = 0; x < width; x++)
+            fwrite(rgba + (y * width + x) * 4, 3, 1, f);
+    }
+
+    return fclose(f) == 0;
+}
+
+// Reads what write_ppm writes, into RGB rows bottom row first
+static bool read_ppm(const char * filename, std::vector<unsigned char>& rgb, int& width, int& height)
+{
+    FILE * f = fopen(filename, "rb");
+    int max_value = 0;
+    int y;
+    bool ok;
+
+    if (f == NULL)
+        return false;
+
+    ok = fscanf(f, "P6 %d %d %d", &width, &height, &max_value) == 3 && max_value == 255 &&
+         width > 0 && height > 0 && fgetc(f) != EOF;
+
+    if (ok)
+    {
+        rgb.resize(size_t(width) * height * 3);
+        for (y = height - 1; y >= 0 && ok; y--)
+            ok = fread(&rgb[size_t(y) * width * 3], 3, width, f) == size_t(width);
+    }
+
+    fclose(f);
+
+    return ok;
+}
+
+// A hidden window for the tests that use the GPU, opened on first use
+static GLFWwindow * gl_window = NULL;
+
+static bool gl_available(void)
+{
+    static bool tried = false;
+
+    if (!tried)
+    {
+        tried = true;
+        if (glfwInit())
+        {
+            glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+            gl_window = glfwCreateWindow(64, 64, "vbench", NULL, NULL);
+            if (gl_window != NULL)
+            {
+                glfwMakeContextCurrent(gl_window);
+                gl3wInit();
+            }
+        }
+        if (gl_window == NULL)
+            printf("No OpenGL context; GPU tests are skipped\n");
+    }
+
+    return gl_window != NULL;
+}
+
+//----------------------------------------------------------------------------
+//
+// Clustered lighting (08-lightmodels)
+//
+
+// Froxel bounds as ClusteredLighting::SetProjection makes them
+static void make_froxels(const vmath::mat4& projection, float n, float f,
+                         unsigned int gx, unsigned int gy, unsigned int gz,
+                         std::vector<vmath::vec4>& bounds_min, std::vector<vmath::vec4>& bounds_max)
+{
+    unsigned int x, y, z;
+    int i, j;
+
+    bounds_min.resize(gx * gy * gz);
+    bounds_max.resize(gx * gy * gz);
+
+    for (z = 0; z < gz; z++)
+    {
+        const float d0 = n * powf(f / n, float(z) / float(gz));
+        const float d1 = n * powf(f / n, float(z + 1) / float(gz));
+
+        for (y = 0; y < gy; y++)
+        {
+            for (x = 0; x < gx; x++)
+            {
+                const unsigned int c = x + (y + z * gy) * gx;
+                vmath::vec4 bmin(1e30f, 1e30f, 1e30f, 0.0f);
+                vmath::vec4 bmax(-1e30f, -1e30f, -1e30f, 0.0f);
+
+                for (i = 0; i < 8; i++)
+                {
+                    const float xn = -1.0f + 2.0f * float(x + (i & 1)) / float(gx);
+                    const float yn = -1.0f + 2.0f * float(y + ((i >> 1) & 1)) / float(gy);
+                    const float d = (i & 4) ? d1 : d0;
+                    const vmath::vec4 p(d * (xn + projection[2][0]) / projection[0][0],
+                                        d * (yn + projection[2][1]) / projection[1][1],
+                                        -d, 0.0f);
+
+                    for (j = 0; j < 3; j++)
+                    {
+                        bmin[j] = vmath::min(bmin[j], p[j]);
+                        bmax[j] = vmath::max(bmax[j], p[j]);
+                    }
+                }
+
+                bounds_min[c] = bmin;
+                bounds_max[c] = bmax;
+            }
+        }
+    }
+}
+
+// The CPU light assignment against a test of every light against every
+// froxel, and its time for a range of light counts
+static bool bench_clusters(JobSystem& jobs)
+{
+    static const unsigned int light_counts[] = { 256, 1024, 4096 };
+    const unsigned int gx = 16, gy = 9, gz = 24;
+    const unsigned int froxels = gx * gy * gz;
+    const int repeats = 10;
+    std::vector<vmath::vec4> bounds_min, bounds_max;
+    std::vector<GLuint> ranges(froxels * 2);
+    std::vector<GLuint> indices(froxels * CLUSTER_MAX_LIGHTS);
+    std::vector<GLuint> expected;
+    unsigned int failures = 0;
+    unsigned int c, i, l;
+    int k;
+
+    make_froxels(vmath::perspective(60.0f, 16.0f / 9.0f, 1.0f, 500.0f), 1.0f, 500.0f, gx, gy, gz, bounds_min, bounds_max);
+
+    for (l = 0; l < sizeof(light_counts) / sizeof(light_counts[0]); l++)
+    {
+        const unsigned int count = light_counts[l];
+        std::vector<float> x(count), y(count), z(count), r(count);
+        ClusterStats stats;
+
+        vmath::random_fill_uniform(&x[0], count, 0x31u, 0, -150.0f, 150.0f);
+        vmath::random_fill_uniform(&y[0], count, 0x31u, count, -90.0f, 90.0f);
+        vmath::random_fill_uniform(&z[0], count, 0x31u, count * 2, -450.0f, -1.0f);
+        vmath::random_fill_uniform(&r[0], count, 0x31u, count * 3, 2.0f, 20.0f);
+        memset(&stats, 0, sizeof(stats));
+
+        bench_clock::time_point start = bench_clock::now();
+
+        for (k = 0; k < repeats; k++)
+        {
+            ClusteredLighting::AssignReference(jobs, &x[0], &y[0], &z[0], &r[0], count, &bounds_min[0], &bounds_max[0],
+                                               gx, gy, gz, &ranges[0], &indices[0], (unsigned int)indices.size(), &stats);
+        }
+
+        const double us = seconds_since(start) * 1.0e6 / repeats;
+
+        // Every light whose sphere reaches the box, in order, up to the
+        // limit on each list
+        for (c = 0; c < froxels; c++)
+        {
+            const vmath::vec4& bmin = bounds_min[c];
+            const vmath::vec4& bmax = bounds_max[c];
+
+            expected.clear();
+            for (i = 0; i < count && expected.size() < CLUSTER_MAX_LIGHTS; i++)
+            {
+                const float dx = vmath::max(vmath::max(bmin[0] - x[i], x[i] - bmax[0]), 0.0f);
+                const float dy = vmath::max(vmath::max(bmin[1] - y[i], y[i] - bmax[1]), 0.0f);
+                const float dz = vmath::max(vmath::max(bmin[2] - z[i], z[i] - bmax[2]), 0.0f);
+
+                if (dx * dx + dy * dy + dz * dz <= r[i] * r[i])
+                    expected.push_back(i);
+            }
+
+            if (ranges[c * 2 + 1] < expected.size() ||
+                (expected.size() < CLUSTER_MAX_LIGHTS && ranges[c * 2 + 1] != expected.size()) ||
+                (!expected.empty() && memcmp(&indices[ranges[c * 2]], &expected[0], expected.size() * sizeof(GLuint)) != 0))
+            {
+                failures++;
+            }
+        }
+
+        printf("%5u lights: %.2f per froxel (longest %u), %8.1f us\n",
+               count, stats.average_cluster_lights, stats.max_cluster_lights, us);
+    }
+
+    return report("Cluster assignment", failures);
+}
+
+//----------------------------------------------------------------------------
+//
+// Overdraw (11-overdrawcount)
+//
+
+// The CPU reduction against a plain loop, on a 1080p frame's worth of
+// counts: mostly zero to three, with a few hot pixels, some past the
+// histogram's last bin
+static bool bench_overdraw(JobSystem&)
+{
+    const unsigned int count = 1920 * 1080;
+    const int repeats = 20;
+    std::vector<unsigned int> bits(count);
+    std::vector<GLuint> counts(count);
+    unsigned int histogram[OVERDRAW_HISTOGRAM_SIZE];
+    unsigned long long sum = 0;
+    unsigned int max_count = 0;
+    unsigned int failures = 0;
+    OverdrawStats stats;
+    unsigned int i;
+    int k;
+
+    vmath::random_fill_bits(&bits[0], count, 0x32u, 0);
+    for (i = 0; i < count; i++)
+        counts[i] = (bits[i] & 0xFF) < 250 ? bits[i] >> 30 : (bits[i] >> 8) & 0x3FF;
+
+    memset(&stats, 0, sizeof(stats));
+
+    bench_clock::time_point start = bench_clock::now();
+
+    for (k = 0; k < repeats; k++)
+        OverdrawCounter::Reduce(&counts[0], count, stats);
+
+    const double seconds = seconds_since(start) / repeats;
+
+    memset(histogram, 0, sizeof(histogram));
+    for (i = 0; i < count; i++)
+    {
+        sum += counts[i];
+        max_count = std::max(max_count, counts[i]);
+        histogram[std::min(counts[i], (GLuint)OVERDRAW_HISTOGRAM_SIZE - 1)]++;
+    }
+
+    failures += stats.fragments != sum;
+    failures += stats.max != max_count;
+    for (i = 0; i < OVERDRAW_HISTOGRAM_SIZE; i++)
+        failures += stats.histogram[i] != histogram[i];
+
+    printf("1920x1080 reduced in %.2f ms (%.1f GB/s): mean %.2f, p50 %u, p99 %u, max %u\n",
+           seconds * 1.0e3, double(count) * sizeof(GLuint) / (seconds * 1.0e9),
+           stats.mean, stats.p50, stats.p99, stats.max);
+
+    return report("Overdraw reduction", failures);
+}
+
+//----------------------------------------------------------------------------
+//
+// Order independent transparency (11-oit)
+//
+
+// Builds a fragment store like the one the OIT shaders leave, with lists
+// longer than the resolve keeps at the front, and resolves it as the shaders
+// do and by sorting every fragment. Pixels that fit in the front k, and
+// every pixel of a k-buffer, must come out the same both ways; the tails
+// are blended approximately and only their error is reported.
+static bool bench_oit(JobSystem&)
+{
+    static const char * const mode_names[] = { "linked lists", "k-buffer" };
+    const GLsizei width = 256;
+    const GLsizei height = 256;
+    const unsigned int pixels = width * height;
+    const unsigned int k = 8;
+    std::vector<unsigned int> bits(OIT_RESOLVE_FRONT_K * 8);
+    std::vector<unsigned int> counts(pixels);
+    std::vector<GLuint> heads(pixels);
+    std::vector<GLuint> fragments;
+    std::vector<float> approximate(pixels * 4);
+    std::vector<float> exact(pixels * 4);
+    OITResolveStats approximate_stats;
+    OITResolveStats exact_stats;
+    unsigned int failures = 0;
+    unsigned int p, n, c;
+    int m;
+
+    vmath::random_fill_bits(&counts[0], pixels, 0x41u, 0);
+    for (p = 0; p < pixels; p++)
+        counts[p] %= OIT_RESOLVE_FRONT_K + OIT_RESOLVE_FRONT_K / 2;
+
+    for (m = 0; m < 2; m++)
+    {
+        const OITMode mode = m == 0 ? OIT_LINKED_LIST : OIT_K_BUFFER;
+        float front_error = 0.0f;
+        float tail_error = 0.0f;
+
+        // Four words a fragment: the next in the list, color, depth and
+        // specular. Lists end at index 0, so the store starts one in. The
+        // alphas are low enough for the tails to show through.
+        fragments.assign(mode == OIT_K_BUFFER ? pixels * k * 4 : 4, 0);
+
+        for (p = 0; p < pixels; p++)
+        {
+            vmath::random_fill_bits(&bits[0], counts[p] * 4, 0x41u, (p + 1) * 256);
+            heads[p] = mode == OIT_K_BUFFER ? counts[p] : 0;
+
+            for (n = 0; n < counts[p]; n++)
+            {
+                const unsigned int * b = &bits[n * 4];
+                GLuint fragment[4] = { heads[p], (b[0] & 0x1FFFFFFF) + 0x08000000, b[1], b[2] & 0x0F0F0F0F };
+
+                if (mode == OIT_K_BUFFER)
+                {
+                    if (n < k)
+                        memcpy(&fragments[(p * k + n) * 4], fragment, sizeof(fragment));
+                }
+                else
+                {
+                    heads[p] = (GLuint)(fragments.size() / 4);
+                    fragments.insert(fragments.end(), fragment, fragment + 4);
+                }
+            }
+        }
+
+        const unsigned int capacity = (unsigned int)(fragments.size() / 4);
+
+        OITBuffer::ResolveReference(mode, &heads[0], &fragments[0], capacity, width, height,
+                                    false, &approximate[0], &approximate_stats);
+        OITBuffer::ResolveReference(mode, &heads[0], &fragments[0], capacity, width, height,
+                                    true, &exact[0], &exact_stats);
+
+        for (p = 0; p < pixels; p++)
+        {
+            const bool front = mode == OIT_K_BUFFER || counts[p] <= OIT_RESOLVE_FRONT_K;
+
+            for (c = 0; c < 4; c++)
+            {
+                const float error = fabsf(approximate[p * 4 + c] - exact[p * 4 + c]);
+
+                if (front)
+                    front_error = vmath::max(front_error, error);
+                else
+                    tail_error = vmath::max(tail_error, error);
+            }
+        }
+
+        failures += front_error > 1.0e-4f;
+
+        printf("%-12s %u fragments in %u pixels (up to %u), %u in tails; max error %.6f in front, %.4f with tails\n",
+               mode_names[m], exact_stats.fragments, exact_stats.pixels, exact_stats.max_fragments,
+               approximate_stats.tail_fragments, front_error, tail_error);
+        printf("%-12s resolved at %.0f fragments/ms, exact sort at %.0f fragments/ms\n",
+               mode_names[m], approximate_stats.fragments_per_ms, exact_stats.fragments_per_ms);
+    }
+
+    return report("OIT resolve", failures);
+}
+
+//----------------------------------------------------------------------------
+//
+// Occlusion culling (03-instancing3)
+//
+
+// A few enlarged armadillos close to the camera in front of a field of
+// them, behind the coarse occluder that BuildOccluder makes and behind the
+// whole model. The coarse one must hide nothing that the whole one shows.
+// The culler runs on the calling thread here, so the time is all of its
+// work.
+static bool bench_occlusion(JobSystem&)
+{
+    const int grid = 32;
+    const int repeats = 20;
+    VBObject object;
+    OcclusionCuller cullers[2];
+    std::vector<vmath::mat4> matrices;
+    std::vector<unsigned int> visible[2];
+    unsigned int visible_count[2] = { 0, 0 };
+    unsigned int failures = 0;
+    int x, y, k, c;
+    unsigned int i;
+
+    if (!object.LoadFromVBM("media/armadillo_low.vbm", 0, 1, 2, VBM_LOAD_CPU_ONLY))
+    {
+        printf("Can't load media/armadillo_low.vbm\n");
+        return false;
+    }
+
+    const float radius = object.GetBoundingSphere()[3];
+    const vmath::mat4 projection = vmath::frustum(-1.0f, 1.0f, -0.5f, 0.5f, 1.0f, radius * 200.0f);
+
+    for (c = 0; c < 2; c++)
+        cullers[c].Initialize(512, 256, false);
+
+    bench_clock::time_point start = bench_clock::now();
+    const bool built = cullers[0].BuildOccluder(object);
+    const double build_ms = seconds_since(start) * 1.0e3;
+
+    for (c = 0; c < 2; c++)
+    {
+        for (x = 0; x < 6; x++)
+        {
+            cullers[c].AddOccluder(object, vmath::translate(radius * (float(x) * 2.0f - 5.0f), 0.0f, -radius * 6.0f) *
+                                           vmath::scale(2.0f));
+        }
+    }
+
+    for (y = 0; y < grid; y++)
+    {
+        for (x = 0; x < grid; x++)
+        {
+            matrices.push_back(vmath::translate(radius * float(x - grid / 2) * 1.5f,
+                                                radius * float(y - grid / 2) * 0.5f,
+                                                -radius * (20.0f + float(y) * 2.0f)));
+        }
+    }
+
+    printf("Coarse occluder built in %.1f ms\n", build_ms);
+
+    for (c = 0; c < 2; c++)
+    {
+        visible[c].resize(matrices.size());
+        start = bench_clock::now();
+
+        for (k = 0; k < repeats; k++)
+        {
+            cullers[c].Submit(projection, object.GetBounds(), &matrices[0], (unsigned int)matrices.size());
+            visible_count[c] = cullers[c].Wait(&visible[c][0]);
+        }
+
+        const double us = seconds_since(start) * 1.0e6 / repeats;
+        const OcclusionStats& stats = cullers[c].GetStats();
+
+        printf("%s: %u instances behind %u occluder triangles: %u visible (%.1f%% culled), "
+               "%.1f us rasterizing, %.1f us testing, %.1f us in all\n",
+               c == 0 ? "Coarse" : "Whole ", (unsigned int)matrices.size(), stats.occluder_triangles,
+               visible_count[c], stats.culled_percent, stats.rasterize_time, stats.test_time, us);
+
+        cullers[c].Free();
+    }
+
+    // Both lists are in increasing order
+    for (i = 0; i < visible_count[1]; i++)
+        failures += !std::binary_search(visible[0].begin(), visible[0].begin() + visible_count[0], visible[1][i]);
+
+    return report("Coarse occluder", failures + !built);
+}
+
+//----------------------------------------------------------------------------
+//
+// Software rasterizer
+//
+
+// Places 'object' so that its bounding sphere has radius 'size' at 'center'
+static vmath::mat4 place(const VBObject& object, const vmath::vec3& center, float size, float angle)
+{
+    const vmath::vec4 sphere = object.GetBoundingSphere();
+
+    return vmath::translate(center) * vmath::rotate(angle, 0.0f, 1.0f, 0.0f) *
+           vmath::scale(size / sphere[3]) * vmath::translate(-sphere[0], -sphere[1], -sphere[2]);
+}
+
+static void draw_raster_scene(JobSystem& jobs, SoftwareRasterizer& raster, const VBObject& torus, const VBObject& armadillo)
+{
+    const float aspect = float(raster.GetWidth()) / float(raster.GetHeight());
+    const vmath::mat4 projection = vmath::perspective(50.0f, aspect, 1.0f, 100.0f);
+
+    raster.Clear(vmath::vec4(0.2f, 0.2f, 0.3f, 1.0f));
+    raster.SetLightDirection(vmath::vec3(0.3f, 0.6f, 1.0f));
+
+    // The torus runs through the armadillo, so the depth test decides
+    // along the edges where they meet
+    raster.Draw(jobs, armadillo, 0, place(armadillo, vmath::vec3(0.5f, 0.0f, -6.0f), 2.0f, 200.0f), projection,
+                vmath::vec4(0.9f, 0.8f, 0.6f, 1.0f));
+    raster.Draw(jobs, torus, 0, place(torus, vmath::vec3(-0.8f, 0.2f, -6.5f), 2.0f, 30.0f) *
+                                vmath::rotate(70.0f, 1.0f, 0.0f, 0.0f), projection,
+                vmath::vec4(0.4f, 0.7f, 1.0f, 1.0f));
+    raster.Finish(jobs);
+}
+
+// Renders two of the media meshes and compares them with a stored image.
+// Depth and shading differ by a unit here and there between compilers, so
+// a few pixels a little apart are allowed. Then times the same scene at
+// 1920x1080.
+static bool bench_raster(JobSystem& jobs)
+{
+    static const char reference_file[] = "media/vbench_raster.ppm";
+    const int width = 320;
+    const int height = 240;
+    const int repeats = 10;
+    VBObject torus, armadillo;
+    SoftwareRasterizer raster;
+    vglImageData image;
+    std::vector<unsigned char> reference;
+    int reference_width = 0, reference_height = 0;
+    unsigned int differ = 0;
+    int max_error = 0;
+    int i, c, k;
+
+    if (!torus.LoadFromVBM("media/torus.vbm", 0, 1, 2, VBM_LOAD_CPU_ONLY) ||
+        !armadillo.LoadFromVBM("media/armadillo_low.vbm", 0, 1, 2, VBM_LOAD_CPU_ONLY))
+    {
+        printf("Can't load media/torus.vbm and media/armadillo_low.vbm\n");
+        return false;
+    }
+
+    raster.Initialize(width, height);
+    draw_raster_scene(jobs, raster, torus, armadillo);
+    raster.ReadImage(&image);
+
+    const unsigned char * pixels = (const unsigned char *)image.mip[0].data;
+
+    if (write_references)
+    {
+        const bool written = write_ppm(reference_file, pixels, width, height);
+
+        printf("%s %s\n", written ? "Wrote" : "Can't write", reference_file);
+        vglUnloadImage(&image);
+        return written;
+    }
+
+    if (!read_ppm(reference_file, reference, reference_width, reference_height) ||
+        reference_width != width || reference_height != height)
+    {
+        printf("Can't read a %dx%d image from %s; vbench -write raster makes one\n", width, height, reference_file);
+        vglUnloadImage(&image);
+        return false;
+    }
+
+    for (i = 0; i < width * height; i++)
+    {
+        int error = 0;
+
+        for (c = 0; c < 3; c++)
+            error = std::max(error, abs(int(pixels[i * 4 + c]) - int(reference[i * 3 + c])));
+
+        differ += error > 2;
+        max_error = std::max(max_error, error);
+    }
+
+    vglUnloadImage(&image);
+
+    printf("%dx%d against %s: %u pixels differ (max %d)\n", width, height, reference_file, differ, max_error);
+
+    raster.Initialize(1920, 1080);
+    for (k = 0; k < repeats; k++)
+        draw_raster_scene(jobs, raster, torus, armadillo);
+
+    const RasterStats& stats = raster.GetStats();
+
+    printf("1920x1080: %u triangles (%u culled), %u bin entries, %u of %u blocks rejected, "
+           "%.1f us setup, %.1f us raster\n",
+           stats.triangles, stats.culled, stats.bin_entries, stats.blocks_rejected, stats.blocks_tested,
+           stats.setup_time, stats.raster_time);
+
+    raster.Free();
+
+    return report("Reference image", differ <= unsigned(width * height / 1000) ? 0 : differ);
+}
+
+//----------------------------------------------------------------------------
+//
+// Radix sort (03-pointsprites)
+//
+
+// Random keys from a thousand to ten million. The result must be in order,
+// and stable: equal keys keep the order of their values.
+static bool bench_sort(JobSystem& jobs)
+{
+    static const unsigned int key_seed = 0x5027u;
+    const unsigned int max_count = 10 * 1000 * 1000;
+    std::vector<unsigned int> keys(max_count);
+    std::vector<unsigned int> values(max_count);
+    std::vector<unsigned int> original(max_count);
+    std::vector<unsigned char> seen(max_count);
+    RadixSorter sorter;
+    unsigned int failures = 0;
+    unsigned int count;
+    unsigned int i;
+
+    for (count = 1000; count <= max_count; count *= 10)
+    {
+        vmath::random_fill_bits(&keys[0], count, key_seed, 0);
+        // One size with few distinct keys, so that stability is tested
+        if (count == 10000)
+        {
+            for (i = 0; i < count; i++)
+                keys[i] &= 0xFF00;
+        }
+        for (i = 0; i < count; i++)
+            values[i] = i;
+        memcpy(&original[0], &keys[0], count * sizeof(unsigned int));
+
+        bench_clock::time_point start = bench_clock::now();
+
+        sorter.Sort(jobs, &keys[0], &values[0], count);
+
+        const double ms = seconds_since(start) * 1.0e3;
+
+        for (i = 1; i < count; i++)
+        {
+            failures += keys[i - 1] > keys[i];
+            failures += keys[i - 1] == keys[i] && values[i - 1] > values[i];
+        }
+
+        // Nothing lost or repeated: the values are the original positions,
+        // each once, and each key came from its value's position
+        memset(&seen[0], 0, count);
+        for (i = 0; i < count; i++)
+        {
+            if (values[i] >= count || seen[values[i]])
+            {
+                failures++;
+                continue;
+            }
+            seen[values[i]] = 1;
+            failures += keys[i] != original[values[i]];
+        }
+
+        printf("%8u keys in %8.2f ms, %6.1f Mkeys/s (%u passes)\n",
+               count, ms, ms > 0.0 ? double(count) / (ms * 1000.0) : 0.0, sorter.GetPassCount());
+    }
+
+    return report("Radix sort", failures);
+}
+
+//----------------------------------------------------------------------------
+//
+// Image filters (12-imageprocessing)
+//
+
+// Soft gradients under a grid of sharp edges, at a size that isn't a power
+// of two
+static void make_test_pattern(vglImageData * image, GLsizei width, GLsizei height)
+{
+    float * pixels;
+    GLsizei x, y;
+
+    create_rgba32f_image(image, width, height);
+    pixels = (float *)image->mip[0].data;
+
+    for (y = 0; y < height; y++)
+    {
+        for (x = 0; x < width; x++)
+        {
+            float * pixel = pixels + (y * width + x) * 4;
+            const bool line = (x % 64) < 2 || (y % 64) < 2;
+
+            pixel[0] = line ? 1.0f : float(x) / float(width);
+            pixel[1] = line ? 1.0f : float(y) / float(height);
+            pixel[2] = line ? 1.0f : 0.5f + 0.5f * sinf(float(x + y) * 0.05f);
+            pixel[3] = 1.0f;
+        }
+    }
+}
+
+static GLuint create_float_texture(GLsizei width, GLsizei height)
+{
+    GLuint texture;
+
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, width, height);
+
+    return texture;
+}
+
+// One pass of a separable filter in double, along the rows of 'in' and
+// down the columns of 'out' (so two passes make the whole filter). With
+// 'weights', the taps clamp to the ends of the row; without, each pixel is
+// the mean of the part of its box inside the row.
+static void filter_pass_in_double(const std::vector<double>& in, std::vector<double>& out, int width, int height,
+                                  const std::vector<float> * weights, int radius)
+{
+    int x, y, k, c;
+
+    out.assign(in.size(), 0.0);
+
+    for (y = 0; y < height; y++)
+    {
+        for (x = 0; x < width; x++)
+        {
+            double sum[4] = { 0.0, 0.0, 0.0, 0.0 };
+            const int first = weights != NULL ? x - radius : std::max(x - radius, 0);
+            const int last = weights != NULL ? x + radius : std::min(x + radius, width - 1);
+
+            for (k = first; k <= last; k++)
+            {
+                const double * pixel = &in[(size_t(y) * width + std::min(std::max(k, 0), width - 1)) * 4];
+                const double w = weights != NULL ? (*weights)[k - first] : 1.0 / (last - first + 1);
+
+                for (c = 0; c < 4; c++)
+                    sum[c] += w * pixel[c];
+            }
+
+            for (c = 0; c < 4; c++)
+                out[(size_t(x) * height + y) * 4 + c] = sum[c];
+        }
+    }
+}
+
+// The largest difference between a filtered 'image' and the same filter
+// on 'source' in double
+static double filter_error(const vglImageData * source, const vglImageData * image,
+                           const std::vector<float> * weights, int radius)
+{
+    const int width = source->mip[0].width;
+    const int height = source->mip[0].height;
+    const size_t values = size_t(width) * height * 4;
+    const float * pixels = (const float *)source->mip[0].data;
+    const float * result = (const float *)image->mip[0].data;
+    std::vector<double> in(pixels, pixels + values);
+    std::vector<double> across;
+    std::vector<double> filtered;
+    double error = 0.0;
+    size_t i;
+
+    filter_pass_in_double(in, across, width, height, weights, radius);
+    filter_pass_in_double(across, filtered, height, width, weights, radius);
+
+    for (i = 0; i < values; i++)
+        error = std::max(error, fabs(double(result[i]) - filtered[i]));
+
+    return error;
+}
+
+// Both filters for a range of radii: megapixels per second on the CPU,
+// whose results must be within rounding of the filters in double, and on
+// the GPU (waiting for it to finish), whose results must match the CPU's
+// bit for bit. The Gaussian's sums are of at most 129 taps that add to
+// one, so they are good to a few times 2^-24 per pass. The box blur's
+// summed-area table of this image reaches about 2^19, where floats are
+// 1/16 apart, and every step down a column rounds by up to half that. A
+// box's corners are 2 * radius + 1 steps apart in two columns, so its sum
+// is good to (2 * radius + 3) / 16 and its mean to that over its area.
+static bool bench_filter(JobSystem& jobs)
+{
+    static const int radii[] = { 1, 4, 16, 64 };
+    static const char * const filter_names[] = { "Gaussian", "SAT box" };
+    const GLsizei width = 1000;
+    const GLsizei height = 600;
+    const size_t values = size_t(width) * size_t(height) * 4;
+    const float megapixels = float(width) * float(height) * 1.0e-6f;
+    const int repeats = 10;
+    ImageProcessor processor;
+    vglImageData source, table, result;
+    std::vector<float> weights;
+    std::vector<float> readback;
+    GLuint input = 0, sat = 0, output = 0;
+    unsigned int failures = 0;
+    bool gpu = gl_available();
+    int m, r, k;
+    size_t i;
+
+    memset(&source, 0, sizeof(source));
+    memset(&table, 0, sizeof(table));
+    memset(&result, 0, sizeof(result));
+    make_test_pattern(&source, width, height);
+
+    gpu = processor.Initialize(gpu) && gpu;
+    if (gpu)
+    {
+        input = create_float_texture(width, height);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_FLOAT, source.mip[0].data);
+        sat = create_float_texture(width, height);
+        output = create_float_texture(width, height);
+        readback.resize(values);
+    }
+
+    for (m = 0; m < 2; m++)
+    {
+        for (r = 0; r < int(sizeof(radii) / sizeof(radii[0])); r++)
+        {
+            const int radius = radii[r];
+            double gpu_time = 0.0;
+            unsigned int differ = 0;
+
+            gaussian_kernel(float(radius) / 3.0f, weights, radius);
+            processor.SetKernel(&weights[0], radius);
+
+            bench_clock::time_point start = bench_clock::now();
+
+            if (m == 0)
+            {
+                processor.Convolve(jobs, &source, &result);
+            }
+            else
+            {
+                processor.SummedAreaTable(jobs, &source, &table);
+                processor.BoxBlur(jobs, &table, &result, radius);
+            }
+
+            const double cpu_time = seconds_since(start);
+            const double error = filter_error(&source, &result, m == 0 ? &weights : NULL, radius);
+            const double tolerance = m == 0 ? 1.0e-5 : double(2 * radius + 3) / 16.0 / double((2 * radius + 1) * (2 * radius + 1));
+
+            failures += error > tolerance;
+
+            if (gpu)
+            {
+                // Once to settle the transposed image and tables
+                for (k = 0; k <= repeats; k++)
+                {
+                    if (k == 1)
+                    {
+                        glFinish();
+                        start = bench_clock::now();
+                    }
+
+                    if (m == 0)
+                    {
+                        processor.Convolve(input, output, width, height);
+                    }
+                    else
+                    {
+                        processor.SummedAreaTable(input, sat, width, height);
+                        processor.BoxBlur(sat, output, width, height, radius);
+                    }
+                }
+                glFinish();
+                gpu_time = seconds_since(start) / repeats;
+
+                glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+                glBindTexture(GL_TEXTURE_2D, output);
+                glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, &readback[0]);
+
+                const float * reference = (const float *)result.mip[0].data;
+
+                for (i = 0; i < values; i++)
+                    differ += memcmp(&readback[i], &reference[i], sizeof(float)) != 0;
+                failures += differ;
+
+                printf("%-8s radius %3d: CPU %7.1f MP/s, error %.2g (limit %.2g), GPU %8.1f MP/s, %u values differ\n",
+                       filter_names[m], radius, megapixels / cpu_time, error, tolerance, megapixels / gpu_time, differ);
+            }
+            else
+            {
+                printf("%-8s radius %3d: CPU %7.1f MP/s, error %.2g (limit %.2g)\n",
+                       filter_names[m], radius, megapixels / cpu_time, error, tolerance);
+            }
+        }
+    }
+
+    if (gpu)
+    {
+        glDeleteTextures(1, &input);
+        glDeleteTextures(1, &sat);
+        glDeleteTextures(1, &output);
+    }
+    processor.Free();
+
+    vglUnloadImage(&source);
+    if (table.mip[0].data != NULL)
+        vglUnloadImage(&table);
+    if (result.mip[0].data != NULL)
+        vglUnloadImage(&result);
+
+    return report(gpu ? "CPU and GPU filters" : "CPU filters", failures);
+}
+
+//----------------------------------------------------------------------------
+//
+// vmath::expr (03-instancing3)
+//
+
+// Nanoseconds per item of the fastest of a few runs of 'repeats' calls of
+// 'pass' over 'count' items. The fastest is what the code can do; the
+// others have lost time to the rest of the machine.
+template <typename F>
+static double best_ns_per_item(int count, int repeats, F pass)
+{
+    double best = 0.0;
+    int run, k;
+
+    for (run = 0; run < 5; run++)
+    {
+        bench_clock::time_point start = bench_clock::now();
+
+        for (k = 0; k < repeats; k++)
+            pass();
+
+        const double ns = seconds_since(start) * 1.0e9 / (double(count) * repeats);
+
+        if (run == 0 || ns < best)
+            best = ns;
+    }
+
+    return best;
+}
+
+// Elements of the 'items' items of 'elements' floats at 'a' and 'b' that
+// differ by more than 'tolerance' times the larger of one and the largest
+// element of their item in 'a'
+static unsigned int count_apart(const float * a, const float * b, size_t items, int elements, float tolerance)
+{
+    unsigned int failures = 0;
+    size_t i;
+    int j;
+
+    for (i = 0; i < items; i++, a += elements, b += elements)
+    {
+        float scale = 1.0f;
+
+        for (j = 0; j < elements; j++)
+            scale = vmath::max(scale, fabsf(a[j]));
+        for (j = 0; j < elements; j++)
+            failures += !(fabsf(a[j] - b[j]) <= tolerance * scale);
+    }
+
+    return failures;
+}
+
+// The products that make 03-instancing3's instance matrices, and a vector
+// expression, with vmath's operators, which make a whole mat4 or vec4 at
+// each step (the mat4 products with SSE), and with vmath::expr; and the
+// vector expression in SSE written by hand. Each way must agree with the
+// operators to within rounding: the products are made in a different
+// order, the vector expression in the same one.
+static bool bench_expressions(JobSystem&)
+{
+    // The vectors' seven arrays fit in the first level cache, so that the
+    // vector expression is timed rather than the memory
+    const int count = 4096;
+    const int vector_count = 256;
+    const int repeats = 64;
+    std::vector<vmath::mat4> matrices(count), expr_matrices(count);
+    std::vector<vmath::mat4> rotations(count * 3);
+    std::vector<vmath::expr::Linear<float> > linear(count * 3);
+    std::vector<vmath::vec4> a(vector_count), b(vector_count), c(vector_count), d(vector_count);
+    std::vector<vmath::vec4> r(vector_count), expr_r(vector_count), sse_r(vector_count);
+    unsigned int failures = 0;
+    double ns[5];
+    int i, j;
+
+    for (i = 0; i < vector_count; i++)
+    {
+        for (j = 0; j < 4; j++)
+        {
+            a[i][j] = vmath::random_normal(0x47u, i * 16 + j);
+            b[i][j] = vmath::random_normal(0x47u, i * 16 + 4 + j);
+            c[i][j] = vmath::random_normal(0x47u, i * 16 + 8 + j);
+            d[i][j] = vmath::random_normal(0x47u, i * 16 + 12 + j);
+        }
+    }
+
+    // The rotations are made up front, so that only the products are timed
+    for (i = 0; i < count; i++)
+    {
+        const float x = float(i);
+
+        rotations[i * 3 + 0] = vmath::rotate(x, 1.0f, 0.0f, 0.0f);
+        rotations[i * 3 + 1] = vmath::rotate(x * 0.8f, 0.0f, 1.0f, 0.0f);
+        rotations[i * 3 + 2] = vmath::rotate(x * 0.6f, 0.0f, 0.0f, 1.0f);
+        linear[i * 3 + 0] = vmath::expr::rotate(x, 1.0f, 0.0f, 0.0f);
+        linear[i * 3 + 1] = vmath::expr::rotate(x * 0.8f, 0.0f, 1.0f, 0.0f);
+        linear[i * 3 + 2] = vmath::expr::rotate(x * 0.6f, 0.0f, 0.0f, 1.0f);
+    }
+
+    ns[0] = best_ns_per_item(count, repeats, [&]()
+    {
+        for (int n = 0; n < count; n++)
+        {
+            const float x = float(n);
+
+            matrices[n] = rotations[n * 3 + 0] * rotations[n * 3 + 1] * rotations[n * 3 + 2] *
+                          vmath::translate(10.0f + x, 40.0f + x, 50.0f + x);
+        }
+    });
+
+    ns[1] = best_ns_per_item(count, repeats, [&]()
+    {
+        for (int n = 0; n < count; n++)
+        {
+            const float x = float(n);
+
+            expr_matrices[n] = vmath::expr::to_mat4(linear[n * 3 + 0] * linear[n * 3 + 1] * linear[n * 3 + 2] *
+                                                    vmath::expr::translate(10.0f + x, 40.0f + x, 50.0f + x));
+        }
+    });
+
+    ns[2] = best_ns_per_item(vector_count, repeats * 16, [&]()
+    {
+        for (int n = 0; n < vector_count; n++)
+            r[n] = a[n] * 3.0f + b[n] - c[n] * d[n];
+    });
+
+    ns[3] = best_ns_per_item(vector_count, repeats * 16, [&]()
+    {
+        for (int n = 0; n < vector_count; n++)
+            expr_r[n] = vmath::expr::lazy(a[n]) * 3.0f + b[n] - c[n] * vmath::expr::lazy(d[n]);
+    });
+
+#if defined(VMATH_SSE2)
+    ns[4] = best_ns_per_item(vector_count, repeats * 16, [&]()
+    {
+        const __m128 three = _mm_set1_ps(3.0f);
+
+        for (int n = 0; n < vector_count; n++)
+        {
+            const __m128 ab = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(a[n]), three), _mm_loadu_ps(b[n]));
+
+            _mm_storeu_ps(&sse_r[n][0], _mm_sub_ps(ab, _mm_mul_ps(_mm_loadu_ps(c[n]), _mm_loadu_ps(d[n]))));
+        }
+    });
+#else
+    ns[4] = 0.0;
+    sse_r = r;
+#endif
+
+    // The translations reach 4000, so their rounding is relative to that
+    failures += count_apart(&matrices[0][0][0], &expr_matrices[0][0][0], count, 16, 1.0e-5f);
+    failures += count_apart(&r[0][0], &expr_r[0][0], vector_count, 4, 1.0e-6f);
+    failures += count_apart(&r[0][0], &sse_r[0][0], vector_count, 4, 1.0e-6f);
+
+    printf("Instance matrix products: %.1f ns with mat4s, %.1f ns with vmath::expr\n", ns[0], ns[1]);
+    printf("a * s + b - c * d: %.2f ns with vec4 operators, %.2f ns with vmath::expr, %.2f ns with SSE\n",
+           ns[2], ns[3], ns[4]);
+
+    return report("Expression templates", failures);
+}
+
+//----------------------------------------------------------------------------
+//
+// Matrix inverses and decomposition (08-lightmodels)
+//
+
+// Random matrices from the counter-based stream 'key'. Affine ones are
+// random rotations, translations and scales of 0.25 to 4, some negative.
+static void random_matrices(std::vector<vmath::mat4>& matrices, unsigned int key, bool affine)
+{
+    unsigned int counter = 0;
+    size_t i;
+    int j;
+
+    for (i = 0; i < matrices.size(); i++)
+    {
+        if (affine)
+        {
+            const vmath::vec3 axis = vmath::random_on_sphere(key, counter++);
+            const float angle = vmath::random_uniform(key, counter++) * 3.14159265f;
+            vmath::vec3 t, s;
+
+            for (j = 0; j < 3; j++)
+            {
+                t[j] = vmath::random_normal(key, counter++) * 10.0f;
+                s[j] = powf(4.0f, vmath::random_uniform(key, counter++) * 2.0f - 1.0f);
+            }
+            if (vmath::random_uniform(key, counter++) < 0.25f)
+                s[0] = -s[0];
+
+            matrices[i] = vmath::composeTRS(t, vmath::quaternion(axis[0] * sinf(angle), axis[1] * sinf(angle),
+                                                                 axis[2] * sinf(angle), cosf(angle)), s);
+        }
+        else
+        {
+            for (j = 0; j < 16; j++)
+                matrices[i][j / 4][j % 4] = vmath::random_normal(key, counter++);
+        }
+    }
+}
+
+static vmath::dmat4 to_double(const vmath::mat4& m)
+{
+    vmath::dmat4 result;
+    int i, j;
+
+    for (i = 0; i < 4; i++)
+        for (j = 0; j < 4; j++)
+            result[i][j] = m[i][j];
+
+    return result;
+}
+
+// The largest difference between a and b, relative to the largest element
+// of b
+template <int N>
+static double relative_error(const vmath::matNM<float,N,N>& a, const vmath::matNM<double,N,N>& b)
+{
+    double error = 0.0;
+    double size = 0.0;
+    int i, j;
+
+    for (i = 0; i < N; i++)
+    {
+        for (j = 0; j < N; j++)
+        {
+            error = std::max(error, fabs(double(a[i][j]) - b[i][j]));
+            size = std::max(size, fabs(b[i][j]));
+        }
+    }
+
+    return error / size;
+}
+
+// Checks the float matrix functions against the same ones in double. A
+// general matrix loses about as many digits as its condition number has,
+// so that error is also given, and checked, per unit of condition number.
+static bool validate_matrices(void)
+{
+    const int count = 100000;
+    std::vector<vmath::mat4> general(count);
+    std::vector<vmath::mat4> affine(count);
+    std::vector<vmath::mat4> batch(count);
+    double inverse_error = 0.0, conditioned_error = 0.0, batch_error = 0.0, determinant_error = 0.0;
+    double affine_error = 0.0, normal_error = 0.0, trs_error = 0.0;
+    int i;
+
+    random_matrices(general, 0x46u, false);
+    random_matrices(affine, 0x47u, true);
+    vmath::inverse(&general[0], &batch[0], count);
+
+    for (i = 0; i < count; i++)
+    {
+        const vmath::dmat4 m = to_double(general[i]);
+        const vmath::dmat4 m_inverse = vmath::inverse(m);
+        const double error = relative_error(vmath::inverse(general[i]), m_inverse);
+        double size = 0.0, inverse_size = 0.0;
+        int j;
+
+        for (j = 0; j < 16; j++)
+        {
+            size = std::max(size, fabs(m[j / 4][j % 4]));
+            inverse_size = std::max(inverse_size, fabs(m_inverse[j / 4][j % 4]));
+        }
+
+        inverse_error = std::max(inverse_error, error);
+        conditioned_error = std::max(conditioned_error, error / (size * inverse_size));
+        batch_error = std::max(batch_error, relative_error(batch[i], m_inverse) / (size * inverse_size));
+        determinant_error = std::max(determinant_error, fabs(vmath::determinant(general[i]) - vmath::determinant(m)) /
+                                                        std::max(1.0, fabs(vmath::determinant(m))));
+
+        const vmath::dmat4 a = to_double(affine[i]);
+        vmath::vec3 t, s;
+        vmath::quaternion q;
+
+        affine_error = std::max(affine_error, relative_error(vmath::affineInverse(affine[i]), vmath::inverse(a)));
+        normal_error = std::max(normal_error, relative_error(vmath::inverseTranspose3x3(affine[i]), vmath::inverseTranspose3x3(a)));
+        vmath::decomposeTRS(affine[i], t, q, s);
+        trs_error = std::max(trs_error, relative_error(vmath::composeTRS(t, q, s), a));
+    }
+
+    printf("Matrices: %d random, largest errors relative to the double precision results\n", count);
+    printf("  inverse             %.3g (%.3g per unit of condition number, %.3g in batches)\n",
+           inverse_error, conditioned_error, batch_error);
+    printf("  determinant         %.3g\n", determinant_error);
+    printf("  affineInverse       %.3g\n", affine_error);
+    printf("  inverseTranspose3x3 %.3g\n", normal_error);
+    printf("  decomposeTRS        %.3g (composed again)\n", trs_error);
+
+    // A few hundred float epsilons apart is a mismatch
+    const double limit = 1.0e-4;
+    const unsigned int mismatches = (conditioned_error > limit) + (batch_error > limit) +
+                                    (determinant_error > limit) + (affine_error > limit) +
+                                    (normal_error > limit) + (trs_error > limit);
+
+    return report("Matrices", mismatches);
+}
+
+// The elements of an Angel mat4, which stores rows, copied one by one into
+// a vmath::mat4, which stores columns
+static vmath::mat4 from_angel(const mat4& a)
+{
+    vmath::mat4 result;
+    int i, j;
+
+    for (i = 0; i < 4; i++)
+        for (j = 0; j < 4; j++)
+            result[j][i] = a[i][j];
+
+    return result;
+}
+
+static bool same_bits(const vmath::mat4& a, const vmath::mat4& b)
+{
+    return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+// mat.h's mat4, which runs on the kernels in vmathkernels.h too: products,
+// transpose, inverse, matrix times vector, to_vmath and to_angel, and
+// products of one of each kind, against the same done in double (or, for
+// the conversions and transpose, moved element by element). Products are
+// relative to the largest elements of their operands.
+static bool validate_angel_matrices(void)
+{
+    const int count = 100000;
+    std::vector<vmath::mat4> general(count);
+    double product_error = 0.0, vector_error = 0.0, inverse_error = 0.0, mixed_error = 0.0;
+    unsigned int moved_mismatches = 0;
+    int i;
+
+    random_matrices(general, 0x48u, false);
+
+    for (i = 0; i < count; i++)
+    {
+        const vmath::mat4& m = general[i];
+        const vmath::mat4& n = general[(i + 1) % count];
+        mat4 a, b;
+        vec4 v(vmath::random_normal(0x49u, i * 4), vmath::random_normal(0x49u, i * 4 + 1),
+               vmath::random_normal(0x49u, i * 4 + 2), vmath::random_normal(0x49u, i * 4 + 3));
+        double m_size = 0.0, n_size = 0.0, inverse_size = 0.0, v_size = 0.0;
+        int j, k;
+
+        // a and b hold the same matrices as m and n
+        for (j = 0; j < 4; j++)
+        {
+            for (k = 0; k < 4; k++)
+            {
+                a[j][k] = m[k][j];
+                b[j][k] = n[k][j];
+            }
+        }
+
+        const vmath::dmat4 dm = to_double(m);
+        const vmath::dmat4 dn = to_double(n);
+        const vmath::dmat4 dm_inverse = vmath::inverse(dm);
+
+        for (j = 0; j < 16; j++)
+        {
+            m_size = std::max(m_size, fabs(dm[j / 4][j % 4]));
+            n_size = std::max(n_size, fabs(dn[j / 4][j % 4]));
+            inverse_size = std::max(inverse_size, fabs(dm_inverse[j / 4][j % 4]));
+        }
+        for (j = 0; j < 4; j++)
+            v_size = std::max(v_size, fabs(double(v[j])));
+
+        // Errors relative to the size of the result are scaled back to the
+        // size of the operands
+        const vmath::dmat4 product = dm * dn;
+        double product_size = 0.0;
+
+        for (j = 0; j < 16; j++)
+            product_size = std::max(product_size, fabs(product[j / 4][j % 4]));
+
+        const double product_scale = product_size / (m_size * n_size);
+
+        product_error = std::max(product_error, relative_error(from_angel(a * b), product) * product_scale);
+        mixed_error = std::max(mixed_error, relative_error(m * b, product) * product_scale);
+        mixed_error = std::max(mixed_error, relative_error(from_angel(a * n), product) * product_scale);
+
+        mat4 c = a;
+        c *= b;
+        product_error = std::max(product_error, relative_error(from_angel(c), product) * product_scale);
+
+        inverse_error = std::max(inverse_error, relative_error(from_angel(inverse(a)), dm_inverse) / (m_size * inverse_size));
+
+        const vec4 r = a * v;
+
+        for (j = 0; j < 4; j++)
+        {
+            double expected = 0.0;
+
+            for (k = 0; k < 4; k++)
+                expected += dm[k][j] * double(v[k]);
+            vector_error = std::max(vector_error, fabs(double(r[j]) - expected) / (m_size * v_size));
+        }
+
+        moved_mismatches += !same_bits(to_vmath(a), m);
+        moved_mismatches += !same_bits(from_angel(to_angel(m)), m);
+        moved_mismatches += !same_bits(from_angel(transpose(a)), m.transpose());
+        moved_mismatches += !same_bits(from_angel(to_angel(to_vmath(a))), m);
+    }
+
+    printf("Angel mat4: %d random, largest errors relative to the double precision results\n", count);
+    printf("  mat4 * mat4         %.3g\n", product_error);
+    printf("  mat4 * vec4         %.3g\n", vector_error);
+    printf("  inverse             %.3g per unit of condition number\n", inverse_error);
+    printf("  mixed products      %.3g\n", mixed_error);
+    printf("  to_vmath, to_angel and transpose: %u not moved exactly\n", moved_mismatches);
+
+    const double limit = 1.0e-4;
+    const unsigned int mismatches = (product_error > limit) + (vector_error > limit) +
+                                    (inverse_error > limit) + (mixed_error > limit) + moved_mismatches;
+
+    return report("Angel matrices", mismatches);
+}
+
+
+static bool bench_matrices(JobSystem&)
+{
+    const int count = 10000;
+    const int repeats = 100;
+    std::vector<vmath::mat4> general(count);
+    std::vector<vmath::mat4> affine(count);
+    std::vector<vmath::mat4> result(count);
+    std::vector<vmath::mat3> normal(count);
+    bench_clock::time_point start;
+    double ns[7];
+    float sum = 0.0f;
+    int i, r;
+
+    random_matrices(general, 0x46u, false);
+    random_matrices(affine, 0x47u, true);
+
+    // Nanoseconds per matrix since 'start'
+#define NS_PER_MATRIX() (seconds_since(start) * 1.0e9 / double(count * repeats))
+
+    start = bench_clock::now();
+    for (r = 0; r < repeats; r++)
+        for (i = 0; i < count; i++)
+            result[i] = vmath::inverse(general[i]);
+    ns[0] = NS_PER_MATRIX();
+
+    start = bench_clock::now();
+    for (r = 0; r < repeats; r++)
+        vmath::inverse(&general[0], &result[0], count);
+    ns[1] = NS_PER_MATRIX();
+
+    start = bench_clock::now();
+    for (r = 0; r < repeats; r++)
+        for (i = 0; i < count; i++)
+            result[i] = vmath::affineInverse(affine[i]);
+    ns[2] = NS_PER_MATRIX();
+
+    start = bench_clock::now();
+    for (r = 0; r < repeats; r++)
+        vmath::inverseTranspose3x3(&affine[0], &normal[0], count);
+    ns[3] = NS_PER_MATRIX();
+
+    start = bench_clock::now();
+    for (r = 0; r < repeats; r++)
+        for (i = 0; i < count; i++)
+            sum += vmath::determinant(general[i]);
+    ns[4] = NS_PER_MATRIX();
+
+    start = bench_clock::now();
+    for (r = 0; r < repeats; r++)
+    {
+        for (i = 0; i < count; i++)
+        {
+            vmath::vec3 t, s;
+            vmath::quaternion q;
+
+            vmath::decomposeTRS(affine[i], t, q, s);
+            sum += q[3];
+        }
+    }
+    ns[5] = NS_PER_MATRIX();
+
+    start = bench_clock::now();
+    for (r = 0; r < repeats; r++)
+        for (i = 0; i < count; i++)
+            sum += vmath::inverse(to_double(general[i]))[0][0];
+    ns[6] = NS_PER_MATRIX();
+
+#undef NS_PER_MATRIX
+
+    // Keep the results alive
+    volatile float sink = sum + result[count - 1][0][0] + normal[count - 1][0][0];
+    (void)sink;
+
+    printf("Matrices: inverse %.1f ns (%.1f in batches), affineInverse %.1f ns, inverseTranspose3x3 %.1f ns,\n"
+           "          determinant %.1f ns, decomposeTRS %.1f ns, double inverse %.1f ns\n",
+           ns[0], ns[1], ns[2], ns[3], ns[4], ns[5], ns[6]);
+
+    const bool vmath_passed = validate_matrices();
+
+    return validate_angel_matrices() && vmath_passed;
+}
+
+//----------------------------------------------------------------------------
+//
+// Frustum culling (03-instancing2)
+//
+
+// The planes of 'view_projection' in double, as frustumPlanes finds them
+static void planes_in_double(const vmath::mat4& view_projection, vmath::dvec4 planes[6])
+{
+    const vmath::dmat4 m = to_double(view_projection);
+    int p, j;
+
+    for (p = 0; p < 6; p++)
+    {
+        for (j = 0; j < 4; j++)
+            planes[p][j] = m[j][3] + ((p & 1) ? -m[j][p / 2] : m[j][p / 2]);
+
+        const double length = sqrt(planes[p][0] * planes[p][0] + planes[p][1] * planes[p][1] + planes[p][2] * planes[p][2]);
+
+        planes[p] /= length;
+    }
+}
+
+// Tests each instance's sphere against the planes of 'view_projection' in
+// double. 'margin' is how far each is from changing its mind.
+static void cull_in_double(const vmath::mat4& view_projection, const vmath::vec4& sphere,
+                           const std::vector<vmath::mat4>& matrices,
+                           std::vector<unsigned char>& inside, std::vector<double>& margin)
+{
+    vmath::dvec4 planes[6];
+    size_t i;
+    int p, j;
+
+    planes_in_double(view_projection, planes);
+
+    inside.assign(matrices.size(), 1);
+    margin.assign(matrices.size(), DBL_MAX);
+
+    for (i = 0; i < matrices.size(); i++)
+    {
+        const vmath::dmat4 model = to_double(matrices[i]);
+        vmath::dvec3 center;
+        double scale = 0.0;
+
+        for (j = 0; j < 3; j++)
+        {
+            center[j] = model[0][j] * sphere[0] + model[1][j] * sphere[1] + model[2][j] * sphere[2] + model[3][j];
+            scale = std::max(scale, model[j][0] * model[j][0] + model[j][1] * model[j][1] + model[j][2] * model[j][2]);
+        }
+
+        const double r = sphere[3] * sqrt(scale);
+
+        for (p = 0; p < 6; p++)
+        {
+            const double d = planes[p][0] * center[0] + planes[p][1] * center[1] + planes[p][2] * center[2] + planes[p][3];
+
+            inside[i] = inside[i] && d >= -r;
+            margin[i] = std::min(margin[i], fabs(d + r));
+        }
+    }
+}
+
+// The same for boxes given by their centers 'c' and half-extents 'e': a
+// box is outside a plane when its center is further behind it than the
+// box reaches towards it
+static void cull_boxes_in_double(const vmath::mat4& view_projection,
+                                 const std::vector<float> c[3], const std::vector<float> e[3],
+                                 std::vector<unsigned char>& inside, std::vector<double>& margin)
+{
+    vmath::dvec4 planes[6];
+    size_t i;
+    int p;
+
+    planes_in_double(view_projection, planes);
+
+    inside.assign(c[0].size(), 1);
+    margin.assign(c[0].size(), DBL_MAX);
+
+    for (i = 0; i < c[0].size(); i++)
+    {
+        for (p = 0; p < 6; p++)
+        {
+            const double d = planes[p][0] * c[0][i] + planes[p][1] * c[1][i] + planes[p][2] * c[2][i] + planes[p][3];
+            const double reach = fabs(planes[p][0]) * e[0][i] + fabs(planes[p][1]) * e[1][i] + fabs(planes[p][2]) * e[2][i];
+
+            inside[i] = inside[i] && d >= -reach;
+            margin[i] = std::min(margin[i], fabs(d + reach));
+        }
+    }
+}
+
+// Checks a list of visible instances, which must be in increasing order,
+// against cull_in_double. Spheres that touch a plane to within rounding
+// may go either way.
+static unsigned int cull_mismatches(const unsigned int * visible, unsigned int visible_count,
+                                    const std::vector<unsigned char>& inside, const std::vector<double>& margin)
+{
+    const unsigned int count = (unsigned int)inside.size();
+    std::vector<unsigned char> listed(count, 0);
+    unsigned int failures = 0;
+    unsigned int i;
+
+    for (i = 0; i < visible_count; i++)
+    {
+        failures += visible[i] >= count || (i != 0 && visible[i] <= visible[i - 1]);
+        if (visible[i] < count)
+            listed[visible[i]] = 1;
+    }
+
+    for (i = 0; i < count; i++)
+        failures += listed[i] != inside[i] && margin[i] > 1.0e-4;
+
+    return failures;
+}
+
+// The instances of 03-instancing2 through transformSpheres, cullSpheres
+// and compactInstances, with the camera looking across a cloud of them so
+// that a good share cross the edges, checked against cull_in_double. Then
+// boxes around the same centers, of a few shapes, through cullBoxes and
+// against cull_boxes_in_double. The count leaves a few over from the SIMD
+// width.
+static bool bench_cull(JobSystem&)
+{
+    const unsigned int count = 100003;
+    const int repeats = 50;
+    const vmath::vec4 sphere(0.25f, -0.5f, 0.125f, 1.5f);
+    const vmath::mat4 view_projection = vmath::frustum(-0.25f, 0.25f, -0.125f, 0.125f, 1.0f, 40.0f) *
+                                        vmath::lookat(vmath::vec3(5.0f, 3.0f, 25.0f), vmath::vec3(0.0f), vmath::vec3(0.0f, 1.0f, 0.0f));
+    std::vector<vmath::mat4> matrices(count);
+    std::vector<vmath::mat4> compacted(count);
+    std::vector<float> x(count), y(count), z(count), r(count);
+    std::vector<unsigned int> visible(count);
+    unsigned int visible_count = 0;
+    vmath::vec4 planes[6];
+    double us[3] = { 0.0, 0.0, 0.0 };
+    int k;
+
+    random_matrices(matrices, 0x48u, true);
+
+    for (k = 0; k < repeats; k++)
+    {
+        bench_clock::time_point start = bench_clock::now();
+
+        vmath::frustumPlanes(view_projection, planes);
+        vmath::transformSpheres(sphere, &matrices[0], count, &x[0], &y[0], &z[0], &r[0]);
+        us[0] += seconds_since(start) * 1.0e6;
+
+        start = bench_clock::now();
+        visible_count = vmath::cullSpheres(planes, &x[0], &y[0], &z[0], &r[0], count, &visible[0]);
+        us[1] += seconds_since(start) * 1.0e6;
+
+        start = bench_clock::now();
+        vmath::compactInstances(&matrices[0], &visible[0], visible_count, &compacted[0]);
+        us[2] += seconds_since(start) * 1.0e6;
+    }
+
+    printf("%u instances, %u visible: transform %.0f, cull %.0f, compact %.0f, all %.0f instances/us\n",
+           count, visible_count, count * repeats / us[0], count * repeats / us[1], count * repeats / us[2],
+           count * repeats / (us[0] + us[1] + us[2]));
+
+    // The compacted instances must be the visible ones in order
+    std::vector<unsigned char> inside;
+    std::vector<double> margin;
+    unsigned int failures = 0;
+    unsigned int i;
+
+    cull_in_double(view_projection, sphere, matrices, inside, margin);
+    failures += cull_mismatches(&visible[0], visible_count, inside, margin);
+    for (i = 0; i < visible_count; i++)
+        failures += memcmp(&compacted[i], &matrices[std::min(visible[i], count - 1)], sizeof(vmath::mat4)) != 0;
+
+    // Flat, long and cube-shaped boxes that mostly fit inside the spheres
+    std::vector<float> c[3] = { x, y, z };
+    std::vector<float> e[3];
+    double box_us = 0.0;
+
+    for (k = 0; k < 3; k++)
+        e[k].resize(count);
+    for (i = 0; i < count; i++)
+    {
+        e[0][i] = r[i] * (i % 3 == 0 ? 0.75f : 0.25f);
+        e[1][i] = r[i] * (i % 3 == 1 ? 0.75f : 0.25f);
+        e[2][i] = r[i] * (i % 3 == 2 ? 0.25f : 0.5f);
+    }
+
+    for (k = 0; k < repeats; k++)
+    {
+        bench_clock::time_point start = bench_clock::now();
+
+        visible_count = vmath::cullBoxes(planes, &c[0][0], &c[1][0], &c[2][0], &e[0][0], &e[1][0], &e[2][0], count, &visible[0]);
+        box_us += seconds_since(start) * 1.0e6;
+    }
+
+    printf("%u boxes, %u visible: cull %.0f boxes/us\n", count, visible_count, count * repeats / box_us);
+
+    cull_boxes_in_double(view_projection, c, e, inside, margin);
+    failures += cull_mismatches(&visible[0], visible_count, inside, margin);
+
+    return report("Frustum culling", failures);
+}
+
+// GPUInstanceCuller::CullReference, which stands in for the compute pass
+// on machines without a GPU, against cull_in_double; and with a GPU, the
+// compute pass itself, whose visible set (in any order) must agree with
+// both and whose compacted matrices must be the instances'.
+static bool bench_gpucull(JobSystem&)
+{
+    const unsigned int count = 100003;
+    const int repeats = 20;
+    std::vector<vmath::mat4> matrices(count);
+    std::vector<unsigned int> visible(count);
+    std::vector<unsigned char> inside;
+    std::vector<double> margin;
+    unsigned int visible_count = 0;
+    unsigned int failures = 0;
+    unsigned int i;
+    VBObject object;
+    const bool gpu = gl_available();
+    int k;
+
+    if (!object.LoadFromVBM("media/armadillo_low.vbm", 0, 1, 2, gpu ? 0 : VBM_LOAD_CPU_ONLY))
+    {
+        printf("Can't load media/armadillo_low.vbm\n");
+        return false;
+    }
+
+    // The cloud of bench_cull, in units of the armadillo
+    const vmath::vec4 sphere = object.GetBoundingSphere();
+    const float unit = sphere[3];
+    const vmath::mat4 view_projection = vmath::frustum(-0.25f * unit, 0.25f * unit, -0.125f * unit, 0.125f * unit, unit, unit * 40.0f) *
+                                        vmath::lookat(vmath::vec3(5.0f, 3.0f, 25.0f) * unit, vmath::vec3(0.0f), vmath::vec3(0.0f, 1.0f, 0.0f));
+
+    random_matrices(matrices, 0x49u, true);
+    for (i = 0; i < count; i++)
+        matrices[i][3] = vmath::vec4(vmath::vec3(matrices[i][3][0], matrices[i][3][1], matrices[i][3][2]) * unit, 1.0f);
+
+    bench_clock::time_point start = bench_clock::now();
+
+    for (k = 0; k < repeats; k++)
+        visible_count = GPUInstanceCuller::CullReference(&matrices[0], count, sphere, view_projection, &visible[0]);
+
+    const double cpu_time = seconds_since(start) / repeats;
+
+    cull_in_double(view_projection, sphere, matrices, inside, margin);
+    failures += cull_mismatches(&visible[0], visible_count, inside, margin);
+
+    // The culler frees its GL objects when it goes, so it only exists here
+    GPUInstanceCuller * culler = gpu ? new GPUInstanceCuller : NULL;
+
+    if (culler != NULL && culler->Initialize(count))
+    {
+        std::vector<vmath::mat4> compacted;
+        std::vector<unsigned int> indices;
+        GLuint command[5];
+        unsigned int differ = 0;
+
+        culler->SetInstances(&matrices[0], count);
+
+        // Once to warm up
+        for (k = 0; k <= repeats; k++)
+        {
+            if (k == 1)
+            {
+                glFinish();
+                start = bench_clock::now();
+            }
+            culler->Cull(object, 0, view_projection);
+        }
+        glFinish();
+
+        const double gpu_time = seconds_since(start) / repeats;
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, culler->GetCommandBuffer());
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(command), command);
+
+        const unsigned int gpu_count = std::min(command[1], count);
+
+        compacted.resize(gpu_count + 1);
+        indices.resize(gpu_count + 1);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, culler->GetVisibleMatrixBuffer());
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, gpu_count * sizeof(vmath::mat4), &compacted[0]);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, culler->GetVisibleIndexBuffer());
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, gpu_count * sizeof(GLuint), &indices[0]);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        for (i = 0; i < gpu_count; i++)
+            differ += memcmp(&compacted[i], &matrices[std::min(indices[i], count - 1)], sizeof(vmath::mat4)) != 0;
+
+        std::sort(indices.begin(), indices.begin() + gpu_count);
+        differ += cull_mismatches(&indices[0], gpu_count, inside, margin);
+        failures += differ;
+
+        printf("%u instances: CPU reference %u visible at %.0f instances/us, GPU %u visible at %.0f instances/us, %u differ\n",
+               count, visible_count, count / (cpu_time * 1.0e6), gpu_count, count / (gpu_time * 1.0e6), differ);
+    }
+    else
+    {
+        printf("%u instances: CPU reference %u visible at %.0f instances/us\n",
+               count, visible_count, count / (cpu_time * 1.0e6));
+    }
+
+    delete culler;
+
+    return report("GPU culling reference", failures);
+}
+
+//----------------------------------------------------------------------------
+//
+// Hierarchical Z (03-indirectculling)
+//
+
+// A far background with a few random rectangles in front, every pixel a
+// little rough so that the farthest of each block is somewhere different
+static void make_depth(std::vector<float>& depth, int width, int height, unsigned int key)
+{
+    std::vector<float> rough(size_t(width) * height);
+    unsigned int counter = 0;
+    size_t i;
+    int r, x, y;
+
+    vmath::random_fill_uniform(&rough[0], (unsigned int)rough.size(), key, 0x10000u, 0.0f, 0.05f);
+    depth.resize(rough.size());
+    for (i = 0; i < rough.size(); i++)
+        depth[i] = 0.95f + rough[i];
+
+    for (r = 0; r < 12; r++)
+    {
+        const int x0 = int(vmath::random_uniform(key, counter) * width);
+        const int y0 = int(vmath::random_uniform(key, counter + 1) * height);
+        const int x1 = std::min(width, x0 + 1 + int(vmath::random_uniform(key, counter + 2) * width * 0.5f));
+        const int y1 = std::min(height, y0 + 1 + int(vmath::random_uniform(key, counter + 3) * height * 0.5f));
+        const float d = 0.1f + 0.7f * vmath::random_uniform(key, counter + 4);
+
+        counter += 5;
+        for (y = y0; y < y1; y++)
+        {
+            for (x = x0; x < x1; x++)
+            {
+                i = size_t(y) * width + x;
+                depth[i] = std::min(depth[i], d + rough[i]);
+            }
+        }
+    }
+}
+
+// Every texel of every level must be the farthest of exactly the pixels
+// it covers, the blocks at the right and top edges being cut short
+static unsigned int check_pyramid(const std::vector<float>& depth, int width, int height, const float * pyramid)
+{
+    GLuint offsets[HIZ_MAX_LEVELS];
+    const int levels = HiZPyramid::LevelCount(width, height);
+    unsigned int failures = 0;
+    int level, x, y, i, j;
+
+    HiZPyramid::LevelOffsets(width, height, offsets);
+
+    for (level = 0; level < levels; level++)
+    {
+        const int size = 1 << level;
+        const int level_width = (width + size - 1) / size;
+        const int level_height = (height + size - 1) / size;
+
+        failures += level == levels - 1 && (level_width != 1 || level_height != 1);
+
+        for (y = 0; y < level_height; y++)
+        {
+            for (x = 0; x < level_width; x++)
+            {
+                float farthest = -FLT_MAX;
+
+                for (j = y * size; j < std::min(height, (y + 1) * size); j++)
+                    for (i = x * size; i < std::min(width, (x + 1) * size); i++)
+                        farthest = std::max(farthest, depth[size_t(j) * width + i]);
+
+                failures += pyramid[offsets[level] + y * level_width + x] != farthest;
+            }
+        }
+    }
+
+    return failures;
+}
+
+// Random boxes, some partly or wholly off the screen
+static void make_boxes(std::vector<HiZBox>& boxes, int width, int height, unsigned int key)
+{
+    unsigned int counter = 0;
+    size_t i;
+
+    for (i = 0; i < boxes.size(); i++)
+    {
+        const float x = (vmath::random_uniform(key, counter) * 1.2f - 0.1f) * width;
+        const float y = (vmath::random_uniform(key, counter + 1) * 1.2f - 0.1f) * height;
+        const float w = vmath::random_uniform(key, counter + 2) * vmath::random_uniform(key, counter + 3) * width * 0.5f;
+        const float h = vmath::random_uniform(key, counter + 4) * vmath::random_uniform(key, counter + 5) * height * 0.5f;
+        const float z = vmath::random_uniform(key, counter + 6);
+
+        counter += 7;
+        boxes[i].min = vmath::vec4(x, y, z, 0.0f);
+        boxes[i].max = vmath::vec4(x + w, y + h, std::min(1.0f, z + 0.1f), 0.0f);
+    }
+}
+
+// A box is hidden only if every pixel under it is nearer than its nearest
+// point: the test may keep a hidden box but never drop a visible one.
+// Returns the failures and counts the hidden boxes, and those kept.
+static unsigned int check_boxes(const std::vector<float>& depth, int width, int height,
+                                const std::vector<HiZBox>& boxes, const GLuint * visible,
+                                unsigned int& hidden, unsigned int& kept)
+{
+    unsigned int failures = 0;
+    size_t b;
+    int x, y;
+
+    for (b = 0; b < boxes.size(); b++)
+    {
+        const HiZBox& box = boxes[b];
+        bool seen = false;
+
+        if (box.max[0] >= 0.0f && box.max[1] >= 0.0f && box.min[0] < float(width) && box.min[1] < float(height))
+        {
+            const int x0 = std::max(0, (int)floorf(box.min[0])), y0 = std::max(0, (int)floorf(box.min[1]));
+            const int x1 = std::min(width - 1, (int)floorf(box.max[0])), y1 = std::min(height - 1, (int)floorf(box.max[1]));
+
+            for (y = y0; y <= y1 && !seen; y++)
+                for (x = x0; x <= x1 && !seen; x++)
+                    seen = box.min[2] <= depth[size_t(y) * width + x];
+        }
+
+        failures += seen && visible[b] != 1;
+        failures += visible[b] > 1;
+        hidden += !seen;
+        kept += !seen && visible[b] == 1;
+    }
+
+    return failures;
+}
+
+// HiZPyramid::BuildReference and TestReference on sizes that halve
+// unevenly, against the pixels themselves; and with a GPU, Build and Test,
+// which must give the same bits
+static bool bench_hiz(JobSystem& jobs)
+{
+    static const int sizes[][2] = { { 1, 1 }, { 2, 3 }, { 7, 5 }, { 33, 17 }, { 640, 360 }, { 1001, 601 } };
+    const unsigned int box_count = 20000;
+    std::vector<float> depth;
+    std::vector<float> pyramid;
+    std::vector<HiZBox> boxes(box_count);
+    std::vector<GLuint> visible(box_count);
+    GLuint offsets[HIZ_MAX_LEVELS];
+    unsigned int failures = 0;
+    const bool gpu = gl_available();
+    unsigned int s;
+
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        const int width = sizes[s][0];
+        const int height = sizes[s][1];
+        unsigned int hidden = 0;
+        unsigned int kept = 0;
+        unsigned int differ = 0;
+
+        make_depth(depth, width, height, 0x50u + s);
+        make_boxes(boxes, width, height, 0x60u + s);
+        pyramid.assign(HiZPyramid::LevelOffsets(width, height, offsets) + 1, -1.0f);
+
+        bench_clock::time_point start = bench_clock::now();
+        HiZPyramid::BuildReference(jobs, &depth[0], width, height, &pyramid[0]);
+        const double build_us = seconds_since(start) * 1.0e6;
+
+        start = bench_clock::now();
+        HiZPyramid::TestReference(jobs, &pyramid[0], width, height, &boxes[0], box_count, &visible[0]);
+        const double test_us = seconds_since(start) * 1.0e6;
+
+        const unsigned int wrong = check_pyramid(depth, width, height, &pyramid[0]) +
+                                   (pyramid.back() != -1.0f) +
+                                   check_boxes(depth, width, height, boxes, &visible[0], hidden, kept);
+
+        failures += wrong;
+
+        HiZPyramid * hiz = gpu ? new HiZPyramid : NULL;
+
+        if (hiz != NULL && hiz->Initialize(width, height))
+        {
+            const unsigned int size = (unsigned int)pyramid.size() - 1;
+            std::vector<float> gpu_pyramid(size);
+            std::vector<GLuint> gpu_visible(box_count);
+            GLuint texture, buffers[2];
+            unsigned int i;
+
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, width, height);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_DEPTH_COMPONENT, GL_FLOAT, &depth[0]);
+
+            glGenBuffers(2, buffers);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[0]);
+            glBufferStorage(GL_SHADER_STORAGE_BUFFER, box_count * sizeof(HiZBox), &boxes[0], 0);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[1]);
+            glBufferStorage(GL_SHADER_STORAGE_BUFFER, box_count * sizeof(GLuint), NULL, 0);
+
+            hiz->Build(texture);
+            hiz->Test(buffers[0], box_count, buffers[1]);
+
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, hiz->GetBuffer());
+            glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, size * sizeof(float), &gpu_pyramid[0]);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[1]);
+            glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, box_count * sizeof(GLuint), &gpu_visible[0]);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+            for (i = 0; i < size; i++)
+                differ += memcmp(&gpu_pyramid[i], &pyramid[i], sizeof(float)) != 0;
+            for (i = 0; i < box_count; i++)
+                differ += gpu_visible[i] != visible[i];
+            failures += differ;
+
+            glDeleteBuffers(2, buffers);
+            glDeleteTextures(1, &texture);
+        }
+
+        delete hiz;
+
+        printf("%4d x %-4d %2d levels: build %7.1f us, %u boxes at %5.1f boxes/us, %u hidden, %u of them kept, %u wrong%s",
+               width, height, HiZPyramid::LevelCount(width, height), build_us, box_count, box_count / test_us,
+               hidden, kept, wrong, gpu ? "" : "\n");
+        if (gpu)
+            printf(", %u differ on the GPU\n", differ);
+    }
+
+    return report("Hi-Z pyramid", failures);
+}
+
+//----------------------------------------------------------------------------
+//
+// Scan, compaction, reduction and histogram (12-raytracer)
+//
+
+// Holds 'count' uints of 'data', or room for them, in a new storage buffer
+static GLuint create_uint_buffer(const GLuint * data, unsigned int count)
+{
+    GLuint buffer;
+
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, (count + 1) * sizeof(GLuint), NULL, GL_DYNAMIC_STORAGE_BIT);
+    if (data != NULL)
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(GLuint), data);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    return buffer;
+}
+
+// The number of the first 'count' uints of 'buffer' that differ from 'expected'
+static unsigned int gpu_mismatches(GLuint buffer, const void * expected, unsigned int count)
+{
+    std::vector<GLuint> result(count + 1);
+    unsigned int differ = 0;
+    unsigned int i;
+
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(GLuint), &result[0]);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    for (i = 0; i < count; i++)
+        differ += memcmp(&result[i], (const GLuint *)expected + i, sizeof(GLuint)) != 0;
+
+    return differ;
+}
+
+// The GPUPrimitives references on counts either side of the tile size and
+// up to a few million, against what each must produce: differences of the
+// scan giving back its input (wrapping, as the shader does), compaction
+// putting element i where the scan of the flags says, reductions that
+// match a plain sum (exactly for uints, and to within rounding for floats)
+// over more segments than one dispatch takes, and histograms with more
+// bins than fit in shared memory. With a GPU, each primitive must give
+// the reference's bits.
+static bool bench_primitives(JobSystem&)
+{
+    static const unsigned int counts[] = { 1, 1023, 1024, 1025, 100000, 3000000 };
+    const unsigned int max_count = counts[sizeof(counts) / sizeof(counts[0]) - 1];
+    const unsigned int words = 3;
+    std::vector<GLuint> input(max_count), output(max_count), flags(max_count), offsets;
+    std::vector<GLuint> elements(size_t(max_count) * words), kept(size_t(max_count) * words);
+    std::vector<GLuint> sums, bins, accumulated;
+    std::vector<float> values(max_count), float_sums;
+    unsigned int failures = 0;
+    const bool gpu = gl_available();
+    GPUPrimitives * primitives = gpu ? new GPUPrimitives : NULL;
+    unsigned int c, i, j;
+
+    if (primitives != NULL && !primitives->Initialize(max_count))
+    {
+        delete primitives;
+        primitives = NULL;
+    }
+
+    for (c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+    {
+        const unsigned int count = counts[c];
+        unsigned int wrong = 0;
+        unsigned int differ = 0;
+
+        // Large values so that the sums wrap, flags that keep about a third
+        vmath::random_fill_bits(&input[0], count, 0x70u + c, 0);
+        vmath::random_fill_bits(&flags[0], count, 0x80u + c, 0);
+        vmath::random_fill_bits(&elements[0], count * words, 0x90u + c, 0);
+        vmath::random_fill_uniform(&values[0], count, 0xa0u + c, 0, -1000.0f, 1000.0f);
+        for (i = 0; i < count; i++)
+            flags[i] = flags[i] % 3 == 0 ? flags[i] | 1 : 0;
+
+        // Scan, out of place and in place
+        bench_clock::time_point start = bench_clock::now();
+        const GLuint total = GPUPrimitives::ExclusiveScanReference(&input[0], &output[0], count);
+        const double scan_us = seconds_since(start) * 1.0e6;
+
+        wrong += output[0] != 0;
+        for (i = 0; i + 1 < count; i++)
+            wrong += output[i + 1] - output[i] != input[i];
+        wrong += total - output[count - 1] != input[count - 1];
+
+        std::vector<GLuint> in_place(input.begin(), input.begin() + count);
+
+        wrong += GPUPrimitives::ExclusiveScanReference(&in_place[0], &in_place[0], count) != total;
+        wrong += memcmp(&in_place[0], &output[0], count * sizeof(GLuint)) != 0;
+
+        // Compaction of single uints and of several, each element landing
+        // where the scan of its flag puts it
+        std::vector<GLuint> ones(count), places(count);
+
+        for (i = 0; i < count; i++)
+            ones[i] = flags[i] != 0;
+
+        const GLuint kept_count = GPUPrimitives::ExclusiveScanReference(&ones[0], &places[0], count);
+
+        start = bench_clock::now();
+        const GLuint compacted = GPUPrimitives::CompactReference(&elements[0], &flags[0], &kept[0], count, words);
+        const double compact_us = seconds_since(start) * 1.0e6;
+
+        wrong += compacted != kept_count;
+        for (i = 0; i < count; i++)
+        {
+            if (flags[i] != 0)
+                wrong += memcmp(&kept[size_t(places[i]) * words], &elements[size_t(i) * words], words * sizeof(GLuint)) != 0;
+        }
+
+        std::vector<GLuint> kept_single(count);
+
+        wrong += GPUPrimitives::CompactReference(&input[0], &flags[0], &kept_single[0], count) != kept_count;
+        for (i = 0; i < count; i++)
+        {
+            if (flags[i] != 0)
+                wrong += kept_single[places[i]] != input[i];
+        }
+
+        // Segments mostly shorter than a workgroup, some longer and some
+        // empty: over MAX_GROUPS of them for the largest count
+        offsets.assign(1, 0);
+        for (i = 0; offsets.back() < count; i++)
+        {
+            const unsigned int r = GLuint(vmath::random_uniform(0xb0u + c, i) * 16.0f);
+            const unsigned int length = r == 0 ? 0 : r == 15 ? 1 + i % 600 : 1 + i % 32;
+
+            offsets.push_back(std::min(count, offsets.back() + length));
+        }
+
+        const unsigned int segment_count = (unsigned int)offsets.size() - 1;
+
+        sums.resize(segment_count);
+        float_sums.resize(segment_count);
+
+        start = bench_clock::now();
+        GPUPrimitives::SegmentedReduceReference(&input[0], &offsets[0], segment_count, &sums[0]);
+        GPUPrimitives::SegmentedReduceReference(&values[0], &offsets[0], segment_count, &float_sums[0]);
+        const double reduce_us = seconds_since(start) * 1.0e6;
+
+        for (i = 0; i < segment_count; i++)
+        {
+            GLuint sum = 0;
+            double exact = 0.0;
+            double magnitude = 0.0;
+
+            for (j = offsets[i]; j < offsets[i + 1]; j++)
+            {
+                sum += input[j];
+                exact += values[j];
+                magnitude += fabs(values[j]);
+            }
+
+            wrong += sums[i] != sum;
+            wrong += fabs(float_sums[i] - exact) > magnitude * 1.0e-6;
+        }
+
+        // Histograms of the top bits into a few bins, and into more than
+        // SHARED_BINS but fewer than the largest values need, each counted
+        // once and then again on top
+        static const unsigned int bin_counts[] = { 16, GPUPrimitives::SHARED_BINS + 4000 };
+        static const unsigned int shifts[] = { 28, 19 };
+        double histogram_us = 0.0;
+        unsigned int h;
+
+        for (h = 0; h < 2; h++)
+        {
+            const unsigned int bin_count = bin_counts[h];
+            std::vector<GLuint> expected(bin_count, 0);
+
+            bins.assign(bin_count, 0xdeadu);
+            start = bench_clock::now();
+            GPUPrimitives::HistogramReference(&input[0], count, &bins[0], bin_count, shifts[h]);
+            histogram_us += seconds_since(start) * 1.0e6;
+
+            for (i = 0; i < count; i++)
+            {
+                if ((input[i] >> shifts[h]) < bin_count)
+                    expected[input[i] >> shifts[h]]++;
+            }
+
+            accumulated = bins;
+            GPUPrimitives::HistogramReference(&input[0], count, &accumulated[0], bin_count, shifts[h], true);
+
+            for (i = 0; i < bin_count; i++)
+                wrong += bins[i] != expected[i] || accumulated[i] != 2 * expected[i];
+        }
+
+        failures += wrong;
+
+        if (primitives != NULL)
+        {
+            const GLuint input_buffer = create_uint_buffer(&input[0], count);
+            const GLuint flag_buffer = create_uint_buffer(&flags[0], count);
+            const GLuint element_buffer = create_uint_buffer(&elements[0], count * words);
+            const GLuint value_buffer = create_uint_buffer((const GLuint *)&values[0], count);
+            const GLuint offset_buffer = create_uint_buffer(&offsets[0], segment_count + 1);
+            const GLuint output_buffer = create_uint_buffer(NULL, count * words);
+            const GLuint total_buffer = create_uint_buffer(NULL, 1);
+
+            primitives->ExclusiveScan(input_buffer, output_buffer, count, total_buffer, 0);
+            differ += gpu_mismatches(output_buffer, &output[0], count);
+            differ += gpu_mismatches(total_buffer, &total, 1);
+
+            primitives->Compact(element_buffer, flag_buffer, output_buffer, count, total_buffer, 0, words);
+            differ += gpu_mismatches(output_buffer, &kept[0], kept_count * words);
+            differ += gpu_mismatches(total_buffer, &kept_count, 1);
+
+            primitives->SegmentedReduce(input_buffer, offset_buffer, segment_count, output_buffer);
+            differ += gpu_mismatches(output_buffer, &sums[0], segment_count);
+            primitives->SegmentedReduce(value_buffer, offset_buffer, segment_count, output_buffer, PRIMITIVE_FLOAT);
+            differ += gpu_mismatches(output_buffer, &float_sums[0], segment_count);
+
+            primitives->Histogram(input_buffer, count, output_buffer, bin_counts[1], shifts[1]);
+            primitives->Histogram(input_buffer, count, output_buffer, bin_counts[1], shifts[1], true);
+            differ += gpu_mismatches(output_buffer, &accumulated[0], bin_counts[1]);
+
+            const GLuint buffers[] = { input_buffer, flag_buffer, element_buffer, value_buffer,
+                                       offset_buffer, output_buffer, total_buffer };
+
+            glDeleteBuffers(sizeof(buffers) / sizeof(buffers[0]), buffers);
+            failures += differ;
+        }
+
+        printf("%7u elements, %6u segments: scan %7.1f, compact %7.1f, reduce %7.1f, histogram %7.1f elements/us, %u wrong%s",
+               count, segment_count, count / scan_us, count / compact_us, 2 * count / reduce_us,
+               2 * count / histogram_us, wrong, primitives != NULL ? "" : "\n");
+        if (primitives != NULL)
+            printf(", %u differ on the GPU\n", differ);
+    }
+
+    delete primitives;
+
+    return report("scan, compaction, reduction and histogram", failures);
+}
+
+//----------------------------------------------------------------------------
+//
+// Shadow cascades (04-shadowmap)
+//
+
+// m * (x, y, z, 1) in double
+static vmath::dvec4 transform_point(const vmath::dmat4& m, const vmath::vec3& p)
+{
+    vmath::dvec4 result;
+    int i;
+
+    for (i = 0; i < 4; i++)
+        result[i] = m[0][i] * p[0] + m[1][i] * p[1] + m[2][i] * p[2] + m[3][i];
+
+    return result;
+}
+
+// Whether 'texels' is further from a whole number than float rounding of
+// a position 'size' texels from the origin would take it
+static bool off_texel(double texels, double size)
+{
+    return fabs(texels - floor(texels + 0.5)) > 1.0e-2 + fabs(size) * 4.0e-7;
+}
+
+// The checks that 04-shadowmap's cascades rely on. The splits must rise
+// from n to f for any blend. Slice corners, projected again by the camera
+// that made them, must land on the corners of the screen at the slice's
+// distances, inside the radius returned. And each cascade's projection
+// must keep its size as the camera moves, with the world's origin on a
+// texel corner, so that moving less than a texel changes it by at most a
+// texel and usually not at all. Errors are relative to the distance from
+// the origin, which is all that float positions can manage.
+static bool bench_shadow(JobSystem&)
+{
+    static const float ranges[][2] = { { 1.0f, 2000.0f }, { 0.1f, 100.0f }, { 0.5f, 50000.0f } };
+    static const float lambdas[] = { 0.0f, 0.5f, 0.75f, 1.0f };
+    static const float ndc[4][2] = { { -1.0f, -1.0f }, { 1.0f, -1.0f }, { 1.0f, 1.0f }, { -1.0f, 1.0f } };
+    const unsigned int max_count = 8;
+    const unsigned int cameras = 200;
+    const unsigned int steps = 64;
+    const unsigned int cascades = 4;
+    const unsigned int resolution = 2048;
+    const vmath::vec3 up(0.0f, 1.0f, 0.0f);
+    const vmath::mat4 light_view = vmath::lookat(vmath::vec3(0.3f, 1.0f, 0.4f), vmath::vec3(0.0f), up);
+    float splits[max_count + 1];
+    unsigned int split_failures = 0;
+    unsigned int corner_failures = 0;
+    unsigned int snap_failures = 0;
+    unsigned int moves = 0;
+    unsigned int frames = 0;
+    double corner_error = 0.0;
+    double frame_us = 0.0;
+    unsigned int r, l, count, cam, i, c, s;
+
+    for (r = 0; r < sizeof(ranges) / sizeof(ranges[0]); r++)
+    {
+        const float n = ranges[r][0];
+        const float f = ranges[r][1];
+
+        for (l = 0; l < sizeof(lambdas) / sizeof(lambdas[0]); l++)
+        {
+            for (count = 1; count <= max_count; count++)
+            {
+                vmath::cascadeSplits(n, f, count, lambdas[l], splits);
+
+                split_failures += splits[0] != n || splits[count] != f;
+                for (i = 0; i < count; i++)
+                    split_failures += !(splits[i + 1] > splits[i]);
+            }
+        }
+    }
+
+    for (cam = 0; cam < cameras; cam++)
+    {
+        const unsigned int key = 0xc0u + cam;
+        const vmath::vec3 eye(vmath::random_uniform(key, 0) * 2000.0f - 1000.0f,
+                              vmath::random_uniform(key, 1) * 300.0f,
+                              vmath::random_uniform(key, 2) * 2000.0f - 1000.0f);
+        const vmath::vec3 target(vmath::random_uniform(key, 3) * 200.0f - 100.0f,
+                                 vmath::random_uniform(key, 4) * 100.0f - 50.0f,
+                                 vmath::random_uniform(key, 5) * 200.0f - 100.0f);
+        const float aspect = 0.5f + vmath::random_uniform(key, 6);
+        const float n = ranges[cam % 3][0];
+        const float f = ranges[cam % 3][1];
+
+        // Symmetric and off-center projections
+        const vmath::mat4 projection = cam & 1 ? vmath::perspective(30.0f + 60.0f * vmath::random_uniform(key, 7), aspect, n, f)
+                                               : vmath::frustum(-0.8f * aspect, 1.2f * aspect, -0.6f, 1.0f, n, f);
+        const vmath::dmat4 camera = to_double(projection) * to_double(vmath::lookat(eye, target, up));
+        const vmath::vec3 direction = vmath::normalize(vmath::vec3(vmath::random_uniform(key, 8) - 0.5f,
+                                                                   vmath::random_uniform(key, 9) - 0.5f,
+                                                                   vmath::random_uniform(key, 10) - 0.5f));
+        vmath::mat4 first[cascades], previous[cascades];
+        float texel[cascades];
+
+        vmath::cascadeSplits(n, f, cascades, 0.75f, splits);
+
+        // The camera steps an eighth of the nearest cascade's texel at a
+        // time, which the first frame gives
+        for (s = 0; s < steps; s++)
+        {
+            const vmath::vec3 offset = s == 0 ? vmath::vec3(0.0f) : direction * (float(s) * 0.125f * texel[0]);
+            const vmath::mat4 view = vmath::lookat(eye + offset, target + offset, up);
+            vmath::vec3 corners[cascades][8];
+            vmath::mat4 cascade[cascades];
+            float radius[cascades];
+
+            bench_clock::time_point start = bench_clock::now();
+
+            for (c = 0; c < cascades; c++)
+            {
+                radius[c] = vmath::frustumSliceCorners(view, projection, splits[c], splits[c + 1], corners[c]);
+                cascade[c] = vmath::cascadeProjection(corners[c], radius[c], light_view, resolution, 1000.0f);
+            }
+
+            frame_us += seconds_since(start) * 1.0e6;
+
+            for (c = 0; c < cascades; c++)
+            {
+                const vmath::mat4& m = cascade[c];
+
+                if (s == 0)
+                {
+                    vmath::vec3 center(0.0f);
+
+                    for (i = 0; i < 8; i++)
+                        center += corners[c][i] / 8.0f;
+
+                    for (i = 0; i < 8; i++)
+                    {
+                        const vmath::dvec4 clip = transform_point(camera, corners[c][i]);
+                        const double d = i < 4 ? splits[c] : splits[c + 1];
+                        const double scale = vmath::length(eye) + d;
+
+                        // Back in view space, in world units
+                        corner_error = std::max(corner_error, fabs(clip[3] - d) / scale);
+                        corner_error = std::max(corner_error, fabs(clip[0] / clip[3] - ndc[i & 3][0]) * d / projection[0][0] / scale);
+                        corner_error = std::max(corner_error, fabs(clip[1] / clip[3] - ndc[i & 3][1]) * d / projection[1][1] / scale);
+                        corner_failures += vmath::length(corners[c][i] - center) > radius[c] + 1.0e-5 * scale;
+                    }
+
+                    first[c] = m;
+                    texel[c] = 2.0f / (m[0][0] * float(resolution));
+                }
+                else
+                {
+                    // The same size, and where it moves, by a whole texel
+                    // and no more
+                    const double dx = (double(m[3][0]) - previous[c][3][0]) * resolution * 0.5;
+                    const double dy = (double(m[3][1]) - previous[c][3][1]) * resolution * 0.5;
+
+                    snap_failures += m[0][0] != first[c][0][0] || m[1][1] != first[c][1][1];
+                    snap_failures += off_texel(dx, m[3][0] * resolution) || fabs(dx) > 1.1;
+                    snap_failures += off_texel(dy, m[3][1] * resolution) || fabs(dy) > 1.1;
+                    moves += dx != 0.0 || dy != 0.0;
+                    frames++;
+                }
+
+                // The world's origin on a texel corner
+                const double ox = m[3][0] * resolution * 0.5;
+                const double oy = m[3][1] * resolution * 0.5;
+
+                snap_failures += off_texel(ox, ox) || off_texel(oy, oy);
+                previous[c] = m;
+            }
+        }
+    }
+
+    // An eighth of a texel per step moves the bounds on at most one step in
+    // eight for each axis
+    corner_failures += corner_error > 1.0e-5;
+    snap_failures += moves > frames / 4;
+
+    printf("%u cameras, %u steps: %.2f us a frame for %u cascades, corners within %.2g, bounds moved on %u of %u steps\n",
+           cameras, steps, frame_us / (cameras * steps), cascades, corner_error, moves, frames);
+
+    const bool splits_passed = report("Cascade splits", split_failures);
+    const bool corners_passed = report("Slice corners", corner_failures);
+
+    return report("Texel snapping", snap_failures) && splits_passed && corners_passed;
+}
+
+//----------------------------------------------------------------------------
+//
+// Skeletal animation (05-skinning)
+//
+
+static const char tentacle_file[] = "media/tentacle.vbm";
+
+// Writes media/tentacle.vbm as vbmexport would export the tentacle from a
+// scene: a tapering tube 8 units long around a chain of 12 joints up the y
+// axis, in unindexed triangles moved so that its bounding box is centered
+// on the origin. Its one clip, "take", has a key every frame at 24 frames a
+// second for 2 s, and bends the chain back and forth about an axis that
+// turns slowly, sending ripples up it. Each ring of vertices is fully on a
+// joint in the middle of its segment and blends into the next across the
+// joint between them. As in the exporter, influences are sorted heaviest
+// first; those with no weight are left out.
+static bool write_tentacle(const char * filename)
+{
+    enum
+    {
+        JOINT_COUNT         = 12,
+        RING_COUNT          = 49,
+        RING_SEGMENTS       = 16,
+        KEY_COUNT           = 49,
+        VERTEX_COUNT        = (RING_COUNT - 1) * RING_SEGMENTS * 6
+    };
+    const float length = 8.0f;
+    const float segment = length / float(JOINT_COUNT);
+    VBM_HEADER header;
+    VBM_ATTRIB_HEADER attrib_headers[4];
+    VBM_FRAME_HEADER frame_header;
+    VBM_SKELETON_HEADER skeleton_header;
+    VBM_JOINT joints[JOINT_COUNT];
+    VBM_CLIP_HEADER clip_header;
+    std::vector<VBM_JOINT_POSE> keys(KEY_COUNT * JOINT_COUNT);
+    std::vector<VBM_VEC4F> ring_positions(RING_COUNT * RING_SEGMENTS);
+    std::vector<VBM_VEC3F> ring_normals(RING_COUNT * RING_SEGMENTS);
+    std::vector<VBM_VEC4F> ring_joints(RING_COUNT), ring_weights(RING_COUNT);
+    std::vector<VBM_VEC4F> positions, joint_indices, joint_weights;
+    std::vector<VBM_VEC3F> normals;
+    float radius_squared = 0.0f;
+    int i, j, k;
+
+    // The tube, ring by ring
+    for (i = 0; i < RING_COUNT; i++)
+    {
+        const float y = length * float(i) / float(RING_COUNT - 1);
+        const float radius = 0.5f * (1.0f - 0.8f * y / length);
+        const float t = y / segment - 0.5f;
+        int joint = (int)floorf(t);
+        float blend = t - float(joint);
+        float * index = &ring_joints[i].x;
+        float * weight = &ring_weights[i].x;
+
+        if (joint < 0)
+        {
+            joint = 0;
+            blend = 0.0f;
+        }
+        if (joint >= JOINT_COUNT - 1)
+        {
+            joint = JOINT_COUNT - 1;
+            blend = 0.0f;
+        }
+
+        // Heaviest first, and the lower joint first when they're equal
+        memset(index, 0, sizeof(VBM_VEC4F));
+        memset(weight, 0, sizeof(VBM_VEC4F));
+        k = 0;
+        if (blend > 0.5f)
+        {
+            index[k] = float(joint + 1);
+            weight[k++] = blend;
+        }
+        if (blend < 1.0f)
+        {
+            index[k] = float(joint);
+            weight[k++] = 1.0f - blend;
+        }
+        if (blend > 0.0f && blend <= 0.5f)
+        {
+            index[k] = float(joint + 1);
+            weight[k++] = blend;
+        }
+
+        for (j = 0; j < RING_SEGMENTS; j++)
+        {
+            const float theta = 6.2831853f * float(j) / float(RING_SEGMENTS);
+            VBM_VEC4F& p = ring_positions[i * RING_SEGMENTS + j];
+            VBM_VEC3F& n = ring_normals[i * RING_SEGMENTS + j];
+
+            p.x = cosf(theta) * radius;
+            p.y = y;
+            p.z = sinf(theta) * radius;
+            p.w = 1.0f;
+            n.x = cosf(theta);
+            n.y = 0.0f;
+            n.z = sinf(theta);
+        }
+    }
+
+    // Two triangles for each quad between rings, unindexed
+    for (i = 0; i < RING_COUNT - 1; i++)
+    {
+        for (j = 0; j < RING_SEGMENTS; j++)
+        {
+            const int a = i * RING_SEGMENTS + j;
+            const int b = i * RING_SEGMENTS + (j + 1) % RING_SEGMENTS;
+            const int corners[6] = { a, a + RING_SEGMENTS, b, b, a + RING_SEGMENTS, b + RING_SEGMENTS };
+
+            for (k = 0; k < 6; k++)
+            {
+                positions.push_back(ring_positions[corners[k]]);
+                normals.push_back(ring_normals[corners[k]]);
+                joint_indices.push_back(ring_joints[corners[k] / RING_SEGMENTS]);
+                joint_weights.push_back(ring_weights[corners[k] / RING_SEGMENTS]);
+            }
+        }
+    }
+
+    // Centered on its bounding box, as the exporter does
+    VBM_VEC3F box_min = { positions[0].x, positions[0].y, positions[0].z };
+    VBM_VEC3F box_max = box_min;
+
+    for (i = 1; i < VERTEX_COUNT; i++)
+    {
+        box_min.x = std::min(box_min.x, positions[i].x);
+        box_min.y = std::min(box_min.y, positions[i].y);
+        box_min.z = std::min(box_min.z, positions[i].z);
+        box_max.x = std::max(box_max.x, positions[i].x);
+        box_max.y = std::max(box_max.y, positions[i].y);
+        box_max.z = std::max(box_max.z, positions[i].z);
+    }
+
+    const vmath::vec3 center((box_max.x + box_min.x) * 0.5f,
+                             (box_max.y + box_min.y) * 0.5f,
+                             (box_max.z + box_min.z) * 0.5f);
+
+    for (i = 0; i < VERTEX_COUNT; i++)
+    {
+        positions[i].x -= center[0];
+        positions[i].y -= center[1];
+        positions[i].z -= center[2];
+        radius_squared = std::max(radius_squared, positions[i].x * positions[i].x +
+                                                  positions[i].y * positions[i].y +
+                                                  positions[i].z * positions[i].z);
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = VBM_MAGIC_CURRENT;
+    header.size = sizeof(header);
+    sprintf(header.name, "model");
+    header.num_attribs = 4;
+    header.num_frames = 1;
+    header.num_vertices = VERTEX_COUNT;
+    header.flags = VBM_FLAG_HAS_BOUNDS | VBM_FLAG_HAS_SKELETON;
+    header.bounds.min.x = box_min.x - center[0];
+    header.bounds.min.y = box_min.y - center[1];
+    header.bounds.min.z = box_min.z - center[2];
+    header.bounds.max.x = box_max.x - center[0];
+    header.bounds.max.y = box_max.y - center[1];
+    header.bounds.max.z = box_max.z - center[2];
+    header.bounds.radius = sqrtf(radius_squared);
+
+    static const char * const attrib_names[4] = { "position", "normal", "joints", "weights" };
+
+    memset(attrib_headers, 0, sizeof(attrib_headers));
+    for (i = 0; i < 4; i++)
+    {
+        strcpy(attrib_headers[i].name, attrib_names[i]);
+        attrib_headers[i].type = GL_FLOAT;
+        attrib_headers[i].components = i == 1 ? 3 : 4;
+    }
+
+    frame_header.first = 0;
+    frame_header.count = VERTEX_COUNT;
+    frame_header.flags = 0;
+
+    // A chain of joints, each a segment above its parent. The root and the
+    // inverse bind matrices move with the mesh.
+    memset(joints, 0, sizeof(joints));
+    for (i = 0; i < JOINT_COUNT; i++)
+    {
+        const vmath::mat4 inverse_bind = vmath::translate(0.0f, -segment * float(i), 0.0f) * vmath::translate(center);
+
+        sprintf(joints[i].name, "joint%d", i + 1);
+        joints[i].parent = i - 1;
+        joints[i].bind_pose.rotation.w = 1.0f;
+        joints[i].bind_pose.translation.y = i == 0 ? 0.0f : segment;
+        joints[i].bind_pose.scale.x = joints[i].bind_pose.scale.y = joints[i].bind_pose.scale.z = 1.0f;
+        if (i == 0)
+        {
+            joints[i].bind_pose.translation.x -= center[0];
+            joints[i].bind_pose.translation.y -= center[1];
+            joints[i].bind_pose.translation.z -= center[2];
+        }
+        memcpy(joints[i].inverse_bind, (const float *)inverse_bind, sizeof(joints[i].inverse_bind));
+    }
+
+    for (k = 0; k < KEY_COUNT; k++)
+    {
+        const float phase = 6.2831853f * float(k) / float(KEY_COUNT - 1);
+        const vmath::vec3 axis = vmath::normalize(vmath::vec3(cosf(phase), 0.0f, sinf(phase)));
+
+        for (i = 0; i < JOINT_COUNT; i++)
+        {
+            VBM_JOINT_POSE& key = keys[k * JOINT_COUNT + i];
+            const float angle = 0.35f * sinf(phase * 2.0f - float(i) * 0.6f);
+
+            key = joints[i].bind_pose;
+            key.rotation.x = axis[0] * sinf(angle * 0.5f);
+            key.rotation.y = axis[1] * sinf(angle * 0.5f);
+            key.rotation.z = axis[2] * sinf(angle * 0.5f);
+            key.rotation.w = cosf(angle * 0.5f);
+        }
+    }
+
+    skeleton_header.num_joints = JOINT_COUNT;
+    skeleton_header.num_clips = 1;
+    memset(&clip_header, 0, sizeof(clip_header));
+    sprintf(clip_header.name, "take");
+    clip_header.num_keys = KEY_COUNT;
+    clip_header.duration = float(KEY_COUNT - 1) / 24.0f;
+
+    FILE * f = fopen(filename, "wb");
+
+    if (f == NULL)
+        return false;
+
+    fwrite(&header, sizeof(header), 1, f);
+    fwrite(attrib_headers, sizeof(VBM_ATTRIB_HEADER), 4, f);
+    fwrite(&frame_header, sizeof(frame_header), 1, f);
+    fwrite(&header.bounds, sizeof(header.bounds), 1, f);
+    fwrite(&skeleton_header, sizeof(skeleton_header), 1, f);
+    fwrite(joints, sizeof(VBM_JOINT), JOINT_COUNT, f);
+    fwrite(&clip_header, sizeof(clip_header), 1, f);
+    fwrite(&keys[0], sizeof(VBM_JOINT_POSE), keys.size(), f);
+    fwrite(&positions[0], sizeof(VBM_VEC4F), VERTEX_COUNT, f);
+    fwrite(&normals[0], sizeof(VBM_VEC3F), VERTEX_COUNT, f);
+    fwrite(&joint_indices[0], sizeof(VBM_VEC4F), VERTEX_COUNT, f);
+    fwrite(&joint_weights[0], sizeof(VBM_VEC4F), VERTEX_COUNT, f);
+
+    return fclose(f) == 0;
+}
+
+// A joint pose in double
+struct ReferencePose
+{
+    double rotation[4];
+    double translation[3];
+    double scale[3];
+};
+
+static ReferencePose to_double(const VBM_JOINT_POSE& pose)
+{
+    const ReferencePose result =
+    {
+        { pose.rotation.x, pose.rotation.y, pose.rotation.z, pose.rotation.w },
+        { pose.translation.x, pose.translation.y, pose.translation.z },
+        { pose.scale.x, pose.scale.y, pose.scale.z }
+    };
+
+    return result;
+}
+
+// The keys of 'clip' either side of 'time', interpolated the short way
+// round; by slerp at any angle if asked
+static void reference_sample(const VBObject& object, unsigned int clip, double time, bool slerp,
+                             std::vector<ReferencePose>& local)
+{
+    const VBM_CLIP_HEADER& header = object.GetClip(clip);
+    const unsigned int joint_count = object.GetJointCount();
+    const double position = time / header.duration * double(header.num_keys - 1);
+    const unsigned int key = std::min((unsigned int)position, header.num_keys - 2);
+    const double t = position - double(key);
+    const VBM_JOINT_POSE * keys = object.GetClipKeys(clip) + key * joint_count;
+    unsigned int i;
+    int k;
+
+    local.resize(joint_count);
+    for (i = 0; i < joint_count; i++)
+    {
+        const ReferencePose a = to_double(keys[i]);
+        const ReferencePose b = to_double(keys[i + joint_count]);
+        const double d = a.rotation[0] * b.rotation[0] + a.rotation[1] * b.rotation[1] +
+                         a.rotation[2] * b.rotation[2] + a.rotation[3] * b.rotation[3];
+        const double sign = d < 0.0 ? -1.0 : 1.0;
+        const double theta = acos(std::min(fabs(d), 1.0));
+        double w0 = 1.0 - t;
+        double w1 = t;
+        double length = 0.0;
+
+        if (slerp && theta > 1.0e-6)
+        {
+            w0 = sin((1.0 - t) * theta) / sin(theta);
+            w1 = sin(t * theta) / sin(theta);
+        }
+
+        for (k = 0; k < 4; k++)
+        {
+            local[i].rotation[k] = a.rotation[k] * w0 + b.rotation[k] * sign * w1;
+            length += local[i].rotation[k] * local[i].rotation[k];
+        }
+        for (k = 0; k < 4; k++)
+            local[i].rotation[k] /= sqrt(length);
+        for (k = 0; k < 3; k++)
+        {
+            local[i].translation[k] = a.translation[k] + t * (b.translation[k] - a.translation[k]);
+            local[i].scale[k] = a.scale[k] + t * (b.scale[k] - a.scale[k]);
+        }
+    }
+}
+
+// Each joint's model space transform times its inverse bind matrix
+static void reference_palette(const VBObject& object, const std::vector<ReferencePose>& local,
+                              std::vector<vmath::dmat4>& palette)
+{
+    const unsigned int joint_count = object.GetJointCount();
+    const VBM_JOINT * joints = object.GetJoints();
+    std::vector<vmath::dmat4> model(joint_count);
+    unsigned int i;
+    int j;
+
+    palette.resize(joint_count);
+    for (i = 0; i < joint_count; i++)
+    {
+        const double * q = local[i].rotation;
+        const double * s = local[i].scale;
+        vmath::dmat4 m;
+        vmath::dmat4 inverse_bind;
+
+        m[0] = vmath::dvec4((1.0 - 2.0 * (q[1] * q[1] + q[2] * q[2])) * s[0], 2.0 * (q[0] * q[1] + q[3] * q[2]) * s[0], 2.0 * (q[0] * q[2] - q[3] * q[1]) * s[0], 0.0);
+        m[1] = vmath::dvec4(2.0 * (q[0] * q[1] - q[3] * q[2]) * s[1], (1.0 - 2.0 * (q[0] * q[0] + q[2] * q[2])) * s[1], 2.0 * (q[1] * q[2] + q[3] * q[0]) * s[1], 0.0);
+        m[2] = vmath::dvec4(2.0 * (q[0] * q[2] + q[3] * q[1]) * s[2], 2.0 * (q[1] * q[2] - q[3] * q[0]) * s[2], (1.0 - 2.0 * (q[0] * q[0] + q[1] * q[1])) * s[2], 0.0);
+        m[3] = vmath::dvec4(local[i].translation[0], local[i].translation[1], local[i].translation[2], 1.0);
+
+        for (j = 0; j < 16; j++)
+            inverse_bind[j / 4][j % 4] = joints[i].inverse_bind[j];
+
+        model[i] = joints[i].parent < 0 ? m : model[joints[i].parent] * m;
+        palette[i] = model[i] * inverse_bind;
+    }
+}
+
+// The rotation of a rigid transform as a quaternion and the dual part that
+// carries its translation, dual = (t, 0) * real / 2
+static void reference_dual_quaternion(const vmath::dmat4& m, double real[4], double dual[4])
+{
+    const double trace = m[0][0] + m[1][1] + m[2][2];
+    const double * t = &m[3][0];
+
+    // Divide by the largest of the four candidates
+    if (trace > 0.0)
+    {
+        const double s = sqrt(trace + 1.0) * 2.0;
+        real[0] = (m[1][2] - m[2][1]) / s;
+        real[1] = (m[2][0] - m[0][2]) / s;
+        real[2] = (m[0][1] - m[1][0]) / s;
+        real[3] = 0.25 * s;
+    }
+    else if (m[0][0] > m[1][1] && m[0][0] > m[2][2])
+    {
+        const double s = sqrt(1.0 + m[0][0] - m[1][1] - m[2][2]) * 2.0;
+        real[0] = 0.25 * s;
+        real[1] = (m[1][0] + m[0][1]) / s;
+        real[2] = (m[2][0] + m[0][2]) / s;
+        real[3] = (m[1][2] - m[2][1]) / s;
+    }
+    else if (m[1][1] > m[2][2])
+    {
+        const double s = sqrt(1.0 + m[1][1] - m[0][0] - m[2][2]) * 2.0;
+        real[0] = (m[1][0] + m[0][1]) / s;
+        real[1] = 0.25 * s;
+        real[2] = (m[2][1] + m[1][2]) / s;
+        real[3] = (m[2][0] - m[0][2]) / s;
+    }
+    else
+    {
+        const double s = sqrt(1.0 + m[2][2] - m[0][0] - m[1][1]) * 2.0;
+        real[0] = (m[2][0] + m[0][2]) / s;
+        real[1] = (m[2][1] + m[1][2]) / s;
+        real[2] = 0.25 * s;
+        real[3] = (m[0][1] - m[1][0]) / s;
+    }
+
+    dual[0] = 0.5 * (real[3] * t[0] + t[1] * real[2] - t[2] * real[1]);
+    dual[1] = 0.5 * (real[3] * t[1] + t[2] * real[0] - t[0] * real[2]);
+    dual[2] = 0.5 * (real[3] * t[2] + t[0] * real[1] - t[1] * real[0]);
+    dual[3] = -0.5 * (t[0] * real[0] + t[1] * real[1] + t[2] * real[2]);
+}
+
+// p + 2 r x (r x p + w p), the rotation of p by the unit quaternion r
+static void rotate(const double r[4], const double p[3], double out[3])
+{
+    const double a[3] = { r[1] * p[2] - r[2] * p[1] + r[3] * p[0],
+                          r[2] * p[0] - r[0] * p[2] + r[3] * p[1],
+                          r[0] * p[1] - r[1] * p[0] + r[3] * p[2] };
+
+    out[0] = p[0] + 2.0 * (r[1] * a[2] - r[2] * a[1]);
+    out[1] = p[1] + 2.0 * (r[2] * a[0] - r[0] * a[2]);
+    out[2] = p[2] + 2.0 * (r[0] * a[1] - r[1] * a[0]);
+}
+
+// Skins every vertex of 'mesh' in double from 'palette' both ways, and
+// returns the largest distances of SkinLinear's and SkinDualQuaternion's
+// positions and normals from them
+static void check_skinning(const SkinnedMesh& mesh, const std::vector<vmath::dmat4>& palette,
+                           const vmath::vec4 * linear, const vmath::vec4 * dual_quaternion,
+                           double& position_error, double& normal_error)
+{
+    const unsigned int joint_count = (unsigned int)palette.size();
+    std::vector<double> reals(joint_count * 4);
+    std::vector<double> duals(joint_count * 4);
+    unsigned int i;
+    int j, k;
+
+    for (i = 0; i < joint_count; i++)
+        reference_dual_quaternion(palette[i], &reals[i * 4], &duals[i * 4]);
+
+    for (i = 0; i < mesh.vertex_count; i++)
+    {
+        const float * p = mesh.positions + i * mesh.position_components;
+        const float * n = mesh.normals + i * 3;
+        const double position[3] = { p[0], p[1], p[2] };
+        const double normal[3] = { n[0], n[1], n[2] };
+        const double * pivot = &reals[int(mesh.joints[i * 4]) * 4];
+        double blended[6] = { 0.0 };
+        double real[4] = { 0.0 };
+        double dual[4] = { 0.0 };
+
+        // Linear: blend the transformed vertex
+        for (j = 0; j < 4; j++)
+        {
+            const unsigned int joint = (unsigned int)mesh.joints[i * 4 + j];
+            const vmath::dmat4& m = palette[joint];
+            double w = mesh.weights[i * 4 + j];
+
+            for (k = 0; k < 3; k++)
+            {
+                blended[k] += w * (m[0][k] * position[0] + m[1][k] * position[1] + m[2][k] * position[2] + m[3][k]);
+                blended[k + 3] += w * (m[0][k] * normal[0] + m[1][k] * normal[1] + m[2][k] * normal[2]);
+            }
+
+            // Dual quaternion: blend in the first joint's hemisphere
+            const double * r = &reals[joint * 4];
+
+            if (r[0] * pivot[0] + r[1] * pivot[1] + r[2] * pivot[2] + r[3] * pivot[3] < 0.0)
+                w = -w;
+            for (k = 0; k < 4; k++)
+            {
+                real[k] += w * r[k];
+                dual[k] += w * duals[joint * 4 + k];
+            }
+        }
+
+        for (k = 0; k < 3; k++)
+        {
+            position_error = std::max(position_error, fabs(double(linear[i * 2][k]) - blended[k]));
+            normal_error = std::max(normal_error, fabs(double(linear[i * 2 + 1][k]) - blended[k + 3]));
+        }
+
+        const double length = sqrt(real[0] * real[0] + real[1] * real[1] + real[2] * real[2] + real[3] * real[3]);
+
+        for (k = 0; k < 4; k++)
+        {
+            real[k] /= length;
+            dual[k] /= length;
+        }
+
+        const double translation[3] = { 2.0 * (real[3] * dual[0] - dual[3] * real[0] + real[1] * dual[2] - real[2] * dual[1]),
+                                        2.0 * (real[3] * dual[1] - dual[3] * real[1] + real[2] * dual[0] - real[0] * dual[2]),
+                                        2.0 * (real[3] * dual[2] - dual[3] * real[2] + real[0] * dual[1] - real[1] * dual[0]) };
+
+        rotate(real, position, blended);
+        rotate(real, normal, blended + 3);
+
+        for (k = 0; k < 3; k++)
+        {
+            position_error = std::max(position_error, fabs(double(dual_quaternion[i * 2][k]) - blended[k] - translation[k]));
+            normal_error = std::max(normal_error, fabs(double(dual_quaternion[i * 2 + 1][k]) - blended[k + 3]));
+        }
+    }
+}
+
+// Loads the tentacle that 05-skinning animates, which write_tentacle made
+// in the form vbmexport writes skinned meshes, and checks what was loaded. Then the bind pose
+// and samples of its clip, with nlerp and slerp, are skinned by both
+// methods and checked against the same done in double: the sampled poses,
+// the palettes, the dual quaternions and the skinned positions and
+// normals. Last, a crowd is animated on the job system to time the
+// characters evaluated, or evaluated and skinned, per millisecond; each
+// character must come out as it does animated alone.
+static bool bench_skinning(JobSystem& jobs)
+{
+    const unsigned int characters = 2304;
+    const unsigned int samples = 64;
+    VBObject object;
+    Skeleton skeleton;
+    SkinnedMesh mesh;
+    CrowdAnimator animator;
+    std::vector<ReferencePose> reference_local;
+    std::vector<vmath::dmat4> reference;
+    std::vector<JointPose> local;
+    std::vector<vmath::mat4> palette;
+    std::vector<DualQuaternion> dual_quaternions;
+    std::vector<vmath::vec4> linear, dual;
+    std::vector<CharacterState> states(characters);
+    double pose_error = 0.0;
+    double palette_error = 0.0;
+    double dual_quaternion_error = 0.0;
+    double position_error = 0.0;
+    double normal_error = 0.0;
+    unsigned int load_failures = 0;
+    unsigned int crowd_failures = 0;
+    unsigned int i, j, s;
+    int k, m;
+
+    if (write_references)
+    {
+        const bool written = write_tentacle(tentacle_file);
+
+        printf("%s %s\n", written ? "Wrote" : "Can't write", tentacle_file);
+        if (!written)
+            return false;
+    }
+
+    if (!object.LoadFromVBM(tentacle_file, 0, 1, 2, VBM_LOAD_CPU_ONLY))
+    {
+        printf("Can't load %s; vbench -write skinning makes it\n", tentacle_file);
+        return false;
+    }
+
+    // The skeleton, its clip and the skin weights, as loaded
+    const unsigned int joint_count = object.GetJointCount();
+
+    load_failures += joint_count == 0 || object.GetClipCount() == 0;
+    load_failures += !skeleton.Initialize(object) || !mesh.FromVBM(object) || mesh.normals == NULL;
+    if (load_failures != 0)
+        return report("Skinned VBM", load_failures);
+
+    for (i = 0; i < joint_count; i++)
+        load_failures += object.GetJoints()[i].parent >= int(i);
+    for (i = 0; i < object.GetClipCount(); i++)
+        load_failures += object.GetClip(i).num_keys < 2 || object.GetClip(i).duration <= 0.0f;
+    for (i = 0; i < mesh.vertex_count; i++)
+    {
+        float total = 0.0f;
+
+        for (k = 0; k < 4; k++)
+        {
+            load_failures += mesh.joints[i * 4 + k] < 0.0f || mesh.joints[i * 4 + k] >= float(joint_count);
+            total += mesh.weights[i * 4 + k];
+        }
+        load_failures += fabsf(total - 1.0f) > 1.0e-5f;
+    }
+
+    printf("%s: %u vertices, %u joints, clip \"%s\" of %u keys over %.2f s\n",
+           tentacle_file, mesh.vertex_count, joint_count, object.GetClip(0).name, object.GetClip(0).num_keys, object.GetClip(0).duration);
+
+    const bool loaded = report("Skinned VBM", load_failures);
+
+    local.resize(joint_count);
+    palette.resize(joint_count);
+    dual_quaternions.resize(joint_count);
+    linear.resize(mesh.vertex_count * 2);
+    dual.resize(mesh.vertex_count * 2);
+
+    // The bind pose first, then samples of the clip
+    for (s = 0; s <= samples * 2; s++)
+    {
+        const bool slerp = s > samples;
+        const float time = object.GetClip(0).duration * float(s % samples) / float(samples) +
+                           vmath::random_uniform(0x5C1Au, s) * object.GetClip(0).duration / float(samples);
+
+        if (s == 0)
+        {
+            skeleton.GetBindPose(&local[0]);
+            reference_local.resize(joint_count);
+            for (i = 0; i < joint_count; i++)
+                reference_local[i] = to_double(object.GetJoints()[i].bind_pose);
+        }
+        else
+        {
+            skeleton.Sample(0, time, &local[0], slerp ? SKELETON_SLERP : SKELETON_NLERP);
+            reference_sample(object, 0, time, slerp, reference_local);
+        }
+
+        for (i = 0; i < joint_count; i++)
+        {
+            for (k = 0; k < 4; k++)
+                pose_error = std::max(pose_error, fabs(local[i].rotation[k] - reference_local[i].rotation[k]));
+            for (k = 0; k < 3; k++)
+            {
+                pose_error = std::max(pose_error, fabs(local[i].translation[k] - reference_local[i].translation[k]));
+                pose_error = std::max(pose_error, fabs(local[i].scale[k] - reference_local[i].scale[k]));
+            }
+        }
+
+        skeleton.ComputeSkinningMatrices(&local[0], &palette[0]);
+        Skeleton::ToDualQuaternions(&palette[0], &dual_quaternions[0], joint_count);
+        reference_palette(object, reference_local, reference);
+
+        for (i = 0; i < joint_count; i++)
+        {
+            double real[4], dual_part[4];
+            double same = 0.0, opposite = 0.0;
+
+            palette_error = std::max(palette_error, relative_error(palette[i], reference[i]));
+
+            // q and -q are the same rotation
+            reference_dual_quaternion(reference[i], real, dual_part);
+            for (k = 0; k < 4; k++)
+            {
+                same = std::max(same, std::max(fabs(dual_quaternions[i].real[k] - real[k]), fabs(dual_quaternions[i].dual[k] - dual_part[k])));
+                opposite = std::max(opposite, std::max(fabs(dual_quaternions[i].real[k] + real[k]), fabs(dual_quaternions[i].dual[k] + dual_part[k])));
+            }
+            dual_quaternion_error = std::max(dual_quaternion_error, std::min(same, opposite));
+        }
+
+        SkinLinear(mesh, &palette[0], &linear[0]);
+        SkinDualQuaternion(mesh, &dual_quaternions[0], &dual[0]);
+        check_skinning(mesh, reference, &linear[0], &dual[0], position_error, normal_error);
+
+        // Bound, both methods give back the mesh
+        if (s == 0)
+        {
+            for (i = 0; i < mesh.vertex_count; i++)
+            {
+                for (k = 0; k < 3; k++)
+                {
+                    position_error = std::max(position_error, (double)fabsf(linear[i * 2][k] - mesh.positions[i * mesh.position_components + k]));
+                    position_error = std::max(position_error, (double)fabsf(dual[i * 2][k] - mesh.positions[i * mesh.position_components + k]));
+                }
+            }
+        }
+    }
+
+    const float radius = object.GetBoundingSphere()[3];
+
+    printf("%u poses: sampled within %.2g, palettes within %.2g, dual quaternions within %.2g, "
+           "positions within %.2g of the radius, normals within %.2g\n",
+           samples * 2 + 1, pose_error, palette_error, dual_quaternion_error, position_error / radius, normal_error);
+
+    const bool skinned = report("Skinning against double",
+                                (pose_error > 1.0e-5) + (palette_error > 1.0e-5) + (dual_quaternion_error > 1.0e-5) +
+                                (position_error > 1.0e-5 * radius) + (normal_error > 1.0e-5));
+
+    // Characters spread through the clip, as 05-skinning has them
+    for (i = 0; i < characters; i++)
+    {
+        states[i].clip = 0;
+        states[i].time = vmath::random_uniform(0x5EED5EEDu, i) * 10.0f;
+    }
+
+    animator.Initialize(&skeleton, &mesh, characters, false);
+
+    for (m = 0; m < 4; m++)
+    {
+        const SkinningMethod method = (m & 1) ? SKINNING_DUAL_QUATERNION : SKINNING_LINEAR;
+        const bool cpu = m >= 2;
+        const int repeats = cpu ? 2 : 10;
+
+        bench_clock::time_point start = bench_clock::now();
+
+        for (k = 0; k < repeats; k++)
+            animator.Update(jobs, &states[0], characters, method, cpu);
+
+        const double ms = seconds_since(start) * 1.0e3 / repeats;
+
+        printf("%u characters of %u joints, %-27s %s: %8.3f ms, %8.1f characters/ms\n",
+               characters, joint_count, method == SKINNING_LINEAR ? "linear blend skinning" : "dual quaternion skinning",
+               cpu ? "evaluated and skinned" : "evaluated            ", ms, characters / ms);
+
+        for (i = 0; i < characters; i += 97)
+        {
+            skeleton.Sample(states[i].clip, states[i].time, &local[0]);
+            skeleton.ComputeSkinningMatrices(&local[0], &palette[0]);
+            Skeleton::ToDualQuaternions(&palette[0], &dual_quaternions[0], joint_count);
+
+            crowd_failures += memcmp(&palette[0], animator.GetMatrixPalettes() + i * joint_count, joint_count * sizeof(vmath::mat4)) != 0;
+            if (method == SKINNING_DUAL_QUATERNION)
+                crowd_failures += memcmp(&dual_quaternions[0], animator.GetDualQuaternionPalettes() + i * joint_count, joint_count * sizeof(DualQuaternion)) != 0;
+
+            if (cpu)
+            {
+                if (method == SKINNING_DUAL_QUATERNION)
+                    SkinDualQuaternion(mesh, &dual_quaternions[0], &linear[0]);
+                else
+                    SkinLinear(mesh, &palette[0], &linear[0]);
+
+                for (j = 0; j < mesh.vertex_count * 2; j++)
+                    crowd_failures += memcmp(&linear[j], animator.GetSkinnedVertices() + i * mesh.vertex_count * 2 + j, sizeof(vmath::vec4)) != 0;
+            }
+        }
+    }
+
+    animator.Free();
+
+    return report("Crowd animation", crowd_failures) && loaded && skinned;
+}
+
+//----------------------------------------------------------------------------
+//
+// Vertex packing (06-cubemap)
+//
+
+// Packs the torus' normals and texture coordinates as the loader does and
+// reports how far they move; then checks that the bulk conversions give
+// the same bits as the single-value ones and that every half survives the
+// trip to float and back.
+// The bulk unpacks against the scalar ones, bit for bit, on 'count'
+// packed words
+static unsigned int unpack_mismatches(const unsigned int * packed, unsigned int count)
+{
+    std::vector<vmath::vec4> unpacked4(count);
+    std::vector<vmath::vec3> unpacked(count);
+    unsigned int mismatches = 0;
+    unsigned int i;
+
+    vmath::unpack_snorm_2_10_10_10(&unpacked4[0], packed, count);
+    vmath::unpack_octahedral(&unpacked[0], packed, count);
+    for (i = 0; i < count; i++)
+    {
+        const vmath::vec4 v4 = vmath::unpack_snorm_2_10_10_10(packed[i]);
+        const vmath::vec3 v = vmath::unpack_octahedral(packed[i]);
+
+        mismatches += memcmp(&unpacked4[i], &v4, sizeof(v4)) != 0;
+        mismatches += memcmp(&unpacked[i], &v, sizeof(v)) != 0;
+    }
+
+    return mismatches;
+}
+
+// The torus's normals and texture coordinates through the bulk packers,
+// which must agree with the scalar ones and stay within 0.2 degrees for
+// 10:10:10:2 and 0.01 degrees for 16-bit octahedral; the bulk unpacks on
+// those and on random words; and every half through the float round trip
+static bool validate_packing(void)
+{
+    const double max_degrees_10 = 0.2;
+    const double max_degrees_octahedral = 0.01;
+    const unsigned int random_count = 65536 + 3;
+    VBObject mesh;
+    vmath::QuantizeError error;
+    unsigned int mismatches = 0;
+    unsigned int i;
+
+    if (mesh.LoadFromVBM("media/torus.vbm", 0, 1, 2, VBM_LOAD_CPU_ONLY))
+    {
+        const unsigned int count = mesh.GetAttributeVertexCount();
+        const int normal = mesh.FindAttribute("normal");
+        int texcoord = mesh.FindAttribute("texcoord");
+
+        // The media files name their texture coordinates after the exporter's
+        // first map channel
+        if (texcoord < 0)
+            texcoord = mesh.FindAttribute("map1");
+
+        if (normal >= 0 && mesh.GetAttributeComponents(normal) == 3)
+        {
+            const vmath::vec3 * normals = (const vmath::vec3 *)mesh.GetAttributeData(normal);
+            std::vector<unsigned int> packed(count);
+
+            vmath::pack_snorm_2_10_10_10(&packed[0], normals, count, &error);
+            for (i = 0; i < count; i++)
+                mismatches += packed[i] != vmath::pack_snorm_2_10_10_10(vmath::vec4(normals[i], 0.0f));
+            mismatches += vmath::degrees(error.max_error) >= max_degrees_10;
+            mismatches += unpack_mismatches(&packed[0], count);
+            printf("Normals, 10:10:10:2: max error %.3f degrees (limit %.1f), rms %.3f degrees, %u clamped\n",
+                   vmath::degrees(error.max_error), max_degrees_10, vmath::degrees(error.rms_error), (unsigned int)error.clamped);
+
+            vmath::pack_octahedral(&packed[0], normals, count, &error);
+            for (i = 0; i < count; i++)
+                mismatches += packed[i] != vmath::pack_octahedral(normals[i]);
+            mismatches += vmath::degrees(error.max_error) >= max_degrees_octahedral;
+            mismatches += unpack_mismatches(&packed[0], count);
+            printf("Normals, octahedral: max error %.4f degrees (limit %.2f), rms %.4f degrees\n",
+                   vmath::degrees(error.max_error), max_degrees_octahedral, vmath::degrees(error.rms_error));
+        }
+
+        if (texcoord >= 0)
+        {
+            const unsigned int values = count * mesh.GetAttributeComponents(texcoord);
+            const float * texcoords = mesh.GetAttributeData(texcoord);
+            std::vector<unsigned short> halves(values);
+            float max_error = 0.0f;
+
+            vmath::float_to_half(&halves[0], texcoords, values);
+            for (i = 0; i < values; i++)
+            {
+                mismatches += halves[i] != vmath::float_to_half(texcoords[i]);
+                max_error = vmath::max(max_error, fabsf(vmath::half_to_float(halves[i]) - texcoords[i]));
+            }
+            printf("Texture coordinates, half: max error %g\n", max_error);
+        }
+    }
+    else
+    {
+        printf("Can't load media/torus.vbm\n");
+        mismatches++;
+    }
+
+    // Every bit pattern unpacks, including the ones the packers never make,
+    // and the count leaves some over from the SIMD width
+    std::vector<unsigned int> words(random_count);
+
+    vmath::random_fill_bits(&words[0], random_count, 0x0649u, 0);
+    mismatches += unpack_mismatches(&words[0], random_count);
+
+    // Every half that isn't a NaN comes back as itself
+    std::vector<unsigned short> halves(65536);
+    std::vector<unsigned short> round_trip(65536);
+    std::vector<float> floats(65536);
+
+    for (i = 0; i < 65536; i++)
+        halves[i] = (unsigned short)i;
+    vmath::half_to_float(&floats[0], &halves[0], 65536);
+    vmath::float_to_half(&round_trip[0], &floats[0], 65536);
+    for (i = 0; i < 65536; i++)
+    {
+        if ((i & 0x7C00) == 0x7C00 && (i & 0x3FF) != 0)
+            mismatches += round_trip[i] != (i | 0x200);
+        else
+            mismatches += round_trip[i] != i;
+    }
+
+    return report("Packing", mismatches);
+}
+
+template <typename F>
+static double elements_per_ns(unsigned int count, F convert)
+{
+    const int repeats = 20;
+    int i;
+
+    convert();
+
+    bench_clock::time_point start = bench_clock::now();
+
+    for (i = 0; i < repeats; i++)
+        convert();
+
+    return double(count) * double(repeats) / (seconds_since(start) * 1.0e9);
+}
+
+static bool bench_packing(JobSystem&)
+{
+    const unsigned int count = 1 << 20;
+    std::vector<vmath::vec3> normals(count);
+    std::vector<vmath::vec3> unpacked(count);
+    std::vector<vmath::vec4> unpacked4(count);
+    std::vector<float> floats(count);
+    std::vector<unsigned short> halves(count);
+    std::vector<short> shorts(count);
+    std::vector<unsigned int> packed(count);
+
+    vmath::random_fill_on_sphere(&normals[0], count, 0x0606, 0);
+    vmath::random_fill_uniform(&floats[0], count, 0x0606, 0, -1.0f, 1.0f);
+
+    printf("float to half            %6.2f elements/ns\n", elements_per_ns(count, [&]() { vmath::float_to_half(&halves[0], &floats[0], count); }));
+    printf("half to float            %6.2f elements/ns\n", elements_per_ns(count, [&]() { vmath::half_to_float(&floats[0], &halves[0], count); }));
+    printf("SNORM16                  %6.2f elements/ns\n", elements_per_ns(count, [&]() { vmath::quantize_snorm16(&shorts[0], &floats[0], count); }));
+    printf("pack 10:10:10:2          %6.2f elements/ns\n", elements_per_ns(count, [&]() { vmath::pack_snorm_2_10_10_10(&packed[0], &normals[0], count); }));
+    printf("unpack 10:10:10:2        %6.2f elements/ns\n", elements_per_ns(count, [&]() { vmath::unpack_snorm_2_10_10_10(&unpacked4[0], &packed[0], count); }));
+    printf("pack octahedral          %6.2f elements/ns\n", elements_per_ns(count, [&]() { vmath::pack_octahedral(&packed[0], &normals[0], count); }));
+    printf("unpack octahedral        %6.2f elements/ns\n", elements_per_ns(count, [&]() { vmath::unpack_octahedral(&unpacked[0], &packed[0], count); }));
+
+    return validate_packing();
+}
+
+//----------------------------------------------------------------------------
+//
+// Levels of detail (obj2vbm -lod)
+//
+
+// Distance from p to the triangle abc in double: to the plane if p projects
+// inside, otherwise to the nearest edge
+static double point_triangle_distance(const vmath::dvec3& p, const vmath::dvec3& a, const vmath::dvec3& b, const vmath::dvec3& c)
+{
+    const vmath::dvec3 corners[3] = { a, b, c };
+    const vmath::dvec3 normal = vmath::normalize(vmath::cross(b - a, c - a));
+    double distance = DBL_MAX;
+    bool inside = true;
+    int i;
+
+    for (i = 0; i < 3; i++)
+    {
+        const vmath::dvec3& e0 = corners[i];
+        const vmath::dvec3& e1 = corners[(i + 1) % 3];
+        const vmath::dvec3 edge = e1 - e0;
+        const double t = std::min(std::max(vmath::dot(p - e0, edge) / vmath::dot(edge, edge), 0.0), 1.0);
+
+        inside = inside && vmath::dot(vmath::cross(edge, p - e0), normal) >= 0.0;
+        distance = std::min(distance, vmath::length(p - (e0 + edge * t)));
+    }
+
+    return inside ? fabs(vmath::dot(p - a, normal)) : distance;
+}
+
+// Builds obj2vbm's default chain, 50%, 25%, 12.5% and 6.25% of the
+// triangles, on a unit sphere, which is closed and has no seams, so every
+// target should be met to within a collapse. Each level must only use
+// vertices of the one before, its error must be no less, and every vertex
+// of the sphere must lie within it of the level's surface. The chain is
+// then written as obj2vbm writes it and loaded, and SelectLOD must pick
+// the coarsest level whose error fits in the allowed pixels at each size.
+static bool bench_lod(JobSystem&)
+{
+    static const float ratios[] = { 50.0f, 25.0f, 12.5f, 6.25f };
+    static const float pixel_errors[] = { 0.5f, 1.0f, 4.0f };
+    static const char filename[] = "vbench_lod.vbm";
+    const unsigned int level_count = sizeof(ratios) / sizeof(ratios[0]) + 1;
+    const int stacks = 48, slices = 96;
+    std::vector<float> positions;
+    std::vector<unsigned int> indices;
+    std::vector<unsigned int> chain;
+    std::vector<VBM_FRAME_HEADER> frames(level_count);
+    std::vector<VBM_LOD_HEADER> lods(level_count);
+    unsigned int chain_failures = 0;
+    unsigned int select_failures = 0;
+    unsigned int i, j, l;
+    int x, y;
+
+    // Rings of vertices between single vertices at the poles
+    positions.push_back(0.0f); positions.push_back(1.0f); positions.push_back(0.0f);
+    for (y = 1; y < stacks; y++)
+    {
+        const float phi = 3.14159265f * float(y) / float(stacks);
+
+        for (x = 0; x < slices; x++)
+        {
+            const float theta = 6.28318531f * float(x) / float(slices);
+
+            positions.push_back(sinf(phi) * cosf(theta));
+            positions.push_back(cosf(phi));
+            positions.push_back(sinf(phi) * sinf(theta));
+        }
+    }
+    positions.push_back(0.0f); positions.push_back(-1.0f); positions.push_back(0.0f);
+
+    const unsigned int vertex_count = (unsigned int)positions.size() / 3;
+    const unsigned int south = vertex_count - 1;
+
+    for (x = 0; x < slices; x++)
+    {
+        const unsigned int x1 = (x + 1) % slices;
+
+        indices.push_back(0); indices.push_back(1 + x1); indices.push_back(1 + x);
+        for (y = 0; y < stacks - 2; y++)
+        {
+            const unsigned int a = 1 + y * slices + x, b = 1 + y * slices + x1;
+
+            indices.push_back(a); indices.push_back(b); indices.push_back(a + slices);
+            indices.push_back(b); indices.push_back(b + slices); indices.push_back(a + slices);
+        }
+        indices.push_back(south); indices.push_back(south - slices + x); indices.push_back(south - slices + x1);
+    }
+
+    const unsigned int full_triangles = (unsigned int)indices.size() / 3;
+    MeshSimplifier simplifier(&positions[0], NULL, vertex_count, 3, &indices[0], (unsigned int)indices.size());
+    std::vector<unsigned int> level;
+    std::vector<bool> used(vertex_count, true);
+
+    frames[0].first = 0;
+    frames[0].count = (unsigned int)indices.size();
+    frames[0].flags = 0;
+    lods[0].frame = 0;
+    lods[0].error = 0.0f;
+    chain = indices;
+
+    for (l = 1; l < level_count; l++)
+    {
+        const unsigned int target = (unsigned int)(full_triangles * ratios[l - 1] / 100.0f);
+        bench_clock::time_point start = bench_clock::now();
+        const float error = simplifier.Simplify(target);
+        const double ms = seconds_since(start) * 1.0e3;
+        std::vector<bool> in_level(vertex_count, false);
+        double distance = 0.0;
+
+        simplifier.GetIndices(level);
+
+        // Within a collapse (two triangles) of the target
+        const unsigned int triangles = (unsigned int)level.size() / 3;
+        chain_failures += triangles != simplifier.GetTriangleCount() || triangles > target || triangles + 2 <= target;
+        chain_failures += !(error > lods[l - 1].error);
+
+        for (i = 0; i < level.size(); i++)
+        {
+            chain_failures += level[i] >= vertex_count || !used[level[i]];
+            in_level[level[i] < vertex_count ? level[i] : 0] = true;
+        }
+        for (i = 0; i < level.size(); i += 3)
+            chain_failures += level[i] == level[i + 1] || level[i + 1] == level[i + 2] || level[i] == level[i + 2];
+        used = in_level;
+
+        // Every vertex of the sphere, merged or not, within the error
+        for (i = 0; i < vertex_count; i++)
+        {
+            const vmath::dvec3 p(positions[i * 3], positions[i * 3 + 1], positions[i * 3 + 2]);
+            double nearest = DBL_MAX;
+
+            for (j = 0; j < level.size() && nearest > 0.0; j += 3)
+            {
+                const float * a = &positions[level[j] * 3];
+                const float * b = &positions[level[j + 1] * 3];
+                const float * c = &positions[level[j + 2] * 3];
+
+                nearest = std::min(nearest, point_triangle_distance(p, vmath::dvec3(a[0], a[1], a[2]),
+                                                                       vmath::dvec3(b[0], b[1], b[2]),
+                                                                       vmath::dvec3(c[0], c[1], c[2])));
+            }
+            distance = std::max(distance, nearest);
+        }
+        chain_failures += distance > error + 1.0e-5;
+
+        printf("LOD %u: %5u triangles (target %5u) in %6.2f ms, error %.5f, farthest vertex %.5f\n",
+               l, triangles, target, ms, error, distance);
+
+        frames[l].first = (unsigned int)chain.size();
+        frames[l].count = (unsigned int)level.size();
+        frames[l].flags = 0;
+        lods[l].frame = l;
+        lods[l].error = error;          // The radius is one
+        chain.insert(chain.end(), level.begin(), level.end());
+    }
+
+    const bool chain_passed = report("Simplification chain", chain_failures);
+
+    // As obj2vbm writes it, bounds and all. The sphere's bounds do for every
+    // level, since they only lose vertices.
+    VBM_HEADER header;
+    VBM_ATTRIB_HEADER attrib;
+    FILE * f = fopen(filename, "wb");
+
+    if (f == NULL)
+    {
+        printf("Can't write %s\n", filename);
+        return false;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = VBM_MAGIC_CURRENT;
+    header.size = sizeof(header);
+    strcpy(header.name, "sphere");
+    header.num_attribs = 1;
+    header.num_frames = level_count;
+    header.num_vertices = vertex_count;
+    header.num_indices = (unsigned int)chain.size();
+    header.index_type = GL_UNSIGNED_INT;
+    header.flags = VBM_FLAG_HAS_LODS | VBM_FLAG_HAS_BOUNDS;
+    header.num_lods = level_count;
+    header.bounds.min.x = header.bounds.min.y = header.bounds.min.z = -1.0f;
+    header.bounds.max.x = header.bounds.max.y = header.bounds.max.z = 1.0f;
+    header.bounds.radius = 1.0f;
+
+    memset(&attrib, 0, sizeof(attrib));
+    strcpy(attrib.name, "position");
+    attrib.type = GL_FLOAT;
+    attrib.components = 3;
+
+    fwrite(&header, sizeof(header), 1, f);
+    fwrite(&attrib, sizeof(attrib), 1, f);
+    fwrite(&frames[0], sizeof(VBM_FRAME_HEADER), level_count, f);
+    fwrite(&lods[0], sizeof(VBM_LOD_HEADER), level_count, f);
+    for (l = 0; l < level_count; l++)
+        fwrite(&header.bounds, sizeof(header.bounds), 1, f);
+    fwrite(&positions[0], sizeof(float), positions.size(), f);
+    fwrite(&chain[0], sizeof(unsigned int), chain.size(), f);
+    fclose(f);
+
+    VBObject object;
+    const bool loaded = object.LoadFromVBM(filename, 0, 1, 2, VBM_LOAD_CPU_ONLY);
+
+    remove(filename);
+
+    if (!loaded || object.GetLODCount() != level_count || object.GetFrameCount() != level_count ||
+        object.GetIndexData() == NULL ||
+        memcmp(object.GetIndexData(), &chain[0], chain.size() * sizeof(unsigned int)) != 0)
+    {
+        return report("Level selection", 1);
+    }
+
+    for (l = 0; l < level_count; l++)
+        select_failures += object.GetFirstVertex(l) != frames[l].first || object.GetVertexCount(l) != frames[l].count;
+
+    // Everything fits at no size at all
+    select_failures += object.SelectLOD(0.0f) != level_count - 1;
+
+    for (i = 0; i < sizeof(pixel_errors) / sizeof(pixel_errors[0]); i++)
+    {
+        unsigned int previous = level_count - 1;
+        float size;
+
+        for (size = 1.0f; size < 100000.0f; size *= 1.1f)
+        {
+            const unsigned int selected = object.SelectLOD(size, pixel_errors[i]);
+
+            // Finer with size, and the coarsest that fits. The full mesh is
+            // all there is once nothing else does.
+            select_failures += selected >= level_count || selected > previous;
+            if (selected < level_count)
+            {
+                select_failures += selected != 0 && lods[selected].error * size * 0.5f > pixel_errors[i];
+                select_failures += selected + 1 < level_count && lods[selected + 1].error * size * 0.5f <= pixel_errors[i];
+                previous = selected;
+            }
+        }
+
+        printf("%.1f pixel%s allowed: full detail from %.0f pixels across\n",
+               pixel_errors[i], pixel_errors[i] == 1.0f ? "" : "s", 2.0f * pixel_errors[i] / lods[1].error);
+    }
+
+    return report("Level selection", select_failures) && chain_passed;
+}
+
+//----------------------------------------------------------------------------
+//
+// VBM stream codec (obj2vbm -compress)
+//
+
+// Encodes every attribute of a few meshes, then decodes them again: the
+// bits must come back, and a stream one byte short must be refused. The
+// meshes together must decode at 'target' GB/s or better on one thread
+// with SIMD, timing each stream by its fastest decode.
+static bool bench_codec(JobSystem&)
+{
+    static const char * const files[] = { "media/torus.vbm", "media/ninja.vbm", "media/armadillo_low.vbm" };
+    const int repeats = 20;
+    const double target = 2.0;
+    std::vector<unsigned char> encoded;
+    std::vector<unsigned int> decoded;
+    unsigned int failures = 0;
+    double total_bytes = 0.0;
+    double total_seconds = 0.0;
+    std::vector<unsigned int> walk(3 * 20000);
+    unsigned int f, a, i;
+    int k;
+
+    for (f = 0; f < sizeof(files) / sizeof(files[0]); f++)
+    {
+        VBObject mesh;
+
+        if (!mesh.LoadFromVBM(files[f], 0, 1, 2, VBM_LOAD_CPU_ONLY))
+        {
+            printf("Can't load %s\n", files[f]);
+            failures++;
+            continue;
+        }
+
+        const unsigned int count = mesh.GetAttributeVertexCount();
+
+        for (a = 0; a <= mesh.GetAttributeCount(); a++)
+        {
+            // The indices come last
+            const bool indices = a == mesh.GetAttributeCount();
+            const unsigned int components = indices ? 1 : mesh.GetAttributeComponents(a);
+            const unsigned int values = indices ? mesh.GetVertexCount() : count;
+            const void * data = indices ? (const void *)mesh.GetIndexData() : (const void *)mesh.GetAttributeData(a);
+            const size_t size = size_t(values) * components * sizeof(unsigned int);
+            bool ok = true;
+
+            if (indices && !mesh.IsIndexed())
+                break;
+
+            encoded.clear();
+            if (indices)
+                vbm_encode_indices(encoded, (const unsigned int *)data, values);
+            else
+                vbm_encode_vertices(encoded, data, components, values);
+            decoded.assign(size_t(values) * components + 1, 0);
+
+            double seconds = 0.0;
+
+            for (k = 0; k < repeats; k++)
+            {
+                bench_clock::time_point start = bench_clock::now();
+
+                ok = ok && (indices ? vbm_decode_indices(&decoded[0], values, &encoded[0], encoded.size()) :
+                                      vbm_decode_vertices(&decoded[0], components, values, &encoded[0], encoded.size()));
+
+                const double once = seconds_since(start);
+
+                if (k == 0 || once < seconds)
+                    seconds = once;
+            }
+
+            total_bytes += double(size);
+            total_seconds += seconds;
+
+            failures += !ok || memcmp(&decoded[0], data, size) != 0 || decoded[size / sizeof(unsigned int)] != 0;
+            if (encoded.size() > 1)
+            {
+                failures += indices ? vbm_decode_indices(&decoded[0], values, &encoded[0], encoded.size() - 1) :
+                                      vbm_decode_vertices(&decoded[0], components, values, &encoded[0], encoded.size() - 1);
+            }
+
+            printf("%-26s %-10s %9u -> %9u bytes (%5.1f%%), decoded at %5.2f GB/s\n",
+                   files[f], indices ? "indices" : mesh.GetAttributeName(a),
+                   (unsigned int)size, (unsigned int)encoded.size(), 100.0 * double(encoded.size()) / double(size),
+                   double(size) / (seconds * 1.0e9));
+        }
+    }
+
+    // None of the meshes has a plane that rANS pays for, so a walk with
+    // steps spread evenly over 32 sizes makes one. It isn't timed.
+    for (i = 0; i < walk.size(); i++)
+        walk[i] = (i >= 3 ? walk[i - 3] : 0) + (vmath::random_bits(0x51u, i) & 31) - 16;
+
+    encoded.clear();
+    vbm_encode_vertices(encoded, &walk[0], 3, (unsigned int)walk.size() / 3);
+    decoded.assign(walk.size() + 1, 0);
+
+    failures += !vbm_decode_vertices(&decoded[0], 3, (unsigned int)walk.size() / 3, &encoded[0], encoded.size()) ||
+                memcmp(&decoded[0], &walk[0], walk.size() * sizeof(unsigned int)) != 0 || decoded[walk.size()] != 0;
+    failures += vbm_decode_vertices(&decoded[0], 3, (unsigned int)walk.size() / 3, &encoded[0], encoded.size() - 1);
+
+    printf("%-37s %9u -> %9u bytes (%5.1f%%)\n", "A random walk",
+           (unsigned int)(walk.size() * sizeof(unsigned int)), (unsigned int)encoded.size(),
+           100.0 * double(encoded.size()) / double(walk.size() * sizeof(unsigned int)));
+
+    const double rate = total_seconds > 0.0 ? total_bytes / (total_seconds * 1.0e9) : 0.0;
+
+    // The target is for the SIMD decoders, and is a floor rather than a
+    // goal. None of these streams has a plane that rANS pays for, and the
+    // packed ones decode by shuffles, so a 2 GHz core decodes them at 5 to
+    // 6.5 GB/s and without SIMD at about 0.8. 2 GB/s leaves room for a
+    // busy machine.
+#if defined(VMATH_SSE2)
+    printf("All streams decoded at %5.2f GB/s (target %.2f)\n", rate, target);
+    failures += rate < target;
+#else
+    printf("All streams decoded at %5.2f GB/s (no SIMD, no target)\n", rate);
+#endif
+
+    return report("Codec round trip", failures);
+}
+
+//----------------------------------------------------------------------------
+//
+// Job system
+//
+
+// Runs ParallelFor over 'count' with 'grain' and checks that it covered
+// every index exactly once
+static unsigned int check_parallel_for(JobSystem& jobs, unsigned int count, unsigned int grain)
+{
+    std::vector<unsigned char> hits(count, 0);
+    unsigned int failures = 0;
+    unsigned int i;
+
+    jobs.ParallelFor(count, grain, [&](unsigned int begin, unsigned int end)
+    {
+        for (unsigned int k = begin; k < end; k++)
+            hits[k]++;
+    });
+
+    for (i = 0; i < count; i++)
+        failures += hits[i] != 1;
+
+    return failures;
+}
+
+// Large ranges with small grains, alone and nested, on one thread and on
+// several; a pool that runs out; a job with too many dependents; and what
+// a job costs. The system is reinitialized for each thread count and put
+// back as it was at the end.
+static bool bench_jobs(JobSystem& jobs)
+{
+    static const unsigned int ranges[][2] =
+    {
+        { 5000, 1 }, { 100000, 1 }, { 1000000, 16 }, { 16 * 1000 * 1000, 1 }
+    };
+    static const int thread_counts[] = { 1, 4 };
+    const unsigned int outer = 64;
+    const unsigned int inner = 100000;
+    unsigned int failures = 0;
+    unsigned int t, r, i;
+
+    for (t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); t++)
+    {
+        jobs.Initialize(thread_counts[t]);
+        jobs.ResetStats();
+
+        for (r = 0; r < sizeof(ranges) / sizeof(ranges[0]); r++)
+        {
+            const unsigned int missed = check_parallel_for(jobs, ranges[r][0], ranges[r][1]);
+
+            printf("%u threads: ParallelFor(%u, %u): %u indices not covered once\n",
+                   thread_counts[t], ranges[r][0], ranges[r][1], missed);
+            failures += missed;
+        }
+
+        // Each outer piece splits its own range again, so the pool fills
+        // up with both levels at once
+        std::vector<unsigned char> hits(outer * inner, 0);
+        unsigned int missed = 0;
+
+        jobs.ParallelFor(outer, 1, [&](unsigned int begin, unsigned int end)
+        {
+            for (unsigned int o = begin; o < end; o++)
+            {
+                jobs.ParallelFor(inner, 1, [&](unsigned int b, unsigned int e)
+                {
+                    for (unsigned int k = b; k < e; k++)
+                        hits[o * inner + k]++;
+                });
+            }
+        });
+
+        for (i = 0; i < outer * inner; i++)
+            missed += hits[i] != 1;
+        failures += missed;
+
+        const JobStats stats = jobs.GetStats();
+
+        printf("%u threads: nested ParallelFor(%u, 1) in ParallelFor(%u, 1): %u indices not covered once\n",
+               thread_counts[t], inner, outer, missed);
+        printf("%u threads: %u jobs run, %u stolen, %u run inline, %u refused by a full pool\n",
+               thread_counts[t], stats.executed, stats.stolen, stats.inline_runs, stats.pool_full);
+    }
+
+    // With every job held back by a prerequisite that hasn't run, the pool
+    // fills up and Create says so
+    {
+        std::atomic<unsigned int> runs(0);
+        std::vector<JobSystem::Job *> created;
+        JobSystem::Job * gate = jobs.Create([]() {});
+        JobSystem::Job * job = NULL;
+        unsigned int added = 0;
+
+        while (created.size() < JOB_POOL_SIZE && (job = jobs.Create([&runs]() { runs++; })) != NULL)
+        {
+            if (jobs.AddDependency(job, gate))
+                added++;
+            created.push_back(job);
+        }
+
+        const bool refused = job == NULL && created.size() == JOB_POOL_SIZE - 1;
+
+        jobs.Run(gate);
+        for (i = 0; i < created.size(); i++)
+            jobs.Run(created[i]);
+        for (i = 0; i < created.size(); i++)
+            jobs.Wait(created[i]);
+
+        failures += !refused;
+        failures += added != JOB_MAX_DEPENDENTS;
+        failures += runs != created.size();
+
+        printf("Pool: %u jobs created before Create refused, %u of them held by one prerequisite (limit %u), %u run\n",
+               (unsigned int)created.size() + 1, added, JOB_MAX_DEPENDENTS, runs.load());
+    }
+
+    // Empty pieces, as many as ParallelFor makes, to show what each costs
+    {
+        const int repeats = 1000;
+        int k;
+
+        bench_clock::time_point start = bench_clock::now();
+
+        for (k = 0; k < repeats; k++)
+            jobs.ParallelFor(JOB_MAX_RANGE_PIECES, 1, [](unsigned int, unsigned int) {});
+
+        printf("%u threads: %.0f ns a piece\n", jobs.GetThreadCount(),
+               seconds_since(start) * 1.0e9 / (double(repeats) * JOB_MAX_RANGE_PIECES));
+    }
+
+    jobs.Initialize();
+
+    return report("Job system", failures);
+}
+
+//----------------------------------------------------------------------------
+//
+// Random numbers (vmath)
+//
+
+// Philox4x32-10 against the known answers published with Random123, then
+// random_fill_bits and random_fill_uniform, filled in pieces of odd sizes
+// by ParallelFor from a counter that isn't a multiple of four, against the
+// scalar functions, which must give the same bits
+static bool bench_random(JobSystem& jobs)
+{
+    static const unsigned int known_answers[][10] =
+    {
+        // Counter, key, result
+        { 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 0x00000000,
+          0x6627E8D5, 0xE169C58D, 0xBC57AC4C, 0x9B00DBD8 },
+        { 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF, 0xFFFFFFFF,
+          0x408F276D, 0x41C83B0E, 0xA20BC7C6, 0x6D5451FD },
+        { 0x243F6A88, 0x85A308D3, 0x13198A2E, 0x03707344, 0xA4093822, 0x299F31D0,
+          0xD16CFE09, 0x94FDCCEB, 0x5001E420, 0x24126EA1 },
+    };
+    const unsigned int count = 1000003;
+    const unsigned int first = 4099;
+    const unsigned int key = 0x38u;
+    const int repeats = 10;
+    std::vector<unsigned int> bits(count);
+    std::vector<float> uniform(count);
+    unsigned int answer_failures = 0;
+    unsigned int bits_failures = 0;
+    unsigned int uniform_failures = 0;
+    unsigned int i, j;
+    int k;
+
+    for (i = 0; i < sizeof(known_answers) / sizeof(known_answers[0]); i++)
+    {
+        unsigned int result[4];
+
+        vmath::philox4x32(known_answers[i], known_answers[i][4], known_answers[i][5], result);
+        for (j = 0; j < 4; j++)
+            answer_failures += result[j] != known_answers[i][6 + j];
+    }
+
+    // The stream through random_bits is the first of these with the key in
+    // key0 and the counter in c0
+    for (j = 0; j < 4; j++)
+        answer_failures += vmath::random_bits(0, j) != known_answers[0][6 + j];
+
+    bench_clock::time_point start = bench_clock::now();
+
+    for (k = 0; k < repeats; k++)
+    {
+        jobs.ParallelFor(count, 999, [&](unsigned int begin, unsigned int end)
+        {
+            vmath::random_fill_bits(&bits[begin], end - begin, key, first + begin);
+        });
+    }
+
+    const double bits_ns = seconds_since(start) * 1.0e9 / (double(repeats) * count);
+
+    jobs.ParallelFor(count, 999, [&](unsigned int begin, unsigned int end)
+    {
+        vmath::random_fill_uniform(&uniform[begin], end - begin, key, first + begin, -2.0f, 3.0f);
+    });
+
+    for (i = 0; i < count; i++)
+    {
+        bits_failures += bits[i] != vmath::random_bits(key, first + i);
+        uniform_failures += uniform[i] != -2.0f + 5.0f * vmath::random_uniform(key, first + i);
+    }
+
+    printf("random_fill_bits: %.2f ns a value across %u threads\n", bits_ns, jobs.GetThreadCount());
+
+    const bool answers_passed = report("Philox4x32-10 known answers", answer_failures);
+    const bool bits_passed = report("Parallel bits against scalar", bits_failures);
+
+    return report("Parallel uniform against scalar", uniform_failures) && answers_passed && bits_passed;
+}
+
+//----------------------------------------------------------------------------
+//
+// main
+//
+
+struct Test
+{
+    const char *    name;
+    bool            (*run)(JobSystem& jobs);
+    const char *    description;
+};
+
+static const Test tests[] =
+{
+    { "jobs",           bench_jobs,         "job system under large ranges, nesting and a full pool" },
+    { "random",         bench_random,       "Philox4x32-10 known answers, and parallel fills against the scalar stream (vmath)" },
+    { "clusters",       bench_clusters,     "CPU light assignment, against a test of every light (08-lightmodels)" },
+    { "overdraw",       bench_overdraw,     "CPU overdraw reduction, against a plain loop (11-overdrawcount)" },
+    { "oit",            bench_oit,          "OIT resolve, against an exact sort of every fragment (11-oit)" },
+    { "cull",           bench_cull,         "SIMD frustum culling of instances, against a plane test in double (03-instancing2)" },
+    { "gpucull",        bench_gpucull,      "GPUInstanceCuller's CPU reference, and with a GPU the compute pass, against double (03-indirectculling)" },
+    { "hiz",            bench_hiz,          "Hi-Z build and box test against the pixels, GPU against CPU (03-indirectculling)" },
+    { "primitives",     bench_primitives,   "scan, compaction, segmented reduction and histogram references, GPU against CPU (12-raytracer)" },
+    { "shadow",         bench_shadow,       "cascade splits, slice corners and texel snapping of shadow cascades (04-shadowmap)" },
+    { "skinning",       bench_skinning,     "skeletal animation from a skinned VBM, both skinning methods against double, and a crowd (05-skinning)" },
+    { "occlusion",      bench_occlusion,    "masked occlusion culling, coarse occluders against whole ones (03-instancing3)" },
+    { "raster",         bench_raster,       "software rasterizer against a stored image" },
+    { "sort",           bench_sort,         "parallel radix sort, checked for order and stability (03-pointsprites)" },
+    { "filter",         bench_filter,       "Gaussian and summed-area filters, CPU against double and GPU against CPU (12-imageprocessing)" },
+    { "expressions",    bench_expressions,  "vmath::expr against vmath's operators (03-instancing3)" },
+    { "matrices",       bench_matrices,     "vmath inverse, affine inverse, normal matrix and TRS, and the Angel mat4, against double (08-lightmodels)" },
+    { "packing",        bench_packing,      "half, SNORM, 10:10:10:2 and octahedral packing (06-cubemap)" },
+    { "lod",            bench_lod,          "simplification chain on a sphere and level selection from the file (obj2vbm -lod)" },
+    { "codec",          bench_codec,        "VBM stream codec round trip (obj2vbm -compress)" },
+};
+
+int main(int argc, char ** argv)
+{
+    const unsigned int test_count = sizeof(tests) / sizeof(tests[0]);
+    JobSystem jobs;
+    unsigned int failed = 0;
+    unsigned int i;
+    int first = 1;
+    int a;
+
+    if (argc > 1 && !strcmp(argv[1], "-list"))
+    {
+        for (i = 0; i < test_count; i++)
+            printf("%-12s %s\n", tests[i].name, tests[i].description);
+        return 0;
+    }
+
+    if (argc > 1 && !strcmp(argv[1], "-write"))
+    {
+        write_references = true;
+        first = 2;
+    }
+
+    for (a = first; a < argc; a++)
+    {
+        for (i = 0; i < test_count && strcmp(argv[a], tests[i].name) != 0; i++)
+            ;
+        if (i == test_count)
+        {
+            printf("No test called '%s'; vbench -list shows them\n", argv[a]);
+            return 1;
+        }
+    }
+
+    jobs.Initialize();
+    printf("%u threads\n", jobs.GetThreadCount());
+
+    // Beyond SSE2, what the compiler was told to target (VERMILION_AVX2)
+    printf("SIMD paths built:%s%s%s%s%s\n",
+#if defined(VMATH_SSE2)
+           " SSE2",
+#else
+           " none",
+#endif
+#if defined(VMATH_SSE41)
+           " SSE4.1",
+#else
+           "",
+#endif
+#if defined(VMATH_AVX)
+           " AVX",
+#else
+           "",
+#endif
+#if defined(VMATH_AVX2)
+           " AVX2",
+#else
+           "",
+#endif
+#if defined(VMATH_F16C)
+           " F16C");
+#else
+           "");
+#endif
+
+    for (i = 0; i < test_count; i++)
+    {
+        bool selected = argc == first;
+
+        for (a = first; a < argc; a++)
+            selected = selected || !strcmp(argv[a], tests[i].name);
+        if (!selected)
+            continue;
+
+        printf("\n[%s]\n", tests[i].name);
+        if (!tests[i].run(jobs))
+            failed++;
+    }
+
+    jobs.Free();
+
+    if (gl_window != NULL)
+    {
+        glfwDestroyWindow(gl_window);
+        glfwTerminate();
+    }
+
+    if (failed != 0)
+        printf("\n%u of the tests FAILED\n", failed);
+
+    return failed != 0 ? 1 : 0;
+}
@@ -13,6 +13,8 @@
 #include <fstream>
 #include <iostream>
 #include <vector>
+#include <algorithm>
+#include <math.h>
 
 #define _BOOL
 #include <maya/MObject.h>
@@ -29,9 +31,21 @@
 #include <maya/MGlobal.h>
 #include <maya/MSelectionList.h>
 #include <maya/MItSelectionList.h>
+#include <maya/MFnSkinCluster.h>
+#include <maya/MFnSingleIndexedComponent.h>
+#include <maya/MFnMatrixData.h>
+#include <maya/MDagPathArray.h>
+#include <maya/MDoubleArray.h>
+#include <maya/MAnimControl.h>
+#include <maya/MTransformationMatrix.h>
+#include <maya/MQuaternion.h>
+#include <maya/MMatrix.h>
+#include <maya/MPlug.h>
+#include <maya/MTime.h>
 
 #define VBM_FILE_TYPES_ONLY
 #include "vbm.h"
+#include "vpack.h"
 
 #ifdef _DEBUG
 #define DEBUG_MSG(a) do { std::cout << a; } while (0)
@@ -130,39 +144,77 @@ inline VBM_VEC4F color_to_SBM(const MColor& c)
     return col;
 }
 
-inline unsigned short float_bits_to_half_bits(const float f)
+// Finds the skin cluster deforming the mesh at 'mesh_path', if any
+static bool FindSkinCluster(const MDagPath& mesh_path, MObject& skin_object)
 {
-    union
-    {
-        struct
-        {
-            unsigned short m : 10;
-            unsigned short e : 5;
-            unsigned short s : 1;
-        };
-        unsigned short all_bits;
-    } f16;
-
-    union
-    {
-        struct
-        {
-            unsigned int m : 23;
-            unsigned int e : 8;
-            unsigned int s : 1;
-        };
-        unsigned int all_bits;
-       float float_bits;
-    } f32;
-
-    f32.float_bits = f;
-
-    f16.all_bits = 0;
-    f16.s = f32.s;
-    f16.e = f32.e - 112;
-    f16.m = f32.m >> 13;
-
-    return f16.all_bits;
+    MItDependencyNodes it(MFn::kSkinClusterFilter);
+
+    for (; !it.isDone(); it.next()) {
+        MFnSkinCluster skin(it.item());
+        unsigned int i;
+
+        for (i = 0; i < skin.numOutputConnections(); i++) {
+            MDagPath path;
+
+            skin.getPathAtIndex(skin.indexForOutputConnection(i), path);
+            if (path == mesh_path) {
+                skin_object = it.item();
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+// Maya's matrices act on row vectors, so their rows are the columns of the
+// equivalent column-major matrix and can be copied straight across
+static void matrix_to_SBM(const MMatrix& m, float out[16])
+{
+    int i, j;
+
+    for (i = 0; i < 4; i++)
+        for (j = 0; j < 4; j++)
+            out[i * 4 + j] = (float)m(i, j);
+}
+
+static VBM_JOINT_POSE matrix_to_joint_pose(const MMatrix& m)
+{
+    MTransformationMatrix transform(m);
+    MQuaternion rotation = transform.rotation();
+    MVector translation = transform.getTranslation(MSpace::kTransform);
+    double scale[3];
+    VBM_JOINT_POSE pose;
+
+    transform.getScale(scale, MSpace::kTransform);
+
+    pose.rotation.x = (float)rotation.x;
+    pose.rotation.y = (float)rotation.y;
+    pose.rotation.z = (float)rotation.z;
+    pose.rotation.w = (float)rotation.w;
+    pose.translation.x = (float)translation.x;
+    pose.translation.y = (float)translation.y;
+    pose.translation.z = (float)translation.z;
+    pose.scale.x = (float)scale[0];
+    pose.scale.y = (float)scale[1];
+    pose.scale.z = (float)scale[2];
+
+    return pose;
+}
+
+// Pose of each joint relative to its parent joint at the current time.
+// Transforms in between that aren't joints are folded in.
+static void GetJointPoses(const MDagPathArray& joints, const std::vector<int>& parents, std::vector<VBM_JOINT_POSE>& poses)
+{
+    unsigned int i;
+
+    for (i = 0; i < joints.length(); i++) {
+        MMatrix local = joints[i].inclusiveMatrix();
+
+        if (parents[i] >= 0)
+            local = local * joints[parents[i]].inclusiveMatrixInverse();
+        poses.push_back(matrix_to_joint_pose(local));
+    }
 }
 
 MStatus MayaSBMExporter::writer(const MFileObject &file, const MString &optionsString, MPxFileTranslator::FileAccessMode mode)
@@ -186,6 +238,8 @@ MStatus MayaSBMExporter::writer(const MFileObject &file, const MString &optionsS
     std::vector<std::string> uv_names;          // Names of UVs
     std::vector<VBM_VEC2F> uv[16];              // Up to 16 UVs supported
     std::vector<VBM_VEC4F> colors;              // Vertex colors
+    std::vector<int> mesh_vertices;             // Mesh vertex each vertex came from, for skin weights
+    MDagPath mesh_path;
 
     VBM_HEADER header;
 
@@ -282,6 +336,7 @@ MStatus MayaSBMExporter::writer(const MFileObject &file, const MString &optionsS
 
                         elements.push_back(static_cast<unsigned int>(vertices.size()));
                         vertices.push_back(vec4);
+                        mesh_vertices.push_back(triangleVertices[i]);
                     }
 
                     if (normalList.length() != 0) {
@@ -322,11 +377,131 @@ MStatus MayaSBMExporter::writer(const MFileObject &file, const MString &optionsS
 
             }
 
+            mesh_path = dagPath;
             break;
         }
 
     }
 
+    // The skeleton, if the mesh is skinned. The joints are the skin
+    // cluster's influences, sorted so that parents come first; each
+    // vertex keeps its four largest weights.
+    MObject skin_object;
+    MDagPathArray joint_paths;
+    std::vector<VBM_JOINT> joints;
+    std::vector<VBM_VEC4F> joint_indices;
+    std::vector<VBM_VEC4F> joint_weights;
+    std::vector<VBM_JOINT_POSE> clip_keys;
+    VBM_SKELETON_HEADER skeleton_header;
+    VBM_CLIP_HEADER clip_header;
+
+    memset(&skeleton_header, 0, sizeof(skeleton_header));
+    memset(&clip_header, 0, sizeof(clip_header));
+
+    if (vertices.size() != 0 && FindSkinCluster(mesh_path, skin_object)) {
+        MFnSkinCluster skin(skin_object);
+        MDagPathArray influences;
+        unsigned int influence_count = skin.influenceObjects(influences);
+        std::vector<std::pair<unsigned int, unsigned int> > by_depth;
+        std::vector<int> joint_of_influence(influence_count);
+        std::vector<int> parents;
+
+        for (i = 0; i < influence_count; i++)
+            by_depth.push_back(std::make_pair(influences[i].length(), i));
+        std::sort(by_depth.begin(), by_depth.end());
+
+        for (i = 0; i < influence_count; i++) {
+            joint_paths.append(influences[by_depth[i].second]);
+            joint_of_influence[by_depth[i].second] = i;
+        }
+
+        // Each joint's parent is its nearest ancestor that's also a joint
+        for (i = 0; i < joint_paths.length(); i++) {
+            MDagPath ancestor = joint_paths[i];
+            int parent = -1;
+
+            while (parent < 0 && ancestor.length() > 1) {
+                ancestor.pop();
+                for (j = 0; j < i; j++) {
+                    if (joint_paths[j] == ancestor) {
+                        parent = j;
+                        break;
+                    }
+                }
+            }
+            parents.push_back(parent);
+        }
+
+        std::vector<VBM_JOINT_POSE> bind_poses;
+        GetJointPoses(joint_paths, parents, bind_poses);
+
+        for (i = 0; i < joint_paths.length(); i++) {
+            VBM_JOINT joint;
+            MObject data;
+            MPlug plug = skin.findPlug("bindPreMatrix").elementByLogicalIndex(skin.indexForInfluenceObject(joint_paths[i]));
+
+            memset(&joint, 0, sizeof(joint));
+            strncpy(joint.name, joint_paths[i].partialPathName().asChar(), sizeof(joint.name) - 1);
+            joint.parent = parents[i];
+            joint.bind_pose = bind_poses[i];
+            plug.getValue(data);
+            matrix_to_SBM(MFnMatrixData(data).matrix(), joint.inverse_bind);
+            joints.push_back(joint);
+        }
+
+        // Weights of every mesh vertex, influence by influence
+        MFnSingleIndexedComponent component;
+        MObject all_vertices = component.create(MFn::kMeshVertComponent);
+        MDoubleArray weights;
+        unsigned int weights_per_vertex = 0;
+
+        component.setCompleteData(MFnMesh(mesh_path).numVertices());
+        skin.getWeights(mesh_path, all_vertices, weights, weights_per_vertex);
+
+        for (i = 0; i < mesh_vertices.size(); i++) {
+            std::vector<std::pair<double, int> > influence_weights;
+            VBM_VEC4F indices = { 0.0f, 0.0f, 0.0f, 0.0f };
+            VBM_VEC4F top = { 0.0f, 0.0f, 0.0f, 0.0f };
+            float * index = &indices.x;
+            float * weight = &top.x;
+            float total = 0.0f;
+
+            for (j = 0; j < weights_per_vertex; j++)
+                influence_weights.push_back(std::make_pair(-weights[mesh_vertices[i] * weights_per_vertex + j], joint_of_influence[j]));
+            std::sort(influence_weights.begin(), influence_weights.end());
+
+            for (j = 0; j < 4 && j < influence_weights.size(); j++) {
+                index[j] = (float)influence_weights[j].second;
+                weight[j] = (float)-influence_weights[j].first;
+                total += weight[j];
+            }
+            for (j = 0; j < 4 && total > 0.0f; j++)
+                weight[j] /= total;
+
+            joint_indices.push_back(indices);
+            joint_weights.push_back(top);
+        }
+
+        // The playback range becomes a clip with a key every frame
+        MTime start = MAnimControl::minTime();
+        MTime end = MAnimControl::maxTime();
+        MTime current = MAnimControl::currentTime();
+        MTime time;
+
+        for (time = start; time <= end; time += MTime(1.0, MTime::uiUnit())) {
+            MAnimControl::setCurrentTime(time);
+            GetJointPoses(joint_paths, parents, clip_keys);
+            clip_header.num_keys++;
+        }
+        MAnimControl::setCurrentTime(current);
+
+        sprintf(clip_header.name, "take");
+        clip_header.duration = (float)(end - start).as(MTime::kSeconds);
+
+        skeleton_header.num_joints = static_cast<unsigned int>(joints.size());
+        skeleton_header.num_clips = clip_header.num_keys != 0 ? 1 : 0;
+    }
+
     header.num_vertices = static_cast<unsigned int>(vertices.size());
     header.num_indices = 0; // elements.size();
     header.index_type = 0; // GL_NONE
@@ -373,6 +548,63 @@ MStatus MayaSBMExporter::writer(const MFileObject &file, const MString &optionsS
         vertices[i].z -= center_z;
     }
 
+    // Move the skeleton with the mesh: its roots shift by the same amount,
+    // and binding adds it back before the inverse bind matrices apply
+    if (joints.size() != 0)
+    {
+        MTransformationMatrix shift;
+        shift.setTranslation(MVector(center_x, center_y, center_z), MSpace::kTransform);
+
+        for (i = 0; i < joints.size(); i++)
+        {
+            MMatrix inverse_bind;
+
+            for (j = 0; j < 16; j++)
+                inverse_bind(j / 4, j % 4) = joints[i].inverse_bind[j];
+            matrix_to_SBM(shift.asMatrix() * inverse_bind, joints[i].inverse_bind);
+
+            if (joints[i].parent < 0)
+            {
+                joints[i].bind_pose.translation.x -= center_x;
+                joints[i].bind_pose.translation.y -= center_y;
+                joints[i].bind_pose.translation.z -= center_z;
+            }
+        }
+
+        for (i = 0; i < clip_keys.size(); i++)
+        {
+            if (joints[i % joints.size()].parent < 0)
+            {
+                clip_keys[i].translation.x -= center_x;
+                clip_keys[i].translation.y -= center_y;
+                clip_keys[i].translation.z -= center_z;
+            }
+        }
+    }
+
+    // The model is now centered on the origin, which is also the center of
+    // its bounding sphere. There's only one frame, so it shares the bounds.
+    float radius_squared = 0.0f;
+
+    for (i = 0; i < header.num_vertices; i++)
+    {
+        radius_squared = std::max(radius_squared, vertices[i].x * vertices[i].x +
+                                                  vertices[i].y * vertices[i].y +
+                                                  vertices[i].z * vertices[i].z);
+    }
+
+    header.flags |= VBM_FLAG_HAS_BOUNDS;
+    header.bounds.min.x = min_x - center_x;
+    header.bounds.min.y = min_y - center_y;
+    header.bounds.min.z = min_z - center_z;
+    header.bounds.max.x = max_x - center_x;
+    header.bounds.max.y = max_y - center_y;
+    header.bounds.max.z = max_z - center_z;
+    header.bounds.center.x = 0.0f;
+    header.bounds.center.y = 0.0f;
+    header.bounds.center.z = 0.0f;
+    header.bounds.radius = sqrtf(radius_squared);
+
     if (normals.size() != 0)
         header.num_attribs++;
     if (tangents.size() != 0)
@@ -380,6 +612,12 @@ MStatus MayaSBMExporter::writer(const MFileObject &file, const MString &optionsS
 
     header.num_attribs +=  static_cast<unsigned int>(uv_names.size());
 
+    if (joints.size() != 0)
+    {
+        header.flags |= VBM_FLAG_HAS_SKELETON;
+        header.num_attribs += 2;
+    }
+
     header.size = sizeof(header);
     fwrite(&header, sizeof(header), 1, f);
     fwrite(&attrib_header, sizeof(attrib_header), 1, f);
@@ -408,9 +646,25 @@ MStatus MayaSBMExporter::writer(const MFileObject &file, const MString &optionsS
         attrib_header.components = 2;
         fwrite(&attrib_header, sizeof(attrib_header), 1, f);
     }
+    if (joints.size() != 0) {
+        sprintf(attrib_header.name, "joints");
+        attrib_header.components = 4;
+        fwrite(&attrib_header, sizeof(attrib_header), 1, f);
+        sprintf(attrib_header.name, "weights");
+        fwrite(&attrib_header, sizeof(attrib_header), 1, f);
+    }
     fwrite(&frame_header, sizeof(frame_header), 1, f);
+    fwrite(&header.bounds, sizeof(header.bounds), 1, f);
+    if (joints.size() != 0) {
+        fwrite(&skeleton_header, sizeof(skeleton_header), 1, f);
+        fwrite(&joints[0], sizeof(VBM_JOINT), joints.size(), f);
+        if (skeleton_header.num_clips != 0) {
+            fwrite(&clip_header, sizeof(clip_header), 1, f);
+            fwrite(&clip_keys[0], sizeof(VBM_JOINT_POSE), clip_keys.size(), f);
+        }
+    }
 
-    unsigned short s = float_bits_to_half_bits(vertices[0].x);
+    unsigned short s = vmath::float_to_half(vertices[0].x);
 
     if (header.num_vertices != 0)
     {
@@ -426,6 +680,10 @@ MStatus MayaSBMExporter::writer(const MFileObject &file, const MString &optionsS
         for (i = 0; i < uv_names.size(); i++) {
             fwrite((const float *)&uv[i][0], sizeof(VBM_VEC2F), header.num_vertices, f);
         }
+        if (joints.size() != 0) {
+            fwrite((const float *)&joint_indices[0], sizeof(VBM_VEC4F), header.num_vertices, f);
+            fwrite((const float *)&joint_weights[0], sizeof(VBM_VEC4F), header.num_vertices, f);
+        }
     }
     // fwrite((const unsigned int *)&elements[0], sizeof(unsigned int), elements.size(), f);
 